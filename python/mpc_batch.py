@@ -0,0 +1,122 @@
+"""Batch solves of the controller library from Python.
+
+Loads libmpc_capi, built with -DMPC_PYTHON=ON, see src/MpcCApi.h:
+
+    from mpc_batch import BatchSolver
+    solver = BatchSolver()
+    result = solver.solve_batch(states, coeffs)   # (n, 6) and (n, 4)
+    result.actuations                              # (n, 2): delta, a
+
+The arrays, or anything exposing float64 rows through the buffer
+protocol, are handed to the library where they are: nothing is copied
+unless their rows are not contiguous float64. The answers are written
+straight into the NumPy arrays returned. ctypes releases the GIL for the
+length of the call, during which the problems are solved on the threads
+of the library's TaskScheduler (MPC_TASK_THREADS), so other Python
+threads keep running.
+
+The solvers are set up from the environment like the server's, MPC_SOLVER,
+MPC_MODEL and the options, when the first BatchSolver is created.
+"""
+
+import collections
+import ctypes
+import os
+
+import numpy as np
+
+BATCH_RTI = 1
+BATCH_CHAIN = 2
+
+BatchResult = collections.namedtuple(
+    "BatchResult", ["actuations", "status", "iterations", "objective", "xs", "ys", "solved"])
+
+_double_p = ctypes.POINTER(ctypes.c_double)
+_int_p = ctypes.POINTER(ctypes.c_int)
+
+
+def _load(path):
+    if path is None:
+        path = os.environ.get("MPC_CAPI", os.path.join(os.path.dirname(__file__), "..", "build", "libmpc_capi.so"))
+    lib = ctypes.CDLL(path)
+    lib.mpc_batch_new.restype = ctypes.c_void_p
+    lib.mpc_batch_new.argtypes = []
+    lib.mpc_batch_free.restype = None
+    lib.mpc_batch_free.argtypes = [ctypes.c_void_p]
+    lib.mpc_batch_set_horizon.restype = ctypes.c_size_t
+    lib.mpc_batch_set_horizon.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.mpc_batch_horizon.restype = ctypes.c_size_t
+    lib.mpc_batch_horizon.argtypes = [ctypes.c_void_p]
+    lib.mpc_batch_solve.restype = ctypes.c_long
+    lib.mpc_batch_solve.argtypes = [
+        ctypes.c_void_p, ctypes.c_size_t, _double_p, ctypes.c_size_t, _double_p, ctypes.c_size_t,
+        ctypes.c_uint, ctypes.c_double, _double_p, _int_p, _int_p, _double_p, _double_p, _double_p]
+    return lib
+
+
+def _rows(values, width, name):
+    """`values` as (n, width) float64 rows and their stride in doubles,
+    viewed in place whenever its layout allows."""
+    array = np.asarray(values, dtype=np.float64)
+    if array.ndim != 2 or array.shape[1] != width:
+        raise ValueError("%s must be of shape (n, %d), not %s" % (name, width, array.shape))
+    if array.strides[1] != 8 or array.strides[0] % 8 != 0 or array.strides[0] < 0:
+        array = np.ascontiguousarray(array)
+    return array, array.strides[0] // 8
+
+
+def _pointer(array, kind):
+    return None if array is None else array.ctypes.data_as(kind)
+
+
+class BatchSolver(object):
+    def __init__(self, library=None, horizon=None):
+        self._lib = _load(library)
+        self._batch = self._lib.mpc_batch_new()
+        if horizon is not None:
+            self.horizon = horizon
+
+    def close(self):
+        if self._batch:
+            self._lib.mpc_batch_free(self._batch)
+            self._batch = None
+
+    def __del__(self):
+        self.close()
+
+    @property
+    def horizon(self):
+        return self._lib.mpc_batch_horizon(self._batch)
+
+    @horizon.setter
+    def horizon(self, N):
+        if self._lib.mpc_batch_set_horizon(self._batch, N) != N:
+            raise ValueError("horizon %d is not compiled in" % N)
+
+    def solve_batch(self, states, coeffs, rti=False, chain=False, deadline_ms=0.0, plans=False):
+        """Solve the problems of the rows of `states` (x, y, psi, v, cte,
+        epsi) against those of `coeffs` (the cubic c0..c3), in the vehicle
+        frame. rti=True solves them all at once by batched RTI, chain=True
+        warm starts each from the one before; otherwise they are solved
+        independently, side by side. plans=True also returns the planned
+        positions, (n, horizon) each, NaN past the stages of a plan."""
+        states, state_stride = _rows(states, 6, "states")
+        coeffs, coeff_stride = _rows(coeffs, 4, "coeffs")
+        n = states.shape[0]
+        if coeffs.shape[0] != n:
+            raise ValueError("%d states but %d coeffs" % (n, coeffs.shape[0]))
+        actuations = np.empty((n, 2))
+        status = np.empty(n, dtype=np.intc)
+        iterations = np.empty(n, dtype=np.intc)
+        objective = np.empty(n)
+        xs = ys = None
+        if plans:
+            xs = np.empty((n, self.horizon))
+            ys = np.empty((n, self.horizon))
+        flags = (BATCH_RTI if rti else 0) | (BATCH_CHAIN if chain else 0)
+        solved = self._lib.mpc_batch_solve(
+            self._batch, n, _pointer(states, _double_p), state_stride, _pointer(coeffs, _double_p), coeff_stride,
+            flags, deadline_ms, _pointer(actuations, _double_p), _pointer(status, _int_p),
+            _pointer(iterations, _int_p), _pointer(objective, _double_p), _pointer(xs, _double_p),
+            _pointer(ys, _double_p))
+        return BatchResult(actuations, status, iterations, objective, xs, ys, solved)
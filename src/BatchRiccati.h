@@ -0,0 +1,360 @@
+#ifndef BATCH_RICCATI_H
+#define BATCH_RICCATI_H
+
+#include <math.h>
+#include <limits>
+#include "Eigen-3.3/Eigen/Core"
+#include "Riccati.h"
+
+// Problems solved side by side by BatchBoxRiccati, one per SIMD lane.
+static const int batch_lanes = 4;
+
+// W independent BoxRiccati problems of the same dimensions, solved
+// together. The stage data are stored as structure of arrays, every scalar
+// of the problem being an array of W lanes, so each arithmetic operation
+// of the recursion is a packet operation of Eigen across the problems.
+//
+// The interior point iterations run in lockstep. A lane stops moving once
+// it has converged or failed, the others carry on.
+template <int nx, int nu, int K, int W = batch_lanes>
+class BatchBoxRiccati {
+public:
+    typedef Eigen::Array<double, W, 1> Lanes;
+    typedef Eigen::Array<bool, W, 1> Mask;
+    typedef BoxRiccati<nx, nu, K> Problem;
+    typedef typename Problem::State State;
+    typedef typename Problem::Input Input;
+
+    // Copy the stage data and bounds of `problem` into `lane`.
+    void load(int lane, const Problem &problem) {
+        for (int k = 0; k < K; k++) {
+            for (int i = 0; i < nx; i++) {
+                for (int j = 0; j < nx; j++) {
+                    A[k][i][j][lane] = problem.A[k](i, j);
+                }
+                for (int j = 0; j < nu; j++) {
+                    B[k][i][j][lane] = problem.B[k](i, j);
+                }
+                c[k][i][lane] = problem.c[k][i];
+            }
+            for (int i = 0; i < nu; i++) {
+                for (int j = 0; j < nx; j++) {
+                    S[k][i][j][lane] = problem.S[k](i, j);
+                }
+                for (int j = 0; j < nu; j++) {
+                    R[k][i][j][lane] = problem.R[k](i, j);
+                }
+                r[k][i][lane] = problem.r[k][i];
+                lb[k][i][lane] = problem.lb[k][i];
+                ub[k][i][lane] = problem.ub[k][i];
+            }
+        }
+        for (int k = 0; k <= K; k++) {
+            for (int i = 0; i < nx; i++) {
+                for (int j = 0; j < nx; j++) {
+                    Q[k][i][j][lane] = problem.Q[k](i, j);
+                }
+                q[k][i][lane] = problem.q[k][i];
+            }
+        }
+    }
+
+    // As BoxRiccati::solve for every lane from x[0] = x0, the result being
+    // read back with store. Returns the number of lanes that succeeded.
+    int solve(const State &x0, double tol = 1e-8, int max_iter = 50) {
+        Mask failed = Mask::Constant(false);
+        for (int k = 0; k < K; k++) {
+            for (int i = 0; i < nu; i++) {
+                failed = failed || lb[k][i] >= ub[k][i];
+                u[k][i] = boxStart(lb[k][i], ub[k][i]);
+                zl[k][i] = Lanes::Ones();
+                zu[k][i] = Lanes::Ones();
+            }
+        }
+        for (int i = 0; i < nx; i++) {
+            x[0][i] = Lanes::Constant(x0[i]);
+        }
+
+        Mask done = Mask::Constant(false);
+        for (int lane = 0; lane < W; lane++) {
+            iterations[lane] = -1;
+        }
+        for (int iter = 1; iter <= max_iter; iter++) {
+            Lanes gap = Lanes::Zero();
+            for (int k = 0; k < K; k++) {
+                for (int i = 0; i < nu; i++) {
+                    gap += zl[k][i] * (u[k][i] - lb[k][i]) + zu[k][i] * (ub[k][i] - u[k][i]);
+                }
+            }
+            gap /= 2 * nu * K;
+            Mask converged = !done && !failed && gap < tol;
+            for (int lane = 0; lane < W; lane++) {
+                if (converged[lane]) {
+                    iterations[lane] = iter - 1;
+                }
+            }
+            done = done || converged;
+            Mask active = !done && !failed;
+            if (!active.any()) {
+                break;
+            }
+
+            // Newton step towards the central path at a tenth of the gap,
+            // with the dual steps eliminated into the input Hessian.
+            Lanes tau = boxCentering(gap);
+            for (int k = 0; k < K; k++) {
+                for (int i = 0; i < nu; i++) {
+                    Lanes sl = u[k][i] - lb[k][i];
+                    Lanes su = ub[k][i] - u[k][i];
+                    boxBarrier(sl, su, zl[k][i], zu[k][i], u[k][i], tau, D[k][i], d[k][i]);
+                }
+            }
+            failed = failed || (active && !recursion());
+
+            // Largest steps that keep the slacks and the duals positive.
+            Lanes alpha_p = Lanes::Ones();
+            Lanes alpha_d = Lanes::Ones();
+            for (int k = 0; k < K; k++) {
+                for (int i = 0; i < nu; i++) {
+                    Lanes sl = u[k][i] - lb[k][i];
+                    Lanes su = ub[k][i] - u[k][i];
+                    Lanes du = u_new[k][i] - u[k][i];
+                    boxDualStep(sl, su, zl[k][i], zu[k][i], du, tau, dzl[k][i], dzu[k][i]);
+                    alpha_p = alpha_p.min(boxPrimalLimit(sl, su, du));
+                    alpha_d = alpha_d.min(boxDualLimit(zl[k][i], zu[k][i], dzl[k][i], dzu[k][i]));
+                }
+            }
+            // Lanes that stopped keep their point, whatever the recursion
+            // produced for them.
+            Mask moving = !done && !failed;
+            for (int k = 0; k < K; k++) {
+                for (int i = 0; i < nu; i++) {
+                    u[k][i] = moving.select(u[k][i] + alpha_p * (u_new[k][i] - u[k][i]), u[k][i]);
+                    zl[k][i] = moving.select(zl[k][i] + alpha_d * dzl[k][i], zl[k][i]);
+                    zu[k][i] = moving.select(zu[k][i] + alpha_d * dzu[k][i], zu[k][i]);
+                }
+            }
+        }
+        rollout(u, x);
+
+        int ok = 0;
+        for (int lane = 0; lane < W; lane++) {
+            ok += iterations[lane] >= 0;
+        }
+        return ok;
+    }
+
+    // Riccati recursions of `lane` in the last solve, -1 if it failed.
+    int laneIterations(int lane) const { return iterations[lane]; }
+
+    // Trajectory of `lane` in the last solve.
+    void store(int lane, State xs[K + 1], Input us[K]) const {
+        for (int k = 0; k <= K; k++) {
+            for (int i = 0; i < nx; i++) {
+                xs[k][i] = x[k][i][lane];
+            }
+        }
+        for (int k = 0; k < K; k++) {
+            for (int i = 0; i < nu; i++) {
+                us[k][i] = u[k][i][lane];
+            }
+        }
+    }
+
+private:
+    Lanes A[K][nx][nx];
+    Lanes B[K][nx][nu];
+    Lanes c[K][nx];
+    Lanes Q[K + 1][nx][nx];
+    Lanes S[K][nu][nx];
+    Lanes R[K][nu][nu];
+    Lanes q[K + 1][nx];
+    Lanes r[K][nu];
+    Lanes lb[K][nu];
+    Lanes ub[K][nu];
+
+    // Current iterate, the multipliers of the bounds and their steps.
+    Lanes x[K + 1][nx];
+    Lanes u[K][nu];
+    Lanes zl[K][nu];
+    Lanes zu[K][nu];
+    Lanes dzl[K][nu];
+    Lanes dzu[K][nu];
+
+    // Newton system terms, its solution and the feedback law.
+    Lanes D[K][nu];
+    Lanes d[K][nu];
+    Lanes x_new[K + 1][nx];
+    Lanes u_new[K][nu];
+    Lanes gain[K][nu][nx];
+    Lanes feedforward[K][nu];
+    int iterations[W];
+
+    // States from x[0] under the inputs `us`.
+    void rollout(const Lanes us[K][nu], Lanes xs[K + 1][nx]) {
+        for (int k = 0; k < K; k++) {
+            for (int i = 0; i < nx; i++) {
+                Lanes next = c[k][i];
+                for (int j = 0; j < nx; j++) {
+                    next += A[k][i][j] * xs[k][j];
+                }
+                for (int j = 0; j < nu; j++) {
+                    next += B[k][i][j] * us[k][j];
+                }
+                xs[k + 1][i] = next;
+            }
+        }
+    }
+
+    // RiccatiLQ::solve with D and d added to the input terms, into x_new
+    // and u_new. False for the lanes where a stage Hessian is not positive
+    // definite.
+    Mask recursion() {
+        Mask ok = Mask::Constant(true);
+        Lanes P[nx][nx], p[nx];
+        for (int i = 0; i < nx; i++) {
+            for (int j = 0; j < nx; j++) {
+                P[i][j] = Q[K][i][j];
+            }
+            p[i] = q[K][i];
+        }
+
+        Lanes Pc[nx], PA[nx][nx], PB[nx][nu];
+        Lanes H[nu][nu], G[nu][nx], g[nu], L[nu][nu];
+        for (int k = K - 1; k >= 0; k--) {
+            for (int i = 0; i < nx; i++) {
+                Pc[i] = p[i];
+                for (int j = 0; j < nx; j++) {
+                    Pc[i] += P[i][j] * c[k][j];
+                }
+                for (int j = 0; j < nx; j++) {
+                    PA[i][j] = Lanes::Zero();
+                    for (int l = 0; l < nx; l++) {
+                        PA[i][j] += P[i][l] * A[k][l][j];
+                    }
+                }
+                for (int j = 0; j < nu; j++) {
+                    PB[i][j] = Lanes::Zero();
+                    for (int l = 0; l < nx; l++) {
+                        PB[i][j] += P[i][l] * B[k][l][j];
+                    }
+                }
+            }
+            for (int i = 0; i < nu; i++) {
+                for (int j = 0; j < nu; j++) {
+                    H[i][j] = R[k][i][j];
+                    for (int l = 0; l < nx; l++) {
+                        H[i][j] += B[k][l][i] * PB[l][j];
+                    }
+                }
+                H[i][i] += D[k][i];
+                for (int j = 0; j < nx; j++) {
+                    G[i][j] = S[k][i][j];
+                    for (int l = 0; l < nx; l++) {
+                        G[i][j] += B[k][l][i] * PA[l][j];
+                    }
+                }
+                g[i] = r[k][i] + d[k][i];
+                for (int l = 0; l < nx; l++) {
+                    g[i] += B[k][l][i] * Pc[l];
+                }
+            }
+
+            // Cholesky factor of H, lane by lane in the same instructions.
+            for (int j = 0; j < nu; j++) {
+                Lanes diag = H[j][j];
+                for (int l = 0; l < j; l++) {
+                    diag -= L[j][l] * L[j][l];
+                }
+                ok = ok && diag > 0;
+                L[j][j] = diag.max(std::numeric_limits<double>::min()).sqrt();
+                for (int i = j + 1; i < nu; i++) {
+                    Lanes off = H[i][j];
+                    for (int l = 0; l < j; l++) {
+                        off -= L[i][l] * L[j][l];
+                    }
+                    L[i][j] = off / L[j][j];
+                }
+            }
+            // gain = -H^-1 G and feedforward = -H^-1 g, one column at a time.
+            for (int col = 0; col <= nx; col++) {
+                Lanes y[nu];
+                for (int i = 0; i < nu; i++) {
+                    y[i] = col < nx ? G[i][col] : g[i];
+                    for (int l = 0; l < i; l++) {
+                        y[i] -= L[i][l] * y[l];
+                    }
+                    y[i] /= L[i][i];
+                }
+                for (int i = nu - 1; i >= 0; i--) {
+                    for (int l = i + 1; l < nu; l++) {
+                        y[i] -= L[l][i] * y[l];
+                    }
+                    y[i] /= L[i][i];
+                }
+                for (int i = 0; i < nu; i++) {
+                    if (col < nx) {
+                        gain[k][i][col] = -y[i];
+                    } else {
+                        feedforward[k][i] = -y[i];
+                    }
+                }
+            }
+
+            for (int i = 0; i < nx; i++) {
+                Lanes next_p = q[k][i];
+                for (int l = 0; l < nx; l++) {
+                    next_p += A[k][l][i] * Pc[l];
+                }
+                for (int l = 0; l < nu; l++) {
+                    next_p += G[l][i] * feedforward[k][l];
+                }
+                p[i] = next_p;
+            }
+            for (int i = 0; i < nx; i++) {
+                for (int j = i; j < nx; j++) {
+                    Lanes value = Q[k][i][j];
+                    for (int l = 0; l < nx; l++) {
+                        value += A[k][l][i] * PA[l][j];
+                    }
+                    for (int l = 0; l < nu; l++) {
+                        value += G[l][i] * gain[k][l][j];
+                    }
+                    P[i][j] = value;
+                }
+            }
+            // Symmetric by construction, mirror the upper triangle.
+            for (int i = 0; i < nx; i++) {
+                for (int j = 0; j < i; j++) {
+                    P[i][j] = P[j][i];
+                }
+            }
+        }
+
+        for (int i = 0; i < nx; i++) {
+            x_new[0][i] = x[0][i];
+        }
+        for (int k = 0; k < K; k++) {
+            for (int i = 0; i < nu; i++) {
+                Lanes value = feedforward[k][i];
+                for (int j = 0; j < nx; j++) {
+                    value += gain[k][i][j] * x_new[k][j];
+                }
+                u_new[k][i] = value;
+            }
+            for (int i = 0; i < nx; i++) {
+                Lanes next = c[k][i];
+                for (int j = 0; j < nx; j++) {
+                    next += A[k][i][j] * x_new[k][j];
+                }
+                for (int j = 0; j < nu; j++) {
+                    next += B[k][i][j] * u_new[k][j];
+                }
+                x_new[k + 1][i] = next;
+            }
+        }
+        return ok;
+    }
+};
+
+#endif /* BATCH_RICCATI_H */
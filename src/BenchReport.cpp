@@ -0,0 +1,220 @@
+#include "BenchReport.h"
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+#include "Eigen-3.3/Eigen/Core"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+const char *architectureName() {
+#if defined(__aarch64__)
+    return "aarch64";
+#elif defined(__arm__)
+    return "arm";
+#elif defined(__x86_64__)
+    return "x86_64";
+#else
+    return "unknown";
+#endif
+}
+
+string BenchResult::key() const {
+    string key = name;
+    if (!label.empty()) {
+        key += " " + label;
+    }
+    if (!backend.empty()) {
+        key += " " + backend;
+    }
+    if (N > 0) {
+        key += " N=" + to_string(N);
+    }
+    return key;
+}
+
+BenchReport::BenchReport() {
+#if defined(__VERSION__)
+    env["compiler"] = __VERSION__;
+#endif
+    env["architecture"] = architectureName();
+    env["simd"] = Eigen::SimdInstructionSetsInUse();
+    env["threads"] = to_string(thread::hardware_concurrency());
+    char host[256];
+    if (gethostname(host, sizeof(host)) == 0) {
+        host[sizeof(host) - 1] = '\0';
+        env["host"] = host;
+    }
+    time_t now = time(nullptr);
+    struct tm utc;
+    char stamp[32];
+    if (gmtime_r(&now, &utc) && strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &utc) > 0) {
+        env["time"] = stamp;
+    }
+#ifdef NDEBUG
+    env["build"] = "release";
+#else
+    env["build"] = "debug";
+#endif
+    const char *solver = getenv("MPC_SOLVER");
+    env["solver"] = solver ? solver : "";
+}
+
+bool BenchReport::write(const char *path) const {
+    json results = json::array();
+    for (const BenchResult &result : entries) {
+        vector<double> sorted = result.samples;
+        sort(sorted.begin(), sorted.end());
+        double sum = 0;
+        for (double sample : sorted) {
+            sum += sample;
+        }
+        json entry;
+        entry["name"] = result.name;
+        entry["label"] = result.label;
+        entry["backend"] = result.backend;
+        entry["N"] = result.N;
+        entry["unit"] = result.unit;
+        entry["count"] = sorted.size();
+        entry["mean"] = sorted.empty() ? 0.0 : sum / sorted.size();
+        entry["p50"] = benchPercentile(sorted, 0.5);
+        entry["p90"] = benchPercentile(sorted, 0.9);
+        entry["p99"] = benchPercentile(sorted, 0.99);
+        entry["max"] = sorted.empty() ? 0.0 : sorted.back();
+        entry["throughput"] = result.throughput;
+        entry["iterations_mean"] = result.iterations_mean;
+        entry["iterations_max"] = result.iterations_max;
+        entry["failures"] = result.failures;
+        entry["allocations"] = result.allocations;
+        entry["samples"] = result.samples;
+        results.push_back(entry);
+    }
+    json out;
+    out["format"] = 1;
+    out["environment"] = env;
+    out["results"] = results;
+
+    ofstream file(path);
+    file << out.dump(1) << '\n';
+    return (bool) file;
+}
+
+bool BenchReport::read(const char *path) {
+    ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    try {
+        json in = json::parse(file);
+        map<string, string> read_env;
+        for (auto it = in.at("environment").begin(); it != in.at("environment").end(); ++it) {
+            read_env[it.key()] = it.value().get<string>();
+        }
+        vector<BenchResult> read_entries;
+        for (const json &entry : in.at("results")) {
+            BenchResult result;
+            result.name = entry.at("name").get<string>();
+            result.label = entry.value("label", string());
+            result.backend = entry.value("backend", string());
+            result.N = entry.value("N", (size_t) 0);
+            result.unit = entry.value("unit", string());
+            result.samples = entry.at("samples").get<vector<double> >();
+            result.throughput = entry.value("throughput", 0.0);
+            result.iterations_mean = entry.value("iterations_mean", -1.0);
+            result.iterations_max = entry.value("iterations_max", -1);
+            result.failures = entry.value("failures", -1L);
+            result.allocations = entry.value("allocations", -1.0);
+            read_entries.push_back(result);
+        }
+        env.swap(read_env);
+        entries.swap(read_entries);
+        return true;
+    } catch (const exception &) {
+        return false;
+    }
+}
+
+double benchPercentile(const vector<double> &sorted, double q) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t i = min(sorted.size() - 1, (size_t) (q * sorted.size()));
+    return sorted[i];
+}
+
+double mannWhitneyP(const vector<double> &a, const vector<double> &b) {
+    size_t n1 = a.size(), n2 = b.size(), n = n1 + n2;
+    if (n1 < 2 || n2 < 2) {
+        return 1.0;
+    }
+    // The samples of both, ranked together, ties taking their mean rank.
+    vector<pair<double, int> > all;
+    all.reserve(n);
+    for (double x : a) {
+        all.emplace_back(x, 0);
+    }
+    for (double x : b) {
+        all.emplace_back(x, 1);
+    }
+    sort(all.begin(), all.end());
+    double rank_sum = 0;
+    double ties = 0;
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        while (j < n && all[j].first == all[i].first) {
+            j++;
+        }
+        double rank = (i + 1 + j) / 2.0;
+        for (size_t k = i; k < j; k++) {
+            if (all[k].second == 0) {
+                rank_sum += rank;
+            }
+        }
+        double t = j - i;
+        ties += t * t * t - t;
+        i = j;
+    }
+    double u = rank_sum - n1 * (n1 + 1) / 2.0;
+    double mean = n1 * n2 / 2.0;
+    double variance = n1 * n2 / 12.0 * ((n + 1) - ties / (n * (n - 1.0)));
+    if (variance <= 0) {
+        return 1.0;
+    }
+    double z = max(0.0, fabs(u - mean) - 0.5) / sqrt(variance);
+    return erfc(z / sqrt(2.0));
+}
+
+vector<BenchComparison> compareBench(const BenchReport &baseline, const BenchReport &candidate) {
+    map<string, const BenchResult *> candidates;
+    for (const BenchResult &result : candidate.results()) {
+        candidates[result.key()] = &result;
+    }
+    vector<BenchComparison> comparisons;
+    for (const BenchResult &base : baseline.results()) {
+        auto match = candidates.find(base.key());
+        if (match == candidates.end()) {
+            continue;
+        }
+        const BenchResult &cand = *match->second;
+        vector<double> a = base.samples, b = cand.samples;
+        sort(a.begin(), a.end());
+        sort(b.begin(), b.end());
+        BenchComparison comparison;
+        comparison.key = base.key();
+        comparison.unit = base.unit;
+        comparison.baseline_count = a.size();
+        comparison.candidate_count = b.size();
+        comparison.baseline_p50 = benchPercentile(a, 0.5);
+        comparison.candidate_p50 = benchPercentile(b, 0.5);
+        comparison.change = comparison.baseline_p50 > 0
+                                ? comparison.candidate_p50 / comparison.baseline_p50 - 1
+                                : 0.0;
+        comparison.p = mannWhitneyP(a, b);
+        comparisons.push_back(comparison);
+    }
+    return comparisons;
+}
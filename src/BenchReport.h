@@ -0,0 +1,105 @@
+#ifndef BENCH_REPORT_H
+#define BENCH_REPORT_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// One measurement of mpc_bench: what was timed, on which backend and
+// horizon, and its samples, e.g. the step times of a corpus replay in ms
+// or the times per call of a stage in ns.
+struct BenchResult {
+    // What was timed, e.g. "replay" or "parse warm", and the settings of
+    // the run, e.g. "exact" for the exact Hessian of -H; empty for none.
+    string name;
+    string label;
+    // Backend and horizon, see backendName; empty and 0 where they do not
+    // apply.
+    string backend;
+    size_t N = 0;
+    string unit;
+    vector<double> samples;
+    // Calls per second over the whole run, 0 if not measured.
+    double throughput = 0;
+    // IPOPT iterations per sample, mean and largest, and the samples that
+    // failed; -1 if not counted.
+    double iterations_mean = -1;
+    int iterations_max = -1;
+    long failures = -1;
+    // Heap allocations per call, -1 if not counted.
+    double allocations = -1;
+
+    // What a result of another file has to match to be compared with this
+    // one, see compareBench.
+    string key() const;
+};
+
+// The results of a run of mpc_bench and where they were measured, written
+// as JSON by `mpc_bench -o file` and compared by mpc_benchdiff:
+//
+//     {"format": 1,
+//      "environment": {"compiler": ..., "architecture": ..., "simd": ...,
+//                      "threads": ..., "host": ..., "time": ...,
+//                      "build": ..., "solver": ...},
+//      "results": [{"name": ..., "label": ..., "backend": ..., "N": ...,
+//                   "unit": ..., "count": ..., "mean": ..., "p50": ...,
+//                   "p90": ..., "p99": ..., "max": ..., "throughput": ...,
+//                   "iterations_mean": ..., "iterations_max": ...,
+//                   "failures": ..., "allocations": ...,
+//                   "samples": [...]}, ...]}
+//
+// The summaries are for reading the file; only the samples are read back.
+class BenchReport {
+public:
+    // A report of no results in the environment of this process.
+    BenchReport();
+
+    void add(const BenchResult &result) { entries.push_back(result); }
+
+    const vector<BenchResult> &results() const { return entries; }
+    const map<string, string> &environment() const { return env; }
+
+    bool write(const char *path) const;
+
+    // Replace this report with the one in `path`; false, leaving it
+    // alone, if it cannot be read.
+    bool read(const char *path);
+
+private:
+    map<string, string> env;
+    vector<BenchResult> entries;
+};
+
+// Name of the architecture built for, e.g. "x86_64".
+const char *architectureName();
+
+// Value at quantile `q` of `sorted`, the nearest rank below; 0 if empty.
+double benchPercentile(const vector<double> &sorted, double q);
+
+// Two-sided p-value of the Mann-Whitney U test that the samples `a` and
+// `b` come from the same distribution, by the normal approximation with
+// the correction for ties; 1 if either has fewer than two samples.
+double mannWhitneyP(const vector<double> &a, const vector<double> &b);
+
+// A result of a baseline against the same one of a candidate: their
+// medians, the relative change of the candidate's, and the p-value of the
+// difference, see mannWhitneyP.
+struct BenchComparison {
+    string key;
+    string unit;
+    size_t baseline_count;
+    size_t candidate_count;
+    double baseline_p50;
+    double candidate_p50;
+    double change;
+    double p;
+};
+
+// The results of `candidate` that have a match in `baseline`, in the order
+// of `baseline`.
+vector<BenchComparison> compareBench(const BenchReport &baseline, const BenchReport &candidate);
+
+#endif /* BENCH_REPORT_H */
@@ -0,0 +1,133 @@
+#include "BinaryProtocol.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+// The bytes are assembled by shifts, so the layout does not depend on the
+// byte order of the host.
+uint16_t getU16(const unsigned char *p) {
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+double getDouble(const unsigned char *p) {
+    uint64_t bits = 0;
+    for (int i = 7; i >= 0; i--) {
+        bits = bits << 8 | p[i];
+    }
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void putU16(string &out, size_t value) {
+    out += (char) (value & 0xff);
+    out += (char) (value >> 8 & 0xff);
+}
+
+void putDouble(string &out, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    char bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (char) (bits >> (8 * i));
+    }
+    out.append(bytes, sizeof(bytes));
+}
+
+void putDoubles(string &out, StridedView values) {
+    for (size_t i = 0; i < values.size; i++) {
+        putDouble(out, values[i]);
+    }
+}
+
+void getDoubles(const unsigned char *p, size_t n, WaypointVector &values) {
+    values.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        values[i] = getDouble(p + 8 * i);
+    }
+}
+
+const size_t telemetry_header = 4;
+const size_t telemetry_scalars = 6;
+
+} // namespace
+
+MessageKind parseBinaryMessage(const char *data, size_t length, Telemetry &telemetry) {
+    const unsigned char *p = (const unsigned char *) data;
+    if (length > 0 && p[0] == 'V') {
+        return length == 2 && p[1] == binary_version ? MSG_VISUALIZE : MSG_MALFORMED;
+    }
+    if (length < telemetry_header) {
+        return MSG_MALFORMED;
+    }
+    if (p[0] != 'T') {
+        return MSG_OTHER;
+    }
+    size_t n = getU16(p + 2);
+    if (p[1] != binary_version || length != telemetry_header + 8 * (telemetry_scalars + 2 * n)) {
+        return MSG_MALFORMED;
+    }
+    
+    p += telemetry_header;
+    telemetry.x = getDouble(p);
+    telemetry.y = getDouble(p + 8);
+    telemetry.psi = getDouble(p + 16);
+    telemetry.speed = getDouble(p + 24);
+    telemetry.steering_angle = getDouble(p + 32);
+    telemetry.throttle = getDouble(p + 40);
+    p += 8 * telemetry_scalars;
+    getDoubles(p, n, telemetry.ptsx);
+    getDoubles(p + 8 * n, n, telemetry.ptsy);
+    return MSG_TELEMETRY;
+}
+
+void writeTelemetryBinary(string &out, const Telemetry &telemetry) {
+    size_t n = min(telemetry.ptsx.size(), telemetry.ptsy.size());
+    out.clear();
+    out += 'T';
+    out += (char) binary_version;
+    putU16(out, n);
+    putDouble(out, telemetry.x);
+    putDouble(out, telemetry.y);
+    putDouble(out, telemetry.psi);
+    putDouble(out, telemetry.speed);
+    putDouble(out, telemetry.steering_angle);
+    putDouble(out, telemetry.throttle);
+    for (size_t i = 0; i < n; i++) {
+        putDouble(out, telemetry.ptsx[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        putDouble(out, telemetry.ptsy[i]);
+    }
+}
+
+void writeSteerBinary(string &out, double steering_angle, double throttle,
+                      StridedView mpc_x, StridedView mpc_y, StridedView next_x, StridedView next_y) {
+    out.clear();
+    out += 'S';
+    out += (char) binary_version;
+    putU16(out, mpc_x.size);
+    putU16(out, next_x.size);
+    putU16(out, 0);
+    putDouble(out, steering_angle);
+    putDouble(out, throttle);
+    putDoubles(out, mpc_x);
+    putDoubles(out, mpc_y);
+    putDoubles(out, next_x);
+    putDoubles(out, next_y);
+}
+
+size_t stripSteerBinaryLines(string &msg) {
+    const size_t actuations_end = 8 + 2 * 8;
+    if (msg.size() <= actuations_end || msg[0] != 'S' || msg[1] != (char) binary_version) {
+        return 0;
+    }
+    size_t removed = msg.size() - actuations_end;
+    for (size_t i = 2; i < 6; i++) {
+        msg[i] = 0;
+    }
+    msg.resize(actuations_end);
+    return removed;
+}
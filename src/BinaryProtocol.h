@@ -0,0 +1,51 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <cstddef>
+#include <string>
+#include "Controller.h"
+#include "SteerMessage.h"
+#include "TelemetryParser.h"
+
+using namespace std;
+
+// Compact binary framing of the telemetry and steer events, sent as binary
+// websocket messages by clients that connect to the /binary path of the
+// server instead of speaking the simulator's Socket.IO JSON. Integers and
+// doubles are little-endian, the doubles IEEE 754:
+//
+//     telemetry: u8 'T', u8 version, u16 n_points,
+//                x, y, psi, speed, steering_angle, throttle,
+//                ptsx[n_points], ptsy[n_points]
+//
+//     steer:     u8 'S', u8 version, u16 n_mpc, u16 n_next, u16 0,
+//                steering_angle, throttle,
+//                mpc_x[n_mpc], mpc_y[n_mpc], next_x[n_next], next_y[n_next]
+//
+//     visualize: u8 'V', u8 version
+//
+// The fields mean the same as in the JSON events; n_points = 0 is a frame
+// without waypoints, see Controller::setMap.
+const unsigned char binary_version = 1;
+
+// Decode the binary message `data` of `length` bytes into `telemetry`,
+// keeping the capacity of ptsx/ptsy. Returns MSG_TELEMETRY, MSG_VISUALIZE,
+// MSG_OTHER for another type byte, or MSG_MALFORMED for a wrong version or
+// length.
+MessageKind parseBinaryMessage(const char *data, size_t length, Telemetry &telemetry);
+
+// Write the binary telemetry event of `telemetry` into `out`, the client's
+// side of parseBinaryMessage, replacing its content but keeping its
+// storage.
+void writeTelemetryBinary(string &out, const Telemetry &telemetry);
+
+// Write the binary steer event into `out`, replacing its content but
+// keeping its storage.
+void writeSteerBinary(string &out, double steering_angle, double throttle,
+                      StridedView mpc_x, StridedView mpc_y, StridedView next_x, StridedView next_y);
+
+// Drop the four lines of a binary steer event in place, keeping the
+// actuations. Returns the bytes removed, 0 for any other message.
+size_t stripSteerBinaryLines(string &msg);
+
+#endif /* BINARY_PROTOCOL_H */
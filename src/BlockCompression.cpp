@@ -0,0 +1,52 @@
+#include "BlockCompression.h"
+#include <zlib.h>
+#include <cstdlib>
+#include <cstring>
+#include "Logger.h"
+
+int compressionLevel() {
+    static const int level = [] {
+        const char *s = getenv("MPC_COMPRESS");
+        if (!s || !*s) {
+            return 0;
+        }
+        int n = atoi(s);
+        if (n < 0 || n > 9) {
+            MPC_LOG(LOG_ERROR, "Ignoring MPC_COMPRESS=%s, expected a zlib level from 0 to 9", s);
+            return 0;
+        }
+        return n;
+    }();
+    return level;
+}
+
+void appendBlock(const char *records, size_t size, int level, string &out) {
+    size_t header = out.size();
+    uLongf compressed = compressBound(size);
+    out.resize(header + 2 * sizeof(uint32_t) + compressed);
+    compress2((Bytef *) &out[header + 2 * sizeof(uint32_t)], &compressed, (const Bytef *) records, size, level);
+    uint32_t lengths[2] = {(uint32_t) compressed, (uint32_t) size};
+    memcpy(&out[header], lengths, sizeof(lengths));
+    out.resize(header + 2 * sizeof(uint32_t) + compressed);
+}
+
+void indexBlocks(const char *data, size_t size, vector<CompressedBlock> &blocks) {
+    size_t offset = 0;
+    while (size - offset >= 2 * sizeof(uint32_t)) {
+        uint32_t lengths[2];
+        memcpy(lengths, data + offset, sizeof(lengths));
+        offset += sizeof(lengths);
+        if (size - offset < lengths[0]) {
+            break;
+        }
+        blocks.push_back({offset, lengths[0], lengths[1]});
+        offset += lengths[0];
+    }
+}
+
+bool inflateBlock(const char *data, const CompressedBlock &block, string &records) {
+    records.resize(block.raw_size);
+    uLongf size = block.raw_size;
+    return uncompress((Bytef *) &records[0], &size, (const Bytef *) data + block.offset, block.compressed_size) ==
+               Z_OK && size == block.raw_size;
+}
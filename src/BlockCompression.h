@@ -0,0 +1,49 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Files of length-prefixed records, the capture and the slow-solve log,
+// compressed with zlib in blocks. A compressed file has a magic of its
+// own, followed by one block after another:
+//
+//     uint32  length of the compressed data in bytes
+//     uint32  length of the records it inflates to
+//     byte    compressed data, a zlib stream
+//
+// in the byte order of the machine that wrote it. A block holds whole
+// records and is compressed on its own, so the blocks of a file can be
+// inflated in any order and on different threads.
+
+// Records a writer gathers before it compresses them into a block.
+const size_t compressed_block_bytes = 64 * 1024;
+
+// The zlib level of MPC_COMPRESS=<level>, 1 fastest to 9 smallest, for
+// the files written by this process; 0, the default, writes them
+// uncompressed.
+int compressionLevel();
+
+// Where a block is in a file.
+struct CompressedBlock {
+    size_t offset;
+    uint32_t compressed_size;
+    uint32_t raw_size;
+};
+
+// Compress `records` at `level` and append the block to `out`.
+void appendBlock(const char *records, size_t size, int level, string &out);
+
+// The blocks of the `size` bytes at `data`, the file past its magic, in
+// order. A truncated block ends them.
+void indexBlocks(const char *data, size_t size, vector<CompressedBlock> &blocks);
+
+// Inflate `block` of `data` into `records`, reusing its storage; false if
+// it is corrupt.
+bool inflateBlock(const char *data, const CompressedBlock &block, string &records);
+
+#endif /* BLOCK_COMPRESSION_H */
@@ -0,0 +1,102 @@
+#ifndef BOX_QP_H
+#define BOX_QP_H
+
+#include <math.h>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+
+// Dense QP with simple bounds,
+//
+//     min 1/2 u' H u + h' u   s.t.  lb <= u <= ub,
+//
+// for a positive definite H of fixed size n, solved by a primal active-set
+// method. Each iteration factors H with the rows and columns of the active
+// bounds replaced by the identity, so nothing is ever resized.
+//
+// The working set starts as the bounds `u` lies on, so started from the
+// previous solution of a receding horizon, shifted, it is the last working
+// set carried over: the saturated bounds barely change from one cycle to
+// the next and most solves take a single iteration.
+template <int n, typename Scalar = double>
+class BoxQP {
+public:
+    typedef Eigen::Matrix<Scalar, n, n> Matrix;
+    typedef Eigen::Matrix<Scalar, n, 1> Vector;
+    
+    // Solve starting from `u`, which is first clamped into the box.
+    // Returns the number of active-set iterations, or -1 if max_iter was
+    // reached; `u` is feasible either way.
+    int solve(const Matrix &H, const Vector &h, const Vector &lb, const Vector &ub,
+              Vector &u, int max_iter = 100) {
+        u = u.cwiseMax(lb).cwiseMin(ub);
+        for (int i = 0; i < n; i++) {
+            active[i] = u[i] == lb[i] ? -1 : (u[i] == ub[i] ? 1 : 0);
+        }
+        
+        for (int iter = 1; iter <= max_iter; iter++) {
+            // Minimizer over the free variables with the active ones held.
+            Matrix M = H;
+            Vector rhs = -h;
+            for (int i = 0; i < n; i++) {
+                if (active[i] != 0) {
+                    rhs -= H.col(i) * u[i];
+                }
+            }
+            for (int i = 0; i < n; i++) {
+                if (active[i] != 0) {
+                    M.row(i).setZero();
+                    M.col(i).setZero();
+                    M(i, i) = 1.0;
+                    rhs[i] = u[i];
+                }
+            }
+            Vector target = M.ldlt().solve(rhs);
+            
+            // Walk towards it until the first bound blocks.
+            Scalar alpha = 1.0;
+            int blocking = -1;
+            for (int i = 0; i < n; i++) {
+                Scalar step = target[i] - u[i];
+                if (active[i] != 0 || step == 0.0) {
+                    continue;
+                }
+                Scalar limit = ((step < 0 ? lb[i] : ub[i]) - u[i]) / step;
+                if (limit < alpha) {
+                    alpha = limit;
+                    blocking = i;
+                }
+            }
+            u += alpha * (target - u);
+            
+            if (blocking >= 0) {
+                u[blocking] = target[blocking] < u[blocking] ? lb[blocking] : ub[blocking];
+                active[blocking] = u[blocking] == lb[blocking] ? -1 : 1;
+                continue;
+            }
+            
+            // At the subspace minimizer: release the bound whose multiplier
+            // has the wrong sign, if any.
+            Vector grad = H * u + h;
+            int release = -1;
+            Scalar worst = 0.0;
+            for (int i = 0; i < n; i++) {
+                Scalar violation = active[i] * grad[i];
+                if (violation > worst) {
+                    worst = violation;
+                    release = i;
+                }
+            }
+            if (release < 0) {
+                return iter;
+            }
+            active[release] = 0;
+        }
+        return -1;
+    }
+    
+private:
+    // -1 at the lower bound, 1 at the upper bound, 0 free.
+    int active[n];
+};
+
+#endif /* BOX_QP_H */
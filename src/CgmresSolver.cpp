@@ -0,0 +1,265 @@
+#include "CgmresSolver.h"
+#include <algorithm>
+#include <cmath>
+#include "FG_eval.h"
+
+template <typename Config>
+const int CgmresSolver<Config>::n_inputs;
+
+// Weight of the barrier of the actuation bounds, small against the cost
+// of saturating them.
+static const double barrier_weight = 1e-2;
+
+// Closest the actuations come to a bound, relative to the width of the
+// box.
+static const double bound_margin = 1e-4;
+
+// GMRES stops early once the residual has dropped by this factor.
+static const double gmres_tol = 1e-6;
+
+template <typename Config>
+CgmresSolver<Config>::CgmresSolver() : speeds(constantSpeeds()), iterations(1) {
+    setDirections(4);
+}
+
+template <typename Config>
+void CgmresSolver<Config>::setDirections(int directions) {
+    this->directions = max(1, min(directions, n_inputs));
+    basis.resize(n_inputs, this->directions + 1);
+    hessenberg.resize(this->directions + 1, this->directions);
+    cosines.resize(this->directions);
+    sines.resize(this->directions);
+    residuals.resize(this->directions + 1);
+}
+
+template <typename Config>
+void CgmresSolver<Config>::gradient(const Controls &u, Controls &F) {
+    states[0] = initial;
+    for (int t = 1; t < N; t++) {
+        int j = Config::controlIndex(t);
+        double dt = Config::stageDt(t);
+        vehicleStepDegree(states[t - 1].data(), u[deltaIndex(j)], u[aIndex(j)], poly, dt, states[t].data(),
+                          &jac_A[t], &jac_B[t]);
+    }
+
+    // The costate of stage t is the derivative of the cost from t on with
+    // respect to its state; each transition hands it to its actuations.
+    auto stateGradient = [this](int t) {
+        State g = State::Zero();
+        g[3] = 2 * weights.v * (states[t][3] - speeds[t]);
+        g[4] = 2 * weights.cte * states[t][4];
+        g[5] = 2 * weights.epsi * states[t][5];
+        return g;
+    };
+    F.setZero();
+    State costate = stateGradient(N - 1);
+    for (int t = N - 1; t >= 1; t--) {
+        int j = Config::controlIndex(t);
+        Eigen::Vector2d g = jac_B[t].transpose() * costate;
+        F[deltaIndex(j)] += g[0];
+        F[aIndex(j)] += g[1];
+        costate = stateGradient(t - 1) + jac_A[t].transpose() * costate;
+    }
+
+    for (int j = 0; j < n_controls; j++) {
+        F[deltaIndex(j)] += 2 * weights.delta * u[deltaIndex(j)];
+        F[aIndex(j)] += 2 * weights.a * u[aIndex(j)];
+    }
+    for (int j = 0; j + 1 < n_controls; j++) {
+        const int cols[2] = {deltaIndex(j), aIndex(j)};
+        const double w[2] = {weights.ddelta, weights.da};
+        for (int k = 0; k < 2; k++) {
+            int c0 = cols[k], c1 = cols[k] + 2;
+            double r = u[c1] - u[c0];
+            F[c0] -= 2 * w[k] * r;
+            F[c1] += 2 * w[k] * r;
+        }
+    }
+    for (int i = 0; i < n_inputs; i++) {
+        F[i] += barrier_weight * (1 / (ub[i] - u[i]) - 1 / (u[i] - lb[i]));
+    }
+}
+
+template <typename Config>
+void CgmresSolver<Config>::gaussNewtonProduct(const Controls &u, const Controls &v, Controls &w) {
+    // The change of the rollout along v, linearized, then the costate
+    // recursion of gradient() with the residuals' derivatives in place of
+    // the residuals.
+    State dx[Config::N];
+    dx[0].setZero();
+    for (int t = 1; t < N; t++) {
+        int j = Config::controlIndex(t);
+        dx[t] = jac_A[t] * dx[t - 1] + jac_B[t] * Eigen::Vector2d(v[deltaIndex(j)], v[aIndex(j)]);
+    }
+    auto stateGradient = [&](int t) {
+        State g = State::Zero();
+        g[3] = 2 * weights.v * dx[t][3];
+        g[4] = 2 * weights.cte * dx[t][4];
+        g[5] = 2 * weights.epsi * dx[t][5];
+        return g;
+    };
+    w.setZero();
+    State costate = stateGradient(N - 1);
+    for (int t = N - 1; t >= 1; t--) {
+        int j = Config::controlIndex(t);
+        Eigen::Vector2d g = jac_B[t].transpose() * costate;
+        w[deltaIndex(j)] += g[0];
+        w[aIndex(j)] += g[1];
+        costate = stateGradient(t - 1) + jac_A[t].transpose() * costate;
+    }
+    for (int j = 0; j < n_controls; j++) {
+        w[deltaIndex(j)] += 2 * weights.delta * v[deltaIndex(j)];
+        w[aIndex(j)] += 2 * weights.a * v[aIndex(j)];
+    }
+    for (int j = 0; j + 1 < n_controls; j++) {
+        const int cols[2] = {deltaIndex(j), aIndex(j)};
+        const double wt[2] = {weights.ddelta, weights.da};
+        for (int k = 0; k < 2; k++) {
+            int c0 = cols[k], c1 = cols[k] + 2;
+            double r = v[c1] - v[c0];
+            w[c0] -= 2 * wt[k] * r;
+            w[c1] += 2 * wt[k] * r;
+        }
+    }
+    for (int i = 0; i < n_inputs; i++) {
+        w[i] += barrier_weight * (1 / square(ub[i] - u[i]) + 1 / square(u[i] - lb[i])) * v[i];
+    }
+}
+
+template <typename Config>
+int CgmresSolver<Config>::gmres(const Controls &u, const Controls &F, Controls &d) {
+    d.setZero();
+    double beta = F.norm();
+    if (!(beta > 0)) {
+        return 0;
+    }
+    basis.col(0) = -F / beta;
+    residuals.setZero();
+    residuals[0] = beta;
+
+    int m = 0;
+    while (m < directions) {
+        // Arnoldi: the product along the last direction, orthogonalized
+        // against the basis.
+        Controls w;
+        gaussNewtonProduct(u, basis.col(m), w);
+        for (int i = 0; i <= m; i++) {
+            hessenberg(i, m) = w.dot(basis.col(i));
+            w -= hessenberg(i, m) * basis.col(i);
+        }
+        double norm = w.norm();
+
+        // Keep the Hessenberg matrix triangular with Givens rotations,
+        // which leaves the residual of the least-squares problem in
+        // `residuals`.
+        for (int i = 0; i < m; i++) {
+            double h0 = hessenberg(i, m), h1 = hessenberg(i + 1, m);
+            hessenberg(i, m) = cosines[i] * h0 + sines[i] * h1;
+            hessenberg(i + 1, m) = -sines[i] * h0 + cosines[i] * h1;
+        }
+        double r = hypot(hessenberg(m, m), norm);
+        if (!(r > 0)) {
+            break;
+        }
+        cosines[m] = hessenberg(m, m) / r;
+        sines[m] = norm / r;
+        hessenberg(m, m) = r;
+        residuals[m + 1] = -sines[m] * residuals[m];
+        residuals[m] *= cosines[m];
+        m++;
+        if (fabs(residuals[m]) <= gmres_tol * beta || norm <= gmres_tol * beta) {
+            break;
+        }
+        if (m < directions) {
+            basis.col(m) = w / norm;
+        }
+    }
+    if (m == 0) {
+        return 0;
+    }
+    Eigen::VectorXd y = hessenberg.topLeftCorner(m, m).template triangularView<Eigen::Upper>().solve(residuals.head(m));
+    d = basis.leftCols(m) * y;
+    return m;
+}
+
+template <typename Config>
+double CgmresSolver<Config>::rollout(const Controls &u, Dvector &x) {
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    states[0] = initial;
+    for (int t = 1; t < N; t++) {
+        int j = Config::controlIndex(t);
+        vehicleStepDegree<double>(states[t - 1].data(), u[deltaIndex(j)], u[aIndex(j)], poly, Config::stageDt(t),
+                                  states[t].data(), nullptr, nullptr);
+    }
+    double cost = 0.0;
+    for (int t = 0; t < N; t++) {
+        for (int k = 0; k < 6; k++) {
+            x[starts[k] + t] = states[t][k];
+        }
+        cost += weights.cte * square(states[t][4]);
+        cost += weights.epsi * square(states[t][5]);
+        cost += weights.v * square(states[t][3] - speeds[t]);
+    }
+    for (int j = 0; j < n_controls; j++) {
+        x[delta_start + j] = u[deltaIndex(j)];
+        x[a_start + j] = u[aIndex(j)];
+        cost += weights.delta * square(u[deltaIndex(j)]);
+        cost += weights.a * square(u[aIndex(j)]);
+    }
+    for (int j = 0; j + 1 < n_controls; j++) {
+        cost += weights.ddelta * square(u[deltaIndex(j + 1)] - u[deltaIndex(j)]);
+        cost += weights.da * square(u[aIndex(j + 1)] - u[aIndex(j)]);
+    }
+    return cost;
+}
+
+template <typename Config>
+void CgmresSolver<Config>::solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+                                 const Dvector &gl, const Dvector &gu,
+                                 const Eigen::VectorXd &coeffs, SolveResult &solution, SolveStats &stats) {
+    // The initial state is fixed by the constraint bounds.
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    for (int k = 0; k < 6; k++) {
+        initial[k] = gl[starts[k]];
+    }
+    poly = coeffs;
+
+    Controls u;
+    for (int j = 0; j < n_controls; j++) {
+        u[deltaIndex(j)] = xi[delta_start + j];
+        u[aIndex(j)] = xi[a_start + j];
+        lb[deltaIndex(j)] = xl[delta_start + j];
+        ub[deltaIndex(j)] = xu[delta_start + j];
+        lb[aIndex(j)] = xl[a_start + j];
+        ub[aIndex(j)] = xu[a_start + j];
+    }
+    Controls margin = bound_margin * (ub - lb);
+    u = u.cwiseMax(lb + margin).cwiseMin(ub - margin);
+
+    bool ok = true;
+    int n_directions = 0;
+    Controls F, d;
+    for (int it = 0; it < iterations; it++) {
+        gradient(u, F);
+        if (!F.allFinite()) {
+            ok = false;
+            break;
+        }
+        n_directions += gmres(u, F, d);
+
+        // Projected onto the box rather than cut short at the first bound
+        // it meets, so that a saturating move does not hold back the others.
+        u = (u + d).cwiseMax(lb + margin).cwiseMin(ub - margin);
+    }
+
+    solution.x.resize(n_vars);
+    solution.obj_value = rollout(u, solution.x);
+
+    finishRolledOut(gl, n_vars, ok, n_directions, solution, stats);
+}
+
+// Horizons the controller is built for.
+template class CgmresSolver<DefaultConfig>;
+template class CgmresSolver<MediumConfig>;
+template class CgmresSolver<LongConfig>;
+template class CgmresSolver<BlockedConfig>;
@@ -0,0 +1,108 @@
+#ifndef CGMRES_SOLVER_H
+#define CGMRES_SOLVER_H
+
+#include "CostWeights.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "MpcConfig.h"
+#include "NLPTypes.h"
+#include "SpeedProfile.h"
+
+// Continuation/GMRES for the kinematic model of FG_eval, in the actuations
+// only like SINGLE_SHOOTING: the optimality condition F(u) = 0 is the
+// gradient of the cost of the rollout from the initial state, found by
+// the costate recursion backwards along it. Rather than iterating to
+// convergence, every solve takes one Newton step on F from the shifted
+// previous solution, which tracks the optimum as the problem moves from
+// cycle to cycle. The Newton system is solved by GMRES with a fixed
+// number of directions, so no Hessian is ever formed and the work per
+// solve is fixed: one gradient plus one product per direction.
+//
+// The products are the Gauss-Newton ones of the cost, a forward sweep of
+// the direction through the model Jacobians of the gradient's rollout and
+// a costate sweep back, rather than forward differences of F: those are
+// the exact Hessian's, indefinite along sharp turns, and lost the track
+// where the positive definite Gauss-Newton steps, the curvature RtiSolver
+// uses, keep it. Few directions under-solve the step, which damps it.
+//
+// The actuation bounds enter F as a logarithmic barrier of fixed weight
+// and every step is projected onto the box, so the actuations stay
+// strictly within, at most a small margin from a bound they saturate.
+// The returned trajectory satisfies the dynamics exactly.
+template <typename Config>
+class CgmresSolver : private Config {
+    using Config::N;
+    using Config::n_controls;
+    using Config::x_start;
+    using Config::y_start;
+    using Config::psi_start;
+    using Config::v_start;
+    using Config::cte_start;
+    using Config::epsi_start;
+    using Config::delta_start;
+    using Config::a_start;
+    using Config::n_vars;
+    using Config::n_constraints;
+
+public:
+    static const int n_inputs = 2 * Config::n_controls;
+
+    CgmresSolver();
+
+    void setCostWeights(const CostWeights &weights) { this->weights = weights; }
+
+    // See FG_eval::speeds.
+    void setReferenceSpeeds(const StageSpeeds &speeds) { this->speeds = speeds; }
+
+    // GMRES directions per Newton step, at most n_inputs; 4 by default.
+    void setDirections(int directions);
+
+    // Newton steps per solve, 1 being the continuation update.
+    void setIterations(int iterations) { this->iterations = iterations; }
+
+    // Same contract as CppAD::ipopt::solve. stats.iterations counts the
+    // GMRES directions of all Newton steps.
+    void solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+               const Dvector &gl, const Dvector &gu,
+               const Eigen::VectorXd &coeffs, SolveResult &solution, SolveStats &stats);
+
+private:
+    typedef Eigen::Matrix<double, 6, 1> State;
+    typedef Eigen::Matrix<double, n_inputs, 1> Controls;
+
+    CostWeights weights;
+    StageSpeeds speeds;
+    int iterations;
+    int directions;
+
+    // The problem of the solve, delta and a interleaved per move.
+    State initial;
+    Eigen::VectorXd poly;
+    Controls lb, ub;
+
+    // Rollout of the last gradient and the model Jacobians along it.
+    State states[Config::N];
+    Eigen::Matrix<double, 6, 6> jac_A[Config::N];
+    Eigen::Matrix<double, 6, 2> jac_B[Config::N];
+
+    // Krylov basis, Hessenberg matrix and Givens rotations of GMRES.
+    Eigen::Matrix<double, n_inputs, Eigen::Dynamic> basis;
+    Eigen::MatrixXd hessenberg;
+    Eigen::VectorXd cosines, sines, residuals;
+
+    // F at `u`: the gradient of the cost plus that of the barrier.
+    void gradient(const Controls &u, Controls &F);
+
+    // The Gauss-Newton Hessian of the cost and the barrier's Hessian at
+    // `u` times `v`, along the rollout of the last gradient at `u`.
+    void gaussNewtonProduct(const Controls &u, const Controls &v, Controls &w);
+
+    // Solve H d = -F by GMRES from d = 0, H being that product. Returns
+    // the directions taken.
+    int gmres(const Controls &u, const Controls &F, Controls &d);
+
+    // Roll out `u` from the initial state into the stages of `x`, and the
+    // cost of that trajectory.
+    double rollout(const Controls &u, Dvector &x);
+};
+
+#endif /* CGMRES_SOLVER_H */
@@ -0,0 +1,483 @@
+#include "ColumnTrace.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Logger.h"
+
+using namespace std;
+
+namespace {
+
+enum ColumnType {
+    TYPE_UINT8,
+    TYPE_INT32,
+    TYPE_UINT32,
+    TYPE_INT64,
+    TYPE_FLOAT64,
+    // Nanoseconds since the epoch, UTC.
+    TYPE_TIMESTAMP
+};
+
+struct Column {
+    const char *name;
+    ColumnType type;
+    size_t offset;
+};
+
+#define TRACE_COLUMN(name, type, field) {name, type, offsetof(TraceRow, field)}
+
+const Column columns[] = {
+    TRACE_COLUMN("time", TYPE_TIMESTAMP, time),
+    TRACE_COLUMN("arrival_ns", TYPE_INT64, arrival),
+    TRACE_COLUMN("source", TYPE_UINT32, source),
+    TRACE_COLUMN("x", TYPE_FLOAT64, x),
+    TRACE_COLUMN("y", TYPE_FLOAT64, y),
+    TRACE_COLUMN("psi", TYPE_FLOAT64, psi),
+    TRACE_COLUMN("speed", TYPE_FLOAT64, speed),
+    TRACE_COLUMN("steering_angle", TYPE_FLOAT64, steering_angle),
+    TRACE_COLUMN("throttle", TYPE_FLOAT64, throttle),
+    TRACE_COLUMN("n_waypoints", TYPE_INT32, n_waypoints),
+    TRACE_COLUMN("c0", TYPE_FLOAT64, coeffs[0]),
+    TRACE_COLUMN("c1", TYPE_FLOAT64, coeffs[1]),
+    TRACE_COLUMN("c2", TYPE_FLOAT64, coeffs[2]),
+    TRACE_COLUMN("c3", TYPE_FLOAT64, coeffs[3]),
+    TRACE_COLUMN("state_x", TYPE_FLOAT64, state[0]),
+    TRACE_COLUMN("state_y", TYPE_FLOAT64, state[1]),
+    TRACE_COLUMN("state_psi", TYPE_FLOAT64, state[2]),
+    TRACE_COLUMN("state_v", TYPE_FLOAT64, state[3]),
+    TRACE_COLUMN("cte", TYPE_FLOAT64, state[4]),
+    TRACE_COLUMN("epsi", TYPE_FLOAT64, state[5]),
+    TRACE_COLUMN("status", TYPE_INT32, status),
+    TRACE_COLUMN("iterations", TYPE_INT32, iterations),
+    TRACE_COLUMN("wall_time", TYPE_FLOAT64, wall_time),
+    TRACE_COLUMN("eval_time", TYPE_FLOAT64, eval_time),
+    TRACE_COLUMN("linear_solver_time", TYPE_FLOAT64, linear_solver_time),
+    TRACE_COLUMN("objective", TYPE_FLOAT64, objective),
+    TRACE_COLUMN("cost_cte", TYPE_FLOAT64, cost_terms[0]),
+    TRACE_COLUMN("cost_epsi", TYPE_FLOAT64, cost_terms[1]),
+    TRACE_COLUMN("cost_speed", TYPE_FLOAT64, cost_terms[2]),
+    TRACE_COLUMN("cost_actuation", TYPE_FLOAT64, cost_terms[3]),
+    TRACE_COLUMN("cost_rate", TYPE_FLOAT64, cost_terms[4]),
+    TRACE_COLUMN("constraint_violation", TYPE_FLOAT64, constraint_violation),
+    TRACE_COLUMN("origin", TYPE_UINT8, origin),
+    TRACE_COLUMN("tier", TYPE_UINT8, tier),
+    TRACE_COLUMN("horizon", TYPE_INT32, horizon),
+    TRACE_COLUMN("reply_steering", TYPE_FLOAT64, reply_steering),
+    TRACE_COLUMN("reply_throttle", TYPE_FLOAT64, reply_throttle),
+};
+
+const size_t n_columns = sizeof(columns) / sizeof(columns[0]);
+
+size_t widthOf(ColumnType type) {
+    switch (type) {
+    case TYPE_UINT8:
+        return 1;
+    case TYPE_INT32:
+    case TYPE_UINT32:
+        return 4;
+    default:
+        return 8;
+    }
+}
+
+size_t padded(size_t n) {
+    return (n + 7) & ~size_t(7);
+}
+
+// Builds a flatbuffer front to back. The offsets of the format only point
+// forward, so every table goes before the tables, strings and vectors it
+// refers to, whose offsets are patched in once they are placed. One table
+// is open at a time. Everything is aligned to its size relative to the
+// start, which goes at an offset of 8 in the stream.
+class FlatBuilder {
+public:
+    string buf;
+
+    // The root offset comes first.
+    FlatBuilder() : buf(4, '\0'), vtable(0), table(0) {}
+
+    void align(size_t n) {
+        buf.append((n - buf.size() % n) % n, '\0');
+    }
+
+    template <typename T>
+    size_t put(T value) {
+        align(sizeof(T));
+        size_t at = buf.size();
+        buf.append((const char *) &value, sizeof(value));
+        return at;
+    }
+
+    // Point the offset at `slot` to `target`.
+    void point(size_t slot, size_t target) {
+        uint32_t offset = target - slot;
+        memcpy(&buf[slot], &offset, sizeof(offset));
+    }
+
+    // A table with fields numbered below `n_fields`, its vtable just before.
+    size_t beginTable(int n_fields) {
+        vtable = put<uint16_t>(4 + 2 * n_fields);
+        put<uint16_t>(0);
+        for (int i = 0; i < n_fields; i++) {
+            put<uint16_t>(0);
+        }
+        table = put<int32_t>(0);
+        int32_t back = table - vtable;
+        memcpy(&buf[table], &back, sizeof(back));
+        return table;
+    }
+
+    template <typename T>
+    void field(int id, T value) {
+        enter(id, put(value));
+    }
+
+    // An offset field, to be pointed once its target is placed.
+    size_t offsetField(int id) {
+        size_t at = put<uint32_t>(0);
+        enter(id, at);
+        return at;
+    }
+
+    void endTable() {
+        uint16_t size = buf.size() - table;
+        memcpy(&buf[vtable + 2], &size, sizeof(size));
+    }
+
+    size_t str(const char *s) {
+        size_t at = put<uint32_t>(strlen(s));
+        buf.append(s, strlen(s) + 1);
+        return at;
+    }
+
+    // The length of a vector of `n` elements aligned to `element_align`,
+    // which follow.
+    size_t beginVector(size_t n, size_t element_align) {
+        align(4);
+        while ((buf.size() + 4) % element_align != 0) {
+            put<uint32_t>(0);
+        }
+        return put<uint32_t>(n);
+    }
+
+    // The buffer as the metadata of a message, padded so that the body
+    // after it is aligned.
+    const string &finish(size_t root) {
+        point(0, root);
+        align(8);
+        return buf;
+    }
+
+private:
+    size_t vtable;
+    size_t table;
+
+    void enter(int id, size_t at) {
+        uint16_t offset = at - table;
+        memcpy(&buf[vtable + 4 + 2 * id], &offset, sizeof(offset));
+    }
+};
+
+// Of the Arrow format, see Schema.fbs and Message.fbs there.
+const int16_t metadata_v5 = 4;
+const uint8_t header_schema = 1;
+const uint8_t header_record_batch = 3;
+const uint8_t type_int = 2;
+const uint8_t type_floating_point = 3;
+const uint8_t type_timestamp = 10;
+const int16_t precision_double = 2;
+const int16_t unit_nanosecond = 3;
+const uint32_t continuation = 0xffffffff;
+
+// The message table, returning the slot of its header.
+size_t beginMessage(FlatBuilder &b, uint8_t header_type, int64_t body_length, size_t &message) {
+    message = b.beginTable(4);
+    b.field<int16_t>(0, metadata_v5);
+    b.field<uint8_t>(1, header_type);
+    size_t header = b.offsetField(2);
+    b.field<int64_t>(3, body_length);
+    b.endTable();
+    return header;
+}
+
+void frame(const string &metadata, string &out) {
+    uint32_t length = metadata.size();
+    out.append((const char *) &continuation, 4);
+    out.append((const char *) &length, 4);
+    out += metadata;
+}
+
+void writeSchema(string &out) {
+    FlatBuilder b;
+    size_t message;
+    size_t header = beginMessage(b, header_schema, 0, message);
+
+    size_t schema = b.beginTable(2);
+    size_t fields_slot = b.offsetField(1);
+    b.endTable();
+    b.point(header, schema);
+
+    size_t fields = b.beginVector(n_columns, 4);
+    for (size_t i = 0; i < n_columns; i++) {
+        b.put<uint32_t>(0);
+    }
+    b.point(fields_slot, fields);
+
+    for (size_t i = 0; i < n_columns; i++) {
+        const Column &column = columns[i];
+        uint8_t type_type = column.type == TYPE_FLOAT64 ? type_floating_point
+                            : column.type == TYPE_TIMESTAMP ? type_timestamp : type_int;
+        size_t field = b.beginTable(6);
+        size_t name_slot = b.offsetField(0);
+        b.field<uint8_t>(1, 0);
+        b.field<uint8_t>(2, type_type);
+        size_t type_slot = b.offsetField(3);
+        // Readers want the children of every field, even without any.
+        size_t children_slot = b.offsetField(5);
+        b.endTable();
+        b.point(fields + 4 + 4 * i, field);
+        b.point(name_slot, b.str(column.name));
+
+        size_t type;
+        size_t timezone_slot = 0;
+        if (type_type == type_floating_point) {
+            type = b.beginTable(1);
+            b.field<int16_t>(0, precision_double);
+        } else if (type_type == type_timestamp) {
+            type = b.beginTable(2);
+            b.field<int16_t>(0, unit_nanosecond);
+            timezone_slot = b.offsetField(1);
+        } else {
+            type = b.beginTable(2);
+            b.field<int32_t>(0, 8 * widthOf(column.type));
+            b.field<uint8_t>(1, column.type != TYPE_UINT8 && column.type != TYPE_UINT32);
+        }
+        b.endTable();
+        b.point(type_slot, type);
+        if (timezone_slot) {
+            b.point(timezone_slot, b.str("UTC"));
+        }
+        b.point(children_slot, b.beginVector(0, 4));
+    }
+    frame(b.finish(message), out);
+}
+
+// Rows appended column by column.
+struct Batch {
+    size_t rows = 0;
+    chrono::steady_clock::time_point opened;
+    array<string, n_columns> data;
+};
+
+void writeBatch(const Batch &batch, string &out) {
+    size_t body = 0;
+    for (size_t i = 0; i < n_columns; i++) {
+        body += padded(batch.data[i].size());
+    }
+
+    FlatBuilder b;
+    size_t message;
+    size_t header = beginMessage(b, header_record_batch, body, message);
+
+    size_t record_batch = b.beginTable(3);
+    b.field<int64_t>(0, batch.rows);
+    size_t nodes_slot = b.offsetField(1);
+    size_t buffers_slot = b.offsetField(2);
+    b.endTable();
+    b.point(header, record_batch);
+
+    // A node per column, no nulls; its validity buffer, empty, and its
+    // values.
+    b.point(nodes_slot, b.beginVector(n_columns, 8));
+    for (size_t i = 0; i < n_columns; i++) {
+        b.put<int64_t>(batch.rows);
+        b.put<int64_t>(0);
+    }
+    b.point(buffers_slot, b.beginVector(2 * n_columns, 8));
+    int64_t offset = 0;
+    for (size_t i = 0; i < n_columns; i++) {
+        b.put<int64_t>(offset);
+        b.put<int64_t>(0);
+        b.put<int64_t>(offset);
+        b.put<int64_t>(batch.data[i].size());
+        offset += padded(batch.data[i].size());
+    }
+    frame(b.finish(message), out);
+
+    for (size_t i = 0; i < n_columns; i++) {
+        out += batch.data[i];
+        out.append(padded(batch.data[i].size()) - batch.data[i].size(), '\0');
+    }
+}
+
+// How long a batch stays open before it is written however few its rows.
+const chrono::seconds batch_age(10);
+
+// Batches full or being written beyond which rows are dropped.
+const size_t max_queued = 4;
+
+class Backend {
+public:
+    Backend() : file(nullptr), batch_rows(4096), sources(0), n_dropped(0), stopping(false) {
+        const char *s = getenv("MPC_TRACE_COLUMNS");
+        if (!s || !*s) {
+            return;
+        }
+        string path = s;
+        size_t colon = path.rfind(':');
+        if (colon != string::npos && colon + 1 < path.size() &&
+            path.find_first_not_of("0123456789", colon + 1) == string::npos) {
+            batch_rows = max(1ul, strtoul(path.c_str() + colon + 1, nullptr, 10));
+            path.resize(colon);
+        }
+        file = fopen(path.c_str(), "wb");
+        if (!file) {
+            MPC_LOG(LOG_ERROR, "Cannot write the column trace %s", path.c_str());
+            return;
+        }
+        string schema;
+        writeSchema(schema);
+        fwrite(schema.data(), 1, schema.size(), file);
+        writer = thread(&Backend::run, this);
+    }
+
+    ~Backend() {
+        if (!file) {
+            return;
+        }
+        {
+            lock_guard<mutex> hold(lock);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        writer.join();
+        // End of stream.
+        uint32_t end[2] = {continuation, 0};
+        fwrite(end, sizeof(end), 1, file);
+        fclose(file);
+        // The logger may be gone by now.
+        if (n_dropped > 0) {
+            fprintf(stderr, "Dropped %zu rows of the column trace\n", n_dropped.load());
+        }
+    }
+
+    FILE *file;
+    size_t batch_rows;
+    atomic<uint32_t> sources;
+    atomic<size_t> n_dropped;
+
+    void record(const TraceRow &row) {
+        lock_guard<mutex> hold(lock);
+        if (!open) {
+            if (!spare.empty()) {
+                open = std::move(spare.back());
+                spare.pop_back();
+            } else if (queued < max_queued) {
+                open.reset(new Batch);
+                for (size_t i = 0; i < n_columns; i++) {
+                    open->data[i].reserve(batch_rows * widthOf(columns[i].type));
+                }
+            } else {
+                n_dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+            open->opened = chrono::steady_clock::now();
+        }
+        for (size_t i = 0; i < n_columns; i++) {
+            open->data[i].append((const char *) &row + columns[i].offset, widthOf(columns[i].type));
+        }
+        if (++open->rows >= batch_rows) {
+            full.push_back(std::move(open));
+            queued++;
+            wakeup.notify_one();
+        }
+    }
+
+private:
+    // Guards the batches, held for the copy of a row or a hand-over only.
+    mutex lock;
+    condition_variable wakeup;
+    bool stopping;
+    unique_ptr<Batch> open;
+    deque<unique_ptr<Batch>> full;
+    vector<unique_ptr<Batch>> spare;
+    // Batches full or being written.
+    size_t queued = 0;
+    thread writer;
+
+    void run() {
+        string out;
+        unique_lock<mutex> hold(lock);
+        for (;;) {
+            wakeup.wait_for(hold, chrono::seconds(1), [this] {
+                return stopping || !full.empty();
+            });
+            if (full.empty() && open && open->rows > 0 &&
+                (stopping || chrono::steady_clock::now() - open->opened >= batch_age)) {
+                full.push_back(std::move(open));
+                queued++;
+            }
+            if (full.empty()) {
+                if (stopping) {
+                    return;
+                }
+                continue;
+            }
+            unique_ptr<Batch> batch = std::move(full.front());
+            full.pop_front();
+            hold.unlock();
+
+            out.clear();
+            writeBatch(*batch, out);
+            fwrite(out.data(), 1, out.size(), file);
+            fflush(file);
+            batch->rows = 0;
+            for (size_t i = 0; i < n_columns; i++) {
+                batch->data[i].clear();
+            }
+
+            hold.lock();
+            spare.push_back(std::move(batch));
+            queued--;
+        }
+    }
+};
+
+Backend &backend() {
+    static Backend instance;
+    return instance;
+}
+
+} // namespace
+
+namespace ColumnTrace {
+
+bool enabled() {
+    return backend().file != nullptr;
+}
+
+uint32_t nextSource() {
+    return backend().sources.fetch_add(1, memory_order_relaxed);
+}
+
+void record(const TraceRow &row) {
+    backend().record(row);
+}
+
+size_t dropped() {
+    return backend().n_dropped.load(memory_order_relaxed);
+}
+
+} // namespace ColumnTrace
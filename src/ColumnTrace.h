@@ -0,0 +1,89 @@
+#ifndef COLUMN_TRACE_H
+#define COLUMN_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// One control cycle as traced: the telemetry, the frame prepared from it,
+// how the solve went and the reply.
+struct TraceRow {
+    // Wall clock of the reply, nanoseconds since the epoch, and the arrival
+    // of the telemetry on the steady clock.
+    int64_t time;
+    int64_t arrival;
+    // Number of the controller in the process, see ColumnTrace::nextSource.
+    uint32_t source;
+    // Telemetry.
+    double x;
+    double y;
+    double psi;
+    double speed;
+    double steering_angle;
+    double throttle;
+    int32_t n_waypoints;
+    // The reference polynomial and the state at the end of the delay, in
+    // the vehicle frame.
+    double coeffs[4];
+    double state[6];
+    // SolveStats, with status -1 for a frame answered without solving,
+    // see Controller::solveFast, and the answer's origin as TraceOrigin.
+    int32_t status;
+    int32_t iterations;
+    double wall_time;
+    // SolveStats::eval_time and linear_solver_time.
+    double eval_time;
+    double linear_solver_time;
+    double objective;
+    // SolveStats::cost_terms, by CostTerm.
+    double cost_terms[5];
+    double constraint_violation;
+    uint8_t origin;
+    uint8_t tier;
+    int32_t horizon;
+    // The reply, in the simulator's convention.
+    double reply_steering;
+    double reply_throttle;
+};
+
+// Where the actuations of a TraceRow came from.
+enum TraceOrigin {
+    ORIGIN_SOLVED,
+    // The previous plan, after a failed solve.
+    ORIGIN_FALLBACK,
+    ORIGIN_TABLE,
+    ORIGIN_SPECULATIVE,
+    ORIGIN_DEGRADED,
+    ORIGIN_CACHED,
+    // The LQR after a failed solve with no plan to follow.
+    ORIGIN_LQR,
+    // Controller::solveFast.
+    ORIGIN_FAST
+};
+
+// Columnar trace of every control cycle for offline analysis, written as
+// an Apache Arrow IPC stream, so pyarrow, polars or DuckDB read weeks of
+// runs directly:
+//
+//     pyarrow.ipc.open_stream(open("trace.arrows", "rb")).read_all()
+//
+// MPC_TRACE_COLUMNS=<file>[:<rows>] turns it on. Callers append their row
+// into the open batch under a lock held for the copy alone; a background
+// thread encodes full batches of `rows`, 4096 by default, and those left
+// open for 10 s, and writes them. While it is more batches behind than it
+// keeps, rows are dropped and counted rather than waited for. The stream
+// ends when the process exits.
+namespace ColumnTrace {
+
+bool enabled();
+
+// A number for the rows of one more controller.
+uint32_t nextSource();
+
+void record(const TraceRow &row);
+
+// Rows dropped so far.
+size_t dropped();
+
+} // namespace ColumnTrace
+
+#endif /* COLUMN_TRACE_H */
@@ -0,0 +1,93 @@
+#ifndef CONDENSED_FG_EVAL_H
+#define CONDENSED_FG_EVAL_H
+
+#include <cppad/cppad.hpp>
+#include "CostWeights.h"
+#include "FG_eval.h"
+#include "MpcConfig.h"
+#include "VehicleModel.h"
+
+using CppAD::AD;
+
+// Trajectory of the model, see vehicleStep, from `state` under the
+// actuations `u`, written into `vars` in the layout of Config: the states
+// of every stage followed by the actuations. `u` holds the delta then the
+// a of each move, in the order of the actuation block of that layout.
+//
+// `Scalar` is double when expanding a result or AD<double> on the tape;
+// `State` and `Coeffs` are Eigen::VectorXd or AD<double> parameters.
+template <typename Config, typename Scalar, typename State, typename Coeffs, typename Controls,
+          typename Vector>
+void rollout(const State &state, const Coeffs &coeffs, const Controls &u, Vector &vars) {
+    const size_t N = Config::N;
+    const size_t delta_start = Config::delta_start;
+    const size_t n_controls = Config::n_controls;
+    const size_t starts[6] = {Config::x_start, Config::y_start, Config::psi_start,
+                              Config::v_start, Config::cte_start, Config::epsi_start};
+
+    Scalar s[6];
+    for (int k = 0; k < 6; k++) {
+        s[k] = state[k];
+    }
+    for (int t = 0; t < N; t++) {
+        if (t > 0) {
+            Scalar delta = u[Config::controlIndex(t)];
+            Scalar a = u[n_controls + Config::controlIndex(t)];
+            Scalar next[6];
+            vehicleStep(s, delta, a, coeffs, Config::stageDt(t), next);
+            for (int k = 0; k < 6; k++) {
+                s[k] = next[k];
+            }
+        }
+        for (int k = 0; k < 6; k++) {
+            vars[starts[k] + t] = s[k];
+        }
+    }
+    for (int i = 0; i < 2 * n_controls; i++) {
+        vars[delta_start + i] = u[i];
+    }
+}
+
+// Single-shooting (condensed) form of FG_eval: only the actuations are
+// variables and the states are rolled out from the initial state inside
+// the objective, so there are no constraints but the actuation bounds.
+// The problem has 2 * n_controls variables instead of n_vars, with a dense
+// Hessian.
+//
+// `Params` is either Eigen::VectorXd or AD<double> dynamic parameters, as
+// the `Coeffs` of FG_eval, and holds the initial state followed by the
+// polynomial coefficients.
+template <typename Config, typename Params>
+class CondensedFG_eval {
+public:
+    static constexpr size_t n_vars = 2 * Config::n_controls;
+    static constexpr size_t n_constraints = 0;
+
+    Params state;
+    Params coeffs;
+    CostWeights weights;
+    // See FG_eval::speeds.
+    StageSpeeds speeds;
+    CondensedFG_eval(const Params &params, const CostWeights &weights = CostWeights())
+        : state(6), coeffs(params.size() - 6), weights(weights), speeds(constantSpeeds()) {
+        for (int i = 0; i < 6; i++) {
+            state[i] = params[i];
+        }
+        for (int i = 0; i < coeffs.size(); i++) {
+            coeffs[i] = params[6 + i];
+        }
+    }
+
+    typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
+    void operator()(ADvector& fg, const ADvector& u) {
+        ADvector vars(Config::n_vars);
+        rollout<Config, AD<double> >(state, coeffs, u, vars);
+        fg[0] = 0;
+        addCost<Config>(fg[0], vars, weights, speeds);
+    }
+};
+
+template <typename Config, typename Params> constexpr size_t CondensedFG_eval<Config, Params>::n_vars;
+template <typename Config, typename Params> constexpr size_t CondensedFG_eval<Config, Params>::n_constraints;
+
+#endif /* CONDENSED_FG_EVAL_H */
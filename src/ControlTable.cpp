@@ -0,0 +1,259 @@
+#include "ControlTable.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include "Controller.h"
+#include "TaskScheduler.h"
+
+namespace {
+
+// Start of the file, followed by the nodes and the cells.
+struct TableHeader {
+    char magic[8];
+    uint32_t n_axes;
+    uint32_t node_size;
+    TableGrid grid;
+};
+
+const char table_magic[8] = {'M', 'P', 'C', 'T', 'A', 'B', 'L', '1'};
+
+const int n_corners = 1 << N_TABLE_AXES;
+
+size_t countNodes(const TableGrid &grid) {
+    size_t n = 1;
+    for (int i = 0; i < N_TABLE_AXES; i++) {
+        n *= grid.n[i];
+    }
+    return n;
+}
+
+size_t countCells(const TableGrid &grid) {
+    size_t n = 1;
+    for (int i = 0; i < N_TABLE_AXES; i++) {
+        n *= grid.n[i] - 1;
+    }
+    return n;
+}
+
+bool validGrid(const TableGrid &grid) {
+    for (int i = 0; i < N_TABLE_AXES; i++) {
+        if (grid.n[i] < 2 || !(grid.hi[i] > grid.lo[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The cell holding `p`, its first node and the position of `p` within it
+// in [0, 1] along each axis. False outside the grid.
+bool locate(const TableGrid &grid, const double p[N_TABLE_AXES], size_t &cell, size_t &node,
+            double f[N_TABLE_AXES]) {
+    cell = 0;
+    node = 0;
+    for (int i = 0; i < N_TABLE_AXES; i++) {
+        double s = (p[i] - grid.lo[i]) / (grid.hi[i] - grid.lo[i]) * (grid.n[i] - 1);
+        if (!(s >= 0 && s <= grid.n[i] - 1)) {
+            return false;
+        }
+        uint32_t k = min((uint32_t) s, grid.n[i] - 2);
+        f[i] = s - k;
+        cell = cell * (grid.n[i] - 1) + k;
+        node = node * grid.n[i] + k;
+    }
+    return true;
+}
+
+void interpolate(const TableGrid &grid, const float *nodes, size_t node, const double f[N_TABLE_AXES],
+                 double &delta, double &a) {
+    size_t stride[N_TABLE_AXES];
+    stride[N_TABLE_AXES - 1] = 1;
+    for (int i = N_TABLE_AXES - 1; i > 0; i--) {
+        stride[i - 1] = stride[i] * grid.n[i];
+    }
+    delta = 0;
+    a = 0;
+    for (int corner = 0; corner < n_corners; corner++) {
+        double w = 1;
+        size_t k = node;
+        for (int i = 0; i < N_TABLE_AXES; i++) {
+            bool upper = (corner >> i) & 1;
+            w *= upper ? f[i] : 1 - f[i];
+            k += upper ? stride[i] : 0;
+        }
+        delta += w * nodes[2 * k];
+        a += w * nodes[2 * k + 1];
+    }
+}
+
+// Parameters of node `k`, or of the center of cell `k` if `center`.
+void gridPoint(const TableGrid &grid, size_t k, bool center, double p[N_TABLE_AXES]) {
+    for (int i = N_TABLE_AXES; i-- > 0;) {
+        uint32_t n = center ? grid.n[i] - 1 : grid.n[i];
+        double step = (grid.hi[i] - grid.lo[i]) / (grid.n[i] - 1);
+        p[i] = grid.lo[i] + (k % n + (center ? 0.5 : 0.0)) * step;
+        k /= n;
+    }
+}
+
+// Call `job` for every k in [0, count) on `n_threads` threads, the
+// caller's and low priority tasks of the TaskScheduler, each with its own
+// MPC.
+void forEachPoint(size_t n_threads, size_t count, const function<void(MPC &, Solution &, size_t)> &job) {
+    atomic<size_t> next(0);
+    auto work = [&] {
+        MPC mpc;
+        configureMpc(mpc);
+        Solution solution;
+        for (size_t k = next++; k < count; k = next++) {
+            job(mpc, solution, k);
+        }
+    };
+    auto helper = [&](size_t) { work(); };
+    TaskGroup helpers(TASK_LOW);
+    helpers.run(1, min(n_threads, count), helper);
+    work();
+    helpers.wait();
+}
+
+bool solveAt(MPC &mpc, const double p[N_TABLE_AXES], Solution &solution) {
+    StateVector state;
+    CubicCoeffs coeffs;
+    tableProblem(p, state, coeffs);
+    SolveStats stats;
+    mpc.Solve(state, coeffs, stats, Deadline::max(), solution);
+    return stats.ok();
+}
+
+} // namespace
+
+void tableProblem(const double p[N_TABLE_AXES], StateVector &state, CubicCoeffs &coeffs) {
+    // cte = f(0) and epsi = -atan(f'(0)) as in Controller::prepare.
+    double slope = -tan(p[TABLE_EPSI]);
+    state << 0, 0, 0, p[TABLE_V], p[TABLE_CTE], p[TABLE_EPSI];
+    coeffs << p[TABLE_CTE], slope, 0.5 * p[TABLE_CURVATURE] * pow(1 + slope * slope, 1.5), 0;
+}
+
+ControlTable::ControlTable() : nodes(nullptr), cells(nullptr), mapped(nullptr), mapped_size(0) {}
+
+ControlTable::~ControlTable() {
+    if (mapped) {
+        munmap(mapped, mapped_size);
+    }
+}
+
+bool ControlTable::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(TableHeader)) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    const TableHeader *header = (const TableHeader *) data;
+    bool ok = memcmp(header->magic, table_magic, sizeof(table_magic)) == 0 &&
+              header->n_axes == N_TABLE_AXES && header->node_size == 2 * sizeof(float) &&
+              validGrid(header->grid);
+    size_t n_nodes = ok ? countNodes(header->grid) : 0;
+    size_t n_cells = ok ? countCells(header->grid) : 0;
+    if (!ok || (size_t) st.st_size != sizeof(TableHeader) + n_nodes * header->node_size + n_cells) {
+        munmap(data, st.st_size);
+        return false;
+    }
+
+    if (mapped) {
+        munmap(mapped, mapped_size);
+    }
+    mapped = data;
+    mapped_size = st.st_size;
+    table_grid = header->grid;
+    nodes = (const float *) (header + 1);
+    cells = (const uint8_t *) (nodes + 2 * n_nodes);
+    return true;
+}
+
+bool ControlTable::lookup(const double p[N_TABLE_AXES], double &delta, double &a) const {
+    size_t cell, node;
+    double f[N_TABLE_AXES];
+    if (!nodes || !locate(table_grid, p, cell, node, f) || !cells[cell]) {
+        return false;
+    }
+    interpolate(table_grid, nodes, node, f, delta, a);
+    return true;
+}
+
+bool buildTable(const TableGrid &grid, size_t n_threads, double delta_tol, double a_tol,
+                const char *path, TableReport &report) {
+    report = TableReport();
+    if (!validGrid(grid)) {
+        return false;
+    }
+    report.nodes = countNodes(grid);
+    report.cells = countCells(grid);
+
+    // A failed node is NaN, which fails every cell around it below.
+    vector<float> nodes(2 * report.nodes);
+    forEachPoint(n_threads, report.nodes, [&](MPC &mpc, Solution &solution, size_t k) {
+        double p[N_TABLE_AXES];
+        gridPoint(grid, k, false, p);
+        bool ok = solveAt(mpc, p, solution);
+        nodes[2 * k] = ok ? solution.delta : NAN;
+        nodes[2 * k + 1] = ok ? solution.a : NAN;
+    });
+
+    vector<uint8_t> cells(report.cells);
+    vector<double> delta_errors(report.cells), a_errors(report.cells);
+    forEachPoint(n_threads, report.cells, [&](MPC &mpc, Solution &solution, size_t k) {
+        double p[N_TABLE_AXES], f[N_TABLE_AXES];
+        gridPoint(grid, k, true, p);
+        size_t cell, node;
+        double delta, a;
+        locate(grid, p, cell, node, f);
+        interpolate(grid, nodes.data(), node, f, delta, a);
+        if (!isfinite(delta) || !isfinite(a) || !solveAt(mpc, p, solution)) {
+            return;
+        }
+        delta_errors[k] = fabs(delta - solution.delta);
+        a_errors[k] = fabs(a - solution.a);
+        cells[k] = delta_errors[k] <= delta_tol && a_errors[k] <= a_tol;
+    });
+
+    for (size_t k = 0; k < report.nodes; k++) {
+        report.failed_nodes += !isfinite(nodes[2 * k]);
+    }
+    for (size_t k = 0; k < report.cells; k++) {
+        if (cells[k]) {
+            report.validated_cells++;
+            report.max_delta_error = fmax(report.max_delta_error, delta_errors[k]);
+            report.max_a_error = fmax(report.max_a_error, a_errors[k]);
+        }
+    }
+
+    TableHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, table_magic, sizeof(table_magic));
+    header.n_axes = N_TABLE_AXES;
+    header.node_size = 2 * sizeof(float);
+    header.grid = grid;
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(nodes.data(), sizeof(float), nodes.size(), file) == nodes.size() &&
+              fwrite(cells.data(), 1, cells.size(), file) == cells.size();
+    return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,90 @@
+#ifndef CONTROL_TABLE_H
+#define CONTROL_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include "MPC.h"
+
+using namespace std;
+
+// Parameters of a tabulated problem: the errors of the car against the
+// reference, its speed and the curvature of the reference at the car,
+// positive to the left.
+enum TableAxis {
+    TABLE_CTE,
+    TABLE_EPSI,
+    TABLE_V,
+    TABLE_CURVATURE,
+    N_TABLE_AXES
+};
+
+// A regular grid of `n[i]` >= 2 nodes from `lo[i]` to `hi[i]` on each axis.
+struct TableGrid {
+    double lo[N_TABLE_AXES];
+    double hi[N_TABLE_AXES];
+    uint32_t n[N_TABLE_AXES];
+};
+
+// The problem of parameters `p`: the car at the origin heading along x at
+// speed p[TABLE_V], and the parabola with the given offset, angle and
+// curvature at x = 0 as the reference.
+void tableProblem(const double p[N_TABLE_AXES], StateVector &state, CubicCoeffs &coeffs);
+
+// Explicit MPC: the first actuations of MPC::Solve tabulated on a grid
+// and interpolated multilinearly in between, see buildTable. Only cells
+// whose interpolation was checked against a solve at their center are
+// answered, the validated region; everything else is left to the online
+// solve.
+//
+// The table is mapped read-only from its file, so it is shared by every
+// controller of the process, and between processes by the page cache.
+class ControlTable {
+public:
+    ControlTable();
+
+    ~ControlTable();
+
+    // Map a table written by buildTable.
+    bool open(const char *path);
+
+    bool isOpen() const { return nodes != nullptr; }
+
+    const TableGrid &grid() const { return table_grid; }
+
+    // The actuations delta and a at `p`. False outside the validated
+    // region.
+    bool lookup(const double p[N_TABLE_AXES], double &delta, double &a) const;
+
+private:
+    TableGrid table_grid;
+    // delta and a of every node, the last axis fastest, and one byte per
+    // cell, nonzero if it is validated.
+    const float *nodes;
+    const uint8_t *cells;
+    void *mapped;
+    size_t mapped_size;
+
+    ControlTable(const ControlTable &) = delete;
+    ControlTable &operator=(const ControlTable &) = delete;
+};
+
+// How buildTable went.
+struct TableReport {
+    size_t nodes = 0;
+    size_t failed_nodes = 0;
+    size_t cells = 0;
+    size_t validated_cells = 0;
+    // Largest interpolation error at the center of a validated cell.
+    double max_delta_error = 0;
+    double max_a_error = 0;
+};
+
+// Solve every node of `grid` and the center of every cell, on `n_threads`
+// threads with an MPC each set up by configureMpc, from a cold start. A
+// cell is validated if none of its nodes failed and the interpolation at
+// its center is within `delta_tol` and `a_tol` of the solve there. Writes
+// the table to `path`.
+bool buildTable(const TableGrid &grid, size_t n_threads, double delta_tol, double a_tol,
+                const char *path, TableReport &report);
+
+#endif /* CONTROL_TABLE_H */
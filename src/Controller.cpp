@@ -0,0 +1,1476 @@
+#include "Controller.h"
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "BinaryProtocol.h"
+#include "ColumnTrace.h"
+#include "ControlTable.h"
+#include "ControllerState.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "GeometricControl.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "PathSpline.h"
+#include "PolyFit.h"
+#include "ShadowSolver.h"
+#include "Polynomial.h"
+#include "SteerMessage.h"
+#include "Trace.h"
+#include "LapCache.h"
+#include "Track.h"
+#include "VehicleModel.h"
+
+// For converting back and forth between radians and degrees.
+constexpr double pi() { return M_PI; }
+static double deg2rad(double x) { return x * pi() / 180; }
+
+// The rotation is computed once and applied to all points as array
+// operations straight on the waypoint vectors.
+void convertToCoordinates(double x, double y, double psi, const WaypointVector &ptsx, const WaypointVector &ptsy,
+                                 Eigen::VectorXd &xvals, Eigen::VectorXd &yvals) {
+    
+    assert(ptsx.size() == ptsy.size());
+    unsigned len = ptsx.size();
+    
+    xvals.resize(len);
+    yvals.resize(len);
+    
+    double c = cos(psi);
+    double s = sin(psi);
+    Eigen::Map<const Eigen::ArrayXd> px(ptsx.data(), len);
+    Eigen::Map<const Eigen::ArrayXd> py(ptsy.data(), len);
+    xvals.array() = c * (px - x) + s * (py - y);
+    yvals.array() = -s * (px - x) + c * (py - y);
+}
+
+// Set the frame of the window to the first of the waypoints ptsx, ptsy
+// with the x axis towards their last, and fit them from scratch in it.
+static void anchorWindow(ControlFrame &frame, const WaypointVector &ptsx, const WaypointVector &ptsy) {
+    size_t n = ptsx.size();
+    frame.window_ox = ptsx[0];
+    frame.window_oy = ptsy[0];
+    frame.window_heading = atan2(ptsy[n - 1] - ptsy[0], ptsx[n - 1] - ptsx[0]);
+    frame.window_first = 0;
+    frame.window_slid = 0;
+    double c = cos(frame.window_heading);
+    double s = sin(frame.window_heading);
+    frame.has_window_fit = true;
+    for (size_t i = 0; i < n; i++) {
+        frame.window_u[i] = c * (ptsx[i] - ptsx[0]) + s * (ptsy[i] - ptsy[0]);
+        frame.window_w[i] = -s * (ptsx[i] - ptsx[0]) + c * (ptsy[i] - ptsy[0]);
+        frame.has_window_fit &= i == 0 || frame.window_u[i] > frame.window_u[i - 1];
+    }
+    if (frame.has_window_fit) {
+        // Scaled like polyfitFixed; the abscissas grow to about twice that
+        // before the window is anchored again.
+        frame.window_sums = PolyFit<3>(frame.window_u[n - 1]);
+        frame.window_sums.add(frame.window_u.data(), frame.window_w.data(), n);
+        frame.window_fit = frame.window_sums.solve();
+    }
+}
+
+// Points the waypoints ptsx, ptsy advanced by since those of the fit in
+// `frame`, when they are the same but for that many dropped at the front
+// and as many new ones at the back, or 0. The frame of the window is kept
+// for fewer than the points of the window in all, so the sums do not carry
+// the rounding of their updates for long.
+static size_t windowShift(const ControlFrame &frame, const WaypointVector &ptsx, const WaypointVector &ptsy) {
+    size_t n = ptsx.size();
+    if (!frame.has_window_fit || frame.window_x.size() != n) {
+        return 0;
+    }
+    for (size_t k = 1; frame.window_slid + k < n; k++) {
+        if (equal(ptsx.begin(), ptsx.end() - k, frame.window_x.begin() + k) &&
+            equal(ptsy.begin(), ptsy.end() - k, frame.window_y.begin() + k)) {
+            return k;
+        }
+    }
+    return 0;
+}
+
+// Advance the fit in `frame` by the `k` points of windowShift: the oldest
+// ones leave its sums and the new ones enter them, in the frame of the
+// window, and the cubic is solved from them. False when a new point does
+// not advance along the frame's axis; the fit has to be anchored again.
+static bool slideWindow(ControlFrame &frame, const WaypointVector &ptsx, const WaypointVector &ptsy, size_t k) {
+    const size_t capacity = ControlFrame::max_window_points;
+    size_t n = ptsx.size();
+    for (size_t i = 0; i < k; i++) {
+        size_t j = frame.window_first;
+        frame.window_sums.remove(frame.window_u[j], frame.window_w[j]);
+        frame.window_first = (j + 1) % capacity;
+    }
+    double c = cos(frame.window_heading);
+    double s = sin(frame.window_heading);
+    double last = frame.window_u[(frame.window_first + n - k - 1) % capacity];
+    for (size_t i = n - k; i < n; i++) {
+        double u = c * (ptsx[i] - frame.window_ox) + s * (ptsy[i] - frame.window_oy);
+        double w = -s * (ptsx[i] - frame.window_ox) + c * (ptsy[i] - frame.window_oy);
+        if (!(u > last)) {
+            return false;
+        }
+        size_t j = (frame.window_first + i) % capacity;
+        frame.window_u[j] = u;
+        frame.window_w[j] = w;
+        frame.window_sums.add(u, w);
+        last = u;
+    }
+    frame.window_slid += k;
+    frame.window_fit = frame.window_sums.solve();
+    return true;
+}
+
+// The reference for a car at (px, py) heading psi from the waypoints ptsx,
+// ptsy in map coordinates, fitted in the frame of the window and kept in
+// `frame` for as long as the simulator sends the same ones, or updated
+// point by point as they advance: the fit is then only rotated into the
+// vehicle frame, as the third order expansion about the car's abscissa
+// like PathSpline::localCubic. Fails when the waypoints do not advance
+// along their chord, there are more than ControlFrame::max_window_points
+// of them or the car faces away from them.
+static bool windowCubic(ControlFrame &frame, const WaypointVector &ptsx, const WaypointVector &ptsy,
+                        double px, double py, double psi, CubicCoeffs &coeffs) {
+    size_t n = ptsx.size();
+    if (n < 4 || n > ControlFrame::max_window_points) {
+        return false;
+    }
+    if (!frame.has_window_fit || frame.window_x != ptsx || frame.window_y != ptsy) {
+        size_t k = windowShift(frame, ptsx, ptsy);
+        if (k == 0 || !slideWindow(frame, ptsx, ptsy, k)) {
+            anchorWindow(frame, ptsx, ptsy);
+        }
+        frame.window_x = ptsx;
+        frame.window_y = ptsy;
+    }
+    if (!frame.has_window_fit) {
+        return false;
+    }
+    
+    // The fit at the car's abscissa and its derivatives, in the window
+    // frame, then turned into the vehicle frame.
+    double c = cos(frame.window_heading);
+    double s = sin(frame.window_heading);
+    double u = c * (px - frame.window_ox) + s * (py - frame.window_oy);
+    double w[4];
+    polyDerivatives<3>(frame.window_fit, u, w);
+    double dx = frame.window_ox + c * u - s * w[0] - px;
+    double dy = frame.window_oy + s * u + c * w[0] - py;
+    double a = frame.window_heading - psi;
+    double ca = cos(a);
+    double sa = sin(a);
+    double cp = cos(psi);
+    double sp = sin(psi);
+    double x0 = cp * dx + sp * dy;
+    double y0 = -sp * dx + cp * dy;
+    return curveCubic(x0, y0, ca - sa * w[1], sa + ca * w[1], -sa * w[2], ca * w[2], -sa * w[3], ca * w[3],
+                      coeffs.data());
+}
+
+// Waypoints taken from the map, as many as the simulator sends.
+static const size_t map_window = 6;
+
+// Stretch of the map read ahead of the car, see Track::prefetch: the
+// distance covered in this many seconds at its speed, and this much more.
+static const double map_prefetch_time = 10;
+static const double map_prefetch_margin = 100;
+
+// Spacing of the samples of a speed profile, see Controller::prepare: its
+// 64 reach 250 m ahead, as far as 20 stages of 0.1 s go at 125 m/s.
+static const double profile_spacing = 4;
+
+// One control period of the simulator.
+static const chrono::microseconds default_deadline_budget(100000);
+
+// Solve time the adaptive horizon aims below unless MPC_ADAPTIVE_HORIZON
+// names one, half a control period to leave room for the rest of the cycle.
+static const chrono::microseconds default_adaptive_target(50000);
+
+// Smoothing of the solve time and cycles to wait after a switch before
+// judging the new horizon.
+static const double solve_time_smoothing = 0.2;
+static const size_t adaptive_hold = 10;
+
+// See Controller::setSpeculationTolerance.
+static const double default_speculation_tolerance = 0.005;
+
+// Names of the backends, for MPC_SOLVER and the solver of a connection.
+static const struct {
+    const char *name;
+    SolverBackend backend;
+} backend_names[] = {
+    {"cppad", CPPAD_IPOPT}, {"taped", TAPED_IPOPT}, {"kinematic", KINEMATIC_IPOPT}, {"rti", SQP_RTI},
+    {"mppi", MPPI}, {"cgmres", CGMRES}, {"geometric", GEOMETRIC},
+};
+
+bool parseBackend(const string &name, SolverBackend &backend) {
+    for (const auto &entry : backend_names) {
+        if (name == entry.name) {
+            backend = entry.backend;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *backendName(SolverBackend backend) {
+    for (const auto &entry : backend_names) {
+        if (entry.backend == backend) {
+            return entry.name;
+        }
+    }
+    return "unknown";
+}
+
+// Backend named by MPC_SOLVER, the hand-derived IPOPT problem by default.
+static SolverBackend parseBackend(const char *s) {
+    SolverBackend backend = KINEMATIC_IPOPT;
+    if (s != nullptr) {
+        parseBackend(s, backend);
+    }
+    return backend;
+}
+
+// Model named by MPC_MODEL, the polynomial one by default.
+static ModelVariant parseModel(const char *s) {
+    if (s != nullptr && strcmp(s, "frenet") == 0) {
+        return FRENET_MODEL;
+    }
+    if (s != nullptr && strcmp(s, "reduced") == 0) {
+        return REDUCED_FRENET_MODEL;
+    }
+    return CARTESIAN_MODEL;
+}
+
+// Formulation named by MPC_FORMULATION, multiple shooting by default.
+static Formulation parseFormulation(const char *s) {
+    if (s != nullptr && strcmp(s, "single") == 0) {
+        return SINGLE_SHOOTING;
+    }
+    return MULTIPLE_SHOOTING;
+}
+
+// QP of the RTI steps named by MPC_RTI_QP, Riccati or condensed by
+// default.
+static RtiQp parseRtiQp(const char *s) {
+    if (strcmp(s, "active-set") == 0) {
+        return RTI_QP_ACTIVE_SET;
+    }
+    if (strcmp(s, "sparse") == 0) {
+        return RTI_QP_SPARSE;
+    }
+    return RTI_QP_DEFAULT;
+}
+
+// IPOPT settings from MPC_LINEAR_SOLVER, MPC_MU_STRATEGY, MPC_TOL,
+// MPC_ACCEPTABLE_TOL, MPC_HESSIAN (exact or limited-memory), MPC_BOUND_PUSH
+// and MPC_SCALING (gradient-based or user), IPOPT's defaults for those not set, and those
+// of the other backends from
+// MPC_EVAL_THREADS, MPC_MPPI_SAMPLES, MPC_MPPI_GPU,
+// MPC_CGMRES_DIRECTIONS, MPC_PRECISION, MPC_RTI_ITERATIONS, MPC_RTI_QP,
+// MPC_WARM_LIBRARY, MPC_SOLUTION_CACHE, MPC_MULTI_START, MPC_PREDICTOR,
+// MPC_GEOMETRIC (pursuit or stanley), MPC_COST_BREAKDOWN, MPC_TERMINAL_COST,
+// MPC_SOFT_PENALTY, MPC_CONTROL_TOL (<tol>[:<iterations>]) and MPC_LAYOUT
+// (block or stage).
+static MpcOptions parseOptions() {
+    MpcOptions options;
+    if (const char *s = getenv("MPC_LINEAR_SOLVER")) {
+        options.linear_solver = s;
+    }
+    if (const char *s = getenv("MPC_MU_STRATEGY")) {
+        options.mu_strategy = s;
+    }
+    if (const char *s = getenv("MPC_TOL")) {
+        options.tol = atof(s);
+    }
+    if (const char *s = getenv("MPC_ACCEPTABLE_TOL")) {
+        options.acceptable_tol = atof(s);
+    }
+    if (const char *s = getenv("MPC_HESSIAN")) {
+        options.exact_hessian = strcmp(s, "limited-memory") != 0;
+    }
+    if (const char *s = getenv("MPC_BOUND_PUSH")) {
+        options.bound_push = atof(s);
+    }
+    if (const char *s = getenv("MPC_SCALING")) {
+        options.user_scaling = strcmp(s, "user") == 0;
+    }
+    if (const char *s = getenv("MPC_EVAL_THREADS")) {
+        options.eval_threads = strtoul(s, nullptr, 10);
+    }
+    if (const char *s = getenv("MPC_MPPI_SAMPLES")) {
+        options.mppi_samples = strtoul(s, nullptr, 10);
+    }
+    if (const char *s = getenv("MPC_MPPI_GPU")) {
+        options.mppi_gpu = strcmp(s, "1") == 0;
+    }
+    if (const char *s = getenv("MPC_CGMRES_DIRECTIONS")) {
+        options.cgmres_directions = max(1, atoi(s));
+    }
+    if (const char *s = getenv("MPC_PRECISION")) {
+        options.single_precision = strcmp(s, "single") == 0;
+    }
+    if (const char *s = getenv("MPC_WARM_LIBRARY")) {
+        options.warm_library = strtoul(s, nullptr, 10);
+    }
+    if (const char *s = getenv("MPC_SOLUTION_CACHE")) {
+        options.solution_cache = strtoul(s, nullptr, 10);
+    }
+    if (const char *s = getenv("MPC_MULTI_START")) {
+        options.multi_start = max(1ul, strtoul(s, nullptr, 10));
+    }
+    if (const char *s = getenv("MPC_RTI_ITERATIONS")) {
+        options.rti_iterations = max(1, atoi(s));
+    }
+    if (const char *s = getenv("MPC_PREDICTOR")) {
+        options.predictor = strcmp(s, "1") == 0;
+    }
+    if (const char *s = getenv("MPC_RTI_QP")) {
+        options.rti_qp = parseRtiQp(s);
+    }
+    if (const char *s = getenv("MPC_GEOMETRIC")) {
+        options.geometric_law = strcmp(s, "stanley") == 0 ? GEOMETRIC_STANLEY : GEOMETRIC_PURSUIT;
+    }
+    if (const char *s = getenv("MPC_COST_BREAKDOWN")) {
+        options.cost_breakdown = strcmp(s, "1") == 0;
+    }
+    if (const char *s = getenv("MPC_TERMINAL_COST")) {
+        options.terminal_cost = strcmp(s, "1") == 0;
+    }
+    if (const char *s = getenv("MPC_SOFT_PENALTY")) {
+        options.soft_penalty = atof(s);
+    }
+    if (const char *s = getenv("MPC_LAYOUT")) {
+        options.interleaved_layout = strcmp(s, "stage") == 0;
+    }
+    if (const char *s = getenv("MPC_CONTROL_TOL")) {
+        sscanf(s, "%lf:%d", &options.control_tol, &options.control_iterations);
+        options.control_iterations = max(1, options.control_iterations);
+    }
+    return options;
+}
+
+void configureMpc(MPC &mpc) {
+    mpc.setBackend(parseBackend(getenv("MPC_SOLVER")));
+    mpc.setModel(parseModel(getenv("MPC_MODEL")));
+    mpc.setFormulation(parseFormulation(getenv("MPC_FORMULATION")));
+    mpc.setOptions(parseOptions());
+}
+
+// The weights of CostWeights by name, for parseVariant.
+static const struct {
+    const char *name;
+    double CostWeights::*weight;
+} weight_names[] = {
+    {"cte", &CostWeights::cte}, {"epsi", &CostWeights::epsi}, {"v", &CostWeights::v},
+    {"delta", &CostWeights::delta}, {"a", &CostWeights::a}, {"ddelta", &CostWeights::ddelta},
+    {"da", &CostWeights::da},
+};
+
+// `s` as a number into `x`; false unless all of it is one.
+static bool parseNumber(const string &s, double &x) {
+    char *end;
+    x = strtod(s.c_str(), &end);
+    return !s.empty() && *end == '\0';
+}
+
+bool parseVariant(const string &spec, ControllerVariant &variant) {
+    variant = ControllerVariant();
+    variant.options = parseOptions();
+    size_t begin = 0;
+    while (begin < spec.size()) {
+        size_t end = min(spec.find(',', begin), spec.size());
+        string pair = spec.substr(begin, end - begin);
+        begin = end + 1;
+        size_t eq = pair.find('=');
+        if (eq == string::npos) {
+            return false;
+        }
+        string key = pair.substr(0, eq), value = pair.substr(eq + 1);
+        double x = 0;
+        bool number = parseNumber(value, x);
+        bool found = false;
+        for (const auto &entry : weight_names) {
+            if (key == entry.name) {
+                if (!number) {
+                    return false;
+                }
+                variant.weights.*entry.weight = x;
+                variant.has_weights = found = true;
+            }
+        }
+        if (found) {
+            continue;
+        }
+        if (key == "solver") {
+            if (!parseBackend(value, variant.backend)) {
+                return false;
+            }
+            variant.has_backend = true;
+            continue;
+        }
+        if (key == "linear_solver") {
+            variant.options.linear_solver = value;
+        } else if (key == "mu_strategy") {
+            variant.options.mu_strategy = value;
+        } else if (key == "hessian") {
+            variant.options.exact_hessian = value != "limited-memory";
+        } else if (key == "geometric") {
+            variant.options.geometric_law = value == "stanley" ? GEOMETRIC_STANLEY : GEOMETRIC_PURSUIT;
+        } else if (!number || x < 0) {
+            return false;
+        } else if (key == "horizon") {
+            variant.horizon = (size_t) x;
+            continue;
+        } else if (key == "tol") {
+            variant.options.tol = x;
+        } else if (key == "acceptable_tol") {
+            variant.options.acceptable_tol = x;
+        } else if (key == "bound_push") {
+            variant.options.bound_push = x;
+        } else if (key == "control_tol") {
+            variant.options.control_tol = x;
+        } else if (key == "rti_iterations") {
+            variant.options.rti_iterations = max(1, (int) x);
+        } else if (key == "mppi_samples") {
+            variant.options.mppi_samples = (size_t) x;
+        } else if (key == "cgmres_directions") {
+            variant.options.cgmres_directions = max(1, (int) x);
+        } else {
+            return false;
+        }
+        variant.has_options = true;
+    }
+    return true;
+}
+
+bool readVariant(const char *path, ControllerVariant &variant) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    string spec;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        string pair;
+        for (const char *c = line; *c && *c != '#'; c++) {
+            if (!isspace((unsigned char) *c)) {
+                pair += *c;
+            }
+        }
+        if (!pair.empty()) {
+            spec += (spec.empty() ? "" : ",") + pair;
+        }
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok && parseVariant(spec, variant);
+}
+
+Controller::Controller()
+    : deadline_budget(default_deadline_budget), last_steering(0.0), last_throttle(0.0),
+      adaptive_min(0), adaptive_max(0), adaptive_target(default_adaptive_target),
+      solve_time(0), adaptive_cycles(0),
+      wire_format(WIRE_JSON), visualization_period(1), visualization_replies(0), visualization_requested(false),
+      split_visualization(false), visualization_pending(false), pending_predicted(0), reference_samples(0),
+      map(nullptr), table(nullptr), reference(nullptr), profile_track(nullptr), fleet(nullptr), fleet_vehicle(0),
+      lap_spacing(0), has_reply_plan(false),
+      tier(TIER_FULL), tier_cap(TIER_FULL), tier_frames(0), bad_solves(0), full_horizon(DefaultConfig::N),
+      shadow_backend(SQP_RTI), has_speculation(false), speculation_tolerance(default_speculation_tolerance),
+      speculating(false), solving(false),
+      traced(ColumnTrace::enabled()), trace_source(traced ? ColumnTrace::nextSource() : 0) {
+    mpc.setWarmStart(true);
+    configureMpc(mpc);
+    
+    // MPC_ADAPTIVE_HORIZON=min:max[:target_ms], see setAdaptiveHorizon.
+    if (const char *s = getenv("MPC_ADAPTIVE_HORIZON")) {
+        unsigned long min_N = 0, max_N = 0;
+        double target_ms = default_adaptive_target.count() * 1e-3;
+        if (sscanf(s, "%lu:%lu:%lf", &min_N, &max_N, &target_ms) >= 2) {
+            setAdaptiveHorizon(min_N, max_N, chrono::microseconds((long long) (target_ms * 1e3)));
+        }
+    }
+    
+    // MPC_LAP_CACHE=<spacing>, see setLapCache.
+    if (const char *s = getenv("MPC_LAP_CACHE")) {
+        setLapCache(atof(s));
+    }
+    
+    // MPC_VISUALIZE=<period>[:<samples>], see setVisualization and
+    // setReferenceSamples.
+    if (const char *s = getenv("MPC_VISUALIZE")) {
+        unsigned long period = 1, samples = 0;
+        if (sscanf(s, "%lu:%lu", &period, &samples) >= 1) {
+            setVisualization(period);
+            setReferenceSamples(samples);
+        }
+    }
+    
+    // MPC_SPLIT_VISUALIZATION=1, see setSplitVisualization.
+    if (const char *s = getenv("MPC_SPLIT_VISUALIZATION")) {
+        setSplitVisualization(strcmp(s, "0") != 0);
+    }
+    
+    // MPC_STEER_DECIMALS=<points>[:<actuators>], see setSteerPrecision.
+    if (const char *s = getenv("MPC_STEER_DECIMALS")) {
+        SteerPrecision precision;
+        if (sscanf(s, "%d:%d", &precision.points, &precision.actuators) >= 1) {
+            setSteerPrecision(precision);
+        }
+    }
+    
+    // MPC_SHADOW=<solver>, see setShadow.
+    if (const char *s = getenv("MPC_SHADOW")) {
+        SolverBackend backend;
+        if (parseBackend(s, backend)) {
+            setShadow(true, backend);
+        } else {
+            MPC_LOG(LOG_WARN, "Unknown shadow solver %s", s);
+        }
+    }
+    
+    // MPC_DEGRADE=<failures>[:<recovery>[:<budget_ms>]], see setDegradation.
+    if (const char *s = getenv("MPC_DEGRADE")) {
+        DegradationPolicy policy;
+        unsigned long failures = 0, recovery = policy.recovery;
+        double budget_ms = 0;
+        if (sscanf(s, "%lu:%lu:%lf", &failures, &recovery, &budget_ms) >= 1) {
+            policy.failures = failures;
+            policy.recovery = recovery;
+            policy.budget = budget_ms / 1000;
+            setDegradation(policy);
+        }
+    }
+}
+
+Controller::~Controller() {}
+
+void Controller::reset() {
+    setTier(TIER_FULL);
+    mpc.resetWarmStart();
+    has_speculation = false;
+}
+
+void Controller::setShadow(bool enabled, SolverBackend backend) {
+    shadow.reset();
+    shadow_backend = backend;
+    if (enabled) {
+        shadow.reset(new ShadowSolver(backend, mpc.getCostWeights()));
+    }
+}
+
+void Controller::setDegradation(const DegradationPolicy &policy) {
+    setTier(TIER_FULL);
+    degradation = policy;
+}
+
+// The longest compiled horizon shorter than N, 0 if there is none.
+static size_t shorterHorizon(size_t N) {
+    size_t shorter = 0;
+    for (size_t i = 0; i < n_compiled_horizons; i++) {
+        if (compiled_horizons[i] < N) {
+            shorter = compiled_horizons[i];
+        }
+    }
+    return shorter;
+}
+
+void Controller::setTierCap(ControlTier cap) {
+    size_t horizon = tier == TIER_FULL ? mpc.getHorizon() : full_horizon;
+    if (cap == TIER_REDUCED && shorterHorizon(horizon) == 0) {
+        cap = TIER_LQR;
+    }
+    if (cap == tier_cap) {
+        return;
+    }
+    bool lifted = cap < tier_cap;
+    tier_cap = cap;
+    if (tier < cap || lifted) {
+        setTier(cap);
+    }
+}
+
+void Controller::setTier(ControlTier next) {
+    if (next < tier_cap) {
+        next = tier_cap;
+    }
+    if (next == tier) {
+        return;
+    }
+    MPC_LOG(LOG_INFO, "Control tier %d -> %d", tier, next);
+    if (tier == TIER_FULL) {
+        full_horizon = mpc.getHorizon();
+    }
+    size_t N = next == TIER_FULL ? full_horizon : next == TIER_REDUCED ? shorterHorizon(full_horizon) : 0;
+    if (N != 0 && N != mpc.getHorizon()) {
+        mpc.setHorizon(N);
+        mpc.seedWarmStart(solution);
+    }
+    if (next >= TIER_LQR) {
+        has_speculation = false;
+    }
+    tier = next;
+    tier_frames = 0;
+    bad_solves = 0;
+    Metrics::recordTier(next);
+}
+
+bool Controller::degradedControl(const ControlFrame &frame, double &delta, double &a) {
+    if (tier < TIER_LQR) {
+        return false;
+    }
+    double cte, epsi, curvature;
+    referenceErrors(frame.coeffs, frame.state[0], frame.state[1], frame.state[2], cte, epsi, curvature);
+    bool far = fabs(cte) > degradation.pursuit_cte || fabs(epsi) > degradation.pursuit_epsi;
+    bool near = fabs(cte) < 0.5 * degradation.pursuit_cte && fabs(epsi) < 0.5 * degradation.pursuit_epsi;
+    if (tier == TIER_LQR && far) {
+        setTier(TIER_PURSUIT);
+    } else if (tier == TIER_PURSUIT && near) {
+        setTier(TIER_LQR);
+    } else if (tier == TIER_LQR && tier_cap < TIER_LQR && ++tier_frames > degradation.recovery) {
+        // Try solving again, over the short horizon first.
+        setTier(shorterHorizon(full_horizon) != 0 ? TIER_REDUCED : TIER_FULL);
+        return false;
+    }
+    if (tier == TIER_PURSUIT) {
+        pursuitControl(frame, delta, a);
+    } else {
+        lqrControl(frame, delta, a);
+        a = min(a, degradation.degraded_speed - frame.state[3]);
+    }
+    return true;
+}
+
+void Controller::gradeSolve(const SolveStats &stats) {
+    if (degradation.failures == 0) {
+        return;
+    }
+    double budget = degradation.budget > 0 ? degradation.budget : chrono::duration<double>(deadline_budget).count();
+    bool bad = !stats.ok() || (budget > 0 && stats.wall_time > budget);
+    bad_solves = bad ? bad_solves + 1 : 0;
+    tier_frames = bad ? 0 : tier_frames + 1;
+    if (bad_solves >= degradation.failures) {
+        setTier(tier == TIER_FULL && shorterHorizon(mpc.getHorizon()) != 0 ? TIER_REDUCED : TIER_LQR);
+    } else if (tier == TIER_REDUCED && tier_frames > degradation.recovery) {
+        setTier(TIER_FULL);
+    }
+}
+
+void Controller::setDeadlineBudget(chrono::microseconds budget) {
+    deadline_budget = budget;
+}
+
+bool Controller::setHorizon(size_t N) {
+    has_speculation = false;
+    return mpc.setHorizon(N);
+}
+
+size_t Controller::getHorizon() const {
+    return mpc.getHorizon();
+}
+
+void Controller::setAdaptiveHorizon(size_t min_N, size_t max_N, chrono::microseconds target) {
+    adaptive_min = min_N;
+    adaptive_max = max_N;
+    adaptive_target = target;
+    adaptive_cycles = 0;
+    
+    // Start from the shortest horizon within the bounds.
+    size_t N = mpc.getHorizon();
+    if (min_N != 0 && (N < min_N || N > max_N)) {
+        for (size_t i = 0; i < n_compiled_horizons; i++) {
+            if (compiled_horizons[i] >= min_N && compiled_horizons[i] <= max_N) {
+                mpc.setHorizon(compiled_horizons[i]);
+                break;
+            }
+        }
+    }
+}
+
+void Controller::adaptHorizon(double wall_time) {
+    if (adaptive_min == 0) {
+        return;
+    }
+    solve_time = adaptive_cycles == 0 ? wall_time
+                                      : solve_time + solve_time_smoothing * (wall_time - solve_time);
+    if (++adaptive_cycles < adaptive_hold) {
+        return;
+    }
+    
+    // The compiled horizons next to the current one, if within the bounds.
+    size_t N = mpc.getHorizon();
+    size_t shorter = 0;
+    size_t longer = 0;
+    for (size_t i = 0; i < n_compiled_horizons; i++) {
+        size_t M = compiled_horizons[i];
+        if (M < N && M >= adaptive_min) {
+            shorter = M;
+        }
+        if (M > N && M <= adaptive_max && longer == 0) {
+            longer = M;
+        }
+    }
+    
+    // The solve time grows faster than the horizon, with more stages that
+    // also tend to take more iterations, so the longer one is estimated
+    // quadratically.
+    double target = chrono::duration<double>(adaptive_target).count();
+    double growth = (double) longer / N;
+    size_t next = N;
+    if (solve_time > target && shorter != 0) {
+        next = shorter;
+    } else if (longer != 0 && solve_time * growth * growth < 0.5 * target) {
+        next = longer;
+    }
+    if (next == N) {
+        return;
+    }
+    
+    MPC_LOG(LOG_INFO, "Horizon %zu -> %zu (solve time %.1f ms)", N, next, solve_time * 1e3);
+    mpc.setHorizon(next);
+    mpc.seedWarmStart(solution);
+    adaptive_cycles = 0;
+}
+
+void Controller::setCostWeights(const CostWeights &weights) {
+    mpc.setCostWeights(weights);
+    lqr.build(weights);
+    if (shadow) {
+        shadow.reset(new ShadowSolver(shadow_backend, weights));
+    }
+    has_speculation = false;
+}
+
+void Controller::setOptions(const MpcOptions &options) {
+    mpc.setOptions(options);
+    has_speculation = false;
+}
+
+void Controller::setFormulation(Formulation formulation) {
+    mpc.setFormulation(formulation);
+    has_speculation = false;
+}
+
+void Controller::setBackend(SolverBackend backend) {
+    mpc.setBackend(backend);
+    has_speculation = false;
+}
+
+bool Controller::configure(const ControllerVariant &variant) {
+    if (variant.has_backend) {
+        setBackend(variant.backend);
+    }
+    if (variant.has_options) {
+        setOptions(variant.options);
+    }
+    if (variant.has_weights) {
+        setCostWeights(variant.weights);
+    }
+    return variant.horizon == 0 || setHorizon(variant.horizon);
+}
+
+void Controller::setSpeculationTolerance(double tolerance) {
+    speculation_tolerance = tolerance;
+}
+
+void Controller::snapshot(ControllerSnapshot &out) const {
+    // Marked invalid for the duration, in case the process dies halfway.
+    out.valid = 0;
+    atomic_signal_fence(memory_order_seq_cst);
+    out.horizon = mpc.getHorizon();
+    out.solve_time = solve_time;
+    out.n_stages = solution.n_stages;
+    copy(solution.stages.begin(), solution.stages.begin() + solution.n_stages, out.stages);
+    atomic_signal_fence(memory_order_seq_cst);
+    out.valid = 1;
+}
+
+bool Controller::restore(const ControllerSnapshot &in) {
+    if (!in.valid || in.n_stages < 2 || in.n_stages > max_horizon) {
+        return false;
+    }
+    bool adaptive = adaptive_min != 0;
+    if (adaptive && in.horizon >= adaptive_min && in.horizon <= adaptive_max && in.horizon != mpc.getHorizon()) {
+        mpc.setHorizon(in.horizon);
+    }
+    if (adaptive) {
+        solve_time = in.solve_time;
+    }
+    
+    solution.n_stages = in.n_stages;
+    copy(in.stages, in.stages + in.n_stages, solution.stages.begin());
+    mpc.seedWarmStart(solution);
+    has_speculation = false;
+    return true;
+}
+
+void Controller::exportContext(ControllerContext &out) const {
+    snapshot(out.snapshot);
+    size_t fallbacks;
+    mpc.getWarmStart(out.warm_start, fallbacks);
+    out.fallbacks = fallbacks;
+    mpc.getDuals(out.duals);
+    out.lap_plans.clear();
+    if (lap_cache) {
+        lap_cache->exportPlans(out.lap_plans);
+    }
+}
+
+bool Controller::importContext(const ControllerContext &in) {
+    if (!restore(in.snapshot)) {
+        return false;
+    }
+    // restore() seeded the warm start from the plan already, which stands
+    // for one of another horizon.
+    if (!in.warm_start.empty()) {
+        mpc.restoreWarmStart(in.warm_start, in.fallbacks);
+    }
+    mpc.restoreDuals(in.duals);
+    if (lap_cache && !in.lap_plans.empty()) {
+        lap_cache->importPlans(in.lap_plans);
+    }
+    return true;
+}
+
+void Controller::setWireFormat(WireFormat format) {
+    wire_format = format;
+}
+
+void Controller::setVisualization(size_t period) {
+    visualization_period = period;
+    visualization_replies = 0;
+}
+
+void Controller::requestVisualization() {
+    visualization_requested = true;
+}
+
+void Controller::setSplitVisualization(bool split) {
+    split_visualization = split;
+    visualization_pending = false;
+}
+
+bool Controller::writeVisualization(const ControlFrame &frame, string &out) {
+    if (!visualization_pending) {
+        return false;
+    }
+    visualization_pending = false;
+    writeSteerEvent(frame, pending_predicted, true, out);
+    return true;
+}
+
+void Controller::setReferenceSamples(size_t n) {
+    reference_samples = n;
+}
+
+void Controller::setSteerPrecision(const SteerPrecision &precision) {
+    steer_precision = precision;
+}
+
+void Controller::setTable(const ControlTable *table) {
+    this->table = table;
+}
+
+void Controller::setFleet(FleetHash *fleet, uint32_t vehicle, double radius, double weight) {
+    this->fleet = fleet;
+    fleet_vehicle = vehicle;
+    obstacles.radius = radius;
+    obstacles.weight = weight;
+    obstacles.points.clear();
+    fleet_x.clear();
+    fleet_y.clear();
+    mpc.setObstacles(fleet ? &obstacles : nullptr);
+}
+
+void Controller::setLapCache(double spacing) {
+    lap_spacing = spacing;
+    lap_cache.reset(map && spacing > 0 ? new LapCache(*map, spacing) : nullptr);
+}
+
+void Controller::fleetObstacles(const ControlFrame &frame) {
+    obstacles.points.clear();
+    if (fleet_x.empty()) {
+        return;
+    }
+    fleet->near(fleet_vehicle, fleet_x.data(), fleet_y.data(), fleet_x.size(), obstacles.points);
+    // Into the vehicle frame of the telemetry, that of the state.
+    const Telemetry &pose = frame.telemetry;
+    double c = cos(pose.psi);
+    double s = sin(pose.psi);
+    for (StageObstacle &o : obstacles.points) {
+        double dx = o.x - pose.x;
+        double dy = o.y - pose.y;
+        o.x = c * dx + s * dy;
+        o.y = -s * dx + c * dy;
+    }
+}
+
+void Controller::publishPlan(const ControlFrame &frame) {
+    const Telemetry &pose = frame.telemetry;
+    double c = cos(pose.psi);
+    double s = sin(pose.psi);
+    fleet_x.resize(solution.n_stages);
+    fleet_y.resize(solution.n_stages);
+    for (size_t t = 0; t < solution.n_stages; t++) {
+        const PredictedStage &stage = solution.stages[t];
+        fleet_x[t] = pose.x + c * stage.x - s * stage.y;
+        fleet_y[t] = pose.y + s * stage.x + c * stage.y;
+    }
+    fleet->publish(fleet_vehicle, fleet_x.data(), fleet_y.data(), fleet_x.size());
+}
+
+void Controller::setMap(const Track *map) {
+    this->map = map;
+    setLapCache(lap_spacing);
+}
+
+void Controller::setReference(const PathSpline *path) {
+    reference = path;
+}
+
+void Controller::setSpeedProfile(const Track *track) {
+    profile_track = track && track->hasSpeedProfile() ? track : nullptr;
+}
+
+void Controller::step(const Telemetry &telemetry, string &reply) {
+    ScopedTimer step_timer(STAGE_STEP);
+    prepare(telemetry, frame);
+    solve(frame, reply);
+}
+
+void predictState(const Telemetry &telemetry, const CubicCoeffs &coeffs, StateVector &state) {
+    double v = telemetry.speed * 0.447;
+    
+    // calculate the cross track error
+    double cte = polyeval(coeffs, 0.0);
+    
+    // calculate the orientation error
+    double epsi = -atan(coeffs[1]);
+    
+    // use the model of the optimizer to predict the state at the end of
+    // the actuation delay, from the car at the origin under the actuations
+    // last applied. The simulator steers right for positive angles.
+    const double now[6] = {0.0, 0.0, 0.0, v, cte, epsi};
+    double actual[6];
+    vehicleStep(now, -telemetry.steering_angle, telemetry.throttle, coeffs, telemetry.delay, actual);
+    
+    // state in vehicle coordinates
+    state << actual[0], actual[1], actual[2], actual[3], actual[4], actual[5];
+}
+
+void Controller::prepare(const Telemetry &telemetry, ControlFrame &frame) const {
+    MPC_TRACE_SCOPE("prepare");
+    StageClock clock;
+    
+    double px = telemetry.x;
+    double py = telemetry.y;
+    frame.track_s = -1;
+    if (map) {
+        Track::Projection projection = map->locate(px, py);
+        size_t segment = projection.segment;
+        frame.track_s = projection.s;
+        map->window(segment, map_window, frame.map_x, frame.map_y);
+        // Read ahead in the direction the car is going.
+        double reach = telemetry.speed * 0.447 * map_prefetch_time + map_prefetch_margin;
+        map->prefetch(segment, cos(telemetry.psi - map->heading(segment)) >= 0 ? reach : -reach);
+    }
+    const WaypointVector &ptsx = map ? frame.map_x : telemetry.ptsx;
+    const WaypointVector &ptsy = map ? frame.map_y : telemetry.ptsy;
+    double psi = telemetry.psi;
+    CubicCoeffs &coeffs = frame.coeffs;
+    
+    // convert from flobal/map coordinates to vehicles coordinates
+    convertToCoordinates(px, py, psi, ptsx, ptsy, frame.xvals, frame.yvals);
+    clock.lap(STAGE_TRANSFORM);
+    
+    // The expansion of the reference path fails only when the car faces
+    // away from it, the fit is the fallback then.
+    frame.arrival = telemetry.arrival;
+    if (&frame.telemetry != &telemetry) {
+        frame.telemetry = telemetry;
+    }
+    frame.has_reference = true;
+    if ((!reference || !reference->localCubic(px, py, psi, coeffs.data())) &&
+        !windowCubic(frame, ptsx, ptsy, px, py, psi, coeffs)) {
+        if (frame.xvals.size() < 4) {
+            frame.has_reference = false;
+            return;
+        }
+        coeffs = polyfitFixed<3>(frame.xvals.data(), frame.yvals.data(), frame.xvals.size());
+    }
+    clock.lap(STAGE_POLYFIT);
+    
+    predictState(telemetry, coeffs, frame.state);
+    
+    // The profile from where the car is at the end of the delay on, along
+    // the track in the direction it is going.
+    frame.profile.spacing = 0;
+    if (profile_track) {
+        Track::Projection p = profile_track->locate(px, py);
+        double direction = cos(psi - profile_track->heading(p.segment)) >= 0 ? 1 : -1;
+        double s = p.s + direction * frame.state[0];
+        frame.profile.spacing = profile_spacing;
+        for (size_t k = 0; k < SpeedProfile::n_samples; k++) {
+            frame.profile.v[k] = profile_track->speedAt(s + direction * k * profile_spacing);
+        }
+    }
+    clock.lap(STAGE_PREDICT);
+}
+
+// Advance the pose x, y, psi in map coordinates and the speed v in m/s by
+// dt under the kinematic bicycle, the steering angle in the simulator's
+// convention, positive to the right.
+static void advancePose(double &x, double &y, double &psi, double &v, double steering_angle,
+                        double throttle, double dt) {
+    x += v * cos(psi) * dt;
+    y += v * sin(psi) * dt;
+    psi -= v / Lf * steering_angle * dt;
+    v += throttle * dt;
+}
+
+// Whether the problem of `frame` is within `tol` of that of `guess`, in
+// every entry of the state and in the offset of the reference at the
+// car and 10, 20 and 30 m ahead.
+static bool nearFrame(const ControlFrame &frame, const ControlFrame &guess, double tol) {
+    for (int i = 0; i < 6; i++) {
+        if (fabs(frame.state[i] - guess.state[i]) > tol) {
+            return false;
+        }
+    }
+    for (double x = 0; x <= 30; x += 10) {
+        if (fabs(polyeval(frame.coeffs, x) - polyeval(guess.coeffs, x)) > tol) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Controller::solve(const ControlFrame &frame, string &reply) {
+    MPC_TRACE_SCOPE("controller_solve");
+    StageClock clock;
+    if (!frame.has_reference) {
+        // Nothing to track: the actuations of the last reply again.
+        has_speculation = false;
+        has_reply_plan = false;
+        writeReply(frame, -last_steering * deg2rad(25), last_throttle, 0, nullptr, reply);
+        clock.lap(STAGE_SERIALIZE);
+        return;
+    }
+    
+    // Calculate steering angle and throttle using MPC. Both are in between [-1, 1].
+    SolveStats &stats = last_stats;
+    stats = SolveStats();
+    double delta, a;
+    double now[6];
+    for (int i = 0; i < 6; i++) {
+        now[i] = frame.state[i];
+    }
+    if (table && tableControl(frame.coeffs, now, delta, a)) {
+        has_speculation = false;
+        tablePlan(frame, delta, a);
+        stats.status = SOLVE_SUCCESS;
+        stats.table = true;
+        clock.lap(STAGE_SOLVE);
+        Metrics::recordTable();
+        has_reply_plan = true;
+        writeReply(frame, delta, a, solution.n_stages - 1, &stats, reply);
+        clock.lap(STAGE_SERIALIZE);
+        return;
+    }
+    
+    if (degradedControl(frame, delta, a)) {
+        stats.status = SOLVE_SUCCESS;
+        stats.degraded = true;
+        clock.lap(STAGE_SOLVE);
+        has_reply_plan = false;
+        writeReply(frame, delta, a, 0, &stats, reply);
+        clock.lap(STAGE_SERIALIZE);
+        return;
+    }
+    
+    // A speculative answer close enough to this frame is taken as it is.
+    // Otherwise the solve starts from the plan last answered with, not the
+    // speculation.
+    bool hit = false;
+    if (has_speculation) {
+        has_speculation = false;
+        hit = speculative_stats.ok() && nearFrame(frame, speculated, speculation_tolerance);
+        Metrics::recordSpeculation(hit);
+        if (hit) {
+            stats = speculative_stats;
+            stats.speculative = true;
+            swap(solution, speculative);
+        } else {
+            mpc.seedWarmStart(solution);
+        }
+    }
+    if (!hit) {
+        Deadline deadline = Deadline::max();
+        if (deadline_budget.count() > 0) {
+            deadline = frame.arrival + deadline_budget;
+        }
+        mpc.setSpeedProfile(frame.profile);
+        if (fleet) {
+            fleetObstacles(frame);
+        }
+        const Telemetry &now = frame.telemetry;
+        if (lap_cache && lap_cache->seed(frame.state, now.x, now.y, now.psi, lap_seed)) {
+            mpc.seedWarmStart(lap_seed);
+            Metrics::recordLapSeed();
+        }
+        solve_cancel.reset();
+        solving.store(true, memory_order_relaxed);
+        mpc.setCancel(&solve_cancel);
+        mpc.Solve(frame.state, frame.coeffs, stats, deadline, solution);
+        mpc.setCancel(nullptr);
+        solving.store(false, memory_order_relaxed);
+    }
+    clock.lap(STAGE_SOLVE);
+    if (fleet && (stats.ok() || stats.fallback)) {
+        publishPlan(frame);
+    }
+    if (lap_cache && stats.ok() && !stats.fallback && !hit) {
+        lap_cache->store(solution, frame.telemetry.x, frame.telemetry.y, frame.telemetry.psi);
+    }
+    Metrics::recordSolve(stats);
+    if (frame.track_s >= 0) {
+        Metrics::recordTrackSolve(frame.track_s, stats);
+    }
+    if (stats.recorded) {
+        Metrics::recordTape(mpc.getTapeStats());
+    }
+    if (tier == TIER_FULL) {
+        adaptHorizon(stats.wall_time);
+    }
+    if (!stats.ok()) {
+        MPC_LOG(LOG_WARN, "Solve failed (status %d, %d iterations, %.1f ms)%s", stats.status,
+                stats.iterations, stats.wall_time * 1e3, stats.fallback ? ", following previous plan" : "");
+    }
+    
+    delta = solution.delta;
+    a = solution.a;
+    has_reply_plan = stats.ok() || stats.fallback;
+    if (!has_reply_plan) {
+        lqrControl(frame, delta, a);
+    }
+    writeReply(frame, delta, a, solution.n_stages - 1, &stats, reply);
+    clock.lap(STAGE_SERIALIZE);
+    gradeSolve(stats);
+    
+    // Only solves of this frame, a speculation was timed on another.
+    if (shadow && stats.ok() && !stats.fallback && !hit) {
+        ShadowFrame shadowed;
+        shadowed.state = frame.state;
+        shadowed.coeffs = frame.coeffs;
+        shadowed.profile = frame.profile;
+        shadowed.horizon = mpc.getHorizon();
+        shadowed.delta = solution.delta;
+        shadowed.a = solution.a;
+        shadowed.wall_time = stats.wall_time;
+        shadow->submit(shadowed);
+    }
+}
+
+void Controller::speculate(const ControlFrame &frame, double period) {
+    MPC_TRACE_SCOPE("controller_speculate");
+    // A degraded tier is likely to answer the next frame as well.
+    if (last_stats.degraded) {
+        return;
+    }
+    const Telemetry &now = frame.telemetry;
+    
+    // The pose in map coordinates under the actuations of the telemetry
+    // until the reply takes effect, then under those of the reply, which
+    // the next telemetry reports.
+    double delay = min(now.delay, period);
+    double next_steering = last_steering * deg2rad(25);
+    Telemetry &next = speculated_telemetry;
+    next = now;
+    double v = now.speed * 0.447;
+    advancePose(next.x, next.y, next.psi, v, now.steering_angle, now.throttle, delay);
+    advancePose(next.x, next.y, next.psi, v, next_steering, last_throttle, period - delay);
+    next.speed = v / 0.447;
+    next.steering_angle = next_steering;
+    next.throttle = last_throttle;
+    next.arrival = now.arrival + chrono::duration_cast<chrono::steady_clock::duration>(
+                                     chrono::duration<double>(period));
+    prepare(next, speculated);
+    if (!speculated.has_reference) {
+        return;
+    }
+    
+    // A table answer is not solved for, and neither is its speculation.
+    double now_state[6];
+    for (int i = 0; i < 6; i++) {
+        now_state[i] = speculated.state[i];
+    }
+    double delta, a;
+    if (table && tableControl(speculated.coeffs, now_state, delta, a)) {
+        return;
+    }
+    mpc.setSpeedProfile(speculated.profile);
+    
+    // Given up, it reports SOLVE_CANCELLED, which solve() takes for a miss.
+    solve_cancel.reset();
+    speculating.store(true, memory_order_release);
+    mpc.setCancel(&solve_cancel);
+    mpc.Solve(speculated.state, speculated.coeffs, speculative_stats, next.arrival, speculative);
+    mpc.setCancel(nullptr);
+    speculating.store(false, memory_order_relaxed);
+    has_speculation = true;
+}
+
+bool Controller::abandonSpeculation(const ControlFrame &frame) {
+    if (!speculating.load(memory_order_acquire) || nearFrame(frame, speculated, speculation_tolerance)) {
+        return false;
+    }
+    solve_cancel.cancel();
+    return true;
+}
+
+bool Controller::preempt() {
+    if (!solving.load(memory_order_relaxed)) {
+        return false;
+    }
+    solve_cancel.cancel();
+    return true;
+}
+
+void Controller::solveFast(const ControlFrame &frame, string &reply) {
+    MPC_TRACE_SCOPE("controller_fast");
+    StageClock clock;
+    // A speculation is a frame behind now; the next solve shifts it once
+    // as usual.
+    has_speculation = false;
+    has_reply_plan = false;
+    double delta, a;
+    if (!frame.has_reference) {
+        delta = -last_steering * deg2rad(25);
+        a = last_throttle;
+    } else if (mpc.Predict(frame.state, frame.coeffs, delta, a)) {
+        Metrics::recordPredicted();
+    } else {
+        lqrControl(frame, delta, a);
+    }
+    writeReply(frame, delta, a, 0, nullptr, reply);
+    clock.lap(STAGE_SERIALIZE);
+}
+
+void Controller::answer(const ControlFrame &frame, double delta, double a, const SolveStats &stats,
+                        string &reply) {
+    StageClock clock;
+    has_speculation = false;
+    has_reply_plan = false;
+    last_stats = stats;
+    Metrics::recordSolve(stats);
+    if (frame.track_s >= 0) {
+        Metrics::recordTrackSolve(frame.track_s, stats);
+    }
+    if (!stats.ok()) {
+        lqrControl(frame, delta, a);
+    }
+    writeReply(frame, delta, a, 0, &last_stats, reply);
+    clock.lap(STAGE_SERIALIZE);
+}
+
+bool ActuationPlan::at(double t, double &steering, double &throttle) const {
+    double k = t / dt;
+    if (n_moves == 0 || !(k >= 0) || k > n_moves - 1) {
+        return false;
+    }
+    size_t i = min((size_t) k, n_moves - 1);
+    size_t j = min(i + 1, n_moves - 1);
+    double f = k - i;
+    steering = this->steering[i] + f * (this->steering[j] - this->steering[i]);
+    throttle = this->throttle[i] + f * (this->throttle[j] - this->throttle[i]);
+    return true;
+}
+
+void Controller::actuationPlan(ActuationPlan &plan) {
+    plan.dt = mpc.getTimeInterval();
+    plan.n_moves = has_reply_plan && solution.n_stages > 1 ? solution.n_stages - 1 : 0;
+    for (size_t i = 0; i < plan.n_moves; i++) {
+        plan.steering[i] = -solution.stages[i].delta / deg2rad(25);
+        plan.throttle[i] = solution.stages[i].a;
+    }
+}
+
+void Controller::lqrControl(const ControlFrame &frame, double &delta, double &a) const {
+    double cte, epsi, curvature;
+    referenceErrors(frame.coeffs, frame.state[0], frame.state[1], frame.state[2], cte, epsi, curvature);
+    lqr.control(frame.state[3], cte, epsi, curvature, delta, a);
+    Metrics::recordLqr();
+}
+
+void Controller::pursuitControl(const ControlFrame &frame, double &delta, double &a) const {
+    GeometricParams params;
+    params.lookahead_time = degradation.lookahead_time;
+    params.min_lookahead = degradation.min_lookahead;
+    params.speed = degradation.degraded_speed;
+    double s[6];
+    for (int i = 0; i < 6; i++) {
+        s[i] = frame.state[i];
+    }
+    geometricControl(params, frame.coeffs, s, delta, a);
+}
+
+bool Controller::tableControl(const CubicCoeffs &coeffs, const double s[6], double &delta, double &a) const {
+    double p[N_TABLE_AXES];
+    referenceErrors(coeffs, s[0], s[1], s[2], p[TABLE_CTE], p[TABLE_EPSI], p[TABLE_CURVATURE]);
+    p[TABLE_V] = s[3];
+    return table->lookup(p, delta, a);
+}
+
+void Controller::tablePlan(const ControlFrame &frame, double delta, double a) {
+    const double dt = mpc.getTimeInterval();
+    double s[6];
+    for (int i = 0; i < 6; i++) {
+        s[i] = frame.state[i];
+    }
+    solution.n_stages = mpc.getHorizon();
+    for (size_t t = 0; t < solution.n_stages; t++) {
+        bool last = t + 1 == solution.n_stages;
+        solution.stages[t] = {s[0], s[1], s[2], s[3], s[4], s[5], last ? 0.0 : delta, last ? 0.0 : a};
+        if (last) {
+            break;
+        }
+        double next[6];
+        vehicleStep(s, delta, a, frame.coeffs, dt, next);
+        copy(next, next + 6, s);
+        if (!tableControl(frame.coeffs, s, delta, a)) {
+            double cte, epsi, curvature;
+            referenceErrors(frame.coeffs, s[0], s[1], s[2], cte, epsi, curvature);
+            lqr.control(s[3], cte, epsi, curvature, delta, a);
+        }
+    }
+    const PredictedStage &first = solution.stages[0];
+    const PredictedStage &next = solution.stages[1];
+    solution.x = next.x;
+    solution.y = next.y;
+    solution.psi = next.psi;
+    solution.v = next.v;
+    solution.cte = next.cte;
+    solution.epsi = next.epsi;
+    solution.delta = first.delta;
+    solution.a = first.a;
+    mpc.seedWarmStart(solution);
+}
+
+void Controller::sampleReference(const ControlFrame &frame) {
+    Eigen::Index n = reference_samples;
+    sample_x = Eigen::ArrayXd::LinSpaced(n, frame.xvals.minCoeff(), frame.xvals.maxCoeff());
+    
+    // Horner's rule on all the abscissas at once.
+    sample_y = Eigen::ArrayXd::Constant(n, frame.coeffs[3]);
+    for (int i = 2; i >= 0; i--) {
+        sample_y = sample_y * sample_x + frame.coeffs[i];
+    }
+}
+
+void Controller::writeReply(const ControlFrame &frame, double delta, double a, size_t n_predicted,
+                            const SolveStats *stats, string &reply) {
+    double steer_value = delta;
+    double throttle_value = a;
+    
+    // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
+    // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
+    steer_value = steer_value/deg2rad(25);
+    
+    //Display the MPC predicted trajectory (Green line) and the waypoints/reference
+    //line (Yellow line), both in the vehicle's coordinate system. The stages after
+    //the initial state are read straight out of the solution. Only the replies
+    //of the visualization period, or asked for, draw them, see setVisualization.
+    bool draw = visualization_requested ||
+                (visualization_period != 0 && visualization_replies % visualization_period == 0);
+    visualization_replies++;
+    visualization_requested = false;
+    
+    last_steering = -steer_value;
+    last_throttle = throttle_value;
+    // Split, the lines wait for writeVisualization after the reply is out.
+    visualization_pending = split_visualization && draw;
+    pending_predicted = n_predicted;
+    writeSteerEvent(frame, n_predicted, draw && !split_visualization, reply);
+    if (traced) {
+        traceCycle(frame, stats);
+    }
+}
+
+void Controller::writeSteerEvent(const ControlFrame &frame, size_t n_predicted, bool draw, string &out) {
+    size_t n_points = draw ? frame.xvals.size() : 0;
+    const size_t stride = sizeof(PredictedStage) / sizeof(double);
+    StridedView mpc_x(&solution.stages[1].x, draw ? n_predicted : 0, stride);
+    StridedView mpc_y(&solution.stages[1].y, draw ? n_predicted : 0, stride);
+    StridedView next_x(frame.xvals.data(), n_points);
+    StridedView next_y(frame.yvals.data(), n_points);
+    if (n_points > 0 && reference_samples > 0) {
+        sampleReference(frame);
+        next_x = StridedView(sample_x.data(), reference_samples);
+        next_y = StridedView(sample_y.data(), reference_samples);
+    }
+    
+    if (wire_format == WIRE_BINARY) {
+        writeSteerBinary(out, last_steering, last_throttle, mpc_x, mpc_y, next_x, next_y);
+    } else {
+        writeSteer(out, last_steering, last_throttle, mpc_x, mpc_y, next_x, next_y, steer_precision);
+    }
+}
+
+void Controller::traceCycle(const ControlFrame &frame, const SolveStats *stats) const {
+    TraceRow row;
+    row.time = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    row.arrival = chrono::duration_cast<chrono::nanoseconds>(frame.arrival.time_since_epoch()).count();
+    row.source = trace_source;
+    const Telemetry &telemetry = frame.telemetry;
+    row.x = telemetry.x;
+    row.y = telemetry.y;
+    row.psi = telemetry.psi;
+    row.speed = telemetry.speed;
+    row.steering_angle = telemetry.steering_angle;
+    row.throttle = telemetry.throttle;
+    row.n_waypoints = frame.xvals.size();
+    for (int i = 0; i < 4; i++) {
+        row.coeffs[i] = frame.coeffs[i];
+    }
+    for (int i = 0; i < 6; i++) {
+        row.state[i] = frame.state[i];
+    }
+    
+    SolveStats none;
+    const SolveStats &s = stats ? *stats : none;
+    row.status = stats ? s.status : -1;
+    row.iterations = s.iterations;
+    row.wall_time = s.wall_time;
+    row.eval_time = s.eval_time;
+    row.linear_solver_time = s.linear_solver_time;
+    row.objective = s.objective;
+    for (int i = 0; i < N_COST_TERMS; i++) {
+        row.cost_terms[i] = s.cost_terms[i];
+    }
+    row.constraint_violation = s.constraint_violation;
+    if (!stats) {
+        row.origin = ORIGIN_FAST;
+    } else if (s.table) {
+        row.origin = ORIGIN_TABLE;
+    } else if (s.degraded) {
+        row.origin = ORIGIN_DEGRADED;
+    } else if (s.fallback) {
+        row.origin = ORIGIN_FALLBACK;
+    } else if (!s.ok()) {
+        row.origin = ORIGIN_LQR;
+    } else if (s.speculative) {
+        row.origin = ORIGIN_SPECULATIVE;
+    } else if (s.cached) {
+        row.origin = ORIGIN_CACHED;
+    } else {
+        row.origin = ORIGIN_SOLVED;
+    }
+    row.tier = tier;
+    row.horizon = mpc.getHorizon();
+    row.reply_steering = last_steering;
+    row.reply_throttle = last_throttle;
+    ColumnTrace::record(row);
+}
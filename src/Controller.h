@@ -0,0 +1,596 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FleetHash.h"
+#include "LqrSchedule.h"
+#include "Metrics.h"
+#include "MPC.h"
+#include "PolyFit.h"
+#include "SmallVector.h"
+#include "SteerMessage.h"
+
+using namespace std;
+
+class LapCache;
+class ShadowSolver;
+class ControlTable;
+class PathSpline;
+class Track;
+struct ControllerContext;
+struct ControllerSnapshot;
+
+// Fields of one "telemetry" event sent by the simulator.
+struct Telemetry {
+    WaypointVector ptsx;
+    WaypointVector ptsy;
+    double x;
+    double y;
+    double psi;
+    double speed;
+    double steering_angle;
+    double throttle;
+    // When the message was received, the solve deadline counts from here.
+    chrono::steady_clock::time_point arrival;
+    // Time from the state reported until the reply to it takes effect, in
+    // seconds, which Controller::prepare predicts the state over. The
+    // server measures it, see MPC_MEASURED_DELAY.
+    double delay = actuation_delay_ms / 1000.0;
+};
+
+// Encoding of the replies: the simulator's Socket.IO JSON, or the binary
+// framing of BinaryProtocol.h.
+enum WireFormat {
+    WIRE_JSON,
+    WIRE_BINARY
+};
+
+// The problem of one telemetry frame, see Controller::prepare: the
+// waypoints in vehicle coordinates, the reference polynomial and the state
+// at the end of the actuation delay. It keeps its storage from frame to
+// frame.
+struct ControlFrame {
+    Eigen::VectorXd xvals;
+    Eigen::VectorXd yvals;
+    CubicCoeffs coeffs;
+    StateVector state;
+    // Arrival of the telemetry, see Telemetry::arrival.
+    chrono::steady_clock::time_point arrival;
+    // The telemetry itself, for Controller::speculate.
+    Telemetry telemetry;
+    
+    // Reference velocity ahead of the car, see Controller::setSpeedProfile.
+    SpeedProfile profile;
+    
+    // Waypoints looked up on the map, kept to reuse their storage.
+    WaypointVector map_x;
+    WaypointVector map_y;
+    // Arc length of the map where the car is, see Track::Projection::s; -1
+    // without a map.
+    double track_s = -1;
+    // Whether prepare() found a reference polynomial. Without a map or a
+    // reference path it needs 4 waypoints; solve() and solveFast() repeat
+    // the last actuations for a frame with fewer.
+    bool has_reference = false;
+    
+    // Fit of the waypoints last prepared into this frame, kept while the
+    // same ones come again and updated as they advance, see
+    // Controller::prepare: the cubic in the frame of the first point of an
+    // earlier window with the x axis towards its last, that frame in map
+    // coordinates, and the points in it, a ring starting at window_first,
+    // with their sums.
+    static const size_t max_window_points = 32;
+    WaypointVector window_x;
+    WaypointVector window_y;
+    CubicCoeffs window_fit;
+    double window_ox = 0;
+    double window_oy = 0;
+    double window_heading = 0;
+    bool has_window_fit = false;
+    array<double, max_window_points> window_u;
+    array<double, max_window_points> window_w;
+    size_t window_first = 0;
+    // Points that left the window since its frame was set.
+    size_t window_slid = 0;
+    PolyFit<3> window_sums;
+};
+
+// The actuations of a plan over time in the simulator's convention, see
+// Controller::lastSteering, copied out of the controller so that they can
+// be read while it solves the next frame, see Controller::actuationPlan.
+struct ActuationPlan {
+    // Duration of every move, and the moves.
+    double dt = 0;
+    size_t n_moves = 0;
+    array<double, max_horizon> steering;
+    array<double, max_horizon> throttle;
+    
+    // The actuations `t` seconds after the first move took effect, linear
+    // between consecutive moves. False past the last move.
+    bool at(double t, double &steering, double &throttle) const;
+};
+
+// When a controller degrades through the ControlTier, see
+// Controller::setDegradation.
+struct DegradationPolicy {
+    // Bad solves in a row, failed or over the budget, that step down a
+    // tier; 0 never degrades.
+    size_t failures = 0;
+    // Frames a degraded tier answers, good solves in a row for the reduced
+    // horizon, before the tier above is tried again.
+    size_t recovery = 20;
+    // Solve time beyond which a solve is bad, in s; 0 takes the deadline
+    // budget, see Controller::setDeadlineBudget.
+    double budget = 0;
+    // Errors against the reference beyond which pure pursuit takes over
+    // from the LQR, in m and rad. Below half of them the LQR takes back.
+    double pursuit_cte = 1.0;
+    double pursuit_epsi = 0.2;
+    // Look-ahead of pure pursuit: this long at the current speed, in s, and
+    // at least the distance, in m.
+    double lookahead_time = 0.8;
+    double min_lookahead = 6;
+    // Speed pure pursuit holds on the straight, see GeometricParams, and the
+    // LQR of a degraded controller does not speed up beyond, in m/s.
+    double degraded_speed = 15;
+};
+
+// An alternate configuration of a controller, see Controller::configure
+// and parseVariant: what it sets replaces the environment's, the rest is
+// kept.
+struct ControllerVariant {
+    bool has_backend = false;
+    SolverBackend backend = SQP_RTI;
+    // 0 keeps the horizon.
+    size_t horizon = 0;
+    bool has_weights = false;
+    CostWeights weights;
+    // Those of the environment with the ones given replaced.
+    bool has_options = false;
+    MpcOptions options;
+};
+
+// The state of the MPC for `telemetry` against the reference `coeffs` in
+// its vehicle frame: the errors at the car, then the model's prediction
+// over telemetry.delay under the actuations last applied.
+void predictState(const Telemetry &telemetry, const CubicCoeffs &coeffs, StateVector &state);
+
+// Convert the waypoints `ptsx`, `ptsy` from map coordinates into those of
+// a car at (x, y) heading psi, into `xvals` and `yvals`, which keep their
+// storage while the number of points holds.
+void convertToCoordinates(double x, double y, double psi, const WaypointVector &ptsx, const WaypointVector &ptsy,
+                          Eigen::VectorXd &xvals, Eigen::VectorXd &yvals);
+
+// The backend called `name` as in MPC_SOLVER, e.g. "rti", into
+// `backend`; false for no backend of that name.
+bool parseBackend(const string &name, SolverBackend &backend);
+
+// The name of `backend` as in MPC_SOLVER.
+const char *backendName(SolverBackend backend);
+
+// The variant `spec` describes into `variant`: comma separated key=value
+// pairs, e.g. "solver=cgmres,horizon=20,cte=20,tol=1e-4". The keys are
+// solver, with the names of MPC_SOLVER, horizon, the weights of
+// CostWeights by their names, and the options tol, acceptable_tol,
+// bound_push, linear_solver, mu_strategy, hessian (exact or
+// limited-memory), rti_iterations, mppi_samples, cgmres_directions and
+// geometric. False on any other key or a value that
+// does not parse.
+bool parseVariant(const string &spec, ControllerVariant &variant);
+
+// The variant of the configuration file at `path`, see MPC_CONFIG: the
+// pairs of parseVariant one per line, blanks ignored and # starting a
+// comment. False if it cannot be read or does not parse.
+bool readVariant(const char *path, ControllerVariant &variant);
+
+// Set up `mpc` from the environment like every controller: MPC_SOLVER,
+// MPC_MODEL, MPC_FORMULATION and the options, see parseOptions in
+// Controller.cpp. The warm start is left alone.
+void configureMpc(MPC &mpc);
+
+// Everything needed to drive a single car: the MPC with its warm start and
+// solver state, and the conversion of the telemetry into a "steer" reply.
+//
+// A controller is not thread safe, but it may be moved between threads as
+// long as only one of them uses it at a time.
+class Controller {
+public:
+    Controller();
+    
+    ~Controller();
+    
+    // Compute the actuations for `telemetry` and write the message to send
+    // back to the simulator into `reply`, reusing its storage. The same as
+    // prepare() followed by solve().
+    void step(const Telemetry &telemetry, string &reply);
+    
+    // The first half of step(): the transform, the reference polynomial and
+    // the prediction over the actuation delay, into `frame`. It only reads
+    // the map and the reference, so it may run on one thread while solve()
+    // works on an earlier frame on another.
+    void prepare(const Telemetry &telemetry, ControlFrame &frame) const;
+    
+    // The second half of step(): solve `frame` and write the reply.
+    // Inside the validated region of the table, if any, the actuations
+    // are looked up instead of solved for, see setTable. A failed solve
+    // with no previous plan to follow is answered by the gain-scheduled
+    // LQR instead, see LqrSchedule.
+    void solve(const ControlFrame &frame, string &reply);
+    
+    // Answer `frame` without solving, for a frame there is no time to
+    // solve: by the tangential predictor of the last solve if there is one,
+    // see MPC::Predict, by the LQR otherwise, and without a predicted
+    // trajectory either way. Leaves lastStats() alone.
+    void solveFast(const ControlFrame &frame, string &reply);
+    
+    // Answer `frame` with the first actuations `delta` and `a` solved for
+    // it elsewhere, with `stats`, e.g. by MPC::SolveBatch together with the
+    // frames of other controllers: the LQR if that solve failed, and no
+    // predicted trajectory, nor a plan for the next solve to follow or
+    // warm start from. Sets lastStats().
+    void answer(const ControlFrame &frame, double delta, double a, const SolveStats &stats, string &reply);
+    
+    // Solve ahead while waiting for the next frame: predict its telemetry,
+    // `period` seconds after that of `frame`, which has to be the frame
+    // last solved, with the model under the actuations in flight and then
+    // those of the reply, and solve it until that telemetry is due. The
+    // next solve() takes the answer if its frame is within the tolerance
+    // of the prediction, see setSpeculationTolerance, and otherwise solves
+    // from the last plan shifted as usual.
+    void speculate(const ControlFrame &frame, double period);
+    
+    // Give up the solve of speculate() running on another thread if
+    // `frame`, the one it was solving ahead for, is not within the
+    // tolerance of the prediction, so that the solve of `frame` waiting
+    // for it starts at once, see MPC::setCancel. Safe to call from any
+    // thread; true if it was given up.
+    bool abandonSpeculation(const ControlFrame &frame);
+    
+    // Cancel the solve of solve() running on another thread, for a
+    // fresher frame that it would only delay: its frame is answered from
+    // the previous plan, as after a failed solve, and its last iterate
+    // warm starts the next solve, see MPC::setCancel. Safe to call from
+    // any thread; true if a solve was running.
+    bool preempt();
+    
+    // How far the frame of solve() may be from the one speculate()
+    // predicted for its answer to be taken: in every entry of the state,
+    // in m, rad and m/s, and in the offset of the reference over its
+    // first 30 m. 0.005 by default: the laps are sensitive to answers
+    // for a problem even centimetres off.
+    void setSpeculationTolerance(double tolerance);
+    
+    // Graceful degradation: after policy.failures bad solves in a row,
+    // answer with the next ControlTier down, the MPC over the next shorter
+    // compiled horizon if there is one, then the LQR, which hands over to
+    // pure pursuit far from the reference. After policy.recovery frames a
+    // tier tries the one above. Every change is counted in
+    // mpc_tier_changes_total. The adaptive horizon, see setAdaptiveHorizon,
+    // only adapts at the full tier. MPC_DEGRADE=<failures>[:<recovery>
+    // [:<budget_ms>]] sets it from the environment.
+    void setDegradation(const DegradationPolicy &policy);
+    
+    ControlTier getTier() const { return tier; }
+    
+    // Answer at `cap` or a cheaper tier only, whatever the solves, so an
+    // overloaded server can shed the solves of the vehicles it values
+    // least; TIER_REDUCED without a shorter compiled horizon is the LQR.
+    // Lifting it goes back up to the tier allowed at once; the degradation
+    // steps down from there again if the solves still fail. TIER_FULL, no
+    // cap, by default.
+    void setTierCap(ControlTier cap);
+    
+    // Shadow mode: solve every frame the MPC solved again with `backend`
+    // on a thread of its own, at idle priority, and record how far apart
+    // the actuations and the solve times are, see ShadowSolver. The reply
+    // never waits for it. MPC_SHADOW=<solver> sets it from the environment,
+    // with the names of MPC_SOLVER.
+    void setShadow(bool enabled, SolverBackend backend = SQP_RTI);
+    
+    // Forget the state of the previous cycle, e.g. after a reconnect.
+    void reset();
+    
+    // Time after the arrival of the telemetry by which the solve must be
+    // done, see MPC::Solve. Zero only keeps IPOPT's own time limit.
+    void setDeadlineBudget(chrono::microseconds budget);
+    
+    // See MPC::setHorizon.
+    bool setHorizon(size_t N);
+    
+    size_t getHorizon() const;
+    
+    // Let the horizon follow the measured solve time between the compiled
+    // horizons in [min_N, max_N]: step down to a shorter one when the
+    // smoothed wall time of MPC::Solve exceeds `target`, step up when the
+    // next longer one is expected to take less than half of it. The plan
+    // carries over as the warm start. min_N = 0 keeps the horizon fixed.
+    void setAdaptiveHorizon(size_t min_N, size_t max_N, chrono::microseconds target);
+    
+    // Of the MPC and of the LQR.
+    void setCostWeights(const CostWeights &weights);
+    
+    // See MPC::setOptions; by default they come from the environment.
+    void setOptions(const MpcOptions &options);
+    
+    // See MPC::setFormulation; by default it comes from the environment.
+    void setFormulation(Formulation formulation);
+    
+    // See MPC::setBackend; by default it comes from the environment.
+    void setBackend(SolverBackend backend);
+    
+    SolverBackend getBackend() const { return mpc.getBackend(); }
+    
+    // See MPC::getTapeStats.
+    TapeStats tapeStats() { return mpc.getTapeStats(); }
+    
+    // See MPC::setIterationTrace.
+    void setIterationTrace(IterationTrace *trace) { mpc.setIterationTrace(trace); }
+    
+    // Apply what `variant` sets; false if its horizon is not one of those
+    // of MPC::setHorizon, which then stays.
+    bool configure(const ControllerVariant &variant);
+    
+    // Save what the controller learned so far into `out`, see
+    // ControllerSnapshot.
+    void snapshot(ControllerSnapshot &out) const;
+    
+    // Pick up a snapshot saved by an earlier process: the horizon, within
+    // the adaptive bounds if any, the solve time estimate and the plan
+    // seeding the warm start. Returns false, changing nothing, for an
+    // empty or unusable snapshot.
+    bool restore(const ControllerSnapshot &in);
+    
+    // Everything of the controller its vehicle resumes warm from on another
+    // node, into `out`, see ControllerContext; the connection's period and
+    // delay are left to the caller.
+    void exportContext(ControllerContext &out) const;
+    
+    // Take over the context of another node's controller: restore() its
+    // snapshot, then its warm start, multipliers and lap plans where they
+    // fit the horizon, backend and map of this one, those that do not
+    // being rebuilt by the next solves. Returns false, changing nothing,
+    // for an unusable snapshot.
+    bool importContext(const ControllerContext &in);
+    
+    // How solve() writes the reply, JSON by default.
+    void setWireFormat(WireFormat format);
+    
+    // Which replies carry the lines the simulator draws, mpc_x/mpc_y and
+    // next_x/next_y: every `period`-th, 1 by default, or none for 0 but
+    // those requested. The others carry the steering and the throttle
+    // alone, see writeSteer; in JSON the four keys stay, empty, for
+    // clients that read them unconditionally. MPC_VISUALIZE=<period> sets
+    // it from the environment.
+    void setVisualization(size_t period);
+    
+    // Draw the lines in the next reply whatever the period.
+    void requestVisualization();
+    
+    // Leave the lines of the replies that draw them to a message of their
+    // own, see writeVisualization, so the reply carries the actuations
+    // alone and goes out before the lines are formatted. Off by default;
+    // MPC_SPLIT_VISUALIZATION=1 sets it from the environment.
+    void setSplitVisualization(bool split);
+    
+    // Whether the last reply left its lines to writeVisualization.
+    bool hasVisualization() const { return visualization_pending; }
+    
+    // The steer event of the last reply, its actuations with its lines,
+    // into `out`, replacing its content but keeping its storage; `frame`
+    // is the one it answered, unchanged since. Only the first call after
+    // a reply writes it, false otherwise.
+    bool writeVisualization(const ControlFrame &frame, string &out);
+    
+    // Draw next_x/next_y as the reference polynomial sampled at `n`
+    // abscissas evenly spread over the waypoints, 0 for the waypoints
+    // themselves, the default. Only the replies that draw evaluate it.
+    // MPC_VISUALIZE=<period>:<samples> sets it from the environment.
+    void setReferenceSamples(size_t n);
+    
+    // Decimals of the JSON replies. MPC_STEER_DECIMALS=<points>[:<actuators>]
+    // sets them from the environment.
+    void setSteerPrecision(const SteerPrecision &precision);
+    
+    const SteerPrecision &steerPrecision() const { return steer_precision; }
+    
+    // Take the waypoints ahead of the car from `map` rather than from the
+    // telemetry, which then need not carry any. The map is shared, not
+    // copied, and must outlive the controller. nullptr goes back to the
+    // telemetry's waypoints.
+    void setMap(const Track *map);
+    
+    // Take the reference polynomial from the expansion of `path` about the
+    // car, see PathSpline::localCubic, instead of fitting it to the
+    // waypoints. Shared like the map; nullptr goes back to the fit.
+    void setReference(const PathSpline *path);
+    
+    // Pull the speed of every stage of the MPC towards the speed profile
+    // of `track` there, see Track::buildSpeedProfile, instead of ref_v
+    // everywhere: slower into the bends and back up out of them, in the
+    // direction the car drives. Shared like the map; nullptr, or a track
+    // without a profile, goes back to ref_v. MPC_SPEED_PROFILE sets it from
+    // the environment.
+    void setSpeedProfile(const Track *track);
+    
+    // Look the actuations up in `table` where it is validated, and solve
+    // online elsewhere. Shared like the
+    // map; nullptr always solves.
+    void setTable(const ControlTable *table);
+    
+    // Drive as `vehicle` of `fleet`, clear of the others: each solve
+    // looks up the vehicles within the fleet's range of the stages of the
+    // last plan, as predicted at the same stages, and keeps its stages
+    // `radius` from them by a penalty of `weight`, see MPC::setObstacles.
+    // Its plan is published after it, in map coordinates. Shared like the
+    // map; nullptr drives alone. MPC_FLEET=<range>[:<radius>[:<weight>]]
+    // sets it for the server's connections.
+    void setFleet(FleetHash *fleet, uint32_t vehicle, double radius, double weight);
+    
+    // Keep the converged plans of every `spacing` m of the map, see
+    // LapCache, and on the laps after seed the solves from the one that
+    // passed where the car is. Only with a map, see setMap, which empties
+    // the plans; 0 stops. MPC_LAP_CACHE=<spacing> sets it from the
+    // environment.
+    void setLapCache(double spacing);
+    
+    // The actuations of the plan of the last reply, in `plan`; no moves
+    // after a reply without one, see solveFast and the LQR of solve().
+    void actuationPlan(ActuationPlan &plan);
+    
+    // How the solve of the last step went.
+    const SolveStats &lastStats() const { return last_stats; }
+    
+    // Actuations of the last reply, in the simulator's convention: the
+    // steering in [-1, 1], positive to the right, and the throttle.
+    double lastSteering() const { return last_steering; }
+    double lastThrottle() const { return last_throttle; }
+    
+private:
+    MPC mpc;
+    LqrSchedule lqr;
+    chrono::microseconds deadline_budget;
+    SolveStats last_stats;
+    double last_steering;
+    double last_throttle;
+    
+    // Adaptive horizon, see setAdaptiveHorizon: the bounds, the target,
+    // the smoothed solve time in seconds and the cycles since the last
+    // switch.
+    size_t adaptive_min;
+    size_t adaptive_max;
+    chrono::microseconds adaptive_target;
+    double solve_time;
+    size_t adaptive_cycles;
+    
+    void adaptHorizon(double wall_time);
+    
+    // Actuations of the LQR for `frame`.
+    void lqrControl(const ControlFrame &frame, double &delta, double &a) const;
+    
+    // Actuations of pure pursuit of the reference for `frame`, see
+    // DegradationPolicy.
+    void pursuitControl(const ControlFrame &frame, double &delta, double &a) const;
+    
+    // Graceful degradation, see setDegradation: whether a tier without a
+    // solve answers `frame`, with the actuations if so; the tier after the
+    // solve `stats`; and the change to `next`, with its horizon.
+    bool degradedControl(const ControlFrame &frame, double &delta, double &a);
+    void gradeSolve(const SolveStats &stats);
+    void setTier(ControlTier next);
+    
+    // Actuations of the table for the state `s` against `coeffs`, false
+    // outside its validated region.
+    bool tableControl(const CubicCoeffs &coeffs, const double s[6], double &delta, double &a) const;
+    
+    // The plan the table implies from `frame`, whose first actuations are
+    // delta and a: the model rolled out under the table, and the LQR where
+    // the table has no answer, into `solution`. It seeds the warm start,
+    // so the online solve picks up from the table without a cold start.
+    void tablePlan(const ControlFrame &frame, double delta, double a);
+    
+    // Look the fleet up for the obstacles of the solve of `frame`, and
+    // publish the plan solved for it, see setFleet.
+    void fleetObstacles(const ControlFrame &frame);
+    void publishPlan(const ControlFrame &frame);
+    
+    // Write the reply of `frame` for the actuations delta and a, with the
+    // first `n_predicted` stages of the solution after the initial state.
+    // `stats` tells how they came about for the column trace, nullptr for
+    // solveFast.
+    // The reference of `frame` at reference_samples abscissas into
+    // sample_x and sample_y.
+    void sampleReference(const ControlFrame &frame);
+    
+    void writeReply(const ControlFrame &frame, double delta, double a, size_t n_predicted, const SolveStats *stats,
+                    string &reply);
+    
+    // The steer event of the last actuations into `out`, with the lines of
+    // `frame` and of the first `n_predicted` stages if `draw`.
+    void writeSteerEvent(const ControlFrame &frame, size_t n_predicted, bool draw, string &out);
+    
+    // Append the cycle of the reply just written to the column trace, see
+    // ColumnTrace.h, with MPC_TRACE_COLUMNS.
+    void traceCycle(const ControlFrame &frame, const SolveStats *stats) const;
+    
+    WireFormat wire_format;
+    // See setVisualization: the period, the replies written so far and
+    // whether the next one was asked to draw.
+    size_t visualization_period;
+    size_t visualization_replies;
+    bool visualization_requested;
+    // See setSplitVisualization: whether it is on, and whether the lines
+    // of the last reply are still to be written, with its stages.
+    bool split_visualization;
+    bool visualization_pending;
+    size_t pending_predicted;
+    // See setReferenceSamples: their number and the buffers they are
+    // evaluated into, reused from reply to reply.
+    size_t reference_samples;
+    Eigen::ArrayXd sample_x;
+    Eigen::ArrayXd sample_y;
+    SteerPrecision steer_precision;
+    const Track *map;
+    const ControlTable *table;
+    const PathSpline *reference;
+    const Track *profile_track;
+    
+    // See setFleet: the fleet, this vehicle in it, the obstacles of the
+    // next solve and the stages of the last plan published, in map
+    // coordinates.
+    FleetHash *fleet;
+    uint32_t fleet_vehicle;
+    FleetObstacles obstacles;
+    vector<double> fleet_x;
+    vector<double> fleet_y;
+    
+    // See setLapCache: the spacing, the plans once there is a map and the
+    // seed of the solve being set up.
+    double lap_spacing;
+    unique_ptr<LapCache> lap_cache;
+    Solution lap_seed;
+    
+    // Scratch of each step, kept to reuse their storage: the frame of
+    // step() and the answer of the solver, and whether the last reply
+    // came from the latter.
+    ControlFrame frame;
+    Solution solution;
+    bool has_reply_plan;
+    
+    // Graceful degradation, see setDegradation: the policy, the tier, the
+    // frames it answered or good solves in a row, the bad solves in a row
+    // and the horizon of the full tier.
+    DegradationPolicy degradation;
+    ControlTier tier;
+    ControlTier tier_cap;
+    size_t tier_frames;
+    size_t bad_solves;
+    size_t full_horizon;
+    
+    // Shadow mode, see setShadow.
+    unique_ptr<ShadowSolver> shadow;
+    SolverBackend shadow_backend;
+    
+    // The last speculate(): the predicted telemetry and its frame, the
+    // answer and how its solve went, until solve() picks them up.
+    Telemetry speculated_telemetry;
+    ControlFrame speculated;
+    Solution speculative;
+    SolveStats speculative_stats;
+    bool has_speculation;
+    double speculation_tolerance;
+    // Raised by abandonSpeculation and preempt, while `speculating` that
+    // the solve of `speculated` runs, while `solving` that of solve().
+    CancelToken solve_cancel;
+    atomic<bool> speculating;
+    atomic<bool> solving;
+    
+    // Whether the cycles are traced, see traceCycle, and the number of
+    // this controller's rows.
+    bool traced;
+    uint32_t trace_source;
+};
+
+#endif /* CONTROLLER_H */
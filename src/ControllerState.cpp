@@ -0,0 +1,224 @@
+#include "ControllerState.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Start of the file. A store written for another number of slots or
+// another layout of the snapshot is started afresh.
+struct StoreHeader {
+    char magic[8];
+    uint32_t n_slots;
+    uint32_t slot_size;
+};
+
+const char store_magic[8] = {'M', 'P', 'C', 'S', 'T', 'A', 'T', '1'};
+
+// Lock or unlock, by `type`, `length` bytes of `fd` from `start`, without
+// waiting; false if another process holds a lock there.
+bool lockRange(int fd, short type, off_t start, off_t length) {
+    struct flock range = {};
+    range.l_type = type;
+    range.l_whence = SEEK_SET;
+    range.l_start = start;
+    range.l_len = length;
+    return fcntl(fd, F_SETLK, &range) == 0;
+}
+
+off_t slotOffset(size_t slot) {
+    return sizeof(StoreHeader) + slot * sizeof(ControllerSnapshot);
+}
+
+template <typename T>
+void put(string &out, T value) {
+    out.append((const char *) &value, sizeof(value));
+}
+
+template <typename T>
+void putArray(string &out, const T *values, size_t n) {
+    put(out, (uint32_t) n);
+    out.append((const char *) values, n * sizeof(T));
+}
+
+// Reads what put and putArray wrote, failing for good once past the end.
+struct Reader {
+    const char *p;
+    const char *end;
+    
+    template <typename T>
+    bool get(T &value) {
+        if ((size_t) (end - p) < sizeof(value)) {
+            return false;
+        }
+        memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return true;
+    }
+    
+    // At most `max` elements.
+    template <typename T>
+    bool getArray(vector<T> &values, size_t max) {
+        uint32_t n;
+        if (!get(n) || n > max || (size_t) (end - p) < n * sizeof(T)) {
+            return false;
+        }
+        values.resize(n);
+        memcpy(values.data(), p, n * sizeof(T));
+        p += n * sizeof(T);
+        return true;
+    }
+};
+
+// Bound on the lengths read, far beyond any horizon and track.
+const size_t max_context_array = 1 << 20;
+
+} // namespace
+
+const char context_magic[8] = {'M', 'P', 'C', 'C', 'T', 'X', 'T', '1'};
+
+bool isContextMessage(const char *data, size_t length) {
+    return length >= sizeof(context_magic) && memcmp(data, context_magic, sizeof(context_magic)) == 0;
+}
+
+void encodeContext(const ControllerContext &context, string &out) {
+    out.assign(context_magic, sizeof(context_magic));
+    put(out, (uint32_t) sizeof(PredictedStage));
+    const ControllerSnapshot &snapshot = context.snapshot;
+    put(out, snapshot.valid);
+    put(out, snapshot.horizon);
+    put(out, snapshot.solve_time);
+    putArray(out, snapshot.stages, snapshot.valid ? snapshot.n_stages : 0);
+    putArray(out, context.warm_start.data(), context.warm_start.size());
+    put(out, context.fallbacks);
+    putArray(out, context.duals.data(), context.duals.size());
+    put(out, context.period);
+    put(out, (uint8_t) context.has_delay);
+    put(out, context.delay);
+    put(out, (uint32_t) context.lap_plans.size());
+    for (const vector<PredictedStage> &plan : context.lap_plans) {
+        putArray(out, plan.data(), plan.size());
+    }
+}
+
+bool decodeContext(const char *data, size_t length, ControllerContext &context) {
+    if (!isContextMessage(data, length)) {
+        return false;
+    }
+    Reader in = {data + sizeof(context_magic), data + length};
+    uint32_t stage_size;
+    if (!in.get(stage_size) || stage_size != sizeof(PredictedStage)) {
+        return false;
+    }
+    ControllerSnapshot &snapshot = context.snapshot;
+    vector<PredictedStage> stages;
+    uint8_t has_delay;
+    uint32_t n_plans;
+    if (!in.get(snapshot.valid) || !in.get(snapshot.horizon) || !in.get(snapshot.solve_time) ||
+        !in.getArray(stages, max_horizon) || !in.getArray(context.warm_start, max_context_array) ||
+        !in.get(context.fallbacks) || !in.getArray(context.duals, max_context_array) || !in.get(context.period) ||
+        !in.get(has_delay) || !in.get(context.delay) || !in.get(n_plans) || n_plans > max_context_array) {
+        return false;
+    }
+    snapshot.n_stages = stages.size();
+    copy(stages.begin(), stages.end(), snapshot.stages);
+    context.has_delay = has_delay != 0;
+    context.lap_plans.resize(n_plans);
+    for (vector<PredictedStage> &plan : context.lap_plans) {
+        if (!in.getArray(plan, max_horizon)) {
+            return false;
+        }
+    }
+    return in.p == in.end;
+}
+
+StateStore::StateStore() : slots(nullptr), n_slots(0), mapped_size(0), fd(-1) {}
+
+StateStore::~StateStore() {
+    if (slots) {
+        munmap((char *) slots - sizeof(StoreHeader), mapped_size);
+    }
+    // Releases the locks.
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+bool StateStore::open(const char *path, size_t n_slots) {
+    int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    // The header, locked while it is checked, so two processes starting
+    // together agree on the layout. A store of another layout is only
+    // started afresh while no process holds a slot of it, which resizing
+    // would kill.
+    struct flock header_lock = {};
+    header_lock.l_type = F_WRLCK;
+    header_lock.l_whence = SEEK_SET;
+    header_lock.l_len = sizeof(StoreHeader);
+    fcntl(fd, F_SETLKW, &header_lock);
+    size_t size = sizeof(StoreHeader) + n_slots * sizeof(ControllerSnapshot);
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || (size_t) st.st_size != size;
+    void *mapped = MAP_FAILED;
+    if (!fresh) {
+        mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    StoreHeader *header = mapped == MAP_FAILED ? nullptr : (StoreHeader *) mapped;
+    bool reset = !header || memcmp(header->magic, store_magic, sizeof(store_magic)) != 0 ||
+                 header->n_slots != n_slots || header->slot_size != sizeof(ControllerSnapshot);
+    if (reset && !lockRange(fd, F_WRLCK, sizeof(StoreHeader), 0)) {
+        if (header) {
+            munmap(mapped, size);
+        }
+        ::close(fd);
+        return false;
+    }
+    if (reset && fresh && ftruncate(fd, size) != 0) {
+        ::close(fd);
+        return false;
+    }
+    if (!header) {
+        mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        header = (StoreHeader *) mapped;
+    }
+    if (reset) {
+        memset(mapped, 0, size);
+        memcpy(header->magic, store_magic, sizeof(store_magic));
+        header->n_slots = n_slots;
+        header->slot_size = sizeof(ControllerSnapshot);
+        lockRange(fd, F_UNLCK, sizeof(StoreHeader), 0);
+    }
+    lockRange(fd, F_UNLCK, 0, sizeof(StoreHeader));
+    this->fd = fd;
+    slots = (ControllerSnapshot *) (header + 1);
+    this->n_slots = n_slots;
+    mapped_size = size;
+    taken.assign(n_slots, false);
+    return true;
+}
+
+int StateStore::acquire() {
+    lock_guard<mutex> hold(lock);
+    for (size_t i = 0; i < n_slots; i++) {
+        if (!taken[i] && lockRange(fd, F_WRLCK, slotOffset(i), sizeof(ControllerSnapshot))) {
+            taken[i] = true;
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+void StateStore::release(int slot) {
+    lock_guard<mutex> hold(lock);
+    lockRange(fd, F_UNLCK, slotOffset(slot), sizeof(ControllerSnapshot));
+    taken[slot] = false;
+}
@@ -0,0 +1,104 @@
+#ifndef CONTROLLER_STATE_H
+#define CONTROLLER_STATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "MPC.h"
+
+using namespace std;
+
+// What a controller carries over a restart of the process: the horizon it
+// settled on, its smoothed solve time and the last plan, which seeds the
+// warm start of the first solve, see Controller::restore. Flat, so it can
+// live in a memory-mapped file.
+struct ControllerSnapshot {
+    // Zero while the snapshot is being written or was never written.
+    uint32_t valid;
+    uint32_t horizon;
+    double solve_time;
+    uint32_t n_stages;
+    PredictedStage stages[max_horizon];
+};
+
+// Everything a vehicle's controller carries to another process, e.g. on
+// the node the router moves it to, see /migrate in router.cpp: the
+// snapshot, the decision vector and multipliers the next solve warm
+// starts from, see MPC::getWarmStart and MPC::getDuals, the frame period
+// and actuation delay its connection measured, and the plans of its lap
+// cache, see Controller::exportContext.
+struct ControllerContext {
+    ControllerSnapshot snapshot;
+    vector<double> warm_start;
+    uint64_t fallbacks = 0;
+    // Empty for a backend that keeps none.
+    vector<double> duals;
+    double period = 0;
+    bool has_delay = false;
+    double delay = 0;
+    // By slot of the LapCache, empty for slots without a plan and none
+    // without a cache.
+    vector<vector<PredictedStage> > lap_plans;
+};
+
+// Binary websocket messages of a migration: context_magic alone asks a
+// node for the context of the connection's controller, which it answers
+// with the context written by encodeContext; a node that is sent one
+// picks it up before its next solve. The doubles are in the byte order of
+// the host, so the context only moves between nodes of the same
+// architecture and build, which the stage size in it checks.
+extern const char context_magic[8];
+
+// Whether `data` starts with context_magic.
+bool isContextMessage(const char *data, size_t length);
+
+// Write `context` into `out`, replacing its content.
+void encodeContext(const ControllerContext &context, string &out);
+
+// Read the message written by encodeContext into `context`; false for a
+// malformed or foreign one.
+bool decodeContext(const char *data, size_t length, ControllerContext &context);
+
+// A file of snapshots mapped into memory, one slot per vehicle. Slots are
+// handed out lowest first, so after a restart the vehicles that reconnect
+// in the same order find their own state again.
+//
+// The file is written through the mapping, so a snapshot survives a crash
+// of the process as soon as it is complete. The slots are acquired and
+// released under a lock, from any thread, e.g. each event loop's; each
+// slot may then be written by any one thread at a time. A slot acquired is
+// also locked in the file, see fcntl(F_SETLK), so a process taking over
+// from another, see MPC_HANDOFF, skips those the other still writes,
+// until it releases them or exits.
+class StateStore {
+public:
+    StateStore();
+    
+    ~StateStore();
+    
+    // Map `path`, creating it with `n_slots` empty slots if it does not
+    // hold a store of that size yet. False if it does not while another
+    // process holds slots of it.
+    bool open(const char *path, size_t n_slots);
+    
+    bool isOpen() const { return slots != nullptr; }
+    
+    // A free slot's index, or -1 if all are taken.
+    int acquire();
+    
+    void release(int slot);
+    
+    ControllerSnapshot &operator[](int slot) { return slots[slot]; }
+    
+private:
+    ControllerSnapshot *slots;
+    size_t n_slots;
+    size_t mapped_size;
+    int fd;
+    vector<bool> taken;
+    mutex lock;
+};
+
+#endif /* CONTROLLER_STATE_H */
@@ -0,0 +1,42 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+// Stackless coroutines for C++11: a function that returns at each
+// MPC_CORO_AWAIT and, called again, goes on right after it, as Boost.Asio's
+// coroutine does, by a switch over where it left off (Duff's device). The
+// state is the resume point only, so locals do not survive an await; what
+// the flow needs across one lives next to the Coroutine. No await may sit
+// inside another switch.
+//
+//     void resume(Flow &flow) {
+//         MPC_CORO_BEGIN(flow.coro);
+//         for (;;) {
+//             while (!flow.ready) {
+//                 MPC_CORO_AWAIT(flow.coro);
+//             }
+//             ...
+//         }
+//         MPC_CORO_END(flow.coro);
+//     }
+struct Coroutine {
+    int point = 0;
+};
+
+#define MPC_CORO_BEGIN(coro) \
+    switch ((coro).point) {  \
+    case 0:
+
+// Return, to go on here at the next call.
+#define MPC_CORO_AWAIT(coro)     \
+    do {                         \
+        (coro).point = __LINE__; \
+        return;                  \
+    case __LINE__:;              \
+    } while (0)
+
+// Start over at the next call.
+#define MPC_CORO_END(coro) \
+    }                      \
+    (coro).point = 0
+
+#endif /* COROUTINE_H */
@@ -0,0 +1,374 @@
+#ifndef COST_MODEL_H
+#define COST_MODEL_H
+
+#include <cstddef>
+#include <ratio>
+#include <type_traits>
+#include "CostWeights.h"
+#include "SpeedProfile.h"
+
+// Every cost term is a weighted squared residual. A product records a
+// single multiply on the tape where CppAD::pow(r, 2) records a generic
+// power (log and exp) and is more expensive to differentiate twice.
+template <typename T>
+T square(const T &r) {
+    return r * r;
+}
+
+// The cost of a horizon composed at compile time from its terms, and
+// expanded from that one definition by each of its evaluators: addCost
+// records it on the tapes of the CppAD backends, costTerms evaluates it in
+// double term by term, and SeparableCost builds its closed form, with the
+// constant Hessian, for TapedNLP. A node is a type of static functions
+// only, so an expansion is nothing but the loops it writes out, with the
+// weights read from the CostWeights of the solve or folded in as
+// constants.
+//
+//     Tracking<VAR_CTE, WeightOf<&CostWeights::cte>, COST_CTE> w * cte_t^2, every stage
+//     Effort<VAR_A, FixedWeight<ratio<10>>, COST_ACTUATION>    10 * a_t^2, every move
+//     Rate<VAR_DELTA, ...>                                     w * (delta_t+1 - delta_t)^2
+//     Terminal                                                 the TerminalCost of the last stage
+//     Zip<A, B, ...>                                           A, B, ... stage by stage
+//     Sum<A, B, ...>                                           all of A, then all of B, ...
+//
+// Each node has
+//
+//     template <typename Config, typename T, typename V>
+//     static void add(T &cost, const V &vars, const CostWeights &, const StageSpeeds &, const TerminalCost &);
+//     template <typename Config>
+//     static void terms(const double *vars, const CostWeights &, const StageSpeeds &, const TerminalCost &,
+//                       double *terms);
+//     template <typename Config, typename Sink>
+//     static void separable(Sink &sink, const CostWeights &, const StageSpeeds &);
+//
+// and the residual nodes the same at one index k, for Zip.
+
+// Weight of a term from the CostWeights of the solve.
+template <double CostWeights::*member>
+struct WeightOf {
+    static double get(const CostWeights &weights) { return weights.*member; }
+};
+
+// Weight of a term fixed at compile time, the std::ratio R.
+template <typename R>
+struct FixedWeight {
+    static double get(const CostWeights &) { return (double) R::num / R::den; }
+};
+
+// The variables a residual is of.
+enum CostVar { VAR_CTE, VAR_EPSI, VAR_SPEED, VAR_DELTA, VAR_A };
+
+template <typename Config>
+constexpr size_t costVarStart(CostVar var) {
+    return var == VAR_CTE ? Config::cte_start
+                          : var == VAR_EPSI ? Config::epsi_start
+                                            : var == VAR_SPEED ? Config::v_start
+                                                               : var == VAR_DELTA ? Config::delta_start
+                                                                                  : Config::a_start;
+}
+
+// The speed stage of SeparableCost::addTerm for a term whose reference is
+// not the speed profile.
+const size_t no_speed_stage = (size_t) -1;
+
+// A residual node: `Derived` gives count<Config>() residuals, the k-th
+// vars[first(k)] minus vars[second(k)] if `relative`, otherwise minus
+// ref(k, speeds), weighted by Weight under CostTerm `term`.
+template <typename Derived, typename Weight, CostTerm term, bool relative>
+struct ResidualNode {
+    template <typename Config, typename T, typename V>
+    static void addAt(size_t k, T &cost, const V &vars, const CostWeights &weights, const StageSpeeds &speeds) {
+        cost += Weight::get(weights) * square(residual<Config>(k, vars, speeds, std::integral_constant<bool, relative>()));
+    }
+
+    template <typename Config>
+    static void termsAt(size_t k, const double *vars, const CostWeights &weights, const StageSpeeds &speeds,
+                        double *terms) {
+        terms[term] +=
+            Weight::get(weights) * square(residual<Config>(k, vars, speeds, std::integral_constant<bool, relative>()));
+    }
+
+    template <typename Config, typename Sink>
+    static void separableAt(size_t k, Sink &sink, const CostWeights &weights, const StageSpeeds &speeds) {
+        sink.addTerm(Derived::template first<Config>(k),
+                     subtracted<Config, Sink>(k, std::integral_constant<bool, relative>()), Weight::get(weights),
+                     relative ? 0.0 : Derived::ref(k, speeds), Derived::follows_speeds ? k : no_speed_stage);
+    }
+
+    template <typename Config, typename T, typename V>
+    static void add(T &cost, const V &vars, const CostWeights &weights, const StageSpeeds &speeds,
+                    const TerminalCost &) {
+        for (size_t k = 0; k < Derived::template count<Config>(); k++) {
+            addAt<Config>(k, cost, vars, weights, speeds);
+        }
+    }
+
+    template <typename Config>
+    static void terms(const double *vars, const CostWeights &weights, const StageSpeeds &speeds,
+                      const TerminalCost &, double *terms) {
+        for (size_t k = 0; k < Derived::template count<Config>(); k++) {
+            termsAt<Config>(k, vars, weights, speeds, terms);
+        }
+    }
+
+    template <typename Config, typename Sink>
+    static void separable(Sink &sink, const CostWeights &weights, const StageSpeeds &speeds) {
+        for (size_t k = 0; k < Derived::template count<Config>(); k++) {
+            separableAt<Config>(k, sink, weights, speeds);
+        }
+    }
+
+private:
+    template <typename Config, typename Sink>
+    static size_t subtracted(size_t k, std::true_type) {
+        return Derived::template second<Config>(k);
+    }
+
+    template <typename Config, typename Sink>
+    static size_t subtracted(size_t, std::false_type) {
+        return Sink::none;
+    }
+
+    // Only the branch of the node is instantiated, so a tape records no
+    // more than the residual.
+    template <typename Config, typename V>
+    static auto residual(size_t k, const V &vars, const StageSpeeds &, std::true_type)
+        -> decltype(vars[0] - vars[0]) {
+        return vars[Derived::template first<Config>(k)] - vars[Derived::template second<Config>(k)];
+    }
+
+    template <typename Config, typename V>
+    static auto residual(size_t k, const V &vars, const StageSpeeds &speeds, std::false_type)
+        -> decltype(vars[0] - 0.0) {
+        return vars[Derived::template first<Config>(k)] - Derived::ref(k, speeds);
+    }
+};
+
+// The state `var` at every stage of the horizon, against the speed of the
+// stage for VAR_SPEED and against 0 otherwise.
+template <CostVar var, typename Weight, CostTerm term>
+struct Tracking : ResidualNode<Tracking<var, Weight, term>, Weight, term, false> {
+    static const bool follows_speeds = var == VAR_SPEED;
+
+    template <typename Config>
+    static constexpr size_t count() {
+        return Config::N;
+    }
+
+    template <typename Config>
+    static constexpr size_t first(size_t k) {
+        return costVarStart<Config>(var) + k;
+    }
+
+    static double ref(size_t k, const StageSpeeds &speeds) { return follows_speeds ? speeds[k] : 0.0; }
+};
+
+// The actuation `var` of every move, against 0.
+template <CostVar var, typename Weight, CostTerm term>
+struct Effort : ResidualNode<Effort<var, Weight, term>, Weight, term, false> {
+    static const bool follows_speeds = false;
+
+    template <typename Config>
+    static constexpr size_t count() {
+        return Config::n_controls;
+    }
+
+    template <typename Config>
+    static constexpr size_t first(size_t k) {
+        return costVarStart<Config>(var) + k;
+    }
+
+    static double ref(size_t, const StageSpeeds &) { return 0.0; }
+};
+
+// The change of the actuation `var` from each move to the next.
+template <CostVar var, typename Weight, CostTerm term>
+struct Rate : ResidualNode<Rate<var, Weight, term>, Weight, term, true> {
+    static const bool follows_speeds = false;
+
+    template <typename Config>
+    static constexpr size_t count() {
+        return Config::n_controls > 0 ? Config::n_controls - 1 : 0;
+    }
+
+    template <typename Config>
+    static constexpr size_t first(size_t k) {
+        return costVarStart<Config>(var) + k + 1;
+    }
+
+    template <typename Config>
+    static constexpr size_t second(size_t k) {
+        return costVarStart<Config>(var) + k;
+    }
+
+    static double ref(size_t, const StageSpeeds &) { return 0.0; }
+};
+
+// The TerminalCost of the last stage: a quadratic form in its cte and epsi
+// and its speed against the reference. Left off the tape while it is all
+// zero; SeparableCost keeps its three terms for a fixed sparsity, see
+// SeparableCost::setTerminal.
+struct Terminal {
+    template <typename Config, typename T, typename V>
+    static void add(T &cost, const V &vars, const CostWeights &, const StageSpeeds &speeds,
+                    const TerminalCost &terminal) {
+        if (terminal == TerminalCost()) {
+            return;
+        }
+        const size_t last = Config::N - 1;
+        cost += terminal.cte * square(vars[Config::cte_start + last]);
+        cost += terminal.epsi * square(vars[Config::epsi_start + last]);
+        cost += terminal.cte_epsi * vars[Config::cte_start + last] * vars[Config::epsi_start + last];
+        cost += terminal.v * square(vars[Config::v_start + last] - speeds[last]);
+    }
+
+    template <typename Config>
+    static void terms(const double *vars, const CostWeights &, const StageSpeeds &speeds,
+                      const TerminalCost &terminal, double *terms) {
+        const size_t last = Config::N - 1;
+        double cte = vars[Config::cte_start + last], epsi = vars[Config::epsi_start + last];
+        terms[COST_CTE] += terminal.cte * square(cte) + terminal.cte_epsi * cte * epsi;
+        terms[COST_EPSI] += terminal.epsi * square(epsi);
+        terms[COST_SPEED] += terminal.v * square(vars[Config::v_start + last] - speeds[last]);
+    }
+
+    template <typename Config, typename Sink>
+    static void separable(Sink &sink, const CostWeights &, const StageSpeeds &speeds) {
+        const size_t last = Config::N - 1;
+        sink.addTerminal(Config::cte_start + last, Config::epsi_start + last, Config::v_start + last, last,
+                         speeds[last]);
+    }
+};
+
+// Nodes expanded index by index: residual k of each of them in turn, then
+// residual k + 1, so the stages of a horizon are added one after another.
+template <typename... Nodes>
+struct Zip;
+
+template <>
+struct Zip<> {
+    template <typename Config>
+    static constexpr size_t count() {
+        return 0;
+    }
+
+    template <typename Config, typename T, typename V>
+    static void addAt(size_t, T &, const V &, const CostWeights &, const StageSpeeds &) {}
+
+    template <typename Config>
+    static void termsAt(size_t, const double *, const CostWeights &, const StageSpeeds &, double *) {}
+
+    template <typename Config, typename Sink>
+    static void separableAt(size_t, Sink &, const CostWeights &, const StageSpeeds &) {}
+};
+
+template <typename Head, typename... Tail>
+struct Zip<Head, Tail...> {
+    template <typename Config>
+    static constexpr size_t count() {
+        return Head::template count<Config>() > Zip<Tail...>::template count<Config>()
+                   ? Head::template count<Config>()
+                   : Zip<Tail...>::template count<Config>();
+    }
+
+    template <typename Config, typename T, typename V>
+    static void addAt(size_t k, T &cost, const V &vars, const CostWeights &weights, const StageSpeeds &speeds) {
+        if (k < Head::template count<Config>()) {
+            Head::template addAt<Config>(k, cost, vars, weights, speeds);
+        }
+        Zip<Tail...>::template addAt<Config>(k, cost, vars, weights, speeds);
+    }
+
+    template <typename Config>
+    static void termsAt(size_t k, const double *vars, const CostWeights &weights, const StageSpeeds &speeds,
+                        double *terms) {
+        if (k < Head::template count<Config>()) {
+            Head::template termsAt<Config>(k, vars, weights, speeds, terms);
+        }
+        Zip<Tail...>::template termsAt<Config>(k, vars, weights, speeds, terms);
+    }
+
+    template <typename Config, typename Sink>
+    static void separableAt(size_t k, Sink &sink, const CostWeights &weights, const StageSpeeds &speeds) {
+        if (k < Head::template count<Config>()) {
+            Head::template separableAt<Config>(k, sink, weights, speeds);
+        }
+        Zip<Tail...>::template separableAt<Config>(k, sink, weights, speeds);
+    }
+
+    template <typename Config, typename T, typename V>
+    static void add(T &cost, const V &vars, const CostWeights &weights, const StageSpeeds &speeds,
+                    const TerminalCost &) {
+        for (size_t k = 0; k < count<Config>(); k++) {
+            addAt<Config>(k, cost, vars, weights, speeds);
+        }
+    }
+
+    template <typename Config>
+    static void terms(const double *vars, const CostWeights &weights, const StageSpeeds &speeds,
+                      const TerminalCost &, double *terms) {
+        for (size_t k = 0; k < count<Config>(); k++) {
+            termsAt<Config>(k, vars, weights, speeds, terms);
+        }
+    }
+
+    template <typename Config, typename Sink>
+    static void separable(Sink &sink, const CostWeights &weights, const StageSpeeds &speeds) {
+        for (size_t k = 0; k < count<Config>(); k++) {
+            separableAt<Config>(k, sink, weights, speeds);
+        }
+    }
+};
+
+// Nodes expanded one after the other.
+template <typename... Nodes>
+struct Sum;
+
+template <>
+struct Sum<> {
+    template <typename Config, typename T, typename V>
+    static void add(T &, const V &, const CostWeights &, const StageSpeeds &, const TerminalCost &) {}
+
+    template <typename Config>
+    static void terms(const double *, const CostWeights &, const StageSpeeds &, const TerminalCost &, double *) {}
+
+    template <typename Config, typename Sink>
+    static void separable(Sink &, const CostWeights &, const StageSpeeds &) {}
+};
+
+template <typename Head, typename... Tail>
+struct Sum<Head, Tail...> {
+    template <typename Config, typename T, typename V>
+    static void add(T &cost, const V &vars, const CostWeights &weights, const StageSpeeds &speeds,
+                    const TerminalCost &terminal) {
+        Head::template add<Config>(cost, vars, weights, speeds, terminal);
+        Sum<Tail...>::template add<Config>(cost, vars, weights, speeds, terminal);
+    }
+
+    template <typename Config>
+    static void terms(const double *vars, const CostWeights &weights, const StageSpeeds &speeds,
+                      const TerminalCost &terminal, double *terms) {
+        Head::template terms<Config>(vars, weights, speeds, terminal, terms);
+        Sum<Tail...>::template terms<Config>(vars, weights, speeds, terminal, terms);
+    }
+
+    template <typename Config, typename Sink>
+    static void separable(Sink &sink, const CostWeights &weights, const StageSpeeds &speeds) {
+        Head::template separable<Config>(sink, weights, speeds);
+        Sum<Tail...>::template separable<Config>(sink, weights, speeds);
+    }
+};
+
+// The cost of the controller: cte, epsi and speed at every stage, the use
+// of the actuators and their change between moves, and the terminal cost.
+typedef Sum<Zip<Tracking<VAR_CTE, WeightOf<&CostWeights::cte>, COST_CTE>,
+                Tracking<VAR_EPSI, WeightOf<&CostWeights::epsi>, COST_EPSI>,
+                Tracking<VAR_SPEED, WeightOf<&CostWeights::v>, COST_SPEED> >,
+            Zip<Effort<VAR_DELTA, WeightOf<&CostWeights::delta>, COST_ACTUATION>,
+                Effort<VAR_A, WeightOf<&CostWeights::a>, COST_ACTUATION> >,
+            Zip<Rate<VAR_DELTA, WeightOf<&CostWeights::ddelta>, COST_RATE>,
+                Rate<VAR_A, WeightOf<&CostWeights::da>, COST_RATE> >,
+            Terminal>
+    ControllerCost;
+
+#endif /* COST_MODEL_H */
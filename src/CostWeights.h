@@ -0,0 +1,55 @@
+#ifndef COST_WEIGHTS_H
+#define COST_WEIGHTS_H
+
+// The terms of the cost, see addCost: cross track and orientation error,
+// speed against the reference, use of the actuators and their change.
+enum CostTerm {
+    COST_CTE,
+    COST_EPSI,
+    COST_SPEED,
+    COST_ACTUATION,
+    COST_RATE,
+    N_COST_TERMS
+};
+
+// Weights of the cost terms of FG_eval, each multiplying a squared
+// residual. The defaults are the tuning for the simulator's lake track.
+struct CostWeights {
+    // Cross track and orientation error.
+    double cte = 12;
+    double epsi = 4050;
+    // Deviation from the reference velocity.
+    double v = 0.3;
+    // Use of the actuators.
+    double delta = 10000;
+    double a = 10;
+    // Change between sequential actuations.
+    double ddelta = 0.1;
+    double da = 10;
+    
+    bool operator==(const CostWeights &other) const {
+        return cte == other.cte && epsi == other.epsi && v == other.v && delta == other.delta &&
+               a == other.a && ddelta == other.ddelta && da == other.da;
+    }
+    
+    bool operator!=(const CostWeights &other) const { return !(*this == other); }
+};
+
+// Cost-to-go of the last stage beyond its own stage cost, see
+// LqrSchedule::terminalCost: a quadratic form in its cte and epsi, and a
+// weight on its speed against the reference. None by default.
+struct TerminalCost {
+    double cte = 0;
+    double epsi = 0;
+    // Of the product cte * epsi.
+    double cte_epsi = 0;
+    double v = 0;
+
+    bool operator==(const TerminalCost &other) const {
+        return cte == other.cte && epsi == other.epsi && cte_epsi == other.cte_epsi && v == other.v;
+    }
+
+    bool operator!=(const TerminalCost &other) const { return !(*this == other); }
+};
+
+#endif /* COST_WEIGHTS_H */
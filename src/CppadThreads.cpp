@@ -0,0 +1,89 @@
+#include "CppadThreads.h"
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <cppad/cppad.hpp>
+#include "Logger.h"
+
+using namespace std;
+
+static const size_t no_number = CPPAD_MAX_NUM_THREADS;
+
+static atomic<bool> parallel(false);
+static once_flag setup_once;
+
+// The numbers taken, lowest handed out first.
+static mutex numbers_lock;
+static bool taken[CPPAD_MAX_NUM_THREADS];
+static size_t active = 0;
+
+static size_t takeNumber() {
+    lock_guard<mutex> lock(numbers_lock);
+    for (size_t i = 0; i < no_number; i++) {
+        if (!taken[i]) {
+            taken[i] = true;
+            active++;
+            return i;
+        }
+    }
+    MPC_LOG(LOG_ERROR, "More than %zu threads use CppAD", no_number);
+    Logger::flush();
+    abort();
+}
+
+// The number of the calling thread, given back when the thread exits.
+struct ThreadNumber {
+    size_t number = no_number;
+
+    ~ThreadNumber() {
+        if (number == no_number) {
+            return;
+        }
+        CppAD::thread_alloc::free_available(number);
+        lock_guard<mutex> lock(numbers_lock);
+        taken[number] = false;
+        active--;
+    }
+};
+
+static thread_local ThreadNumber thread_number;
+
+static bool inParallel() {
+    return parallel.load(memory_order_acquire);
+}
+
+static size_t threadNum() {
+    if (thread_number.number == no_number) {
+        thread_number.number = takeNumber();
+    }
+    return thread_number.number;
+}
+
+void setupCppadThreads() {
+    call_once(setup_once, [] {
+        // CppAD is set up in sequential mode, on thread 0.
+        threadNum();
+        CppAD::thread_alloc::parallel_setup(no_number, inParallel, threadNum);
+        // The statics of AD<double> have to exist before two threads
+        // race to construct them.
+        CppAD::parallel_ad<double>();
+        parallel.store(true, memory_order_release);
+    });
+}
+
+bool cppadThreadsSetUp() {
+    return inParallel();
+}
+
+size_t cppadThreadNumber() {
+    return threadNum();
+}
+
+size_t cppadMaxThreads() {
+    return no_number;
+}
+
+size_t cppadActiveThreads() {
+    lock_guard<mutex> lock(numbers_lock);
+    return active;
+}
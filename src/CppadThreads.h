@@ -0,0 +1,39 @@
+#ifndef CPPAD_THREADS_H
+#define CPPAD_THREADS_H
+
+#include <cstddef>
+
+// CppAD keeps a tape and a memory pool per thread, told apart by a number
+// it asks the application for. Until it is told how, it assumes a single
+// thread, and two solves recording or sweeping on different threads share
+// the state of thread 0.
+//
+// Put CppAD in parallel mode for the rest of the process: each thread
+// that uses it is numbered on first use, below cppadMaxThreads, and gives
+// its number back when it exits. CppAD memory then has to be freed on the
+// thread that allocated it, so an MPC keeps none across calls: its
+// vectors are std::vector, see Dvector, and the tapes of TAPED_IPOPT are
+// kept per thread, see TapedNLP. An MPC can so be made, solved and
+// destroyed on any threads, one at a time.
+//
+// Called by the constructor of MPC; the first call must come from a
+// thread before it starts any other that uses CppAD, later calls do
+// nothing.
+void setupCppadThreads();
+
+// Whether setupCppadThreads was called. CppAD's checkpoint functions can
+// only be constructed before, see StageCheckpoint.h.
+bool cppadThreadsSetUp();
+
+// The number of the calling thread, taken on first use. Thread local
+// state that holds CppAD memory takes it in its constructor, so that the
+// number is only given back once the state is destroyed.
+size_t cppadThreadNumber();
+
+// Threads CppAD can tell apart, CPPAD_MAX_NUM_THREADS.
+size_t cppadMaxThreads();
+
+// Threads numbered at the moment, those that used CppAD and did not exit.
+size_t cppadActiveThreads();
+
+#endif /* CPPAD_THREADS_H */
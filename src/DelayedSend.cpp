@@ -0,0 +1,166 @@
+#include "DelayedSend.h"
+#include <cstring>
+#include "Metrics.h"
+
+DelayedSend::DelayedSend(uv_loop_t *loop, uint64_t delay_ms)
+    : loop(loop), delay_ms(delay_ms), timer(new uv_timer_t), stale_limit(0), deflate_threshold(0),
+      has_deflater(false) {
+    uv_timer_init(loop, timer);
+    timer->data = this;
+}
+
+DelayedSend::~DelayedSend() {
+    if (has_deflater) {
+        deflateEnd(&deflater);
+    }
+    // The handle is only released by libuv once the close completes.
+    uv_timer_stop(timer);
+    uv_close((uv_handle_t *) timer, [](uv_handle_t *handle) {
+        delete (uv_timer_t *) handle;
+    });
+}
+
+void DelayedSend::send(uWS::WebSocket<uWS::SERVER> ws, string &msg, uWS::OpCode opcode) {
+    pending.push_back({uv_now(loop) + delay_ms, ws, opcode, string()});
+    swap(pending.back().msg, msg);
+    if (!spare.empty()) {
+        swap(spare.back(), msg);
+        spare.pop_back();
+    }
+    if (pending.size() == 1) {
+        arm();
+    }
+}
+
+void DelayedSend::cancel(uWS::WebSocket<uWS::SERVER> ws) {
+    for (auto it = pending.begin(); it != pending.end();) {
+        if (it->ws == ws) {
+            spare.push_back(std::move(it->msg));
+            it = pending.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (pending.empty()) {
+        uv_timer_stop(timer);
+    }
+    auto it = backlogs.find(ws);
+    if (it != backlogs.end()) {
+        Backlog *backlog = it->second;
+        backlogs.erase(it);
+        if (backlog->lengths.empty()) {
+            delete backlog;
+        } else {
+            backlog->closed = true;
+        }
+    }
+}
+
+size_t DelayedSend::buffered(uWS::WebSocket<uWS::SERVER> ws) const {
+    auto it = backlogs.find(ws);
+    return it == backlogs.end() ? 0 : it->second->bytes;
+}
+
+void DelayedSend::arm() {
+    uint64_t now = uv_now(loop);
+    uint64_t due = pending.front().due;
+    uv_timer_start(timer, onTimer, due > now ? due - now : 0, 0);
+}
+
+DelayedSend::Backlog *DelayedSend::backlogOf(uWS::WebSocket<uWS::SERVER> ws) {
+    Backlog *&backlog = backlogs[ws];
+    if (!backlog) {
+        backlog = new Backlog(this, ws);
+    }
+    return backlog;
+}
+
+bool DelayedSend::compress(const string &msg) {
+    if (!has_deflater) {
+        memset(&deflater, 0, sizeof(deflater));
+        if (deflateInit2(&deflater, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        has_deflater = true;
+    }
+    deflateReset(&deflater);
+    deflated.resize(deflateBound(&deflater, msg.length()) + 8);
+    deflater.next_in = (Bytef *) msg.data();
+    deflater.avail_in = msg.length();
+    deflater.next_out = (Bytef *) &deflated[0];
+    deflater.avail_out = deflated.size();
+    if (deflate(&deflater, Z_SYNC_FLUSH) != Z_OK || deflater.avail_in != 0) {
+        return false;
+    }
+    // A message ends without the empty block of the sync flush, RFC 7692.
+    size_t length = deflated.size() - deflater.avail_out;
+    if (length < 4 || length - 4 >= msg.length()) {
+        return false;
+    }
+    deflated.resize(length - 4);
+    return true;
+}
+
+void DelayedSend::write(Backlog &backlog, string &msg, uWS::OpCode opcode) {
+    typedef uWS::WebSocket<uWS::SERVER> Socket;
+    if (backlog.deflate && deflate_threshold > 0 && msg.length() >= deflate_threshold && compress(msg)) {
+        backlog.lengths.push_back(deflated.length());
+        backlog.bytes += deflated.length();
+        Metrics::recordDeflate(msg.length(), deflated.length());
+        Socket::PreparedMessage *prepared =
+            Socket::prepareMessage(&deflated[0], deflated.length(), opcode, true, onWritten);
+        backlog.ws.sendPrepared(prepared, &backlog);
+        Socket::finalizeMessage(prepared);
+        return;
+    }
+    backlog.lengths.push_back(msg.length());
+    backlog.bytes += msg.length();
+    // The completion may run within the call, once the message is written.
+    backlog.ws.send(msg.data(), msg.length(), opcode, onWritten, &backlog);
+}
+
+template <typename Socket>
+void DelayedSend::onWritten(Socket, void *data, bool, void *) {
+    Backlog *backlog = (Backlog *) data;
+    if (!backlog->lengths.empty()) {
+        backlog->bytes -= backlog->lengths.front();
+        backlog->lengths.pop_front();
+    }
+    if (backlog->closed) {
+        if (backlog->lengths.empty()) {
+            delete backlog;
+        }
+        return;
+    }
+    DelayedSend *self = backlog->owner;
+    if (backlog->has_held && backlog->bytes <= self->stale_limit) {
+        backlog->has_held = false;
+        self->write(*backlog, backlog->held, backlog->held_opcode);
+    }
+}
+
+void DelayedSend::onTimer(uv_timer_t *timer) {
+    DelayedSend *self = (DelayedSend *) timer->data;
+    uint64_t now = uv_now(self->loop);
+    while (!self->pending.empty() && self->pending.front().due <= now) {
+        Pending &p = self->pending.front();
+        Backlog *backlog = self->backlogOf(p.ws);
+        if (self->stale_limit > 0 && backlog->bytes > self->stale_limit) {
+            // Held back until the socket drains, replacing the one held so
+            // far, which is stale now.
+            if (backlog->has_held) {
+                Metrics::recordShed(SHED_STALE, backlog->held.length());
+            }
+            swap(backlog->held, p.msg);
+            backlog->held_opcode = p.opcode;
+            backlog->has_held = true;
+        } else {
+            self->write(*backlog, p.msg, p.opcode);
+        }
+        self->spare.push_back(std::move(p.msg));
+        self->pending.pop_front();
+    }
+    if (!self->pending.empty()) {
+        self->arm();
+    }
+}
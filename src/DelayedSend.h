@@ -0,0 +1,115 @@
+#ifndef DELAYED_SEND_H
+#define DELAYED_SEND_H
+
+#include <uWS/uWS.h>
+#include <zlib.h>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Sends messages after a fixed delay without blocking the event loop.
+//
+// All messages share the same delay, so they become due in the order they
+// were queued and a single uv timer armed for the oldest one is enough.
+//
+// It also keeps track of the bytes each socket has been handed and not
+// written yet, which grows while the peer reads slower than it is sent
+// to, see buffered(). Past the stale limit, a message that comes due waits
+// instead, replaced by any newer one, until the socket is back below it.
+//
+// Messages to a socket that opted in to permessage-deflate, see
+// enableDeflate, are compressed when they are at least as long as the
+// deflate threshold, each on its own as under server_no_context_takeover.
+// The hub must have been created with uWS::PERMESSAGE_DEFLATE and the
+// client must have offered it, the socket does not tell.
+class DelayedSend {
+public:
+    DelayedSend(uv_loop_t *loop, uint64_t delay_ms);
+    
+    ~DelayedSend();
+    
+    // Queue `msg` for `ws`, it is sent delay_ms from now as a message of
+    // `opcode`. `msg` is swapped with the buffer of an already sent
+    // message, so callers that keep writing into the same string do not
+    // allocate once warmed up.
+    void send(uWS::WebSocket<uWS::SERVER> ws, string &msg, uWS::OpCode opcode = uWS::OpCode::TEXT);
+    
+    // Drop the messages still pending for `ws`, it must not be written to
+    // once it is disconnected.
+    void cancel(uWS::WebSocket<uWS::SERVER> ws);
+    
+    uint64_t delay() const { return delay_ms; }
+    
+    // Bytes sent to `ws` that uWS has not written out yet.
+    size_t buffered(uWS::WebSocket<uWS::SERVER> ws) const;
+    
+    // Above `bytes` buffered, keep only the newest message due for a
+    // socket, counting those replaced as SHED_STALE; 0, the default, never
+    // holds any back.
+    void setStaleLimit(size_t bytes) { stale_limit = bytes; }
+    
+    // Compress messages of at least `bytes` to the sockets that enabled
+    // it; 0, the default, compresses none.
+    void setDeflateThreshold(size_t bytes) { deflate_threshold = bytes; }
+    
+    // Compress the long messages to `ws` from now on, until cancel().
+    void enableDeflate(uWS::WebSocket<uWS::SERVER> ws) { backlogOf(ws)->deflate = true; }
+    
+private:
+    struct Pending {
+        uint64_t due;
+        uWS::WebSocket<uWS::SERVER> ws;
+        uWS::OpCode opcode;
+        string msg;
+    };
+    
+    // What a socket was handed: the length of every message not written
+    // yet, in order, their sum and the newest message held back. It is
+    // only freed once uWS completed each of them, written or cancelled,
+    // so it outlives cancel() if it has to.
+    struct Backlog {
+        DelayedSend *owner;
+        uWS::WebSocket<uWS::SERVER> ws;
+        deque<size_t> lengths;
+        size_t bytes = 0;
+        bool closed = false;
+        bool has_held = false;
+        uWS::OpCode held_opcode = uWS::OpCode::TEXT;
+        string held;
+        bool deflate = false;
+        
+        Backlog(DelayedSend *owner, uWS::WebSocket<uWS::SERVER> ws) : owner(owner), ws(ws) {}
+    };
+    
+    uv_loop_t *loop;
+    uint64_t delay_ms;
+    uv_timer_t *timer;
+    deque<Pending> pending;
+    vector<string> spare;
+    size_t stale_limit;
+    map<uWS::WebSocket<uWS::SERVER>, Backlog *> backlogs;
+    size_t deflate_threshold;
+    // Raw deflate, reset for every message, and its output.
+    z_stream deflater;
+    bool has_deflater;
+    string deflated;
+    
+    void arm();
+    // Deflate `msg` into `deflated` as a message of permessage-deflate;
+    // false if that does not make it shorter.
+    bool compress(const string &msg);
+    Backlog *backlogOf(uWS::WebSocket<uWS::SERVER> ws);
+    void write(Backlog &backlog, string &msg, uWS::OpCode opcode);
+    static void onTimer(uv_timer_t *timer);
+    
+    // The completion of a message of `data`, a Backlog, whatever uWS
+    // passes for the socket.
+    template <typename Socket>
+    static void onWritten(Socket, void *data, bool cancelled, void *reserved);
+};
+
+#endif /* DELAYED_SEND_H */
@@ -0,0 +1,90 @@
+#ifndef DUAL_NUMBER_H
+#define DUAL_NUMBER_H
+
+#include <cmath>
+#include "Eigen-3.3/Eigen/Core"
+#include "FastMath.h"
+
+// Forward-mode dual number: a value and its derivatives along n seeded
+// directions, carried through every operation by the chain rule. The
+// derivatives are a fixed-size Eigen vector, so each operation is a few
+// packed multiply-adds and nothing is ever allocated or recorded.
+//
+// vehicleStep and the math of the model are templates in their Scalar, so
+// evaluating them on Dual<double, 8> seeded with the six states and the
+// two actuations gives the Jacobian blocks of a stage in one sweep, see
+// vehicleDualStep. The operators and functions are friends found by
+// argument-dependent lookup, as those of AD<double> are.
+template <typename Scalar, int n>
+struct Dual {
+    typedef Eigen::Matrix<Scalar, n, 1> Gradient;
+
+    Scalar value;
+    Gradient grad;
+
+    Dual() {}
+
+    // A constant, no direction depends on it.
+    Dual(const Scalar &value) : value(value), grad(Gradient::Zero()) {}
+
+    // The `i`-th input, seeded along its own direction.
+    Dual(const Scalar &value, int i) : value(value), grad(Gradient::Unit(i)) {}
+
+    Dual(const Scalar &value, const Gradient &grad) : value(value), grad(grad) {}
+
+    friend Dual operator-(const Dual &x) { return Dual(-x.value, -x.grad); }
+
+    friend Dual operator+(const Dual &x, const Dual &y) { return Dual(x.value + y.value, x.grad + y.grad); }
+    friend Dual operator+(const Dual &x, const Scalar &c) { return Dual(x.value + c, x.grad); }
+    friend Dual operator+(const Scalar &c, const Dual &x) { return Dual(c + x.value, x.grad); }
+
+    friend Dual operator-(const Dual &x, const Dual &y) { return Dual(x.value - y.value, x.grad - y.grad); }
+    friend Dual operator-(const Dual &x, const Scalar &c) { return Dual(x.value - c, x.grad); }
+    friend Dual operator-(const Scalar &c, const Dual &x) { return Dual(c - x.value, -x.grad); }
+
+    friend Dual operator*(const Dual &x, const Dual &y) {
+        return Dual(x.value * y.value, x.grad * y.value + y.grad * x.value);
+    }
+    friend Dual operator*(const Dual &x, const Scalar &c) { return Dual(x.value * c, x.grad * c); }
+    friend Dual operator*(const Scalar &c, const Dual &x) { return Dual(c * x.value, x.grad * c); }
+
+    friend Dual operator/(const Dual &x, const Dual &y) {
+        Scalar q = x.value / y.value;
+        return Dual(q, (x.grad - y.grad * q) / y.value);
+    }
+    friend Dual operator/(const Dual &x, const Scalar &c) { return Dual(x.value / c, x.grad / c); }
+    friend Dual operator/(const Scalar &c, const Dual &x) {
+        Scalar q = c / x.value;
+        return Dual(q, x.grad * (-q / x.value));
+    }
+
+    Dual &operator+=(const Dual &x) { return *this = *this + x; }
+    Dual &operator-=(const Dual &x) { return *this = *this - x; }
+    Dual &operator*=(const Dual &x) { return *this = *this * x; }
+
+    friend Dual sin(const Dual &x) {
+        using std::cos;
+        using std::sin;
+        return Dual(sin(x.value), x.grad * cos(x.value));
+    }
+    friend Dual cos(const Dual &x) {
+        using std::cos;
+        using std::sin;
+        return Dual(cos(x.value), x.grad * -sin(x.value));
+    }
+    friend Dual atan(const Dual &x) {
+        using std::atan;
+        return Dual(atan(x.value), x.grad / (1 + x.value * x.value));
+    }
+    friend Dual sqrt(const Dual &x) {
+        using std::sqrt;
+        Scalar r = sqrt(x.value);
+        return Dual(r, x.grad / (2 * r));
+    }
+
+    // The angle reduction of FastMath.h shifts the value by whole turns,
+    // which leaves the derivatives as they are.
+    friend Dual fastReduce(const Dual &x) { return Dual(fastReduce(x.value), x.grad); }
+};
+
+#endif /* DUAL_NUMBER_H */
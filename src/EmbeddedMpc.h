@@ -0,0 +1,167 @@
+#ifndef EMBEDDED_MPC_H
+#define EMBEDDED_MPC_H
+
+#include <math.h>
+#include "CostWeights.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "MpcConfig.h"
+#include "PolyFit.h"
+#include "Polynomial.h"
+#include "Riccati.h"
+#include "RtiStage.h"
+#include "SpeedProfile.h"
+#include "VehicleModel.h"
+
+// The controller of the embedded build, see MPC_EMBEDDED in
+// CMakeLists.txt: the fit of Controller, its prediction over the actuation
+// delay and the real-time iteration of RtiSolver in stage form, on the
+// horizon `Config` fixed at compile time. Every buffer is a fixed-size
+// member, so an instance in static storage is all the memory it needs: it
+// allocates nothing, throws nothing and needs no RTTI. The model is
+// vehicleStep and the QP that of stageProblem, the same as on the desktop
+// with MPC_SOLVER=rti.
+//
+// At most `max_points` waypoints per frame.
+template <typename Config = DefaultConfig, int max_points = 16>
+class EmbeddedMpc {
+public:
+    static_assert(Config::uniform && Config::latency <= 1,
+                  "the stage form needs a uniform grid and at most one stage of latency");
+
+    static const int N = Config::N;
+    static const int n_controls = Config::n_controls;
+
+    typedef Eigen::Matrix<double, 6, 1> State;
+    typedef PolyFit<3>::Coeffs Coeffs;
+
+    // One frame of telemetry in the units of the simulator: the pose in
+    // map coordinates, the speed in mph, the actuations last applied, the
+    // time in s until the next ones take effect and the waypoints ahead.
+    struct Frame {
+        double x = 0, y = 0, psi = 0;
+        double speed = 0;
+        double steering_angle = 0, throttle = 0;
+        double delay = actuation_delay_ms / 1000.0;
+        int n_points = 0;
+        double ptsx[max_points];
+        double ptsy[max_points];
+    };
+
+    EmbeddedMpc() : iterations(1), speeds(constantSpeeds()) {
+        lb.setZero();
+        ub.setZero();
+        for (int j = 0; j < n_controls; j++) {
+            lb.template segment<2>(2 * j) << -max_delta, -max_a;
+            ub.template segment<2>(2 * j) << max_delta, max_a;
+        }
+        reset();
+    }
+
+    void setCostWeights(const CostWeights &weights) { this->weights = weights; }
+
+    // SQP iterations per step, 1 being the real-time iteration.
+    void setIterations(int iterations) { this->iterations = iterations > 0 ? iterations : 1; }
+
+    // Forget the plan, so the next step starts from zero actuations.
+    void reset() { u.setZero(); }
+
+    // The actuations for `frame` as the simulator takes them, the steering
+    // in [-1, 1] positive to the right and the throttle. False with fewer
+    // than 4 or more than max_points waypoints, leaving both alone, or when
+    // a QP failed, the plan as far as it got then being applied.
+    bool step(const Frame &frame, double &steering, double &throttle) {
+        int n = frame.n_points;
+        if (n < 4 || n > max_points) {
+            return false;
+        }
+
+        // The waypoints in the vehicle frame and the cubic through them.
+        double c = cos(frame.psi), s = sin(frame.psi);
+        for (int i = 0; i < n; i++) {
+            double dx = frame.ptsx[i] - frame.x, dy = frame.ptsy[i] - frame.y;
+            xs[i] = c * dx + s * dy;
+            ys[i] = -s * dx + c * dy;
+        }
+        coeffs = polyfitFixed<3>(xs, ys, n);
+
+        // The state at the end of the delay under the actuations last
+        // applied, as predictState.
+        const double now[6] = {0.0, 0.0, 0.0, frame.speed * 0.447, polyeval(coeffs, 0.0), -atan(coeffs[1])};
+        vehicleStep(now, -frame.steering_angle, frame.throttle, coeffs, frame.delay, states[0].data());
+
+        // The last plan shifted by a move, the last one held.
+        for (int j = 0; j + 1 < n_controls; j++) {
+            u.template segment<2>(2 * j) = u.template segment<2>(2 * j + 2);
+        }
+        u = u.cwiseMax(lb).cwiseMin(ub);
+
+        bool ok = true;
+        for (int i = 0; i < iterations && ok; i++) {
+            linearize();
+            stageProblem<Config>(states, jac_A, jac_B, u, weights, speeds, lq);
+            for (int k = 0; k < N - 1; k++) {
+                lq.lb[k] = lb.template segment<2>(2 * k) - u.template segment<2>(2 * k);
+                lq.ub[k] = ub.template segment<2>(2 * k) - u.template segment<2>(2 * k);
+            }
+            stage_x[0].setZero();
+            ok = lq.solve(stage_x, stage_u) >= 0;
+            if (ok) {
+                for (int k = 0; k < N - 1; k++) {
+                    u.template segment<2>(2 * k) += stage_u[k];
+                }
+                u = u.cwiseMax(lb).cwiseMin(ub);
+            }
+        }
+        simulate();
+
+        steering = -u[0] / max_delta;
+        throttle = u[1];
+        return ok;
+    }
+
+    // Stage t of the trajectory planned by the last step, in the vehicle
+    // frame at the end of the delay.
+    const State &stage(int t) const { return states[t]; }
+
+private:
+    typedef Eigen::Matrix<double, 2 * Config::n_controls, 1> Controls;
+    typedef BoxRiccati<8, 2, Config::N - 1> StageQP;
+
+    int iterations;
+    CostWeights weights;
+    StageSpeeds speeds;
+
+    double xs[max_points];
+    double ys[max_points];
+    Coeffs coeffs;
+
+    // The plan, delta and a interleaved per move, and its bounds.
+    Controls u;
+    Controls lb, ub;
+
+    State states[Config::N];
+    Eigen::Matrix<double, 6, 6> jac_A[Config::N];
+    Eigen::Matrix<double, 6, 2> jac_B[Config::N];
+    StageQP lq;
+    typename StageQP::State stage_x[Config::N];
+    typename StageQP::Input stage_u[Config::N - 1];
+
+    // The states from states[0] under the plan.
+    void simulate() {
+        for (int t = 1; t < N; t++) {
+            int j = Config::controlIndex(t);
+            vehicleStep(states[t - 1].data(), u[2 * j], u[2 * j + 1], coeffs, Config::stageDt(t), states[t].data());
+        }
+    }
+
+    // simulate() with the Jacobians of every transition.
+    void linearize() {
+        for (int t = 1; t < N; t++) {
+            int j = Config::controlIndex(t);
+            vehicleStepJacobians(states[t - 1].data(), u[2 * j], u[2 * j + 1], coeffs, Config::stageDt(t),
+                                 states[t].data(), &jac_A[t], &jac_B[t]);
+        }
+    }
+};
+
+#endif /* EMBEDDED_MPC_H */
@@ -0,0 +1,164 @@
+#ifndef FG_EVAL_H
+#define FG_EVAL_H
+
+#include <cppad/cppad.hpp>
+#include "CostModel.h"
+#include "CostWeights.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "FleetHash.h"
+#include "MpcConfig.h"
+#include "Polynomial.h"
+#include "SpeedProfile.h"
+#include "StageCheckpoint.h"
+#include "VehicleModel.h"
+
+using CppAD::AD;
+
+// Cost of a trajectory, shared by the model variants: only the cte, epsi
+// and speed states and the actuations enter it, the speed against the
+// reference of its stage, plus the `terminal` cost of the last stage. See
+// ControllerCost, which SeparableCost::build and costTerms expand too.
+template <typename Config, typename Scalar, typename Vector>
+void addCost(Scalar &cost, const Vector &vars, const CostWeights &weights, const StageSpeeds &speeds,
+             const TerminalCost &terminal = TerminalCost()) {
+    ControllerCost::add<Config>(cost, vars, weights, speeds, terminal);
+}
+
+// Penalty keeping the stages of a plan off the other vehicles of a fleet,
+// see FleetHash: the weight times the square of how far, in m^2, the
+// squared distance of a stage to the predicted position of another
+// vehicle at that stage is inside the squared radius, 0 outside. The
+// initial stage is fixed and left out. A conditional expression on the
+// tape, which is recorded at the first iterate.
+template <typename Config, typename Scalar, typename Vector>
+void addObstacleCost(Scalar &cost, const Vector &vars, const FleetObstacles &obstacles) {
+    const Scalar zero(0);
+    double r2 = obstacles.radius * obstacles.radius;
+    for (const StageObstacle &o : obstacles.points) {
+        if (o.stage == 0 || o.stage >= Config::N) {
+            continue;
+        }
+        Scalar dx = vars[Config::x_start + o.stage] - o.x;
+        Scalar dy = vars[Config::y_start + o.stage] - o.y;
+        Scalar inside = r2 - (dx * dx + dy * dy);
+        cost += obstacles.weight * CppAD::CondExpGt(inside, zero, inside * inside, zero);
+    }
+}
+
+// addCost of `vars` in double, into its terms, see CostTerm.
+template <typename Config>
+void costTerms(const double *vars, const CostWeights &weights, const StageSpeeds &speeds, double *terms,
+               const TerminalCost &terminal = TerminalCost()) {
+    for (int i = 0; i < N_COST_TERMS; i++) {
+        terms[i] = 0;
+    }
+    ControllerCost::terms<Config>(vars, weights, speeds, terminal, terms);
+}
+
+// `Config` is the compile-time horizon, see MpcConfig.h.
+//
+// `Coeffs` is either a plain Eigen::VectorXd, when the model is taped on
+// every solve, or a vector of AD<double> dynamic parameters, when it is taped
+// once and re-evaluated with new coefficients.
+template <typename Config, typename Coeffs>
+class FG_eval : private Config {
+    using Config::N;
+    using Config::x_start;
+    using Config::y_start;
+    using Config::psi_start;
+    using Config::v_start;
+    using Config::cte_start;
+    using Config::epsi_start;
+    using Config::delta_start;
+    using Config::a_start;
+    
+public:
+    // Fitted polynomial coefficients
+    Coeffs coeffs;
+    CostWeights weights;
+    // Reference velocity of each stage.
+    StageSpeeds speeds;
+    // When set, the stages call these instead of inlining vehicleStep.
+    StageCheckpoints *checkpoints;
+    // See addCost.
+    TerminalCost terminal;
+    // Whether fg[0] is the cost; TapedNLP leaves it at zero and evaluates
+    // the cost itself, see SeparableCost.
+    bool with_cost;
+    // Other vehicles to keep clear of, see addObstacleCost; null for none.
+    const FleetObstacles *obstacles;
+    FG_eval(Coeffs coeffs, const CostWeights &weights = CostWeights())
+        : weights(weights), speeds(constantSpeeds()), checkpoints(nullptr), with_cost(true),
+          obstacles(nullptr) {
+        this->coeffs = coeffs;
+    }
+    
+    typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
+    // `Vector` is ADvector when taping, or a vector of double with plain
+    // Eigen::VectorXd coefficients to evaluate [f, g] without a tape, see
+    // TapedNLP::evaluate; the checkpoints are for the tape only.
+    template <typename Vector>
+    void operator()(Vector& fg, const Vector& vars) {
+        typedef typename Vector::value_type Scalar;
+        // implement MPC
+        // `fg` a vector of the cost constraints, `vars` is a vector of variable values (state & actuators)
+        // NOTE: You'll probably go back and forth between this function and
+        // the Solver function below.
+        
+        fg[0] = 0;
+        if (with_cost) {
+            addCost<Config>(fg[0], vars, weights, speeds, terminal);
+        }
+        if (with_cost && obstacles) {
+            addObstacleCost<Config>(fg[0], vars, *obstacles);
+        }
+        
+        // Setup Constraints
+        // We add 1 to each of the starting indices due to cost being located at
+        // index 0 of `fg`.
+        // This bumps up the position of all the other values.
+        fg[1 + x_start] = vars[x_start];
+        fg[1 + y_start] = vars[y_start];
+        fg[1 + psi_start] = vars[psi_start];
+        fg[1 + v_start] = vars[v_start];
+        fg[1 + cte_start] = vars[cte_start];
+        fg[1 + epsi_start] = vars[epsi_start];
+        
+        // The rest of the constraints
+        for (int t = 1; t < N; t++) {
+            const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+            Scalar s0[6];
+            for (int k = 0; k < 6; k++) {
+                s0[k] = vars[starts[k] + t - 1];
+            }
+            
+            // actuations, accounting for the actuation delay
+            Scalar delta = vars[delta_start + Config::controlIndex(t)];
+            Scalar a = vars[a_start + Config::controlIndex(t)];
+            
+            // NOTE: The use of `AD<double>` and use of `CppAD`!
+            // This is also CppAD can compute derivatives and pass
+            // these to the solver.
+            Scalar s1[6];
+            step(t, s0, delta, a, s1);
+            for (int k = 0; k < 6; k++) {
+                fg[1 + starts[k] + t] = vars[starts[k] + t] - s1[k];
+            }
+        }
+    }
+
+private:
+    void step(int t, const AD<double> s0[6], const AD<double> &delta, const AD<double> &a, AD<double> s1[6]) {
+        if (checkpoints) {
+            checkpoints->step(Config::stageDt(t), s0, delta, a, coeffs, s1);
+        } else {
+            vehicleStep(s0, delta, a, coeffs, Config::stageDt(t), s1);
+        }
+    }
+
+    void step(int t, const double s0[6], const double &delta, const double &a, double s1[6]) {
+        vehicleStep(s0, delta, a, coeffs, Config::stageDt(t), s1);
+    }
+};
+
+#endif /* FG_EVAL_H */
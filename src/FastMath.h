@@ -0,0 +1,177 @@
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <cmath>
+#include <cstddef>
+
+// Polynomial sin, cos and atan for the model, see modelSin, and their
+// exact derivatives, so a backend differentiating the approximation gets
+// the slopes of the function it evaluates. They are minimax fits, found by
+// Lawson's iteration; the largest errors against libm are
+//
+//     fastSin    9.6e-8 on [-pi, pi], fastSinSlope   5.1e-6
+//     fastCos    1.1e-8 on [-pi, pi], fastCosSlope   6.8e-7
+//     fastAtan   1.5e-8 everywhere,   fastAtanSlope  9.5e-8
+//
+// In double and float the angle of sin and cos is first reduced to
+// [-pi, pi]. Any other Scalar, AD<double> in particular, is taken as it
+// is: a reduction would be recorded as a constant on a tape, so there the
+// bounds only hold within [-pi, pi], which covers the headings of a
+// horizon in the vehicle frame. atan needs no reduction: halving the angle
+// twice, atan(x) = 2 atan(x / (1 + sqrt(1 + x^2))), brings any argument
+// within tan(pi/8) of zero, where the fit is taken.
+//
+// mpc_bench -m checks these bounds and times the functions against libm.
+
+static const double fast_sin_c[6] = {0.9999996039311374, -0.16666553448598756, 0.008332407604888382,
+                                     -0.0001980874028691212, 2.6998230255730648e-06, -2.036623929733741e-08};
+static const double fast_sin_slope_c[6] = {0.9999996039311374, -0.4999966034579627, 0.04166203802444191,
+                                           -0.0013866118200838483, 2.429840723015758e-05, -2.240286322707115e-07};
+static const double fast_cos_c[7] = {0.9999999891547912, -0.49999989167966535, 0.0416664900054521,
+                                     -0.00138878070074851, 2.4769950278834456e-05, -2.7079632664745677e-07,
+                                     1.7247127295472366e-09};
+static const double fast_cos_slope_c[6] = {-0.9999997833593307, 0.1666659600218084, -0.00833268420449106,
+                                           0.00019815960223067565, -2.7079632664745677e-06, 2.069655275456684e-08};
+static const double fast_atan_c[5] = {0.9999999055928491, -0.33332204141981725, 0.19961966515337487,
+                                      -0.13754817229563007, 0.07734569692362643};
+static const double fast_atan_slope_c[5] = {0.9999999055928491, -0.9999661242594517, 0.9980983257668743,
+                                            -0.9628372060694105, 0.6961112723126379};
+
+// sum c[k] u^k by Horner's rule.
+template <typename Scalar, size_t n>
+inline Scalar fastHorner(const double (&c)[n], const Scalar &u) {
+    Scalar p = Scalar(c[n - 1]);
+    for (size_t k = n - 1; k-- > 0;) {
+        p = p * u + Scalar(c[k]);
+    }
+    return p;
+}
+
+// The angle in [-pi, pi] that x is a turn of, in double and float.
+inline double fastReduce(double x) {
+    return x - 2 * M_PI * std::nearbyint(x * (0.5 / M_PI));
+}
+
+inline float fastReduce(float x) {
+    return x - float(2 * M_PI) * std::nearbyint(x * float(0.5 / M_PI));
+}
+
+template <typename Scalar>
+inline const Scalar &fastReduce(const Scalar &x) {
+    return x;
+}
+
+template <typename Scalar>
+inline Scalar fastSin(const Scalar &x) {
+    Scalar r = fastReduce(x);
+    return r * fastHorner(fast_sin_c, r * r);
+}
+
+template <typename Scalar>
+inline Scalar fastSinSlope(const Scalar &x) {
+    Scalar r = fastReduce(x);
+    return fastHorner(fast_sin_slope_c, r * r);
+}
+
+template <typename Scalar>
+inline Scalar fastCos(const Scalar &x) {
+    Scalar r = fastReduce(x);
+    return fastHorner(fast_cos_c, r * r);
+}
+
+template <typename Scalar>
+inline Scalar fastCosSlope(const Scalar &x) {
+    Scalar r = fastReduce(x);
+    return r * fastHorner(fast_cos_slope_c, r * r);
+}
+
+// tan of half the angle whose tan is x, and its derivative.
+template <typename Scalar>
+inline Scalar fastHalfTan(const Scalar &x) {
+    using std::sqrt;
+    return x / (Scalar(1) + sqrt(Scalar(1) + x * x));
+}
+
+template <typename Scalar>
+inline Scalar fastHalfTanSlope(const Scalar &x) {
+    using std::sqrt;
+    Scalar s = sqrt(Scalar(1) + x * x);
+    return Scalar(1) / (s * (Scalar(1) + s));
+}
+
+template <typename Scalar>
+inline Scalar fastAtan(const Scalar &x) {
+    Scalar t = fastHalfTan(fastHalfTan(x));
+    return Scalar(4) * t * fastHorner(fast_atan_c, t * t);
+}
+
+template <typename Scalar>
+inline Scalar fastAtanSlope(const Scalar &x) {
+    Scalar h = fastHalfTan(x);
+    Scalar t = fastHalfTan(h);
+    return Scalar(4) * fastHorner(fast_atan_slope_c, t * t) * fastHalfTanSlope(h) * fastHalfTanSlope(x);
+}
+
+// The sin, cos and atan of the model and their derivatives: the fits
+// above in builds with MPC_FAST_MATH, libm's and CppAD's otherwise, found
+// by argument-dependent lookup for AD<double>.
+template <typename Scalar>
+inline Scalar modelSin(const Scalar &x) {
+#ifdef MPC_FAST_MATH
+    return fastSin(x);
+#else
+    using std::sin;
+    return sin(x);
+#endif
+}
+
+template <typename Scalar>
+inline Scalar modelSinSlope(const Scalar &x) {
+#ifdef MPC_FAST_MATH
+    return fastSinSlope(x);
+#else
+    using std::cos;
+    return cos(x);
+#endif
+}
+
+template <typename Scalar>
+inline Scalar modelCos(const Scalar &x) {
+#ifdef MPC_FAST_MATH
+    return fastCos(x);
+#else
+    using std::cos;
+    return cos(x);
+#endif
+}
+
+template <typename Scalar>
+inline Scalar modelCosSlope(const Scalar &x) {
+#ifdef MPC_FAST_MATH
+    return fastCosSlope(x);
+#else
+    using std::sin;
+    return -sin(x);
+#endif
+}
+
+template <typename Scalar>
+inline Scalar modelAtan(const Scalar &x) {
+#ifdef MPC_FAST_MATH
+    return fastAtan(x);
+#else
+    using std::atan;
+    return atan(x);
+#endif
+}
+
+template <typename Scalar>
+inline Scalar modelAtanSlope(const Scalar &x) {
+#ifdef MPC_FAST_MATH
+    return fastAtanSlope(x);
+#else
+    return Scalar(1) / (Scalar(1) + x * x);
+#endif
+}
+
+#endif /* FAST_MATH_H */
@@ -0,0 +1,88 @@
+#include "FleetHash.h"
+#include <math.h>
+#include <algorithm>
+
+FleetHash::FleetHash(double range) : cell(range > 0 ? range : 1.0), snapshot(new Snapshot) {}
+
+uint64_t FleetHash::cellOf(double x, double y, int64_t dx, int64_t dy) const {
+    int64_t ix = (int64_t) floor(x / cell) + dx;
+    int64_t iy = (int64_t) floor(y / cell) + dy;
+    return ((uint64_t) (uint32_t) ix << 32) | (uint32_t) iy;
+}
+
+void FleetHash::publish(uint32_t vehicle, const double *xs, const double *ys, size_t n) {
+    lock_guard<mutex> hold(pending_lock);
+    vector<Point> &plan = pending[vehicle];
+    plan.resize(n);
+    for (size_t t = 0; t < n; t++) {
+        plan[t] = Point{xs[t], ys[t], vehicle, (uint32_t) t};
+    }
+}
+
+void FleetHash::retire(uint32_t vehicle) {
+    lock_guard<mutex> hold(pending_lock);
+    pending.erase(vehicle);
+}
+
+void FleetHash::tick() {
+    shared_ptr<Snapshot> next(new Snapshot);
+    {
+        lock_guard<mutex> hold(pending_lock);
+        for (const auto &plan : pending) {
+            next->points.insert(next->points.end(), plan.second.begin(), plan.second.end());
+        }
+        next->vehicles = pending.size();
+    }
+    vector<pair<uint64_t, size_t> > keys(next->points.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = make_pair(cellOf(next->points[i].x, next->points[i].y), i);
+    }
+    sort(keys.begin(), keys.end());
+    vector<Point> sorted(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        sorted[i] = next->points[keys[i].second];
+        if (i == 0 || keys[i].first != keys[i - 1].first) {
+            next->cells[keys[i].first] = make_pair(i, i + 1);
+        } else {
+            next->cells[keys[i].first].second = i + 1;
+        }
+    }
+    next->points.swap(sorted);
+    lock_guard<mutex> hold(snapshot_lock);
+    snapshot = next;
+}
+
+size_t FleetHash::near(uint32_t vehicle, const double *xs, const double *ys, size_t n,
+                       vector<StageObstacle> &out) const {
+    shared_ptr<const Snapshot> hashed;
+    {
+        lock_guard<mutex> hold(snapshot_lock);
+        hashed = snapshot;
+    }
+    size_t found = 0;
+    for (size_t t = 0; t < n; t++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                auto it = hashed->cells.find(cellOf(xs[t], ys[t], dx, dy));
+                if (it == hashed->cells.end()) {
+                    continue;
+                }
+                for (size_t i = it->second.first; i < it->second.second; i++) {
+                    const Point &p = hashed->points[i];
+                    if (p.vehicle == vehicle || p.stage != t ||
+                        hypot(p.x - xs[t], p.y - ys[t]) > cell) {
+                        continue;
+                    }
+                    out.push_back(StageObstacle{t, p.x, p.y});
+                    found++;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+size_t FleetHash::vehicles() const {
+    lock_guard<mutex> hold(snapshot_lock);
+    return snapshot->vehicles;
+}
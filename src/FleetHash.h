@@ -0,0 +1,96 @@
+#ifndef FLEET_HASH_H
+#define FLEET_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Predicted position of another vehicle at a stage of the plan, in the
+// vehicle frame of the solve it is kept away from.
+struct StageObstacle {
+    size_t stage;
+    double x;
+    double y;
+};
+
+// The other vehicles near the plan of a solve, and how they enter its
+// cost, see addObstacleCost.
+struct FleetObstacles {
+    // Distance the stages are to keep from them, m.
+    double radius = 0;
+    // Weight of the square of how far a stage is inside that distance.
+    double weight = 0;
+    vector<StageObstacle> points;
+};
+
+// Predicted trajectories of the vehicles of a fleet driving one track,
+// shared by their controllers so each keeps clear of the others, see
+// Controller::setFleet.
+//
+// Every controller publishes the stages of its plan after a solve, in map
+// coordinates. tick(), once per control period, makes those published so
+// far the ones looked up, hashed into square cells as wide as the range: a
+// point within range of a position is in its cell or one of the eight
+// around it. A lookup then costs the vehicles nearby rather than the whole
+// fleet, and a tick the points of the fleet. Lookups run against the
+// snapshot of the last tick without blocking the publishers or each other.
+class FleetHash {
+public:
+    explicit FleetHash(double range);
+
+    double range() const { return cell; }
+
+    // The plan of `vehicle`, its stages at (xs[t], ys[t]) for t < n, for
+    // the next tick, in place of the one it published before.
+    void publish(uint32_t vehicle, const double *xs, const double *ys, size_t n);
+
+    // Drop the plan of `vehicle`, e.g. once it disconnects.
+    void retire(uint32_t vehicle);
+
+    // Hash the plans published so far for the lookups until the next tick.
+    void tick();
+
+    // The stages of the plans of the vehicles other than `vehicle` within
+    // range of its stages (xs[t], ys[t]) at the same stage t, t < n,
+    // appended to `out` in map coordinates. Their number.
+    size_t near(uint32_t vehicle, const double *xs, const double *ys, size_t n,
+                vector<StageObstacle> &out) const;
+
+    // Vehicles hashed at the last tick.
+    size_t vehicles() const;
+
+private:
+    struct Point {
+        double x;
+        double y;
+        uint32_t vehicle;
+        uint32_t stage;
+    };
+
+    // The points of a tick sorted by cell, and the range of each cell in
+    // them.
+    struct Snapshot {
+        vector<Point> points;
+        unordered_map<uint64_t, pair<size_t, size_t> > cells;
+        size_t vehicles = 0;
+    };
+
+    double cell;
+
+    // Latest plan of each vehicle, as published.
+    mutex pending_lock;
+    unordered_map<uint32_t, vector<Point> > pending;
+
+    // The snapshot looked up, replaced whole at every tick.
+    mutable mutex snapshot_lock;
+    shared_ptr<const Snapshot> snapshot;
+
+    uint64_t cellOf(double x, double y, int64_t dx = 0, int64_t dy = 0) const;
+};
+
+#endif /* FLEET_HASH_H */
@@ -0,0 +1,59 @@
+#include "FleetStore.h"
+#include <algorithm>
+
+FleetStore::FleetStore(size_t trajectory) : trajectory(trajectory), n_live(0) {}
+
+FleetHandle FleetStore::add() {
+    uint32_t slot;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        slot = (uint32_t) generations.size();
+        size_t n = slot + 1;
+        for (auto &column : states) {
+            column.resize(n);
+        }
+        for (auto &column : coeffs) {
+            column.resize(n);
+        }
+        deltas.resize(n);
+        accelerations.resize(n);
+        trajectories.resize(n * trajectory);
+        warm_starts.resize(n);
+        generations.resize(n);
+        live.resize(n);
+    }
+    for (auto &column : states) {
+        column[slot] = 0;
+    }
+    for (auto &column : coeffs) {
+        column[slot] = 0;
+    }
+    deltas[slot] = 0;
+    accelerations[slot] = 0;
+    fill(trajectoryOf(slot), trajectoryOf(slot) + trajectory, 0.0);
+    warm_starts[slot] = 0;
+    live[slot] = 1;
+    n_live++;
+    return FleetHandle{slot, generations[slot]};
+}
+
+void FleetStore::remove(FleetHandle handle) {
+    if (!contains(handle)) {
+        return;
+    }
+    live[handle.slot] = 0;
+    generations[handle.slot]++;
+    free_slots.push_back(handle.slot);
+    n_live--;
+}
+
+void FleetStore::setProblem(size_t slot, const StateVector &state, const CubicCoeffs &coeffs) {
+    for (int k = 0; k < 6; k++) {
+        states[k][slot] = state[k];
+    }
+    for (int k = 0; k < 4; k++) {
+        this->coeffs[k][slot] = coeffs[k];
+    }
+}
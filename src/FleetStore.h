@@ -0,0 +1,85 @@
+#ifndef FLEET_STORE_H
+#define FLEET_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "MPC.h"
+
+using namespace std;
+
+// A vehicle of a FleetStore: its slot, and the generation of the slot it
+// was added in, so that a handle of a removed vehicle is told from the one
+// that took its slot over.
+struct FleetHandle {
+    uint32_t slot;
+    uint32_t generation;
+};
+
+// What the batch solves of a fleet read and write per vehicle, kept as
+// structure of arrays indexed by slot rather than in the controller of
+// each vehicle: every entry of the initial states, of the reference
+// cubics, and the last actuations, a column each, and the warm starts,
+// the primal trajectories of the last solves, back to back, `trajectory`
+// doubles apart. A packet of MPC::SolveBatch then reads a few cache lines
+// of each column, and one run of memory per warm start.
+//
+// Handles stay valid until their vehicle is removed; its slot is reused
+// by the next one added. The columns may move when the store grows, so
+// their pointers are only good until the next add().
+class FleetStore {
+public:
+    // A store of no vehicles whose warm starts are `trajectory` doubles,
+    // MPC::getBatchWarmStartSize of the horizon that solves them.
+    explicit FleetStore(size_t trajectory);
+
+    // A new vehicle, with everything zero and no warm start.
+    FleetHandle add();
+
+    // Release the slot of `handle`, if it is still valid.
+    void remove(FleetHandle handle);
+
+    bool contains(FleetHandle handle) const {
+        return handle.slot < generations.size() && generations[handle.slot] == handle.generation && live[handle.slot];
+    }
+
+    // Vehicles held, and slots including the free ones.
+    size_t size() const { return n_live; }
+    size_t slots() const { return generations.size(); }
+
+    size_t trajectorySize() const { return trajectory; }
+
+    // Columns over the slots: entry k of the initial states, in the order
+    // of StateVector, and coefficient k of the reference cubics.
+    double *state(int k) { return states[k].data(); }
+    const double *state(int k) const { return states[k].data(); }
+    double *coeff(int k) { return coeffs[k].data(); }
+    const double *coeff(int k) const { return coeffs[k].data(); }
+
+    // The first actuations of the last solves.
+    double *delta() { return deltas.data(); }
+    double *a() { return accelerations.data(); }
+
+    // The warm start of `slot`, valid if warm(slot).
+    double *trajectoryOf(size_t slot) { return &trajectories[slot * trajectory]; }
+    const double *trajectoryOf(size_t slot) const { return &trajectories[slot * trajectory]; }
+    bool warm(size_t slot) const { return warm_starts[slot] != 0; }
+    void setWarm(size_t slot, bool warm) { warm_starts[slot] = warm; }
+
+    void setProblem(size_t slot, const StateVector &state, const CubicCoeffs &coeffs);
+
+private:
+    size_t trajectory;
+    vector<double> states[6];
+    vector<double> coeffs[4];
+    vector<double> deltas;
+    vector<double> accelerations;
+    vector<double> trajectories;
+    vector<char> warm_starts;
+    vector<uint32_t> generations;
+    vector<char> live;
+    vector<uint32_t> free_slots;
+    size_t n_live;
+};
+
+#endif /* FLEET_STORE_H */
@@ -0,0 +1,140 @@
+#ifndef FRENET_FG_EVAL_H
+#define FRENET_FG_EVAL_H
+
+#include <cppad/cppad.hpp>
+#include "CostWeights.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "FG_eval.h"
+#include "MpcConfig.h"
+#include "Polynomial.h"
+
+using CppAD::AD;
+
+// Curvature of the reference polynomial under each transition of the
+// initial guess `vars`, positive to the left: at its predicted x when warm
+// starting, otherwise at the distance covered at the initial speed.
+template <typename Config, typename Vector>
+Eigen::VectorXd curvatureProfile(const Eigen::VectorXd &coeffs, const Vector &vars, bool warm) {
+    Eigen::VectorXd kappa(Config::N - 1);
+    double elapsed = 0;
+    for (size_t t = 0; t + 1 < Config::N; t++) {
+        double x = warm ? vars[Config::x_start + t]
+                        : vars[Config::x_start] + vars[Config::v_start] * elapsed;
+        elapsed += Config::stageDt(t + 1);
+        double f[3];
+        polyDerivatives<2>(coeffs, x, f);
+        kappa[t] = f[2] / pow(1.0 + f[1] * f[1], 1.5);
+    }
+    return kappa;
+}
+
+// The model of FG_eval with the cte and epsi dynamics in path-relative
+// (Frenet) coordinates: the reference only enters through its curvature
+// under each transition, `kappa`, precomputed by curvatureProfile. No
+// polynomial or atan is evaluated on the tape.
+//
+// cte is the offset of the path from the car, as in FG_eval, so the car's
+// offset from the path is -cte:
+//
+//     cte' = -v sin(epsi)
+//     epsi' = v / Lf delta - kappa v cos(epsi) / (1 + kappa cte)
+//
+// x, y and psi keep the kinematics of the vehicle frame; they are not in
+// the cost and only serve the predicted trajectory and the warm start.
+// With `reduced` their rows pin them instead, g = x, so TapedNLP fixes
+// them by their bounds and IPOPT solves over v, cte, epsi and the
+// actuations alone; rollOutPose fills them in after the solve.
+//
+// `Curvature` is Eigen::VectorXd or AD<double> dynamic parameters, as the
+// `Coeffs` of FG_eval.
+template <typename Config, typename Curvature>
+class FrenetFG_eval : private Config {
+    using Config::N;
+    using Config::x_start;
+    using Config::y_start;
+    using Config::psi_start;
+    using Config::v_start;
+    using Config::cte_start;
+    using Config::epsi_start;
+    using Config::delta_start;
+    using Config::a_start;
+
+public:
+    Curvature kappa;
+    CostWeights weights;
+    // See FG_eval::speeds, FG_eval::terminal and FG_eval::with_cost.
+    StageSpeeds speeds;
+    TerminalCost terminal;
+    bool with_cost;
+    bool reduced;
+    FrenetFG_eval(Curvature kappa, const CostWeights &weights = CostWeights())
+        : weights(weights), speeds(constantSpeeds()), with_cost(true), reduced(false) {
+        this->kappa = kappa;
+    }
+
+    typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
+    // See FG_eval::operator().
+    template <typename Vector>
+    void operator()(Vector& fg, const Vector& vars) {
+        typedef typename Vector::value_type Scalar;
+        fg[0] = 0;
+        if (with_cost) {
+            addCost<Config>(fg[0], vars, weights, speeds, terminal);
+        }
+
+        fg[1 + x_start] = vars[x_start];
+        fg[1 + y_start] = vars[y_start];
+        fg[1 + psi_start] = vars[psi_start];
+        fg[1 + v_start] = vars[v_start];
+        fg[1 + cte_start] = vars[cte_start];
+        fg[1 + epsi_start] = vars[epsi_start];
+
+        for (int t = 1; t < N; t++) {
+            Scalar x0 = vars[x_start + t - 1];
+            Scalar y0 = vars[y_start + t - 1];
+            Scalar psi0 = vars[psi_start + t - 1];
+            Scalar v0 = vars[v_start + t - 1];
+            Scalar cte0 = vars[cte_start + t - 1];
+            Scalar epsi0 = vars[epsi_start + t - 1];
+
+            Scalar delta = vars[delta_start + Config::controlIndex(t)];
+            Scalar a = vars[a_start + Config::controlIndex(t)];
+            double dt = Config::stageDt(t);
+
+            Scalar k = kappa[t - 1];
+            Scalar turn = (v0/Lf) * delta * dt;
+
+            if (reduced) {
+                fg[1 + x_start + t] = vars[x_start + t];
+                fg[1 + y_start + t] = vars[y_start + t];
+                fg[1 + psi_start + t] = vars[psi_start + t];
+            } else {
+                fg[1 + x_start + t] = vars[x_start + t] - (x0 + v0 * CppAD::cos(psi0) * dt);
+                fg[1 + y_start + t] = vars[y_start + t] - (y0 + v0 * CppAD::sin(psi0) * dt);
+                fg[1 + psi_start + t] = vars[psi_start + t] - (psi0 + turn);
+            }
+            fg[1 + v_start + t] = vars[v_start + t] - (v0 + a * dt);
+            fg[1 + cte_start + t] = vars[cte_start + t] - (cte0 - v0 * CppAD::sin(epsi0) * dt);
+            fg[1 + epsi_start + t] = vars[epsi_start + t] -
+                (epsi0 + turn - k * v0 * CppAD::cos(epsi0) * dt / (1.0 + k * cte0));
+        }
+    }
+};
+
+// x, y and psi of every stage of `vars` after the first, by the
+// kinematics of FrenetFG_eval, from the initial ones and the speeds and
+// steering of the solution of REDUCED_FRENET_MODEL.
+template <typename Config, typename Vector>
+void rollOutPose(Vector &vars) {
+    for (size_t t = 1; t < Config::N; t++) {
+        double psi0 = vars[Config::psi_start + t - 1];
+        double v0 = vars[Config::v_start + t - 1];
+        double delta = vars[Config::delta_start + Config::controlIndex(t)];
+        double dt = Config::stageDt(t);
+        vars[Config::x_start + t] = vars[Config::x_start + t - 1] + v0 * cos(psi0) * dt;
+        vars[Config::y_start + t] = vars[Config::y_start + t - 1] + v0 * sin(psi0) * dt;
+        vars[Config::psi_start + t] = psi0 + v0 / Lf * delta * dt;
+    }
+}
+
+#endif /* FRENET_FG_EVAL_H */
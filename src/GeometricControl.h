@@ -0,0 +1,69 @@
+#ifndef GEOMETRIC_CONTROL_H
+#define GEOMETRIC_CONTROL_H
+
+#include <math.h>
+#include <algorithm>
+#include "LqrSchedule.h"
+#include "MpcOptions.h"
+#include "VehicleModel.h"
+
+using namespace std;
+
+// Settings of geometricControl.
+struct GeometricParams {
+    GeometricLaw law = GEOMETRIC_PURSUIT;
+    // Look-ahead of pure pursuit: this long at the current speed, in s, and
+    // at least the distance, in m.
+    double lookahead_time = 0.8;
+    double min_lookahead = 6;
+    // Gain of the Stanley law on the cross track error, and the speed in
+    // m/s below which it stops growing with 1/v.
+    double stanley_gain = 1.0;
+    double stanley_softening = 2.0;
+    // Speed held on the straight, in m/s, and the lateral acceleration,
+    // in m/s^2, that limits it in the turns of the reference.
+    double speed = 15;
+    double lateral_acceleration = 4;
+    // Throttle per m/s below the speed.
+    double speed_gain = 1.0;
+};
+
+// Actuations of a geometric path tracker for the state `s` of the MPC
+// against the cubic reference `c` in its vehicle frame, in the MPC's
+// convention and within its bounds. No horizon, no model beyond the
+// bicycle geometry, no allocation: a few dozen flops and an atan, so it
+// answers a frame on any thread.
+//
+// GEOMETRIC_PURSUIT steers onto the arc through the point of the
+// reference a look-ahead ahead; GEOMETRIC_STANLEY, at the front axle, by
+// the heading error plus atan(k cte / (k_s + v)). Either way the speed
+// follows that of the params, capped by the curvature of the reference.
+template <typename Coeffs>
+inline void geometricControl(const GeometricParams &params, const Coeffs &c, const double s[6], double &delta,
+                             double &a) {
+    double x = s[0], y = s[1], psi = s[2], v = s[3];
+    double cos_psi = cos(psi), sin_psi = sin(psi);
+    double steering;
+    double cte, epsi, curvature;
+    if (params.law == GEOMETRIC_STANLEY) {
+        referenceErrors(c, x + Lf * cos_psi, y + Lf * sin_psi, psi, cte, epsi, curvature);
+        steering = -epsi + atan(params.stanley_gain * cte / (params.stanley_softening + fabs(v)));
+    } else {
+        // The arc through the goal from the car, tangent to its heading;
+        // the model turns at v / Lf delta.
+        referenceErrors(c, x, y, psi, cte, epsi, curvature);
+        double dx = max(params.min_lookahead, params.lookahead_time * v);
+        double dy = polyeval(c, x + dx) - y;
+        double lateral = -sin_psi * dx + cos_psi * dy;
+        steering = Lf * 2 * lateral / (dx * dx + dy * dy);
+    }
+    delta = min(max(steering, -max_delta), max_delta);
+
+    double speed = params.speed;
+    if (fabs(curvature) * speed * speed > params.lateral_acceleration) {
+        speed = sqrt(params.lateral_acceleration / fabs(curvature));
+    }
+    a = min(max(params.speed_gain * (speed - v), -max_a), max_a);
+}
+
+#endif /* GEOMETRIC_CONTROL_H */
@@ -0,0 +1,55 @@
+#include "GeometricSolver.h"
+#include <algorithm>
+#include <cmath>
+#include "FG_eval.h"
+
+template <typename Config>
+void GeometricSolver<Config>::solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+                                    const Dvector &gl, const Dvector &gu,
+                                    const Eigen::VectorXd &coeffs, SolveResult &solution, SolveStats &stats) {
+    // The initial state is fixed by the constraint bounds.
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    double states[Config::N][6];
+    for (int k = 0; k < 6; k++) {
+        states[0][k] = gl[starts[k]];
+    }
+
+    solution.x.resize(n_vars);
+    double delta = 0, a = 0;
+    int move = -1;
+    for (size_t t = 1; t < N; t++) {
+        int j = Config::controlIndex(t);
+        if (j != move) {
+            move = j;
+            geometricControl(params, coeffs, states[t - 1], delta, a);
+            delta = min(max(delta, xl[delta_start + j]), xu[delta_start + j]);
+            a = min(max(a, xl[a_start + j]), xu[a_start + j]);
+            solution.x[delta_start + j] = delta;
+            solution.x[a_start + j] = a;
+        }
+        vehicleStep(states[t - 1], delta, a, coeffs, Config::stageDt(t), states[t]);
+    }
+    for (size_t t = 0; t < N; t++) {
+        for (int k = 0; k < 6; k++) {
+            solution.x[starts[k] + t] = states[t][k];
+        }
+    }
+
+    double terms[N_COST_TERMS];
+    costTerms<Config>(&solution.x[0], weights, speeds, terms, terminal);
+    double cost = 0.0;
+    for (int i = 0; i < N_COST_TERMS; i++) {
+        cost += terms[i];
+    }
+    if (obstacles) {
+        addObstacleCost<Config>(cost, solution.x, *obstacles);
+    }
+    solution.obj_value = cost;
+    finishRolledOut(gl, n_vars, true, 0, solution, stats);
+}
+
+// Horizons the controller is built for.
+template class GeometricSolver<DefaultConfig>;
+template class GeometricSolver<MediumConfig>;
+template class GeometricSolver<LongConfig>;
+template class GeometricSolver<BlockedConfig>;
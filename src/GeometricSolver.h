@@ -0,0 +1,63 @@
+#ifndef GEOMETRIC_SOLVER_H
+#define GEOMETRIC_SOLVER_H
+
+#include "CostWeights.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "GeometricControl.h"
+#include "MpcConfig.h"
+#include "NLPTypes.h"
+#include "SpeedProfile.h"
+
+// The GEOMETRIC backend: geometricControl behind the interface of the
+// solvers, for the controller and mpc_bench to run it like any other.
+// Every move of the horizon takes the law's actuations at the state it
+// starts from, so the trajectory returned is the law's own closed loop
+// under the model and satisfies the dynamics exactly. Its objective is
+// FG_eval's cost of that trajectory, terminal and obstacle costs
+// included, comparable with the optimizers'.
+template <typename Config>
+class GeometricSolver : private Config {
+    using Config::N;
+    using Config::n_controls;
+    using Config::x_start;
+    using Config::y_start;
+    using Config::psi_start;
+    using Config::v_start;
+    using Config::cte_start;
+    using Config::epsi_start;
+    using Config::delta_start;
+    using Config::a_start;
+    using Config::n_vars;
+    using Config::n_constraints;
+
+public:
+    GeometricSolver() : speeds(constantSpeeds()), obstacles(nullptr) {}
+
+    void setCostWeights(const CostWeights &weights) { this->weights = weights; }
+
+    // Of the reported objective only, the speed is that of the params.
+    void setReferenceSpeeds(const StageSpeeds &speeds) { this->speeds = speeds; }
+
+    // Of the reported objective only, as the speeds, see FG_eval::terminal.
+    void setTerminalCost(const TerminalCost &terminal) { this->terminal = terminal; }
+
+    // Of the reported objective only, see FG_eval::obstacles; null for none.
+    void setObstacles(const FleetObstacles *obstacles) { this->obstacles = obstacles; }
+
+    void setParams(const GeometricParams &params) { this->params = params; }
+
+    // Same contract as CppAD::ipopt::solve; the guess is not used.
+    // stats.iterations is 0.
+    void solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+               const Dvector &gl, const Dvector &gu,
+               const Eigen::VectorXd &coeffs, SolveResult &solution, SolveStats &stats);
+
+private:
+    CostWeights weights;
+    StageSpeeds speeds;
+    TerminalCost terminal;
+    const FleetObstacles *obstacles;
+    GeometricParams params;
+};
+
+#endif /* GEOMETRIC_SOLVER_H */
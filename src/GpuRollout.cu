@@ -0,0 +1,169 @@
+#include "GpuRollout.h"
+#include <cmath>
+#include <cuda_runtime.h>
+
+// Threads per thread block, a power of two for the reductions.
+static const int threads_per_block = 256;
+
+// Must match the rollout of MppiSolver, vehicleStep and addCost.
+template <typename Scalar>
+__global__ void rolloutKernel(RolloutProblem p, const Scalar *samples, int n_samples, int lanes,
+                              Scalar lf, Scalar *costs, double *block_best,
+                              double *block_total, unsigned long long *block_finite) {
+    __shared__ double shared_best[threads_per_block];
+    __shared__ double shared_total[threads_per_block];
+    __shared__ unsigned long long shared_finite[threads_per_block];
+
+    const int k = blockIdx.x * blockDim.x + threadIdx.x;
+    const Scalar w_cte = p.weights.cte, w_epsi = p.weights.epsi, w_v = p.weights.v;
+    const Scalar w_delta = p.weights.delta, w_a = p.weights.a;
+    const Scalar w_ddelta = p.weights.ddelta, w_da = p.weights.da;
+    Scalar cost = 0;
+    if (k < n_samples) {
+        // Actuation i of this sample is in[i * lanes].
+        const int n_inputs = 2 * p.n_controls;
+        const Scalar *in = samples + (size_t) (k / lanes) * n_inputs * lanes + k % lanes;
+
+        Scalar x = p.initial[0], y = p.initial[1], psi = p.initial[2];
+        Scalar v = p.initial[3], cte = p.initial[4], epsi = p.initial[5];
+        Scalar ref_v = p.ref_v[0];
+        cost = w_cte * cte * cte + w_epsi * epsi * epsi + w_v * (v - ref_v) * (v - ref_v);
+        for (int t = 1; t < p.n_stages; t++) {
+            const int j = p.control[t];
+            const Scalar delta = in[2 * j * lanes];
+            const Scalar a = in[(2 * j + 1) * lanes];
+            const Scalar dt = p.dt[t];
+            Scalar f0 = 0, slope = 0;
+            for (int c = p.n_coeffs; c-- > 0;) {
+                slope = slope * x + f0;
+                f0 = f0 * x + Scalar(p.coeffs[c]);
+            }
+            const Scalar turn = (v / lf) * delta * dt;
+            const Scalar x0 = x, y0 = y, psi0 = psi, v0 = v, epsi0 = epsi;
+            x = x0 + v0 * cos(psi0) * dt;
+            y = x0 + v0 * sin(psi0) * dt;
+            psi = psi0 + turn;
+            v = v0 + a * dt;
+            cte = (f0 - y0) + v0 * sin(epsi0) * dt;
+            epsi = (psi0 - atan(slope)) + turn;
+            ref_v = p.ref_v[t];
+            cost += w_cte * cte * cte + w_epsi * epsi * epsi + w_v * (v - ref_v) * (v - ref_v);
+        }
+        for (int j = 0; j < p.n_controls; j++) {
+            const Scalar delta = in[2 * j * lanes];
+            const Scalar a = in[(2 * j + 1) * lanes];
+            cost += w_delta * delta * delta + w_a * a * a;
+            if (j + 1 < p.n_controls) {
+                const Scalar ddelta = in[2 * (j + 1) * lanes] - delta;
+                const Scalar da = in[(2 * (j + 1) + 1) * lanes] - a;
+                cost += w_ddelta * ddelta * ddelta + w_da * da * da;
+            }
+        }
+        costs[k] = cost;
+    }
+
+    // Minimum, sum and count of the finite costs of the thread block.
+    const bool counted = k < n_samples && isfinite(cost);
+    shared_best[threadIdx.x] = counted ? cost : INFINITY;
+    shared_total[threadIdx.x] = counted ? cost : 0.0;
+    shared_finite[threadIdx.x] = counted ? 1 : 0;
+    __syncthreads();
+    for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+        if (threadIdx.x < stride) {
+            shared_best[threadIdx.x] = fmin(shared_best[threadIdx.x], shared_best[threadIdx.x + stride]);
+            shared_total[threadIdx.x] += shared_total[threadIdx.x + stride];
+            shared_finite[threadIdx.x] += shared_finite[threadIdx.x + stride];
+        }
+        __syncthreads();
+    }
+    if (threadIdx.x == 0) {
+        block_best[blockIdx.x] = shared_best[0];
+        block_total[blockIdx.x] = shared_total[0];
+        block_finite[blockIdx.x] = shared_finite[0];
+    }
+}
+
+GpuRollout::GpuRollout(size_t max_samples)
+    : max_samples(max_samples), device_samples(nullptr), device_costs(nullptr), device_best(nullptr),
+      device_total(nullptr), device_finite(nullptr),
+      n_thread_blocks((max_samples + threads_per_block - 1) / threads_per_block),
+      partial_best(n_thread_blocks), partial_total(n_thread_blocks), partial_finite(n_thread_blocks) {
+    int devices = 0;
+    if (cudaGetDeviceCount(&devices) != cudaSuccess || devices == 0) {
+        return;
+    }
+    // Room for the actuations of the longest horizon, rounded up to whole
+    // thread blocks, so to whole sample blocks of any lane count dividing
+    // threads_per_block.
+    const size_t padded = n_thread_blocks * threads_per_block;
+    double *samples = nullptr;
+    bool ok = cudaMalloc(&samples, padded * 2 * max_horizon * sizeof(double)) == cudaSuccess;
+    ok = ok && cudaMalloc(&device_costs, padded * sizeof(double)) == cudaSuccess;
+    ok = ok && cudaMalloc(&device_best, n_thread_blocks * sizeof(double)) == cudaSuccess;
+    ok = ok && cudaMalloc(&device_total, n_thread_blocks * sizeof(double)) == cudaSuccess;
+    ok = ok && cudaMalloc(&device_finite, n_thread_blocks * sizeof(unsigned long long)) == cudaSuccess;
+    if (ok) {
+        device_samples = samples;
+    } else {
+        cudaFree(samples);
+    }
+}
+
+GpuRollout::~GpuRollout() {
+    cudaFree(device_samples);
+    cudaFree(device_costs);
+    cudaFree(device_best);
+    cudaFree(device_total);
+    cudaFree(device_finite);
+}
+
+bool GpuRollout::costs(const RolloutProblem &problem, const double *samples, size_t n_samples, int lanes,
+                       double *costs, double &best, double &total, size_t &finite) {
+    return rollOut(problem, samples, n_samples, lanes, costs, best, total, finite);
+}
+
+bool GpuRollout::costs(const RolloutProblem &problem, const float *samples, size_t n_samples, int lanes,
+                       float *costs, double &best, double &total, size_t &finite) {
+    return rollOut(problem, samples, n_samples, lanes, costs, best, total, finite);
+}
+
+// The device buffers are sized for double and hold float as well.
+template <typename Scalar>
+bool GpuRollout::rollOut(const RolloutProblem &problem, const Scalar *samples, size_t n_samples, int lanes,
+                         Scalar *costs, double &best, double &total, size_t &finite) {
+    if (!ready() || n_samples == 0 || n_samples > max_samples || lanes <= 0 || threads_per_block % lanes != 0 ||
+        problem.n_coeffs > gpu_max_coeffs || problem.n_stages > (int) max_horizon) {
+        return false;
+    }
+    Scalar *in = reinterpret_cast<Scalar *>(device_samples);
+    Scalar *out = reinterpret_cast<Scalar *>(device_costs);
+    const size_t n_values = (n_samples + lanes - 1) / lanes * lanes * 2 * problem.n_controls;
+    if (cudaMemcpy(in, samples, n_values * sizeof(Scalar), cudaMemcpyHostToDevice) != cudaSuccess) {
+        return false;
+    }
+
+    const int grid = (n_samples + threads_per_block - 1) / threads_per_block;
+    rolloutKernel<Scalar><<<grid, threads_per_block>>>(problem, in, n_samples, lanes, Scalar(Lf), out,
+                                                       device_best, device_total, device_finite);
+    if (cudaGetLastError() != cudaSuccess) {
+        return false;
+    }
+
+    const size_t n_results = grid;
+    if (cudaMemcpy(costs, out, n_samples * sizeof(Scalar), cudaMemcpyDeviceToHost) != cudaSuccess ||
+        cudaMemcpy(partial_best.data(), device_best, n_results * sizeof(double), cudaMemcpyDeviceToHost) != cudaSuccess ||
+        cudaMemcpy(partial_total.data(), device_total, n_results * sizeof(double), cudaMemcpyDeviceToHost) != cudaSuccess ||
+        cudaMemcpy(partial_finite.data(), device_finite, n_results * sizeof(unsigned long long),
+                   cudaMemcpyDeviceToHost) != cudaSuccess) {
+        return false;
+    }
+    best = INFINITY;
+    total = 0;
+    finite = 0;
+    for (size_t b = 0; b < n_results; b++) {
+        best = fmin(best, partial_best[b]);
+        total += partial_total[b];
+        finite += partial_finite[b];
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+#ifndef GPU_ROLLOUT_H
+#define GPU_ROLLOUT_H
+
+#include <cstddef>
+#include <vector>
+#include "CostWeights.h"
+#include "MpcConfig.h"
+
+using namespace std;
+
+// Rollouts of the kinematic model and the cost of FG_eval on a CUDA device,
+// one thread per sample, for MppiSolver. Only built with MPC_CUDA; this
+// header has no CUDA in it, so the host code compiles with the usual
+// compiler and the kernel lives in GpuRollout.cu alone.
+
+// Reference polynomials up to this order minus one.
+static const int gpu_max_coeffs = 8;
+
+// Everything a rollout reads besides its actuations, passed by value to
+// the kernel.
+struct RolloutProblem {
+    int n_stages;
+    int n_controls;
+    // Actuation and length of the transition into stage t, as controlIndex
+    // and stageDt of the Config.
+    int control[max_horizon];
+    double dt[max_horizon];
+    double initial[6];
+    int n_coeffs;
+    double coeffs[gpu_max_coeffs];
+    CostWeights weights;
+    // Reference velocity of stage t, see FG_eval::speeds.
+    double ref_v[max_horizon];
+};
+
+template <typename Config>
+void setHorizon(RolloutProblem &problem) {
+    problem.n_stages = Config::N;
+    problem.n_controls = Config::n_controls;
+    for (size_t t = 1; t < Config::N; t++) {
+        problem.control[t] = Config::controlIndex(t);
+        problem.dt[t] = Config::stageDt(t);
+    }
+}
+
+class GpuRollout {
+public:
+    // Device buffers for up to `max_samples`, on the current device.
+    explicit GpuRollout(size_t max_samples);
+
+    ~GpuRollout();
+
+    // Whether a device was found and the buffers allocated; costs() fails
+    // otherwise.
+    bool ready() const { return device_samples != nullptr; }
+
+    // Roll out `n_samples` samples in the layout of MppiSolver: blocks of
+    // `lanes` samples, each actuation of a block a packet of `lanes`
+    // values, delta and a interleaved per move. Fills the cost of every
+    // sample, plus their minimum and their sum over the finite ones and the
+    // number of those. False on any CUDA error. The rollouts are in the
+    // precision of the samples.
+    bool costs(const RolloutProblem &problem, const double *samples, size_t n_samples, int lanes,
+               double *costs, double &best, double &total, size_t &finite);
+    bool costs(const RolloutProblem &problem, const float *samples, size_t n_samples, int lanes,
+               float *costs, double &best, double &total, size_t &finite);
+
+private:
+    size_t max_samples;
+    double *device_samples;
+    double *device_costs;
+    // Partial reductions, one of each per thread block.
+    double *device_best;
+    double *device_total;
+    unsigned long long *device_finite;
+    size_t n_thread_blocks;
+    vector<double> partial_best;
+    vector<double> partial_total;
+    vector<unsigned long long> partial_finite;
+
+    template <typename Scalar>
+    bool rollOut(const RolloutProblem &problem, const Scalar *samples, size_t n_samples, int lanes,
+                 Scalar *costs, double &best, double &total, size_t &finite);
+
+    GpuRollout(const GpuRollout &) = delete;
+    GpuRollout &operator=(const GpuRollout &) = delete;
+};
+
+#endif /* GPU_ROLLOUT_H */
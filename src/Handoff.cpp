@@ -0,0 +1,118 @@
+#include "Handoff.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+const char ready_byte = 'R';
+const char done_byte = 'D';
+
+bool addressOf(const string &path, sockaddr_un &address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// Write one byte, without SIGPIPE if the peer is gone.
+bool sendByte(int fd, char byte) {
+#ifdef MSG_NOSIGNAL
+    return ::send(fd, &byte, 1, MSG_NOSIGNAL) == 1;
+#else
+    return ::send(fd, &byte, 1, 0) == 1;
+#endif
+}
+
+} // namespace
+
+Handoff::Handoff(const string &path) : path(path), peer(-1), listener(-1) {}
+
+Handoff::~Handoff() {
+    // The path stays, the successor may have bound it already.
+    if (peer >= 0) {
+        close(peer);
+    }
+    if (listener >= 0) {
+        close(listener);
+    }
+}
+
+bool Handoff::connect() {
+    sockaddr_un address;
+    if (!addressOf(path, address)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (::connect(fd, (const sockaddr *) &address, sizeof(address)) != 0) {
+        close(fd);
+        return false;
+    }
+    peer = fd;
+    return true;
+}
+
+bool Handoff::takeOver(chrono::milliseconds timeout) {
+    if (peer < 0 || !sendByte(peer, ready_byte)) {
+        return false;
+    }
+    timeval tv;
+    tv.tv_sec = timeout.count() / 1000;
+    tv.tv_usec = (timeout.count() % 1000) * 1000;
+    setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char byte = 0;
+    ssize_t n = read(peer, &byte, 1);
+    close(peer);
+    peer = -1;
+    // A predecessor that exited without a word let go as well.
+    return n == 0 || (n == 1 && byte == done_byte);
+}
+
+bool Handoff::serve(function<void()> release) {
+    sockaddr_un address;
+    if (!addressOf(path, address)) {
+        return false;
+    }
+    // Left by the predecessor, or by a process that died.
+    unlink(path.c_str());
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (const sockaddr *) &address, sizeof(address)) != 0 ||
+        listen(listener, 1) != 0) {
+        return false;
+    }
+    int fd = listener;
+    thread([this, fd, release] {
+        for (;;) {
+            int successor = accept(fd, nullptr, nullptr);
+            if (successor < 0 && (errno == EINTR || errno == ECONNABORTED)) {
+                continue;
+            } else if (successor < 0) {
+                return;
+            }
+            char byte = 0;
+            if (read(successor, &byte, 1) == 1 && byte == ready_byte) {
+                peer = successor;
+                release();
+                return;
+            }
+            close(successor);
+        }
+    }).detach();
+    return true;
+}
+
+void Handoff::done() {
+    if (peer >= 0) {
+        sendByte(peer, done_byte);
+    }
+}
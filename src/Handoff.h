@@ -0,0 +1,53 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+using namespace std;
+
+// Handover of the port between the mpc process serving it and the one
+// replacing it on the same host, over a Unix socket at `path`, see
+// MPC_HANDOFF in main.cpp:
+//
+//     new: connect(), then listen on the port too, by SO_REUSEPORT
+//     new: takeOver() sends 'R' and waits
+//     old: stops accepting, closes its connections, done() sends 'D'
+//     new: serve(), for the process after it
+//
+// Between the two the kernel spreads the new connections over both, so
+// none is refused. The old process exits once done; the vehicles it
+// closed reconnect to the new one, which picks up their snapshots in
+// MPC_STATE.
+class Handoff {
+public:
+    explicit Handoff(const string &path);
+
+    ~Handoff();
+
+    // Connect to the process serving `path`; false if there is none.
+    bool connect();
+
+    // Tell the process connected to that this one listens, and wait up to
+    // `timeout` for it to have let go; false if it did not.
+    bool takeOver(chrono::milliseconds timeout);
+
+    // Serve `path` on a thread of its own until a successor connects and
+    // is ready, then call `release` there, once. `release` lets go of the
+    // port and the connections and then calls done(). False if `path`
+    // cannot be bound.
+    bool serve(function<void()> release);
+
+    // Tell the successor this process let go.
+    void done();
+
+private:
+    string path;
+    // The connection to the predecessor, then to the successor; -1 for
+    // none.
+    int peer;
+    int listener;
+};
+
+#endif /* HANDOFF_H */
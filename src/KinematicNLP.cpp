@@ -0,0 +1,732 @@
+#include "KinematicNLP.h"
+#include <cassert>
+#include <cmath>
+#include "FG_eval.h"
+#include "Trace.h"
+
+// Collects triplets in the order they are produced. With null pointers it
+// only counts them. Ipopt sums entries that refer to the same position, so
+// terms of different constraints can be added independently. The positions
+// are those of the block layout, mapped to IPOPT's by `rows` and `cols`,
+// see KinematicNLP::setInterleaved.
+struct Triplets {
+    Ipopt::Index *iRow;
+    Ipopt::Index *jCol;
+    Ipopt::Number *values;
+    bool lower;
+    const int *rows;
+    const int *cols;
+    int k;
+
+    Triplets(Ipopt::Index *iRow, Ipopt::Index *jCol, Ipopt::Number *values, bool lower, const int *rows,
+             const int *cols)
+        : iRow(iRow), jCol(jCol), values(values), lower(lower), rows(rows), cols(cols), k(0) {}
+
+    void add(int row, int col, double value) {
+        if (values) {
+            values[k] = value;
+        } else if (iRow) {
+            row = rows[row];
+            col = cols[col];
+            if (lower && col > row) {
+                std::swap(row, col);
+            }
+            iRow[k] = row;
+            jCol[k] = col;
+        }
+        k++;
+    }
+};
+
+// Entries of each transition in the Jacobian and the Hessian, see
+// jacobian() and hessian(), which place the block of stage t by them.
+static const int jac_stage_nnz = 25;
+static const int hes_stage_nnz = 6;
+
+// Fewest transitions worth handing to another thread.
+static const size_t min_parallel_stages = 8;
+
+// Ranges of x, y, psi, v, cte and epsi, then of delta and a, for
+// get_scaling_parameters.
+static const double state_ranges[6] = {30, 30, 0.5, ref_v, 2, 0.1};
+static const double delta_range = 0.436332;
+static const double a_range = 1;
+
+// Largest gradient entry of the objective after scaling, IPOPT's
+// nlp_scaling_max_gradient.
+static const double max_scaled_gradient = 100;
+
+template <typename Config>
+KinematicNLP<Config>::KinematicNLP()
+    : speeds(constantSpeeds()), xi(nullptr), xl(nullptr), xu(nullptr), gl(nullptr), gu(nullptr),
+      solution(nullptr), warm_duals(false), has_duals(false), user_scaling(false), soft_penalty(0),
+      max_slack(0), interleaved(true) {
+    setInterleaved(false);
+    nnz_jac = jacobian(nullptr, nullptr, nullptr, nullptr);
+    nnz_hes = hessian(nullptr, 0.0, nullptr, nullptr, nullptr, nullptr);
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::getDuals(std::vector<double> &duals) const {
+    duals.clear();
+    if (!has_duals) {
+        return false;
+    }
+    duals.reserve(2 * max_vars + n_constraints);
+    duals.insert(duals.end(), prev_zl.begin(), prev_zl.end());
+    duals.insert(duals.end(), prev_zu.begin(), prev_zu.end());
+    duals.insert(duals.end(), prev_lambda.begin(), prev_lambda.end());
+    return true;
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::restoreDuals(const std::vector<double> &duals) {
+    if (!duals.empty() && duals.size() != 2 * max_vars + n_constraints) {
+        return false;
+    }
+    has_duals = !duals.empty();
+    if (has_duals) {
+        std::copy(duals.begin(), duals.begin() + max_vars, prev_zl.begin());
+        std::copy(duals.begin() + max_vars, duals.begin() + 2 * max_vars, prev_zu.begin());
+        std::copy(duals.begin() + 2 * max_vars, duals.end(), prev_lambda.begin());
+    }
+    return true;
+}
+
+template <typename Config>
+void KinematicNLP<Config>::setSoftPenalty(double penalty) {
+    if (penalty == soft_penalty) {
+        return;
+    }
+    // The multipliers of the other problem do not fit this one.
+    soft_penalty = penalty;
+    has_duals = false;
+    nnz_jac = jacobian(nullptr, nullptr, nullptr, nullptr);
+}
+
+template <typename Config>
+void KinematicNLP<Config>::setInterleaved(bool interleaved) {
+    if (interleaved == this->interleaved) {
+        return;
+    }
+    this->interleaved = interleaved;
+    // The multipliers are kept in the block layout, they still fit.
+    for (size_t i = 0; i < max_vars; i++) {
+        column[i] = i;
+    }
+    for (size_t i = 0; i < n_rows; i++) {
+        row[i] = i;
+    }
+    if (!interleaved) {
+        return;
+    }
+    // Stage t, then the actuations of the transition out of it, those no
+    // transition uses last.
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    array<bool, n_controls> placed;
+    placed.fill(false);
+    int next = 0;
+    for (size_t t = 0; t < N; t++) {
+        for (size_t start : starts) {
+            column[start + t] = next++;
+        }
+        size_t j = t + 1 < N ? Config::controlIndex(t + 1) : n_controls;
+        if (j < n_controls && !placed[j]) {
+            placed[j] = true;
+            column[delta_start + j] = next++;
+            column[a_start + j] = next++;
+        }
+    }
+    for (size_t j = 0; j < n_controls; j++) {
+        if (!placed[j]) {
+            column[delta_start + j] = next++;
+            column[a_start + j] = next++;
+        }
+    }
+    assert(next == (int) n_vars);
+    // The six rows of transition t.
+    for (size_t t = 1; t < N; t++) {
+        for (size_t k = 0; k < 6; k++) {
+            row[ipoptRow(starts[k] + t)] = 6 * (t - 1) + k;
+        }
+    }
+}
+
+template <typename Config>
+template <size_t M>
+const Ipopt::Number *KinematicNLP<Config>::toBlock(const array<int, M> &map, const Ipopt::Number *in, size_t n,
+                                                   array<double, M> &out) const {
+    if (!interleaved) {
+        return in;
+    }
+    for (size_t i = 0; i < n; i++) {
+        out[i] = in[map[i]];
+    }
+    return out.data();
+}
+
+template <typename Config>
+template <size_t M>
+void KinematicNLP<Config>::fromBlock(const array<int, M> &map, const double *in, size_t n, Ipopt::Number *out) {
+    for (size_t i = 0; i < n; i++) {
+        out[map[i]] = in[i];
+    }
+}
+
+template <typename Config>
+void KinematicNLP<Config>::setProblem(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+                                      const Dvector &gl, const Dvector &gu,
+                                      const Eigen::VectorXd &coeffs, SolveResult &solution,
+                                      bool warm_duals) {
+    this->coeffs = coeffs;
+    this->xi = &xi;
+    this->xl = &xl;
+    this->xu = &xu;
+    this->gl = &gl;
+    this->gu = &gu;
+    this->solution = &solution;
+    this->warm_duals = warm_duals && has_duals;
+}
+
+template <typename Config>
+void KinematicNLP<Config>::setEvalThreads(size_t n_helpers) {
+    if (n_helpers == (pool ? pool->size() : 0)) {
+        return;
+    }
+    pool.reset(n_helpers > 0 ? new StagePool(n_helpers) : nullptr);
+}
+
+template <typename Config>
+template <typename F>
+void KinematicNLP<Config>::forStages(const F &fn) {
+    if (pool) {
+        pool->run(1, N, min_parallel_stages, fn);
+    } else {
+        fn(1, N);
+    }
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::get_nlp_info(Ipopt::Index &n, Ipopt::Index &m, Ipopt::Index &nnz_jac_g,
+                                        Ipopt::Index &nnz_h_lag, IndexStyleEnum &index_style) {
+    n = nVars();
+    m = n_rows;
+    nnz_jac_g = nnz_jac;
+    nnz_h_lag = nnz_hes;
+    index_style = C_STYLE;
+    return true;
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::get_scaling_parameters(Ipopt::Number &obj_scaling, bool &use_x_scaling,
+                                                  Ipopt::Index n, Ipopt::Number *x_scaling,
+                                                  bool &use_g_scaling, Ipopt::Index m,
+                                                  Ipopt::Number *g_scaling) {
+    if (!user_scaling) {
+        return false;
+    }
+    Ipopt::Number *xs = interleaved ? block_x.data() : x_scaling;
+    Ipopt::Number *gs = interleaved ? block_g.data() : g_scaling;
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    for (int k = 0; k < 6; k++) {
+        for (size_t t = 0; t < N; t++) {
+            xs[starts[k] + t] = 1 / state_ranges[k];
+        }
+        for (size_t t = 1; t < N; t++) {
+            gs[ipoptRow(starts[k] + t)] = 1 / state_ranges[k];
+        }
+    }
+    for (size_t t = 0; t < n_controls; t++) {
+        xs[delta_start + t] = 1 / delta_range;
+        xs[a_start + t] = 1 / a_range;
+    }
+    for (int k = n_vars; k < n; k++) {
+        xs[k] = 1 / state_ranges[(k - n_vars) % n_soft < N - 1 ? 4 : 5];
+    }
+    if (interleaved) {
+        fromBlock(column, xs, n, x_scaling);
+        fromBlock(row, gs, m, g_scaling);
+    }
+    use_x_scaling = true;
+    use_g_scaling = true;
+    
+    array<double, max_vars> start, grad;
+    for (int i = 0; i < n; i++) {
+        start[column[i]] = i < n_vars ? (*xi)[i] : 0.0;
+    }
+    eval_grad_f(n, start.data(), true, grad.data());
+    double largest = 0;
+    for (int i = 0; i < n; i++) {
+        largest = max(largest, fabs(grad[i]));
+    }
+    obj_scaling = largest > max_scaled_gradient ? max_scaled_gradient / largest : 1;
+    return true;
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::get_bounds_info(Ipopt::Index n, Ipopt::Number *ipopt_x_l, Ipopt::Number *ipopt_x_u,
+                                           Ipopt::Index m, Ipopt::Number *ipopt_g_l, Ipopt::Number *ipopt_g_u) {
+    Ipopt::Number *x_l = interleaved ? block_x.data() : ipopt_x_l;
+    Ipopt::Number *x_u = interleaved ? block_v.data() : ipopt_x_u;
+    Ipopt::Number *g_l = interleaved ? block_g.data() : ipopt_g_l;
+    Ipopt::Number *g_u = interleaved ? block_lambda.data() : ipopt_g_u;
+    for (int i = 0; i < n_vars; i++) {
+        x_l[i] = (*xl)[i];
+        x_u[i] = (*xu)[i];
+    }
+    for (int i = n_vars; i < n; i++) {
+        x_l[i] = 0;
+        x_u[i] = 1.0e19;
+    }
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    for (size_t start : starts) {
+        x_l[start] = max(x_l[start], (*gl)[start]);
+        x_u[start] = min(x_u[start], (*gu)[start]);
+        for (size_t t = 1; t < N; t++) {
+            g_l[ipoptRow(start + t)] = (*gl)[start + t];
+            g_u[ipoptRow(start + t)] = (*gu)[start + t];
+        }
+    }
+    if (interleaved) {
+        fromBlock(column, x_l, n, ipopt_x_l);
+        fromBlock(column, x_u, n, ipopt_x_u);
+        fromBlock(row, g_l, m, ipopt_g_l);
+        fromBlock(row, g_u, m, ipopt_g_u);
+    }
+    return true;
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::get_constraints_linearity(Ipopt::Index m, LinearityType *const_types) {
+    for (int i = 0; i < m; i++) {
+        const_types[i] = NON_LINEAR;
+    }
+    for (size_t t = 1; t < N; t++) {
+        const_types[row[ipoptRow(v_start + t)]] = LINEAR;
+    }
+    return true;
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::get_starting_point(Ipopt::Index n, bool init_x, Ipopt::Number *x,
+                                              bool init_z, Ipopt::Number *ipopt_z_L, Ipopt::Number *ipopt_z_U,
+                                              Ipopt::Index m, bool init_lambda, Ipopt::Number *ipopt_lambda) {
+    for (int i = 0; i < n; i++) {
+        x[column[i]] = i < n_vars ? (*xi)[i] : 0.0;
+    }
+
+    if (init_z || init_lambda) {
+        assert(warm_duals);
+        Ipopt::Number *z_L = interleaved ? block_v.data() : ipopt_z_L;
+        Ipopt::Number *z_U = interleaved ? block_z.data() : ipopt_z_U;
+        Ipopt::Number *lambda = interleaved ? block_lambda.data() : ipopt_lambda;
+
+        // Shift the multipliers one step forward like the primal solution,
+        // holding the last stage, in blocks of the N - 1 transitions.
+        for (size_t start = 0; start < n_rows; start += N - 1) {
+            for (int t = 0; t + 1 < N; t++) {
+                int src = (t + 2 < N) ? t + 1 : N - 2;
+                lambda[start + t] = prev_lambda[start + src];
+            }
+        }
+        for (int i = 0; i < delta_start; i++) {
+            z_L[i] = prev_zl[i];
+            z_U[i] = prev_zu[i];
+        }
+        for (size_t start = delta_start; start < n_vars; start += n_controls) {
+            for (int t = 0; t < n_controls; t++) {
+                int src = (t + 1 < n_controls) ? t + 1 : n_controls - 1;
+                z_L[start + t] = prev_zl[start + src];
+                z_U[start + t] = prev_zu[start + src];
+            }
+        }
+        for (int i = n_vars; i < n; i++) {
+            z_L[i] = prev_zl[i];
+            z_U[i] = prev_zu[i];
+        }
+        if (interleaved) {
+            fromBlock(column, z_L, n, ipopt_z_L);
+            fromBlock(column, z_U, n, ipopt_z_U);
+            fromBlock(row, lambda, m, ipopt_lambda);
+        }
+    }
+    return true;
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::eval_f(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number &obj_value) {
+    MPC_TRACE_SCOPE("kinematic_f");
+    EvalTimer timer(*this);
+    x = toBlock(column, x, n, block_x);
+    double cost = 0.0;
+    for (int t = 0; t < N; t++) {
+        double v = x[v_start + t] - speeds[t];
+        cost += weights.cte * x[cte_start + t] * x[cte_start + t];
+        cost += weights.epsi * x[epsi_start + t] * x[epsi_start + t];
+        cost += weights.v * v * v;
+    }
+    for (int t = 0; t < n_controls; t++) {
+        cost += weights.delta * x[delta_start + t] * x[delta_start + t];
+        cost += weights.a * x[a_start + t] * x[a_start + t];
+    }
+    for (int t = 0; t + 1 < n_controls; t++) {
+        double ddelta = x[delta_start + t + 1] - x[delta_start + t];
+        double da = x[a_start + t + 1] - x[a_start + t];
+        cost += weights.ddelta * ddelta * ddelta;
+        cost += weights.da * da * da;
+    }
+    for (int i = n_vars; i < n; i++) {
+        cost += soft_penalty * x[i];
+    }
+    obj_value = cost;
+    return true;
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::eval_grad_f(Ipopt::Index n, const Ipopt::Number *x, bool new_x,
+                                       Ipopt::Number *ipopt_grad_f) {
+    MPC_TRACE_SCOPE("kinematic_grad_f");
+    EvalTimer timer(*this);
+    x = toBlock(column, x, n, block_x);
+    Ipopt::Number *grad_f = interleaved ? block_v.data() : ipopt_grad_f;
+    for (int i = 0; i < n; i++) {
+        grad_f[i] = 0.0;
+    }
+    for (int t = 0; t < N; t++) {
+        grad_f[cte_start + t] = 2 * weights.cte * x[cte_start + t];
+        grad_f[epsi_start + t] = 2 * weights.epsi * x[epsi_start + t];
+        grad_f[v_start + t] = 2 * weights.v * (x[v_start + t] - speeds[t]);
+    }
+    for (int t = 0; t < n_controls; t++) {
+        grad_f[delta_start + t] = 2 * weights.delta * x[delta_start + t];
+        grad_f[a_start + t] = 2 * weights.a * x[a_start + t];
+    }
+    for (int t = 0; t + 1 < n_controls; t++) {
+        double ddelta = 2 * weights.ddelta * (x[delta_start + t + 1] - x[delta_start + t]);
+        double da = 2 * weights.da * (x[a_start + t + 1] - x[a_start + t]);
+        grad_f[delta_start + t + 1] += ddelta;
+        grad_f[delta_start + t] -= ddelta;
+        grad_f[a_start + t + 1] += da;
+        grad_f[a_start + t] -= da;
+    }
+    for (int i = n_vars; i < n; i++) {
+        grad_f[i] = soft_penalty;
+    }
+    if (interleaved) {
+        fromBlock(column, grad_f, n, ipopt_grad_f);
+    }
+    return true;
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::eval_g(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Index m,
+                                  Ipopt::Number *ipopt_g) {
+    MPC_TRACE_SCOPE("kinematic_g");
+    EvalTimer timer(*this);
+    x = toBlock(column, x, n, block_x);
+    Ipopt::Number *g = interleaved ? block_g.data() : ipopt_g;
+    forStages([this, x, g](size_t begin, size_t end) {
+        const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+        for (size_t t = begin; t < end; t++) {
+            double s0[6], s1[6];
+            for (int k = 0; k < 6; k++) {
+                s0[k] = x[starts[k] + t - 1];
+            }
+            double delta = x[delta_start + Config::controlIndex(t)];
+            double a = x[a_start + Config::controlIndex(t)];
+
+            // Same model as FG_eval.
+            vehicleStep(s0, delta, a, coeffs, Config::stageDt(t), s1);
+            for (int k = 0; k < 6; k++) {
+                g[ipoptRow(starts[k] + t)] = x[starts[k] + t] - s1[k];
+            }
+        }
+    });
+    for (size_t k = 0; soft_penalty > 0 && k < n_soft; k++) {
+        g[ipoptRow(softRow(k))] -= x[n_vars + k] - x[n_vars + n_soft + k];
+    }
+    if (interleaved) {
+        fromBlock(row, g, m, ipopt_g);
+    }
+    return true;
+}
+
+template <typename Config>
+int KinematicNLP<Config>::jacobian(const Ipopt::Number *x, Ipopt::Index *iRow, Ipopt::Index *jCol,
+                                   Ipopt::Number *values) {
+    // Each transition fills its own block of entries.
+    forStages([this, x, iRow, jCol, values](size_t begin, size_t end) {
+        Triplets jac(iRow, jCol, values, false, row.data(), column.data());
+        jac.k = jac_stage_nnz * (begin - 1);
+        for (size_t t = begin; t < end; t++) {
+            int ix = x_start + t - 1;
+            int iy = y_start + t - 1;
+            int ipsi = psi_start + t - 1;
+            int iv = v_start + t - 1;
+            int iepsi = epsi_start + t - 1;
+            int idelta = delta_start + Config::controlIndex(t);
+            int ia = a_start + Config::controlIndex(t);
+            double dt = Config::stageDt(t);
+
+            // The defects x[t] - vehicleStep(x[t - 1], u) differentiate to
+            // the identity and minus the model Jacobians, see
+            // vehicleStepJacobians, of which these are the nonzeros.
+            Eigen::Matrix<double, 6, 6> A = Eigen::Matrix<double, 6, 6>::Zero();
+            Eigen::Matrix<double, 6, 2> B = Eigen::Matrix<double, 6, 2>::Zero();
+            if (values) {
+                const double s0[6] = {x[ix], x[iy], x[ipsi], x[iv], x[cte_start + t - 1], x[iepsi]};
+                vehicleStepJacobians(s0, x[idelta], x[ia], coeffs, dt, (double *) nullptr, &A, &B);
+            }
+
+            jac.add(ipoptRow(x_start + t), x_start + t, 1.0);
+            jac.add(ipoptRow(x_start + t), ix, -A(0, 0));
+            jac.add(ipoptRow(x_start + t), ipsi, -A(0, 2));
+            jac.add(ipoptRow(x_start + t), iv, -A(0, 3));
+
+            jac.add(ipoptRow(y_start + t), y_start + t, 1.0);
+            jac.add(ipoptRow(y_start + t), ix, -A(1, 0));
+            jac.add(ipoptRow(y_start + t), ipsi, -A(1, 2));
+            jac.add(ipoptRow(y_start + t), iv, -A(1, 3));
+
+            jac.add(ipoptRow(psi_start + t), psi_start + t, 1.0);
+            jac.add(ipoptRow(psi_start + t), ipsi, -A(2, 2));
+            jac.add(ipoptRow(psi_start + t), iv, -A(2, 3));
+            jac.add(ipoptRow(psi_start + t), idelta, -B(2, 0));
+
+            jac.add(ipoptRow(v_start + t), v_start + t, 1.0);
+            jac.add(ipoptRow(v_start + t), iv, -A(3, 3));
+            jac.add(ipoptRow(v_start + t), ia, -B(3, 1));
+
+            jac.add(ipoptRow(cte_start + t), cte_start + t, 1.0);
+            jac.add(ipoptRow(cte_start + t), ix, -A(4, 0));
+            jac.add(ipoptRow(cte_start + t), iy, -A(4, 1));
+            jac.add(ipoptRow(cte_start + t), iv, -A(4, 3));
+            jac.add(ipoptRow(cte_start + t), iepsi, -A(4, 5));
+
+            jac.add(ipoptRow(epsi_start + t), epsi_start + t, 1.0);
+            jac.add(ipoptRow(epsi_start + t), ipsi, -A(5, 2));
+            jac.add(ipoptRow(epsi_start + t), ix, -A(5, 0));
+            jac.add(ipoptRow(epsi_start + t), iv, -A(5, 3));
+            jac.add(ipoptRow(epsi_start + t), idelta, -B(5, 0));
+        }
+        assert(jac.k == jac_stage_nnz * (end - 1));
+    });
+
+    // The slacks of the soft rows, after the blocks.
+    Triplets jac(iRow, jCol, values, false, row.data(), column.data());
+    jac.k = jac_stage_nnz * (N - 1);
+    for (size_t k = 0; soft_penalty > 0 && k < n_soft; k++) {
+        jac.add(ipoptRow(softRow(k)), n_vars + k, -1.0);
+        jac.add(ipoptRow(softRow(k)), n_vars + n_soft + k, 1.0);
+    }
+    return jac.k;
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::eval_jac_g(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Index m,
+                                      Ipopt::Index nele_jac, Ipopt::Index *iRow, Ipopt::Index *jCol,
+                                      Ipopt::Number *values) {
+    MPC_TRACE_SCOPE("kinematic_jac_g");
+    EvalTimer timer(*this);
+    if (values) {
+        x = toBlock(column, x, n, block_x);
+    }
+    jacobian(x, iRow, jCol, values);
+    return true;
+}
+
+template <typename Config>
+int KinematicNLP<Config>::hessian(const Ipopt::Number *x, Ipopt::Number obj_factor, const Ipopt::Number *lambda,
+                                  Ipopt::Index *iRow, Ipopt::Index *jCol, Ipopt::Number *values) {
+    Triplets hes(iRow, jCol, values, true, column.data(), column.data());
+
+    // The cost is a sum of weighted squares, so its Hessian is constant.
+    for (int t = 0; t < N; t++) {
+        hes.add(cte_start + t, cte_start + t, obj_factor * 2 * weights.cte);
+        hes.add(epsi_start + t, epsi_start + t, obj_factor * 2 * weights.epsi);
+        hes.add(v_start + t, v_start + t, obj_factor * 2 * weights.v);
+    }
+    for (int t = 0; t < n_controls; t++) {
+        hes.add(delta_start + t, delta_start + t, obj_factor * 2 * weights.delta);
+        hes.add(a_start + t, a_start + t, obj_factor * 2 * weights.a);
+    }
+    for (int t = 0; t + 1 < n_controls; t++) {
+        hes.add(delta_start + t, delta_start + t, obj_factor * 2 * weights.ddelta);
+        hes.add(delta_start + t + 1, delta_start + t + 1, obj_factor * 2 * weights.ddelta);
+        hes.add(delta_start + t + 1, delta_start + t, -obj_factor * 2 * weights.ddelta);
+        hes.add(a_start + t, a_start + t, obj_factor * 2 * weights.da);
+        hes.add(a_start + t + 1, a_start + t + 1, obj_factor * 2 * weights.da);
+        hes.add(a_start + t + 1, a_start + t, -obj_factor * 2 * weights.da);
+    }
+
+    // Second derivatives of the dynamics constraints, a block per
+    // transition as in jacobian(). With MPC_FAST_MATH they stay libm's,
+    // off the fits' by about the slope errors of FastMath.h, which only
+    // shapes IPOPT's steps.
+    int first = hes.k;
+    forStages([this, x, lambda, iRow, jCol, values, first](size_t begin, size_t end) {
+        Triplets hes(iRow, jCol, values, true, column.data(), column.data());
+        hes.k = first + hes_stage_nnz * (begin - 1);
+        for (size_t t = begin; t < end; t++) {
+            int ix = x_start + t - 1;
+            int ipsi = psi_start + t - 1;
+            int iv = v_start + t - 1;
+            int iepsi = epsi_start + t - 1;
+            int idelta = delta_start + Config::controlIndex(t);
+            double dt = Config::stageDt(t);
+
+            double psi0 = 0, v0 = 0, epsi0 = 0;
+            double f[4] = {0, 0, 0, 0};
+            double l_x = 0, l_y = 0, l_psi = 0, l_cte = 0, l_epsi = 0;
+            if (values) {
+                psi0 = x[ipsi];
+                v0 = x[iv];
+                epsi0 = x[iepsi];
+                polyDerivatives<3>(coeffs, x[ix], f);
+                l_x = lambda[ipoptRow(x_start + t)];
+                l_y = lambda[ipoptRow(y_start + t)];
+                l_psi = lambda[ipoptRow(psi_start + t)];
+                l_cte = lambda[ipoptRow(cte_start + t)];
+                l_epsi = lambda[ipoptRow(epsi_start + t)];
+            }
+
+            double s = 1 + f[1] * f[1];
+            double datan_xx = (f[3] * s - 2 * f[1] * f[2] * f[2]) / (s * s);
+
+            hes.add(ipsi, ipsi, l_x * v0 * cos(psi0) * dt + l_y * v0 * sin(psi0) * dt);
+            hes.add(iv, ipsi, l_x * sin(psi0) * dt - l_y * cos(psi0) * dt);
+            hes.add(idelta, iv, -(l_psi + l_epsi) * dt / Lf);
+            hes.add(ix, ix, -l_cte * f[2] + l_epsi * datan_xx);
+            hes.add(iepsi, iepsi, l_cte * v0 * sin(epsi0) * dt);
+            hes.add(iepsi, iv, -l_cte * cos(epsi0) * dt);
+        }
+        assert(hes.k == first + hes_stage_nnz * (end - 1));
+    });
+    return first + hes_stage_nnz * (N - 1);
+}
+
+template <typename Config>
+bool KinematicNLP<Config>::eval_h(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number obj_factor,
+                                  Ipopt::Index m, const Ipopt::Number *lambda, bool new_lambda,
+                                  Ipopt::Index nele_hess, Ipopt::Index *iRow, Ipopt::Index *jCol,
+                                  Ipopt::Number *values) {
+    MPC_TRACE_SCOPE("kinematic_h");
+    EvalTimer timer(*this);
+    if (values) {
+        x = toBlock(column, x, n, block_x);
+        lambda = toBlock(row, lambda, m, block_lambda);
+    }
+    hessian(x, obj_factor, lambda, iRow, jCol, values);
+    return true;
+}
+
+template <typename Config>
+void KinematicNLP<Config>::finalize_solution(Ipopt::SolverReturn status, Ipopt::Index n, const Ipopt::Number *x,
+                                             const Ipopt::Number *z_L, const Ipopt::Number *z_U,
+                                             Ipopt::Index m, const Ipopt::Number *g, const Ipopt::Number *lambda,
+                                             Ipopt::Number obj_value, const Ipopt::IpoptData *ip_data,
+                                             Ipopt::IpoptCalculatedQuantities *ip_cq) {
+    x = toBlock(column, x, n, block_x);
+    z_L = toBlock(column, z_L, n, block_v);
+    z_U = toBlock(column, z_U, n, block_z);
+    g = toBlock(row, g, m, block_g);
+    lambda = toBlock(row, lambda, m, block_lambda);
+    solution->status = toStatus(status);
+    solution->x.resize(n_vars);
+    solution->zl.resize(n_vars);
+    solution->zu.resize(n_vars);
+    for (int i = 0; i < n_vars; i++) {
+        solution->x[i] = x[i];
+        solution->zl[i] = z_L[i];
+        solution->zu[i] = z_U[i];
+    }
+    // Back to the rows of the problem, the initial state's at its
+    // variables.
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    solution->g.resize(n_constraints);
+    solution->lambda.resize(n_constraints);
+    for (size_t start : starts) {
+        solution->g[start] = x[start];
+        solution->lambda[start] = 0.0;
+        for (size_t t = 1; t < N; t++) {
+            solution->g[start + t] = g[ipoptRow(start + t)];
+            solution->lambda[start + t] = lambda[ipoptRow(start + t)];
+        }
+    }
+    solution->obj_value = obj_value;
+    max_slack = 0;
+    for (int i = n_vars; i < n; i++) {
+        max_slack = max(max_slack, x[i]);
+    }
+
+    // Only converged multipliers are worth seeding the next solve with.
+    has_duals = status == Ipopt::SUCCESS;
+    if (has_duals) {
+        std::copy(z_L, z_L + n, prev_zl.begin());
+        std::copy(z_U, z_U + n, prev_zu.begin());
+        std::copy(lambda, lambda + m, prev_lambda.begin());
+    }
+}
+
+//
+// KinematicSolver
+//
+template <typename Config>
+KinematicSolver<Config>::KinematicSolver() : linear_solver_lock(linearSolverLock("")) {
+    app = new Ipopt::IpoptApplication();
+    app->Options()->SetIntegerValue("print_level", 0);
+    app->Options()->SetStringValue("sb", "yes");
+    app->Options()->SetStringValue("fixed_variable_treatment", "make_parameter");
+    app->Initialize();
+    nlp = new KinematicNLP<Config>();
+}
+
+template <typename Config>
+void KinematicSolver<Config>::setCostWeights(const CostWeights &weights) {
+    nlp->setCostWeights(weights);
+}
+
+template <typename Config>
+void KinematicSolver<Config>::setReferenceSpeeds(const StageSpeeds &speeds) {
+    nlp->setReferenceSpeeds(speeds);
+}
+
+template <typename Config>
+void KinematicSolver<Config>::setOptions(const MpcOptions &options) {
+    applyOptions(*app, options);
+    linear_solver_lock = linearSolverLock(options.linear_solver);
+    app->Options()->SetStringValue("nlp_scaling_method", options.user_scaling ? "user-scaling" : "gradient-based");
+    nlp->setUserScaling(options.user_scaling);
+    nlp->setEvalThreads(options.eval_threads);
+    nlp->setSoftPenalty(options.soft_penalty);
+    nlp->setInterleaved(options.interleaved_layout);
+    nlp->setControlConvergence(options.control_tol, options.control_iterations);
+    nlp->setFirstControls(nlp->ipoptColumn(Config::delta_start), nlp->ipoptColumn(Config::a_start));
+}
+
+template <typename Config>
+void KinematicSolver<Config>::solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+                                    const Dvector &gl, const Dvector &gu,
+                                    const Eigen::VectorXd &coeffs, SolveResult &solution,
+                                    bool warm_duals, Deadline deadline, SolveStats &stats) {
+    nlp->setProblem(xi, xl, xu, gl, gu, coeffs, solution, warm_duals);
+    nlp->setDeadline(deadline);
+    app->Options()->SetStringValue("warm_start_init_point",
+                                   warm_duals && nlp->hasDuals() ? "yes" : "no");
+    LinearSolverGuard guard(linear_solver_lock, stats);
+    setTimeLimit(*app, deadline);
+    MPC_TRACE_SCOPE("ipopt");
+    fillStats(app->OptimizeTNLP(nlp), *app, *nlp, stats);
+    stats.restoration_iterations = nlp->restorationIterations();
+    stats.max_slack = nlp->maxSlack();
+}
+
+// Horizons the controller is built for.
+template class KinematicNLP<DefaultConfig>;
+template class KinematicSolver<DefaultConfig>;
+template class KinematicNLP<MediumConfig>;
+template class KinematicSolver<MediumConfig>;
+template class KinematicNLP<LongConfig>;
+template class KinematicSolver<LongConfig>;
+template class KinematicNLP<BlockedConfig>;
+template class KinematicSolver<BlockedConfig>;
@@ -0,0 +1,271 @@
+#ifndef KINEMATIC_NLP_H
+#define KINEMATIC_NLP_H
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <coin/IpIpoptApplication.hpp>
+#include <coin/IpTNLP.hpp>
+#include "CostWeights.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "LinearSolverLock.h"
+#include "MpcConfig.h"
+#include "NLPTypes.h"
+#include "SpeedProfile.h"
+#include "StagePool.h"
+
+using namespace std;
+
+// Ipopt problem for the kinematic model of FG_eval with hand-derived
+// gradient, constraint Jacobian and Lagrangian Hessian, so no AD tape is
+// recorded or swept at all. The horizon `Config` is fixed at compile time,
+// see MpcConfig.h, so all stage loops have constant bounds.
+//
+// It also remembers the multipliers of the last solve so that the next one
+// can warm start both the primal and the dual iterates.
+//
+// The initial state is fixed by the bounds of its variables rather than
+// by its six constraint rows, which IPOPT is not given: the transitions'
+// rows are all it sees, so the fixed variables drop out of its KKT
+// system, see fixed_variable_treatment.
+//
+// With setSoftPenalty the cte and epsi dynamics are soft: each gets two
+// slacks s+, s- >= 0 after the variables of Config, the defect less
+// s+ - s-, weighted by the penalty in the objective. The L1 penalty is
+// exact, a solution of the hard problem is the solution once the penalty
+// exceeds its multipliers, but a nearly inconsistent problem no longer
+// sends IPOPT into its restoration phase.
+//
+// The stages of the constraints, the Jacobian and the Hessian are
+// independent given their variables, and every stage writes a fixed block
+// of entries, so with setEvalThreads they are evaluated in chunks on a
+// StagePool.
+//
+// The problem is evaluated in the block layout of Config, but with
+// setInterleaved IPOPT sees its variables stage by stage, the six states
+// of a stage followed by the actuations leaving it, and its rows
+// transition by transition: the KKT matrix is then banded, in blocks of a
+// stage, rather than spread over the blocks of each state.
+template <typename Config>
+class KinematicNLP : public DeadlineTNLP, private Config {
+    using Config::N;
+    using Config::n_controls;
+    using Config::x_start;
+    using Config::y_start;
+    using Config::psi_start;
+    using Config::v_start;
+    using Config::cte_start;
+    using Config::epsi_start;
+    using Config::delta_start;
+    using Config::a_start;
+    using Config::n_vars;
+    using Config::n_constraints;
+
+public:
+    KinematicNLP();
+
+    // Set the data for the next optimization, the result is written to
+    // `solution` by finalize_solution. With `warm_duals` the stored
+    // multipliers, shifted one step forward, seed the solve.
+    void setProblem(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+                    const Dvector &gl, const Dvector &gu,
+                    const Eigen::VectorXd &coeffs, SolveResult &solution,
+                    bool warm_duals);
+
+    void setCostWeights(const CostWeights &weights) { this->weights = weights; }
+
+    // See FG_eval::speeds.
+    void setReferenceSpeeds(const StageSpeeds &speeds) { this->speeds = speeds; }
+
+    // Evaluate the stages on `n_helpers` threads besides IPOPT's, see
+    // MpcOptions::eval_threads; 0 evaluates them serially.
+    void setEvalThreads(size_t n_helpers);
+
+    // Scale the variables and the constraints by the physical ranges of
+    // their blocks, see get_scaling_parameters, for IPOPT's user-scaling.
+    void setUserScaling(bool user_scaling) { this->user_scaling = user_scaling; }
+
+    // Penalty on the slacks of the soft constraints, 0 to keep them hard.
+    void setSoftPenalty(double penalty);
+
+    // Order the variables and rows IPOPT sees stage by stage, see
+    // MpcOptions::interleaved_layout, or by block as in Config.
+    void setInterleaved(bool interleaved);
+
+    // IPOPT's index of the variable at `i` in the layout of Config.
+    Ipopt::Index ipoptColumn(size_t i) const { return column[i]; }
+
+    // Largest slack of the last solve, 0 with hard constraints.
+    double maxSlack() const { return max_slack; }
+
+    // Whether multipliers from a previous solve are available.
+    bool hasDuals() const { return has_duals; }
+
+    // The multipliers of the last converged solve, z_L, z_U and lambda one
+    // after another, into `duals`; false, with it empty, if there are none.
+    bool getDuals(std::vector<double> &duals) const;
+
+    // Seed the next solve with `duals` as returned by getDuals, or with
+    // none if empty. False, changing nothing, for ones of another size.
+    bool restoreDuals(const std::vector<double> &duals);
+
+    bool get_nlp_info(Ipopt::Index &n, Ipopt::Index &m, Ipopt::Index &nnz_jac_g,
+                      Ipopt::Index &nnz_h_lag, IndexStyleEnum &index_style);
+
+    bool get_bounds_info(Ipopt::Index n, Ipopt::Number *x_l, Ipopt::Number *x_u,
+                         Ipopt::Index m, Ipopt::Number *g_l, Ipopt::Number *g_u);
+
+    // The speed dynamics are LINEAR.
+    bool get_constraints_linearity(Ipopt::Index m, LinearityType *const_types);
+
+    // Each variable and the dynamics constraint of each state divided by
+    // the range of its block: tens of metres for the position, the
+    // reference speed, a few metres and tenths of a radian for the errors,
+    // the bounds of the actuations. The objective keeps the scale IPOPT's
+    // gradient-based method gives it at the starting point.
+    bool get_scaling_parameters(Ipopt::Number &obj_scaling, bool &use_x_scaling, Ipopt::Index n,
+                                Ipopt::Number *x_scaling, bool &use_g_scaling, Ipopt::Index m,
+                                Ipopt::Number *g_scaling);
+
+    bool get_starting_point(Ipopt::Index n, bool init_x, Ipopt::Number *x,
+                            bool init_z, Ipopt::Number *z_L, Ipopt::Number *z_U,
+                            Ipopt::Index m, bool init_lambda, Ipopt::Number *lambda);
+
+    bool eval_f(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number &obj_value);
+
+    bool eval_grad_f(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number *grad_f);
+
+    bool eval_g(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Index m, Ipopt::Number *g);
+
+    bool eval_jac_g(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Index m,
+                    Ipopt::Index nele_jac, Ipopt::Index *iRow, Ipopt::Index *jCol,
+                    Ipopt::Number *values);
+
+    bool eval_h(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number obj_factor,
+                Ipopt::Index m, const Ipopt::Number *lambda, bool new_lambda,
+                Ipopt::Index nele_hess, Ipopt::Index *iRow, Ipopt::Index *jCol,
+                Ipopt::Number *values);
+
+    void finalize_solution(Ipopt::SolverReturn status, Ipopt::Index n, const Ipopt::Number *x,
+                           const Ipopt::Number *z_L, const Ipopt::Number *z_U,
+                           Ipopt::Index m, const Ipopt::Number *g, const Ipopt::Number *lambda,
+                           Ipopt::Number obj_value, const Ipopt::IpoptData *ip_data,
+                           Ipopt::IpoptCalculatedQuantities *ip_cq);
+
+private:
+    // Rows IPOPT sees, those of the transitions.
+    static const size_t n_rows = Config::n_constraints - 6;
+    // The rows that may be soft, of cte and epsi, and the variables with
+    // their slacks: s+ of soft row k at n_vars + k, s- n_soft later.
+    static const size_t n_soft = 2 * (Config::N - 1);
+    static const size_t max_vars = Config::n_vars + 2 * n_soft;
+
+    int nnz_jac;
+    int nnz_hes;
+
+    Eigen::VectorXd coeffs;
+    CostWeights weights;
+    StageSpeeds speeds;
+
+    const Dvector *xi;
+    const Dvector *xl;
+    const Dvector *xu;
+    const Dvector *gl;
+    const Dvector *gu;
+    SolveResult *solution;
+
+    bool warm_duals;
+    bool has_duals;
+    bool user_scaling;
+    double soft_penalty;
+    double max_slack;
+    array<double, max_vars> prev_zl;
+    array<double, max_vars> prev_zu;
+    array<double, Config::n_constraints> prev_lambda;
+
+    unique_ptr<StagePool> pool;
+
+    // IPOPT's index of each variable and row of the block layout, see
+    // setInterleaved; the identity unless interleaved. The slacks keep
+    // their place after the variables.
+    bool interleaved;
+    array<int, max_vars> column;
+    array<int, n_rows> row;
+    // The vectors IPOPT passes, and those returned to it, in the block
+    // layout while interleaved.
+    array<double, max_vars> block_x;
+    array<double, max_vars> block_v;
+    array<double, max_vars> block_z;
+    array<double, n_rows> block_g;
+    array<double, n_rows> block_lambda;
+
+    // The row of the constraint `row` of a transition in the block layout,
+    // each state's block one row shorter without its initial one.
+    static size_t ipoptRow(size_t row) { return row - row / N - 1; }
+
+    // `in` from IPOPT's order into `out` in the block layout, by `map`,
+    // or `in` itself if not interleaved.
+    template <size_t M>
+    const Ipopt::Number *toBlock(const array<int, M> &map, const Ipopt::Number *in, size_t n,
+                                 array<double, M> &out) const;
+
+    // `in` of the block layout into `out` in IPOPT's order, by `map`.
+    template <size_t M>
+    static void fromBlock(const array<int, M> &map, const double *in, size_t n, Ipopt::Number *out);
+
+    // The row of soft row k.
+    static size_t softRow(size_t k) { return k < N - 1 ? cte_start + 1 + k : epsi_start + 2 + k - N; }
+
+    size_t nVars() const { return soft_penalty > 0 ? max_vars : n_vars; }
+
+    // Call fn(begin, end) over the transitions [1, N), in chunks on the
+    // pool if there is one.
+    template <typename F>
+    void forStages(const F &fn);
+
+    // Walk the Jacobian/Hessian entries in a fixed order. With null output
+    // pointers they only count the entries.
+    int jacobian(const Ipopt::Number *x, Ipopt::Index *iRow, Ipopt::Index *jCol,
+                 Ipopt::Number *values);
+    int hessian(const Ipopt::Number *x, Ipopt::Number obj_factor, const Ipopt::Number *lambda,
+                Ipopt::Index *iRow, Ipopt::Index *jCol, Ipopt::Number *values);
+};
+
+// Persistent IpoptApplication driving a KinematicNLP.
+template <typename Config>
+class KinematicSolver {
+public:
+    KinematicSolver();
+
+    void setCostWeights(const CostWeights &weights);
+
+    void setReferenceSpeeds(const StageSpeeds &speeds);
+
+    void setOptions(const MpcOptions &options);
+
+    // Same contract as CppAD::ipopt::solve, plus whether the multipliers of
+    // the previous solve may be used as a warm start and when IPOPT has to
+    // stop. The IPOPT status and iteration count go to `stats`.
+    void solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+               const Dvector &gl, const Dvector &gu,
+               const Eigen::VectorXd &coeffs, SolveResult &solution,
+               bool warm_duals, Deadline deadline, SolveStats &stats);
+
+    // Stop solving once `cancel` is raised, see DeadlineTNLP::setCancel.
+    void setCancel(const CancelToken *cancel) { nlp->setCancel(cancel); }
+
+    // See DeadlineTNLP::setIterationTrace.
+    void setIterationTrace(IterationTrace *trace) { nlp->setIterationTrace(trace); }
+
+    // See KinematicNLP::getDuals.
+    bool getDuals(std::vector<double> &duals) const { return nlp->getDuals(duals); }
+    bool restoreDuals(const std::vector<double> &duals) { return nlp->restoreDuals(duals); }
+
+private:
+    Ipopt::SmartPtr<Ipopt::IpoptApplication> app;
+    Ipopt::SmartPtr<KinematicNLP<Config> > nlp;
+    // Held around OptimizeTNLP, see LinearSolverLock.h.
+    mutex *linear_solver_lock;
+};
+
+#endif /* KINEMATIC_NLP_H */
@@ -0,0 +1,97 @@
+#include "LapCache.h"
+#include <math.h>
+#include <algorithm>
+#include "Track.h"
+
+LapCache::LapCache(const Track &track, double spacing, const LapTolerance &tolerance)
+    : map(&track), spacing(spacing), tolerance(tolerance), n_stored(0) {
+    slots.resize(max((size_t) 1, (size_t) ceil(track.length() / spacing)));
+}
+
+size_t LapCache::slotOf(double px, double py) const {
+    double s = map->locate(px, py).s;
+    size_t slot = (size_t) max(0.0, floor(s / spacing));
+    return slot % slots.size();
+}
+
+void LapCache::store(const Solution &plan, double px, double py, double psi) {
+    if (plan.n_stages < 2) {
+        return;
+    }
+    double c = cos(psi), s = sin(psi);
+    const PredictedStage &first = plan.stages[0];
+    Slot &slot = slots[slotOf(px + c * first.x - s * first.y, py + s * first.x + c * first.y)];
+    if (slot.stages.empty()) {
+        n_stored++;
+    }
+    slot.stages.resize(plan.n_stages);
+    for (size_t t = 0; t < plan.n_stages; t++) {
+        PredictedStage stage = plan.stages[t];
+        stage.x = px + c * plan.stages[t].x - s * plan.stages[t].y;
+        stage.y = py + s * plan.stages[t].x + c * plan.stages[t].y;
+        stage.psi += psi;
+        slot.stages[t] = stage;
+    }
+}
+
+bool LapCache::seed(const StateVector &state, double px, double py, double psi, Solution &seed) const {
+    double c = cos(psi), s = sin(psi);
+    double wx = px + c * state[0] - s * state[1];
+    double wy = py + s * state[0] + c * state[1];
+    double wpsi = psi + state[2];
+
+    // The plans of the slot of the state and of the one before, which
+    // started behind it.
+    size_t here = slotOf(wx, wy);
+    size_t candidates[2] = {(here + slots.size() - 1) % slots.size(), here};
+    const Slot *best = nullptr;
+    size_t best_stage = 0;
+    double best_d2 = tolerance.distance * tolerance.distance;
+    for (size_t slot : candidates) {
+        const vector<PredictedStage> &stages = slots[slot].stages;
+        for (size_t t = 1; t + 1 < stages.size(); t++) {
+            const PredictedStage &stage = stages[t];
+            double dx = stage.x - wx, dy = stage.y - wy;
+            double d2 = dx * dx + dy * dy;
+            double dpsi = atan2(sin(stage.psi - wpsi), cos(stage.psi - wpsi));
+            if (d2 < best_d2 && fabs(dpsi) < tolerance.psi && fabs(stage.v - state[3]) < tolerance.v) {
+                best = &slots[slot];
+                best_stage = t;
+                best_d2 = d2;
+            }
+        }
+    }
+    if (!best) {
+        return false;
+    }
+
+    seed.n_stages = min(best->stages.size() - (best_stage - 1), seed.stages.size());
+    for (size_t t = 0; t < seed.n_stages; t++) {
+        PredictedStage stage = best->stages[best_stage - 1 + t];
+        double mx = stage.x - px, my = stage.y - py;
+        stage.x = c * mx + s * my;
+        stage.y = -s * mx + c * my;
+        stage.psi -= psi;
+        seed.stages[t] = stage;
+    }
+    return true;
+}
+
+void LapCache::exportPlans(vector<vector<PredictedStage> > &plans) const {
+    plans.resize(slots.size());
+    for (size_t i = 0; i < slots.size(); i++) {
+        plans[i] = slots[i].stages;
+    }
+}
+
+bool LapCache::importPlans(const vector<vector<PredictedStage> > &plans) {
+    if (plans.size() != slots.size()) {
+        return false;
+    }
+    n_stored = 0;
+    for (size_t i = 0; i < slots.size(); i++) {
+        slots[i].stages = plans[i].size() >= 2 ? plans[i] : vector<PredictedStage>();
+        n_stored += !slots[i].stages.empty();
+    }
+    return true;
+}
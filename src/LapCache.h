@@ -0,0 +1,73 @@
+#ifndef LAP_CACHE_H
+#define LAP_CACHE_H
+
+#include <cstddef>
+#include <vector>
+#include "MPC.h"
+
+using namespace std;
+
+class Track;
+
+// How close a stage of a LapCache has to be to the initial state of a
+// frame for its plan to seed it, in m, rad and m/s.
+struct LapTolerance {
+    double distance = 1.0;
+    double psi = 0.1;
+    double v = 2.0;
+};
+
+// Converged plans of earlier laps of a closed track, kept by the arc
+// length of their first stage in slots of `spacing` m, the latest of each
+// slot. On the next lap the plan that passed where the car is seeds the
+// solve there, see Controller::setLapCache: its tail was solved rather
+// than extrapolated, which the shifted previous plan is not, and matters
+// most through the corners.
+//
+// The stages are kept in map coordinates, x, y and psi of the world, and
+// put back into the vehicle frame of the frame they seed.
+class LapCache {
+public:
+    // Slots of `spacing` m around `track`, all empty.
+    LapCache(const Track &track, double spacing, const LapTolerance &tolerance = LapTolerance());
+
+    const Track &track() const { return *map; }
+
+    // Keep `plan`, solved in the vehicle frame of the pose (px, py, psi),
+    // as the plan of the slot of its first stage.
+    void store(const Solution &plan, double px, double py, double psi);
+
+    // Into `seed`, in the vehicle frame of the pose (px, py, psi), the
+    // stored plan that passes nearest to `state` there, in that frame,
+    // starting at the stage before, so that MPC::seedWarmStart shifts it
+    // onto the state. False if no plan comes within the tolerance.
+    bool seed(const StateVector &state, double px, double py, double psi, Solution &seed) const;
+
+    // Slots holding a plan.
+    size_t size() const { return n_stored; }
+
+    // The plans of all slots in map coordinates, empty for those without,
+    // into `plans`, see ControllerContext.
+    void exportPlans(vector<vector<PredictedStage> > &plans) const;
+
+    // Replace the plans with `plans` as exported by a cache of the same
+    // track and spacing; false, changing nothing, for another number of
+    // slots.
+    bool importPlans(const vector<vector<PredictedStage> > &plans);
+
+private:
+    struct Slot {
+        // Stages in map coordinates.
+        vector<PredictedStage> stages;
+    };
+
+    const Track *map;
+    double spacing;
+    LapTolerance tolerance;
+    vector<Slot> slots;
+    size_t n_stored;
+
+    size_t slotOf(double px, double py) const;
+};
+
+#endif /* LAP_CACHE_H */
@@ -0,0 +1,47 @@
+#include "LinearSolverLock.h"
+#include <map>
+#include <memory>
+#include <coin/IpIpoptApplication.hpp>
+
+// The linear solvers known to be reentrant.
+static const char *reentrant_solvers[] = {"ma27", "ma57", "ma77", "ma86", "ma97", "pardiso", "pardisomkl", "spral"};
+
+// The default linear_solver of the IPOPT linked in, as registered.
+static const string &defaultLinearSolver() {
+    static const string name = [] {
+        Ipopt::SmartPtr<Ipopt::IpoptApplication> app = new Ipopt::IpoptApplication();
+        app->Options()->SetIntegerValue("print_level", 0);
+        app->Options()->SetStringValue("sb", "yes");
+        app->Initialize();
+        string value;
+        app->Options()->GetStringValue("linear_solver", value, "");
+        return value;
+    }();
+    return name;
+}
+
+bool linearSolverReentrant(const string &linear_solver) {
+    const string &name = linear_solver.empty() ? defaultLinearSolver() : linear_solver;
+    for (const char *reentrant : reentrant_solvers) {
+        if (name == reentrant) {
+            return true;
+        }
+    }
+    return false;
+}
+
+mutex *linearSolverLock(const string &linear_solver) {
+    if (linearSolverReentrant(linear_solver)) {
+        return nullptr;
+    }
+    // One lock per solver, alive for the rest of the process.
+    static mutex locks_lock;
+    static map<string, unique_ptr<mutex> > locks;
+    const string &name = linear_solver.empty() ? defaultLinearSolver() : linear_solver;
+    lock_guard<mutex> guard(locks_lock);
+    unique_ptr<mutex> &lock = locks[name];
+    if (!lock) {
+        lock.reset(new mutex);
+    }
+    return lock.get();
+}
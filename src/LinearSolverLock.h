@@ -0,0 +1,52 @@
+#ifndef LINEAR_SOLVER_LOCK_H
+#define LINEAR_SOLVER_LOCK_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include "MPC.h"
+
+using namespace std;
+
+// IPOPT's linear solvers differ in whether two IpoptApplications may
+// factorize at once. MUMPS, the default of an IPOPT built without HSL,
+// keeps global state in its MPI stub and is not reentrant; the HSL
+// solvers, Pardiso and SPRAL are. Solves on one that is not take its lock
+// for the whole of OptimizeTNLP, so concurrent solves serialize on it
+// instead of corrupting each other.
+//
+// The lock of `linear_solver`, the value of MpcOptions::linear_solver,
+// IPOPT's default of this build when empty; nullptr for a reentrant one.
+// Solvers IPOPT does not know of are taken as not reentrant.
+mutex *linearSolverLock(const string &linear_solver);
+
+// Whether the linear solver of `linear_solver`, resolved as above, may
+// run in several solves at once.
+bool linearSolverReentrant(const string &linear_solver);
+
+// Holds `lock`, unless it is null, while in scope. The time spent waiting
+// for it goes to SolveStats::linear_solver_wait.
+class LinearSolverGuard {
+public:
+    LinearSolverGuard(mutex *lock, SolveStats &stats) : lock(lock) {
+        if (lock && !lock->try_lock()) {
+            auto start = chrono::steady_clock::now();
+            lock->lock();
+            stats.linear_solver_wait += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    ~LinearSolverGuard() {
+        if (lock) {
+            lock->unlock();
+        }
+    }
+
+    LinearSolverGuard(const LinearSolverGuard &) = delete;
+    LinearSolverGuard &operator=(const LinearSolverGuard &) = delete;
+
+private:
+    mutex *lock;
+};
+
+#endif /* LINEAR_SOLVER_LOCK_H */
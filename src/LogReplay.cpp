@@ -0,0 +1,355 @@
+#include "LogReplay.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include "Controller.h"
+#include "Metrics.h"
+#include "TaskScheduler.h"
+#include "TelemetryCapture.h"
+#include "TelemetryParser.h"
+
+bool parseSteer(const string &msg, double &steering, double &throttle) {
+    if (msg.compare(0, 10, "42[\"steer\"") != 0) {
+        return false;
+    }
+    const char *s = strstr(msg.c_str(), "\"steering_angle\":");
+    const char *t = strstr(msg.c_str(), "\"throttle\":");
+    if (!s || !t) {
+        return false;
+    }
+    steering = strtod(s + strlen("\"steering_angle\":"), nullptr);
+    throttle = strtod(t + strlen("\"throttle\":"), nullptr);
+    return true;
+}
+
+static void appendDouble(string &out, double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", value);
+    out += buf;
+}
+
+static void appendArray(string &out, const WaypointVector &values) {
+    out += '[';
+    for (size_t i = 0; i < values.size(); i++) {
+        if (i > 0) {
+            out += ',';
+        }
+        appendDouble(out, values[i]);
+    }
+    out += ']';
+}
+
+// The telemetry event the simulator would have sent for `telemetry`, with
+// every number exact.
+static string telemetryMessage(const Telemetry &telemetry) {
+    string out = "42[\"telemetry\",{\"ptsx\":";
+    appendArray(out, telemetry.ptsx);
+    out += ",\"ptsy\":";
+    appendArray(out, telemetry.ptsy);
+    const char *keys[] = {"x", "y", "psi", "speed", "steering_angle", "throttle"};
+    const double values[] = {telemetry.x, telemetry.y, telemetry.psi, telemetry.speed, telemetry.steering_angle,
+                             telemetry.throttle};
+    for (int i = 0; i < 6; i++) {
+        out += ",\"";
+        out += keys[i];
+        out += "\":";
+        appendDouble(out, values[i]);
+    }
+    out += "}]";
+    return out;
+}
+
+bool loadReplayLog(const string &path, ReplayLog &log) {
+    log.path = path;
+    log.messages.clear();
+    log.has_reply.clear();
+    log.steering.clear();
+    log.throttle.clear();
+
+    CaptureReader capture;
+    if (capture.open(path.c_str())) {
+        vector<Telemetry> frames;
+        capture.readAll(frames);
+        for (const Telemetry &telemetry : frames) {
+            log.messages.push_back(telemetryMessage(telemetry));
+            log.has_reply.push_back(false);
+            log.steering.push_back(0);
+            log.throttle.push_back(0);
+        }
+        return true;
+    }
+
+    ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    string line;
+    Telemetry telemetry;
+    while (getline(in, line)) {
+        size_t begin = line.find("42[");
+        if (begin == string::npos) {
+            continue;
+        }
+        line.erase(0, begin);
+        double steering, throttle;
+        if (parseSteer(line, steering, throttle)) {
+            // Only the first reply after a frame answered it.
+            if (!log.messages.empty() && !log.has_reply.back()) {
+                log.has_reply.back() = true;
+                log.steering.back() = steering;
+                log.throttle.back() = throttle;
+            }
+        } else if (parseMessage(line.data(), line.size(), telemetry) == MSG_TELEMETRY) {
+            log.messages.push_back(line);
+            log.has_reply.push_back(false);
+            log.steering.push_back(0);
+            log.throttle.push_back(0);
+        }
+    }
+    return true;
+}
+
+ReplayResult replayLog(const ReplayLog &log, int repeat, double tolerance) {
+    ReplayResult result;
+    size_t n = log.messages.size();
+    vector<double> steps;
+    steps.reserve(n * repeat);
+    vector<double> first_steering(n), first_throttle(n);
+    result.step_buckets.assign(Histogram::n_buckets, 0);
+
+    Controller controller;
+    controller.setDeadlineBudget(chrono::microseconds(0));
+    Telemetry telemetry;
+    string reply;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < repeat; r++) {
+        controller.reset();
+        for (size_t i = 0; i < n; i++) {
+            const string &msg = log.messages[i];
+            auto t0 = chrono::steady_clock::now();
+            if (parseMessage(msg.data(), msg.size(), telemetry) != MSG_TELEMETRY) {
+                continue;
+            }
+            telemetry.arrival = t0;
+            controller.step(telemetry, reply);
+            double steering = 0, throttle = 0;
+            parseSteer(reply, steering, throttle);
+            double step = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            steps.push_back(step);
+            result.step_buckets[Histogram::bucketOf((uint64_t) (step * 1e6))]++;
+            result.frames++;
+            const SolveStats &stats = controller.lastStats();
+            result.failed_solves += !stats.ok();
+            result.fallbacks += stats.fallback;
+            if (stats.iterations >= 0) {
+                result.iterated_solves++;
+                result.iterations += stats.iterations;
+            }
+
+            double ref_steering, ref_throttle;
+            if (log.has_reply[i]) {
+                ref_steering = log.steering[i];
+                ref_throttle = log.throttle[i];
+            } else if (r > 0) {
+                ref_steering = first_steering[i];
+                ref_throttle = first_throttle[i];
+            } else {
+                first_steering[i] = steering;
+                first_throttle[i] = throttle;
+                continue;
+            }
+            double ds = fabs(steering - ref_steering), dt = fabs(throttle - ref_throttle);
+            result.compared++;
+            result.max_steering_error = max(result.max_steering_error, ds);
+            result.max_throttle_error = max(result.max_throttle_error, dt);
+            result.mismatches += !(ds <= tolerance && dt <= tolerance);
+        }
+    }
+    result.time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    sort(steps.begin(), steps.end());
+    if (!steps.empty()) {
+        result.step_p50 = steps[steps.size() / 2];
+        result.step_p99 = steps[min(steps.size() - 1, steps.size() * 99 / 100)];
+    }
+    return result;
+}
+
+vector<ReplayResult> replayLogs(const vector<ReplayLog> &logs, size_t n_threads, int repeat, double tolerance) {
+    vector<ReplayResult> results(logs.size());
+    atomic<size_t> next(0);
+    auto work = [&] {
+        for (size_t i = next++; i < logs.size(); i = next++) {
+            results[i] = replayLog(logs[i], repeat, tolerance);
+        }
+    };
+
+    auto helper = [&](size_t) { work(); };
+    TaskGroup helpers(TASK_LOW);
+    helpers.run(1, min(n_threads, logs.size()), helper);
+    work();
+    helpers.wait();
+    return results;
+}
+
+vector<ReplayResult> replayPaths(const vector<string> &paths, size_t n_threads, int repeat, double tolerance) {
+    vector<ReplayResult> results(paths.size());
+    atomic<size_t> next(0);
+    auto work = [&] {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            ReplayLog log;
+            if (loadReplayLog(paths[i], log)) {
+                results[i] = replayLog(log, repeat, tolerance);
+            } else {
+                results[i].loaded = false;
+            }
+        }
+    };
+
+    auto helper = [&](size_t) { work(); };
+    TaskGroup helpers(TASK_LOW);
+    helpers.run(1, min(n_threads, paths.size()), helper);
+    work();
+    helpers.wait();
+    return results;
+}
+
+vector<string> shardPaths(const vector<string> &paths, size_t shard, size_t n_shards) {
+    vector<pair<uint64_t, size_t> > sizes;
+    for (size_t i = 0; i < paths.size(); i++) {
+        struct stat st;
+        sizes.push_back(make_pair(stat(paths[i].c_str(), &st) == 0 ? (uint64_t) st.st_size : 0, i));
+    }
+    // Largest first, ties in the order given.
+    stable_sort(sizes.begin(), sizes.end(),
+                [](const pair<uint64_t, size_t> &a, const pair<uint64_t, size_t> &b) { return a.first > b.first; });
+    vector<uint64_t> loads(n_shards, 0);
+    vector<bool> mine(paths.size(), false);
+    for (const auto &size : sizes) {
+        size_t lightest = min_element(loads.begin(), loads.end()) - loads.begin();
+        loads[lightest] += size.first;
+        mine[size.second] = lightest == shard;
+    }
+    vector<string> out;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (mine[i]) {
+            out.push_back(paths[i]);
+        }
+    }
+    return out;
+}
+
+// The run file: a "replay <wall> <threads> <logs>" line, then per log a
+// "log <path>" line, a line of its numbers and one of its non-empty step
+// buckets as bucket:count pairs.
+bool writeReplayRun(const string &path, const ReplayRun &run) {
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+        return false;
+    }
+    fprintf(out, "replay %.17g %zu %zu\n", run.wall, run.threads, run.paths.size());
+    for (size_t i = 0; i < run.paths.size(); i++) {
+        const ReplayResult &r = run.results[i];
+        fprintf(out, "log %s\n", run.paths[i].c_str());
+        fprintf(out, "%d %zu %.17g %.17g %.17g %zu %.17g %.17g %zu %zu %zu %zu %llu\n", r.loaded, r.frames, r.time,
+                r.step_p50, r.step_p99, r.compared, r.max_steering_error, r.max_throttle_error, r.mismatches,
+                r.failed_solves, r.fallbacks, r.iterated_solves, (unsigned long long) r.iterations);
+        for (size_t b = 0; b < r.step_buckets.size(); b++) {
+            if (r.step_buckets[b] > 0) {
+                fprintf(out, " %zu:%llu", b, (unsigned long long) r.step_buckets[b]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+    return fclose(out) == 0;
+}
+
+bool readReplayRun(const string &path, ReplayRun &run) {
+    ifstream in(path);
+    string line;
+    size_t n = 0;
+    if (!getline(in, line) || sscanf(line.c_str(), "replay %lf %zu %zu", &run.wall, &run.threads, &n) != 3) {
+        return false;
+    }
+    run.paths.clear();
+    run.results.assign(n, ReplayResult());
+    for (size_t i = 0; i < n; i++) {
+        ReplayResult &r = run.results[i];
+        if (!getline(in, line) || line.compare(0, 4, "log ") != 0) {
+            return false;
+        }
+        run.paths.push_back(line.substr(4));
+        int loaded = 0;
+        unsigned long long iterations = 0;
+        if (!getline(in, line) ||
+            sscanf(line.c_str(), "%d %zu %lf %lf %lf %zu %lf %lf %zu %zu %zu %zu %llu", &loaded, &r.frames, &r.time,
+                   &r.step_p50, &r.step_p99, &r.compared, &r.max_steering_error, &r.max_throttle_error,
+                   &r.mismatches, &r.failed_solves, &r.fallbacks, &r.iterated_solves, &iterations) != 13) {
+            return false;
+        }
+        r.loaded = loaded != 0;
+        r.iterations = iterations;
+        if (!getline(in, line)) {
+            return false;
+        }
+        r.step_buckets.assign(Histogram::n_buckets, 0);
+        const char *s = line.c_str();
+        size_t bucket;
+        unsigned long long count;
+        int used;
+        while (sscanf(s, " %zu:%llu%n", &bucket, &count, &used) == 2) {
+            if (bucket >= r.step_buckets.size()) {
+                return false;
+            }
+            r.step_buckets[bucket] = count;
+            s += used;
+        }
+    }
+    return true;
+}
+
+// Upper bound in seconds of the bucket of `buckets` holding quantile `q`.
+static double bucketQuantile(const vector<uint64_t> &buckets, double q) {
+    uint64_t n = 0;
+    for (uint64_t count : buckets) {
+        n += count;
+    }
+    uint64_t rank = max((uint64_t) 1, (uint64_t) ceil(q * n));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < buckets.size(); b++) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            return Histogram::upperBound(b) * 1e-6;
+        }
+    }
+    return 0;
+}
+
+ReplayResult mergeReplayResults(const vector<ReplayResult> &results) {
+    ReplayResult merged;
+    merged.step_buckets.assign(Histogram::n_buckets, 0);
+    for (const ReplayResult &r : results) {
+        merged.loaded = merged.loaded && r.loaded;
+        merged.frames += r.frames;
+        merged.time += r.time;
+        for (size_t b = 0; b < r.step_buckets.size() && b < merged.step_buckets.size(); b++) {
+            merged.step_buckets[b] += r.step_buckets[b];
+        }
+        merged.compared += r.compared;
+        merged.max_steering_error = max(merged.max_steering_error, r.max_steering_error);
+        merged.max_throttle_error = max(merged.max_throttle_error, r.max_throttle_error);
+        merged.mismatches += r.mismatches;
+        merged.failed_solves += r.failed_solves;
+        merged.fallbacks += r.fallbacks;
+        merged.iterated_solves += r.iterated_solves;
+        merged.iterations += r.iterations;
+    }
+    merged.step_p50 = bucketQuantile(merged.step_buckets, 0.5);
+    merged.step_p99 = bucketQuantile(merged.step_buckets, 0.99);
+    return merged;
+}
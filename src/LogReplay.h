@@ -0,0 +1,96 @@
+#ifndef LOG_REPLAY_H
+#define LOG_REPLAY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// One recorded session as the messages the simulator sent, and the
+// actuations it was answered with where the log has them.
+struct ReplayLog {
+    string path;
+    vector<string> messages;
+    // Per message; has_reply is false where nothing answered it before the
+    // next one, or the log does not record replies.
+    vector<bool> has_reply;
+    vector<double> steering;
+    vector<double> throttle;
+};
+
+// Read the log at `path`: a trace log of mpc (MPC_LOG_LEVEL=trace), whose
+// "telemetry" events are each answered by the "steer" event after them,
+// or a capture of MPC_CAPTURE, see TelemetryCapture.h, whose frames are
+// written back into the simulator's messages and carry no replies.
+bool loadReplayLog(const string &path, ReplayLog &log);
+
+// The actuations of the steer event `msg`, false if it is none.
+bool parseSteer(const string &msg, double &steering, double &throttle);
+
+struct ReplayResult {
+    // The log could be read.
+    bool loaded = true;
+    size_t frames = 0;
+    // Wall time of all passes, and the step time percentiles, in seconds.
+    double time = 0;
+    double step_p50 = 0;
+    double step_p99 = 0;
+    // The step times in the buckets of Histogram, in microseconds, so
+    // that results of several runs merge, see mergeReplayResults.
+    vector<uint64_t> step_buckets;
+    // Frames compared against a reference, the largest differences of the
+    // actuations and the frames beyond the tolerance.
+    size_t compared = 0;
+    double max_steering_error = 0;
+    double max_throttle_error = 0;
+    size_t mismatches = 0;
+    // Solves that failed, those answered from the previous plan, and the
+    // iterations of those that report them.
+    size_t failed_solves = 0;
+    size_t fallbacks = 0;
+    size_t iterated_solves = 0;
+    uint64_t iterations = 0;
+};
+
+// Feed every message of `log` through the pipeline of the server, the
+// parse, Controller::step with the transform, fit, solve and the
+// serialization, and the parse of the reply, `repeat` times on a fresh
+// controller with no solve deadline. The actuations are compared against
+// the recorded replies, or without any against those of the first pass.
+ReplayResult replayLog(const ReplayLog &log, int repeat, double tolerance);
+
+// replayLog for each of `logs`, one log at a time on each of `n_threads`
+// threads: the caller's and low priority tasks of the TaskScheduler.
+vector<ReplayResult> replayLogs(const vector<ReplayLog> &logs, size_t n_threads, int repeat, double tolerance);
+
+// replayLogs for the logs at `paths`, each read by the thread replaying
+// it and dropped after, so only n_threads logs are in memory at a time. A
+// log that cannot be read leaves its result not loaded.
+vector<ReplayResult> replayPaths(const vector<string> &paths, size_t n_threads, int repeat, double tolerance);
+
+// Of `n_shards` shards of the logs at `paths`, the paths of shard `shard`:
+// the logs are dealt out by size, each, from the largest on, to the shard
+// with the fewest bytes so far, so the shards take about as long and every
+// node given the same files agrees on them.
+vector<string> shardPaths(const vector<string> &paths, size_t shard, size_t n_shards);
+
+// Results of one run of mpc_replay, e.g. of one shard on one node: the
+// logs and their results, and the wall time and threads of the run.
+struct ReplayRun {
+    vector<string> paths;
+    vector<ReplayResult> results;
+    double wall = 0;
+    size_t threads = 0;
+};
+
+// Write `run` to `path` as text and read it back, false on errors.
+bool writeReplayRun(const string &path, const ReplayRun &run);
+bool readReplayRun(const string &path, ReplayRun &run);
+
+// All of `results` as one: the sums, the largest errors, and the step
+// percentiles of the merged buckets, to their resolution. The time is the
+// sum of those of the logs.
+ReplayResult mergeReplayResults(const vector<ReplayResult> &results);
+
+#endif /* LOG_REPLAY_H */
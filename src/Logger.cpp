@@ -0,0 +1,218 @@
+#include "Logger.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+const size_t ring_size = 1024;
+const size_t slot_size = 1024;
+
+struct Slot {
+    // Vyukov style sequence: equal to the position when free for the
+    // producer claiming it, position + 1 once it holds a message.
+    atomic<size_t> sequence;
+    size_t length;
+    char text[slot_size];
+};
+
+// Bounded multi-producer/single-consumer ring of formatted lines.
+class Backend {
+public:
+    Backend() : level(parseLevel(getenv("MPC_LOG_LEVEL"))), sample(1), head(0), tail(0),
+                dropped(0), payloads(0), stopping(false), parked(false) {
+        const char *s = getenv("MPC_LOG_SAMPLE");
+        if (s && atoi(s) > 0) {
+            sample = atoi(s);
+        }
+        for (size_t i = 0; i < ring_size; i++) {
+            slots[i].sequence.store(i, memory_order_relaxed);
+        }
+        writer = thread(&Backend::run, this);
+    }
+    
+    ~Backend() {
+        stopping = true;
+        wake();
+        writer.join();
+    }
+    
+    LogLevel level;
+    size_t sample;
+    
+    // Claim a slot, or null if the ring is full.
+    Slot *claim() {
+        size_t pos = tail.load(memory_order_relaxed);
+        for (;;) {
+            Slot &slot = slots[pos % ring_size];
+            size_t seq = slot.sequence.load(memory_order_acquire);
+            if (seq == pos) {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    return &slot;
+                }
+            } else if (seq < pos) {
+                dropped.fetch_add(1, memory_order_relaxed);
+                return nullptr;
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+    
+    void publish(Slot *slot) {
+        size_t pos = slot->sequence.load(memory_order_relaxed);
+        slot->sequence.store(pos + 1, memory_order_release);
+        // A wakeup lost to this racy check only delays the line until the
+        // writer's next poll.
+        if (parked.load()) {
+            wake();
+        }
+    }
+    
+    bool samplePayload() {
+        return payloads.fetch_add(1, memory_order_relaxed) % sample == 0;
+    }
+    
+    void flush() {
+        unique_lock<mutex> lock(park_mutex);
+        drained.wait(lock, [this] {
+            return head.load() == tail.load();
+        });
+    }
+    
+private:
+    array<Slot, ring_size> slots;
+    atomic<size_t> head;
+    atomic<size_t> tail;
+    atomic<size_t> dropped;
+    atomic<size_t> payloads;
+    atomic<bool> stopping;
+    atomic<bool> parked;
+    
+    // Only used to park the writer while the ring is empty.
+    mutex park_mutex;
+    condition_variable ready;
+    condition_variable drained;
+    thread writer;
+    
+    static LogLevel parseLevel(const char *s) {
+        if (!s) {
+            return LOG_TRACE;
+        }
+        const char *names[] = {"error", "warn", "info", "debug", "trace"};
+        for (int i = 0; i <= LOG_TRACE; i++) {
+            if (strcmp(s, names[i]) == 0) {
+                return (LogLevel) i;
+            }
+        }
+        return LOG_TRACE;
+    }
+    
+    void wake() {
+        {
+            lock_guard<mutex> lock(park_mutex);
+        }
+        ready.notify_one();
+    }
+    
+    void run() {
+        for (;;) {
+            size_t pos = head.load(memory_order_relaxed);
+            Slot &slot = slots[pos % ring_size];
+            if (slot.sequence.load(memory_order_acquire) == pos + 1) {
+                fwrite(slot.text, 1, slot.length, stdout);
+                slot.sequence.store(pos + ring_size, memory_order_release);
+                head.store(pos + 1);
+                continue;
+            }
+            
+            size_t lost = dropped.exchange(0);
+            if (lost > 0) {
+                fprintf(stdout, "[log] dropped %zu messages\n", lost);
+            }
+            fflush(stdout);
+            
+            unique_lock<mutex> lock(park_mutex);
+            drained.notify_all();
+            if (stopping && head.load() == tail.load()) {
+                return;
+            }
+            // Producers claim before they publish, so poll briefly in case
+            // a claimed slot is still being filled.
+            parked = true;
+            ready.wait_for(lock, chrono::milliseconds(10), [this, &slot, pos] {
+                return stopping || slot.sequence.load(memory_order_acquire) == pos + 1;
+            });
+            parked = false;
+        }
+    }
+};
+
+Backend &backend() {
+    static Backend instance;
+    return instance;
+}
+
+const char *prefix(LogLevel level) {
+    static const char *names[] = {"[error] ", "[warn] ", "", "", ""};
+    return names[level];
+}
+
+} // namespace
+
+namespace Logger {
+
+bool enabled(LogLevel level) {
+    return level <= backend().level;
+}
+
+bool samplePayload() {
+    return backend().samplePayload();
+}
+
+void write(LogLevel level, const char *format, ...) {
+    Slot *slot = backend().claim();
+    if (!slot) {
+        return;
+    }
+    const char *p = prefix(level);
+    size_t n = strlen(p);
+    memcpy(slot->text, p, n);
+    
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(slot->text + n, slot_size - n - 1, format, args);
+    va_end(args);
+    // Long messages are truncated to the slot.
+    n += written < 0 ? 0 : min((size_t) written, slot_size - n - 2);
+    slot->text[n++] = '\n';
+    slot->length = n;
+    backend().publish(slot);
+}
+
+void writeRaw(LogLevel level, const char *data, size_t length) {
+    Slot *slot = backend().claim();
+    if (!slot) {
+        return;
+    }
+    size_t n = min(length, slot_size - 1);
+    memcpy(slot->text, data, n);
+    slot->text[n++] = '\n';
+    slot->length = n;
+    backend().publish(slot);
+}
+
+void flush() {
+    backend().flush();
+}
+
+} // namespace Logger
@@ -0,0 +1,63 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <cstddef>
+
+// Severity of a log message, lower is more important.
+enum LogLevel {
+    LOG_ERROR = 0,
+    LOG_WARN = 1,
+    LOG_INFO = 2,
+    LOG_DEBUG = 3,
+    // Raw websocket payloads.
+    LOG_TRACE = 4
+};
+
+// Messages above this level are compiled out entirely, e.g.
+// -DMPC_LOG_MAX_LEVEL=2 strips debug output and payload dumps.
+#ifndef MPC_LOG_MAX_LEVEL
+#define MPC_LOG_MAX_LEVEL 4
+#endif
+
+// Asynchronous logger. Callers format into a slot of a lock-free ring and
+// return; a background thread writes the slots to stdout, so a slow
+// terminal never stalls the control loop. When the ring is full messages
+// are dropped and counted instead of blocking.
+//
+// The runtime level and payload sampling come from the environment:
+//   MPC_LOG_LEVEL   error, warn, info, debug or trace (default trace)
+//   MPC_LOG_SAMPLE  log only every n-th payload (default 1)
+namespace Logger {
+
+bool enabled(LogLevel level);
+
+// Whether the next payload should be logged, honouring MPC_LOG_SAMPLE.
+bool samplePayload();
+
+void write(LogLevel level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Log `length` bytes of `data` verbatim, e.g. a websocket message.
+void writeRaw(LogLevel level, const char *data, size_t length);
+
+// Block until everything logged so far is written.
+void flush();
+
+} // namespace Logger
+
+#define MPC_LOG(level, ...) \
+    do { \
+        if ((level) <= MPC_LOG_MAX_LEVEL && Logger::enabled(level)) { \
+            Logger::write(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define MPC_LOG_PAYLOAD(data, length) \
+    do { \
+        if (LOG_TRACE <= MPC_LOG_MAX_LEVEL && Logger::enabled(LOG_TRACE) && \
+            Logger::samplePayload()) { \
+            Logger::writeRaw(LOG_TRACE, data, length); \
+        } \
+    } while (0)
+
+#endif /* LOGGER_H */
@@ -0,0 +1,54 @@
+#include "LqrSchedule.h"
+#include <cmath>
+#include "Eigen-3.3/Eigen/Core"
+#include "FG_eval.h"
+
+constexpr double LqrSchedule::min_speed;
+constexpr double LqrSchedule::speed_step;
+
+// Riccati iterations until the cost-to-go settles, far more than the slow
+// lateral dynamics of the lowest speed take.
+static const int max_riccati_iterations = 100000;
+static const double riccati_tol = 1e-10;
+
+void LqrSchedule::build(const CostWeights &weights, double dt) {
+    const Eigen::Matrix2d Q = (Eigen::Vector2d() << weights.cte, weights.epsi).finished().asDiagonal();
+    const double R = weights.delta;
+    for (int i = 0; i < n_speeds; i++) {
+        double v = min_speed + i * speed_step;
+        Eigen::Matrix2d A;
+        A << 1, -v * dt,
+             0, 1;
+        Eigen::Vector2d B(0, v * dt / Lf);
+
+        Eigen::Matrix2d P = Q;
+        for (int k = 0; k < max_riccati_iterations; k++) {
+            Eigen::RowVector2d K = B.transpose() * P * A / (R + B.dot(P * B));
+            Eigen::Matrix2d next = Q + A.transpose() * P * (A - B * K);
+            next = 0.5 * (next + next.transpose()).eval();
+            bool settled = (next - P).cwiseAbs().maxCoeff() <= riccati_tol * next.cwiseAbs().maxCoeff();
+            P = next;
+            if (settled) {
+                break;
+            }
+        }
+        Eigen::RowVector2d K = B.transpose() * P * A / (R + B.dot(P * B));
+        gains[i].cte = K[0];
+        gains[i].epsi = K[1];
+
+        // The MPC's cte is of the opposite sign, which flips the cross term.
+        terminal[i].cte = P(0, 0) - Q(0, 0);
+        terminal[i].epsi = P(1, 1) - Q(1, 1);
+        terminal[i].cte_epsi = -2 * P(0, 1);
+    }
+
+    // The speed is a scalar integrator, its Riccati equation has the
+    // closed form p = (q dt^2 + sqrt(q^2 dt^4 + 4 q r dt^2)) / (2 dt^2).
+    double q = weights.v, r = weights.a, dt2 = dt * dt;
+    double p = q > 0 ? (q * dt2 + sqrt(q * q * dt2 * dt2 + 4 * q * r * dt2)) / (2 * dt2) : 0;
+    speed_gain = p * dt / (r + p * dt2);
+    reference_speed = ref_v;
+    for (TerminalCost &t : terminal) {
+        t.v = p - q;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef LQR_SCHEDULE_H
+#define LQR_SCHEDULE_H
+
+#include <math.h>
+#include <algorithm>
+#include "CostWeights.h"
+#include "VehicleModel.h"
+
+using namespace std;
+
+// The errors of the pose x, y, psi against the cubic reference `c` and its
+// curvature there, positive to the left, measured geometrically rather
+// than taken from the state, whose cte update is the classroom model's.
+template <typename Coeffs>
+inline void referenceErrors(const Coeffs &c, double x, double y, double psi,
+                            double &cte, double &epsi, double &curvature) {
+    double f0, slope;
+    polyevalSlope(c, x, f0, slope);
+    double second = 2 * c[2] + 6 * c[3] * x;
+    cte = f0 - y;
+    epsi = psi - atan(slope);
+    curvature = second / pow(1 + slope * slope, 1.5);
+}
+
+// Gain-scheduled LQR about the reference, the cheap stand-in for the
+// MPC when it has no answer in time. At speed v the lateral error follows
+//
+//     cte'  = cte - v dt epsi
+//     epsi' = epsi + v dt / Lf delta
+//
+// (the kinematic bicycle linearized at epsi = 0, with cte and epsi as the
+// MPC defines them, only the physical sign of the cte update), and the
+// speed v' = v + a dt. build() solves the discrete Riccati equation of both
+// under the MPC's weights at every speed of a grid; control() interpolates
+// the gains at the current speed, so it costs a handful of flops.
+class LqrSchedule {
+public:
+    // Speeds of the grid, in m/s; the gains of the ends hold beyond them.
+    static const int n_speeds = 50;
+    static constexpr double min_speed = 1.0;
+    static constexpr double speed_step = 1.0;
+    // The step of FG_eval.
+    static constexpr double default_dt = 0.1;
+
+    LqrSchedule() { build(CostWeights()); }
+
+    // Gains for steps of `dt` under `weights`: cte, epsi and v against
+    // delta and a, the rate terms left out.
+    void build(const CostWeights &weights, double dt = default_dt);
+
+    // Cost-to-go at speed v of the errors and the speed as the MPC
+    // defines them, less their stage cost, from the Riccati solution of
+    // the speed bucket nearest v, for the last stage of a horizon.
+    const TerminalCost &terminalCost(double v) const {
+        double s = min(max((v - min_speed) / speed_step, 0.0), (double) (n_speeds - 1));
+        return terminal[(int) lround(s)];
+    }
+
+    // Actuations for the state at speed v with errors cte and epsi to a
+    // reference of the given curvature, positive to the left, within the
+    // actuation bounds of the MPC. The curvature is fed forward as the
+    // steering that holds the turn.
+    void control(double v, double cte, double epsi, double curvature, double &delta, double &a) const {
+        double s = min(max((v - min_speed) / speed_step, 0.0), (double) (n_speeds - 1));
+        int i = min((int) s, n_speeds - 2);
+        double f = s - i;
+        double k_cte = gains[i].cte + f * (gains[i + 1].cte - gains[i].cte);
+        double k_epsi = gains[i].epsi + f * (gains[i + 1].epsi - gains[i].epsi);
+        delta = min(max(Lf * curvature - (k_cte * cte + k_epsi * epsi), -max_delta), max_delta);
+        a = min(max(-speed_gain * (v - reference_speed), -max_a), max_a);
+    }
+
+private:
+    struct LateralGains {
+        double cte;
+        double epsi;
+    };
+
+    LateralGains gains[n_speeds];
+    TerminalCost terminal[n_speeds];
+    double speed_gain;
+    double reference_speed;
+};
+
+#endif /* LQR_SCHEDULE_H */
@@ -1,152 +1,790 @@
 #include "MPC.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
 #include <cppad/cppad.hpp>
 #include <cppad/ipopt/solve.hpp>
+#include "CgmresSolver.h"
+#include "GeometricSolver.h"
+#include "CondensedFG_eval.h"
+#include "CppadThreads.h"
 #include "Eigen-3.3/Eigen/Core"
+#include "FG_eval.h"
+#include "FleetStore.h"
+#include "FrenetFG_eval.h"
+#include "KinematicNLP.h"
+#include "LinearSolverLock.h"
+#include "LqrSchedule.h"
+#include "MppiSolver.h"
+#include "RtiSolver.h"
+#include "Logger.h"
+#include "MpcConfig.h"
+#include "SlowSolveLog.h"
+#include "SolutionCache.h"
+#include "TaskScheduler.h"
+#include "TapedNLP.h"
+#include "Trace.h"
+#include "VehicleModel.h"
+#include "WarmStartLibrary.h"
 
 using CppAD::AD;
 
-// Set the timestep length and duration
-size_t N = 10;
-double dt = 0.1;
-
-// This value assumes the model presented in the classroom is used.
-//
-// It was obtained by measuring the radius formed by running the vehicle in the
-// simulator around in a circle with a constant steering angle and velocity on a
-// flat terrain.
+// Build the initial guess from the previous solution.
 //
-// Lf was tuned until the the radius formed by the simulating the model
-// presented in the classroom matched the previous radius.
-//
-// This is the length from front to CoG that has a similar radius.
-const double Lf = 2.67;
-
-// reference velocity, to make sure the vehicle does not stop
-double ref_v = 80;
-
-// The solver takes all the state variables and actuator
-// variables in a singular vector. Thus, we should to establish
-// when one variable starts and another ends to make our lifes easier.
-size_t x_start = 0;
-size_t y_start = x_start + N;
-size_t psi_start = y_start + N;
-size_t v_start = psi_start + N;
-size_t cte_start = v_start + N;
-size_t epsi_start = cte_start + N;
-size_t delta_start = epsi_start + N;
-size_t a_start = delta_start + N - 1;
-
-class FG_eval {
-public:
-    // Fitted polynomial coefficients
-    Eigen::VectorXd coeffs;
-    FG_eval(Eigen::VectorXd coeffs) { this->coeffs = coeffs; }
-    
-    typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
-    void operator()(ADvector& fg, const ADvector& vars) {
-        // implement MPC
-        // `fg` a vector of the cost constraints, `vars` is a vector of variable values (state & actuators)
-        // NOTE: You'll probably go back and forth between this function and
-        // the Solver function below.
-        
-        fg[0] = 0;
+// The previous trajectory is shifted one step forward in time (the last stage
+// is held) and re-anchored so that its first predicted pose lands on the new
+// initial pose, since both solutions are expressed in the vehicle coordinates
+// of the cycle they were computed in.
+template <typename Config, typename Prev>
+static void shiftSolution(const Prev &prev, const Eigen::VectorXd &state, Dvector &vars) {
+    const size_t N = Config::N;
+    const size_t x_start = Config::x_start;
+    const size_t y_start = Config::y_start;
+    const size_t psi_start = Config::psi_start;
+    const size_t v_start = Config::v_start;
+    const size_t cte_start = Config::cte_start;
+    const size_t epsi_start = Config::epsi_start;
+    const size_t delta_start = Config::delta_start;
+    const size_t a_start = Config::a_start;
+    const size_t n_controls = Config::n_controls;
+    
+    double ax = prev[x_start + 1];
+    double ay = prev[y_start + 1];
+    double apsi = prev[psi_start + 1];
+    
+    double bx = state[0];
+    double by = state[1];
+    double bpsi = state[2];
+    
+    for (int t = 0; t < N; t++) {
+        int src = (t + 1 < N) ? t + 1 : N - 1;
         
-        // Reference State Cost
-        // Define the cost related the reference state and
-        // any anything you think may be beneficial.
+        double dx = prev[x_start + src] - ax;
+        double dy = prev[y_start + src] - ay;
+        double rx =  cos(apsi) * dx + sin(apsi) * dy;
+        double ry = -sin(apsi) * dx + cos(apsi) * dy;
         
-        // cost based on state
-        for (int t=0; t < N; t++) {
-            fg[0] += 12 * CppAD::pow(vars[cte_start + t], 2);
-            fg[0] += 4050 * CppAD::pow(vars[epsi_start + t], 2);
-            fg[0] += 0.3 * CppAD::pow(vars[v_start + t] - ref_v, 2);
+        vars[x_start + t] = bx + cos(bpsi) * rx - sin(bpsi) * ry;
+        vars[y_start + t] = by + sin(bpsi) * rx + cos(bpsi) * ry;
+        vars[psi_start + t] = prev[psi_start + src] - apsi + bpsi;
+        vars[v_start + t] = prev[v_start + src];
+        vars[cte_start + t] = prev[cte_start + src];
+        vars[epsi_start + t] = prev[epsi_start + src];
+    }
+    
+    for (int t = 0; t < n_controls; t++) {
+        int src = (t + 1 < n_controls) ? t + 1 : n_controls - 1;
+        vars[delta_start + t] = prev[delta_start + src];
+        vars[a_start + t] = prev[a_start + src];
+    }
+}
+
+// Build the initial guess from the actuations `u` of an earlier solve,
+// laid out as in the decision vector: the model rolled out from `state`
+// under them.
+template <typename Config>
+static void rollOutGuess(const double *u, const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                         Dvector &vars) {
+    const size_t starts[6] = {Config::x_start, Config::y_start, Config::psi_start,
+                              Config::v_start, Config::cte_start, Config::epsi_start};
+    double s[6];
+    for (int k = 0; k < 6; k++) {
+        s[k] = state[k];
+    }
+    for (size_t t = 0; t < Config::N; t++) {
+        if (t > 0) {
+            size_t j = Config::controlIndex(t);
+            double next[6];
+            vehicleStep(s, u[j], u[Config::n_controls + j], coeffs, Config::stageDt(t), next);
+            copy(next, next + 6, s);
         }
-        
-        // Minimize the use of actuators.
-        for (int t = 0; t < N - 1; t++) {
-            fg[0] += 10000 * CppAD::pow(vars[delta_start + t], 2);
-            fg[0] += 10 * CppAD::pow(vars[a_start + t], 2);
+        for (int k = 0; k < 6; k++) {
+            vars[starts[k] + t] = s[k];
         }
-        
-        // Minimize the value gap between sequential actuations.
-        for (int t = 0; t < N - 2; t++) {
-            fg[0] += 0.1 * CppAD::pow(vars[delta_start + t + 1] - vars[delta_start + t], 2);
-            fg[0] += 10 * CppAD::pow(vars[a_start + t + 1] - vars[a_start + t], 2);
+    }
+    for (size_t i = 0; i < 2 * Config::n_controls; i++) {
+        vars[Config::delta_start + i] = u[i];
+    }
+}
+
+// Build the initial guess of `lqr` in closed loop: the model rolled out
+// from `state`, each move set by the LQR from the state it starts at.
+template <typename Config>
+static void lqrGuess(const LqrSchedule &lqr, const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                     Dvector &vars) {
+    const size_t n_controls = Config::n_controls;
+    double u[2 * n_controls];
+    double s[6];
+    for (int k = 0; k < 6; k++) {
+        s[k] = state[k];
+    }
+    size_t moves = 0;
+    for (size_t t = 1; t < Config::N; t++) {
+        size_t j = Config::controlIndex(t);
+        for (; moves <= j; moves++) {
+            double cte, epsi, curvature;
+            referenceErrors(coeffs, s[0], s[1], s[2], cte, epsi, curvature);
+            lqr.control(s[3], cte, epsi, curvature, u[moves], u[n_controls + moves]);
         }
+        double next[6];
+        vehicleStep(s, u[j], u[n_controls + j], coeffs, Config::stageDt(t), next);
+        copy(next, next + 6, s);
+    }
+    // Moves past the end of the horizon, behind the latency, hold the last.
+    for (; moves < n_controls; moves++) {
+        u[moves] = u[moves - 1];
+        u[n_controls + moves] = u[n_controls + moves - 1];
+    }
+    rollOutGuess<Config>(u, state, coeffs, vars);
+}
+
+// Mismatch between the previous plan's prediction for now and the state
+// beyond which its shift is not worth starting from, see
+// FixedHorizon::Solve. Steady state stays well under a third of them.
+static const double poor_shift_cte = 1.0;
+static const double poor_shift_epsi = 0.25;
+
+// Bounds of the variables and constraints that do not depend on the
+// initial state, set once per problem.
+template <typename Config>
+static void setFixedBounds(Dvector &vars_lowerbound, Dvector &vars_upperbound,
+                           Dvector &constraints_lowerbound, Dvector &constraints_upperbound) {
+    const size_t n_vars = Config::n_vars;
+    const size_t n_constraints = Config::n_constraints;
+    const size_t delta_start = Config::delta_start;
+    const size_t a_start = Config::a_start;
+    
+    vars_lowerbound.resize(n_vars);
+    vars_upperbound.resize(n_vars);
+    constraints_lowerbound.resize(n_constraints);
+    constraints_upperbound.resize(n_constraints);
+    
+    // Set lower and upper limits for variables.
+    for (int i = 0; i < delta_start; i++) {
+        vars_lowerbound[i] = -1.0e19;
+        vars_upperbound[i] = 1.0e19;
+    }
+    for (int i = delta_start; i < a_start; i++) {
+        vars_lowerbound[i] = -max_delta;
+        vars_upperbound[i] = max_delta;
+    }
+    for (int i = a_start; i < n_vars; i++) {
+        vars_lowerbound[i] = -max_a;
+        vars_upperbound[i] = max_a;
+    }
+    
+    // Lower and upper limits for the constraints
+    // Should be 0 besides initial state.
+    for (int i = 0; i < n_constraints; i++) {
+        constraints_lowerbound[i] = 0;
+        constraints_upperbound[i] = 0;
+    }
+}
+
+// Pin the initial state constraints of bounds from setFixedBounds to
+// `state`, the only entries that change from one solve to the next.
+template <typename Config>
+static void setInitialState(const Eigen::VectorXd &state, Dvector &constraints_lowerbound,
+                            Dvector &constraints_upperbound) {
+    const size_t starts[6] = {Config::x_start, Config::y_start, Config::psi_start,
+                              Config::v_start, Config::cte_start, Config::epsi_start};
+    for (int k = 0; k < 6; k++) {
+        constraints_lowerbound[starts[k]] = state[k];
+        constraints_upperbound[starts[k]] = state[k];
+    }
+}
+
+// Option string of CppAD::ipopt::solve for `options`, without the time
+// limit, which is added per solve.
+static string cppadOptions(const MpcOptions &options) {
+    //
+    // NOTE: You don't have to worry about these options
+    //
+    // options for IPOPT solver
+    string s;
+    // Uncomment this if you'd like more print information
+    s += "Integer print_level  0\n";
+    // NOTE: Setting sparse to true allows the solver to take advantage
+    // of sparse routines, this makes the computation MUCH FASTER. If you
+    // can uncomment 1 of these and see if it makes a difference or not but
+    // if you uncomment both the computation time should go up in orders of
+    // magnitude.
+    s += "Sparse  true        forward\n";
+    s += "Sparse  true        reverse\n";
+    if (!options.linear_solver.empty()) {
+        s += "String  linear_solver " + options.linear_solver + "\n";
+    }
+    if (!options.mu_strategy.empty()) {
+        s += "String  mu_strategy " + options.mu_strategy + "\n";
+    }
+    char line[64];
+    snprintf(line, sizeof(line), "Numeric tol %.17g\n", options.tol);
+    s += line;
+    snprintf(line, sizeof(line), "Numeric acceptable_tol %.17g\n", options.acceptable_tol);
+    s += line;
+    snprintf(line, sizeof(line), "Numeric bound_push %.17g\n", options.bound_push);
+    s += line;
+    snprintf(line, sizeof(line), "Numeric bound_frac %.17g\n", options.bound_push);
+    s += line;
+    if (!options.exact_hessian) {
+        s += "String  hessian_approximation limited-memory\n";
+    }
+    return s;
+}
+
+// Solver state that depends on the horizon. MPC only talks to it through
+// this interface, once per solve, so everything below it is compiled for a
+// fixed horizon.
+class MpcHorizon {
+public:
+    virtual ~MpcHorizon() {}
+    virtual void setWarmStart(bool enabled) = 0;
+    virtual void resetWarmStart() = 0;
+    virtual void seedWarmStart(const Solution &plan) = 0;
+    virtual bool getWarmStart(vector<double> &vars, size_t &fallbacks) const = 0;
+    virtual bool restoreWarmStart(const vector<double> &vars, size_t fallbacks) = 0;
+    virtual bool getDuals(vector<double> &duals) const = 0;
+    virtual bool restoreDuals(const vector<double> &duals) = 0;
+    virtual void setBackend(SolverBackend backend) = 0;
+    virtual void setModel(ModelVariant model) = 0;
+    virtual void setFormulation(Formulation formulation) = 0;
+    virtual void setCostWeights(const CostWeights &weights) = 0;
+    virtual void setSpeedProfile(const SpeedProfile &profile) = 0;
+    virtual void setOptions(const MpcOptions &options) = 0;
+    virtual void setCancel(const CancelToken *token) = 0;
+    virtual void setIterationTrace(IterationTrace *trace) = 0;
+    virtual void setObstacles(const FleetObstacles *obstacles) = 0;
+    virtual SparsityStats getSparsityStats() = 0;
+    virtual TapeStats getTapeStats() = 0;
+    virtual void Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                       SolveStats &stats, Deadline deadline, Solution &result) = 0;
+    virtual void SolveBatch(const vector<Eigen::VectorXd> &states, const vector<Eigen::VectorXd> &coeffs,
+                            vector<vector<double> > &actuations, vector<SolveStats> &stats) = 0;
+    virtual void SolveBatch(FleetStore &fleet, const vector<size_t> &slots, vector<SolveStats> &stats) = 0;
+    virtual size_t getBatchWarmStartSize() const = 0;
+    virtual bool Predict(const StateVector &state, const CubicCoeffs &coeffs, double &delta, double &a) const = 0;
+    virtual double getTimeInterval() = 0;
+    virtual size_t getHorizon() const = 0;
+};
+
+template <typename Config>
+class FixedHorizon : public MpcHorizon, private Config {
+    using Config::N;
+    using Config::dt;
+    using Config::n_controls;
+    using Config::x_start;
+    using Config::y_start;
+    using Config::psi_start;
+    using Config::v_start;
+    using Config::cte_start;
+    using Config::epsi_start;
+    using Config::delta_start;
+    using Config::a_start;
+    using Config::n_vars;
+    using Config::n_constraints;
+    
+public:
+    FixedHorizon()
+        : warm_start(false), has_prev(false), fallbacks(0), backend(CPPAD_IPOPT), model(CARTESIAN_MODEL),
+          formulation(MULTIPLE_SHOOTING), speeds(constantSpeeds()), cppad_options(cppadOptions(options)),
+          linear_solver_lock(linearSolverLock(options.linear_solver)), cancel(nullptr), iteration_trace(nullptr), obstacles(nullptr),
+          has_gain(false) {
+        setFixedBounds<Config>(vars_lowerbound, vars_upperbound, constraints_lowerbound, constraints_upperbound);
         
-        // Setup Constraints
-        // We add 1 to each of the starting indices due to cost being located at
-        // index 0 of `fg`.
-        // This bumps up the position of all the other values.
-        fg[1 + x_start] = vars[x_start];
-        fg[1 + y_start] = vars[y_start];
-        fg[1 + psi_start] = vars[psi_start];
-        fg[1 + v_start] = vars[v_start];
-        fg[1 + cte_start] = vars[cte_start];
-        fg[1 + epsi_start] = vars[epsi_start];
-        
-        // The rest of the constraints
-        for (int t = 1; t < N; t++) {
-            AD<double> x1 = vars[x_start + t];
-            AD<double> y1 = vars[y_start + t];
-            AD<double> psi1 = vars[psi_start + t];
-            AD<double> v1 = vars[v_start + t];
-            AD<double> cte1 = vars[cte_start + t];
-            AD<double> epsi1 = vars[epsi_start + t];
-            
-            AD<double> x0 = vars[x_start + t - 1];
-            AD<double> y0 = vars[y_start + t - 1];
-            AD<double> psi0 = vars[psi_start + t - 1];
-            AD<double> v0 = vars[v_start + t - 1];
-            AD<double> cte0 = vars[cte_start + t - 1];
-            AD<double> epsi0 = vars[epsi_start + t - 1];
-            
-            // actuations
-            AD<double> delta = vars[delta_start + t - 1];
-            AD<double> a = vars[a_start + t - 1];
-            
-            // Account for actuations delay (100 ms)
-            int latency = 0.1/dt;
-            if (t > latency) {
-                // To account for 100 ms delay.
-                delta = vars[delta_start + t - 1 - latency];
-                a = vars[a_start + t - 1 - latency];
-            }
-            
-            // NOTE: The use of `AD<double>` and use of `CppAD`!
-            // This is also CppAD can compute derivatives and pass
-            // these to the solver.
-            
-            AD<double> f0 = 0.0;
-            for (int i = 0; i < coeffs.size(); i++) {
-                f0 += coeffs[i] * CppAD::pow(x0, i);
+        // The actuation bounds of SINGLE_SHOOTING are the tail of those.
+        size_t n = CondensedFG_eval<Config, Eigen::VectorXd>::n_vars;
+        controls_lowerbound.resize(n);
+        controls_upperbound.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            controls_lowerbound[i] = vars_lowerbound[delta_start + i];
+            controls_upperbound[i] = vars_upperbound[delta_start + i];
+        }
+    }
+    
+    void setWarmStart(bool enabled) {
+        warm_start = enabled;
+        if (!enabled) {
+            resetWarmStart();
+        }
+    }
+    
+    void resetWarmStart() {
+        has_prev = false;
+        fallbacks = 0;
+        has_gain = false;
+    }
+    
+    // Take `plan`, which may be of another horizon, as the previous
+    // solution. Stages past its end continue the kinematics with its last
+    // actuations held. The stages of a non-uniform grid do not line up
+    // with the plan's, so it then starts cold.
+    void seedWarmStart(const Solution &plan) {
+        if (!warm_start || !Config::uniform || plan.n_stages < 2) {
+            return;
+        }
+        size_t n = min((size_t) N, plan.n_stages);
+        for (size_t t = 0; t < N; t++) {
+            double x, y, psi, v, cte, epsi;
+            if (t < n) {
+                const PredictedStage &stage = plan.stages[t];
+                x = stage.x;
+                y = stage.y;
+                psi = stage.psi;
+                v = stage.v;
+                cte = stage.cte;
+                epsi = stage.epsi;
+            } else {
+                double delta = prev_vars[delta_start + t - 2];
+                double a = prev_vars[a_start + t - 2];
+                double v0 = prev_vars[v_start + t - 1];
+                double epsi0 = prev_vars[epsi_start + t - 1];
+                x = prev_vars[x_start + t - 1] + v0 * cos(prev_vars[psi_start + t - 1]) * dt;
+                y = prev_vars[y_start + t - 1] + v0 * sin(prev_vars[psi_start + t - 1]) * dt;
+                psi = prev_vars[psi_start + t - 1] + v0 / Lf * delta * dt;
+                v = v0 + a * dt;
+                cte = prev_vars[cte_start + t - 1] + v0 * sin(epsi0) * dt;
+                epsi = epsi0 + v0 / Lf * delta * dt;
             }
-            
-            AD<double> psides0 = 0.0;
-            for (int i = 1; i < coeffs.size(); i++) {
-                psides0 += i*coeffs[i] * CppAD::pow(x0, i-1); // f'(x0)
+            prev_vars[x_start + t] = x;
+            prev_vars[y_start + t] = y;
+            prev_vars[psi_start + t] = psi;
+            prev_vars[v_start + t] = v;
+            prev_vars[cte_start + t] = cte;
+            prev_vars[epsi_start + t] = epsi;
+            if (t + 1 < N) {
+                size_t src = min(t, n - 2);
+                prev_vars[delta_start + t] = plan.stages[src].delta;
+                prev_vars[a_start + t] = plan.stages[src].a;
             }
-            psides0 = CppAD::atan(psides0);
-            
-            fg[1 + x_start + t] = x1 - (x0 + v0 * CppAD::cos(psi0) * dt);
-            fg[1 + y_start + t] = y1 - (x0 + v0 * CppAD::sin(psi0) * dt);
-            fg[1 + psi_start + t] = psi1 - (psi0 + (v0/Lf) * delta * dt);
-            fg[1 + v_start + t] = v1 - (v0 + a * dt);
-            fg[1 + cte_start + t] = cte1 - ((f0 - y0) + v0 * CppAD::sin(epsi0) * dt);
-            fg[1 + epsi_start + t] = epsi1 - ((psi0 - psides0) + (v0/Lf) * delta * dt);
         }
+        has_prev = true;
+        fallbacks = 0;
+    }
+    
+    bool getWarmStart(vector<double> &vars, size_t &fallbacks) const {
+        fallbacks = this->fallbacks;
+        if (!warm_start || !has_prev) {
+            vars.clear();
+            return false;
+        }
+        vars.assign(prev_vars.begin(), prev_vars.end());
+        return true;
+    }
+    
+    bool restoreWarmStart(const vector<double> &vars, size_t fallbacks) {
+        if (!warm_start || (!vars.empty() && vars.size() != prev_vars.size())) {
+            return false;
+        }
+        has_prev = !vars.empty();
+        copy(vars.begin(), vars.end(), prev_vars.begin());
+        this->fallbacks = fallbacks;
+        return true;
+    }
+    
+    // Only the kinematic backend keeps its multipliers between solves.
+    bool getDuals(vector<double> &duals) const {
+        if (backend != KINEMATIC_IPOPT || !kinematic) {
+            duals.clear();
+            return false;
+        }
+        return kinematic->getDuals(duals);
+    }
+    
+    bool restoreDuals(const vector<double> &duals) {
+        if (backend != KINEMATIC_IPOPT || !kinematic) {
+            return duals.empty();
+        }
+        return kinematic->restoreDuals(duals);
+    }
+    
+    void setBackend(SolverBackend backend) {
+        this->backend = backend;
+        if (backend == TAPED_IPOPT && !taped) {
+            taped.reset(new TapedSolver<Config>());
+        }
+        if (backend == KINEMATIC_IPOPT && !kinematic) {
+            kinematic.reset(new KinematicSolver<Config>());
+        }
+        if (backend == SQP_RTI && !rti) {
+            rti.reset(new RtiSolver<Config>());
+        }
+        if (backend == MPPI && !mppi) {
+            mppi.reset(new MppiSolver<Config>());
+        }
+        if (backend == CGMRES && !cgmres) {
+            cgmres.reset(new CgmresSolver<Config>());
+        }
+        if (backend == GEOMETRIC && !geometric) {
+            geometric.reset(new GeometricSolver<Config>());
+        }
+        setCostWeights(weights);
+        setReferenceSpeeds();
+        setModel(model);
+        setOptions(options);
+    }
+    
+    void setModel(ModelVariant model) {
+        this->model = model;
+        cache.clear();
+        if (taped) {
+            taped->setModel(model);
+        }
+    }
+    
+    void setFormulation(Formulation formulation) {
+        this->formulation = formulation;
+        cache.clear();
+    }
+    
+    void setCostWeights(const CostWeights &weights) {
+        this->weights = weights;
+        if (taped) {
+            taped->setCostWeights(weights);
+        }
+        if (kinematic) {
+            kinematic->setCostWeights(weights);
+        }
+        if (rti) {
+            rti->setCostWeights(weights);
+        }
+        if (batch) {
+            batch->setCostWeights(weights);
+        }
+        if (mppi) {
+            mppi->setCostWeights(weights);
+        }
+        if (cgmres) {
+            cgmres->setCostWeights(weights);
+        }
+        if (geometric) {
+            geometric->setCostWeights(weights);
+        }
+        if (rti_single) {
+            rti_single->setCostWeights(weights);
+        }
+        if (mppi_single) {
+            mppi_single->setCostWeights(weights);
+        }
+        if (predictor) {
+            predictor->setCostWeights(weights);
+        }
+        for (auto &start : multi_starts) {
+            start->solver->setCostWeights(weights);
+        }
+        lqr.build(weights, dt);
+        has_gain = false;
+        cache.clear();
+    }
+    
+    void setSpeedProfile(const SpeedProfile &profile) {
+        this->profile = profile;
+    }
+    
+    // Hand `speeds` to every solver.
+    void setReferenceSpeeds() {
+        if (taped) {
+            taped->setReferenceSpeeds(speeds);
+        }
+        if (kinematic) {
+            kinematic->setReferenceSpeeds(speeds);
+        }
+        if (rti) {
+            rti->setReferenceSpeeds(speeds);
+        }
+        if (batch) {
+            batch->setReferenceSpeeds(speeds);
+        }
+        if (mppi) {
+            mppi->setReferenceSpeeds(speeds);
+        }
+        if (cgmres) {
+            cgmres->setReferenceSpeeds(speeds);
+        }
+        if (geometric) {
+            geometric->setReferenceSpeeds(speeds);
+        }
+        if (rti_single) {
+            rti_single->setReferenceSpeeds(speeds);
+        }
+        if (mppi_single) {
+            mppi_single->setReferenceSpeeds(speeds);
+        }
+        if (predictor) {
+            predictor->setReferenceSpeeds(speeds);
+        }
+        for (auto &start : multi_starts) {
+            start->solver->setReferenceSpeeds(speeds);
+        }
+    }
+    
+    void setOptions(const MpcOptions &options) {
+        // What the library learned is kept unless its size changes.
+        if (options.warm_library != this->options.warm_library) {
+            library.reset(options.warm_library, 2 * n_controls);
+        }
+        if (options.solution_cache != this->options.solution_cache) {
+            cache.reset(options.solution_cache, n_vars);
+        }
+        cache.clear();
+        this->options = options;
+        cppad_options = cppadOptions(options);
+        linear_solver_lock = linearSolverLock(options.linear_solver);
+        if (taped) {
+            taped->setOptions(options);
+        }
+        if (kinematic) {
+            kinematic->setOptions(options);
+        }
+        if (backend == KINEMATIC_IPOPT) {
+            setStarts(options.multi_start);
+        }
+        for (auto &start : multi_starts) {
+            start->solver->setOptions(options);
+        }
+        if (options.single_precision && backend == SQP_RTI && !rti_single) {
+            rti_single.reset(new RtiSolver<Config, float>());
+            rti_single->setCostWeights(weights);
+            rti_single->setReferenceSpeeds(speeds);
+        }
+        if (options.predictor && !predictor) {
+            predictor.reset(new RtiSolver<Config>());
+            predictor->setCostWeights(weights);
+            predictor->setReferenceSpeeds(speeds);
+        }
+        has_gain &= options.predictor;
+        if (options.single_precision && backend == MPPI && !mppi_single) {
+            mppi_single.reset(new MppiSolver<Config, float>());
+            mppi_single->setCostWeights(weights);
+            mppi_single->setReferenceSpeeds(speeds);
+        }
+        if (rti) {
+            setRtiOptions(*rti, options);
+        }
+        if (rti_single) {
+            setRtiOptions(*rti_single, options);
+        }
+        if (mppi) {
+            setMppiOptions(*mppi, options);
+        }
+        if (mppi_single) {
+            setMppiOptions(*mppi_single, options);
+        }
+        if (cgmres) {
+            cgmres->setDirections(options.cgmres_directions);
+        }
+        if (geometric) {
+            GeometricParams params;
+            params.law = options.geometric_law;
+            geometric->setParams(params);
+        }
+    }
+    
+    // Handed to the solver of each solve, see MPC::setCancel.
+    void setCancel(const CancelToken *token) {
+        cancel = token;
+    }
+    
+    // Handed to the IPOPT solver of each solve, see MPC::setIterationTrace.
+    void setIterationTrace(IterationTrace *trace) {
+        iteration_trace = trace;
+    }
+    
+    // Added to the cost of each CPPAD_IPOPT solve and to the objective
+    // GEOMETRIC reports, see MPC::setObstacles.
+    void setObstacles(const FleetObstacles *obstacles) {
+        this->obstacles = obstacles;
+    }
+    
+    SparsityStats getSparsityStats() {
+        return taped ? taped->sparsityStats() : SparsityStats();
+    }
+    
+    TapeStats getTapeStats() {
+        return taped ? taped->tapeStats() : TapeStats();
+    }
+    
+    void Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+               SolveStats &stats, Deadline deadline, Solution &result);
+    
+    void SolveBatch(const vector<Eigen::VectorXd> &states, const vector<Eigen::VectorXd> &coeffs,
+                    vector<vector<double> > &actuations, vector<SolveStats> &stats);
+    
+    void SolveBatch(FleetStore &fleet, const vector<size_t> &slots, vector<SolveStats> &stats);
+    
+    size_t getBatchWarmStartSize() const {
+        return n_vars;
+    }
+    
+    double getTimeInterval() {
+        return dt;
+    }
+    
+    size_t getHorizon() const {
+        return N;
+    }
+    
+    bool Predict(const StateVector &state, const CubicCoeffs &coeffs, double &delta, double &a) const {
+        if (!has_gain) {
+            return false;
+        }
+        Eigen::Matrix<double, Gain::ColsAtCompileTime, 1> p;
+        p << state, coeffs;
+        Eigen::Vector2d u = gain_u + gain * (p - gain_params);
+        delta = fmin(fmax(u[0], vars_lowerbound[delta_start]), vars_upperbound[delta_start]);
+        a = fmin(fmax(u[1], vars_lowerbound[a_start]), vars_upperbound[a_start]);
+        return true;
+    }
+    
+private:
+    bool warm_start;
+    
+    // Decision vector of the last successful solve, valid if has_prev. After
+    // a failed solve it holds that plan shifted forward once per failure.
+    array<double, Config::n_vars> prev_vars;
+    bool has_prev;
+    size_t fallbacks;
+    
+    SolverBackend backend;
+    ModelVariant model;
+    Formulation formulation;
+    CostWeights weights;
+    // The speed profile ahead of the car and the stage speeds of the last
+    // solve along it.
+    SpeedProfile profile;
+    StageSpeeds speeds;
+    MpcOptions options;
+    // Option string of CPPAD_IPOPT but for the time limit.
+    string cppad_options;
+    // Held around the solves of CPPAD_IPOPT, see LinearSolverLock.h.
+    mutex *linear_solver_lock;
+    const CancelToken *cancel;
+    IterationTrace *iteration_trace;
+    const FleetObstacles *obstacles;
+    unique_ptr<TapedSolver<Config> > taped;
+    unique_ptr<KinematicSolver<Config> > kinematic;
+    unique_ptr<RtiSolver<Config> > rti;
+    // Converged actuations of earlier solves, see MpcOptions::warm_library.
+    WarmStartLibrary library;
+    // Converged solutions of earlier solves, see MpcOptions::solution_cache.
+    SolutionCache cache;
+    unique_ptr<RtiBatch<Config> > batch;
+    unique_ptr<MppiSolver<Config> > mppi;
+    unique_ptr<CgmresSolver<Config> > cgmres;
+    unique_ptr<GeometricSolver<Config> > geometric;
+    // The same in single precision, made once MpcOptions::single_precision
+    // asks for them.
+    unique_ptr<RtiSolver<Config, float> > rti_single;
+    unique_ptr<MppiSolver<Config, float> > mppi_single;
+    
+    // Tangential predictor, see MpcOptions::predictor: the first
+    // actuations of the last successful solve, the parameters of its
+    // problem and the sensitivity of the former to the latter.
+    typedef typename RtiSolver<Config>::Gain Gain;
+    unique_ptr<RtiSolver<Config> > predictor;
+    bool has_gain;
+    Gain gain;
+    Eigen::Matrix<double, Gain::ColsAtCompileTime, 1> gain_params;
+    Eigen::Vector2d gain_u;
+    
+    // The starts of MpcOptions::multi_start but the first, which is
+    // `kinematic` on the usual guess. They run as tasks of the
+    // TaskScheduler, the first on the solving thread.
+    struct Start {
+        unique_ptr<KinematicSolver<Config> > solver;
+        SolveSeed seed;
+        Dvector vars;
+        SolveResult solution;
+        SolveStats stats;
+    };
+    vector<unique_ptr<Start> > multi_starts;
+    // Gains of the SEED_LQR guess.
+    LqrSchedule lqr;
+    
+    // Problem and answer of Solve, kept to reuse their storage. All bounds
+    // but those of the initial state are set once, by the constructor.
+    Dvector vars;
+    Dvector vars_lowerbound;
+    Dvector vars_upperbound;
+    Dvector constraints_lowerbound;
+    Dvector constraints_upperbound;
+    SolveResult solution;
+    
+    // The same for SINGLE_SHOOTING: the actuations with their bounds, no
+    // constraints, the initial state followed by the coefficients, and the
+    // answer before it is rolled out into `solution`.
+    Dvector controls;
+    Dvector controls_lowerbound;
+    Dvector controls_upperbound;
+    Dvector no_constraints;
+    Eigen::VectorXd condensed_params;
+    SolveResult condensed_solution;
+    
+    // Solve in SINGLE_SHOOTING from the guess and bounds in the members,
+    // writing the rolled out trajectory into `solution`.
+    void solveCondensed(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                        Deadline deadline, SolveStats &stats);
+    
+    // Make the solvers of `n` starts in all.
+    void setStarts(size_t n) {
+        size_t extra = n > 1 ? n - 1 : 0;
+        if (multi_starts.size() == extra) {
+            return;
+        }
+        multi_starts.clear();
+        for (size_t i = 0; i < extra; i++) {
+            multi_starts.emplace_back(new Start());
+            multi_starts.back()->solver.reset(new KinematicSolver<Config>());
+            multi_starts.back()->solver->setCostWeights(weights);
+            multi_starts.back()->solver->setReferenceSpeeds(speeds);
+        }
+    }
+    
+    // Fill `x` with the guess of `seed` for `state`, false if it has none.
+    bool seedGuess(SolveSeed seed, const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, Dvector &x);
+    
+    // Solve KINEMATIC_IPOPT from the guess in `vars`, of `seed`, and those
+    // of the other starts concurrently, writing the first converged one
+    // into `solution` and `stats`.
+    // The batch solves of SolveBatch: problem i of `n` is loaded by
+    // load(i, state, coeffs, vars), which fills its initial state and
+    // reference, and its initial guess into `vars` if it returns true,
+    // else it starts cold; answer(i, solution) takes its result.
+    template <typename Load, typename Answer>
+    void solvePackets(size_t n, Load load, Answer answer, SolveStats *stats);
+    
+    void solveMultiStart(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, bool warm,
+                         SolveSeed seed, Deadline deadline, SolveStats &stats);
+    
+    template <typename Solver>
+    static void setRtiOptions(Solver &solver, const MpcOptions &options) {
+        solver.setIterations(options.rti_iterations);
+        solver.setStructured(options.rti_qp == RTI_QP_DEFAULT);
+        solver.setSparse(options.rti_qp == RTI_QP_SPARSE);
     }
+    
+    template <typename Solver>
+    static void setMppiOptions(Solver &solver, const MpcOptions &options) {
+        solver.setSamples(options.mppi_samples);
+        solver.setThreads(options.eval_threads);
+        solver.setGpu(options.mppi_gpu);
+    }
+    
+    template <typename FG>
+    void solveCppAD(const Dvector &vars, const Dvector &vars_lowerbound, const Dvector &vars_upperbound,
+                    const Dvector &constraints_lowerbound, const Dvector &constraints_upperbound,
+                    FG &fg_eval, Deadline deadline, SolveResult &solution, SolveStats &stats);
 };
 
-//
-// MPC class definition implementation.
-//
-MPC::MPC() {}
-MPC::~MPC() {}
-
-vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
+template <typename Config>
+void FixedHorizon<Config>::Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                                 SolveStats &stats, Deadline deadline, Solution &result) {
+    auto start = chrono::steady_clock::now();
+    MPC_TRACE_CLOCK(phases);
+    stats = SolveStats();
     bool ok = true;
-    typedef CPPAD_TESTVECTOR(double) Dvector;
     
     double x = state[0];
     double y = state[1];
@@ -155,23 +793,49 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
     double cte = state[4];
     double epsi = state[5];
     
-    // Set the number of model variables (includes both states and inputs).
-    // For example: If the state is a 4 element vector, the actuators is a 2
-    // element vector and there are 10 timesteps. The number of variables is:
-    //
-    // 4 * 10 + 2 * 9
-    size_t n_vars = N * 6 + (N - 1) * 2;
-    
-    // Set the number of constraints
-    size_t n_constraints = N * 6;
+    // The number of model variables (includes both states and inputs) and
+    // constraints are fixed by the horizon, see MpcConfig.h.
     
     // Initial value of the independent variables.
-    // SHOULD BE 0 besides initial state.
-    Dvector vars(n_vars);
-    for (int i = 0; i < n_vars; i++) {
-        vars[i] = 0;
+    // SHOULD BE 0 besides initial state, unless warm starting from the
+    // previous solution.
+    vars.resize(n_vars);
+    bool warm = warm_start && has_prev;
+    if (warm) {
+        shiftSolution<Config>(prev_vars, state, vars);
     }
     
+    // A solve of the cache is only the same problem under the same stage
+    // speeds.
+    StageSpeeds stage_speeds;
+    stageSpeeds<Config>(profile, v, stage_speeds);
+    if (stage_speeds != speeds) {
+        speeds = stage_speeds;
+        setReferenceSpeeds();
+        cache.clear();
+    }
+    
+    // Without a previous plan, or with one the errors have moved away from
+    // (a sharp change of curvature, a new reference), the nearest converged
+    // solve of the library is rolled out from the state instead.
+    bool poor = warm && (fabs(prev_vars[cte_start + 1] - cte) > poor_shift_cte ||
+                         fabs(prev_vars[epsi_start + 1] - epsi) > poor_shift_epsi);
+    bool seeded = false;
+    if (library.enabled() && (!warm || poor)) {
+        if (const double *u = library.nearest(state, coeffs)) {
+            rollOutGuess<Config>(u, state, coeffs, vars);
+            seeded = true;
+            warm = false;
+        }
+    }
+    if (!warm && !seeded) {
+        for (int i = 0; i < n_vars; i++) {
+            vars[i] = 0;
+        }
+    }
+    SolveSeed seed = warm ? SEED_SHIFTED : seeded ? SEED_LIBRARY : SEED_ZERO;
+    stats.seed = seed;
+    
     // Set the initial variable values
     vars[x_start] = x;
     vars[y_start] = y;
@@ -180,85 +844,188 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
     vars[cte_start] = cte;
     vars[epsi_start] = epsi;
     
-    Dvector vars_lowerbound(n_vars);
-    Dvector vars_upperbound(n_vars);
-    // Set lower and upper limits for variables.
-    for (int i = 0; i < delta_start; i++) {
-        vars_lowerbound[i] = -1.0e19;
-        vars_upperbound[i] = 1.0e19;
-    }
+    // Only the initial state changes, the rest was set by the constructor.
+    setInitialState<Config>(state, constraints_lowerbound, constraints_upperbound);
     
-    // The upper and lower limits of delta are set to -25 and 25
-    // degrees (values in radians).
-    for (int i = delta_start; i < a_start; i++) {
-        vars_lowerbound[i] = -0.436332;
-        vars_upperbound[i] = 0.436332;
+    // place to return solution, emptied so that a solve giving up before
+    // producing a point is told apart from the last one
+    solution.x.resize(0);
+    solution.g.resize(0);
+    solution.status = SolveResult::unknown;
+    solution.obj_value = 0;
+    
+    // The same problem as a solve in the cache is answered with its
+    // solution.
+    double cached_objective = 0;
+    const double *cached = nullptr;
+    if (cache.enabled()) {
+        cached = cache.find(state, coeffs, cached_objective);
+        stats.cache_lookup = true;
+        stats.cached = cached != nullptr;
     }
+    MPC_TRACE_LAP(phases, "setup");
     
-    // Acceleration/decceleration upper and lower limits.
-    for (int i = a_start; i < n_vars; i++) {
-        vars_lowerbound[i] = -1.0;
-        vars_upperbound[i] = 1.0;
+    // The Frenet model is parameterized by the curvature under the guess
+    // instead of the coefficients.
+    Eigen::VectorXd kappa;
+    if (!cached && model != CARTESIAN_MODEL && (backend == TAPED_IPOPT || backend == CPPAD_IPOPT)) {
+        kappa = curvatureProfile<Config>(coeffs, vars, warm || seeded);
     }
     
-    // Lower and upper limits for the constraints
-    // Should be 0 besides initial state.
-    Dvector constraints_lowerbound(n_constraints);
-    Dvector constraints_upperbound(n_constraints);
-    for (int i = 0; i < n_constraints; i++) {
-        constraints_lowerbound[i] = 0;
-        constraints_upperbound[i] = 0;
+    bool condensed = formulation == SINGLE_SHOOTING && model == CARTESIAN_MODEL &&
+                     (backend == TAPED_IPOPT || backend == CPPAD_IPOPT);
+    
+    // The cost-to-go of the speed bucket, on the multiple shooting costs of
+    // the CppAD backends and the objective GEOMETRIC reports.
+    TerminalCost terminal;
+    if (options.terminal_cost && !condensed &&
+        (backend == TAPED_IPOPT || backend == CPPAD_IPOPT || backend == GEOMETRIC)) {
+        terminal = lqr.terminalCost(v);
+    }
+    if (cached) {
+        solution.x.resize(n_vars);
+        for (int i = 0; i < n_vars; i++) {
+            solution.x[i] = cached[i];
+        }
+        solution.obj_value = cached_objective;
+        stats.status = SOLVE_SUCCESS;
+    } else if (cancel && cancel->cancelled()) {
+        stats.status = SOLVE_CANCELLED;
+    } else if (condensed) {
+        solveCondensed(state, coeffs, deadline, stats);
+    } else if (backend == TAPED_IPOPT) {
+        taped->setFormulation(MULTIPLE_SHOOTING);
+        taped->setTerminalCost(terminal);
+        taped->setCancel(cancel);
+        taped->setIterationTrace(iteration_trace);
+        taped->solve(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                     constraints_upperbound, model != CARTESIAN_MODEL ? kappa : coeffs, solution,
+                     deadline, stats);
+        if (model == REDUCED_FRENET_MODEL && solution.x.size() == n_vars) {
+            rollOutPose<Config>(solution.x);
+        }
+    } else if (backend == KINEMATIC_IPOPT && !multi_starts.empty()) {
+        kinematic->setIterationTrace(iteration_trace);
+        solveMultiStart(state, coeffs, warm, seed, deadline, stats);
+    } else if (backend == KINEMATIC_IPOPT) {
+        kinematic->setCancel(cancel);
+        kinematic->setIterationTrace(iteration_trace);
+        kinematic->solve(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                         constraints_upperbound, coeffs, solution, warm, deadline, stats);
+    } else if (backend == SQP_RTI && options.single_precision) {
+        rti_single->setCancel(cancel);
+        rti_single->solve(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                          constraints_upperbound, coeffs, solution, stats);
+    } else if (backend == SQP_RTI) {
+        rti->setCancel(cancel);
+        rti->solve(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                   constraints_upperbound, coeffs, solution, stats);
+    } else if (backend == MPPI && options.single_precision) {
+        mppi_single->solve(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                           constraints_upperbound, coeffs, solution, stats);
+    } else if (backend == MPPI) {
+        mppi->solve(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                    constraints_upperbound, coeffs, solution, stats);
+    } else if (backend == CGMRES) {
+        cgmres->solve(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                      constraints_upperbound, coeffs, solution, stats);
+    } else if (backend == GEOMETRIC) {
+        geometric->setTerminalCost(terminal);
+        geometric->setObstacles(obstacles && !obstacles->points.empty() ? obstacles : nullptr);
+        geometric->solve(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                         constraints_upperbound, coeffs, solution, stats);
+    } else if (model != CARTESIAN_MODEL) {
+        FrenetFG_eval<Config, Eigen::VectorXd> fg_eval(kappa, weights);
+        fg_eval.speeds = speeds;
+        fg_eval.terminal = terminal;
+        solveCppAD(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                   constraints_upperbound, fg_eval, deadline, solution, stats);
+    } else {
+        // object that computes objective and constraints
+        FG_eval<Config, Eigen::VectorXd> fg_eval(coeffs, weights);
+        fg_eval.speeds = speeds;
+        fg_eval.terminal = terminal;
+        fg_eval.obstacles = obstacles && !obstacles->points.empty() ? obstacles : nullptr;
+        solveCppAD(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                   constraints_upperbound, fg_eval, deadline, solution, stats);
     }
+    MPC_TRACE_LAP(phases, "optimize");
     
-    constraints_lowerbound[x_start] = x;
-    constraints_lowerbound[y_start] = y;
-    constraints_lowerbound[psi_start] = psi;
-    constraints_lowerbound[v_start] = v;
-    constraints_lowerbound[cte_start] = cte;
-    constraints_lowerbound[epsi_start] = epsi;
+    // Cost
+    auto cost = solution.obj_value;
+    stats.objective = cost;
+    MPC_LOG(LOG_DEBUG, "Cost %g", cost);
     
-    constraints_upperbound[x_start] = x;
-    constraints_upperbound[y_start] = y;
-    constraints_upperbound[psi_start] = psi;
-    constraints_upperbound[v_start] = v;
-    constraints_upperbound[cte_start] = cte;
-    constraints_upperbound[epsi_start] = epsi;
+    for (int i = 0; i < n_constraints && i < solution.g.size(); i++) {
+        double violation = max(constraints_lowerbound[i] - solution.g[i],
+                               solution.g[i] - constraints_upperbound[i]);
+        stats.constraint_violation = max(stats.constraint_violation, violation);
+    }
     
-    // object that computes objective and constraints
-    FG_eval fg_eval(coeffs);
+    // An iterate cut short by the deadline is still usable if it satisfies
+    // the dynamics, within IPOPT's default constr_viol_tol.
+    if (stats.status == SOLVE_DEADLINE_EXCEEDED && solution.x.size() == n_vars &&
+        stats.constraint_violation <= 1e-4) {
+        stats.status = SOLVE_DEADLINE_FEASIBLE;
+    }
     
-    //
-    // NOTE: You don't have to worry about these options
-    //
-    // options for IPOPT solver
-    std::string options;
-    // Uncomment this if you'd like more print information
-    options += "Integer print_level  0\n";
-    // NOTE: Setting sparse to true allows the solver to take advantage
-    // of sparse routines, this makes the computation MUCH FASTER. If you
-    // can uncomment 1 of these and see if it makes a difference or not but
-    // if you uncomment both the computation time should go up in orders of
-    // magnitude.
-    options += "Sparse  true        forward\n";
-    options += "Sparse  true        reverse\n";
-    // NOTE: Currently the solver has a maximum time limit of 0.5 seconds.
-    // Change this as you see fit.
-    options += "Numeric max_cpu_time          0.5\n";
+    // Check some of the solution values
+    ok &= stats.ok() && solution.x.size() == n_vars;
     
-    // place to return solution
-    CppAD::ipopt::solve_result<Dvector> solution;
+    // A solve cancelled for a fresher frame, see Controller::preempt,
+    // leaves its last iterate to warm start the solve of that frame from,
+    // whatever answers this one.
+    bool preempted = warm_start && stats.status == SOLVE_CANCELLED && solution.x.size() == n_vars;
+    if (preempted) {
+        for (int i = 0; i < n_vars; i++) {
+            prev_vars[i] = solution.x[i];
+        }
+    }
     
-    // solve the problem
-    CppAD::ipopt::solve<Dvector, FG_eval>(
-                                          options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
-                                          constraints_upperbound, fg_eval, solution);
+    // A failed solve is not trusted: while the previous plan lasts, follow
+    // it (already shifted into `vars`) instead of applying its first control.
+    if (!ok && warm && fallbacks + 1 < n_controls) {
+        stats.fallback = true;
+        fallbacks++;
+        solution.x.resize(n_vars);
+        for (int i = 0; i < n_vars; i++) {
+            solution.x[i] = vars[i];
+        }
+    } else {
+        fallbacks = 0;
+        if (solution.x.size() != n_vars) {
+            // IPOPT gave up before producing a point, return the guess.
+            solution.x.resize(n_vars);
+            for (int i = 0; i < n_vars; i++) {
+                solution.x[i] = vars[i];
+            }
+        }
+    }
     
-    // Check some of the solution values
-    ok &= solution.status == CppAD::ipopt::solve_result<Dvector>::success;
+    if (ok && library.enabled()) {
+        library.add(state, coeffs, &solution.x[delta_start]);
+    }
+    if (ok && !cached && cache.enabled()) {
+        cache.add(state, coeffs, &solution.x[0], cost);
+    }
     
-    // Cost
-    auto cost = solution.obj_value;
-    std::cout << "Cost " << cost << std::endl;
+    // The predictor only ever extrapolates from a converged solve.
+    has_gain = ok && predictor && options.predictor && coeffs.size() == 4 &&
+               predictor->sensitivity(solution.x, vars_lowerbound, vars_upperbound, coeffs, gain);
+    if (has_gain) {
+        gain_params << state, coeffs;
+        gain_u << solution.x[delta_start], solution.x[a_start];
+    }
+    MPC_TRACE_LAP(phases, "sensitivity");
+    
+    // Only a converged solution (or the plan it continues) is worth seeding
+    // the next cycle with.
+    has_prev = warm_start && (ok || stats.fallback || preempted);
+    if (has_prev && !preempted) {
+        for (int i = 0; i < n_vars; i++) {
+            prev_vars[i] = solution.x[i];
+        }
+    }
     
     // Return the first actuator values. The variables can be accessed with
     // `solution.x[i]`.
@@ -266,20 +1033,620 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
     // {...} is shorthand for creating a vector, so auto x1 = {1.0,2.0}
     // creates a 2 element double vector.
     
-    this->mpc_x = {};
-    this->mpc_y = {};
+    result.n_stages = N;
+    for (int i=0; i<N; i++) {
+        PredictedStage &stage = result.stages[i];
+        stage.x = solution.x[x_start + i];
+        stage.y = solution.x[y_start + i];
+        stage.psi = solution.x[psi_start + i];
+        stage.v = solution.x[v_start + i];
+        stage.cte = solution.x[cte_start + i];
+        stage.epsi = solution.x[epsi_start + i];
+        size_t move = min((size_t) i, n_controls - 1);
+        stage.delta = i + 1 < N ? solution.x[delta_start + move] : 0.0;
+        stage.a = i + 1 < N ? solution.x[a_start + move] : 0.0;
+    }
+    
+    stats.wall_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (options.cost_breakdown) {
+        costTerms<Config>(&solution.x[0], weights, speeds, stats.cost_terms, terminal);
+    }
+    
+    result.x = solution.x[x_start + 1];
+    result.y = solution.x[y_start + 1];
+    result.psi = solution.x[psi_start + 1];
+    result.v = solution.x[v_start + 1];
+    result.cte = solution.x[cte_start + 1];
+    result.epsi = solution.x[epsi_start + 1];
+    result.delta = solution.x[delta_start];
+    result.a = solution.x[a_start];
+    MPC_TRACE_LAP(phases, "extract");
+}
+
+template <typename Config>
+bool FixedHorizon<Config>::seedGuess(SolveSeed seed, const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                                     Dvector &x) {
+    x.resize(n_vars);
+    if (seed == SEED_SHIFTED) {
+        if (!warm_start || !has_prev) {
+            return false;
+        }
+        shiftSolution<Config>(prev_vars, state, x);
+    } else if (seed == SEED_LQR) {
+        lqrGuess<Config>(lqr, state, coeffs, x);
+    } else if (seed == SEED_LIBRARY) {
+        const double *u = library.enabled() ? library.nearest(state, coeffs) : nullptr;
+        if (u == nullptr) {
+            return false;
+        }
+        rollOutGuess<Config>(u, state, coeffs, x);
+    } else {
+        for (int i = 0; i < n_vars; i++) {
+            x[i] = 0;
+        }
+    }
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    for (int k = 0; k < 6; k++) {
+        x[starts[k]] = state[k];
+    }
+    return true;
+}
+
+template <typename Config>
+void FixedHorizon<Config>::solveMultiStart(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                                           bool warm, SolveSeed seed, Deadline deadline, SolveStats &stats) {
+    // The other starts take the seeds the first did not, in this order,
+    // as far as they have a guess.
+    size_t n = 0;
+    for (int s = 0; s < N_SOLVE_SEEDS && n < multi_starts.size(); s++) {
+        Start &start = *multi_starts[n];
+        if (s != seed && seedGuess((SolveSeed) s, state, coeffs, start.vars)) {
+            start.seed = (SolveSeed) s;
+            start.stats = SolveStats();
+            start.stats.seed = start.seed;
+            n++;
+        }
+    }
+    
+    // 0 is the first start, i > 0 multi_starts[i - 1]. Whichever converges
+    // first raises `stop`, which the others see at their next iteration,
+    // and those not started yet are skipped; as they do once the solve is
+    // cancelled.
+    CancelToken stop(cancel);
+    atomic<int> winner(-1);
+    auto run = [&](size_t i) {
+        KinematicSolver<Config> &solver = i == 0 ? *kinematic : *multi_starts[i - 1]->solver;
+        SolveStats &result = i == 0 ? stats : multi_starts[i - 1]->stats;
+        solver.setCancel(&stop);
+        if (i == 0) {
+            solver.solve(vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                         constraints_upperbound, coeffs, solution, warm, deadline, result);
+        } else {
+            Start &start = *multi_starts[i - 1];
+            solver.solve(start.vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                         constraints_upperbound, coeffs, start.solution, false, deadline, result);
+        }
+        solver.setCancel(nullptr);
+        int none = -1;
+        if (result.ok() && winner.compare_exchange_strong(none, (int) i)) {
+            stop.cancel();
+        }
+    };
+    TaskGroup starts(TASK_HIGH, &stop);
+    starts.run(1, n + 1, run);
+    run(0);
+    starts.wait();
+    
+    // Without a winner the first start's answer stands, as without
+    // multi_start.
+    int i = winner.load();
+    if (i > 0) {
+        Start &start = *multi_starts[i - 1];
+        solution = start.solution;
+        stats = start.stats;
+    }
+}
+
+template <typename Config>
+void FixedHorizon<Config>::solveCondensed(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                                          Deadline deadline, SolveStats &stats) {
+    // The actuations are the tail of the multiple-shooting variables, in
+    // the same order.
+    // Their bounds were set by the constructor.
+    const size_t n = CondensedFG_eval<Config, Eigen::VectorXd>::n_vars;
+    controls.resize(n);
+    for (int i = 0; i < n; i++) {
+        controls[i] = vars[delta_start + i];
+    }
+    condensed_params.resize(6 + coeffs.size());
+    condensed_params << state, coeffs;
+    
+    condensed_solution.x.resize(0);
+    condensed_solution.status = SolveResult::unknown;
+    condensed_solution.obj_value = 0;
+    if (backend == TAPED_IPOPT) {
+        taped->setFormulation(SINGLE_SHOOTING);
+        taped->setCancel(cancel);
+        taped->setIterationTrace(iteration_trace);
+        taped->solve(controls, controls_lowerbound, controls_upperbound, no_constraints, no_constraints,
+                     condensed_params, condensed_solution, deadline, stats);
+    } else {
+        CondensedFG_eval<Config, Eigen::VectorXd> fg_eval(condensed_params, weights);
+        fg_eval.speeds = speeds;
+        solveCppAD(controls, controls_lowerbound, controls_upperbound, no_constraints, no_constraints,
+                   fg_eval, deadline, condensed_solution, stats);
+    }
+    
+    // The rolled out trajectory satisfies the dynamics exactly, so g sits
+    // on its bounds.
+    solution.status = condensed_solution.status;
+    solution.obj_value = condensed_solution.obj_value;
+    if (condensed_solution.x.size() == n) {
+        solution.x.resize(n_vars);
+        rollout<Config, double>(state, coeffs, condensed_solution.x, solution.x);
+        solution.g.resize(n_constraints);
+        for (int i = 0; i < n_constraints; i++) {
+            solution.g[i] = constraints_lowerbound[i];
+        }
+    }
+}
+
+template <typename Config>
+template <typename Load, typename Answer>
+void FixedHorizon<Config>::solvePackets(size_t n, Load load, Answer answer, SolveStats *stats) {
+    if (!batch) {
+        batch.reset(new RtiBatch<Config>());
+        batch->setCostWeights(weights);
+        batch->setReferenceSpeeds(speeds);
+    }
     
-    for (int i=0; i<N-1; i++) {
-        this->mpc_x.push_back(solution.x[x_start + i + 1]);
-        this->mpc_y.push_back(solution.x[y_start + i + 1]);
+    vector<Dvector> vars(batch_lanes, Dvector(n_vars));
+    vector<Dvector> vars_lowerbound(batch_lanes, Dvector(n_vars));
+    vector<Dvector> vars_upperbound(batch_lanes, Dvector(n_vars));
+    vector<Dvector> constraints_lowerbound(batch_lanes, Dvector(n_constraints));
+    vector<Dvector> constraints_upperbound(batch_lanes, Dvector(n_constraints));
+    for (size_t i = 0; i < batch_lanes; i++) {
+        setFixedBounds<Config>(vars_lowerbound[i], vars_upperbound[i], constraints_lowerbound[i],
+                               constraints_upperbound[i]);
+    }
+    Eigen::VectorXd states[batch_lanes];
+    Eigen::VectorXd coeffs[batch_lanes];
+    SolveResult solutions[batch_lanes];
+    
+    for (size_t first = 0; first < n; first += batch_lanes) {
+        auto start = chrono::steady_clock::now();
+        size_t m = min(n - first, (size_t) batch_lanes);
+        for (size_t i = 0; i < m; i++) {
+            Eigen::VectorXd &state = states[i];
+            if (!load(first + i, state, coeffs[i], vars[i])) {
+                for (int k = 0; k < n_vars; k++) {
+                    vars[i][k] = 0;
+                }
+                const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+                for (int k = 0; k < 6; k++) {
+                    vars[i][starts[k]] = state[k];
+                }
+            }
+            setInitialState<Config>(state, constraints_lowerbound[i], constraints_upperbound[i]);
+        }
+        batch->solve(m, vars.data(), vars_lowerbound.data(), vars_upperbound.data(),
+                     constraints_lowerbound.data(), coeffs, solutions, &stats[first]);
+        
+        // The batch shares its time among its problems.
+        double wall_time = chrono::duration<double>(chrono::steady_clock::now() - start).count() / m;
+        for (size_t i = 0; i < m; i++) {
+            stats[first + i].objective = solutions[i].obj_value;
+            stats[first + i].wall_time = wall_time;
+            answer(first + i, solutions[i]);
+        }
+    }
+}
+
+template <typename Config>
+void FixedHorizon<Config>::SolveBatch(const vector<Eigen::VectorXd> &states, const vector<Eigen::VectorXd> &coeffs,
+                                      vector<vector<double> > &actuations, vector<SolveStats> &stats) {
+    size_t n = states.size();
+    actuations.resize(n);
+    stats.resize(n);
+    auto load = [&](size_t i, Eigen::VectorXd &state, Eigen::VectorXd &c, Dvector &) {
+        state = states[i];
+        c = coeffs[i];
+        return false;
+    };
+    auto answer = [&](size_t i, const SolveResult &solution) {
+        const Dvector &x = solution.x;
+        actuations[i] = {x[x_start + 1], x[y_start + 1], x[psi_start + 1], x[v_start + 1],
+                         x[cte_start + 1], x[epsi_start + 1], x[delta_start], x[a_start]};
+    };
+    solvePackets(n, load, answer, stats.data());
+}
+
+template <typename Config>
+void FixedHorizon<Config>::SolveBatch(FleetStore &fleet, const vector<size_t> &slots, vector<SolveStats> &stats) {
+    size_t n = slots.size();
+    stats.resize(n);
+    auto load = [&](size_t i, Eigen::VectorXd &state, Eigen::VectorXd &coeffs, Dvector &vars) {
+        size_t slot = slots[i];
+        state.resize(6);
+        for (int k = 0; k < 6; k++) {
+            state[k] = fleet.state(k)[slot];
+        }
+        coeffs.resize(4);
+        for (int k = 0; k < 4; k++) {
+            coeffs[k] = fleet.coeff(k)[slot];
+        }
+        if (!fleet.warm(slot)) {
+            return false;
+        }
+        shiftSolution<Config>(fleet.trajectoryOf(slot), state, vars);
+        return true;
+    };
+    auto answer = [&](size_t i, const SolveResult &solution) {
+        size_t slot = slots[i];
+        const Dvector &x = solution.x;
+        fleet.delta()[slot] = x[delta_start];
+        fleet.a()[slot] = x[a_start];
+        bool ok = stats[i].status == SOLVE_SUCCESS || stats[i].status == SOLVE_ACCEPTABLE;
+        if (ok) {
+            copy(&x[0], &x[0] + n_vars, fleet.trajectoryOf(slot));
+        }
+        fleet.setWarm(slot, ok);
+    };
+    solvePackets(n, load, answer, stats.data());
+}
+
+template <typename Config>
+template <typename FG>
+void FixedHorizon<Config>::solveCppAD(const Dvector &vars, const Dvector &vars_lowerbound,
+                                      const Dvector &vars_upperbound, const Dvector &constraints_lowerbound,
+                                      const Dvector &constraints_upperbound, FG &fg_eval,
+                                      Deadline deadline, SolveResult &solution, SolveStats &stats) {
+    // The fixed options are built once by setOptions, see cppadOptions.
+    std::string options = cppad_options;
+    // NOTE: Currently the solver has a maximum time limit of 0.5 seconds.
+    // Change this as you see fit.
+    //
+    // CppAD::ipopt::solve offers no intermediate callback, so a deadline
+    // can only shorten that limit, counted from when the linear solver is
+    // free.
+    LinearSolverGuard guard(linear_solver_lock, stats);
+    auto start = chrono::steady_clock::now();
+    double limit = max_solve_time;
+    if (deadline != Deadline::max()) {
+        limit = min(limit, max(1e-3, chrono::duration<double>(deadline - start).count()));
     }
+    options += "Numeric max_cpu_time          " + to_string(limit) + "\n";
     
-    return {solution.x[x_start + 1],   solution.x[y_start + 1],
-        solution.x[psi_start + 1], solution.x[v_start + 1],
-        solution.x[cte_start + 1], solution.x[epsi_start + 1],
-        solution.x[delta_start],   solution.x[a_start]};
+    // solve the problem
+    CppAD::ipopt::solve<Dvector, FG>(
+                                          options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+                                          constraints_upperbound, fg_eval, solution);
+    
+    // CppAD neither reports iterations nor has a status for the CPU time
+    // limit, it maps that one to unknown.
+    switch (solution.status) {
+        case SolveResult::success:
+            stats.status = SOLVE_SUCCESS;
+            break;
+        case SolveResult::stop_at_acceptable_point:
+            stats.status = SOLVE_ACCEPTABLE;
+            break;
+        case SolveResult::maxiter_exceeded:
+            stats.status = SOLVE_MAX_ITERATIONS;
+            break;
+        case SolveResult::local_infeasibility:
+            stats.status = SOLVE_INFEASIBLE;
+            break;
+        default:
+            stats.status = SOLVE_FAILED;
+            break;
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (solution.status == SolveResult::unknown && elapsed >= limit) {
+        stats.status = SOLVE_CPU_TIME_EXCEEDED;
+        stats.cpu_time_exceeded = true;
+    }
+}
+
+//
+// MPC class definition implementation.
+//
+MPC::MPC()
+    : horizon(nullptr), warm_start(false), backend(CPPAD_IPOPT), model(CARTESIAN_MODEL),
+      formulation(MULTIPLE_SHOOTING), cancel(nullptr), iteration_trace(nullptr), obstacles(nullptr),
+      state_buffer(6),
+      coeffs_buffer(4) {
+    // Solves of different MPCs may run on different threads, see
+    // CppadThreads.h.
+    setupCppadThreads();
+    setHorizon(DefaultConfig::N);
+    if (SlowSolveLog::enabled()) {
+        slow_solves.reset(new SlowSolveRing);
+        setIterationTrace(nullptr);
+    }
+}
+MPC::~MPC() {}
+
+void MPC::setWarmStart(bool enabled) {
+    warm_start = enabled;
+    for (auto &h : horizons) {
+        if (h) {
+            h->setWarmStart(enabled);
+        }
+    }
+}
+
+void MPC::resetWarmStart() {
+    for (auto &h : horizons) {
+        if (h) {
+            h->resetWarmStart();
+        }
+    }
+}
+
+void MPC::setBackend(SolverBackend backend) {
+    this->backend = backend;
+    for (auto &h : horizons) {
+        if (h) {
+            h->setBackend(backend);
+        }
+    }
+}
+
+void MPC::setModel(ModelVariant model) {
+    this->model = model;
+    for (auto &h : horizons) {
+        if (h) {
+            h->setModel(model);
+        }
+    }
+}
+
+void MPC::setFormulation(Formulation formulation) {
+    this->formulation = formulation;
+    for (auto &h : horizons) {
+        if (h) {
+            h->setFormulation(formulation);
+        }
+    }
+}
+
+void MPC::setCostWeights(const CostWeights &weights) {
+    this->weights = weights;
+    for (auto &h : horizons) {
+        if (h) {
+            h->setCostWeights(weights);
+        }
+    }
+}
+
+void MPC::setSpeedProfile(const SpeedProfile &profile) {
+    this->profile = profile;
+    horizon->setSpeedProfile(profile);
+}
+
+void MPC::setOptions(const MpcOptions &options) {
+    this->options = options;
+    for (auto &h : horizons) {
+        if (h) {
+            h->setOptions(options);
+        }
+    }
+}
+
+void MPC::setCancel(const CancelToken *token) {
+    cancel = token;
+    for (auto &h : horizons) {
+        if (h) {
+            h->setCancel(token);
+        }
+    }
+}
+
+void MPC::setObstacles(const FleetObstacles *obstacles) {
+    this->obstacles = obstacles;
+    for (auto &h : horizons) {
+        if (h) {
+            h->setObstacles(obstacles);
+        }
+    }
+}
+
+void MPC::setIterationTrace(IterationTrace *trace) {
+    iteration_trace = !trace && slow_solves ? &slow_solves->trace : trace;
+    for (auto &h : horizons) {
+        if (h) {
+            h->setIterationTrace(iteration_trace);
+        }
+    }
+}
+
+bool MPC::setHorizon(size_t N) {
+    size_t i = 0;
+    while (i < n_compiled_horizons && compiled_horizons[i] != N) {
+        i++;
+    }
+    if (i == n_compiled_horizons && N != BlockedConfig::N) {
+        return false;
+    }
+    if (horizons[i]) {
+        horizons[i]->resetWarmStart();
+        horizon = horizons[i].get();
+        horizon->setSpeedProfile(profile);
+        return true;
+    }
+    
+    if (N == DefaultConfig::N) {
+        horizons[i].reset(new FixedHorizon<DefaultConfig>());
+    } else if (N == MediumConfig::N) {
+        horizons[i].reset(new FixedHorizon<MediumConfig>());
+    } else if (N == BlockedConfig::N) {
+        horizons[i].reset(new FixedHorizon<BlockedConfig>());
+    } else {
+        horizons[i].reset(new FixedHorizon<LongConfig>());
+    }
+    horizon = horizons[i].get();
+    horizon->setWarmStart(warm_start);
+    horizon->setBackend(backend);
+    horizon->setModel(model);
+    horizon->setFormulation(formulation);
+    horizon->setCostWeights(weights);
+    horizon->setSpeedProfile(profile);
+    horizon->setOptions(options);
+    horizon->setCancel(cancel);
+    horizon->setIterationTrace(iteration_trace);
+    horizon->setObstacles(obstacles);
+    return true;
+}
+
+void MPC::seedWarmStart(const Solution &plan) {
+    horizon->seedWarmStart(plan);
+}
+
+bool MPC::getWarmStart(vector<double> &vars, size_t &fallbacks) const {
+    return horizon->getWarmStart(vars, fallbacks);
+}
+
+bool MPC::restoreWarmStart(const vector<double> &vars, size_t fallbacks) {
+    return horizon->restoreWarmStart(vars, fallbacks);
+}
+
+bool MPC::getDuals(vector<double> &duals) const {
+    return horizon->getDuals(duals);
+}
+
+bool MPC::restoreDuals(const vector<double> &duals) {
+    return horizon->restoreDuals(duals);
+}
+
+bool MPC::Predict(const StateVector &state, const CubicCoeffs &coeffs, double &delta, double &a) const {
+    return horizon->Predict(state, coeffs, delta, a);
+}
+
+size_t MPC::getHorizon() const {
+    return horizon->getHorizon();
+}
+
+SparsityStats MPC::getSparsityStats() {
+    return horizon->getSparsityStats();
+}
+
+TapeStats MPC::getTapeStats() {
+    return horizon->getTapeStats();
+}
+
+vector<double> MPC::Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs) {
+    SolveStats stats;
+    return Solve(state, coeffs, stats);
+}
+
+vector<double> MPC::Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, SolveStats &stats) {
+    return Solve(state, coeffs, stats, Deadline::max());
+}
+
+vector<double> MPC::Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, SolveStats &stats,
+                          Deadline deadline) {
+    vector<double> actuations;
+    Solve(state, coeffs, stats, deadline, actuations);
+    return actuations;
+}
+
+void MPC::Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, SolveStats &stats,
+                Deadline deadline, vector<double> &actuations) {
+    Solution solution;
+    solveHorizon(state, coeffs, stats, deadline, solution);
+    
+    size_t n_predicted = solution.n_stages > 0 ? solution.n_stages - 1 : 0;
+    const size_t stride = sizeof(PredictedStage) / sizeof(double);
+    mpc_x.assign(&solution.stages[1].x, n_predicted, stride);
+    mpc_y.assign(&solution.stages[1].y, n_predicted, stride);
+    
+    actuations.resize(8);
+    actuations[0] = solution.x;
+    actuations[1] = solution.y;
+    actuations[2] = solution.psi;
+    actuations[3] = solution.v;
+    actuations[4] = solution.cte;
+    actuations[5] = solution.epsi;
+    actuations[6] = solution.delta;
+    actuations[7] = solution.a;
+}
+
+void MPC::Solve(const StateVector &state, const CubicCoeffs &coeffs, SolveStats &stats,
+                Deadline deadline, Solution &solution) {
+    state_buffer = state;
+    coeffs_buffer = coeffs;
+    solveHorizon(state_buffer, coeffs_buffer, stats, deadline, solution);
+}
+
+void MPC::SolveAsync(const StateVector &state, const CubicCoeffs &coeffs, Deadline deadline, SolveHandle &handle,
+                     function<void(SolveHandle &)> done) {
+    handle.wait();
+    handle.token.reset();
+    handle.state = state;
+    handle.coeffs = coeffs;
+    handle.deadline = deadline;
+    handle.callback = std::move(done);
+    handle.done.store(false, memory_order_relaxed);
+    handle.job = [this, &handle](size_t) {
+        const CancelToken *token = cancel;
+        setCancel(&handle.token);
+        Solve(handle.state, handle.coeffs, handle.result_stats, handle.deadline, handle.result);
+        setCancel(token);
+        handle.done.store(true, memory_order_release);
+        if (handle.callback) {
+            handle.callback(handle);
+        }
+    };
+    handle.group.run(0, 1, handle.job);
+}
+
+void MPC::solveHorizon(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, SolveStats &stats,
+                       Deadline deadline, Solution &solution) {
+    if (iteration_trace) {
+        iteration_trace->clear();
+    }
+    if (!slow_solves) {
+        horizon->Solve(state, coeffs, stats, deadline, solution);
+        return;
+    }
+    ProblemInstance &problem = slow_solves->next();
+    problem.backend = backend;
+    problem.model = model;
+    problem.formulation = formulation;
+    problem.horizon = getHorizon();
+    problem.warm_starting = warm_start;
+    problem.weights = weights;
+    problem.options = options;
+    problem.state.assign(state.data(), state.data() + state.size());
+    problem.coeffs.assign(coeffs.data(), coeffs.data() + coeffs.size());
+    problem.budget = deadline == Deadline::max()
+                         ? -1
+                         : chrono::duration<double>(deadline - chrono::steady_clock::now()).count();
+    problem.has_warm_start = horizon->getWarmStart(problem.warm_start, problem.fallbacks);
+    horizon->Solve(state, coeffs, stats, deadline, solution);
+    slow_solves->finish(stats, solution, *iteration_trace);
+}
+
+void MPC::SolveBatch(const vector<Eigen::VectorXd> &states, const vector<Eigen::VectorXd> &coeffs,
+                     vector<vector<double> > &actuations, vector<SolveStats> &stats) {
+    if (states.size() != coeffs.size()) {
+        MPC_LOG(LOG_ERROR, "SolveBatch: %zu states for %zu reference polynomials", states.size(), coeffs.size());
+        actuations.clear();
+        stats.clear();
+        return;
+    }
+    horizon->SolveBatch(states, coeffs, actuations, stats);
+}
+
+void MPC::SolveBatch(FleetStore &fleet, const vector<size_t> &slots, vector<SolveStats> &stats) {
+    horizon->SolveBatch(fleet, slots, stats);
+}
+
+size_t MPC::getBatchWarmStartSize() const {
+    return horizon->getBatchWarmStartSize();
 }
 
 double MPC::getTimeInterval() {
-    return dt;
+    return horizon->getTimeInterval();
 }
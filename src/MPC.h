@@ -1,26 +1,536 @@
 #ifndef MPC_H
 #define MPC_H
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <vector>
+#include "CostWeights.h"
 #include "Eigen-3.3/Eigen/Core"
+#include "MpcConfig.h"
+#include "MpcOptions.h"
+#include "SmallVector.h"
+#include "SpeedProfile.h"
+#include "TaskScheduler.h"
 
 using namespace std;
 
+struct FleetObstacles;
+class FleetStore;
+class MpcHorizon;
+class SlowSolveRing;
+class SolveHandle;
+
+// Wall-clock time by which a solve has to return, Deadline::max() for none.
+typedef chrono::steady_clock::time_point Deadline;
+
+// How the NLP is handed to IPOPT.
+enum SolverBackend {
+    // CppAD::ipopt::solve, re-recording FG_eval on every call.
+    CPPAD_IPOPT,
+    // FG_eval recorded once with the coefficients as dynamic parameters and
+    // a persistent IpoptApplication.
+    TAPED_IPOPT,
+    // Hand-derived derivatives of the kinematic model, no AD at all, with a
+    // persistent IpoptApplication and warm-started multipliers.
+    KINEMATIC_IPOPT,
+    // One Gauss-Newton SQP iteration per call, see RtiSolver.h. Does not
+    // use IPOPT.
+    SQP_RTI,
+    // Model Predictive Path Integral control over sampled rollouts, see
+    // MppiSolver.h. Does not use IPOPT either.
+    MPPI,
+    // One continuation/GMRES Newton step on the optimality condition per
+    // call, see CgmresSolver.h. Does not use IPOPT.
+    CGMRES,
+    // Pure pursuit or Stanley on the reference, rolled out in closed loop
+    // over the horizon, see GeometricSolver.h. Optimizes nothing; the
+    // baseline the others are measured against.
+    GEOMETRIC
+};
+
+// How the reference path enters the model of the CppAD backends,
+// CPPAD_IPOPT and TAPED_IPOPT. The others always use FG_eval's.
+enum ModelVariant {
+    // FG_eval: cte and epsi from the polynomial and the atan of its slope
+    // at every stage.
+    CARTESIAN_MODEL,
+    // FrenetFG_eval: path-relative dynamics over the curvature of the
+    // polynomial along the initial guess, see FrenetFG_eval.h.
+    FRENET_MODEL,
+    // FRENET_MODEL without x, y and psi, which neither its cost nor its
+    // other dynamics depend on: the tape pins them, see
+    // FrenetFG_eval::reduced, and they are rolled out of the solution.
+    // TAPED_IPOPT only, CPPAD_IPOPT solves FRENET_MODEL.
+    REDUCED_FRENET_MODEL
+};
+
+// Which variables the CppAD backends optimize over. KINEMATIC_IPOPT is
+// always in multiple shooting, SQP_RTI condenses its QP by itself and MPPI
+// only samples the actuations.
+enum Formulation {
+    // All states and actuations, the dynamics as equality constraints.
+    MULTIPLE_SHOOTING,
+    // The actuations only, the states rolled out inside the objective, see
+    // CondensedFG_eval.h. FRENET_MODEL stays in multiple shooting.
+    SINGLE_SHOOTING
+};
+
+// How often a solve reused the cached Jacobian/Hessian sparsity and
+// coloring instead of computing them.
+struct SparsityStats {
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+// Size of the last tape the TAPED_IPOPT backend recorded for a horizon,
+// after optimization, and of the derivatives handed to IPOPT. All zero
+// before the first recording or with another backend.
+struct TapeStats {
+    size_t horizon = 0;
+    size_t operations = 0;
+    // Variables of the forward sweep, i.e. the values stored per order.
+    size_t variables = 0;
+    size_t parameters = 0;
+    // Memory of the operation sequence in bytes.
+    size_t bytes = 0;
+    // Nonzeros of the constraint Jacobian and of the lower triangle of the
+    // Lagrangian Hessian.
+    size_t jacobian_nnz = 0;
+    size_t hessian_nnz = 0;
+    // Colors of the Jacobian, i.e. the directions of its one forward
+    // sweep, and of the Hessian, one sweep each, as of the last
+    // evaluation; 0 before the first.
+    size_t jacobian_colors = 0;
+    size_t hessian_colors = 0;
+    // Constraints that are linear in the variables, whose Jacobian entries
+    // are evaluated once per solve.
+    size_t linear_constraints = 0;
+};
+
+// Outcome of one solve, as reported by IPOPT.
+enum SolveStatus {
+    SOLVE_SUCCESS,
+    // Stopped at a point satisfying the acceptable tolerances.
+    SOLVE_ACCEPTABLE,
+    SOLVE_MAX_ITERATIONS,
+    SOLVE_CPU_TIME_EXCEEDED,
+    SOLVE_INFEASIBLE,
+    // Stopped at the deadline, the iterate satisfies the constraints.
+    SOLVE_DEADLINE_FEASIBLE,
+    // Stopped at the deadline at an infeasible iterate.
+    SOLVE_DEADLINE_EXCEEDED,
+    // Any other failure.
+    SOLVE_FAILED,
+    // Stopped by its cancel token, see MPC::setCancel.
+    SOLVE_CANCELLED,
+    // Stopped early once the first actuations settled, see
+    // MpcOptions::control_tol. Last, as the slow-solve log and the column
+    // trace keep the numbers.
+    SOLVE_CONTROL_CONVERGED,
+    N_SOLVE_STATUS
+};
+
+// Initial guess a solve started from: the previous plan shifted by a step,
+// the LQR rolled out from the state, the nearest entry of the warm-start
+// library, or zeros.
+enum SolveSeed {
+    SEED_SHIFTED,
+    SEED_LQR,
+    SEED_LIBRARY,
+    SEED_ZERO,
+    N_SOLVE_SEEDS
+};
+
+struct SolveStats {
+    SolveStatus status = SOLVE_FAILED;
+    // Guess of the returned solve; with MpcOptions::multi_start, that of
+    // the start that won.
+    SolveSeed seed = SEED_ZERO;
+    // IPOPT iterations, -1 if the backend does not report them.
+    int iterations = -1;
+    // Of those, the ones in IPOPT's restoration phase.
+    int restoration_iterations = 0;
+    // Largest slack of the soft constraints, see
+    // MpcOptions::soft_penalty.
+    double max_slack = 0;
+    // Wall time of the whole solve in seconds.
+    double wall_time = 0;
+    // Of that, the time spent waiting for another solve's linear solver,
+    // see LinearSolverLock.h.
+    double linear_solver_wait = 0;
+    // Of that, with the taped and kinematic backends, the time in the
+    // evaluations of the model and its derivatives, and in the
+    // factorizations and backsolves of IPOPT's linear solver. The rest is
+    // the overhead of IPOPT and of its wrappers, see Metrics::recordSolve.
+    double eval_time = 0;
+    double linear_solver_time = 0;
+    double objective = 0;
+    // The cost of the returned trajectory by term, with
+    // MpcOptions::cost_breakdown, zeros otherwise. They add up to
+    // `objective` for the backends that minimize addCost.
+    double cost_terms[N_COST_TERMS] = {};
+    // Largest violation of the constraint bounds at the returned point.
+    double constraint_violation = 0;
+    bool cpu_time_exceeded = false;
+    // The actuations come from the previous plan because this solve failed.
+    bool fallback = false;
+    // The solve recorded a new tape, see MPC::getTapeStats.
+    bool recorded = false;
+    // The actuations were looked up in the table, see Controller::setTable,
+    // and nothing was solved.
+    bool table = false;
+    // The answer was solved ahead for a predicted frame close enough to
+    // this one, see Controller::speculate.
+    bool speculative = false;
+    // The answer came from the LQR or pure pursuit of a degraded
+    // controller, see Controller::setDegradation, and nothing was solved.
+    bool degraded = false;
+    // The solution cache was looked up, see MpcOptions::solution_cache,
+    // and had the problem: its solution was returned, nothing was solved.
+    bool cache_lookup = false;
+    bool cached = false;
+    
+    bool ok() const {
+        return status == SOLVE_SUCCESS || status == SOLVE_ACCEPTABLE || status == SOLVE_DEADLINE_FEASIBLE ||
+               status == SOLVE_CONTROL_CONVERGED;
+    }
+};
+
+// One IPOPT iteration as its intermediate callback sees it.
+struct IterationRecord {
+    int iteration = 0;
+    bool restoration = false;
+    double objective = 0;
+    // Primal and dual infeasibility, the barrier parameter and the step
+    // sizes of the primal and the dual variables.
+    double inf_pr = 0;
+    double inf_du = 0;
+    double mu = 0;
+    double alpha_pr = 0;
+    double alpha_du = 0;
+    // Since the solve started, in s.
+    double elapsed = 0;
+};
+
+// The iterations of the last solve of an IPOPT backend, see
+// MPC::setIterationTrace. The ring is preallocated, so recording allocates
+// nothing; it keeps the last `capacity` iterations of a longer solve.
+struct IterationTrace {
+    static const size_t capacity = 64;
+    array<IterationRecord, capacity> records;
+    // Iterations of the solve, of which the last size() are held.
+    size_t n_iterations = 0;
+    chrono::steady_clock::time_point start;
+
+    void clear() {
+        n_iterations = 0;
+        start = chrono::steady_clock::now();
+    }
+
+    void add(const IterationRecord &record) {
+        records[n_iterations % capacity] = record;
+        n_iterations++;
+    }
+
+    size_t size() const { return n_iterations < capacity ? n_iterations : capacity; }
+
+    // The i-th iteration held, oldest first.
+    const IterationRecord &operator[](size_t i) const {
+        return records[(n_iterations - size() + i) % capacity];
+    }
+};
+
+// Initial state x, y, psi, v, cte, epsi and cubic reference polynomial, as
+// taken by the fixed-size Solve.
+typedef Eigen::Matrix<double, 6, 1> StateVector;
+typedef Eigen::Matrix<double, 4, 1> CubicCoeffs;
+
+// One stage of the predicted trajectory: its state and the actuations
+// decided at it, zero at the last stage. With move blocking, see
+// GridConfig, stage t has the t-th move, the last one held past the end.
+struct PredictedStage {
+    double x;
+    double y;
+    double psi;
+    double v;
+    double cte;
+    double epsi;
+    double delta;
+    double a;
+};
+
+// Answer of a solve, written by MPC::Solve. The predicted trajectory has
+// room for the longest horizon, so filling it never allocates.
+struct Solution {
+    // State after the first transition.
+    double x = 0;
+    double y = 0;
+    double psi = 0;
+    double v = 0;
+    double cte = 0;
+    double epsi = 0;
+    // First actuations.
+    double delta = 0;
+    double a = 0;
+    // The whole plan, stage by stage from the initial state; the first
+    // n_stages entries are set.
+    size_t n_stages = 0;
+    array<PredictedStage, max_horizon> stages;
+};
+
 class MPC {
 public:
     MPC();
     
     virtual ~MPC();
     
-    vector<double> mpc_x;
-    vector<double> mpc_y;
+    // Predicted positions of stages 1 to N - 1 of the last solve through
+    // the vector overloads of Solve.
+    SmallVector<double, max_horizon> mpc_x;
+    SmallVector<double, max_horizon> mpc_y;
+    
+    // Seed each solve with the previous solution shifted one step forward
+    // in time instead of starting IPOPT from zeros.
+    void setWarmStart(bool enabled);
+    
+    // Discard the stored solution, e.g. after a reconnect.
+    void resetWarmStart();
+    
+    void setBackend(SolverBackend backend);
+    
+    SolverBackend getBackend() const { return backend; }
+    
+    void setModel(ModelVariant model);
+    
+    // Formulation of the CppAD backends, MULTIPLE_SHOOTING by default.
+    void setFormulation(Formulation formulation);
+    
+    // Weights of the cost terms, for every backend.
+    void setCostWeights(const CostWeights &weights);
+    
+    const CostWeights &getCostWeights() const { return weights; }
+    
+    // Reference velocity ahead of the car for the next solves, for every
+    // backend: the speed term of the cost of each stage pulls towards that
+    // of the profile where the car would be at that stage at its current
+    // speed, see stageSpeeds. The default profile is ref_v all along. Not
+    // of SINGLE_SHOOTING under TAPED_IPOPT, which has ref_v on its tape.
+    void setSpeedProfile(const SpeedProfile &profile);
+    
+    // IPOPT settings of the IPOPT backends, applied to their persistent
+    // applications. IPOPT's defaults until set.
+    void setOptions(const MpcOptions &options);
+    
+    // Token the next solves poll, null for none: once it is raised, from
+    // any thread, IPOPT stops at its next iteration and SQP_RTI before its
+    // next SQP iteration, the other backends are not started, and the
+    // solve reports SOLVE_CANCELLED, falling back on the previous plan
+    // like any failed one. The iterate it stopped at, if any, warm starts
+    // the next solve instead of that plan. It has to outlive the solves it
+    // is set for.
+    void setCancel(const CancelToken *token);
+    
+    // Trace the iterations of the next solves into `trace`, null to stop.
+    // Each solve clears it first; only TAPED_IPOPT and KINEMATIC_IPOPT
+    // fill it, with MpcOptions::multi_start from the first start. With
+    // MPC_SLOW_SOLVES the MPC traces into a trace of its own while none is
+    // set, which goes into the log with the problem. It has to outlive
+    // the solves it is set for.
+    void setIterationTrace(IterationTrace *trace);
+    
+    // Other vehicles the stages of the next solves keep clear of, in the
+    // vehicle frame of the state solved from, null for none. A penalty in
+    // the cost of CPPAD_IPOPT in multiple shooting with the default model,
+    // see addObstacleCost, and in the objective GEOMETRIC reports; the
+    // other backends have their costs on a tape or in closed form and
+    // leave them out. It has to outlive the solves it is set for.
+    void setObstacles(const FleetObstacles *obstacles);
+    
+    // Switch to a horizon of N steps of 100 ms. Only the horizons listed in
+    // MpcConfig.h are compiled in, false for any other. N = 14 selects the
+    // non-uniform BlockedConfig instead. The warm start is
+    // discarded, but the solvers of every horizon used so far are kept, so
+    // switching back to one does not set it up again.
+    bool setHorizon(size_t N);
+    
+    size_t getHorizon() const;
+    
+    // Warm start the next solve from `plan` instead of the previous
+    // solution, e.g. from the last plan of another horizon after
+    // setHorizon. Does nothing without warm starting.
+    void seedWarmStart(const Solution &plan);
+    
+    // The decision vector the next solve warm starts from, shifted by it,
+    // into `vars`, and the solves in a row that fell back on the previous
+    // plan, see SolveStats::fallback; false, with `vars` empty, if it
+    // starts cold.
+    bool getWarmStart(vector<double> &vars, size_t &fallbacks) const;
+    
+    // Start the next solve from `vars` as returned by getWarmStart, for the
+    // current horizon, or cold if empty. False, changing nothing, for one
+    // of another size or without warm starting.
+    bool restoreWarmStart(const vector<double> &vars, size_t fallbacks);
+    
+    // The multipliers the next solve may warm start from, into `duals`;
+    // false, with it empty, if there are none, which only the
+    // KINEMATIC_IPOPT backend keeps. restoreDuals takes them back for the
+    // same backend and horizon, see KinematicNLP::getDuals.
+    bool getDuals(vector<double> &duals) const;
+    bool restoreDuals(const vector<double> &duals);
+    
+    // Sparsity cache statistics of the TAPED_IPOPT backend.
+    SparsityStats getSparsityStats();
+    
+    // See TapeStats, for the current horizon.
+    TapeStats getTapeStats();
     
     // Solve the model given an initial state and polynomial coefficients.
     // Return the first actuatotions.
-    vector<double> Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs);
+    vector<double> Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs);
+    
+    // Same as above, also reporting how the solve went. If it failed while
+    // warm starting, the actuations and the predicted trajectory are taken
+    // from the previous plan shifted forward instead (see stats.fallback),
+    // for at most N - 2 cycles in a row.
+    vector<double> Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, SolveStats &stats);
+    
+    // Anytime mode: IPOPT is stopped at `deadline` and its iterate is used
+    // if it satisfies the constraints (SOLVE_DEADLINE_FEASIBLE), otherwise
+    // this behaves like any other failed solve.
+    vector<double> Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, SolveStats &stats,
+                         Deadline deadline);
+    
+    // Same as above with the actuations written to `actuations`. Along with
+    // the storage the solver keeps between calls, this allocates nothing
+    // once warmed up with the SQP_RTI backend.
+    void Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, SolveStats &stats,
+               Deadline deadline, vector<double> &actuations);
+    
+    // Same as above for a cubic reference, with the answer written to
+    // `solution`; mpc_x and mpc_y are left alone.
+    void Solve(const StateVector &state, const CubicCoeffs &coeffs, SolveStats &stats,
+               Deadline deadline, Solution &solution);
+    
+    // The fixed-size Solve as a task of the TaskScheduler, `handle` taking
+    // a copy of the problem and the answer, see SolveHandle, with `done`
+    // called on the solving thread once it is there. This MPC is not to
+    // be used until then. The cancel token of the solve is that of the
+    // handle instead of any set by setCancel.
+    void SolveAsync(const StateVector &state, const CubicCoeffs &coeffs, Deadline deadline, SolveHandle &handle,
+                    function<void(SolveHandle &)> done = nullptr);
+    
+    // Solve the independent problems given by `states` and `coeffs` at once
+    // with the SQP_RTI solver, whatever the backend, each from a cold start.
+    // The problems are packed batch_lanes at a time so that their QPs share
+    // SIMD packets, see BatchRiccati.h. `actuations[i]` is what Solve
+    // would return for problem i; the warm start, mpc_x and mpc_y are left
+    // alone. Problems whose states and coeffs differ in number are not
+    // solved, and both outputs are left empty.
+    void SolveBatch(const vector<Eigen::VectorXd> &states, const vector<Eigen::VectorXd> &coeffs,
+                    vector<vector<double> > &actuations, vector<SolveStats> &stats);
+    
+    // SolveBatch for the vehicles of `fleet` in `slots`, their problems read
+    // from its columns and their first actuations written back into them,
+    // with `stats[i]` that of slots[i]. Each starts from its trajectory in
+    // the store, shifted as by Solve, if it has one, and leaves the new one
+    // in its place; a failed solve starts the next one cold.
+    void SolveBatch(FleetStore &fleet, const vector<size_t> &slots, vector<SolveStats> &stats);
+    
+    // Size of the trajectories the batch solves of the current horizon warm
+    // start from, see FleetStore.
+    size_t getBatchWarmStartSize() const;
+    
+    // Tangential predictor: the first actuations of the last solve of the
+    // current horizon corrected to first order for a new initial state and
+    // reference, from their sensitivity computed after that solve, see
+    // MpcOptions::predictor. Takes microseconds; false without the option
+    // or a converged last solve.
+    bool Predict(const StateVector &state, const CubicCoeffs &coeffs, double &delta, double &a) const;
     
     // return the dt
     double getTimeInterval();
+    
+private:
+    // Solvers for the compile-time horizons, see MpcConfig.h, in the order
+    // of compiled_horizons then BlockedConfig, and created on first use.
+    // `horizon` is the current one.
+    unique_ptr<MpcHorizon> horizons[n_compiled_horizons + 1];
+    MpcHorizon *horizon;
+    
+    // Settings of every horizon, carried over to a new one.
+    bool warm_start;
+    SolverBackend backend;
+    ModelVariant model;
+    Formulation formulation;
+    CostWeights weights;
+    SpeedProfile profile;
+    MpcOptions options;
+    const CancelToken *cancel;
+    IterationTrace *iteration_trace;
+    const FleetObstacles *obstacles;
+    
+    // Inputs of the fixed-size Solve, kept to reuse their storage.
+    Eigen::VectorXd state_buffer;
+    Eigen::VectorXd coeffs_buffer;
+    
+    // The recent problems, with MPC_SLOW_SOLVES, see SlowSolveLog.h.
+    unique_ptr<SlowSolveRing> slow_solves;
+    
+    // horizon->Solve, through the ring if there is one.
+    void solveHorizon(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, SolveStats &stats,
+                      Deadline deadline, Solution &solution);
+};
+
+// A solve running on its own, see MPC::SolveAsync, e.g. that of the next
+// frame while the network thread goes on, or one of several raced against
+// each other. The answer is only to be read once ready(). Destroying the
+// handle cancels the solve and waits for it.
+//
+//     SolveHandle handle;
+//     mpc.SolveAsync(state, coeffs, deadline, handle);
+//     ...
+//     if (stale) handle.cancel();
+//     handle.wait();
+//     use(handle.solution(), handle.stats());
+class SolveHandle {
+public:
+    SolveHandle() : deadline(Deadline::max()), done(true) {}
+    
+    ~SolveHandle() {
+        cancel();
+        wait();
+    }
+    
+    // Stop the solve at its next check, see MPC::setCancel. It reports
+    // SOLVE_CANCELLED unless it was done already.
+    void cancel() { token.cancel(); }
+    
+    bool ready() const { return done.load(memory_order_acquire); }
+    
+    // Return once the solve, and its callback, are done.
+    void wait() { group.wait(); }
+    
+    const SolveStats &stats() const { return result_stats; }
+    
+    const Solution &solution() const { return result; }
+    
+private:
+    friend class MPC;
+    
+    CancelToken token;
+    StateVector state;
+    CubicCoeffs coeffs;
+    Deadline deadline;
+    SolveStats result_stats;
+    Solution result;
+    function<void(SolveHandle &)> callback;
+    // The task, kept here since the group calls it by reference.
+    function<void(size_t)> job;
+    atomic<bool> done;
+    TaskGroup group;
 };
 
 #endif /* MPC_H */
@@ -0,0 +1,739 @@
+#include "Metrics.h"
+#include <math.h>
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+
+const int Histogram::n_buckets;
+
+int metricShard() {
+    static atomic<unsigned> next(0);
+    static thread_local int shard = next.fetch_add(1, memory_order_relaxed) % metric_shards;
+    return shard;
+}
+
+Counter::Counter() {
+    for (Shard &shard : shards) {
+        shard.value.store(0, memory_order_relaxed);
+    }
+}
+
+uint64_t Counter::value() const {
+    uint64_t n = 0;
+    for (const Shard &shard : shards) {
+        n += shard.value.load(memory_order_relaxed);
+    }
+    return n;
+}
+
+Histogram::Histogram() {
+    for (Shard &shard : shards) {
+        for (int i = 0; i < n_buckets; i++) {
+            shard.buckets[i].store(0, memory_order_relaxed);
+        }
+        shard.recorded.store(0, memory_order_relaxed);
+        shard.sum.store(0, memory_order_relaxed);
+        shard.largest.store(0, memory_order_relaxed);
+    }
+}
+
+int Histogram::bucketOf(uint64_t us) {
+    int bucket = (int) (4.0 * log2(us + 1.0));
+    return bucket < n_buckets ? bucket : n_buckets - 1;
+}
+
+uint64_t Histogram::upperBound(int bucket) {
+    return (uint64_t) ceil(exp2((bucket + 1) / 4.0) - 1.0);
+}
+
+void Histogram::record(uint64_t us) {
+    Shard &shard = shards[metricShard()];
+    shard.buckets[bucketOf(us)].fetch_add(1, memory_order_relaxed);
+    shard.recorded.fetch_add(1, memory_order_relaxed);
+    shard.sum.fetch_add(us, memory_order_relaxed);
+    uint64_t seen = shard.largest.load(memory_order_relaxed);
+    while (us > seen && !shard.largest.compare_exchange_weak(seen, us, memory_order_relaxed)) {
+    }
+}
+
+uint64_t Histogram::count() const {
+    uint64_t n = 0;
+    for (const Shard &shard : shards) {
+        n += shard.recorded.load(memory_order_relaxed);
+    }
+    return n;
+}
+
+uint64_t Histogram::max() const {
+    uint64_t largest = 0;
+    for (const Shard &shard : shards) {
+        uint64_t seen = shard.largest.load(memory_order_relaxed);
+        largest = seen > largest ? seen : largest;
+    }
+    return largest;
+}
+
+uint64_t Histogram::total() const {
+    uint64_t n = 0;
+    for (const Shard &shard : shards) {
+        n += shard.sum.load(memory_order_relaxed);
+    }
+    return n;
+}
+
+double Histogram::mean() const {
+    uint64_t n = count();
+    return n ? (double) total() / n : 0.0;
+}
+
+uint64_t Histogram::quantile(double q) const {
+    uint64_t n = count();
+    if (n == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) ceil(q * n);
+    uint64_t largest = max();
+    uint64_t seen = 0;
+    for (int i = 0; i < n_buckets; i++) {
+        for (const Shard &shard : shards) {
+            seen += shard.buckets[i].load(memory_order_relaxed);
+        }
+        if (seen >= rank && seen > 0) {
+            // The true value can not exceed the maximum.
+            return upperBound(i) < largest ? upperBound(i) : largest;
+        }
+    }
+    return largest;
+}
+
+void Histogram::snapshot(uint64_t counts[n_buckets]) const {
+    for (int i = 0; i < n_buckets; i++) {
+        counts[i] = 0;
+        for (const Shard &shard : shards) {
+            counts[i] += shard.buckets[i].load(memory_order_relaxed);
+        }
+    }
+}
+
+namespace Metrics {
+
+static Histogram stages[N_STAGES];
+static const chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+static const char *stage_names[N_STAGES] = {
+    "parse", "transform", "polyfit", "predict", "solve", "serialize", "step"
+};
+
+static Histogram iterations;
+static Counter statuses[N_SOLVE_STATUS];
+static Counter seeds[N_SOLVE_SEEDS];
+// In thousandths, see recordSolve.
+static Counter cost_terms[N_COST_TERMS];
+static Counter fallbacks;
+static Counter restorations;
+static Counter linear_solver_waits;
+static Histogram linear_solver_wait;
+// Of the solves timed by phase, see SolveStats::eval_time, by SolvePhase.
+enum SolvePhase { PHASE_EVAL, PHASE_LINEAR, PHASE_OTHER, N_SOLVE_PHASES };
+static Histogram solve_phases[N_SOLVE_PHASES];
+static const char *solve_phase_names[N_SOLVE_PHASES] = {"eval", "linear_solver", "other"};
+static Counter drops[N_DROP_REASONS];
+static Counter shed_messages[N_SHED_REASONS];
+static Counter shed_bytes[N_SHED_REASONS];
+static Counter deflated_messages;
+static Counter deflated_raw_bytes;
+static Counter deflated_sent_bytes;
+static Counter lqr_replies;
+static Counter table_replies;
+static Counter predicted_replies;
+static Counter refused_connections;
+static Counter deadline_misses;
+static Counter tier_changes[N_CONTROL_TIERS];
+static Counter shadow_ok;
+static Counter shadow_failed;
+static Counter shadow_skipped;
+static Histogram shadow_latency;
+static Histogram shadow_primary_latency;
+// In microradians and millionths of the throttle range.
+static Histogram shadow_steering;
+static Histogram shadow_throttle;
+static Counter speculation_hits;
+static Counter speculation_misses;
+static Counter lap_seeds;
+static Counter cache_hits;
+static Counter cache_misses;
+
+// Fields of the last TapeStats of each horizon, all zero until one is
+// recorded.
+struct TapeGauges {
+    atomic<uint64_t> operations;
+    atomic<uint64_t> variables;
+    atomic<uint64_t> parameters;
+    atomic<uint64_t> bytes;
+    atomic<uint64_t> jacobian_nnz;
+    atomic<uint64_t> hessian_nnz;
+    atomic<uint64_t> jacobian_colors;
+    atomic<uint64_t> hessian_colors;
+    atomic<uint64_t> linear_constraints;
+};
+static TapeGauges tapes[max_horizon + 1];
+
+// The bins of recordTrackSolve. Unlike the counters they are not
+// sharded: one solve per frame hardly contends, and a bin fits a line.
+struct alignas(64) TrackCounters {
+    atomic<uint64_t> solves;
+    atomic<uint64_t> solve_total_us;
+    atomic<uint64_t> solve_max_us;
+    atomic<uint64_t> iterations_total;
+    atomic<uint64_t> iterations_max;
+    atomic<uint64_t> fallbacks;
+    atomic<uint64_t> failures;
+};
+static TrackCounters track_bins[max_track_bins];
+static double track_length = 0;
+
+static const char *status_names[N_SOLVE_STATUS] = {
+    "success", "acceptable", "max_iterations", "cpu_time_exceeded", "infeasible",
+    "deadline_feasible", "deadline_exceeded", "failed", "cancelled", "control_converged"
+};
+
+static const char *seed_names[N_SOLVE_SEEDS] = {"shifted", "lqr", "library", "zero"};
+
+static const char *cost_term_names[N_COST_TERMS] = {"cte", "epsi", "speed", "actuation", "rate"};
+
+Histogram &stage(Stage s) {
+    return stages[s];
+}
+
+const char *stageName(Stage s) {
+    return stage_names[s];
+}
+
+void recordSolve(const SolveStats &stats) {
+    statuses[stats.status].add();
+    seeds[stats.seed].add();
+    if (stats.fallback) {
+        fallbacks.add();
+    }
+    if (stats.restoration_iterations > 0) {
+        restorations.add();
+    }
+    if (stats.linear_solver_wait > 0) {
+        linear_solver_waits.add();
+        linear_solver_wait.record(llround(stats.linear_solver_wait * 1e6));
+    }
+    if (stats.iterations >= 0) {
+        iterations.record(stats.iterations);
+    }
+    if (stats.eval_time > 0 || stats.linear_solver_time > 0) {
+        double other = stats.wall_time - stats.eval_time - stats.linear_solver_time - stats.linear_solver_wait;
+        solve_phases[PHASE_EVAL].record(llround(stats.eval_time * 1e6));
+        solve_phases[PHASE_LINEAR].record(llround(stats.linear_solver_time * 1e6));
+        solve_phases[PHASE_OTHER].record(llround(max(0.0, other) * 1e6));
+    }
+    if (stats.cache_lookup) {
+        (stats.cached ? cache_hits : cache_misses).add();
+    }
+    for (int i = 0; i < N_COST_TERMS; i++) {
+        if (stats.cost_terms[i] > 0) {
+            cost_terms[i].add(llround(stats.cost_terms[i] * 1e3));
+        }
+    }
+}
+
+void recordDrop(DropReason reason) {
+    drops[reason].add();
+}
+
+void recordShed(ShedReason reason, size_t bytes) {
+    shed_messages[reason].add();
+    shed_bytes[reason].add(bytes);
+}
+
+void recordDeflate(size_t raw, size_t sent) {
+    deflated_messages.add();
+    deflated_raw_bytes.add(raw);
+    deflated_sent_bytes.add(sent);
+}
+
+void recordLqr() {
+    lqr_replies.add();
+}
+
+void recordTable() {
+    table_replies.add();
+}
+
+void recordPredicted() {
+    predicted_replies.add();
+}
+
+void recordTier(ControlTier tier) {
+    tier_changes[tier].add();
+}
+
+void recordShadow(const SolveStats &stats, double primary_time, double steering_delta, double throttle_delta) {
+    (stats.ok() ? shadow_ok : shadow_failed).add();
+    shadow_latency.record((uint64_t) (stats.wall_time * 1e6));
+    shadow_primary_latency.record((uint64_t) (primary_time * 1e6));
+    if (stats.ok()) {
+        shadow_steering.record((uint64_t) (steering_delta * 1e6));
+        shadow_throttle.record((uint64_t) (throttle_delta * 1e6));
+    }
+}
+
+void recordShadowSkipped() {
+    shadow_skipped.add();
+}
+
+void recordRefused() {
+    refused_connections.add();
+}
+
+void recordDeadlineMiss() {
+    deadline_misses.add();
+}
+
+void recordSpeculation(bool hit) {
+    (hit ? speculation_hits : speculation_misses).add();
+}
+
+void recordLapSeed() {
+    lap_seeds.add();
+}
+
+void recordTape(const TapeStats &stats) {
+    if (stats.horizon > max_horizon) {
+        return;
+    }
+    TapeGauges &tape = tapes[stats.horizon];
+    tape.operations.store(stats.operations, memory_order_relaxed);
+    tape.variables.store(stats.variables, memory_order_relaxed);
+    tape.parameters.store(stats.parameters, memory_order_relaxed);
+    tape.bytes.store(stats.bytes, memory_order_relaxed);
+    tape.jacobian_nnz.store(stats.jacobian_nnz, memory_order_relaxed);
+    tape.hessian_nnz.store(stats.hessian_nnz, memory_order_relaxed);
+    tape.jacobian_colors.store(stats.jacobian_colors, memory_order_relaxed);
+    tape.hessian_colors.store(stats.hessian_colors, memory_order_relaxed);
+    tape.linear_constraints.store(stats.linear_constraints, memory_order_relaxed);
+}
+
+// The history of sampleHistory, a ring of its seconds, and the cumulative
+// metrics at the end of the last one, which the next is the difference
+// from.
+namespace {
+
+struct History {
+    mutex lock;
+    HistorySecond seconds[history_seconds];
+    size_t next = 0;
+    size_t size = 0;
+    uint64_t solve_buckets[Histogram::n_buckets] = {};
+    uint64_t iteration_buckets[Histogram::n_buckets] = {};
+    uint64_t fallbacks = 0;
+    uint64_t dropped = 0;
+    uint64_t tier_changes = 0;
+};
+
+History history;
+
+// Upper bound of the bucket holding quantile `q` of what was recorded
+// between the snapshots `before` and `now`, which becomes `before`; 0 if
+// nothing was, and the count into `n`.
+void intervalQuantiles(uint64_t before[Histogram::n_buckets], const uint64_t now[Histogram::n_buckets],
+                       const double *qs, uint64_t *values, int n_qs, uint64_t &n) {
+    uint64_t diff[Histogram::n_buckets];
+    n = 0;
+    for (int i = 0; i < Histogram::n_buckets; i++) {
+        diff[i] = now[i] - before[i];
+        before[i] = now[i];
+        n += diff[i];
+    }
+    for (int k = 0; k < n_qs; k++) {
+        values[k] = 0;
+        if (n == 0) {
+            continue;
+        }
+        uint64_t rank = (uint64_t) ceil(qs[k] * n), seen = 0;
+        for (int i = 0; i < Histogram::n_buckets; i++) {
+            seen += diff[i];
+            if (seen >= rank && seen > 0) {
+                values[k] = Histogram::upperBound(i);
+                break;
+            }
+        }
+    }
+}
+
+uint32_t saturate(uint64_t value, uint32_t limit) {
+    return value < limit ? (uint32_t) value : limit;
+}
+
+} // namespace
+
+void sampleHistory() {
+    static const double qs[3] = {0.5, 0.99, 1.0};
+    uint64_t solve_now[Histogram::n_buckets], iteration_now[Histogram::n_buckets];
+    stages[STAGE_SOLVE].snapshot(solve_now);
+    iterations.snapshot(iteration_now);
+    uint64_t dropped = 0, tiers = 0;
+    for (int i = 0; i < N_DROP_REASONS; i++) {
+        dropped += drops[i].value();
+    }
+    for (int i = 0; i < N_CONTROL_TIERS; i++) {
+        tiers += tier_changes[i].value();
+    }
+    uint64_t falls = fallbacks.value();
+
+    lock_guard<mutex> hold(history.lock);
+    HistorySecond &second = history.seconds[history.next];
+    second.time = (uint32_t) chrono::duration_cast<chrono::seconds>(
+                      chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t solve_q[3], iteration_q[3], solves, n_iterations;
+    intervalQuantiles(history.solve_buckets, solve_now, qs, solve_q, 3, solves);
+    intervalQuantiles(history.iteration_buckets, iteration_now, qs, iteration_q, 2, n_iterations);
+    second.solves = saturate(solves, UINT32_MAX);
+    second.solve_p50_us = saturate(solve_q[0], UINT32_MAX);
+    second.solve_p99_us = saturate(solve_q[1], UINT32_MAX);
+    second.solve_max_us = saturate(solve_q[2], UINT32_MAX);
+    second.iterations_p50 = (uint16_t) saturate(iteration_q[0], UINT16_MAX);
+    second.iterations_p99 = (uint16_t) saturate(iteration_q[1], UINT16_MAX);
+    second.fallbacks = saturate(falls - history.fallbacks, UINT32_MAX);
+    second.dropped = saturate(dropped - history.dropped, UINT32_MAX);
+    second.tier_changes = saturate(tiers - history.tier_changes, UINT32_MAX);
+    history.fallbacks = falls;
+    history.dropped = dropped;
+    history.tier_changes = tiers;
+    history.next = (history.next + 1) % history_seconds;
+    history.size = min(history.size + 1, history_seconds);
+}
+
+double trackBinLength(double length) {
+    return max(track_bin_length, length / max_track_bins);
+}
+
+size_t trackBinOf(double s, double length) {
+    double wrapped = fmod(s, length);
+    if (wrapped < 0) {
+        wrapped += length;
+    }
+    return min(max_track_bins - 1, (size_t) (wrapped / trackBinLength(length)));
+}
+
+void setTrackLength(double length) {
+    track_length = length > 0 ? length : 0;
+    for (TrackCounters &bin : track_bins) {
+        bin.solves.store(0, memory_order_relaxed);
+        bin.solve_total_us.store(0, memory_order_relaxed);
+        bin.solve_max_us.store(0, memory_order_relaxed);
+        bin.iterations_total.store(0, memory_order_relaxed);
+        bin.iterations_max.store(0, memory_order_relaxed);
+        bin.fallbacks.store(0, memory_order_relaxed);
+        bin.failures.store(0, memory_order_relaxed);
+    }
+}
+
+static void storeMax(atomic<uint64_t> &largest, uint64_t value) {
+    uint64_t seen = largest.load(memory_order_relaxed);
+    while (value > seen && !largest.compare_exchange_weak(seen, value, memory_order_relaxed)) {
+    }
+}
+
+void recordTrackSolve(double s, const SolveStats &stats) {
+    if (track_length <= 0) {
+        return;
+    }
+    TrackCounters &bin = track_bins[trackBinOf(s, track_length)];
+    uint64_t us = llround(max(0.0, stats.wall_time) * 1e6);
+    uint64_t its = max(0, stats.iterations);
+    bin.solves.fetch_add(1, memory_order_relaxed);
+    bin.solve_total_us.fetch_add(us, memory_order_relaxed);
+    storeMax(bin.solve_max_us, us);
+    bin.iterations_total.fetch_add(its, memory_order_relaxed);
+    storeMax(bin.iterations_max, its);
+    if (stats.fallback) {
+        bin.fallbacks.fetch_add(1, memory_order_relaxed);
+    }
+    if (!stats.ok()) {
+        bin.failures.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+vector<TrackBin> trackBins() {
+    vector<TrackBin> bins;
+    if (track_length <= 0) {
+        return bins;
+    }
+    double width = trackBinLength(track_length);
+    for (size_t i = 0; i < max_track_bins && i * width < track_length; i++) {
+        const TrackCounters &counters = track_bins[i];
+        TrackBin bin;
+        bin.solves = counters.solves.load(memory_order_relaxed);
+        if (bin.solves == 0) {
+            continue;
+        }
+        bin.s = i * width;
+        bin.solve_total_us = counters.solve_total_us.load(memory_order_relaxed);
+        bin.solve_max_us = counters.solve_max_us.load(memory_order_relaxed);
+        bin.iterations_total = counters.iterations_total.load(memory_order_relaxed);
+        bin.iterations_max = counters.iterations_max.load(memory_order_relaxed);
+        bin.fallbacks = counters.fallbacks.load(memory_order_relaxed);
+        bin.failures = counters.failures.load(memory_order_relaxed);
+        bins.push_back(bin);
+    }
+    return bins;
+}
+
+string renderTrack() {
+    string out = "s,solves,solve_mean_us,solve_max_us,iterations_mean,iterations_max,fallbacks,failures\n";
+    for (const TrackBin &bin : trackBins()) {
+        char line[160];
+        snprintf(line, sizeof(line), "%.0f,%llu,%.0f,%llu,%.1f,%llu,%llu,%llu\n", bin.s,
+                 (unsigned long long) bin.solves, (double) bin.solve_total_us / bin.solves,
+                 (unsigned long long) bin.solve_max_us, (double) bin.iterations_total / bin.solves,
+                 (unsigned long long) bin.iterations_max, (unsigned long long) bin.fallbacks,
+                 (unsigned long long) bin.failures);
+        out += line;
+    }
+    return out;
+}
+
+string renderHistory(uint32_t since) {
+    string out = "time,solves,solve_p50_us,solve_p99_us,solve_max_us,iterations_p50,iterations_p99,fallbacks,"
+                 "dropped,tier_changes\n";
+    lock_guard<mutex> hold(history.lock);
+    size_t first = (history.next + history_seconds - history.size) % history_seconds;
+    for (size_t k = 0; k < history.size; k++) {
+        const HistorySecond &second = history.seconds[(first + k) % history_seconds];
+        if (second.time <= since) {
+            continue;
+        }
+        char line[160];
+        snprintf(line, sizeof(line), "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", second.time, second.solves,
+                 second.solve_p50_us, second.solve_p99_us, second.solve_max_us, second.iterations_p50,
+                 second.iterations_p99, second.fallbacks, second.dropped, second.tier_changes);
+        out += line;
+    }
+    return out;
+}
+
+static const char *drop_names[N_DROP_REASONS] = {"superseded", "saturated", "preempted", "malformed"};
+static const char *shed_names[N_SHED_REASONS] = {"visualization", "stale"};
+static const char *tier_names[N_CONTROL_TIERS] = {"full", "reduced", "lqr", "pursuit"};
+
+// "# TYPE" header of a metric family, all of whose samples must follow it.
+static void family(string &out, const char *name, const char *type) {
+    out += "# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+static void sample(string &out, const char *name, const char *labels, double value) {
+    char buf[192];
+    if (*labels) {
+        snprintf(buf, sizeof(buf), "%s{%s} %.6g\n", name, labels, value);
+    } else {
+        snprintf(buf, sizeof(buf), "%s %.6g\n", name, value);
+    }
+    out += buf;
+}
+
+void appendQuantiles(string &out, const char *name, const char *labels, const Histogram &h) {
+    const char *sep = *labels ? "," : "";
+    char buf[160];
+    snprintf(buf, sizeof(buf), "%s%squantile=\"0.5\"", labels, sep);
+    sample(out, name, buf, h.quantile(0.5));
+    snprintf(buf, sizeof(buf), "%s%squantile=\"0.99\"", labels, sep);
+    sample(out, name, buf, h.quantile(0.99));
+    snprintf(buf, sizeof(buf), "%s%squantile=\"1\"", labels, sep);
+    sample(out, name, buf, h.max());
+}
+
+string render() {
+    string out;
+    double uptime = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    char labels[N_STAGES][48];
+    for (int i = 0; i < N_STAGES; i++) {
+        snprintf(labels[i], sizeof(labels[i]), "stage=\"%s\"", stage_names[i]);
+    }
+    
+    family(out, "mpc_stage_latency_us", "summary");
+    for (int i = 0; i < N_STAGES; i++) {
+        appendQuantiles(out, "mpc_stage_latency_us", labels[i], stages[i]);
+    }
+    family(out, "mpc_stage_latency_us_mean", "gauge");
+    for (int i = 0; i < N_STAGES; i++) {
+        sample(out, "mpc_stage_latency_us_mean", labels[i], stages[i].mean());
+    }
+    family(out, "mpc_stage_count", "counter");
+    for (int i = 0; i < N_STAGES; i++) {
+        sample(out, "mpc_stage_count", labels[i], stages[i].count());
+    }
+    family(out, "mpc_stage_busy_seconds_total", "counter");
+    for (int i = 0; i < N_STAGES; i++) {
+        sample(out, "mpc_stage_busy_seconds_total", labels[i], stages[i].total() * 1e-6);
+    }
+    family(out, "mpc_stage_utilization", "gauge");
+    for (int i = 0; i < N_STAGES; i++) {
+        sample(out, "mpc_stage_utilization", labels[i], uptime > 0 ? stages[i].total() * 1e-6 / uptime : 0.0);
+    }
+    
+    family(out, "mpc_solve_iterations", "summary");
+    appendQuantiles(out, "mpc_solve_iterations", "", iterations);
+    family(out, "mpc_solve_status_total", "counter");
+    for (int i = 0; i < N_SOLVE_STATUS; i++) {
+        char status[48];
+        snprintf(status, sizeof(status), "status=\"%s\"", status_names[i]);
+        sample(out, "mpc_solve_status_total", status, statuses[i].value());
+    }
+    family(out, "mpc_solve_seed_total", "counter");
+    for (int i = 0; i < N_SOLVE_SEEDS; i++) {
+        char seed[48];
+        snprintf(seed, sizeof(seed), "seed=\"%s\"", seed_names[i]);
+        sample(out, "mpc_solve_seed_total", seed, seeds[i].value());
+    }
+    family(out, "mpc_solve_cost_total", "counter");
+    for (int i = 0; i < N_COST_TERMS; i++) {
+        char term[48];
+        snprintf(term, sizeof(term), "term=\"%s\"", cost_term_names[i]);
+        sample(out, "mpc_solve_cost_total", term, cost_terms[i].value() * 1e-3);
+    }
+    family(out, "mpc_solve_fallback_total", "counter");
+    sample(out, "mpc_solve_fallback_total", "", fallbacks.value());
+    family(out, "mpc_solve_restoration_total", "counter");
+    sample(out, "mpc_solve_restoration_total", "", restorations.value());
+    family(out, "mpc_linear_solver_contended_total", "counter");
+    sample(out, "mpc_linear_solver_contended_total", "", linear_solver_waits.value());
+    appendQuantiles(out, "mpc_linear_solver_wait_us", "", linear_solver_wait);
+    family(out, "mpc_solve_phase_us", "summary");
+    for (int i = 0; i < N_SOLVE_PHASES; i++) {
+        char phase[48];
+        snprintf(phase, sizeof(phase), "phase=\"%s\"", solve_phase_names[i]);
+        appendQuantiles(out, "mpc_solve_phase_us", phase, solve_phases[i]);
+    }
+    family(out, "mpc_solve_phase_seconds_total", "counter");
+    for (int i = 0; i < N_SOLVE_PHASES; i++) {
+        char phase[48];
+        snprintf(phase, sizeof(phase), "phase=\"%s\"", solve_phase_names[i]);
+        sample(out, "mpc_solve_phase_seconds_total", phase, solve_phases[i].total() * 1e-6);
+    }
+    family(out, "mpc_frames_dropped_total", "counter");
+    for (int i = 0; i < N_DROP_REASONS; i++) {
+        char reason[48];
+        snprintf(reason, sizeof(reason), "reason=\"%s\"", drop_names[i]);
+        sample(out, "mpc_frames_dropped_total", reason, drops[i].value());
+    }
+    family(out, "mpc_shed_messages_total", "counter");
+    for (int i = 0; i < N_SHED_REASONS; i++) {
+        char reason[48];
+        snprintf(reason, sizeof(reason), "reason=\"%s\"", shed_names[i]);
+        sample(out, "mpc_shed_messages_total", reason, shed_messages[i].value());
+    }
+    family(out, "mpc_shed_bytes_total", "counter");
+    for (int i = 0; i < N_SHED_REASONS; i++) {
+        char reason[48];
+        snprintf(reason, sizeof(reason), "reason=\"%s\"", shed_names[i]);
+        sample(out, "mpc_shed_bytes_total", reason, shed_bytes[i].value());
+    }
+    family(out, "mpc_deflated_messages_total", "counter");
+    sample(out, "mpc_deflated_messages_total", "", deflated_messages.value());
+    family(out, "mpc_deflated_bytes_total", "counter");
+    sample(out, "mpc_deflated_bytes_total", "side=\"raw\"", deflated_raw_bytes.value());
+    sample(out, "mpc_deflated_bytes_total", "side=\"sent\"", deflated_sent_bytes.value());
+    family(out, "mpc_lqr_replies_total", "counter");
+    sample(out, "mpc_lqr_replies_total", "", lqr_replies.value());
+    family(out, "mpc_table_replies_total", "counter");
+    sample(out, "mpc_table_replies_total", "", table_replies.value());
+    family(out, "mpc_predicted_replies_total", "counter");
+    sample(out, "mpc_predicted_replies_total", "", predicted_replies.value());
+    family(out, "mpc_refused_connections_total", "counter");
+    sample(out, "mpc_refused_connections_total", "", refused_connections.value());
+    family(out, "mpc_deadline_misses_total", "counter");
+    sample(out, "mpc_deadline_misses_total", "", deadline_misses.value());
+    family(out, "mpc_shadow_solves_total", "counter");
+    sample(out, "mpc_shadow_solves_total", "outcome=\"ok\"", shadow_ok.value());
+    sample(out, "mpc_shadow_solves_total", "outcome=\"failed\"", shadow_failed.value());
+    family(out, "mpc_shadow_skipped_total", "counter");
+    sample(out, "mpc_shadow_skipped_total", "", shadow_skipped.value());
+    family(out, "mpc_shadow_latency_us", "summary");
+    appendQuantiles(out, "mpc_shadow_latency_us", "solver=\"shadow\"", shadow_latency);
+    appendQuantiles(out, "mpc_shadow_latency_us", "solver=\"primary\"", shadow_primary_latency);
+    family(out, "mpc_shadow_steering_delta_urad", "summary");
+    appendQuantiles(out, "mpc_shadow_steering_delta_urad", "", shadow_steering);
+    family(out, "mpc_shadow_throttle_delta_micro", "summary");
+    appendQuantiles(out, "mpc_shadow_throttle_delta_micro", "", shadow_throttle);
+    family(out, "mpc_tier_changes_total", "counter");
+    for (int i = 0; i < N_CONTROL_TIERS; i++) {
+        char tier[32];
+        snprintf(tier, sizeof(tier), "tier=\"%s\"", tier_names[i]);
+        sample(out, "mpc_tier_changes_total", tier, tier_changes[i].value());
+    }
+    family(out, "mpc_speculation_total", "counter");
+    sample(out, "mpc_speculation_total", "outcome=\"hit\"", speculation_hits.value());
+    sample(out, "mpc_speculation_total", "outcome=\"miss\"", speculation_misses.value());
+    family(out, "mpc_lap_seeds_total", "counter");
+    sample(out, "mpc_lap_seeds_total", "", lap_seeds.value());
+    family(out, "mpc_solution_cache_total", "counter");
+    sample(out, "mpc_solution_cache_total", "outcome=\"hit\"", cache_hits.value());
+    sample(out, "mpc_solution_cache_total", "outcome=\"miss\"", cache_misses.value());
+    
+    // One sample per horizon a tape was recorded for.
+    static const struct {
+        const char *name;
+        atomic<uint64_t> TapeGauges::*field;
+    } tape_fields[] = {
+        {"mpc_tape_operations", &TapeGauges::operations},
+        {"mpc_tape_variables", &TapeGauges::variables},
+        {"mpc_tape_parameters", &TapeGauges::parameters},
+        {"mpc_tape_bytes", &TapeGauges::bytes},
+        {"mpc_tape_jacobian_nonzeros", &TapeGauges::jacobian_nnz},
+        {"mpc_tape_hessian_nonzeros", &TapeGauges::hessian_nnz},
+        {"mpc_tape_jacobian_colors", &TapeGauges::jacobian_colors},
+        {"mpc_tape_hessian_colors", &TapeGauges::hessian_colors},
+        {"mpc_tape_linear_constraints", &TapeGauges::linear_constraints},
+    };
+    for (const auto &f : tape_fields) {
+        family(out, f.name, "gauge");
+        for (size_t N = 0; N <= max_horizon; N++) {
+            if (tapes[N].operations.load(memory_order_relaxed) == 0) {
+                continue;
+            }
+            char horizon[32];
+            snprintf(horizon, sizeof(horizon), "horizon=\"%zu\"", N);
+            sample(out, f.name, horizon, (tapes[N].*f.field).load(memory_order_relaxed));
+        }
+    }
+    
+    // One sample per bin of the track with any solve, labelled with the
+    // arc length it starts at.
+    vector<TrackBin> bins = trackBins();
+    static const struct {
+        const char *name;
+        const char *type;
+        double (*value)(const TrackBin &);
+    } track_fields[] = {
+        {"mpc_track_solves_total", "counter", [](const TrackBin &b) { return (double) b.solves; }},
+        {"mpc_track_solve_seconds_total", "counter", [](const TrackBin &b) { return b.solve_total_us * 1e-6; }},
+        {"mpc_track_solve_max_us", "gauge", [](const TrackBin &b) { return (double) b.solve_max_us; }},
+        {"mpc_track_iterations_total", "counter", [](const TrackBin &b) { return (double) b.iterations_total; }},
+        {"mpc_track_iterations_max", "gauge", [](const TrackBin &b) { return (double) b.iterations_max; }},
+        {"mpc_track_fallback_total", "counter", [](const TrackBin &b) { return (double) b.fallbacks; }},
+        {"mpc_track_failed_total", "counter", [](const TrackBin &b) { return (double) b.failures; }},
+    };
+    for (const auto &f : track_fields) {
+        if (bins.empty()) {
+            break;
+        }
+        family(out, f.name, f.type);
+        for (const TrackBin &bin : bins) {
+            char s[32];
+            snprintf(s, sizeof(s), "s=\"%.0f\"", bin.s);
+            sample(out, f.name, s, f.value(bin));
+        }
+    }
+    return out;
+}
+
+} // namespace Metrics
@@ -0,0 +1,310 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MPC.h"
+
+using namespace std;
+
+// Stages of the control pipeline that are timed.
+enum Stage {
+    STAGE_PARSE,
+    STAGE_TRANSFORM,
+    STAGE_POLYFIT,
+    // Errors and the latency compensated initial state.
+    STAGE_PREDICT,
+    STAGE_SOLVE,
+    STAGE_SERIALIZE,
+    // Whole controller step, from decoded telemetry to the reply, when it
+    // runs in one go, see Controller::step.
+    STAGE_STEP,
+    N_STAGES
+};
+
+// Shards of each Counter and Histogram. Every thread records into the
+// shard it was dealt when it first recorded, round robin, so up to that
+// many threads never write to the same cache line; the shards are only
+// summed when read, e.g. when /metrics is scraped.
+const int metric_shards = 16;
+
+// Shard of the calling thread.
+int metricShard();
+
+// Count that any thread adds to, lock-free and without contention, see
+// metric_shards.
+class Counter {
+public:
+    Counter();
+    
+    void add(uint64_t n = 1) { shards[metricShard()].value.fetch_add(n, memory_order_relaxed); }
+    
+    // Sum of the shards.
+    uint64_t value() const;
+    
+private:
+    struct alignas(64) Shard {
+        atomic<uint64_t> value;
+    };
+    Shard shards[metric_shards];
+};
+
+// Histogram of non-negative integers, latencies in microseconds unless
+// noted otherwise, with log-spaced buckets, four per
+// octave, so quantiles are accurate to about 20%. Recording is lock-free
+// and may happen from any thread, each into its shard, see metric_shards;
+// the reads merge the shards.
+class Histogram {
+public:
+    static const int n_buckets = 128;
+    
+    Histogram();
+    
+    void record(uint64_t us);
+    
+    uint64_t count() const;
+    uint64_t max() const;
+    uint64_t total() const;
+    double mean() const;
+    
+    // Upper bound of the bucket holding quantile `q` in [0, 1].
+    uint64_t quantile(double q) const;
+
+    // The counts of the buckets, summed over the shards.
+    void snapshot(uint64_t counts[n_buckets]) const;
+    
+    // The bucket of `us`, and the largest value falling into `bucket`.
+    static int bucketOf(uint64_t us);
+    static uint64_t upperBound(int bucket);
+    
+private:
+    struct alignas(64) Shard {
+        atomic<uint64_t> buckets[n_buckets];
+        atomic<uint64_t> recorded;
+        atomic<uint64_t> sum;
+        atomic<uint64_t> largest;
+    };
+    Shard shards[metric_shards];
+};
+
+// Why a telemetry frame was never solved.
+enum DropReason {
+    // Replaced by a newer frame while the controller was busy.
+    DROP_SUPERSEDED,
+    // Every solver thread was saturated; the LQR answered it instead.
+    DROP_SATURATED,
+    // Its solve was cancelled past the deadline of its reply for a newer
+    // frame, see Controller::preempt; the previous plan answered it.
+    DROP_PREEMPTED,
+    // Could not be parsed. A frame already waiting is kept, not replaced.
+    DROP_MALFORMED,
+    N_DROP_REASONS
+};
+
+// What a connection that reads too slowly is spared, see DelayedSend.
+enum ShedReason {
+    // The lines of a reply, stripped to its actuations.
+    SHED_VISUALIZATION,
+    // A whole reply, replaced by a newer one before it could be sent.
+    SHED_STALE,
+    N_SHED_REASONS
+};
+
+// What answers the frames of a controller, from the best to the most
+// robust, see Controller::setDegradation.
+enum ControlTier {
+    // The MPC over its configured horizon.
+    TIER_FULL,
+    // The MPC over a shorter compiled horizon, warm started from the last
+    // plan.
+    TIER_REDUCED,
+    // The LQR about the reference, nothing solved.
+    TIER_LQR,
+    // Pure pursuit of the reference, for errors beyond those the LQR is
+    // linearized for.
+    TIER_PURSUIT,
+    N_CONTROL_TIERS
+};
+
+namespace Metrics {
+
+Histogram &stage(Stage stage);
+
+// Name of `stage` in the exposition, e.g. "solve".
+const char *stageName(Stage stage);
+
+// Count the outcome of a solve, its IPOPT iterations, whether the
+// solution cache had it, its cost by term, see
+// MpcOptions::cost_breakdown, and its wall time by phase: evaluations,
+// linear solver, and the rest less the wait for the linear solver, see
+// SolveStats::eval_time.
+void recordSolve(const SolveStats &stats);
+
+// Count a telemetry frame dropped for `reason`.
+void recordDrop(DropReason reason);
+
+// Count `bytes` of replies not sent for `reason`.
+void recordShed(ShedReason reason, size_t bytes);
+
+// Count a reply of `raw` bytes sent deflated to `sent`, see DelayedSend.
+void recordDeflate(size_t raw, size_t sent);
+
+// Count a reply whose actuations came from the LQR, see LqrSchedule.
+void recordLqr();
+
+// Count a reply looked up in the control table, see ControlTable.
+void recordTable();
+
+// Count a reply from the tangential predictor, see MPC::Predict.
+void recordPredicted();
+
+// Count a change of a controller to `tier`.
+void recordTier(ControlTier tier);
+
+// Record a solve of the shadow backend, see ShadowSolver: its outcome and
+// wall time against `primary_time`, the primary's on the same frame, both
+// in s, and how far its first steering, in rad, and throttle are from the
+// primary's.
+void recordShadow(const SolveStats &stats, double primary_time, double steering_delta, double throttle_delta);
+
+// Count a frame the shadow skipped, replaced before it picked it up.
+void recordShadowSkipped();
+
+// Count a connection refused by the admission control of MPC_ADMISSION.
+void recordRefused();
+
+// Count a control job of the worker pool completed after its deadline,
+// see WorkerPool.
+void recordDeadlineMiss();
+
+// Count a speculative answer taken, or discarded as too far from the
+// frame, see Controller::speculate.
+void recordSpeculation(bool hit);
+
+// Count a solve seeded from the plan of an earlier lap, see LapCache.
+void recordLapSeed();
+
+// Publish the size of a newly recorded tape, replacing the previous one of
+// its horizon.
+void recordTape(const TapeStats &stats);
+
+// Bins of the track map the solves are counted in by where the car was,
+// see recordTrackSolve: track_bin_length m of arc each, longer on a track
+// of more than max_track_bins of them.
+const double track_bin_length = 10;
+const size_t max_track_bins = 1024;
+
+// Length of the bins of a track `length` m long.
+double trackBinLength(double length);
+
+// Bin of the arc length `s` on a track `length` m long, wrapping around.
+size_t trackBinOf(double s, double length);
+
+// Count the solves by position on a track of `length` m, the map of
+// MPC_MAP, from now on; 0, the default, counts none. Clears the bins.
+// Not safe against concurrent recordTrackSolve.
+void setTrackLength(double length);
+
+// Count `stats`, of a frame at arc length `s` of the track, into its bin:
+// the solve, its wall time and iterations, and whether it fell back to the
+// previous plan or failed.
+void recordTrackSolve(double s, const SolveStats &stats);
+
+// What recordTrackSolve counted into a bin, from arc length `s` on.
+struct TrackBin {
+    double s;
+    uint64_t solves;
+    uint64_t solve_total_us;
+    uint64_t solve_max_us;
+    uint64_t iterations_total;
+    uint64_t iterations_max;
+    uint64_t fallbacks;
+    uint64_t failures;
+};
+
+// The bins with any solve, in the order of the track.
+vector<TrackBin> trackBins();
+
+// The bins of trackBins as CSV under a header line, the means per solve.
+string renderTrack();
+
+// The quantiles of `h` as samples of the summary `name`, one line each, see
+// render. `labels` are the sample's other labels, e.g. "stage=\"solve\"", or
+// empty.
+void appendQuantiles(string &out, const char *name, const char *labels, const Histogram &h);
+
+// One second of the server in the history of sampleHistory: the solves
+// completed in it, the quantiles of their latency in us and of their
+// iterations, and the frames dropped and the tier changes in it. The
+// quantiles are bucket bounds, as those of Histogram.
+struct HistorySecond {
+    // Unix time of its end.
+    uint32_t time;
+    uint32_t solves;
+    uint32_t solve_p50_us;
+    uint32_t solve_p99_us;
+    uint32_t solve_max_us;
+    uint16_t iterations_p50;
+    uint16_t iterations_p99;
+    uint32_t fallbacks;
+    uint32_t dropped;
+    uint32_t tier_changes;
+};
+
+// Seconds of the history, an hour.
+const size_t history_seconds = 3600;
+
+// Close the second since the previous call, or since the start, into the
+// history, replacing its oldest second once it is full. Called once a
+// second by a timer of the server.
+void sampleHistory();
+
+// The seconds of the history that end after the unix time `since`, oldest
+// first, as CSV under a header line.
+string renderHistory(uint32_t since);
+
+// Text exposition of everything recorded, in the Prometheus text format:
+// one "name{labels} value" per line, each family under its "# TYPE" line.
+// Besides the latencies, the utilization of each stage is the fraction of
+// the time since the start spent in it, summed over the threads running
+// it, so it may exceed 1 on a pool.
+string render();
+
+} // namespace Metrics
+
+// Records the lifetime of the scope into the histogram of a stage.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Stage stage)
+        : stage(stage), start(chrono::steady_clock::now()) {}
+    
+    ~ScopedTimer() {
+        auto elapsed = chrono::steady_clock::now() - start;
+        Metrics::stage(stage).record(chrono::duration_cast<chrono::microseconds>(elapsed).count());
+    }
+    
+private:
+    Stage stage;
+    chrono::steady_clock::time_point start;
+};
+
+// Times consecutive stages of one scope: each lap() records the time since
+// the previous lap (or construction) into the given stage.
+class StageClock {
+public:
+    StageClock() : last(chrono::steady_clock::now()) {}
+    
+    void lap(Stage stage) {
+        auto now = chrono::steady_clock::now();
+        Metrics::stage(stage).record(chrono::duration_cast<chrono::microseconds>(now - last).count());
+        last = now;
+    }
+    
+private:
+    chrono::steady_clock::time_point last;
+};
+
+#endif /* METRICS_H */
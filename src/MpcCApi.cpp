@@ -0,0 +1,184 @@
+#include "MpcCApi.h"
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Controller.h"
+#include "MPC.h"
+#include "TaskScheduler.h"
+
+using namespace std;
+
+struct MpcBatch {
+    mutex lock;
+    vector<unique_ptr<MPC> > idle;
+    atomic<size_t> horizon;
+
+    MpcBatch() : horizon(0) {}
+
+    // An MPC on the current horizon, idle or new.
+    unique_ptr<MPC> take() {
+        unique_ptr<MPC> mpc;
+        {
+            lock_guard<mutex> hold(lock);
+            if (!idle.empty()) {
+                mpc = std::move(idle.back());
+                idle.pop_back();
+            }
+        }
+        if (!mpc) {
+            mpc.reset(new MPC);
+            mpc->setWarmStart(true);
+            configureMpc(*mpc);
+        }
+        size_t N = horizon.load(memory_order_relaxed);
+        if (N != 0 && mpc->getHorizon() != N) {
+            mpc->setHorizon(N);
+        }
+        mpc->resetWarmStart();
+        return mpc;
+    }
+
+    void give(unique_ptr<MPC> mpc) {
+        lock_guard<mutex> hold(lock);
+        idle.push_back(std::move(mpc));
+    }
+};
+
+namespace {
+
+// Problems of an independent solve per task, so that the tasks outnumber
+// the threads and even out the problems that take longer.
+const size_t tasks_per_thread = 4;
+
+struct Outputs {
+    double *actuations;
+    int *status;
+    int *iterations;
+    double *objective;
+    double *xs;
+    double *ys;
+    size_t N;
+};
+
+void store(const Outputs &out, size_t i, const Solution &solution, const SolveStats &stats) {
+    if (out.actuations) {
+        out.actuations[2 * i] = solution.delta;
+        out.actuations[2 * i + 1] = solution.a;
+    }
+    if (out.status) {
+        out.status[i] = stats.status;
+    }
+    if (out.iterations) {
+        out.iterations[i] = stats.iterations;
+    }
+    if (out.objective) {
+        out.objective[i] = stats.objective;
+    }
+    if (out.xs && out.ys) {
+        for (size_t t = 0; t < out.N; t++) {
+            bool planned = t < solution.n_stages;
+            out.xs[i * out.N + t] = planned ? solution.stages[t].x : NAN;
+            out.ys[i * out.N + t] = planned ? solution.stages[t].y : NAN;
+        }
+    }
+}
+
+} // namespace
+
+MpcBatch *mpc_batch_new(void) {
+    MpcBatch *batch = new MpcBatch;
+    unique_ptr<MPC> mpc = batch->take();
+    batch->horizon.store(mpc->getHorizon());
+    batch->give(std::move(mpc));
+    return batch;
+}
+
+void mpc_batch_free(MpcBatch *batch) {
+    delete batch;
+}
+
+size_t mpc_batch_set_horizon(MpcBatch *batch, size_t N) {
+    if (!batch) {
+        return 0;
+    }
+    unique_ptr<MPC> mpc = batch->take();
+    bool ok = mpc->setHorizon(N);
+    if (ok) {
+        batch->horizon.store(N);
+    }
+    batch->give(std::move(mpc));
+    return ok ? N : 0;
+}
+
+size_t mpc_batch_horizon(const MpcBatch *batch) {
+    return batch ? batch->horizon.load() : 0;
+}
+
+long mpc_batch_solve(MpcBatch *batch, size_t n, const double *states, size_t state_stride,
+                     const double *coeffs, size_t coeff_stride, unsigned flags, double deadline_ms,
+                     double *actuations, int *status, int *iterations, double *objective, double *xs,
+                     double *ys) {
+    if (!batch) {
+        return -1;
+    }
+    Outputs out = {actuations, status, iterations, objective, xs, ys, batch->horizon.load()};
+    atomic<long> solved(0);
+
+    // Problems [begin, end) on one MPC, chained or each from a cold start.
+    auto solveRange = [&](size_t begin, size_t end) {
+        unique_ptr<MPC> mpc = batch->take();
+        long ok = 0;
+        if (flags & MPC_BATCH_RTI) {
+            vector<Eigen::VectorXd> xs0(end - begin), cs(end - begin);
+            for (size_t i = begin; i < end; i++) {
+                xs0[i - begin] = Eigen::Map<const StateVector>(states + i * state_stride);
+                cs[i - begin] = Eigen::Map<const CubicCoeffs>(coeffs + i * coeff_stride);
+            }
+            vector<vector<double> > first;
+            vector<SolveStats> stats;
+            mpc->SolveBatch(xs0, cs, first, stats);
+            Solution solution;
+            for (size_t i = begin; i < end; i++) {
+                solution.delta = first[i - begin][0];
+                solution.a = first[i - begin][1];
+                store(out, i, solution, stats[i - begin]);
+                ok += stats[i - begin].ok();
+            }
+        } else {
+            StateVector state;
+            CubicCoeffs cubic;
+            Solution solution;
+            for (size_t i = begin; i < end; i++) {
+                if (!(flags & MPC_BATCH_CHAIN)) {
+                    mpc->resetWarmStart();
+                }
+                state = Eigen::Map<const StateVector>(states + i * state_stride);
+                cubic = Eigen::Map<const CubicCoeffs>(coeffs + i * coeff_stride);
+                Deadline deadline = Deadline::max();
+                if (deadline_ms > 0) {
+                    deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(
+                                                                 chrono::duration<double, milli>(deadline_ms));
+                }
+                SolveStats stats;
+                mpc->Solve(state, cubic, stats, deadline, solution);
+                store(out, i, solution, stats);
+                ok += stats.ok();
+            }
+        }
+        batch->give(std::move(mpc));
+        solved.fetch_add(ok, memory_order_relaxed);
+    };
+
+    if (flags & MPC_BATCH_CHAIN || n == 0) {
+        solveRange(0, n);
+        return solved.load();
+    }
+    size_t tasks = min(n, TaskScheduler::instance().size() * tasks_per_thread);
+    auto solveTask = [&](size_t task) { solveRange(n * task / tasks, n * (task + 1) / tasks); };
+    TaskGroup group(TASK_LOW);
+    group.run(0, tasks, solveTask);
+    group.wait();
+    return solved.load();
+}
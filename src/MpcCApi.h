@@ -0,0 +1,62 @@
+#ifndef MPC_CAPI_H
+#define MPC_CAPI_H
+
+#include <stddef.h>
+
+// C entry points of the batch solves, built into libmpc_capi with
+// MPC_PYTHON and loaded by python/mpc_batch.py through ctypes, which lets
+// go of the GIL for the length of each call.
+//
+// The problems are read where the caller keeps them and the answers
+// written into its arrays: row i of `states` starts at states + i *
+// state_stride and holds x, y, psi, v, cte, epsi, row i of `coeffs` at
+// coeffs + i * coeff_stride the cubic c0..c3 in the vehicle frame, as
+// MPC::Solve takes them. Strides count doubles, so NumPy arrays of float64
+// rows are passed as they are.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Solve the problems with MPC::SolveBatch, whatever the backend: batched
+// RTI, cold, first actuations only.
+#define MPC_BATCH_RTI 1
+// Solve the problems in order on one MPC, each warm started from the
+// solution of the one before, for a sequence along one trajectory.
+// Otherwise they are independent, each starts cold.
+#define MPC_BATCH_CHAIN 2
+
+typedef struct MpcBatch MpcBatch;
+
+// MPCs set up from the environment like the controllers', see
+// configureMpc, on the default horizon. They are created as the solves
+// need them, one per thread solving at a time, and kept for the next.
+MpcBatch *mpc_batch_new(void);
+
+void mpc_batch_free(MpcBatch *batch);
+
+// Horizon of the next solves, see MPC::setHorizon; 0 if it is not one
+// compiled in, N otherwise.
+size_t mpc_batch_set_horizon(MpcBatch *batch, size_t N);
+
+size_t mpc_batch_horizon(const MpcBatch *batch);
+
+// Solve the n problems, spread over the threads of the TaskScheduler
+// unless chained, each with a deadline of `deadline_ms` if positive.
+// Writes the first actuations of problem i, delta then a, to
+// actuations[2i..2i+1], and its SolveStatus, iterations and objective to
+// the other arrays, any of which may be null. With `xs` and `ys`, the
+// plan of each problem from its initial state takes a row of
+// mpc_batch_horizon() entries, NaN past its stages. Returns the number of
+// problems solved ok, see SolveStats::ok, or -1 for a null batch.
+// Calls on the same batch may overlap.
+long mpc_batch_solve(MpcBatch *batch, size_t n, const double *states, size_t state_stride,
+                     const double *coeffs, size_t coeff_stride, unsigned flags, double deadline_ms,
+                     double *actuations, int *status, int *iterations, double *objective, double *xs,
+                     double *ys);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MPC_CAPI_H */
@@ -0,0 +1,147 @@
+#ifndef MPC_CONFIG_H
+#define MPC_CONFIG_H
+
+#include <cstddef>
+#include "VehicleModel.h"
+
+// Compile-time horizon of the MPC problem: N timesteps of dt_ms milliseconds.
+//
+// The solver takes all the state variables and actuator variables in a
+// singular vector. The offsets of each block only depend on the horizon, so
+// they are constants here and index computations fold down at compile time.
+template <size_t N_, size_t dt_ms_>
+struct MpcConfig {
+    static constexpr size_t N = N_;
+    static constexpr double dt = dt_ms_ / 1000.0;
+
+    static constexpr size_t x_start = 0;
+    static constexpr size_t y_start = x_start + N;
+    static constexpr size_t psi_start = y_start + N;
+    static constexpr size_t v_start = psi_start + N;
+    static constexpr size_t cte_start = v_start + N;
+    static constexpr size_t epsi_start = cte_start + N;
+    static constexpr size_t delta_start = epsi_start + N;
+
+    // One actuation per transition.
+    static constexpr size_t n_controls = N - 1;
+    static constexpr size_t a_start = delta_start + n_controls;
+
+    // Number of model variables (6 states for N timesteps and 2 actuators
+    // for N - 1 transitions) and constraints.
+    static constexpr size_t n_vars = N * 6 + n_controls * 2;
+    static constexpr size_t n_constraints = N * 6;
+
+    // Number of stages the actuation delay spans.
+    static constexpr size_t latency = actuation_delay_ms / dt_ms_;
+
+    // Every transition lasts dt, see GridConfig.
+    static constexpr bool uniform = true;
+    static constexpr double stageDt(size_t t) {
+        return dt;
+    }
+
+    // Index of the actuation applied in the transition into stage t.
+    static constexpr size_t controlIndex(size_t t) {
+        return (t > latency) ? t - 1 - latency : t - 1;
+    }
+};
+
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::N;
+template <size_t N_, size_t dt_ms_> constexpr double MpcConfig<N_, dt_ms_>::dt;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::x_start;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::y_start;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::psi_start;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::v_start;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::cte_start;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::epsi_start;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::delta_start;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::n_controls;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::a_start;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::n_vars;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::n_constraints;
+template <size_t N_, size_t dt_ms_> constexpr size_t MpcConfig<N_, dt_ms_>::latency;
+template <size_t N_, size_t dt_ms_> constexpr bool MpcConfig<N_, dt_ms_>::uniform;
+
+// Horizon on a non-uniform grid with move blocking: n_fine transitions of
+// dt_ms, each with its own actuation, then n_coarse transitions of
+// coarse_ms whose actuations are held over `block` transitions at a time.
+// It looks as far ahead as a uniform horizon with fewer variables, and
+// has the interface of MpcConfig: stageDt gives the length of each
+// transition and controlIndex the actuation it applies. The latency has
+// to fall within the fine transitions.
+template <size_t n_fine_, size_t n_coarse_, size_t block_, size_t dt_ms_, size_t coarse_ms_>
+struct GridConfig {
+    static constexpr size_t N = 1 + n_fine_ + n_coarse_;
+    // Length of the first transitions, see MPC::getTimeInterval.
+    static constexpr double dt = dt_ms_ / 1000.0;
+
+    static constexpr size_t x_start = 0;
+    static constexpr size_t y_start = x_start + N;
+    static constexpr size_t psi_start = y_start + N;
+    static constexpr size_t v_start = psi_start + N;
+    static constexpr size_t cte_start = v_start + N;
+    static constexpr size_t epsi_start = cte_start + N;
+    static constexpr size_t delta_start = epsi_start + N;
+
+    static constexpr size_t n_controls = n_fine_ + (n_coarse_ + block_ - 1) / block_;
+    static constexpr size_t a_start = delta_start + n_controls;
+
+    static constexpr size_t n_vars = N * 6 + n_controls * 2;
+    static constexpr size_t n_constraints = N * 6;
+
+    static constexpr size_t latency = actuation_delay_ms / dt_ms_;
+    static_assert(latency < n_fine_, "the latency has to fall within the fine transitions");
+
+    static constexpr bool uniform = false;
+
+    // Length of the transition into stage t.
+    static constexpr double stageDt(size_t t) {
+        return (t <= n_fine_ ? dt_ms_ : coarse_ms_) / 1000.0;
+    }
+
+    // Actuation of the j-th transition, j = 0 into stage 1.
+    static constexpr size_t moveIndex(size_t j) {
+        return j < n_fine_ ? j : n_fine_ + (j - n_fine_) / block_;
+    }
+
+    static constexpr size_t controlIndex(size_t t) {
+        return moveIndex((t > latency) ? t - 1 - latency : t - 1);
+    }
+};
+
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::N;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr double GridConfig<f, c, b, d, cd>::dt;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::x_start;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::y_start;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::psi_start;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::v_start;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::cte_start;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::epsi_start;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::delta_start;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::n_controls;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::a_start;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::n_vars;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::n_constraints;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr size_t GridConfig<f, c, b, d, cd>::latency;
+template <size_t f, size_t c, size_t b, size_t d, size_t cd> constexpr bool GridConfig<f, c, b, d, cd>::uniform;
+
+// Set the timestep length and duration
+typedef MpcConfig<10, 100> DefaultConfig;
+
+// Further horizons the solvers are compiled for, see MPC::setHorizon.
+typedef MpcConfig<15, 100> MediumConfig;
+typedef MpcConfig<20, 100> LongConfig;
+
+// 2 s ahead like LongConfig, in 14 stages: 6 transitions of 100 ms, then 7
+// of 200 ms with each actuation held over two of them. 104 variables
+// instead of 158. Selected with N = 14 by MPC::setHorizon; it is not one
+// of the compiled_horizons below, MPC_ADAPTIVE_HORIZON does not use it,
+// and it does not run with SQP_RTI.
+typedef GridConfig<6, 7, 2, 100, 200> BlockedConfig;
+
+// All of the horizons above, shortest first, and the longest of them.
+static const size_t n_compiled_horizons = 3;
+static const size_t compiled_horizons[n_compiled_horizons] = {DefaultConfig::N, MediumConfig::N, LongConfig::N};
+static const size_t max_horizon = LongConfig::N;
+
+#endif /* MPC_CONFIG_H */
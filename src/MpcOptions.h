@@ -0,0 +1,104 @@
+#ifndef MPC_OPTIONS_H
+#define MPC_OPTIONS_H
+
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+// How the SQP_RTI backend solves its QP steps: in stage form by Riccati
+// where the grid allows it and condensed otherwise, always condensed by the
+// active-set method with its working set carried from solve to solve, or
+// as a sparse QP in the states and actuations, see RtiSolver.
+enum RtiQp { RTI_QP_DEFAULT, RTI_QP_ACTIVE_SET, RTI_QP_SPARSE };
+
+// Path tracking law of the GEOMETRIC backend, see geometricControl.
+enum GeometricLaw { GEOMETRIC_PURSUIT, GEOMETRIC_STANLEY };
+
+// IPOPT settings of the IPOPT backends, plus the few of the others. Empty
+// strings keep IPOPT's own default, the IPOPT numbers default to IPOPT's.
+struct MpcOptions {
+    // ma27, ma57, mumps, pardiso, ...; the HSL and Pardiso solvers have to
+    // be linked into IPOPT.
+    string linear_solver;
+    // monotone or adaptive.
+    string mu_strategy;
+    double tol = 1e-8;
+    double acceptable_tol = 1e-6;
+    // Exact Lagrangian Hessian, or IPOPT's limited-memory quasi-Newton
+    // approximation without eval_h.
+    bool exact_hessian = true;
+    // Least distance, relative and absolute, of the initial point from its
+    // bounds, see IPOPT's bound_push and bound_frac, which take it both.
+    double bound_push = 0.01;
+    // Scale the KINEMATIC_IPOPT problem by the physical ranges of its
+    // blocks, see KinematicNLP::get_scaling_parameters, rather than by
+    // IPOPT's gradient-based default.
+    bool user_scaling = false;
+    // Workers of the TaskScheduler, besides the solving thread, evaluating
+    // chunks of the stages of the kinematic backend's constraints and
+    // derivatives, or of the rollouts of MPPI, see StagePool. Only worth it
+    // for long horizons or many samples; 0 keeps it serial.
+    size_t eval_threads = 0;
+    // Rollouts per MPPI iteration, see MppiSolver::setSamples.
+    size_t mppi_samples = 1024;
+    // Roll MPPI out on the GPU, in builds with MPC_CUDA, see GpuRollout.h.
+    bool mppi_gpu = false;
+    // GMRES directions of each CGMRES solve, see
+    // CgmresSolver::setDirections.
+    int cgmres_directions = 4;
+    // Entries of the library of converged solves seeding a solve without
+    // a fitting previous plan, per horizon, see WarmStartLibrary; 0 turns
+    // it off.
+    size_t warm_library = 0;
+    // Entries of the cache of converged solutions returned as they are for
+    // the same problem again, per horizon, see SolutionCache; 0 turns it
+    // off. Emptied whenever the problem changes, unlike the library.
+    size_t solution_cache = 0;
+    // Concurrent KINEMATIC_IPOPT solves per cycle, each from another guess
+    // (the usual one, then the shifted previous plan, the LQR rollout, the
+    // library and zeros, those not taken yet), on as many threads. The
+    // first to converge is taken and the others are stopped at their next
+    // iteration. 1 solves from the usual guess alone.
+    size_t multi_start = 1;
+    // SQP iterations of each SQP_RTI solve, see RtiSolver::setIterations;
+    // more than the real-time iteration only pays from a cold start.
+    int rti_iterations = 1;
+    // QP of each SQP_RTI step, see RtiSolver.
+    RtiQp rti_qp = RTI_QP_DEFAULT;
+    // After every converged solve, compute the sensitivity of its first
+    // actuations to the initial state and the reference, for MPC::Predict
+    // to correct them without solving. Costs about one RTI iteration.
+    bool predictor = false;
+    // Solve the SQP_RTI and MPPI backends in float instead of double. The
+    // batched RTI solves of MPC::SolveBatch stay in double.
+    bool single_precision = false;
+    // Law of the GEOMETRIC backend.
+    GeometricLaw geometric_law = GEOMETRIC_PURSUIT;
+    // Split the objective of every solve by term, see
+    // SolveStats::cost_terms: the terms of addCost evaluated once more on
+    // the solution, in double, after the solve.
+    bool cost_breakdown = false;
+    // Add the LQR cost-to-go of the speed bucket of the initial speed to
+    // the last stage, see LqrSchedule::terminalCost, so a shorter horizon
+    // tracks as well. CPPAD_IPOPT and TAPED_IPOPT in multiple shooting,
+    // and the objective GEOMETRIC reports.
+    bool terminal_cost = false;
+    // Exact L1 penalty per unit of slack on the cte and epsi dynamics of
+    // KINEMATIC_IPOPT, see KinematicNLP::setSoftPenalty; 0 keeps them hard.
+    double soft_penalty = 0;
+    // Order the variables of KINEMATIC_IPOPT stage by stage for IPOPT, the
+    // states of each stage followed by its actuations, and its rows by
+    // transition, see KinematicNLP::setInterleaved, rather than by block.
+    bool interleaved_layout = false;
+    // Stop the KINEMATIC_IPOPT and TAPED_IPOPT backends early, with
+    // SOLVE_CONTROL_CONVERGED, once the first steering and throttle, the
+    // only actuations applied, moved by less than this at
+    // control_iterations iterations in a row at a feasible iterate, see
+    // DeadlineTNLP::setControlConvergence; 0 runs every solve to `tol`. The
+    // rest of the plan, which seeds the next solve, is left less converged.
+    double control_tol = 0;
+    int control_iterations = 2;
+};
+
+#endif /* MPC_OPTIONS_H */
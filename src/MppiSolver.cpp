@@ -0,0 +1,343 @@
+#include "MppiSolver.h"
+#include <algorithm>
+#include <cmath>
+#include "FG_eval.h"
+#include "Logger.h"
+
+template <typename Config, typename Scalar>
+const int MppiSolver<Config, Scalar>::n_inputs;
+
+template <typename Config, typename Scalar>
+const int MppiSolver<Config, Scalar>::lanes;
+
+// Blocks worth handing to another thread.
+static const size_t min_parallel_blocks = 4;
+
+// Standard normal deviate determined by (seed, sample, input): SplitMix64
+// of the three, split into two uniforms for Box-Muller.
+static inline double gaussian(uint64_t seed, uint64_t sample, uint64_t input) {
+    uint64_t z = seed * 0x9E3779B97F4A7C15ULL + sample * 0xBF58476D1CE4E5B9ULL + input * 0x94D049BB133111EBULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    double u1 = ((z >> 32) + 1.0) / 4294967296.0;
+    double u2 = (z & 0xFFFFFFFFULL) / 4294967296.0;
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+template <typename Config, typename Scalar>
+MppiSolver<Config, Scalar>::MppiSolver()
+    : speeds(constantSpeeds()), iterations(4), n_blocks(0), sigma_delta(0.1), sigma_a(1.0), temperature(0.15), n_solves(0) {
+    setSamples(1024);
+}
+
+template <typename Config, typename Scalar>
+void MppiSolver<Config, Scalar>::setSamples(size_t n_samples) {
+    size_t blocks = max((n_samples + lanes - 1) / lanes, (size_t) 1);
+    if (blocks == n_blocks) {
+        return;
+    }
+    n_blocks = blocks;
+    samples.assign(n_blocks * n_inputs * lanes, Scalar(0));
+    costs.assign(n_blocks * lanes, Scalar(0));
+#ifdef MPC_CUDA
+    if (gpu) {
+        gpu.reset();
+        setGpu(true);
+    }
+#endif
+}
+
+template <typename Config, typename Scalar>
+void MppiSolver<Config, Scalar>::setGpu(bool enabled) {
+#ifdef MPC_CUDA
+    if (!enabled) {
+        gpu.reset();
+    } else if (!gpu) {
+        gpu.reset(new GpuRollout(n_blocks * lanes));
+        if (!gpu->ready()) {
+            MPC_LOG(LOG_WARN, "No CUDA device for the MPPI rollouts, rolling out on the CPU");
+            gpu.reset();
+        }
+    }
+#else
+    if (enabled) {
+        MPC_LOG(LOG_WARN, "MPC_MPPI_GPU needs a build with MPC_CUDA, rolling out on the CPU");
+    }
+#endif
+}
+
+template <typename Config, typename Scalar>
+void MppiSolver<Config, Scalar>::setThreads(size_t n_helpers) {
+    if (n_helpers == (pool ? pool->size() : 0)) {
+        return;
+    }
+    pool.reset(n_helpers > 0 ? new StagePool(n_helpers) : nullptr);
+}
+
+template <typename Config, typename Scalar>
+void MppiSolver<Config, Scalar>::perturb(uint64_t seed, size_t b) {
+    const int L = lanes;
+    Scalar *in = &samples[b * n_inputs * L];
+    // Sample 0 is the guess itself, so the update never does worse than
+    // the best of the samples.
+    for (int i = 0; i < n_inputs; i++) {
+        double sigma = i % 2 == 0 ? sigma_delta : sigma_a;
+        for (int l = 0; l < L; l++) {
+            size_t k = b * L + l;
+            Scalar noise = k == 0 ? 0.0 : sigma * gaussian(seed, k, i);
+            in[i * L + l] = min(max(u[i] + noise, lb[i]), ub[i]);
+        }
+    }
+}
+
+template <typename Config, typename Scalar>
+void MppiSolver<Config, Scalar>::rollout(uint64_t seed, size_t begin, size_t end) {
+    switch (poly.size()) {
+    case 2:
+        rolloutDegree<2>(seed, begin, end);
+        break;
+    case 3:
+        rolloutDegree<3>(seed, begin, end);
+        break;
+    case 4:
+        rolloutDegree<4>(seed, begin, end);
+        break;
+    case 5:
+        rolloutDegree<5>(seed, begin, end);
+        break;
+    case 6:
+        rolloutDegree<6>(seed, begin, end);
+        break;
+    default:
+        rolloutDegree<Eigen::Dynamic>(seed, begin, end);
+    }
+}
+
+template <typename Config, typename Scalar>
+template <int n_fixed>
+void MppiSolver<Config, Scalar>::rolloutDegree(uint64_t seed, size_t begin, size_t end) {
+    const int L = lanes;
+    const size_t n_coeffs = n_fixed == Eigen::Dynamic ? poly.size() : n_fixed;
+    const Scalar lf = Lf;
+    const Scalar w_cte = weights.cte, w_epsi = weights.epsi, w_v = weights.v;
+    for (size_t b = begin; b < end; b++) {
+        perturb(seed, b);
+        const Scalar *in = &samples[b * n_inputs * L];
+        Scalar *cost = &costs[b * L];
+
+        Scalar s[6][L];
+        for (int l = 0; l < L; l++) {
+            for (int k = 0; k < 6; k++) {
+                s[k][l] = initial[k];
+            }
+            cost[l] = w_cte * square(s[4][l]) + w_epsi * square(s[5][l]) + w_v * square(s[3][l] - Scalar(speeds[0]));
+        }
+
+        // vehicleStep on all lanes at once.
+        for (int t = 1; t < N; t++) {
+            int j = Config::controlIndex(t);
+            const Scalar *delta = &in[deltaIndex(j) * L];
+            const Scalar *a = &in[aIndex(j) * L];
+            const Scalar dt = Config::stageDt(t);
+            const Scalar v_ref = speeds[t];
+            for (int l = 0; l < L; l++) {
+                Scalar x0 = s[0][l], y0 = s[1][l], psi0 = s[2][l], v0 = s[3][l], epsi0 = s[5][l];
+                Scalar f0 = 0, slope = 0;
+                for (size_t c = n_coeffs; c-- > 0;) {
+                    slope = slope * x0 + f0;
+                    f0 = f0 * x0 + poly[c];
+                }
+                Scalar turn = (v0 / lf) * delta[l] * dt;
+                s[0][l] = x0 + v0 * modelCos(psi0) * dt;
+                s[1][l] = x0 + v0 * modelSin(psi0) * dt;
+                s[2][l] = psi0 + turn;
+                s[3][l] = v0 + a[l] * dt;
+                s[4][l] = (f0 - y0) + v0 * modelSin(epsi0) * dt;
+                s[5][l] = (psi0 - modelAtan(slope)) + turn;
+                cost[l] += w_cte * square(s[4][l]) + w_epsi * square(s[5][l]) + w_v * square(s[3][l] - v_ref);
+            }
+        }
+
+        const Scalar w_delta = weights.delta, w_a = weights.a, w_ddelta = weights.ddelta, w_da = weights.da;
+        for (int j = 0; j < n_controls; j++) {
+            const Scalar *delta = &in[deltaIndex(j) * L];
+            const Scalar *a = &in[aIndex(j) * L];
+            for (int l = 0; l < L; l++) {
+                cost[l] += w_delta * square(delta[l]) + w_a * square(a[l]);
+            }
+        }
+        for (int j = 0; j + 1 < n_controls; j++) {
+            const Scalar *delta = &in[deltaIndex(j) * L];
+            const Scalar *a = &in[aIndex(j) * L];
+            for (int l = 0; l < L; l++) {
+                cost[l] += w_ddelta * square(delta[2 * L + l] - delta[l]) + w_da * square(a[2 * L + l] - a[l]);
+            }
+        }
+    }
+}
+
+template <typename Config, typename Scalar>
+bool MppiSolver<Config, Scalar>::gpuRollout(uint64_t seed, double &best, double &total, size_t &finite) {
+#ifdef MPC_CUDA
+    if (!gpu) {
+        return false;
+    }
+    auto shard = [this, seed](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; b++) {
+            perturb(seed, b);
+        }
+    };
+    if (pool) {
+        pool->run(0, n_blocks, min_parallel_blocks, shard);
+    } else {
+        shard(0, n_blocks);
+    }
+
+    RolloutProblem problem;
+    setHorizon<Config>(problem);
+    for (int k = 0; k < 6; k++) {
+        problem.initial[k] = initial[k];
+    }
+    problem.n_coeffs = poly.size();
+    for (int c = 0; c < problem.n_coeffs && c < gpu_max_coeffs; c++) {
+        problem.coeffs[c] = poly[c];
+    }
+    problem.weights = weights;
+    for (size_t t = 0; t < Config::N; t++) {
+        problem.ref_v[t] = speeds[t];
+    }
+    if (gpu->costs(problem, samples.data(), n_blocks * lanes, lanes, costs.data(), best, total, finite)) {
+        return true;
+    }
+    MPC_LOG(LOG_WARN, "CUDA rollout failed, rolling out on the CPU from now on");
+    gpu.reset();
+    best = INFINITY;
+    total = 0;
+    finite = 0;
+#endif
+    return false;
+}
+
+template <typename Config, typename Scalar>
+double MppiSolver<Config, Scalar>::simulate(Dvector &x) const {
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    Scalar s[6];
+    for (int k = 0; k < 6; k++) {
+        s[k] = initial[k];
+    }
+    double cost = 0;
+    for (int t = 0; t < N; t++) {
+        if (t > 0) {
+            int j = Config::controlIndex(t);
+            Scalar next[6];
+            vehicleStepDegree<Scalar>(s, u[deltaIndex(j)], u[aIndex(j)], poly, Config::stageDt(t), next, nullptr,
+                                      nullptr);
+            for (int k = 0; k < 6; k++) {
+                s[k] = next[k];
+            }
+        }
+        for (int k = 0; k < 6; k++) {
+            x[starts[k] + t] = s[k];
+        }
+        cost += weights.cte * square<double>(s[4]) + weights.epsi * square<double>(s[5]) +
+                weights.v * square<double>(s[3] - speeds[t]);
+    }
+    for (int j = 0; j < n_controls; j++) {
+        x[delta_start + j] = u[deltaIndex(j)];
+        x[a_start + j] = u[aIndex(j)];
+        cost += weights.delta * square<double>(u[deltaIndex(j)]) + weights.a * square<double>(u[aIndex(j)]);
+    }
+    for (int j = 0; j + 1 < n_controls; j++) {
+        cost += weights.ddelta * square<double>(u[deltaIndex(j + 1)] - u[deltaIndex(j)]) +
+                weights.da * square<double>(u[aIndex(j + 1)] - u[aIndex(j)]);
+    }
+    return cost;
+}
+
+template <typename Config, typename Scalar>
+void MppiSolver<Config, Scalar>::solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+                               const Dvector &gl, const Dvector &gu,
+                               const Eigen::VectorXd &coeffs, SolveResult &solution, SolveStats &stats) {
+    // The initial state is fixed by the constraint bounds.
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    for (int k = 0; k < 6; k++) {
+        initial[k] = gl[starts[k]];
+    }
+    for (int j = 0; j < n_controls; j++) {
+        u[deltaIndex(j)] = xi[delta_start + j];
+        u[aIndex(j)] = xi[a_start + j];
+        lb[deltaIndex(j)] = xl[delta_start + j];
+        lb[aIndex(j)] = xl[a_start + j];
+        ub[deltaIndex(j)] = xu[delta_start + j];
+        ub[aIndex(j)] = xu[a_start + j];
+    }
+    for (int i = 0; i < n_inputs; i++) {
+        u[i] = min(max(u[i], lb[i]), ub[i]);
+    }
+    poly = coeffs.template cast<Scalar>();
+
+    const int L = lanes;
+    const size_t n_samples = n_blocks * L;
+    bool ok = true;
+    for (int it = 0; it < iterations; it++) {
+        uint64_t seed = n_solves++;
+        double best = INFINITY, total = 0;
+        size_t finite = 0;
+        if (!gpuRollout(seed, best, total, finite)) {
+            auto shard = [this, seed](size_t begin, size_t end) { rollout(seed, begin, end); };
+            if (pool) {
+                pool->run(0, n_blocks, min_parallel_blocks, shard);
+            } else {
+                shard(0, n_blocks);
+            }
+            for (size_t k = 0; k < n_samples; k++) {
+                if (std::isfinite(costs[k])) {
+                    best = min(best, (double) costs[k]);
+                    total += costs[k];
+                    finite++;
+                }
+            }
+        }
+        if (finite == 0) {
+            ok = false;
+            break;
+        }
+        double lambda = temperature * (total / finite - best);
+
+        double norm = 0;
+        double next[n_inputs] = {};
+        for (size_t b = 0; b < n_blocks; b++) {
+            const Scalar *in = &samples[b * n_inputs * L];
+            for (int l = 0; l < L; l++) {
+                double cost = costs[b * L + l];
+                if (!std::isfinite(cost)) {
+                    continue;
+                }
+                double w = lambda > 0 ? exp(-(cost - best) / lambda) : (cost == best ? 1.0 : 0.0);
+                norm += w;
+                for (int i = 0; i < n_inputs; i++) {
+                    next[i] += w * in[i * L + l];
+                }
+            }
+        }
+        for (int i = 0; i < n_inputs; i++) {
+            u[i] = next[i] / norm;
+        }
+    }
+
+    solution.x.resize(n_vars);
+    solution.obj_value = simulate(solution.x);
+
+    finishRolledOut(gl, n_vars, ok, iterations, solution, stats);
+}
+
+// Horizons the controller is built for, in both precisions.
+template class MppiSolver<DefaultConfig>;
+template class MppiSolver<MediumConfig>;
+template class MppiSolver<LongConfig>;
+template class MppiSolver<BlockedConfig>;
+template class MppiSolver<DefaultConfig, float>;
+template class MppiSolver<MediumConfig, float>;
+template class MppiSolver<LongConfig, float>;
+template class MppiSolver<BlockedConfig, float>;
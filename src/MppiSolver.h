@@ -0,0 +1,145 @@
+#ifndef MPPI_SOLVER_H
+#define MPPI_SOLVER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "CostWeights.h"
+#include "Eigen-3.3/Eigen/Core"
+#ifdef MPC_CUDA
+#include "GpuRollout.h"
+#endif
+#include "MpcConfig.h"
+#include "NLPTypes.h"
+#include "SpeedProfile.h"
+#include "StagePool.h"
+
+// Samples rolled out together in double precision, one slot of each
+// structure-of-arrays block; a float block has twice as many.
+static const int mppi_lanes = 8;
+
+// Model Predictive Path Integral control for the kinematic model of
+// FG_eval: every solve perturbs the actuations of the initial guess (the
+// shifted previous solution when warm starting) with Gaussian noise, rolls
+// each sample out from the initial state, and takes the average of the
+// samples weighted by exp(-(cost - min cost) / lambda). lambda is the
+// temperature times the mean excess cost of the samples, so it follows the
+// scale of the weights.
+//
+// The samples are rolled out `lanes` at a time with the states of a
+// block in structure-of-arrays layout, so the model is evaluated on whole
+// SIMD packets, and the blocks are sharded over a StagePool with
+// setThreads. The noise is a hash of the solve, the sample and the
+// actuation, so the result does not depend on the sharding. The work per
+// solve is fixed by the number of samples, whatever the problem.
+//
+// With setGpu in an MPC_CUDA build the samples are drawn as above and the
+// rollouts and their cost reductions run on the GPU instead, see
+// GpuRollout.h.
+//
+// No constraints are handled besides the actuation bounds the samples are
+// clamped to; the returned trajectory satisfies the dynamics exactly.
+//
+// `Scalar` is the precision of the samples and the rollouts. The weighted
+// average and the returned trajectory's objective are summed in double.
+template <typename Config, typename Scalar = double>
+class MppiSolver : private Config {
+    using Config::N;
+    using Config::n_controls;
+    using Config::x_start;
+    using Config::y_start;
+    using Config::psi_start;
+    using Config::v_start;
+    using Config::cte_start;
+    using Config::epsi_start;
+    using Config::delta_start;
+    using Config::a_start;
+    using Config::n_vars;
+    using Config::n_constraints;
+
+public:
+    static const int n_inputs = 2 * Config::n_controls;
+    // Samples per block, the same packet width in bytes for either Scalar.
+    static const int lanes = mppi_lanes * sizeof(double) / sizeof(Scalar);
+
+    MppiSolver();
+
+    void setCostWeights(const CostWeights &weights) { this->weights = weights; }
+
+    // See FG_eval::speeds.
+    void setReferenceSpeeds(const StageSpeeds &speeds) { this->speeds = speeds; }
+
+    // Samples per iteration, rounded up to whole blocks of `lanes`, the
+    // first of them being the unperturbed guess.
+    void setSamples(size_t samples);
+
+    // Updates of the actuations per solve, 4 by default and carried on by
+    // the warm start across cycles.
+    void setIterations(int iterations) { this->iterations = iterations; }
+
+    // Roll out on `n_helpers` threads besides the calling one.
+    void setThreads(size_t n_helpers);
+
+    // Roll out on the first CUDA device, if built with MPC_CUDA and there is
+    // one; on the CPU otherwise, and from the first failure of the device.
+    void setGpu(bool enabled);
+
+    // Same contract as CppAD::ipopt::solve. stats.iterations counts the
+    // updates of the actuations.
+    void solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+               const Dvector &gl, const Dvector &gu,
+               const Eigen::VectorXd &coeffs, SolveResult &solution, SolveStats &stats);
+
+private:
+    CostWeights weights;
+    StageSpeeds speeds;
+    int iterations;
+    size_t n_blocks;
+    // Standard deviation of the noise of the steering and the throttle, and
+    // the temperature, see the class comment. Tuned to hold the lake track
+    // with mpc_sim -S from every start.
+    double sigma_delta;
+    double sigma_a;
+    double temperature;
+    // Solves so far, seeding the noise.
+    uint64_t n_solves;
+    unique_ptr<StagePool> pool;
+#ifdef MPC_CUDA
+    unique_ptr<GpuRollout> gpu;
+#endif
+
+    // Guess and bounds of the actuations, delta and a interleaved per move,
+    // and the problem of the solve.
+    Scalar u[n_inputs];
+    Scalar lb[n_inputs];
+    Scalar ub[n_inputs];
+    Scalar initial[6];
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 1> poly;
+
+    // Actuations of every sample, block by block, each actuation a packet
+    // of `lanes` values, and the cost of every sample.
+    vector<Scalar> samples;
+    vector<Scalar> costs;
+
+    // Draw the samples of block `b` around `u`.
+    void perturb(uint64_t seed, size_t b);
+
+    // Perturb and roll out the samples of blocks [begin, end), by
+    // rolloutDegree for the size of `poly`.
+    void rollout(uint64_t seed, size_t begin, size_t end);
+
+    // rollout with `n_fixed` coefficients fixed at compile time, so the
+    // Horner loop of every lane unrolls, or Eigen::Dynamic for poly.size().
+    template <int n_fixed>
+    void rolloutDegree(uint64_t seed, size_t begin, size_t end);
+
+    // Perturb every block and roll them out on the GPU, into `costs` and
+    // their reductions. False, with nothing rolled out, without a GPU.
+    bool gpuRollout(uint64_t seed, double &best, double &total, size_t &finite);
+
+    // The model from `initial` under `u`, into the stages of `x`, and the
+    // cost of that trajectory.
+    double simulate(Dvector &x) const;
+};
+
+#endif /* MPPI_SOLVER_H */
@@ -0,0 +1,331 @@
+#ifndef NLP_TYPES_H
+#define NLP_TYPES_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <coin/IpIpoptApplication.hpp>
+#include <coin/IpIpoptCalculatedQuantities.hpp>
+#include <coin/IpIpoptData.hpp>
+#include <coin/IpOrigIpoptNLP.hpp>
+#include <coin/IpTNLP.hpp>
+#include <coin/IpTNLPAdapter.hpp>
+#include <coin/IpTimingStatistics.hpp>
+#include <cppad/ipopt/solve.hpp>
+#include "MPC.h"
+#include "MpcOptions.h"
+#include "TaskScheduler.h"
+
+// Vector and result types shared by all IPOPT backends, so that MPC::Solve
+// reads the solution the same way whichever backend produced it. A plain
+// std::vector rather than CppAD's, whose memory belongs to the thread that
+// allocated it, see CppadThreads.h.
+typedef vector<double> Dvector;
+typedef CppAD::ipopt::solve_result<Dvector> SolveResult;
+
+// Same mapping as CppAD's own ipopt solve_callback.
+inline SolveResult::status_type toStatus(Ipopt::SolverReturn status) {
+    switch (status) {
+        case Ipopt::SUCCESS:
+            return SolveResult::success;
+        case Ipopt::MAXITER_EXCEEDED:
+            return SolveResult::maxiter_exceeded;
+        case Ipopt::STOP_AT_TINY_STEP:
+            return SolveResult::stop_at_tiny_step;
+        case Ipopt::STOP_AT_ACCEPTABLE_POINT:
+            return SolveResult::stop_at_acceptable_point;
+        case Ipopt::LOCAL_INFEASIBILITY:
+            return SolveResult::local_infeasibility;
+        case Ipopt::USER_REQUESTED_STOP:
+            return SolveResult::user_requested_stop;
+        case Ipopt::DIVERGING_ITERATES:
+            return SolveResult::diverging_iterates;
+        case Ipopt::RESTORATION_FAILURE:
+            return SolveResult::restoration_failure;
+        case Ipopt::ERROR_IN_STEP_COMPUTATION:
+            return SolveResult::error_in_step_computation;
+        case Ipopt::INVALID_NUMBER_DETECTED:
+            return SolveResult::invalid_number_detected;
+        case Ipopt::INTERNAL_ERROR:
+            return SolveResult::internal_error;
+        default:
+            return SolveResult::unknown;
+    }
+}
+
+// Actuation columns of the control vector of the solvers that roll the
+// model out, RtiSolver, MppiSolver and CgmresSolver: delta and a
+// interleaved per move.
+inline int deltaIndex(int j) { return 2 * j; }
+inline int aIndex(int j) { return 2 * j + 1; }
+
+// The rest of the result for a trajectory rolled out through the model,
+// whose stages `solution.x` the solver filled: it satisfies the dynamics,
+// so g sits on its bounds `gl`, the initial state for the first stage and
+// zero defects after, and no multipliers are estimated.
+inline void fillRolledOut(const Dvector &gl, size_t n_vars, SolveResult &solution) {
+    size_t n_constraints = gl.size();
+    solution.g.resize(n_constraints);
+    for (size_t i = 0; i < n_constraints; i++) {
+        solution.g[i] = gl[i];
+    }
+    solution.zl.resize(n_vars);
+    solution.zu.resize(n_vars);
+    for (size_t i = 0; i < n_vars; i++) {
+        solution.zl[i] = solution.zu[i] = 0.0;
+    }
+    solution.lambda.resize(n_constraints);
+    for (size_t i = 0; i < n_constraints; i++) {
+        solution.lambda[i] = 0.0;
+    }
+}
+
+// fillRolledOut, then the status of a solve without an iteration limit:
+// a success if it went `ok` and its objective is finite, a failure
+// otherwise.
+inline void finishRolledOut(const Dvector &gl, size_t n_vars, bool ok, int iterations, SolveResult &solution,
+                            SolveStats &stats) {
+    fillRolledOut(gl, n_vars, solution);
+    ok = ok && std::isfinite(solution.obj_value);
+    solution.status = ok ? SolveResult::success : SolveResult::unknown;
+    stats.status = ok ? SOLVE_SUCCESS : SOLVE_FAILED;
+    stats.iterations = iterations;
+    stats.cpu_time_exceeded = false;
+}
+
+// Time limit applied when the caller does not set a deadline.
+const double max_solve_time = 0.5;
+
+// Largest constraint violation of an iterate taken as it is, IPOPT's
+// default constr_viol_tol.
+const double feasible_violation = 1e-4;
+
+// An Ipopt::TNLP that asks IPOPT to stop once a wall-clock deadline has
+// passed, or once another thread raises its cancel token. IPOPT then
+// finalizes with the current iterate and returns User_Requested_Stop.
+// The same callback records each iteration into an IterationTrace if set,
+// and may stop IPOPT once the first actuations settled, see
+// setControlConvergence. The evaluation callbacks time themselves with
+// an EvalTimer, see evalTime.
+class DeadlineTNLP : public Ipopt::TNLP {
+public:
+    DeadlineTNLP()
+        : deadline(Deadline::max()), deadline_hit(false), restoration_iterations(0), eval_time(0), cancel(nullptr),
+          trace(nullptr), control_tol(0), control_iterations(0), delta_index(0), a_index(0),
+          control_converged(false), settled(0) {}
+    
+    // Before each solve, which also starts its trace.
+    void setDeadline(Deadline deadline) {
+        this->deadline = deadline;
+        deadline_hit = false;
+        restoration_iterations = 0;
+        eval_time = 0;
+        control_converged = false;
+        settled = 0;
+        if (trace) {
+            trace->clear();
+        }
+    }
+    
+    // Stop once the first steering and throttle, see setFirstControls,
+    // moved by less than `tol` at each of `iterations` iterations in a
+    // row, at an iterate within feasible_violation of the constraints.
+    // Only those reach the car; the rest of the plan converging does not
+    // change them any more. A `tol` of 0 turns it off, see
+    // MpcOptions::control_tol.
+    void setControlConvergence(double tol, int iterations) {
+        control_tol = tol;
+        control_iterations = iterations;
+    }
+    
+    // The variables of the first steering and throttle, before each solve
+    // with setControlConvergence.
+    void setFirstControls(Ipopt::Index delta_index, Ipopt::Index a_index) {
+        this->delta_index = delta_index;
+        this->a_index = a_index;
+    }
+    
+    // Whether the last solve was stopped by setControlConvergence.
+    bool controlConverged() const { return control_converged; }
+    
+    // Token checked once per iteration, null for none. It has to outlive
+    // the solves it is set for.
+    void setCancel(const CancelToken *cancel) { this->cancel = cancel; }
+    
+    // Trace the iterations into, null for none, see MPC::setIterationTrace.
+    void setIterationTrace(IterationTrace *trace) { this->trace = trace; }
+    
+    // Whether the last solve was stopped by the deadline.
+    bool deadlineHit() const { return deadline_hit; }
+    
+    // Iterations of the last solve in IPOPT's restoration phase.
+    int restorationIterations() const { return restoration_iterations; }
+    
+    // Wall time of the last solve in the evaluation callbacks, in s.
+    double evalTime() const { return eval_time; }
+    
+    bool intermediate_callback(Ipopt::AlgorithmMode mode, Ipopt::Index iter, Ipopt::Number obj_value,
+                               Ipopt::Number inf_pr, Ipopt::Number inf_du, Ipopt::Number mu,
+                               Ipopt::Number d_norm, Ipopt::Number regularization_size,
+                               Ipopt::Number alpha_du, Ipopt::Number alpha_pr, Ipopt::Index ls_trials,
+                               const Ipopt::IpoptData *ip_data, Ipopt::IpoptCalculatedQuantities *ip_cq) {
+        restoration_iterations += mode == Ipopt::RestorationPhaseMode;
+        if (trace) {
+            IterationRecord record;
+            record.iteration = iter;
+            record.restoration = mode == Ipopt::RestorationPhaseMode;
+            record.objective = obj_value;
+            record.inf_pr = inf_pr;
+            record.inf_du = inf_du;
+            record.mu = mu;
+            record.alpha_pr = alpha_pr;
+            record.alpha_du = alpha_du;
+            record.elapsed = chrono::duration<double>(chrono::steady_clock::now() - trace->start).count();
+            trace->add(record);
+        }
+        if (deadline != Deadline::max() && chrono::steady_clock::now() >= deadline) {
+            deadline_hit = true;
+            return false;
+        }
+        if (control_tol > 0 && mode == Ipopt::RegularMode && controlsSettled(ip_data, ip_cq, inf_pr)) {
+            control_converged = true;
+            return false;
+        }
+        return cancel == nullptr || !cancel->cancelled();
+    }
+    
+protected:
+    // Adds the lifetime of its scope to evalTime, at the top of every
+    // eval_* callback.
+    class EvalTimer {
+    public:
+        explicit EvalTimer(DeadlineTNLP &nlp) : nlp(nlp), start(chrono::steady_clock::now()) {}
+        
+        ~EvalTimer() { nlp.eval_time += chrono::duration<double>(chrono::steady_clock::now() - start).count(); }
+        
+    private:
+        DeadlineTNLP &nlp;
+        chrono::steady_clock::time_point start;
+    };
+    
+private:
+    Deadline deadline;
+    bool deadline_hit;
+    int restoration_iterations;
+    double eval_time;
+    const CancelToken *cancel;
+    IterationTrace *trace;
+    double control_tol;
+    int control_iterations;
+    Ipopt::Index delta_index;
+    Ipopt::Index a_index;
+    bool control_converged;
+    // Iterations in a row the first actuations settled at, and those of
+    // the previous iterate.
+    int settled;
+    double last_delta;
+    double last_a;
+    // The current iterate in the variables of the TNLP.
+    vector<double> iterate;
+    
+    // Whether the first actuations settled, see setControlConvergence. The
+    // iterate is only available in IPOPT's own variables, without the
+    // fixed ones, and mapped back through its TNLPAdapter.
+    bool controlsSettled(const Ipopt::IpoptData *ip_data, Ipopt::IpoptCalculatedQuantities *ip_cq,
+                         double inf_pr) {
+        Ipopt::OrigIpoptNLP *orig = dynamic_cast<Ipopt::OrigIpoptNLP *>(Ipopt::GetRawPtr(ip_cq->GetIpoptNLP()));
+        Ipopt::TNLPAdapter *adapter =
+            orig ? dynamic_cast<Ipopt::TNLPAdapter *>(Ipopt::GetRawPtr(orig->nlp())) : nullptr;
+        if (adapter == nullptr) {
+            return false;
+        }
+        Ipopt::Index n, m, nnz_jac_g, nnz_h_lag;
+        IndexStyleEnum index_style;
+        get_nlp_info(n, m, nnz_jac_g, nnz_h_lag, index_style);
+        iterate.resize(n);
+        adapter->ResortX(*ip_data->curr()->x(), iterate.data());
+        double delta = iterate[delta_index];
+        double a = iterate[a_index];
+        bool still = ip_data->iter_count() > 0 && fabs(delta - last_delta) < control_tol &&
+                     fabs(a - last_a) < control_tol;
+        settled = still ? settled + 1 : 0;
+        last_delta = delta;
+        last_a = a;
+        return settled >= control_iterations && inf_pr <= feasible_violation;
+    }
+};
+
+// Set IPOPT's own CPU time limit to what is left until `deadline`, as a
+// backstop for iterations that run long before the callback sees them.
+inline void setTimeLimit(Ipopt::IpoptApplication &app, Deadline deadline) {
+    double limit = max_solve_time;
+    if (deadline != Deadline::max()) {
+        auto left = deadline - chrono::steady_clock::now();
+        limit = min(limit, max(1e-3, chrono::duration<double>(left).count()));
+    }
+    app.Options()->SetNumericValue("max_cpu_time", limit);
+}
+
+// Apply `options` to a persistent `app`, once before its solves.
+inline void applyOptions(Ipopt::IpoptApplication &app, const MpcOptions &options) {
+    if (!options.linear_solver.empty()) {
+        app.Options()->SetStringValue("linear_solver", options.linear_solver);
+    }
+    if (!options.mu_strategy.empty()) {
+        app.Options()->SetStringValue("mu_strategy", options.mu_strategy);
+    }
+    app.Options()->SetNumericValue("tol", options.tol);
+    app.Options()->SetNumericValue("acceptable_tol", options.acceptable_tol);
+    app.Options()->SetStringValue("hessian_approximation", options.exact_hessian ? "exact" : "limited-memory");
+    app.Options()->SetNumericValue("bound_push", options.bound_push);
+    app.Options()->SetNumericValue("bound_frac", options.bound_push);
+#if IPOPT_VERSION_MAJOR > 3 || (IPOPT_VERSION_MAJOR == 3 && IPOPT_VERSION_MINOR >= 13)
+    // Off by default since 3.13; fillStats reads the linear solver's.
+    app.Options()->SetStringValue("timing_statistics", "yes");
+#endif
+}
+
+// Fill the IPOPT side of `stats` after app.OptimizeTNLP returned `status`
+// for `nlp`.
+inline void fillStats(Ipopt::ApplicationReturnStatus status, Ipopt::IpoptApplication &app,
+                      const DeadlineTNLP &nlp, SolveStats &stats) {
+    switch (status) {
+        case Ipopt::Solve_Succeeded:
+            stats.status = SOLVE_SUCCESS;
+            break;
+        case Ipopt::Solved_To_Acceptable_Level:
+            stats.status = SOLVE_ACCEPTABLE;
+            break;
+        case Ipopt::Maximum_Iterations_Exceeded:
+            stats.status = SOLVE_MAX_ITERATIONS;
+            break;
+        case Ipopt::Maximum_CpuTime_Exceeded:
+            stats.status = SOLVE_CPU_TIME_EXCEEDED;
+            break;
+        case Ipopt::Infeasible_Problem_Detected:
+            stats.status = SOLVE_INFEASIBLE;
+            break;
+        case Ipopt::User_Requested_Stop:
+            stats.status = nlp.controlConverged() ? SOLVE_CONTROL_CONVERGED
+                           : nlp.deadlineHit()    ? SOLVE_DEADLINE_EXCEEDED
+                                                  : SOLVE_CANCELLED;
+            break;
+        default:
+            stats.status = SOLVE_FAILED;
+            break;
+    }
+    stats.cpu_time_exceeded = status == Ipopt::Maximum_CpuTime_Exceeded;
+    Ipopt::SmartPtr<Ipopt::SolveStatistics> statistics = app.Statistics();
+    stats.iterations = Ipopt::IsValid(statistics) ? statistics->IterationCount() : -1;
+    stats.eval_time = nlp.evalTime();
+    Ipopt::SmartPtr<Ipopt::IpoptData> data = app.IpoptDataObject();
+    if (Ipopt::IsValid(data)) {
+        Ipopt::TimingStatistics &timing = data->TimingStats();
+        stats.linear_solver_time = timing.LinearSystemFactorization().TotalWallclockTime() +
+                                   timing.LinearSystemBackSolve().TotalWallclockTime();
+    }
+}
+
+#endif /* NLP_TYPES_H */
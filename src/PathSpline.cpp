@@ -0,0 +1,180 @@
+#include "PathSpline.h"
+#include <math.h>
+#include <algorithm>
+#include "Polynomial.h"
+
+// Solve the tridiagonal system with sub-diagonal a, diagonal b and
+// super-diagonal c in place of d. b is overwritten.
+static void solveTridiagonal(const vector<double> &a, vector<double> &b, const vector<double> &c,
+                             vector<double> &d) {
+    size_t n = d.size();
+    for (size_t i = 1; i < n; i++) {
+        double m = a[i] / b[i - 1];
+        b[i] -= m * c[i - 1];
+        d[i] -= m * d[i - 1];
+    }
+    d[n - 1] /= b[n - 1];
+    for (size_t i = n - 1; i-- > 0;) {
+        d[i] = (d[i] - c[i] * d[i + 1]) / b[i];
+    }
+}
+
+// Solve the cyclic tridiagonal system, a[0] and c[n - 1] being the corner
+// entries, by Sherman-Morrison on the plain tridiagonal one.
+static void solveCyclic(const vector<double> &a, const vector<double> &b, const vector<double> &c,
+                        vector<double> &d) {
+    size_t n = d.size();
+    double alpha = c[n - 1];
+    double beta = a[0];
+    double gamma = -b[0];
+
+    vector<double> bb = b;
+    bb[0] -= gamma;
+    bb[n - 1] -= alpha * beta / gamma;
+    vector<double> bz = bb;
+    solveTridiagonal(a, bb, c, d);
+
+    vector<double> z(n, 0.0);
+    z[0] = gamma;
+    z[n - 1] = alpha;
+    solveTridiagonal(a, bz, c, z);
+
+    double factor = (d[0] + beta * d[n - 1] / gamma) / (1 + z[0] + beta * z[n - 1] / gamma);
+    for (size_t i = 0; i < n; i++) {
+        d[i] -= factor * z[i];
+    }
+}
+
+// Coefficients of the periodic spline through f at the knots, with
+// segment lengths h, four per segment.
+static void fitPeriodic(const vector<double> &f, const vector<double> &h, vector<double> &coeffs) {
+    size_t n = f.size();
+    vector<double> a(n), b(n), c(n), m(n);
+    for (size_t i = 0; i < n; i++) {
+        size_t prev = (i + n - 1) % n;
+        size_t next = (i + 1) % n;
+        a[i] = h[prev];
+        b[i] = 2 * (h[prev] + h[i]);
+        c[i] = h[i];
+        m[i] = 6 * ((f[next] - f[i]) / h[i] - (f[i] - f[prev]) / h[prev]);
+    }
+    // Second derivatives at the knots.
+    solveCyclic(a, b, c, m);
+
+    coeffs.resize(4 * n);
+    for (size_t i = 0; i < n; i++) {
+        size_t next = (i + 1) % n;
+        coeffs[4 * i] = f[i];
+        coeffs[4 * i + 1] = (f[next] - f[i]) / h[i] - h[i] * (2 * m[i] + m[next]) / 6;
+        coeffs[4 * i + 2] = m[i] / 2;
+        coeffs[4 * i + 3] = (m[next] - m[i]) / (6 * h[i]);
+    }
+}
+
+PathSpline::PathSpline() : track(nullptr), knots(nullptr), cx(nullptr), cy(nullptr) {}
+
+bool PathSpline::build(const Track &track) {
+    size_t n = track.size();
+    if (n < 3) {
+        return false;
+    }
+    if (track.splineX()) {
+        this->track = &track;
+        knots = track.arcLengths();
+        cx = track.splineX();
+        cy = track.splineY();
+        return true;
+    }
+    vector<double> xs(n), ys(n), h(n);
+    for (size_t i = 0; i < n; i++) {
+        xs[i] = track.x(i);
+        ys[i] = track.y(i);
+        h[i] = (i + 1 < n ? track.arcLength(i + 1) : track.length()) - track.arcLength(i);
+        if (!(h[i] > 0)) {
+            return false;
+        }
+    }
+    this->track = &track;
+    knots = track.arcLengths();
+    fitPeriodic(xs, h, fitted_x);
+    fitPeriodic(ys, h, fitted_y);
+    cx = fitted_x.data();
+    cy = fitted_y.data();
+    return true;
+}
+
+double PathSpline::wrap(double s) const {
+    double L = length();
+    s = fmod(s, L);
+    return s < 0 ? s + L : s;
+}
+
+size_t PathSpline::segment(double s) const {
+    s = wrap(s);
+    size_t i = upper_bound(knots, knots + track->size(), s) - knots;
+    return i > 0 ? i - 1 : 0;
+}
+
+PathSpline::Sample PathSpline::sample(double s) const {
+    s = wrap(s);
+    size_t i = segment(s);
+    double t = s - knots[i];
+    const double *x = cx + 4 * i;
+    const double *y = cy + 4 * i;
+
+    Sample p;
+    p.x = x[0] + t * (x[1] + t * (x[2] + t * x[3]));
+    p.y = y[0] + t * (y[1] + t * (y[2] + t * y[3]));
+    p.dx = x[1] + t * (2 * x[2] + t * 3 * x[3]);
+    p.dy = y[1] + t * (2 * y[2] + t * 3 * y[3]);
+    p.ddx = 2 * x[2] + t * 6 * x[3];
+    p.ddy = 2 * y[2] + t * 6 * y[3];
+    p.dddx = 6 * x[3];
+    p.dddy = 6 * y[3];
+    return p;
+}
+
+double PathSpline::heading(double s) const {
+    Sample p = sample(s);
+    return atan2(p.dy, p.dx);
+}
+
+double PathSpline::curvature(double s) const {
+    Sample p = sample(s);
+    return (p.dx * p.ddy - p.dy * p.ddx) / pow(p.dx * p.dx + p.dy * p.dy, 1.5);
+}
+
+double PathSpline::project(double px, double py) const {
+    // Start from the polyline and refine on the spline with Newton steps
+    // on the distance.
+    double s = track->locate(px, py).s;
+    for (int i = 0; i < 2; i++) {
+        Sample p = sample(s);
+        double ex = p.x - px;
+        double ey = p.y - py;
+        double g = ex * p.dx + ey * p.dy;
+        double dg = p.dx * p.dx + p.dy * p.dy + ex * p.ddx + ey * p.ddy;
+        if (!(dg > 0)) {
+            break;
+        }
+        s -= g / dg;
+    }
+    return wrap(s);
+}
+
+bool PathSpline::localCubic(double px, double py, double psi, double c[4]) const {
+    Sample p = sample(project(px, py));
+    double cs = cos(psi);
+    double sn = sin(psi);
+
+    // The point and its derivatives in the vehicle frame.
+    double x0 = cs * (p.x - px) + sn * (p.y - py);
+    double y0 = -sn * (p.x - px) + cs * (p.y - py);
+    double x1 = cs * p.dx + sn * p.dy;
+    double y1 = -sn * p.dx + cs * p.dy;
+    double x2 = cs * p.ddx + sn * p.ddy;
+    double y2 = -sn * p.ddx + cs * p.ddy;
+    double x3 = cs * p.dddx + sn * p.dddy;
+    double y3 = -sn * p.dddx + cs * p.dddy;
+    return curveCubic(x0, y0, x1, y1, x2, y2, x3, y3, c);
+}
@@ -0,0 +1,75 @@
+#ifndef PATH_SPLINE_H
+#define PATH_SPLINE_H
+
+#include <cstddef>
+#include <vector>
+#include "Track.h"
+
+using namespace std;
+
+// Periodic cubic spline through the waypoints of a Track, parameterized by
+// the arc length of the polyline, built once when the map is loaded.
+//
+// The controller takes its reference polynomial from here instead of
+// fitting one to the waypoints every frame: localCubic() expands the
+// spline around the point nearest the car in the vehicle frame, so the
+// reference follows the car smoothly from frame to frame.
+class PathSpline {
+public:
+    // Point of the spline with derivatives with respect to s.
+    struct Sample {
+        double x, y;
+        double dx, dy;
+        double ddx, ddy;
+        double dddx, dddy;
+    };
+
+    PathSpline();
+
+    // Fit the spline through the waypoints of `track`, which must outlive
+    // it, or take the coefficients of its map file. Fails on repeated
+    // waypoints.
+    bool build(const Track &track);
+
+    double length() const { return track->length(); }
+
+    // Segment holding arc length s, wrapped into [0, length).
+    size_t segment(double s) const;
+
+    Sample sample(double s) const;
+
+    // Heading and signed curvature, positive to the left, at s.
+    double heading(double s) const;
+    double curvature(double s) const;
+
+    // Arc length of the point of the spline nearest (px, py).
+    double project(double px, double py) const;
+
+    // Coefficients c[0 .. 3], lowest order first, of the cubic y(x) in the
+    // frame of a car at (px, py) heading psi, the third order expansion of
+    // the spline about the point nearest the car. Fails when the path
+    // there is not ahead of the car.
+    bool localCubic(double px, double py, double psi, double c[4]) const;
+
+    // The coefficients below, four per segment, for Track::write.
+    const double *coefficientsX() const { return cx; }
+    const double *coefficientsY() const { return cy; }
+
+private:
+    const Track *track;
+    // Knots, the arc length at each waypoint, see Track::arcLengths.
+    const double *knots;
+    // Per segment, c[0] + c[1] t + c[2] t^2 + c[3] t^3 in t = s - knots[i],
+    // for x and for y, fitted into the vectors or in the track's map file.
+    const double *cx;
+    const double *cy;
+    vector<double> fitted_x;
+    vector<double> fitted_y;
+
+    double wrap(double s) const;
+
+    PathSpline(const PathSpline &) = delete;
+    PathSpline &operator=(const PathSpline &) = delete;
+};
+
+#endif /* PATH_SPLINE_H */
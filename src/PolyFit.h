@@ -0,0 +1,145 @@
+#ifndef POLY_FIT_H
+#define POLY_FIT_H
+
+#include <math.h>
+#include <algorithm>
+#include <cstddef>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "Polynomial.h"
+
+// Least-squares polynomial fit of a fixed degree through the normal
+// equations, with every matrix fixed-size on the stack.
+//
+// The abscissas are divided by `scale` before they enter the sums, which
+// keeps the normal matrix well conditioned for waypoints tens of meters
+// out; the returned coefficients are for the unscaled polynomial.
+//
+// Points can be added (and removed) one at a time, so a sliding window of
+// waypoints does not have to be refitted from scratch.
+template <int Degree>
+class PolyFit {
+public:
+    typedef Eigen::Matrix<double, Degree + 1, 1> Coeffs;
+    
+    explicit PolyFit(double scale = 1.0) : scale(scale) {
+        clear();
+    }
+    
+    void clear() {
+        power_sums.setZero();
+        moments.setZero();
+        n = 0;
+    }
+    
+    void add(double x, double y) {
+        accumulate(x, y, 1.0);
+        n++;
+    }
+    
+    // Add `count` points at once. The sums are accumulated across the
+    // points as array operations, batch_points at a time in fixed-capacity
+    // buffers on the stack.
+    void add(const double *x, const double *y, size_t count) {
+        typedef Eigen::Array<double, Eigen::Dynamic, 1, 0, batch_points, 1> Batch;
+        for (size_t first = 0; first < count; first += batch_points) {
+            Eigen::Index m = std::min(count - first, (size_t) batch_points);
+            Eigen::Map<const Eigen::ArrayXd> xs(x + first, m);
+            Eigen::Map<const Eigen::ArrayXd> ys(y + first, m);
+            Batch t = xs / scale;
+            Batch p = Batch::Ones(m);
+            for (int k = 0; k <= 2 * Degree; k++) {
+                power_sums[k] += p.sum();
+                if (k <= Degree) {
+                    moments[k] += (p * ys).sum();
+                }
+                p *= t;
+            }
+            n += m;
+        }
+    }
+    
+    void remove(double x, double y) {
+        accumulate(x, y, -1.0);
+        n--;
+    }
+    
+    size_t size() const { return n; }
+    
+    // Coefficients, lowest order first. Needs at least Degree + 1 points.
+    Coeffs solve() const {
+        Eigen::Matrix<double, Degree + 1, Degree + 1> A;
+        for (int i = 0; i <= Degree; i++) {
+            for (int j = 0; j <= Degree; j++) {
+                A(i, j) = power_sums[i + j];
+            }
+        }
+        Coeffs c = A.ldlt().solve(moments);
+        double s = 1.0;
+        for (int i = 0; i <= Degree; i++) {
+            c[i] /= s;
+            s *= scale;
+        }
+        return c;
+    }
+    
+private:
+    static const int batch_points = 16;
+    
+    double scale;
+    // Sums of t^k for k = 0 .. 2 Degree and of t^k y for k = 0 .. Degree,
+    // t = x / scale.
+    Eigen::Matrix<double, 2 * Degree + 1, 1> power_sums;
+    Coeffs moments;
+    size_t n;
+    
+    void accumulate(double x, double y, double sign) {
+        double t = x / scale;
+        double p = sign;
+        for (int k = 0; k <= 2 * Degree; k++) {
+            power_sums[k] += p;
+            if (k <= Degree) {
+                moments[k] += p * y;
+            }
+            p *= t;
+        }
+    }
+};
+
+// Fit `n` points in one go, scaled by their largest abscissa.
+template <int Degree>
+typename PolyFit<Degree>::Coeffs polyfitFixed(const double *x, const double *y, size_t n) {
+    double scale = n > 0 ? Eigen::Map<const Eigen::ArrayXd>(x, n).abs().maxCoeff() : 0.0;
+    PolyFit<Degree> fit(scale > 0.0 ? scale : 1.0);
+    fit.add(x, y, n);
+    return fit.solve();
+}
+
+// polyfitFixed of a degree chosen at runtime, from 1 to max_poly_degree,
+// into `coeffs`. False for other degrees or fewer than degree + 1 points.
+inline bool polyfitDegree(int degree, const double *x, const double *y, size_t n, Eigen::VectorXd &coeffs) {
+    if (n < (size_t) degree + 1) {
+        return false;
+    }
+    switch (degree) {
+    case 1:
+        coeffs = polyfitFixed<1>(x, y, n);
+        return true;
+    case 2:
+        coeffs = polyfitFixed<2>(x, y, n);
+        return true;
+    case 3:
+        coeffs = polyfitFixed<3>(x, y, n);
+        return true;
+    case 4:
+        coeffs = polyfitFixed<4>(x, y, n);
+        return true;
+    case 5:
+        coeffs = polyfitFixed<5>(x, y, n);
+        return true;
+    default:
+        return false;
+    }
+}
+
+#endif /* POLY_FIT_H */
@@ -0,0 +1,77 @@
+#ifndef POLYNOMIAL_H
+#define POLYNOMIAL_H
+
+#include <math.h>
+
+// Polynomials sum(coeffs[i] x^i), coefficients lowest order first.
+//
+// `Coeffs` is anything indexable with a size(), e.g. Eigen::VectorXd or a
+// CppAD vector of dynamic parameters, and `Scalar` is double or AD<double>,
+// so the same code serves the plain and the taped evaluation. With AD it
+// records one multiply-add per coefficient instead of a pow per term.
+
+// Value and first Order derivatives at `x` in d[0 .. Order], by Horner's
+// rule carried through the derivatives.
+template <int Order, typename Scalar, typename Coeffs>
+void polyDerivatives(const Coeffs &coeffs, const Scalar &x, Scalar d[Order + 1]) {
+    for (int k = 0; k <= Order; k++) {
+        d[k] = 0.0;
+    }
+    for (int i = (int) coeffs.size() - 1; i >= 0; i--) {
+        for (int k = Order; k > 0; k--) {
+            d[k] = d[k] * x + k * d[k - 1];
+        }
+        d[0] = d[0] * x + coeffs[i];
+    }
+}
+
+template <typename Scalar, typename Coeffs>
+Scalar polyeval(const Coeffs &coeffs, const Scalar &x) {
+    Scalar value = 0.0;
+    for (int i = (int) coeffs.size() - 1; i >= 0; i--) {
+        value = value * x + coeffs[i];
+    }
+    return value;
+}
+
+// Value and slope at `x` in one pass.
+template <typename Scalar, typename Coeffs>
+void polyevalSlope(const Coeffs &coeffs, const Scalar &x, Scalar &value, Scalar &slope) {
+    Scalar d[2];
+    polyDerivatives<1>(coeffs, x, d);
+    value = d[0];
+    slope = d[1];
+}
+
+// Highest degree of a reference with an instantiation of its own, see
+// polyfitDegree and vehicleStepDegree.
+const int max_poly_degree = 5;
+
+// Smallest forward component of the unit tangent for which a curve is
+// still expanded as y(x), see curveCubic.
+static const double min_forward_slope = 0.25;
+
+// Coefficients c[0 .. 3] of the cubic y(x), the third order expansion about
+// x0 of a curve through (x0, y0) with the derivatives (x1, y1), (x2, y2)
+// and (x3, y3) along its parameter there. Fails when the curve does not
+// advance in x there.
+inline bool curveCubic(double x0, double y0, double x1, double y1, double x2, double y2, double x3, double y3,
+                       double c[4]) {
+    if (x1 < min_forward_slope * hypot(x1, y1)) {
+        return false;
+    }
+    
+    // Derivatives of y(x) at x0 by the chain rule.
+    double slope = y1 / x1;
+    double second = (x1 * y2 - y1 * x2) / (x1 * x1 * x1);
+    double third = ((x1 * y3 - y1 * x3) / (x1 * x1 * x1) - 3 * x2 * second / x1) / x1;
+    
+    // Taylor expansion about x0, in powers of x.
+    c[3] = third / 6;
+    c[2] = second / 2 - 3 * c[3] * x0;
+    c[1] = slope - second * x0 + 3 * c[3] * x0 * x0;
+    c[0] = y0 - slope * x0 + second / 2 * x0 * x0 - c[3] * x0 * x0 * x0;
+    return true;
+}
+
+#endif /* POLYNOMIAL_H */
@@ -0,0 +1,63 @@
+#include "RealtimeMemory.h"
+#include <alloca.h>
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef __linux__
+#include <malloc.h>
+#include <sys/mman.h>
+#endif
+
+// Size of a transparent huge page on x86-64 and arm64 with 4 KB pages,
+// and of the pages touched one store each.
+static const size_t huge_page = 2 << 20;
+static const size_t page = 4096;
+
+// One store to every page of [begin, begin + bytes), through volatile so
+// that the stores are kept even though nothing reads them.
+static void touch(char *begin, size_t bytes) {
+    volatile char *p = begin;
+    for (size_t i = 0; i < bytes; i += page) {
+        p[i] = 0;
+    }
+}
+
+bool reserveHeap(const RealtimeOptions &options) {
+#ifdef __linux__
+    bool ok = mallopt(M_ARENA_MAX, 1) == 1;
+    ok = mallopt(M_TRIM_THRESHOLD, -1) == 1 && ok;
+    ok = mallopt(M_MMAP_MAX, 0) == 1 && ok;
+    if (options.heap_bytes == 0) {
+        return ok;
+    }
+    
+    // Without mappings of their own, a block this large comes from the top
+    // of the heap, where it goes back once freed and stays.
+    char *block = (char *) malloc(options.heap_bytes);
+    if (!block) {
+        return false;
+    }
+    if (options.huge_pages) {
+        uintptr_t begin = ((uintptr_t) block + huge_page - 1) & ~(uintptr_t) (huge_page - 1);
+        uintptr_t end = ((uintptr_t) block + options.heap_bytes) & ~(uintptr_t) (huge_page - 1);
+        if (end > begin) {
+            ok = madvise((void *) begin, end - begin, MADV_HUGEPAGE) == 0 && ok;
+        }
+    }
+    touch(block, options.heap_bytes);
+    free(block);
+    return ok;
+#else
+    (void) options;
+    return false;
+#endif
+}
+
+bool lockMemory(size_t stack_bytes) {
+#ifdef __linux__
+    touch((char *) alloca(stack_bytes), stack_bytes);
+    return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#else
+    (void) stack_bytes;
+    return false;
+#endif
+}
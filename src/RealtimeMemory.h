@@ -0,0 +1,32 @@
+#ifndef REALTIME_MEMORY_H
+#define REALTIME_MEMORY_H
+
+#include <cstddef>
+
+using namespace std;
+
+// Memory settings of the real-time mode of the server, see MPC_REALTIME.
+struct RealtimeOptions {
+    // Bytes of heap faulted in up front, on top of what pre-warming the
+    // controllers touches.
+    size_t heap_bytes = 64 << 20;
+    // Back the heap with transparent huge pages where the kernel has them.
+    bool huge_pages = false;
+};
+
+// Set the allocator up so that memory, once faulted in, stays: one arena
+// for every thread, freed memory never given back to the kernel and no
+// allocation served by a mapping of its own. Then grow the heap by
+// options.heap_bytes and touch all of it, so the allocations after start-up
+// reuse faulted-in pages. Must come before any thread but the calling one
+// allocates. Returns false if the allocator refused a setting.
+bool reserveHeap(const RealtimeOptions &options);
+
+// Lock every page mapped now and from now on into memory, see mlockall,
+// after faulting in the next `stack_bytes` of the calling thread's stack,
+// which grows on demand unlike those of the other threads. Returns false
+// without the permission, e.g. CAP_IPC_LOCK or a large enough
+// RLIMIT_MEMLOCK, or the support.
+bool lockMemory(size_t stack_bytes);
+
+#endif /* REALTIME_MEMORY_H */
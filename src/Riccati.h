@@ -0,0 +1,250 @@
+#ifndef RICCATI_H
+#define RICCATI_H
+
+#include <math.h>
+#include <limits>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+
+// Linear-quadratic problem over K stages with nx states and nu inputs,
+//
+//     min  sum_k 1/2 x_k' Q_k x_k + u_k' S_k x_k + 1/2 u_k' R_k u_k + q_k' x_k + r_k' u_k
+//          + 1/2 x_K' Q_K x_K + q_K' x_K
+//     s.t. x_{k+1} = A_k x_k + B_k u_k + c_k,   x_0 given,
+//
+// solved by the backward Riccati recursion in O(K) with fixed-size blocks
+// only. The stage data are public and filled in place by the caller.
+// `Scalar` is double, or float for twice the packets at half the memory.
+template <int nx, int nu, int K, typename Scalar = double>
+class RiccatiLQ {
+public:
+    typedef Eigen::Matrix<Scalar, nx, 1> State;
+    typedef Eigen::Matrix<Scalar, nu, 1> Input;
+
+    Eigen::Matrix<Scalar, nx, nx> A[K];
+    Eigen::Matrix<Scalar, nx, nu> B[K];
+    State c[K];
+    Eigen::Matrix<Scalar, nx, nx> Q[K + 1];
+    Eigen::Matrix<Scalar, nu, nx> S[K];
+    Eigen::Matrix<Scalar, nu, nu> R[K];
+    State q[K + 1];
+    Input r[K];
+
+    // Clear all the stage data.
+    void clear() {
+        for (int k = 0; k < K; k++) {
+            A[k].setZero();
+            B[k].setZero();
+            c[k].setZero();
+            S[k].setZero();
+            R[k].setZero();
+            r[k].setZero();
+        }
+        for (int k = 0; k <= K; k++) {
+            Q[k].setZero();
+            q[k].setZero();
+        }
+    }
+
+    // Optimal trajectory from x[0]. `R_extra` and `r_extra`, if given, are
+    // added to the input terms of every stage without touching the stored
+    // ones. Returns false if a stage Hessian R + B'PB is not positive
+    // definite.
+    bool solve(State x[K + 1], Input u[K],
+               const Input *R_extra = nullptr, const Input *r_extra = nullptr) {
+        Eigen::Matrix<Scalar, nx, nx> P = Q[K];
+        State p = q[K];
+        for (int k = K - 1; k >= 0; k--) {
+            State Pc = P * c[k] + p;
+            Eigen::Matrix<Scalar, nu, nu> H = R[k] + B[k].transpose() * P * B[k];
+            Eigen::Matrix<Scalar, nu, nx> G = S[k] + B[k].transpose() * P * A[k];
+            Input g = r[k] + B[k].transpose() * Pc;
+            if (R_extra) {
+                H.diagonal() += R_extra[k];
+                g += r_extra[k];
+            }
+
+            Eigen::LLT<Eigen::Matrix<Scalar, nu, nu> > llt(H);
+            if (llt.info() != Eigen::Success) {
+                return false;
+            }
+            gain[k] = -llt.solve(G);
+            feedforward[k] = -llt.solve(g);
+
+            p = q[k] + A[k].transpose() * Pc + G.transpose() * feedforward[k];
+            P = Q[k] + A[k].transpose() * P * A[k] + G.transpose() * gain[k];
+            P = Scalar(0.5) * (P + P.transpose()).eval();
+        }
+
+        for (int k = 0; k < K; k++) {
+            u[k] = gain[k] * x[k] + feedforward[k];
+            x[k + 1] = A[k] * x[k] + B[k] * u[k] + c[k];
+        }
+        return true;
+    }
+
+    // Objective of the inputs `u` from x[0], with the states written to `x`.
+    Scalar cost(State x[K + 1], const Input u[K]) const {
+        Scalar value = 0.0;
+        for (int k = 0; k < K; k++) {
+            value += Scalar(0.5) * x[k].dot(Q[k] * x[k]) + u[k].dot(S[k] * x[k]) + Scalar(0.5) * u[k].dot(R[k] * u[k]);
+            value += q[k].dot(x[k]) + r[k].dot(u[k]);
+            x[k + 1] = A[k] * x[k] + B[k] * u[k] + c[k];
+        }
+        value += Scalar(0.5) * x[K].dot(Q[K] * x[K]) + q[K].dot(x[K]);
+        return value;
+    }
+
+private:
+    Eigen::Matrix<Scalar, nu, nx> gain[K];
+    Input feedforward[K];
+};
+
+// Mean complementarity at which BoxRiccati stops by default, as far down
+// as the precision of Scalar goes.
+template <typename Scalar>
+inline Scalar interiorTol() { return 1e-8; }
+template <>
+inline float interiorTol<float>() { return 1e-4f; }
+
+// The rule of the primal-dual interior point method on bounds lb <= u <= ub
+// that BoxRiccati, SparseQP and BatchBoxRiccati share, element by element
+// on Eigen vectors or arrays: the bounds of one problem, or one bound
+// across the lanes of a batch. zl and zu are the multipliers of the lower
+// and upper bounds, sl = u - lb and su = ub - u their slacks.
+
+// Start a little inside the box, as close to zero as possible.
+template <typename V>
+Eigen::Array<typename V::Scalar, V::RowsAtCompileTime, 1> boxStart(const V &lb, const V &ub) {
+    typedef typename V::Scalar Scalar;
+    Eigen::Array<Scalar, V::RowsAtCompileTime, 1> margin = Scalar(0.01) * (ub.array() - lb.array());
+    return (lb.array() + margin).max(Scalar(0)).min(ub.array() - margin);
+}
+
+// Complementarity the Newton step aims at, a tenth of the mean `gap`.
+template <typename T>
+T boxCentering(const T &gap) {
+    return 0.1 * gap;
+}
+
+// The Newton step towards the central path at `tau`, with the dual steps
+// eliminated: the diagonal D and the linear term d it adds to the Hessian
+// and gradient of u.
+template <typename V, typename U, typename T>
+void boxBarrier(const V &sl, const V &su, const V &zl, const V &zu, const U &u, const T &tau, V &D, V &d) {
+    D.array() = zl.array() / sl.array() + zu.array() / su.array();
+    d.array() = tau * (su.array().inverse() - sl.array().inverse()) - D.array() * u.array();
+}
+
+// The dual steps that go with the primal step du of that Newton step.
+template <typename V, typename T>
+void boxDualStep(const V &sl, const V &su, const V &zl, const V &zu, const V &du, const T &tau, V &dzl, V &dzu) {
+    dzl.array() = (tau - zl.array() * (sl.array() + du.array())) / sl.array();
+    dzu.array() = (tau - zu.array() * (su.array() - du.array())) / su.array();
+}
+
+// Largest fraction of the primal step du, and of the dual steps dzl and
+// dzu, that keeps the slacks and the multipliers positive, 99% of the way
+// to the boundary at most; infinite where a step does not approach it.
+template <typename V>
+Eigen::Array<typename V::Scalar, V::RowsAtCompileTime, 1> boxPrimalLimit(const V &sl, const V &su, const V &du) {
+    typedef typename V::Scalar Scalar;
+    const Scalar inf = std::numeric_limits<Scalar>::infinity();
+    return (du.array() < 0).select(Scalar(-0.99) * sl.array() / du.array(),
+                                   (du.array() > 0).select(Scalar(0.99) * su.array() / du.array(), inf));
+}
+
+template <typename V>
+Eigen::Array<typename V::Scalar, V::RowsAtCompileTime, 1> boxDualLimit(const V &zl, const V &zu, const V &dzl,
+                                                                      const V &dzu) {
+    typedef typename V::Scalar Scalar;
+    const Scalar inf = std::numeric_limits<Scalar>::infinity();
+    return (dzl.array() < 0).select(Scalar(-0.99) * zl.array() / dzl.array(), inf)
+        .min((dzu.array() < 0).select(Scalar(-0.99) * zu.array() / dzu.array(), inf));
+}
+
+// RiccatiLQ with finite bounds lb_k <= u_k <= ub_k on the inputs, solved by
+// a primal-dual interior point method. The bounds only add a diagonal to
+// R_k in the Newton system, so every iteration is one Riccati recursion.
+template <int nx, int nu, int K, typename Scalar = double>
+class BoxRiccati : public RiccatiLQ<nx, nu, K, Scalar> {
+public:
+    typedef RiccatiLQ<nx, nu, K, Scalar> LQ;
+    typedef typename LQ::State State;
+    typedef typename LQ::Input Input;
+
+    Input lb[K];
+    Input ub[K];
+
+    // Solve from x[0] until the mean complementarity drops below `tol`.
+    // Returns the number of Riccati recursions, or -1 if one failed, the
+    // bounds leave no interior or max_iter was reached.
+    int solve(State x[K + 1], Input u[K], Scalar tol = interiorTol<Scalar>(), int max_iter = 50) {
+        for (int k = 0; k < K; k++) {
+            if ((lb[k].array() >= ub[k].array()).any()) {
+                return -1;
+            }
+            u[k] = boxStart(lb[k], ub[k]).matrix();
+            zl[k].setOnes();
+            zu[k].setOnes();
+        }
+
+        for (int iter = 1; iter <= max_iter; iter++) {
+            Scalar gap = 0.0;
+            for (int k = 0; k < K; k++) {
+                gap += zl[k].dot(u[k] - lb[k]) + zu[k].dot(ub[k] - u[k]);
+            }
+            gap /= 2 * nu * K;
+            if (gap < tol) {
+                this->cost(x, u);
+                return iter - 1;
+            }
+
+            // Newton step towards the central path at a tenth of the gap,
+            // with the dual steps eliminated into the input Hessian.
+            Scalar tau = boxCentering(gap);
+            for (int k = 0; k < K; k++) {
+                Input sl = u[k] - lb[k];
+                Input su = ub[k] - u[k];
+                boxBarrier(sl, su, zl[k], zu[k], u[k], tau, D[k], d[k]);
+            }
+            x_new[0] = x[0];
+            if (!LQ::solve(x_new, u_new, D, d)) {
+                return -1;
+            }
+
+            // Largest steps that keep the slacks and the duals positive.
+            Scalar alpha_p = 1.0, alpha_d = 1.0;
+            for (int k = 0; k < K; k++) {
+                Input sl = u[k] - lb[k];
+                Input su = ub[k] - u[k];
+                Input du = u_new[k] - u[k];
+                boxDualStep(sl, su, zl[k], zu[k], du, tau, dzl[k], dzu[k]);
+                alpha_p = fmin(alpha_p, boxPrimalLimit(sl, su, du).minCoeff());
+                alpha_d = fmin(alpha_d, boxDualLimit(zl[k], zu[k], dzl[k], dzu[k]).minCoeff());
+            }
+            for (int k = 0; k < K; k++) {
+                u[k] += alpha_p * (u_new[k] - u[k]);
+                zl[k] += alpha_d * dzl[k];
+                zu[k] += alpha_d * dzu[k];
+            }
+        }
+        this->cost(x, u);
+        return -1;
+    }
+
+private:
+    // Multipliers of the lower and upper bounds.
+    Input zl[K];
+    Input zu[K];
+    Input dzl[K];
+    Input dzu[K];
+
+    // Newton system terms and its solution.
+    Input D[K];
+    Input d[K];
+    State x_new[K + 1];
+    Input u_new[K];
+};
+
+#endif /* RICCATI_H */
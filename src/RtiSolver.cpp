@@ -0,0 +1,473 @@
+#include "RtiSolver.h"
+#include <cmath>
+#include <limits>
+#include "FG_eval.h"
+#include "RtiStage.h"
+
+template <typename Config, typename Scalar>
+const int RtiSolver<Config, Scalar>::n_inputs;
+template <typename Config, typename Scalar>
+const int RtiSolver<Config, Scalar>::n_params;
+
+// One step of the model, see vehicleStep, with the Jacobians with respect
+// to the state (A) and actuations (B) if requested, see
+// vehicleStepDegree.
+template <typename Scalar, typename Coeffs>
+static void modelStep(const Scalar *s, Scalar delta, Scalar a, const Coeffs &coeffs, Scalar dt,
+                      Scalar *next, Eigen::Matrix<Scalar, 6, 6> *A, Eigen::Matrix<Scalar, 6, 2> *B) {
+    vehicleStepDegree(s, delta, a, coeffs, dt, next, A, B);
+}
+
+template <typename Config, typename Scalar>
+RtiSolver<Config, Scalar>::RtiSolver()
+    : iterations(1), structured(Config::latency <= 1 && Config::uniform), sparse(false), cancel(nullptr),
+      speeds(constantSpeeds()) {}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::setIterations(int iterations) {
+    this->iterations = iterations;
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::setCostWeights(const CostWeights &weights) {
+    this->weights = weights;
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::setReferenceSpeeds(const StageSpeeds &speeds) {
+    this->speeds = speeds;
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::setStructured(bool structured) {
+    this->structured = structured && Config::latency <= 1 && Config::uniform;
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::setSparse(bool sparse) {
+    this->sparse = sparse;
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::simulate() {
+    for (int t = 1; t < N; t++) {
+        int j = Config::controlIndex(t);
+        modelStep<Scalar>(states[t - 1].data(), u[deltaIndex(j)], u[aIndex(j)], poly, Config::stageDt(t),
+                          states[t].data(), nullptr, nullptr);
+    }
+}
+
+template <typename Config, typename Scalar>
+double RtiSolver<Config, Scalar>::cost() const {
+    // Summed in double whatever Scalar is, for the reported objective.
+    double c = 0.0;
+    for (int t = 0; t < N; t++) {
+        c += weights.cte * square<double>(states[t][4]);
+        c += weights.epsi * square<double>(states[t][5]);
+        c += weights.v * square<double>(states[t][3] - speeds[t]);
+    }
+    for (int j = 0; j < n_controls; j++) {
+        c += weights.delta * square<double>(u[deltaIndex(j)]);
+        c += weights.a * square<double>(u[aIndex(j)]);
+    }
+    for (int j = 0; j + 1 < n_controls; j++) {
+        c += weights.ddelta * square<double>(u[deltaIndex(j + 1)] - u[deltaIndex(j)]);
+        c += weights.da * square<double>(u[aIndex(j + 1)] - u[aIndex(j)]);
+    }
+    return c;
+}
+
+template <typename Config, typename Scalar>
+Scalar RtiSolver<Config, Scalar>::stateWeight(int k) const {
+    return costWeight<Scalar>(weights, k);
+}
+
+template <typename Config, typename Scalar>
+Scalar RtiSolver<Config, Scalar>::residual(int t, int k) const {
+    return costResidual(states[t], speeds[t], k);
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::linearize() {
+    State next;
+    for (int t = 1; t < N; t++) {
+        int j = Config::controlIndex(t);
+        modelStep<Scalar>(states[t - 1].data(), u[deltaIndex(j)], u[aIndex(j)], poly, Config::stageDt(t),
+                          next.data(), &jac_A[t], &jac_B[t]);
+    }
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::condense() {
+    // sens[t] = d states[t] / d u.
+    sens[0].setZero();
+    for (int t = 1; t < N; t++) {
+        int j = Config::controlIndex(t);
+        sens[t] = jac_A[t] * sens[t - 1];
+        sens[t].col(deltaIndex(j)) += jac_B[t].col(0);
+        sens[t].col(aIndex(j)) += jac_B[t].col(1);
+    }
+    
+    // Cost terms on the states, residuals r = J du + r0 with weight w add
+    // 2 w J'J to the Hessian and 2 w J' r0 to the gradient.
+    H.setZero();
+    h.setZero();
+    for (int t = 1; t < N; t++) {
+        for (int k = 0; k < 3; k++) {
+            int r = cost_rows[k];
+            H.noalias() += 2 * stateWeight(k) * sens[t].row(r).transpose() * sens[t].row(r);
+            h.noalias() += 2 * stateWeight(k) * residual(t, k) * sens[t].row(r).transpose();
+        }
+    }
+    
+    // Cost terms on the actuations are linear residuals already.
+    for (int j = 0; j < n_controls; j++) {
+        H(deltaIndex(j), deltaIndex(j)) += 2 * weights.delta;
+        H(aIndex(j), aIndex(j)) += 2 * weights.a;
+        h[deltaIndex(j)] += 2 * weights.delta * u[deltaIndex(j)];
+        h[aIndex(j)] += 2 * weights.a * u[aIndex(j)];
+    }
+    for (int j = 0; j + 1 < n_controls; j++) {
+        const int cols[2] = {deltaIndex(j), aIndex(j)};
+        const Scalar w[2] = {Scalar(weights.ddelta), Scalar(weights.da)};
+        for (int k = 0; k < 2; k++) {
+            int c0 = cols[k], c1 = cols[k] + 2;
+            Scalar r0 = u[c1] - u[c0];
+            H(c0, c0) += 2 * w[k];
+            H(c1, c1) += 2 * w[k];
+            H(c0, c1) -= 2 * w[k];
+            H(c1, c0) -= 2 * w[k];
+            h[c0] -= 2 * w[k] * r0;
+            h[c1] += 2 * w[k] * r0;
+        }
+    }
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::stageProblem() {
+    ::stageProblem<Config>(states, jac_A, jac_B, u, weights, speeds, lq);
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::sparseProblem() {
+    // State t is at 6 (t - 1), x_0 being fixed, the actuations follow in
+    // the order of u. Every Jacobian entry is stored, zero or not, so the
+    // pattern is the same for every problem and only analyzed once.
+    const int n_x = 6 * (N - 1), n = n_x + n_inputs;
+    auto stateIndex = [](int t) { return 6 * (t - 1); };
+    
+    // The cost terms as in condense(), on the deviations.
+    triplets.clear();
+    sparse_q = SparseVector::Zero(n);
+    for (int t = 1; t < N; t++) {
+        for (int k = 0; k < 3; k++) {
+            int i = stateIndex(t) + cost_rows[k];
+            triplets.push_back(Eigen::Triplet<double>(i, i, 2 * stateWeight(k)));
+            sparse_q[i] += 2 * stateWeight(k) * residual(t, k);
+        }
+    }
+    for (int j = 0; j < n_controls; j++) {
+        int d = n_x + deltaIndex(j), a = n_x + aIndex(j);
+        triplets.push_back(Eigen::Triplet<double>(d, d, 2 * weights.delta));
+        triplets.push_back(Eigen::Triplet<double>(a, a, 2 * weights.a));
+        sparse_q[d] += 2 * weights.delta * u[deltaIndex(j)];
+        sparse_q[a] += 2 * weights.a * u[aIndex(j)];
+    }
+    for (int j = 0; j + 1 < n_controls; j++) {
+        const int cols[2] = {deltaIndex(j), aIndex(j)};
+        const double w[2] = {weights.ddelta, weights.da};
+        for (int k = 0; k < 2; k++) {
+            int c0 = cols[k], c1 = cols[k] + 2;
+            double r0 = u[c1] - u[c0];
+            triplets.push_back(Eigen::Triplet<double>(n_x + c0, n_x + c0, 2 * w[k]));
+            triplets.push_back(Eigen::Triplet<double>(n_x + c1, n_x + c1, 2 * w[k]));
+            triplets.push_back(Eigen::Triplet<double>(n_x + c1, n_x + c0, -2 * w[k]));
+            sparse_q[n_x + c0] -= 2 * w[k] * r0;
+            sparse_q[n_x + c1] += 2 * w[k] * r0;
+        }
+    }
+    sparse_P.resize(n, n);
+    sparse_P.setFromTriplets(triplets.begin(), triplets.end());
+    
+    // dx_t - A_t dx_{t-1} - B_t du_j = 0, the simulated trajectory
+    // satisfying the dynamics.
+    triplets.clear();
+    for (int t = 1; t < N; t++) {
+        int row = stateIndex(t), j = Config::controlIndex(t);
+        for (int i = 0; i < 6; i++) {
+            triplets.push_back(Eigen::Triplet<double>(row + i, stateIndex(t) + i, 1));
+            for (int c = 0; t > 1 && c < 6; c++) {
+                triplets.push_back(Eigen::Triplet<double>(row + i, stateIndex(t - 1) + c, -jac_A[t](i, c)));
+            }
+            triplets.push_back(Eigen::Triplet<double>(row + i, n_x + deltaIndex(j), -jac_B[t](i, 0)));
+            triplets.push_back(Eigen::Triplet<double>(row + i, n_x + aIndex(j), -jac_B[t](i, 1)));
+        }
+    }
+    sparse_E.resize(n_x, n);
+    sparse_E.setFromTriplets(triplets.begin(), triplets.end());
+    sparse_b = SparseVector::Zero(n_x);
+    
+    sparse_lb = (lb - u).template cast<double>();
+    sparse_ub = (ub - u).template cast<double>();
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::start(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+                                      const Dvector &gl) {
+    // The initial state is fixed by the constraint bounds.
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    for (int k = 0; k < 6; k++) {
+        states[0][k] = gl[starts[k]];
+    }
+    
+    for (int j = 0; j < n_controls; j++) {
+        u[deltaIndex(j)] = xi[delta_start + j];
+        u[aIndex(j)] = xi[a_start + j];
+        lb[deltaIndex(j)] = xl[delta_start + j];
+        ub[deltaIndex(j)] = xu[delta_start + j];
+        lb[aIndex(j)] = xl[a_start + j];
+        ub[aIndex(j)] = xu[a_start + j];
+    }
+    u = u.cwiseMax(lb).cwiseMin(ub);
+    
+    qp_iterations = 0;
+    converged = true;
+}
+
+template <typename Config, typename Scalar>
+typename RtiSolver<Config, Scalar>::StageQP &
+RtiSolver<Config, Scalar>::stageStep(const Eigen::VectorXd &coeffs) {
+    poly = coeffs.template cast<Scalar>();
+    simulate();
+    linearize();
+    stageProblem();
+    for (int k = 0; k < N - 1; k++) {
+        lq.lb[k] = lb.template segment<2>(2 * k) - u.template segment<2>(2 * k);
+        lq.ub[k] = ub.template segment<2>(2 * k) - u.template segment<2>(2 * k);
+    }
+    return lq;
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::takeStep(const typename StageQP::Input du[], int n) {
+    if (n >= 0) {
+        for (int k = 0; k < N - 1; k++) {
+            u.template segment<2>(2 * k) += du[k];
+        }
+        u = u.cwiseMax(lb).cwiseMin(ub);
+    }
+    converged &= n >= 0;
+    qp_iterations += n >= 0 ? n : 0;
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+                                      const Dvector &gl, const Dvector &gu,
+                                      const Eigen::VectorXd &coeffs, SolveResult &solution, SolveStats &stats) {
+    start(xi, xl, xu, gl);
+    poly = coeffs.template cast<Scalar>();
+    bool cancelled = false;
+    for (int i = 0; i < iterations; i++) {
+        if (i > 0 && cancel && cancel->cancelled()) {
+            cancelled = true;
+            break;
+        }
+        if (sparse) {
+            simulate();
+            linearize();
+            sparseProblem();
+            int n = sparse_qp.solve(sparse_P, sparse_q, sparse_E, sparse_b, sparse_lb, sparse_ub, sparse_z);
+            if (n >= 0) {
+                u += sparse_z.tail<n_inputs>().template cast<Scalar>();
+                u = u.cwiseMax(lb).cwiseMin(ub);
+            }
+            converged &= n >= 0;
+            qp_iterations += n >= 0 ? n : 0;
+        } else if (structured) {
+            stageStep(coeffs);
+            stage_x[0].setZero();
+            takeStep(stage_u, lq.solve(stage_x, stage_u));
+        } else {
+            // The QP is solved for the new actuations directly, so the
+            // bounds are the plain box.
+            simulate();
+            linearize();
+            condense();
+            Controls h_abs = h - H * u;
+            Controls next = u;
+            int n = qp.solve(H, h_abs, lb, ub, next);
+            u = next;
+            converged &= n >= 0;
+            qp_iterations += n >= 0 ? n : 0;
+        }
+    }
+    finish(gl, coeffs, solution, stats);
+    if (cancelled) {
+        stats.status = SOLVE_CANCELLED;
+    }
+}
+
+template <typename Config, typename Scalar>
+void RtiSolver<Config, Scalar>::finish(const Dvector &gl, const Eigen::VectorXd &coeffs,
+                                       SolveResult &solution, SolveStats &stats) {
+    poly = coeffs.template cast<Scalar>();
+    simulate();
+    
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    solution.x.resize(n_vars);
+    for (int t = 0; t < N; t++) {
+        for (int k = 0; k < 6; k++) {
+            solution.x[starts[k] + t] = states[t][k];
+        }
+    }
+    for (int j = 0; j < n_controls; j++) {
+        solution.x[delta_start + j] = u[deltaIndex(j)];
+        solution.x[a_start + j] = u[aIndex(j)];
+    }
+    
+    fillRolledOut(gl, n_vars, solution);
+    solution.obj_value = cost();
+    solution.status = converged ? SolveResult::success : SolveResult::maxiter_exceeded;
+    
+    stats.status = converged ? SOLVE_SUCCESS : SOLVE_MAX_ITERATIONS;
+    stats.iterations = qp_iterations;
+    stats.cpu_time_exceeded = false;
+}
+
+template <typename Config, typename Scalar>
+bool RtiSolver<Config, Scalar>::sensitivity(const Dvector &x, const Dvector &xl, const Dvector &xu,
+                                            const Eigen::VectorXd &coeffs, Gain &gain) {
+    const size_t starts[6] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    for (int k = 0; k < 6; k++) {
+        states[0][k] = x[starts[k]];
+    }
+    for (int j = 0; j < n_controls; j++) {
+        u[deltaIndex(j)] = x[delta_start + j];
+        u[aIndex(j)] = x[a_start + j];
+        lb[deltaIndex(j)] = xl[delta_start + j];
+        ub[deltaIndex(j)] = xu[delta_start + j];
+        lb[aIndex(j)] = xl[a_start + j];
+        ub[aIndex(j)] = xu[a_start + j];
+    }
+    u = u.cwiseMax(lb).cwiseMin(ub);
+    poly = coeffs.template cast<Scalar>();
+    simulate();
+    linearize();
+    condense();
+    
+    // Only the state residuals depend on the parameters, through the
+    // simulation, the actuations held.
+    const State initial = states[0];
+    const Eigen::Matrix<Scalar, Eigen::Dynamic, 1> reference = poly;
+    const Scalar step = cbrt(numeric_limits<Scalar>::epsilon());
+    Eigen::Matrix<Scalar, n_inputs, n_params> dg = Eigen::Matrix<Scalar, n_inputs, n_params>::Zero();
+    Scalar plus[Config::N][3];
+    for (int i = 0; i < n_params; i++) {
+        Scalar &p = i < 6 ? states[0][i] : poly[i - 6];
+        Scalar p0 = p, e = step * fmax(Scalar(1), fabs(p0));
+        for (int side = 0; side < 2; side++) {
+            p = side == 0 ? p0 + e : p0 - e;
+            simulate();
+            for (int t = 1; t < N; t++) {
+                for (int k = 0; k < 3; k++) {
+                    if (side == 0) {
+                        plus[t][k] = residual(t, k);
+                    } else {
+                        Scalar dr = (plus[t][k] - residual(t, k)) / (2 * e);
+                        dg.col(i).noalias() += 2 * stateWeight(k) * dr * sens[t].row(cost_rows[k]).transpose();
+                    }
+                }
+            }
+        }
+        p = p0;
+    }
+    states[0] = initial;
+    poly = reference;
+    simulate();
+    
+    // The bounds the gradient presses the actuations against stay active
+    // under a small change; the others are free, as in BoxQP.
+    Hessian M = H;
+    for (int i = 0; i < n_inputs; i++) {
+        Scalar margin = Scalar(1e-4) * (ub[i] - lb[i]);
+        bool active = (u[i] <= lb[i] + margin && h[i] > 0) || (u[i] >= ub[i] - margin && h[i] < 0);
+        if (active) {
+            M.row(i).setZero();
+            M.col(i).setZero();
+            M(i, i) = 1;
+            dg.row(i).setZero();
+        }
+    }
+    Eigen::LDLT<Hessian> ldlt(M);
+    if (ldlt.info() != Eigen::Success) {
+        return false;
+    }
+    Eigen::Matrix<Scalar, n_inputs, n_params> du = ldlt.solve(-dg);
+    gain.row(0) = du.row(deltaIndex(0)).template cast<double>();
+    gain.row(1) = du.row(aIndex(0)).template cast<double>();
+    return gain.allFinite();
+}
+
+template <typename Config>
+void RtiBatch<Config>::setCostWeights(const CostWeights &weights) {
+    for (auto &lane : lanes) {
+        lane.setCostWeights(weights);
+    }
+}
+
+template <typename Config>
+void RtiBatch<Config>::setReferenceSpeeds(const StageSpeeds &speeds) {
+    for (auto &lane : lanes) {
+        lane.setReferenceSpeeds(speeds);
+    }
+}
+
+template <typename Config>
+void RtiBatch<Config>::solve(size_t n, const Dvector *xi, const Dvector *xl, const Dvector *xu,
+                             const Dvector *gl, const Eigen::VectorXd *coeffs, SolveResult *solutions,
+                             SolveStats *stats) {
+    assert(n > 0 && n <= batch_lanes);
+    if (!lanes[0].isStructured()) {
+        for (size_t i = 0; i < n; i++) {
+            lanes[i].solve(xi[i], xl[i], xu[i], gl[i], gl[i], coeffs[i], solutions[i], stats[i]);
+        }
+        return;
+    }
+    
+    for (size_t i = 0; i < n; i++) {
+        lanes[i].start(xi[i], xl[i], xu[i], gl[i]);
+    }
+    for (int iteration = 0; iteration < lanes[0].getIterations(); iteration++) {
+        // Spare lanes solve a copy of the last problem.
+        StageQP *last = nullptr;
+        for (size_t i = 0; i < batch_lanes; i++) {
+            if (i < n) {
+                last = &lanes[i].stageStep(coeffs[i]);
+            }
+            qp.load(i, *last);
+        }
+        stage_x[0].setZero();
+        qp.solve(stage_x[0]);
+        for (size_t i = 0; i < n; i++) {
+            qp.store(i, stage_x, stage_u);
+            lanes[i].takeStep(stage_u, qp.laneIterations(i));
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        lanes[i].finish(gl[i], coeffs[i], solutions[i], stats[i]);
+    }
+}
+
+// Horizons the controller is built for, in both precisions.
+template class RtiSolver<DefaultConfig>;
+template class RtiSolver<MediumConfig>;
+template class RtiSolver<LongConfig>;
+template class RtiBatch<DefaultConfig>;
+template class RtiBatch<MediumConfig>;
+template class RtiBatch<LongConfig>;
+template class RtiSolver<BlockedConfig>;
+template class RtiBatch<BlockedConfig>;
+template class RtiSolver<DefaultConfig, float>;
+template class RtiSolver<MediumConfig, float>;
+template class RtiSolver<LongConfig, float>;
+template class RtiSolver<BlockedConfig, float>;
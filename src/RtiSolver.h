@@ -0,0 +1,203 @@
+#ifndef RTI_SOLVER_H
+#define RTI_SOLVER_H
+
+#include "BatchRiccati.h"
+#include "BoxQP.h"
+#include "CostWeights.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "MpcConfig.h"
+#include "NLPTypes.h"
+#include "Riccati.h"
+#include "SparseQP.h"
+#include "SpeedProfile.h"
+
+// Real-time iteration SQP for the kinematic model of FG_eval.
+//
+// Each cycle takes the actuations of the initial guess (the shifted
+// previous solution when warm starting), simulates the model from the new
+// initial state, and linearizes around that trajectory. The states are
+// condensed out, so the step is a dense box-constrained QP in the
+// actuations only, with the Gauss-Newton Hessian of the least-squares
+// cost. With at most one stage of latency the same QP can instead be kept
+// in stage form and solved by Riccati recursions, see Riccati.h, in time
+// linear in the horizon, on a uniform grid without move blocking only,
+// see GridConfig. Or the states can be kept as variables of a sparse QP
+// with the dynamics as equality constraints, see SparseQP, for any grid
+// and latency. The states of the result are simulated again, so
+// the returned trajectory satisfies the dynamics exactly.
+//
+// `Scalar` is the precision of the model, its linearization and the QP;
+// with float the problem is solved in single precision around the double
+// interface of the other backends.
+template <typename Config, typename Scalar = double>
+class RtiSolver : private Config {
+    using Config::N;
+    using Config::n_controls;
+    using Config::x_start;
+    using Config::y_start;
+    using Config::psi_start;
+    using Config::v_start;
+    using Config::cte_start;
+    using Config::epsi_start;
+    using Config::delta_start;
+    using Config::a_start;
+    using Config::n_vars;
+    using Config::n_constraints;
+    
+public:
+    // Number of actuation variables.
+    static const int n_inputs = 2 * Config::n_controls;
+    
+    RtiSolver();
+    
+    // SQP iterations per solve, 1 being the real-time iteration.
+    void setIterations(int iterations);
+    
+    void setCostWeights(const CostWeights &weights);
+    
+    // See FG_eval::speeds.
+    void setReferenceSpeeds(const StageSpeeds &speeds);
+    
+    // Solve the QP step in stage form rather than condensed. Only has an
+    // effect with at most one stage of latency on a uniform grid, where it
+    // is the default.
+    void setStructured(bool structured);
+    
+    // Solve the QP step by SparseQP, the states kept as its variables,
+    // rather than condensed or in stage form.
+    void setSparse(bool sparse);
+    
+    // Stop iterating once `cancel` is raised, checked between SQP
+    // iterations, null for none. The iterate of the last one is returned
+    // as SOLVE_CANCELLED. It has to outlive the solves it is set for.
+    void setCancel(const CancelToken *cancel) { this->cancel = cancel; }
+    
+    // Same contract as CppAD::ipopt::solve. stats.iterations counts the
+    // QP active-set iterations, the Riccati recursions in stage form or
+    // the factorizations of the sparse QP.
+    void solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+               const Dvector &gl, const Dvector &gu,
+               const Eigen::VectorXd &coeffs, SolveResult &solution, SolveStats &stats);
+    
+    // Stage-form QP of a step, the state augmented with the previous
+    // actuation.
+    typedef BoxRiccati<8, 2, Config::N - 1, Scalar> StageQP;
+    
+    // solve() in parts, so RtiBatch can solve the QPs of several problems
+    // at once: start() takes the problem, then every SQP iteration builds
+    // its QP with stageStep(), in stage form only, and applies the solution
+    // with takeStep(), `n` being the recursions it took or -1 if it failed.
+    // finish() writes the result.
+    void start(const Dvector &xi, const Dvector &xl, const Dvector &xu, const Dvector &gl);
+    StageQP &stageStep(const Eigen::VectorXd &coeffs);
+    void takeStep(const typename StageQP::Input du[], int n);
+    void finish(const Dvector &gl, const Eigen::VectorXd &coeffs, SolveResult &solution, SolveStats &stats);
+    
+    // Parameters of a problem: the initial state, then the coefficients of
+    // the cubic reference.
+    static const int n_params = 10;
+    typedef Eigen::Matrix<double, 2, n_params> Gain;
+    
+    // Sensitivity of the first actuations of the solution `x`, from any
+    // backend, to the parameters of its problem: the Gauss-Newton QP around
+    // it, its strongly active bounds held, solved for the derivative of
+    // its gradient, which central differences of the simulation give.
+    // False if the QP could not be factored.
+    bool sensitivity(const Dvector &x, const Dvector &xl, const Dvector &xu, const Eigen::VectorXd &coeffs,
+                     Gain &gain);
+    
+    int getIterations() const { return iterations; }
+    bool isStructured() const { return structured && !sparse; }
+    
+private:
+    typedef Eigen::Matrix<Scalar, 6, 1> State;
+    typedef Eigen::Matrix<Scalar, n_inputs, 1> Controls;
+    typedef Eigen::Matrix<Scalar, n_inputs, n_inputs> Hessian;
+    
+    int iterations;
+    bool structured;
+    bool sparse;
+    const CancelToken *cancel;
+    CostWeights weights;
+    StageSpeeds speeds;
+    
+    // Trajectory of the current linearization point, the actuation
+    // bounds and how the QPs went so far.
+    State states[Config::N];
+    Controls u;
+    Controls lb, ub;
+    int qp_iterations;
+    bool converged;
+    
+    // The reference polynomial of the solve.
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 1> poly;
+    
+    // Model Jacobians of the transition into each stage.
+    Eigen::Matrix<Scalar, 6, 6> jac_A[Config::N];
+    Eigen::Matrix<Scalar, 6, 2> jac_B[Config::N];
+    
+    // Condensed QP, with the sensitivity of each state to all actuations.
+    Eigen::Matrix<Scalar, 6, n_inputs> sens[Config::N];
+    Hessian H;
+    Controls h;
+    BoxQP<n_inputs, Scalar> qp;
+    
+    StageQP lq;
+    typename StageQP::State stage_x[Config::N];
+    typename StageQP::Input stage_u[Config::N - 1];
+    
+    // Sparse QP in the state deviations of stages 1 to N - 1, then the
+    // actuation deviations. It is solved in double whatever Scalar is, its
+    // KKT matrix spanning the weights and the dynamics alike being too
+    // ill-conditioned for float.
+    typedef SparseQP<double>::Matrix SparseMatrix;
+    typedef SparseQP<double>::Vector SparseVector;
+    SparseQP<double> sparse_qp;
+    SparseMatrix sparse_P, sparse_E;
+    SparseVector sparse_q, sparse_b, sparse_lb, sparse_ub, sparse_z;
+    vector<Eigen::Triplet<double> > triplets;
+    
+    // Simulate the states from states[0] under `u`.
+    void simulate();
+    
+    double cost() const;
+    
+    // Residual of the state cost term k at stage t, and its weight.
+    Scalar residual(int t, int k) const;
+    Scalar stateWeight(int k) const;
+    
+    // Model Jacobians around the current point.
+    void linearize();
+    
+    // Gauss-Newton model of the cost around the current point, condensed
+    // into H and h or in stage form in lq.
+    void condense();
+    void stageProblem();
+    void sparseProblem();
+};
+
+// RtiSolver for up to batch_lanes independent problems at a time, their
+// stage QPs solved together by BatchBoxRiccati. Each problem gets the same
+// result as from RtiSolver::solve, the batch only shares the instructions.
+template <typename Config>
+class RtiBatch {
+public:
+    void setCostWeights(const CostWeights &weights);
+    
+    void setReferenceSpeeds(const StageSpeeds &speeds);
+    
+    // RtiSolver::solve for problems 0 to n - 1 of the arrays, n at most
+    // batch_lanes.
+    void solve(size_t n, const Dvector *xi, const Dvector *xl, const Dvector *xu, const Dvector *gl,
+               const Eigen::VectorXd *coeffs, SolveResult *solutions, SolveStats *stats);
+    
+private:
+    typedef typename RtiSolver<Config>::StageQP StageQP;
+    
+    RtiSolver<Config> lanes[batch_lanes];
+    BatchBoxRiccati<8, 2, Config::N - 1> qp;
+    typename StageQP::State stage_x[Config::N];
+    typename StageQP::Input stage_u[Config::N - 1];
+};
+
+#endif /* RTI_SOLVER_H */
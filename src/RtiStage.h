@@ -0,0 +1,100 @@
+#ifndef RTI_STAGE_H
+#define RTI_STAGE_H
+
+#include "CostWeights.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "SpeedProfile.h"
+
+// The stage-form QP of a step of the real-time iteration, shared by
+// RtiSolver and EmbeddedMpc. Fixed-size throughout, so it builds without
+// the IPOPT interface of RtiSolver and allocates nothing.
+
+// State rows of the residuals of the cost, cte, epsi and v, see
+// costResidual.
+static const int cost_rows[3] = {4, 5, 3};
+
+// Weight of residual k of the cost.
+template <typename Scalar>
+inline Scalar costWeight(const CostWeights &weights, int k) {
+    const double w[3] = {weights.cte, weights.epsi, weights.v};
+    return w[k];
+}
+
+// Residual k of the cost at `state`, the speed taken against `speed`.
+template <typename Scalar>
+inline Scalar costResidual(const Eigen::Matrix<Scalar, 6, 1> &state, double speed, int k) {
+    return state[cost_rows[k]] - Scalar(cost_rows[k] == 3 ? speed : 0.0);
+}
+
+// Gauss-Newton model of the cost around the trajectory `states` under the
+// actuations `u`, delta and a interleaved per move, into `lq`, with
+// jac_A[t] and jac_B[t] the Jacobians of the transition into stage t.
+//
+// Stage k chooses actuation k and its state is x_{k + latency}, x_0 for
+// the first one. With one stage of latency the first stage thus spans the
+// transitions into x_1 and x_2, which both apply actuation 0. The state
+// is augmented with the previous actuation for the rate terms. The input
+// bounds are left to the caller.
+template <typename Config, typename Scalar, typename Controls, typename StageQP>
+void stageProblem(const Eigen::Matrix<Scalar, 6, 1> states[], const Eigen::Matrix<Scalar, 6, 6> jac_A[],
+                  const Eigen::Matrix<Scalar, 6, 2> jac_B[], const Controls &u, const CostWeights &weights,
+                  const StageSpeeds &speeds, StageQP &lq) {
+    const int N = Config::N;
+    const int L = Config::latency;
+    lq.clear();
+    for (int k = 0; k < N - 1; k++) {
+        int t = k + 1 + L;
+        if (k == 0 && L == 1) {
+            lq.A[0].template topLeftCorner<6, 6>() = jac_A[2] * jac_A[1];
+            lq.B[0].template topRows<6>() = jac_A[2] * jac_B[1] + jac_B[2];
+            
+            // x_1 only depends on actuation 0, x_0 being fixed.
+            for (int i = 0; i < 3; i++) {
+                auto J = jac_B[1].row(cost_rows[i]).transpose();
+                Scalar w = costWeight<Scalar>(weights, i);
+                lq.R[0].noalias() += 2 * w * J * J.transpose();
+                lq.r[0].noalias() += 2 * w * costResidual(states[1], speeds[1], i) * J;
+            }
+        } else if (t < N) {
+            lq.A[k].template topLeftCorner<6, 6>() = jac_A[t];
+            lq.B[k].template topRows<6>() = jac_B[t];
+        }
+        lq.B[k].template bottomRows<2>().setIdentity();
+        
+        if (k > 0) {
+            for (int i = 0; i < 3; i++) {
+                Scalar w = costWeight<Scalar>(weights, i);
+                lq.Q[k](cost_rows[i], cost_rows[i]) += 2 * w;
+                lq.q[k][cost_rows[i]] += 2 * w * costResidual(states[k + L], speeds[k + L], i);
+            }
+        }
+        
+        lq.R[k](0, 0) += 2 * weights.delta;
+        lq.R[k](1, 1) += 2 * weights.a;
+        lq.r[k][0] += 2 * weights.delta * u[2 * k];
+        lq.r[k][1] += 2 * weights.a * u[2 * k + 1];
+        
+        if (k > 0) {
+            const Scalar w[2] = {Scalar(weights.ddelta), Scalar(weights.da)};
+            for (int i = 0; i < 2; i++) {
+                Scalar r0 = u[2 * k + i] - u[2 * (k - 1) + i];
+                lq.Q[k](6 + i, 6 + i) += 2 * w[i];
+                lq.R[k](i, i) += 2 * w[i];
+                lq.S[k](i, 6 + i) -= 2 * w[i];
+                lq.r[k][i] += 2 * w[i] * r0;
+                lq.q[k][6 + i] -= 2 * w[i] * r0;
+            }
+        }
+    }
+    
+    // Without latency the last state is a stage of its own.
+    if (L == 0) {
+        for (int i = 0; i < 3; i++) {
+            Scalar w = costWeight<Scalar>(weights, i);
+            lq.Q[N - 1](cost_rows[i], cost_rows[i]) += 2 * w;
+            lq.q[N - 1][cost_rows[i]] += 2 * w * costResidual(states[N - 1], speeds[N - 1], i);
+        }
+    }
+}
+
+#endif /* RTI_STAGE_H */
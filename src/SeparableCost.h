@@ -0,0 +1,143 @@
+#ifndef SEPARABLE_COST_H
+#define SEPARABLE_COST_H
+
+#include <cstddef>
+#include <vector>
+#include "CostWeights.h"
+#include "FG_eval.h"
+
+using namespace std;
+
+// addCost of a horizon in closed form, for TapedNLP to evaluate the
+// objective, its gradient and its Hessian without the tape. Every term is
+// weight * (vars[i] - vars[j])^2 for adjacent actuations, or
+// weight * (vars[i] - ref)^2, so the Hessian is constant: diagonal in the
+// states and tridiagonal in each actuator block. The terminal cost adds
+// one term weight * (cte - scale * epsi)^2 of the last stage, see
+// setTerminal, and so one entry between the two.
+class SeparableCost {
+public:
+    struct Term {
+        size_t i;
+        // The subtracted variable, or `none` to subtract `ref` instead.
+        size_t j;
+        double weight;
+        double ref;
+        // Of vars[j].
+        double scale;
+    };
+
+    static const size_t none = (size_t) -1;
+
+    // The terms of ControllerCost, which addCost<Config> records, under
+    // `weights`, skipping zero weights as the optimized tape does, against
+    // ref_v at every stage.
+    template <typename Config>
+    void build(const CostWeights &weights) {
+        clear();
+        ControllerCost::separable<Config>(*this, weights, constantSpeeds());
+        setTerminal(terminal);
+    }
+
+    // Take `speeds` as the references of the speed terms instead; the
+    // Hessian stays the same.
+    void setSpeeds(const StageSpeeds &speeds) {
+        for (const SpeedTerm &speed : speed_terms) {
+            terms[speed.term].ref = speeds[speed.stage];
+        }
+    }
+
+    // A term of the expansion of a cost, see CostModel.h: weight * (vars[i]
+    // - vars[j])^2, or weight * (vars[i] - ref)^2 with j `none`, its ref
+    // the speed of `speed_stage` unless that is no_speed_stage. Left out at
+    // zero weight.
+    void addTerm(size_t i, size_t j, double weight, double ref, size_t speed_stage) {
+        if (weight == 0) {
+            return;
+        }
+        if (speed_stage != no_speed_stage) {
+            speed_terms.push_back(SpeedTerm{terms.size(), speed_stage});
+        }
+        terms.push_back(Term{i, j, weight, ref, 1.0});
+    }
+
+    // The terms of a terminal cost of the `last` stage, of its cte, epsi
+    // and speed variables, weighted by setTerminal.
+    void addTerminal(size_t cte, size_t epsi, size_t v, size_t last, double ref) {
+        terminal_terms = terms.size();
+        terms.push_back(Term{cte, epsi, 0, 0, 0});
+        terms.push_back(Term{epsi, none, 0, 0, 1.0});
+        speed_terms.push_back(SpeedTerm{terms.size(), last});
+        terms.push_back(Term{v, none, 0, ref, 1.0});
+    }
+
+    // Take `terminal` as the terminal cost. The cte and epsi form is
+    // completed to weight * (cte + cte_epsi / (2 weight) * epsi)^2 plus
+    // what is left of epsi; the Hessian changes, its sparsity does not.
+    void setTerminal(const TerminalCost &terminal) {
+        this->terminal = terminal;
+        if (terms.empty()) {
+            return;
+        }
+        Term &form = terms[terminal_terms], &epsi = terms[terminal_terms + 1];
+        form.weight = terminal.cte;
+        form.scale = terminal.cte > 0 ? -terminal.cte_epsi / (2 * terminal.cte) : 0;
+        epsi.weight = terminal.epsi - (terminal.cte > 0 ? form.weight * form.scale * form.scale : 0);
+        terms[terminal_terms + 2].weight = terminal.v;
+    }
+
+    const TerminalCost &getTerminal() const { return terminal; }
+
+    void clear() {
+        terms.clear();
+        speed_terms.clear();
+    }
+
+    bool empty() const { return terms.empty(); }
+
+    const vector<Term> &getTerms() const { return terms; }
+
+    double value(const double *x) const {
+        double cost = 0;
+        for (const Term &term : terms) {
+            double r = residual(term, x);
+            cost += term.weight * r * r;
+        }
+        return cost;
+    }
+
+    // Write the gradient of value() at `x` into `grad`, of n_vars entries.
+    void gradient(const double *x, size_t n_vars, double *grad) const {
+        for (size_t k = 0; k < n_vars; k++) {
+            grad[k] = 0;
+        }
+        for (const Term &term : terms) {
+            double g = 2 * term.weight * residual(term, x);
+            grad[term.i] += g;
+            if (term.j != none) {
+                grad[term.j] -= term.scale * g;
+            }
+        }
+    }
+
+private:
+    struct SpeedTerm {
+        size_t term;
+        size_t stage;
+    };
+
+    vector<Term> terms;
+    // The terms against the speed of a stage.
+    vector<SpeedTerm> speed_terms;
+    // The three terms of the terminal cost, the cte and epsi form, epsi
+    // and the speed, kept even at zero weight for a fixed sparsity.
+    size_t terminal_terms = 0;
+    TerminalCost terminal;
+
+    static double residual(const Term &term, const double *x) {
+        return x[term.i] - (term.j != none ? term.scale * x[term.j] : term.ref);
+    }
+
+};
+
+#endif /* SEPARABLE_COST_H */
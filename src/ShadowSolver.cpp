@@ -0,0 +1,71 @@
+#include "ShadowSolver.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <chrono>
+#include <cmath>
+#include "Controller.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+// Longest the thread sleeps before looking for a frame, should it miss
+// the notification of one.
+static const chrono::milliseconds poll_interval(5);
+
+ShadowSolver::ShadowSolver(SolverBackend backend, const CostWeights &weights) : stopping(false) {
+    configureMpc(mpc);
+    mpc.setBackend(backend);
+    mpc.setCostWeights(weights);
+    mpc.setWarmStart(true);
+    worker = thread(&ShadowSolver::run, this);
+}
+
+ShadowSolver::~ShadowSolver() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void ShadowSolver::submit(const ShadowFrame &frame) {
+    frames.back() = frame;
+    if (frames.publish()) {
+        Metrics::recordShadowSkipped();
+    }
+    // Without the lock: a notification missed is made up for by the poll.
+    wake.notify_one();
+}
+
+void ShadowSolver::run() {
+#ifdef __linux__
+    sched_param param;
+    param.sched_priority = 0;
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) {
+        MPC_LOG(LOG_WARN, "Cannot run the shadow solver at idle priority");
+    }
+#endif
+    unique_lock<mutex> guard(lock);
+    while (!stopping) {
+        wake.wait_for(guard, poll_interval);
+        if (stopping) {
+            break;
+        }
+        guard.unlock();
+        while (frames.update()) {
+            MPC_TRACE_SCOPE("shadow_solve");
+            const ShadowFrame &frame = frames.front();
+            if (frame.horizon != mpc.getHorizon()) {
+                mpc.setHorizon(frame.horizon);
+            }
+            mpc.setSpeedProfile(frame.profile);
+            mpc.Solve(frame.state, frame.coeffs, stats, Deadline::max(), solution);
+            Metrics::recordShadow(stats, frame.wall_time, fabs(solution.delta - frame.delta),
+                                  fabs(solution.a - frame.a));
+        }
+        guard.lock();
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef SHADOW_SOLVER_H
+#define SHADOW_SOLVER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "MPC.h"
+#include "TripleBuffer.h"
+
+using namespace std;
+
+// A frame the primary solve answered, for the shadow to solve again.
+struct ShadowFrame {
+    StateVector state;
+    CubicCoeffs coeffs;
+    SpeedProfile profile;
+    size_t horizon = 0;
+    // The primary's actuations and the wall time of its solve, in s.
+    double delta = 0;
+    double a = 0;
+    double wall_time = 0;
+};
+
+// Shadow mode, see Controller::setShadow: a candidate backend solving the
+// frames of the controller again on a thread of its own, at idle priority
+// where the system has one, and recording in the metrics how far its
+// actuations are from the primary's and how long it took against the
+// primary's solve. The primary only ever publishes into a triple buffer,
+// so a slow shadow never delays a reply; it skips the frames published
+// while it was still solving, which mpc_shadow_skipped_total counts.
+class ShadowSolver {
+public:
+    // Solve with `backend` under `weights`, otherwise set up from the
+    // environment like the controller, see configureMpc.
+    ShadowSolver(SolverBackend backend, const CostWeights &weights);
+
+    // Stops the thread after the solve in progress.
+    ~ShadowSolver();
+
+    // Hand `frame` to the shadow, replacing any it has not picked up yet.
+    void submit(const ShadowFrame &frame);
+
+private:
+    MPC mpc;
+    SolveStats stats;
+    Solution solution;
+    TripleBuffer<ShadowFrame> frames;
+
+    thread worker;
+    mutex lock;
+    condition_variable wake;
+    bool stopping;
+
+    void run();
+};
+
+#endif /* SHADOW_SOLVER_H */
@@ -0,0 +1,170 @@
+#include "ShmChannel.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <climits>
+#include <cstring>
+#include <thread>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+namespace {
+
+// Start of the file, then the telemetry slot and the steer slot. A file of
+// another layout is started afresh.
+struct ShmHeader {
+    char magic[8];
+    uint32_t capacity;
+    uint32_t slot_size;
+};
+
+const char shm_magic[8] = {'M', 'P', 'C', 'S', 'H', 'M', 'C', '1'};
+
+// Checks of the sequence before a reader goes to sleep, when the writer
+// may be running on another CPU. A reply usually comes within a few
+// microseconds of the telemetry, sooner than a futex wake-up. On a single
+// CPU spinning only keeps the writer from running.
+const int spin_checks = 2000;
+
+// The futex word of a slot, shared between processes.
+int *futexWord(ShmSlot &slot) {
+    static_assert(sizeof(atomic<uint32_t>) == sizeof(int), "the futex is the sequence itself");
+    return (int *) &slot.sequence;
+}
+
+// Sleep until the sequence of `slot` is no longer `sequence`, a wake-up
+// or `timeout` passes, whichever is first.
+void sleepOn(ShmSlot &slot, uint32_t sequence, chrono::microseconds timeout) {
+#ifdef __linux__
+    struct timespec ts;
+    ts.tv_sec = timeout.count() / 1000000;
+    ts.tv_nsec = timeout.count() % 1000000 * 1000;
+    syscall(SYS_futex, futexWord(slot), FUTEX_WAIT, (int) sequence, &ts, nullptr, 0);
+#else
+    (void) slot;
+    (void) sequence;
+    this_thread::sleep_for(min(timeout, chrono::microseconds(100)));
+#endif
+}
+
+void wake(ShmSlot &slot) {
+#ifdef __linux__
+    if (slot.waiters.load(memory_order_seq_cst) > 0) {
+        syscall(SYS_futex, futexWord(slot), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+#else
+    (void) slot;
+#endif
+}
+
+} // namespace
+
+ShmChannel::ShmChannel() : telemetry(nullptr), steer(nullptr), mapped_size(0), telemetry_seen(0), steer_seen(0) {}
+
+ShmChannel::~ShmChannel() {
+    if (telemetry) {
+        munmap((char *) telemetry - sizeof(ShmHeader), mapped_size);
+    }
+}
+
+bool ShmChannel::open(const char *path) {
+    int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t size = sizeof(ShmHeader) + 2 * sizeof(ShmSlot);
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || (size_t) st.st_size != size;
+    if (fresh && ftruncate(fd, size) != 0) {
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    ShmHeader *header = (ShmHeader *) mapped;
+    if (fresh || memcmp(header->magic, shm_magic, sizeof(shm_magic)) != 0 ||
+        header->capacity != shm_message_capacity || header->slot_size != sizeof(ShmSlot)) {
+        memset(mapped, 0, size);
+        memcpy(header->magic, shm_magic, sizeof(shm_magic));
+        header->capacity = shm_message_capacity;
+        header->slot_size = sizeof(ShmSlot);
+    }
+    telemetry = (ShmSlot *) (header + 1);
+    steer = telemetry + 1;
+    mapped_size = size;
+    telemetry_seen = telemetry->sequence.load(memory_order_acquire) & ~1u;
+    steer_seen = steer->sequence.load(memory_order_acquire) & ~1u;
+    return true;
+}
+
+bool ShmChannel::sendTelemetry(const string &message) {
+    return send(*telemetry, message);
+}
+
+bool ShmChannel::receiveSteer(string &message, chrono::microseconds timeout) {
+    return receive(*steer, steer_seen, message, timeout);
+}
+
+bool ShmChannel::receiveTelemetry(string &message, chrono::microseconds timeout) {
+    return receive(*telemetry, telemetry_seen, message, timeout);
+}
+
+bool ShmChannel::sendSteer(const string &message) {
+    return send(*steer, message);
+}
+
+bool ShmChannel::send(ShmSlot &slot, const string &message) {
+    if (message.size() > shm_message_capacity) {
+        return false;
+    }
+    uint32_t sequence = slot.sequence.load(memory_order_relaxed);
+    slot.sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.length = (uint32_t) message.size();
+    memcpy(slot.data, message.data(), message.size());
+    slot.sequence.store(sequence + 2, memory_order_seq_cst);
+    wake(slot);
+    return true;
+}
+
+bool ShmChannel::receive(ShmSlot &slot, uint32_t &seen, string &message, chrono::microseconds timeout) {
+    static const int spins = thread::hardware_concurrency() > 1 ? spin_checks : 0;
+    auto deadline = chrono::steady_clock::now() + timeout;
+    int checks = 0;
+    for (;;) {
+        uint32_t sequence = slot.sequence.load(memory_order_acquire);
+        if (!(sequence & 1) && sequence != seen) {
+            uint32_t length = min<uint32_t>(slot.length, shm_message_capacity);
+            message.assign(slot.data, length);
+            atomic_thread_fence(memory_order_acquire);
+            // Torn by a writer meanwhile: take the newer message instead.
+            if (slot.sequence.load(memory_order_relaxed) == sequence) {
+                seen = sequence;
+                return true;
+            }
+            continue;
+        }
+        if (++checks < spins) {
+            continue;
+        }
+        auto left = chrono::duration_cast<chrono::microseconds>(deadline - chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            return false;
+        }
+        slot.waiters.fetch_add(1, memory_order_seq_cst);
+        // Published between the check and the increment: the writer may
+        // not have seen the waiter, so look again before sleeping.
+        if (slot.sequence.load(memory_order_seq_cst) == sequence) {
+            sleepOn(slot, sequence, left);
+        }
+        slot.waiters.fetch_sub(1, memory_order_seq_cst);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Largest message either side of a ShmChannel carries, in bytes: a binary
+// steer event of the longest horizon with a few hundred waypoints.
+const size_t shm_message_capacity = 8192;
+
+// One direction of a ShmChannel: the newest message, and its sequence
+// number, odd while it is being written. Readers sleep on the sequence.
+struct ShmSlot {
+    atomic<uint32_t> sequence;
+    atomic<uint32_t> waiters;
+    uint32_t length;
+    char data[shm_message_capacity];
+};
+
+// Transport between a controller and a simulator on the same host through
+// a memory-mapped file, e.g. under /dev/shm, instead of TCP, the websocket
+// framing and the Socket.IO envelope. The messages are those of
+// BinaryProtocol.h, so they go through the same pipeline as on /binary.
+//
+// Each direction is a single slot holding the newest message, so a frame
+// the controller had no time for is replaced, as on a websocket. A writer
+// bumps the slot's sequence around the copy, a reader copies until it got
+// one that did not change meanwhile. Neither ever waits for the other. On
+// Linux, readers block on a futex on the sequence, woken by the writer only
+// if someone sleeps there; elsewhere they poll. Exactly one process sends
+// each direction.
+class ShmChannel {
+public:
+    ShmChannel();
+
+    ~ShmChannel();
+
+    // Map `path`, creating an empty channel there if it holds none yet. Only
+    // the messages sent from then on are received.
+    bool open(const char *path);
+
+    bool isOpen() const { return telemetry != nullptr; }
+
+    // Simulator side. False for a message beyond shm_message_capacity.
+    bool sendTelemetry(const string &message);
+
+    // Simulator side: the steer message sent since the last one received,
+    // waiting up to `timeout` for one; false if none came.
+    bool receiveSteer(string &message, chrono::microseconds timeout);
+
+    // Controller side, the same in the other direction.
+    bool receiveTelemetry(string &message, chrono::microseconds timeout);
+
+    bool sendSteer(const string &message);
+
+private:
+    ShmSlot *telemetry;
+    ShmSlot *steer;
+    size_t mapped_size;
+    // Sequence of the last message received from each slot.
+    uint32_t telemetry_seen;
+    uint32_t steer_seen;
+
+    static bool send(ShmSlot &slot, const string &message);
+    static bool receive(ShmSlot &slot, uint32_t &seen, string &message, chrono::microseconds timeout);
+};
+
+#endif /* SHM_CHANNEL_H */
@@ -0,0 +1,509 @@
+#include "Simulator.h"
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include "BatchRiccati.h"
+#include "FleetStore.h"
+#include "TaskScheduler.h"
+#include "VehicleModel.h"
+
+// Largest steering angle, reached at a steering input of 1.
+static const double max_steering = 25 * M_PI / 180;
+
+// Speeds in the telemetry are in mph.
+static const double mph_per_mps = 1 / 0.447;
+
+void Plant::step(double steering, double throttle, double dt) {
+    // The simulator steers right for positive inputs, the model left.
+    double delta = -steering * max_steering;
+    x += v * cos(psi) * dt;
+    y += v * sin(psi) * dt;
+    psi += v / Lf * delta * dt;
+    v += throttle * dt;
+}
+
+// Actuations waiting for the latency to pass.
+struct PendingActuation {
+    double time;
+    double steering;
+    double throttle;
+};
+
+// One closed-loop run, advanced a step at a time so that runEpisode drives
+// it alone and runFleet many in lockstep. Every step, frameDue() tells
+// whether the telemetry of a frame is sent; observe() makes it, the
+// controller answers it, answered() counts the answer and apply() queues
+// its actuations.
+class Episode {
+public:
+    Episode(const Track &track, Controller &controller, const SimOptions &options, const PathSpline *spline)
+        : controller(controller), track(track), options(options), rng(options.seed), gauss(0, 1),
+          uniform(-1, 1) {
+        controller.reset();
+        controller.setCostWeights(options.weights);
+        controller.setMap(options.use_map ? &track : nullptr);
+        controller.setReference(options.use_spline ? spline : nullptr);
+        controller.setSpeedProfile(options.speed_profile ? &track : nullptr);
+        controller.setTable(options.table);
+        controller.setDeadlineBudget(chrono::microseconds((long long) (options.deadline_budget * 1e6)));
+
+        plant.x = track.x(options.start_segment);
+        plant.y = track.y(options.start_segment);
+        plant.psi = track.heading(options.start_segment);
+        plant.v = options.start_speed;
+        double shift = options.initial_offset * uniform(rng);
+        plant.x -= sin(plant.psi) * shift;
+        plant.y += cos(plant.psi) * shift;
+        plant.psi += options.initial_heading * uniform(rng);
+
+        projection = track.project(plant.x, plant.y, options.start_segment);
+        goal = options.laps * track.length();
+    }
+
+    bool frameDue() const { return t >= next_frame; }
+
+    // Whether the frame due is solved rather than answered fast, see
+    // SimOptions::solve_every.
+    bool solvesFrame() const { return result.frames % options.solve_every == 0; }
+
+    // The telemetry of the frame due, stamped now.
+    const Telemetry &observe() {
+        if (options.use_map) {
+            telemetry.ptsx.clear();
+            telemetry.ptsy.clear();
+        } else {
+            track.window(projection.segment, options.window, telemetry.ptsx, telemetry.ptsy);
+        }
+        telemetry.x = plant.x + options.position_noise * gauss(rng);
+        telemetry.y = plant.y + options.position_noise * gauss(rng);
+        telemetry.psi = plant.psi + options.heading_noise * gauss(rng);
+        telemetry.speed = (plant.v + options.speed_noise * gauss(rng)) * mph_per_mps;
+        telemetry.steering_angle = steering * max_steering;
+        telemetry.throttle = throttle;
+        telemetry.arrival = chrono::steady_clock::now();
+        return telemetry;
+    }
+
+    // The controller answered the frame, `solved` or fast, in `elapsed`
+    // seconds of wall time.
+    void answered(bool solved, double elapsed) {
+        result.step_times.push_back(elapsed);
+        result.frames++;
+        result.failed_solves += solved && !controller.lastStats().ok();
+        result.speculative += solved && controller.lastStats().speculative;
+        result.degraded += solved && controller.lastStats().degraded;
+    }
+
+    // Queue the actuations of the answer for after the latency.
+    void apply() {
+        // Jitter does not reorder the replies, a late one holds back the
+        // next.
+        double applied = t + options.latency + options.latency_jitter * 0.5 * (1 + uniform(rng));
+        if (!pending.empty()) {
+            applied = fmax(applied, pending.back().time);
+        }
+        pending.push_back({applied, controller.lastSteering(), controller.lastThrottle()});
+        next_frame += options.control_period;
+    }
+
+    // Integrate one step; false once the run is over.
+    bool advance() {
+        while (!pending.empty() && pending.front().time <= t) {
+            steering = pending.front().steering;
+            throttle = pending.front().throttle;
+            pending.pop_front();
+        }
+
+        plant.step(steering, throttle, options.dt);
+        speed_sum += plant.v;
+        n_steps++;
+
+        // Arc length driven, unwrapped across the start of the loop.
+        Track::Projection next = track.project(plant.x, plant.y, projection.segment);
+        double ds = next.s - projection.s;
+        if (ds < -0.5 * track.length()) {
+            ds += track.length();
+        } else if (ds > 0.5 * track.length()) {
+            ds -= track.length();
+        }
+        distance += ds;
+        projection = next;
+
+        result.max_offset = fmax(result.max_offset, fabs(projection.offset));
+        offset_sum += projection.offset * projection.offset;
+        if (result.max_offset > options.max_offset || !isfinite(plant.x) || !isfinite(plant.y)) {
+            return false;
+        }
+        if (distance >= goal) {
+            result.completed = true;
+            t += options.dt;
+            return false;
+        }
+        t += options.dt;
+        return t < options.max_time;
+    }
+
+    EpisodeResult finish() {
+        result.time = t;
+        result.mean_speed = n_steps > 0 ? speed_sum / n_steps : 0;
+        result.rms_offset = n_steps > 0 ? sqrt(offset_sum / n_steps) : 0;
+        return std::move(result);
+    }
+
+    Controller &controller;
+    ControlFrame frame;
+    string reply;
+
+private:
+    const Track &track;
+    const SimOptions &options;
+    EpisodeResult result;
+    mt19937 rng;
+    normal_distribution<double> gauss;
+    uniform_real_distribution<double> uniform;
+
+    Plant plant;
+    Track::Projection projection;
+    double distance = 0;
+    double goal = 0;
+
+    double steering = 0;
+    double throttle = 0;
+    deque<PendingActuation> pending;
+    Telemetry telemetry;
+    double t = 0;
+    double next_frame = 0;
+    double speed_sum = 0;
+    double offset_sum = 0;
+    size_t n_steps = 0;
+};
+
+EpisodeResult runEpisode(const Track &track, Controller &controller, const SimOptions &options,
+                         const PathSpline *spline) {
+    Episode episode(track, controller, options, spline);
+    ControlFrame &frame = episode.frame;
+    string &reply = episode.reply;
+    if (options.max_time <= 0) {
+        return episode.finish();
+    }
+    do {
+        if (!episode.frameDue()) {
+            continue;
+        }
+        const Telemetry &telemetry = episode.observe();
+        bool solved = episode.solvesFrame();
+        if (solved && options.speculate) {
+            controller.prepare(telemetry, frame);
+            controller.solve(frame, reply);
+        } else if (solved) {
+            controller.step(telemetry, reply);
+        } else {
+            controller.prepare(telemetry, frame);
+            controller.solveFast(frame, reply);
+        }
+        episode.answered(solved, chrono::duration<double>(chrono::steady_clock::now() - telemetry.arrival).count());
+        if (solved && options.speculate) {
+            controller.speculate(frame, options.control_period);
+        }
+        episode.apply();
+    } while (episode.advance());
+    return episode.finish();
+}
+
+bool prepareSpeedProfile(Track &track, const char *spec) {
+    if (strcmp(spec, "map") == 0) {
+        return track.hasSpeedProfile();
+    }
+    Track::SpeedLimits limits;
+    sscanf(spec, "%lf:%lf:%lf", &limits.lateral, &limits.accel, &limits.braking);
+    if (!(limits.lateral > 0 && limits.accel > 0 && limits.braking > 0)) {
+        return false;
+    }
+    PathSpline spline;
+    track.buildSpeedProfile(spline.build(track) ? &spline : nullptr, limits);
+    return true;
+}
+
+vector<EpisodeResult> runBatch(const Track &track, const vector<SimOptions> &options, size_t n_threads) {
+    vector<EpisodeResult> results(options.size());
+    PathSpline spline;
+    bool has_spline = spline.build(track);
+    atomic<size_t> next(0);
+    auto work = [&] {
+        // One controller per task, reset for each episode.
+        Controller controller;
+        for (size_t i = next++; i < options.size(); i = next++) {
+            results[i] = runEpisode(track, controller, options[i], has_spline ? &spline : nullptr);
+        }
+    };
+
+    auto helper = [&](size_t) { work(); };
+    TaskGroup helpers(TASK_LOW);
+    helpers.run(1, min(n_threads, options.size()), helper);
+    work();
+    helpers.wait();
+    return results;
+}
+
+// Simulated time the prototype of runForked is driven for.
+static const double fork_warm_time = 2.0;
+
+// An episode's result as a process of runForked sends it, followed by
+// its n_steps step times.
+struct ForkedResult {
+    uint64_t index;
+    uint64_t completed;
+    double time;
+    double max_offset;
+    double rms_offset;
+    double mean_speed;
+    uint64_t frames;
+    uint64_t failed_solves;
+    uint64_t speculative;
+    uint64_t degraded;
+    uint64_t n_steps;
+};
+
+static bool writeAll(int fd, const void *data, size_t length) {
+    const char *p = (const char *) data;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *data, size_t length) {
+    char *p = (char *) data;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool writeResult(int fd, size_t index, const EpisodeResult &result) {
+    ForkedResult out = {index, result.completed, result.time, result.max_offset, result.rms_offset,
+                        result.mean_speed, result.frames, result.failed_solves, result.speculative,
+                        result.degraded, result.step_times.size()};
+    return writeAll(fd, &out, sizeof(out)) &&
+           writeAll(fd, result.step_times.data(), result.step_times.size() * sizeof(double));
+}
+
+// False at the end of the pipe or on a short result.
+static bool readResult(int fd, size_t &index, EpisodeResult &result) {
+    ForkedResult in;
+    if (!readAll(fd, &in, sizeof(in))) {
+        return false;
+    }
+    index = in.index;
+    result.completed = in.completed != 0;
+    result.time = in.time;
+    result.max_offset = in.max_offset;
+    result.rms_offset = in.rms_offset;
+    result.mean_speed = in.mean_speed;
+    result.frames = in.frames;
+    result.failed_solves = in.failed_solves;
+    result.speculative = in.speculative;
+    result.degraded = in.degraded;
+    result.step_times.resize(in.n_steps);
+    return readAll(fd, result.step_times.data(), in.n_steps * sizeof(double));
+}
+
+vector<EpisodeResult> runForked(const Track &track, const vector<SimOptions> &options, size_t n_processes) {
+    vector<EpisodeResult> results(options.size());
+    if (options.empty()) {
+        return results;
+    }
+    PathSpline spline;
+    const PathSpline *reference = spline.build(track) ? &spline : nullptr;
+
+    Controller prototype;
+    SimOptions warm = options[0];
+    warm.max_time = fmin(warm.max_time, fork_warm_time);
+    runEpisode(track, prototype, warm, reference);
+
+    // The next episode to run, shared by the processes.
+    void *shared = mmap(nullptr, sizeof(atomic<size_t>), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    vector<pid_t> children;
+    vector<int> pipes;
+    if (shared != MAP_FAILED) {
+        atomic<size_t> *next = new (shared) atomic<size_t>(0);
+        for (size_t k = 0; k < min(n_processes, options.size()); k++) {
+            int fds[2];
+            if (pipe(fds) != 0) {
+                break;
+            }
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(fds[0]);
+                for (int fd : pipes) {
+                    close(fd);
+                }
+                for (size_t i = (*next)++; i < options.size(); i = (*next)++) {
+                    EpisodeResult result = runEpisode(track, prototype, options[i], reference);
+                    if (!writeResult(fds[1], i, result)) {
+                        break;
+                    }
+                }
+                // Without the destructors of this process's statics, whose
+                // threads, e.g. the logger's, were not forked.
+                _exit(0);
+            }
+            close(fds[1]);
+            if (pid < 0) {
+                close(fds[0]);
+                break;
+            }
+            children.push_back(pid);
+            pipes.push_back(fds[0]);
+        }
+    }
+
+    // A process blocked on its pipe meanwhile only holds up itself.
+    vector<char> done(options.size(), 0);
+    for (int fd : pipes) {
+        size_t i;
+        EpisodeResult result;
+        while (readResult(fd, i, result) && i < options.size()) {
+            results[i] = std::move(result);
+            done[i] = 1;
+        }
+        close(fd);
+    }
+    for (pid_t pid : children) {
+        waitpid(pid, nullptr, 0);
+    }
+    if (shared != MAP_FAILED) {
+        munmap(shared, sizeof(atomic<size_t>));
+    }
+    for (size_t i = 0; i < options.size(); i++) {
+        if (!done[i]) {
+            results[i] = runEpisode(track, prototype, options[i], reference);
+        }
+    }
+    return results;
+}
+
+vector<EpisodeResult> runFleet(const Track &track, const vector<SimOptions> &options, size_t n_threads) {
+    size_t n = options.size();
+    PathSpline spline;
+    bool has_spline = spline.build(track);
+    vector<unique_ptr<Controller> > controllers(n);
+    vector<unique_ptr<Episode> > episodes(n);
+    vector<char> running(n, 0);
+    for (size_t i = 0; i < n; i++) {
+        controllers[i].reset(new Controller);
+        episodes[i].reset(new Episode(track, *controllers[i], options[i], has_spline ? &spline : nullptr));
+        running[i] = options[i].max_time > 0;
+    }
+
+    // The problems, actuations and warm starts of the vehicles, structure
+    // of arrays, and the frames of a tick dealt out in whole SIMD packets to
+    // one batch per thread.
+    struct Batch {
+        MPC mpc;
+        vector<size_t> vehicles;
+        vector<size_t> slots;
+        vector<SolveStats> stats;
+    };
+    vector<unique_ptr<Batch> > batches(max<size_t>(1, n_threads));
+    for (auto &batch : batches) {
+        batch.reset(new Batch);
+        configureMpc(batch->mpc);
+    }
+    FleetStore fleet(batches[0]->mpc.getBatchWarmStartSize());
+    vector<FleetHandle> handles(n);
+    for (size_t i = 0; i < n; i++) {
+        handles[i] = fleet.add();
+    }
+    vector<size_t> due;
+
+    for (bool any = true; any;) {
+        due.clear();
+        for (size_t i = 0; i < n; i++) {
+            if (running[i] && episodes[i]->frameDue()) {
+                due.push_back(i);
+            }
+        }
+        if (!due.empty()) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            size_t packets = (due.size() + batch_lanes - 1) / batch_lanes;
+            size_t n_batches = min(batches.size(), packets);
+            for (size_t b = 0; b < n_batches; b++) {
+                Batch &batch = *batches[b];
+                size_t first = packets * b / n_batches * batch_lanes;
+                size_t last = min(due.size(), packets * (b + 1) / n_batches * batch_lanes);
+                batch.vehicles.assign(due.begin() + first, due.begin() + last);
+                batch.slots.resize(batch.vehicles.size());
+                for (size_t k = 0; k < batch.vehicles.size(); k++) {
+                    batch.slots[k] = handles[batch.vehicles[k]].slot;
+                }
+            }
+            // Gather, solve and scatter each batch on a thread of its own.
+            auto solveBatch = [&](size_t b) {
+                Batch &batch = *batches[b];
+                for (size_t k = 0; k < batch.vehicles.size(); k++) {
+                    Episode &episode = *episodes[batch.vehicles[k]];
+                    episode.controller.prepare(episode.observe(), episode.frame);
+                    fleet.setProblem(batch.slots[k], episode.frame.state, episode.frame.coeffs);
+                }
+                batch.mpc.SolveBatch(fleet, batch.slots, batch.stats);
+                for (size_t k = 0; k < batch.vehicles.size(); k++) {
+                    Episode &episode = *episodes[batch.vehicles[k]];
+                    size_t slot = batch.slots[k];
+                    episode.controller.answer(episode.frame, fleet.delta()[slot], fleet.a()[slot], batch.stats[k],
+                                              episode.reply);
+                }
+            };
+            TaskGroup helpers(TASK_LOW);
+            helpers.run(1, n_batches, solveBatch);
+            solveBatch(0);
+            helpers.wait();
+            // The tick's time, shared by its vehicles.
+            double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count() / due.size();
+            for (size_t i : due) {
+                episodes[i]->answered(true, elapsed);
+                episodes[i]->apply();
+            }
+        }
+        any = false;
+        for (size_t i = 0; i < n; i++) {
+            if (running[i]) {
+                running[i] = episodes[i]->advance();
+                any = any || running[i];
+            }
+        }
+    }
+
+    vector<EpisodeResult> results(n);
+    for (size_t i = 0; i < n; i++) {
+        results[i] = episodes[i]->finish();
+    }
+    return results;
+}
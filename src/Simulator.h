@@ -0,0 +1,141 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <cstddef>
+#include <vector>
+#include "Controller.h"
+#include "PathSpline.h"
+#include "Track.h"
+
+using namespace std;
+
+// Kinematic bicycle of VehicleModel.h, in map coordinates, with the correct
+// y update.
+struct Plant {
+    double x = 0;
+    double y = 0;
+    double psi = 0;
+    // Speed in m/s.
+    double v = 0;
+
+    // Advance by dt with the actuations in the simulator's convention, see
+    // Controller::lastSteering.
+    void step(double steering, double throttle, double dt);
+};
+
+// One closed-loop run of the controller against the plant.
+struct SimOptions {
+    // Integration step and time between telemetry frames, in seconds.
+    double dt = 0.01;
+    double control_period = 0.1;
+    // Time from a telemetry frame until its actuations are applied.
+    double latency = 0.1;
+    // Solve deadline after each frame, see Controller::setDeadlineBudget.
+    // The loop does not run in real time, so none by default.
+    double deadline_budget = 0;
+    int laps = 1;
+    // Give up after this much simulated time.
+    double max_time = 600;
+    // The car has left the track beyond this distance from the center line.
+    double max_offset = 6;
+    // Start on this segment of the track, at this speed in m/s.
+    size_t start_segment = 0;
+    double start_speed = 0;
+    // Waypoints sent per frame, like the simulator's.
+    size_t window = 6;
+    // Let the controller look the waypoints up on the track, see
+    // Controller::setMap, and send none in the telemetry.
+    bool use_map = false;
+    // Reference polynomial from a spline of the track, see
+    // Controller::setReference.
+    bool use_spline = false;
+    // Drive the speed profile of the track, see Controller::setSpeedProfile.
+    bool speed_profile = false;
+    // Look the actuations up here where it is validated, see
+    // Controller::setTable.
+    const ControlTable *table = nullptr;
+    // Solve every n-th frame only and answer the others without solving,
+    // see Controller::solveFast, as a saturated server does.
+    size_t solve_every = 1;
+    // Solve ahead for the next frame after every solved one, see
+    // Controller::speculate.
+    bool speculate = false;
+    CostWeights weights;
+    // Randomization of the episode, drawn from `seed`, none by default:
+    // gaussian noise of these deviations on the position in m, the
+    // heading in rad and the speed in m/s of the telemetry, up to
+    // `latency_jitter` seconds more latency for each frame, uniformly, and
+    // a start up to `initial_offset` m to either side of the center line,
+    // turned by up to `initial_heading` rad.
+    unsigned seed = 0;
+    double position_noise = 0;
+    double heading_noise = 0;
+    double speed_noise = 0;
+    double latency_jitter = 0;
+    double initial_offset = 0;
+    double initial_heading = 0;
+};
+
+struct EpisodeResult {
+    // All laps were driven without leaving the track.
+    bool completed = false;
+    // Simulated time until the laps were completed or the run ended.
+    double time = 0;
+    double max_offset = 0;
+    // Root mean square of the offset from the center line over the run.
+    double rms_offset = 0;
+    double mean_speed = 0;
+    size_t frames = 0;
+    size_t failed_solves = 0;
+    // Solved frames answered by their speculation, see
+    // SimOptions::speculate.
+    size_t speculative = 0;
+    // Solved frames answered by a degraded tier without a solve, see
+    // Controller::setDegradation.
+    size_t degraded = 0;
+    // Wall time of every Controller::step, in seconds.
+    vector<double> step_times;
+};
+
+// Drive `controller` around `track` as the simulator would, faster than
+// real time. `spline` is the spline of `track` for SimOptions::use_spline.
+EpisodeResult runEpisode(const Track &track, Controller &controller, const SimOptions &options,
+                         const PathSpline *spline = nullptr);
+
+// Give `track` the speed profile of `spec` for SimOptions::speed_profile:
+// one built within the accelerations it gives, in m/s^2, on the
+// spline of the track, or with "map" the one of its map file. False if it
+// has none.
+bool prepareSpeedProfile(Track &track, const char *spec);
+
+// Run every entry of `options` with a fresh controller, on `n_threads`
+// threads at a time, the caller's and low priority tasks of the
+// TaskScheduler. The results are in the order of `options`.
+vector<EpisodeResult> runBatch(const Track &track, const vector<SimOptions> &options, size_t n_threads);
+
+// Run every entry of `options` in `n_processes` processes forked from
+// this one, sharing one prototype controller set up before: it drives the
+// first entry for a few simulated seconds, so its IPOPT applications,
+// tapes and sparsity patterns are built. Each process then runs episodes
+// one at a time on its copy of the prototype, reset for each. The copy is
+// copy-on-write, so what the episodes only read, the tapes, the patterns
+// and the track, stays in the pages of this process, and no episode sets
+// up a controller. The results come back over pipes, in the order of
+// `options`; those of a process that died are run again here. The
+// processes only have the calling thread, so the controllers must not
+// rely on threads started before, e.g. of MPC_EVAL_THREADS.
+vector<EpisodeResult> runForked(const Track &track, const vector<SimOptions> &options, size_t n_processes);
+
+// Run every entry of `options` at once as one fleet, in lockstep: at every
+// integration step the frames due of all vehicles are gathered, split in
+// whole SIMD packets over `n_threads` batches, solved together by
+// MPC::SolveBatch, batched RTI, and the actuations scattered back to their
+// controllers, see Controller::answer. The problems, actuations and warm
+// starts of the vehicles live in a FleetStore, each vehicle warm started
+// from its own previous trajectory. The step
+// times are those of the tick shared by its frames. The options of the
+// controllers' own solve paths, speculate, solve_every and table, do not
+// apply.
+vector<EpisodeResult> runFleet(const Track &track, const vector<SimOptions> &options, size_t n_threads);
+
+#endif /* SIMULATOR_H */
@@ -0,0 +1,417 @@
+#include "SlowSolveLog.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "BlockCompression.h"
+#include "Logger.h"
+
+namespace {
+
+const char slow_solve_magic[8] = {'M', 'P', 'C', 'S', 'L', 'O', 'W', '4'};
+const char slow_solve_compressed_magic[8] = {'M', 'P', 'C', 'S', 'L', 'O', 'Z', '4'};
+
+// Dumps waiting for the writer beyond which new ones are dropped.
+const size_t max_pending = 64;
+
+template <typename T>
+void put(string &out, const T &value) {
+    out.append((const char *) &value, sizeof(value));
+}
+
+void putString(string &out, const string &s) {
+    put(out, (uint32_t) s.size());
+    out += s;
+}
+
+template <typename T>
+void putVector(string &out, const vector<T> &v) {
+    put(out, (uint32_t) v.size());
+    out.append((const char *) v.data(), v.size() * sizeof(T));
+}
+
+// Reads fields off a record, failing for good once one is short.
+struct Cursor {
+    const char *data;
+    size_t end;
+    size_t at;
+    bool ok;
+
+    template <typename T>
+    T get() {
+        T value = T();
+        if (ok && end - at >= sizeof(value)) {
+            memcpy(&value, data + at, sizeof(value));
+            at += sizeof(value);
+        } else {
+            ok = false;
+        }
+        return value;
+    }
+
+    void getString(string &s) {
+        uint32_t n = get<uint32_t>();
+        if (ok && end - at >= n) {
+            s.assign(data + at, n);
+            at += n;
+        } else {
+            ok = false;
+        }
+    }
+
+    template <typename T>
+    void getVector(vector<T> &v) {
+        uint32_t n = get<uint32_t>();
+        if (ok && (end - at) / sizeof(T) >= n) {
+            v.resize(n);
+            memcpy(v.data(), data + at, n * sizeof(T));
+            at += n * sizeof(T);
+        } else {
+            ok = false;
+        }
+    }
+};
+
+void encode(const ProblemInstance &p, string &out) {
+    size_t start = out.size();
+    put(out, (uint32_t) 0);
+    put(out, p.dump);
+    put(out, (uint8_t) p.trigger);
+    put(out, p.time);
+
+    put(out, (int32_t) p.backend);
+    put(out, (int32_t) p.model);
+    put(out, (int32_t) p.formulation);
+    put(out, (uint32_t) p.horizon);
+    put(out, (uint8_t) p.warm_starting);
+    put(out, p.weights);
+
+    const MpcOptions &o = p.options;
+    putString(out, o.linear_solver);
+    putString(out, o.mu_strategy);
+    put(out, o.tol);
+    put(out, o.acceptable_tol);
+    put(out, (uint8_t) o.exact_hessian);
+    put(out, o.bound_push);
+    put(out, (uint8_t) o.user_scaling);
+    put(out, (uint32_t) o.eval_threads);
+    put(out, (uint32_t) o.mppi_samples);
+    put(out, (uint8_t) o.mppi_gpu);
+    put(out, (int32_t) o.cgmres_directions);
+    put(out, (uint32_t) o.warm_library);
+    put(out, (uint32_t) o.solution_cache);
+    put(out, (uint32_t) o.multi_start);
+    put(out, (int32_t) o.rti_iterations);
+    put(out, (int32_t) o.rti_qp);
+    put(out, (uint8_t) o.predictor);
+    put(out, (uint8_t) o.single_precision);
+    put(out, (int32_t) o.geometric_law);
+
+    putVector(out, p.state);
+    putVector(out, p.coeffs);
+    put(out, p.budget);
+    put(out, (uint8_t) p.has_warm_start);
+    put(out, (uint32_t) p.fallbacks);
+    putVector(out, p.warm_start);
+
+    put(out, (int32_t) p.status);
+    put(out, (int32_t) p.seed);
+    put(out, (int32_t) p.iterations);
+    put(out, p.wall_time);
+    put(out, p.objective);
+    put(out, p.delta);
+    put(out, p.a);
+    putVector(out, p.trace);
+
+    uint32_t length = out.size() - start - sizeof(uint32_t);
+    memcpy(&out[start], &length, sizeof(length));
+}
+
+bool decode(Cursor &c, ProblemInstance &p) {
+    p.dump = c.get<uint32_t>();
+    p.trigger = c.get<uint8_t>();
+    p.time = c.get<int64_t>();
+
+    p.backend = (SolverBackend) c.get<int32_t>();
+    p.model = (ModelVariant) c.get<int32_t>();
+    p.formulation = (Formulation) c.get<int32_t>();
+    p.horizon = c.get<uint32_t>();
+    p.warm_starting = c.get<uint8_t>();
+    p.weights = c.get<CostWeights>();
+
+    MpcOptions &o = p.options;
+    c.getString(o.linear_solver);
+    c.getString(o.mu_strategy);
+    o.tol = c.get<double>();
+    o.acceptable_tol = c.get<double>();
+    o.exact_hessian = c.get<uint8_t>();
+    o.bound_push = c.get<double>();
+    o.user_scaling = c.get<uint8_t>();
+    o.eval_threads = c.get<uint32_t>();
+    o.mppi_samples = c.get<uint32_t>();
+    o.mppi_gpu = c.get<uint8_t>();
+    o.cgmres_directions = c.get<int32_t>();
+    o.warm_library = c.get<uint32_t>();
+    o.solution_cache = c.get<uint32_t>();
+    o.multi_start = c.get<uint32_t>();
+    o.rti_iterations = c.get<int32_t>();
+    o.rti_qp = (RtiQp) c.get<int32_t>();
+    o.predictor = c.get<uint8_t>();
+    o.single_precision = c.get<uint8_t>();
+    o.geometric_law = (GeometricLaw) c.get<int32_t>();
+
+    c.getVector(p.state);
+    c.getVector(p.coeffs);
+    p.budget = c.get<double>();
+    p.has_warm_start = c.get<uint8_t>();
+    p.fallbacks = c.get<uint32_t>();
+    c.getVector(p.warm_start);
+
+    p.status = (SolveStatus) c.get<int32_t>();
+    p.seed = (SolveSeed) c.get<int32_t>();
+    p.iterations = c.get<int32_t>();
+    p.wall_time = c.get<double>();
+    p.objective = c.get<double>();
+    p.delta = c.get<double>();
+    p.a = c.get<double>();
+    c.getVector(p.trace);
+    return c.ok;
+}
+
+class Backend {
+public:
+    Backend()
+        : file(nullptr), threshold(0.020), context(3), dumps(0), n_dropped(0), level(compressionLevel()),
+          stopping(false) {
+        const char *s = getenv("MPC_SLOW_SOLVES");
+        if (!s || !*s) {
+            return;
+        }
+        // <file>[:<ms>[:<context>]], the file name itself may hold colons.
+        string path = s;
+        vector<string> numbers;
+        while (numbers.size() < 2) {
+            size_t colon = path.rfind(':');
+            if (colon == string::npos || colon + 1 == path.size() ||
+                path.find_first_not_of("0123456789.", colon + 1) != string::npos) {
+                break;
+            }
+            numbers.insert(numbers.begin(), path.substr(colon + 1));
+            path.resize(colon);
+        }
+        if (numbers.size() > 0) {
+            threshold = atof(numbers[0].c_str()) / 1000;
+        }
+        if (numbers.size() > 1) {
+            context = min<size_t>(strtoul(numbers[1].c_str(), nullptr, 10), SlowSolveRing::capacity - 1);
+        }
+        file = fopen(path.c_str(), "wb");
+        const char *magic = level ? slow_solve_compressed_magic : slow_solve_magic;
+        if (!file || fwrite(magic, sizeof(slow_solve_magic), 1, file) != 1) {
+            MPC_LOG(LOG_ERROR, "Cannot write slow solves to %s", path.c_str());
+            if (file) {
+                fclose(file);
+                file = nullptr;
+            }
+            return;
+        }
+        writer = thread(&Backend::run, this);
+    }
+
+    ~Backend() {
+        if (!file) {
+            return;
+        }
+        {
+            lock_guard<mutex> hold(lock);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        writer.join();
+        fclose(file);
+    }
+
+    FILE *file;
+    double threshold;
+    size_t context;
+    atomic<uint32_t> dumps;
+    atomic<size_t> n_dropped;
+
+    void submit(string &records, size_t n) {
+        {
+            lock_guard<mutex> hold(lock);
+            if (pending.size() >= max_pending) {
+                n_dropped.fetch_add(n, memory_order_relaxed);
+                return;
+            }
+            pending.push_back(string());
+            swap(pending.back(), records);
+        }
+        wakeup.notify_one();
+    }
+
+private:
+    // Each dump is a block of its own when compressing.
+    int level;
+    mutex lock;
+    condition_variable wakeup;
+    bool stopping;
+    deque<string> pending;
+    thread writer;
+
+    void run() {
+        unique_lock<mutex> hold(lock);
+        for (;;) {
+            wakeup.wait(hold, [this] {
+                return stopping || !pending.empty();
+            });
+            if (pending.empty()) {
+                return;
+            }
+            string records;
+            swap(records, pending.front());
+            pending.pop_front();
+            hold.unlock();
+            if (level) {
+                string block;
+                appendBlock(records.data(), records.size(), level, block);
+                swap(records, block);
+            }
+            fwrite(records.data(), 1, records.size(), file);
+            fflush(file);
+            hold.lock();
+        }
+    }
+};
+
+// Decode the records of the `size` bytes at `data` into `problems`; false
+// if a record is truncated.
+bool readRecords(const char *data, size_t size, vector<ProblemInstance> &problems) {
+    size_t offset = 0;
+    while (offset < size) {
+        Cursor header = {data, size, offset, true};
+        uint32_t length = header.get<uint32_t>();
+        if (!header.ok || size - header.at < length) {
+            return false;
+        }
+        Cursor c = {data, header.at + length, header.at, true};
+        ProblemInstance p;
+        if (!decode(c, p)) {
+            return false;
+        }
+        problems.push_back(std::move(p));
+        offset = header.at + length;
+    }
+    return true;
+}
+
+Backend &backend() {
+    static Backend instance;
+    return instance;
+}
+
+} // namespace
+
+const size_t SlowSolveRing::capacity;
+
+SlowSolveRing::SlowSolveRing() : n_problems(0) {}
+
+ProblemInstance &SlowSolveRing::next() {
+    ProblemInstance &p = problems[n_problems % capacity];
+    p.time = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    return p;
+}
+
+void SlowSolveRing::finish(const SolveStats &stats, const Solution &solution, const IterationTrace &trace) {
+    ProblemInstance &p = problems[n_problems % capacity];
+    n_problems++;
+    p.status = stats.status;
+    p.seed = stats.seed;
+    p.iterations = stats.iterations;
+    p.wall_time = stats.wall_time;
+    p.objective = stats.objective;
+    p.delta = solution.delta;
+    p.a = solution.a;
+    p.trace.resize(trace.size());
+    for (size_t i = 0; i < trace.size(); i++) {
+        p.trace[i] = trace[i];
+    }
+
+    Backend &log = backend();
+    if (stats.ok() && stats.wall_time <= log.threshold) {
+        return;
+    }
+    size_t n = min(n_problems, log.context + 1);
+    uint32_t dump = log.dumps.fetch_add(1, memory_order_relaxed);
+    string records;
+    for (size_t i = n_problems - n; i < n_problems; i++) {
+        ProblemInstance &q = problems[i % capacity];
+        q.dump = dump;
+        q.trigger = i + 1 == n_problems;
+        encode(q, records);
+    }
+    log.submit(records, n);
+}
+
+namespace SlowSolveLog {
+
+bool enabled() {
+    return backend().file != nullptr;
+}
+
+size_t dropped() {
+    return backend().n_dropped.load(memory_order_relaxed);
+}
+
+bool read(const char *path, vector<ProblemInstance> &problems) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(slow_solve_magic)) {
+        close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    const char *data = (const char *) mapped;
+    size_t size = st.st_size;
+    bool compressed = memcmp(data, slow_solve_compressed_magic, sizeof(slow_solve_magic)) == 0;
+    if (!compressed && memcmp(data, slow_solve_magic, sizeof(slow_solve_magic)) != 0) {
+        munmap(mapped, size);
+        return false;
+    }
+
+    if (compressed) {
+        vector<CompressedBlock> blocks;
+        indexBlocks(data + sizeof(slow_solve_magic), size - sizeof(slow_solve_magic), blocks);
+        string records;
+        for (CompressedBlock block : blocks) {
+            block.offset += sizeof(slow_solve_magic);
+            if (!inflateBlock(data, block, records) || !readRecords(records.data(), records.size(), problems)) {
+                break;
+            }
+        }
+    } else {
+        readRecords(data + sizeof(slow_solve_magic), size - sizeof(slow_solve_magic), problems);
+    }
+    munmap(mapped, size);
+    return true;
+}
+
+} // namespace SlowSolveLog
@@ -0,0 +1,109 @@
+#ifndef SLOW_SOLVE_LOG_H
+#define SLOW_SOLVE_LOG_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "MPC.h"
+
+using namespace std;
+
+// Everything one call of MPC::Solve depended on, and what it returned.
+struct ProblemInstance {
+    // Number of the dump within the file and whether this is the problem
+    // that caused it, see SlowSolveRing; the others came before it.
+    uint32_t dump = 0;
+    bool trigger = false;
+    // Wall clock of the call, nanoseconds since the epoch.
+    int64_t time = 0;
+
+    // The configuration of the MPC.
+    SolverBackend backend = CPPAD_IPOPT;
+    ModelVariant model = CARTESIAN_MODEL;
+    Formulation formulation = MULTIPLE_SHOOTING;
+    size_t horizon = 0;
+    bool warm_starting = false;
+    CostWeights weights;
+    MpcOptions options;
+
+    vector<double> state;
+    vector<double> coeffs;
+    // Time from the call to the deadline in s, negative without one.
+    double budget = -1;
+    // The decision vector the solve was warm started from, see
+    // MPC::getWarmStart, and the fallbacks in a row before it.
+    bool has_warm_start = false;
+    size_t fallbacks = 0;
+    vector<double> warm_start;
+
+    // How it went.
+    SolveStatus status = SOLVE_FAILED;
+    SolveSeed seed = SEED_ZERO;
+    int iterations = -1;
+    double wall_time = 0;
+    double objective = 0;
+    double delta = 0;
+    double a = 0;
+    // The iterations it took, those an IterationTrace held, see
+    // MPC::setIterationTrace; empty for the backends without one.
+    vector<IterationRecord> trace;
+};
+
+// The last problems an MPC solved, copied in before each solve so that the
+// warm start is the one the solve started from. When a solve takes longer
+// than the threshold of the log or fails, it goes to the log along with
+// the problems before it, which a replay solves first to bring the state
+// beyond the warm start, the RTI linearization or the active set, back to
+// where it was. Only used by its MPC's thread.
+class SlowSolveRing {
+public:
+    static const size_t capacity = 8;
+
+    SlowSolveRing();
+
+    // The slot of the problem about to be solved, keeping the storage of
+    // the one it held.
+    ProblemInstance &next();
+
+    // After the solve of the problem of next(), with the trace it filled.
+    void finish(const SolveStats &stats, const Solution &solution, const IterationTrace &trace);
+
+    // What the MPC traces into while no other trace is set.
+    IterationTrace trace;
+
+private:
+    array<ProblemInstance, capacity> problems;
+    // Problems solved through the ring so far.
+    size_t n_problems;
+};
+
+// Binary log of the problems of slow or failed solves, for mpc_bench -D to
+// solve them again in isolation.
+//
+// MPC_SLOW_SOLVES=<file>[:<ms>[:<context>]] turns it on: every solve over
+// `ms`, 20 by default, or that did not succeed, is written with the
+// `context` problems its MPC solved before it, 3 by default and at most
+// SlowSolveRing::capacity - 1. The solving thread only encodes them; a
+// background thread writes them out, and drops them while it is too far
+// behind. The contents of the warm-start library and of the solution
+// cache are not part of a problem, their seed is.
+//
+// The file starts with an 8 byte magic, then one record per problem, a
+// uint32 length of the rest followed by the fields of ProblemInstance, in
+// the byte order of the machine that wrote it. With MPC_COMPRESS the magic
+// differs and each dump is a block of its own, see BlockCompression.h.
+namespace SlowSolveLog {
+
+bool enabled();
+
+// Problems dropped so far.
+size_t dropped();
+
+// Read every problem of the log at `path` into `problems`, in the order
+// written; false if it is not a log. A truncated record ends it.
+bool read(const char *path, vector<ProblemInstance> &problems);
+
+} // namespace SlowSolveLog
+
+#endif /* SLOW_SOLVE_LOG_H */
@@ -0,0 +1,153 @@
+#ifndef SMALL_VECTOR_H
+#define SMALL_VECTOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+// Vector of a trivial T that holds up to N elements in itself and only goes
+// to the heap beyond, keeping that storage until destroyed. The subset of
+// std::vector the frame pipeline uses, contiguous, so data() and size()
+// make an Eigen::Map as for a vector.
+template <typename T, size_t N>
+class SmallVector {
+    static_assert(std::is_trivial<T>::value, "SmallVector copies its elements with memcpy");
+
+public:
+    typedef T value_type;
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    SmallVector() : items(local), n(0), n_capacity(N) {}
+
+    SmallVector(const T *first, const T *last) : SmallVector() { assign(first, last); }
+
+    SmallVector(const SmallVector &other) : SmallVector() { assign(other.begin(), other.end()); }
+
+    SmallVector &operator=(const SmallVector &other) {
+        if (this != &other) {
+            assign(other.begin(), other.end());
+        }
+        return *this;
+    }
+
+    ~SmallVector() {
+        if (items != local) {
+            free(items);
+        }
+    }
+
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+    size_t capacity() const { return n_capacity; }
+
+    T *data() { return items; }
+    const T *data() const { return items; }
+    T *begin() { return items; }
+    const T *begin() const { return items; }
+    T *end() { return items + n; }
+    const T *end() const { return items + n; }
+
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+    T &back() { return items[n - 1]; }
+    const T &back() const { return items[n - 1]; }
+
+    void clear() { n = 0; }
+
+    void reserve(size_t capacity) {
+        if (capacity <= n_capacity) {
+            return;
+        }
+        T *grown = static_cast<T *>(malloc(capacity * sizeof(T)));
+        if (!grown) {
+            throw std::bad_alloc();
+        }
+        memcpy(grown, items, n * sizeof(T));
+        if (items != local) {
+            free(items);
+        }
+        items = grown;
+        n_capacity = capacity;
+    }
+
+    // New elements are value initialized, zero.
+    void resize(size_t size) {
+        if (size > n_capacity) {
+            reserve(size > 2 * n_capacity ? size : 2 * n_capacity);
+        }
+        if (size > n) {
+            memset(items + n, 0, (size - n) * sizeof(T));
+        }
+        n = size;
+    }
+
+    void push_back(const T &value) {
+        if (n == n_capacity) {
+            // `value` may be an element.
+            T copy = value;
+            reserve(2 * n_capacity);
+            items[n++] = copy;
+            return;
+        }
+        items[n++] = value;
+    }
+
+    // The range may lie in the vector itself.
+    void assign(const T *first, const T *last) {
+        size_t size = last - first;
+        T *given_up = regrow(size);
+        memmove(items, first, size * sizeof(T));
+        n = size;
+        free(given_up);
+    }
+
+    // `size` elements `stride` apart from `first`, one member of
+    // consecutive records for instance.
+    void assign(const T *first, size_t size, size_t stride) {
+        T *given_up = regrow(size);
+        for (size_t i = 0; i < size; i++) {
+            items[i] = first[i * stride];
+        }
+        n = size;
+        free(given_up);
+    }
+
+    bool operator==(const SmallVector &other) const {
+        return n == other.n && std::equal(begin(), end(), other.begin());
+    }
+
+    bool operator!=(const SmallVector &other) const { return !(*this == other); }
+
+private:
+    T *items;
+    size_t n;
+    size_t n_capacity;
+    T local[N];
+
+    // Storage for `capacity` elements, none of them kept. The heap storage
+    // given up, if any, is returned rather than freed, for an assign to
+    // read its range from first.
+    T *regrow(size_t capacity) {
+        if (capacity <= n_capacity) {
+            return nullptr;
+        }
+        T *grown = static_cast<T *>(malloc(capacity * sizeof(T)));
+        if (!grown) {
+            throw std::bad_alloc();
+        }
+        T *given_up = items != local ? items : nullptr;
+        items = grown;
+        n_capacity = capacity;
+        return given_up;
+    }
+};
+
+// Coordinates of the waypoints of a frame, six from the simulator or the
+// map, see Telemetry::ptsx.
+typedef SmallVector<double, 8> WaypointVector;
+
+#endif /* SMALL_VECTOR_H */
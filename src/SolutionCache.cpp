@@ -0,0 +1,82 @@
+#include "SolutionCache.h"
+#include <algorithm>
+#include <cmath>
+
+// Quantization steps of the key: x, y, psi, v, cte and epsi of the state,
+// then the polynomial coefficients from the constant up, each of those
+// worth about a millimetre of offset 30 m ahead.
+static const double key_steps[n_cache_keys] = {1e-3, 1e-3, 1e-4, 1e-3, 1e-3, 1e-4, 1e-3, 3e-5, 1e-6, 3e-8};
+
+size_t SolutionCache::KeyHash::operator()(const Key &key) const {
+    uint64_t h = 0;
+    for (int i = 0; i < n_cache_keys; i++) {
+        h = h * 0x9e3779b97f4a7c15ull + (uint64_t) key[i];
+    }
+    return (size_t) (h ^ (h >> 32));
+}
+
+SolutionCache::SolutionCache() : capacity(0), n_vars(0) {}
+
+void SolutionCache::reset(size_t capacity, size_t n_vars) {
+    this->capacity = capacity;
+    this->n_vars = n_vars;
+    entries.clear();
+    index.clear();
+    index.reserve(capacity);
+}
+
+void SolutionCache::clear() {
+    entries.clear();
+    index.clear();
+}
+
+SolutionCache::Key SolutionCache::quantize(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs) {
+    double raw[n_cache_keys] = {0};
+    for (int i = 0; i < 6 && i < state.size(); i++) {
+        raw[i] = state[i];
+    }
+    for (int i = 0; i < 4 && i < coeffs.size(); i++) {
+        raw[6 + i] = coeffs[i];
+    }
+    Key key;
+    for (int i = 0; i < n_cache_keys; i++) {
+        key[i] = (int64_t) llround(raw[i] / key_steps[i]);
+    }
+    return key;
+}
+
+const double *SolutionCache::find(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                                  double &objective) {
+    auto it = index.find(quantize(state, coeffs));
+    if (it == index.end()) {
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    objective = it->second->objective;
+    return it->second->x.data();
+}
+
+void SolutionCache::add(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, const double *x,
+                        double objective) {
+    if (capacity == 0) {
+        return;
+    }
+    Key key = quantize(state, coeffs);
+    auto it = index.find(key);
+    if (it != index.end()) {
+        entries.splice(entries.begin(), entries, it->second);
+    } else if (index.size() < capacity) {
+        entries.push_front(Entry());
+        entries.front().x.resize(n_vars);
+        index[key] = entries.begin();
+    } else {
+        // The least recently used entry and its storage take the new one.
+        entries.splice(entries.begin(), entries, prev(entries.end()));
+        index.erase(entries.front().key);
+        index[key] = entries.begin();
+    }
+    Entry &entry = entries.front();
+    entry.key = key;
+    entry.objective = objective;
+    copy(x, x + n_vars, entry.x.begin());
+}
@@ -0,0 +1,74 @@
+#ifndef SOLUTION_CACHE_H
+#define SOLUTION_CACHE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+
+using namespace std;
+
+// Entries of the key: the initial state, then the coefficients of the
+// reference.
+static const int n_cache_keys = 10;
+
+// Decision vectors of the latest converged solves, by the problem they
+// solved, for the same problem posed again: a replayed capture, a sweep
+// over the same frames, a straight where nothing changes. The state and
+// the coefficients are divided by their quantization steps and rounded,
+// and two problems are the same if those agree on every entry. Steps are
+// millimetres at the car and over the first 30 m of the reference, so a
+// hit answers a problem the solver would not tell apart.
+//
+// Least recently used entries make room for new ones; their storage is
+// reused, so a full cache no longer allocates.
+class SolutionCache {
+public:
+    SolutionCache();
+
+    // Room for `capacity` decision vectors of `n_vars` entries each, empty.
+    // Zero disables the cache.
+    void reset(size_t capacity, size_t n_vars);
+
+    // Forget every entry, e.g. once the problem solved changes.
+    void clear();
+
+    bool enabled() const { return capacity > 0; }
+
+    size_t size() const { return index.size(); }
+
+    // The decision vector stored for the problem of `state` and `coeffs`,
+    // now the most recently used, and its objective; nullptr if there is
+    // none.
+    const double *find(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, double &objective);
+
+    // Store the decision vector `x` of a converged solve of that problem,
+    // in place of the one already there if any.
+    void add(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, const double *x, double objective);
+
+private:
+    typedef array<int64_t, n_cache_keys> Key;
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+
+    struct Entry {
+        Key key;
+        double objective;
+        vector<double> x;
+    };
+
+    size_t capacity;
+    size_t n_vars;
+    // Most recently used first.
+    list<Entry> entries;
+    unordered_map<Key, list<Entry>::iterator, KeyHash> index;
+
+    static Key quantize(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs);
+};
+
+#endif /* SOLUTION_CACHE_H */
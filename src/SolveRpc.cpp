@@ -0,0 +1,158 @@
+#include "SolveRpc.h"
+#include <cstring>
+
+namespace {
+
+uint16_t getU16(const unsigned char *p) {
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+uint32_t getU32(const unsigned char *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+double getDouble(const unsigned char *p) {
+    uint64_t bits = 0;
+    for (int i = 7; i >= 0; i--) {
+        bits = bits << 8 | p[i];
+    }
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void putU16(string &out, size_t value) {
+    out += (char) (value & 0xff);
+    out += (char) (value >> 8 & 0xff);
+}
+
+void putU32(string &out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out += (char) (value >> (8 * i) & 0xff);
+    }
+}
+
+void putDouble(string &out, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    char bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (char) (bits >> (8 * i));
+    }
+    out.append(bytes, sizeof(bytes));
+}
+
+const size_t request_header = 20;
+const size_t problem_doubles = 10;
+
+} // namespace
+
+RpcError parseRpcRequest(const char *data, size_t length, RpcRequest &request) {
+    const unsigned char *p = (const unsigned char *) data;
+    request.id = length >= 6 ? getU32(p + 2) : 0;
+    if (length < request_header || p[0] != 'Q' || p[1] != rpc_version) {
+        return RPC_MALFORMED;
+    }
+    size_t n = getU16(p + 6);
+    if (n == 0 || n > max_rpc_problems || length != request_header + 8 * problem_doubles * n) {
+        return RPC_MALFORMED;
+    }
+    request.flags = getU16(p + 8);
+    request.backend = p[10];
+    request.deadline_ms = getDouble(p + 12);
+    if (request.backend != rpc_default_backend && request.backend > GEOMETRIC) {
+        return RPC_BAD_BACKEND;
+    }
+    if (!(request.deadline_ms >= 0)) {
+        return RPC_MALFORMED;
+    }
+
+    request.states.resize(n);
+    request.coeffs.resize(n);
+    p += request_header;
+    for (size_t i = 0; i < n; i++, p += 8 * problem_doubles) {
+        for (int k = 0; k < 6; k++) {
+            request.states[i][k] = getDouble(p + 8 * k);
+        }
+        for (int k = 0; k < 4; k++) {
+            request.coeffs[i][k] = getDouble(p + 8 * (6 + k));
+        }
+    }
+    return RPC_OK;
+}
+
+void solveRpc(MPC &mpc, const RpcRequest &request, vector<Solution> &solutions, vector<SolveStats> &stats) {
+    size_t n = request.states.size();
+    solutions.resize(n);
+    stats.assign(n, SolveStats());
+    SolverBackend backend = mpc.getBackend();
+    if (request.backend != rpc_default_backend) {
+        mpc.setBackend((SolverBackend) request.backend);
+    }
+    mpc.resetWarmStart();
+
+    if (request.flags & RPC_BATCH) {
+        vector<Eigen::VectorXd> states(request.states.begin(), request.states.end());
+        vector<Eigen::VectorXd> coeffs(request.coeffs.begin(), request.coeffs.end());
+        vector<vector<double> > actuations;
+        mpc.SolveBatch(states, coeffs, actuations, stats);
+        for (size_t i = 0; i < n; i++) {
+            solutions[i] = Solution();
+            solutions[i].delta = actuations[i][0];
+            solutions[i].a = actuations[i][1];
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            if (!(request.flags & RPC_CHAIN)) {
+                mpc.resetWarmStart();
+            }
+            Deadline deadline = Deadline::max();
+            if (request.deadline_ms > 0) {
+                deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(
+                                                             chrono::duration<double, milli>(request.deadline_ms));
+            }
+            mpc.Solve(request.states[i], request.coeffs[i], stats[i], deadline, solutions[i]);
+        }
+    }
+
+    mpc.resetWarmStart();
+    if (mpc.getBackend() != backend) {
+        mpc.setBackend(backend);
+    }
+}
+
+void writeRpcReply(string &out, const RpcRequest &request, const vector<Solution> &solutions,
+                   const vector<SolveStats> &stats) {
+    out.clear();
+    out += 'A';
+    out += (char) rpc_version;
+    putU32(out, request.id);
+    putU16(out, solutions.size());
+    putU16(out, request.flags);
+    for (size_t i = 0; i < solutions.size(); i++) {
+        const Solution &solution = solutions[i];
+        out += (char) stats[i].status;
+        out += (char) stats[i].fallback;
+        putU16(out, solution.n_stages);
+        putU32(out, (uint32_t) (int32_t) stats[i].iterations);
+        putDouble(out, solution.delta);
+        putDouble(out, solution.a);
+        putDouble(out, stats[i].objective);
+        putDouble(out, stats[i].wall_time);
+        putDouble(out, stats[i].constraint_violation);
+        for (size_t t = 0; t < solution.n_stages; t++) {
+            putDouble(out, solution.stages[t].x);
+        }
+        for (size_t t = 0; t < solution.n_stages; t++) {
+            putDouble(out, solution.stages[t].y);
+        }
+    }
+}
+
+void writeRpcError(string &out, uint32_t id, RpcError code) {
+    out.clear();
+    out += 'E';
+    out += (char) rpc_version;
+    putU32(out, id);
+    putU16(out, code);
+}
@@ -0,0 +1,85 @@
+#ifndef SOLVE_RPC_H
+#define SOLVE_RPC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MPC.h"
+
+using namespace std;
+
+// Binary RPC of the solver for clients that pose the problems themselves,
+// such as planning and analytics tools, sent as binary websocket messages
+// on the /rpc path of the server. Little-endian like BinaryProtocol.h:
+//
+//     request: u8 'Q', u8 version, u32 id, u16 n_problems, u16 flags,
+//              u8 backend, u8 0, u16 0, deadline_ms,
+//              n_problems times x, y, psi, v, cte, epsi, c0, c1, c2, c3
+//
+//     reply:   u8 'A', u8 version, u32 id, u16 n_problems, u16 flags,
+//              n_problems times u8 status, u8 fallback, u16 n_stages,
+//              i32 iterations, delta, a, objective, wall_time,
+//              constraint_violation, x[n_stages], y[n_stages]
+//
+//     error:   u8 'E', u8 version, u32 id, u16 code
+//
+// The state and the cubic c0 + c1 x + c2 x^2 + c3 x^3 are in the vehicle
+// frame, as MPC::Solve takes them; the reply has the plan of each problem
+// from its initial state, its status as a SolveStatus. A client may send
+// any number of requests without waiting: each is answered once solved,
+// not necessarily in order, with the id it came with.
+const unsigned char rpc_version = 1;
+
+// Problems a request may carry.
+const size_t max_rpc_problems = 4096;
+
+enum RpcFlags {
+    // Solve the problems at once with MPC::SolveBatch, independent and cold,
+    // whatever the backend; only the first actuations come back.
+    RPC_BATCH = 1,
+    // Warm start each problem from the solution of the one before, for a
+    // sequence along one trajectory; otherwise each starts cold.
+    RPC_CHAIN = 2,
+};
+
+// The backend field asking for the one the server is configured with.
+const unsigned char rpc_default_backend = 0xff;
+
+enum RpcError {
+    RPC_OK = 0,
+    RPC_MALFORMED = 1,
+    // Every solver is busy with the requests before, try again later.
+    RPC_BUSY = 2,
+    RPC_BAD_BACKEND = 3,
+};
+
+struct RpcRequest {
+    uint32_t id = 0;
+    uint16_t flags = 0;
+    unsigned char backend = rpc_default_backend;
+    // 0 for none, otherwise from the start of the solve of each problem.
+    double deadline_ms = 0;
+    vector<StateVector, Eigen::aligned_allocator<StateVector> > states;
+    vector<CubicCoeffs, Eigen::aligned_allocator<CubicCoeffs> > coeffs;
+};
+
+// Decode the request `data` of `length` bytes into `request`, keeping the
+// capacity of its vectors. RPC_MALFORMED for anything but a well-formed
+// request, RPC_BAD_BACKEND for a backend that does not exist; its id is
+// still read if the message is long enough to have one.
+RpcError parseRpcRequest(const char *data, size_t length, RpcRequest &request);
+
+// Solve the problems of `request` on `mpc` into `solutions` and `stats`.
+// The backend of `mpc` is only switched for the request, its warm start
+// is discarded.
+void solveRpc(MPC &mpc, const RpcRequest &request, vector<Solution> &solutions, vector<SolveStats> &stats);
+
+// Write the reply to `request` into `out`, replacing its content but
+// keeping its storage.
+void writeRpcReply(string &out, const RpcRequest &request, const vector<Solution> &solutions,
+                   const vector<SolveStats> &stats);
+
+void writeRpcError(string &out, uint32_t id, RpcError code);
+
+#endif /* SOLVE_RPC_H */
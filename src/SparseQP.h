@@ -0,0 +1,187 @@
+#ifndef SPARSE_QP_H
+#define SPARSE_QP_H
+
+#include <math.h>
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/SparseCholesky"
+#include "Eigen-3.3/Eigen/SparseCore"
+#include "Riccati.h"
+
+using namespace std;
+
+// Sparse convex QP with equality constraints and bounds on its trailing
+// variables,
+//
+//     min 1/2 z' P z + q' z   s.t.  E z = b,  lb <= z_tail <= ub,
+//
+// solved by the primal-dual interior point method of BoxRiccati. Every
+// iteration solves the quasi-definite KKT system
+//
+//     [P + D + sigma I   E'       ] [z]   [-(q + d)]
+//     [E                -delta I  ] [y] = [b       ]
+//
+// by a sparse LDL' factorization, D and d being the barrier terms of the
+// bounds. Its pattern only depends on those of P and E, so it is analyzed
+// once (AMD ordering, elimination tree) and every iteration refactorizes
+// its values alone. The regularizations keep the factorization free of
+// zero pivots in any order; one step of iterative refinement against the
+// unregularized system removes most of their bias.
+//
+// The patterns of P and E must not depend on their values, i.e. entries
+// that happen to be zero are stored regardless; P is symmetric and read
+// from its lower triangle.
+template <typename Scalar = double>
+class SparseQP {
+public:
+    typedef Eigen::SparseMatrix<Scalar> Matrix;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+    SparseQP() : analyses(0) {}
+
+    // Solve into `z` until the mean complementarity drops below `tol`.
+    // Returns the number of factorizations, or -1 if one failed, the
+    // bounds leave no interior or max_iter was reached.
+    int solve(const Matrix &P, const Vector &q, const Matrix &E, const Vector &b, const Vector &lb,
+              const Vector &ub, Vector &z, Scalar tol = interiorTol<Scalar>(), int max_iter = 50) {
+        const int n = P.rows(), m = E.rows(), nb = lb.size(), first = n - nb;
+        if ((lb.array() >= ub.array()).any()) {
+            return -1;
+        }
+        assemble(P, E);
+
+        // Bounded variables start a little inside the box, as close to zero
+        // as possible.
+        z = Vector::Zero(n);
+        z.tail(nb) = boxStart(lb, ub).matrix();
+        zl = Vector::Ones(nb);
+        zu = Vector::Ones(nb);
+        rhs.resize(n + m);
+        for (int iter = 1; iter <= max_iter; iter++) {
+            Vector sl = z.tail(nb) - lb;
+            Vector su = ub - z.tail(nb);
+            Scalar gap = (zl.dot(sl) + zu.dot(su)) / (2 * nb);
+            if (gap < tol) {
+                return iter - 1;
+            }
+
+            // Newton step towards the central path at a tenth of the gap,
+            // the dual steps eliminated into the diagonal.
+            Scalar tau = boxCentering(gap);
+            Vector d;
+            boxBarrier(sl, su, zl, zu, z.tail(nb), tau, D, d);
+            Scalar *values = kkt.valuePtr();
+            for (size_t k = 0; k < base.size(); k++) {
+                values[k] = base[k];
+            }
+            for (int i = 0; i < nb; i++) {
+                values[diagonal[first + i]] += D[i];
+            }
+            ldlt.factorize(kkt);
+            if (ldlt.info() != Eigen::Success) {
+                return -1;
+            }
+            rhs.head(n) = -q;
+            rhs.segment(first, nb) -= d;
+            rhs.tail(m) = b;
+            step = ldlt.solve(rhs);
+            refine(P, E, rhs);
+
+            // Largest steps that keep the slacks and the duals positive.
+            Vector dz = step.head(n) - z;
+            Vector du = dz.tail(nb);
+            boxDualStep(sl, su, zl, zu, du, tau, dzl, dzu);
+            Scalar alpha_p = fmin(Scalar(1), boxPrimalLimit(sl, su, du).minCoeff());
+            Scalar alpha_d = fmin(Scalar(1), boxDualLimit(zl, zu, dzl, dzu).minCoeff());
+            z += alpha_p * dz;
+            zl += alpha_d * dzl;
+            zu += alpha_d * dzu;
+        }
+        return -1;
+    }
+
+    // Symbolic analyses so far, one per distinct pattern.
+    size_t analysisCount() const { return analyses; }
+
+private:
+    // KKT matrix, lower triangle, and its values without the barrier
+    // diagonal; where each variable's diagonal entry is in them.
+    Matrix kkt;
+    vector<Scalar> base;
+    vector<int> diagonal;
+    vector<Eigen::Triplet<Scalar> > triplets;
+    Eigen::SimplicialLDLT<Matrix, Eigen::Lower, Eigen::AMDOrdering<int> > ldlt;
+    // Pattern of the last analysis.
+    vector<int> outer;
+    vector<int> inner;
+    size_t analyses;
+
+    Vector zl, zu, dzl, dzu, D, rhs, step, residual;
+
+    // Small against the problem, large enough against the rounding of
+    // Scalar for the pivots to keep their sign.
+    static Scalar primalRegularization() { return sqrt(numeric_limits<Scalar>::epsilon()); }
+    static Scalar dualRegularization() { return sqrt(numeric_limits<Scalar>::epsilon()); }
+
+    // Fill the KKT matrix from P and E, and analyze it if its pattern is
+    // new.
+    void assemble(const Matrix &P, const Matrix &E) {
+        const int n = P.rows(), m = E.rows();
+        triplets.clear();
+        for (int j = 0; j < n; j++) {
+            // Every diagonal entry is stored, for the barrier terms.
+            triplets.push_back(Eigen::Triplet<Scalar>(j, j, primalRegularization()));
+            for (typename Matrix::InnerIterator it(P, j); it; ++it) {
+                if (it.row() >= j) {
+                    triplets.push_back(Eigen::Triplet<Scalar>(it.row(), j, it.value()));
+                }
+            }
+        }
+        for (int j = 0; j < E.outerSize(); j++) {
+            for (typename Matrix::InnerIterator it(E, j); it; ++it) {
+                triplets.push_back(Eigen::Triplet<Scalar>(n + it.row(), it.col(), it.value()));
+            }
+        }
+        for (int i = 0; i < m; i++) {
+            triplets.push_back(Eigen::Triplet<Scalar>(n + i, n + i, -dualRegularization()));
+        }
+        kkt.resize(n + m, n + m);
+        kkt.setFromTriplets(triplets.begin(), triplets.end());
+        kkt.makeCompressed();
+
+        base.assign(kkt.valuePtr(), kkt.valuePtr() + kkt.nonZeros());
+        diagonal.resize(n);
+        for (int j = 0; j < n; j++) {
+            // The diagonal entry is the first of its column in the lower
+            // triangle.
+            diagonal[j] = kkt.outerIndexPtr()[j];
+        }
+
+        const int *o = kkt.outerIndexPtr(), *in = kkt.innerIndexPtr();
+        bool same = outer.size() == (size_t) (n + m + 1) && inner.size() == (size_t) kkt.nonZeros() &&
+                    equal(outer.begin(), outer.end(), o) && equal(inner.begin(), inner.end(), in);
+        if (!same) {
+            outer.assign(o, o + n + m + 1);
+            inner.assign(in, in + kkt.nonZeros());
+            ldlt.analyzePattern(kkt);
+            analyses++;
+        }
+    }
+
+    // One step of iterative refinement of `step` against the KKT system
+    // without the regularizations.
+    void refine(const Matrix &P, const Matrix &E, const Vector &rhs) {
+        const int n = P.rows(), m = E.rows(), nb = D.size();
+        residual = rhs;
+        residual.head(n).noalias() -= P.template selfadjointView<Eigen::Lower>() * step.head(n);
+        residual.segment(n - nb, nb) -= D.cwiseProduct(step.segment(n - nb, nb));
+        residual.head(n).noalias() -= E.transpose() * step.tail(m);
+        residual.tail(m).noalias() -= E * step.head(n);
+        step += ldlt.solve(residual);
+    }
+};
+
+#endif /* SPARSE_QP_H */
@@ -0,0 +1,73 @@
+#ifndef SPEED_PROFILE_H
+#define SPEED_PROFILE_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include "MpcConfig.h"
+
+using namespace std;
+
+// reference velocity, to make sure the vehicle does not stop
+const double ref_v = 80;
+
+// Reference velocity of every stage of a horizon, that the speed term of
+// the cost pulls towards. ref_v at every stage unless a speed profile
+// sets it, see MPC::setSpeedProfile.
+typedef array<double, max_horizon> StageSpeeds;
+
+inline StageSpeeds constantSpeeds() {
+    StageSpeeds speeds;
+    speeds.fill(ref_v);
+    return speeds;
+}
+
+// The reference velocity along the path ahead of a car, read off the
+// speed profile of its track, see Track::buildSpeedProfile: `v` at every
+// `spacing` m from the car on, in m/s. A spacing of 0, the default, is
+// ref_v all along.
+struct SpeedProfile {
+    static const size_t n_samples = 64;
+    double spacing = 0;
+    array<double, n_samples> v;
+
+    // At `distance` m ahead, linear between the samples and the last one
+    // beyond them.
+    double at(double distance) const {
+        if (!(spacing > 0)) {
+            return ref_v;
+        }
+        double k = distance > 0 ? distance / spacing : 0;
+        if (k >= n_samples - 1) {
+            return v[n_samples - 1];
+        }
+        size_t i = (size_t) k;
+        return v[i] + (k - i) * (v[i + 1] - v[i]);
+    }
+};
+
+// How far past the speed of the profile the stage speeds reach from that
+// of the car. The speed term is weighted to pull hard towards a ref_v well
+// above what the car drives at; as a plain target the car settles several
+// m/s short of the profile, much as it does of ref_v.
+const double profile_gain = 10;
+
+// The stage speeds of the horizon `Config` along `profile` for a car at
+// v0 m/s: from v0 towards the profile where the car would be at each stage
+// if it kept its speed, by profile_gain and at most ref_v.
+template <typename Config>
+void stageSpeeds(const SpeedProfile &profile, double v0, StageSpeeds &speeds) {
+    speeds.fill(ref_v);
+    if (!(profile.spacing > 0)) {
+        return;
+    }
+    double distance = 0;
+    for (size_t t = 0; t < Config::N; t++) {
+        speeds[t] = min(ref_v, v0 + profile_gain * (profile.at(distance) - v0));
+        if (t + 1 < Config::N) {
+            distance += (v0 > 0 ? v0 : 0) * Config::stageDt(t + 1);
+        }
+    }
+}
+
+#endif /* SPEED_PROFILE_H */
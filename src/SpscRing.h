@@ -0,0 +1,52 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Each index is only written by one side, so a release store paired
+// with an acquire load of the other side's index is all the synchronization
+// needed.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    
+public:
+    SpscRing() : head(0), tail(0) {}
+    
+    // Producer side. Returns false if the ring is full.
+    bool push(T &&value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        slots[t & (Capacity - 1)] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // Consumer side. Returns false if the ring is empty.
+    bool pop(T &value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(slots[h & (Capacity - 1)]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+    
+private:
+    std::array<T, Capacity> slots;
+    // Kept on separate cache lines so the two sides do not false-share.
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif /* SPSC_RING_H */
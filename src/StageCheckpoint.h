@@ -0,0 +1,97 @@
+#ifndef STAGE_CHECKPOINT_H
+#define STAGE_CHECKPOINT_H
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include <cppad/cppad.hpp>
+#include "VehicleModel.h"
+
+using CppAD::AD;
+using namespace std;
+
+// vehicleStep as CppAD checkpoint functions, for the tape of TapedNLP: the
+// dynamics of a stage are recorded once per step length of the grid and
+// every stage of the tape calls one, instead of repeating the polynomial,
+// atan, sin and cos of each stage inline. The tape then grows by a call per
+// stage rather than by the whole block.
+//
+// The checkpoints have to be recorded before the tape that calls them, as
+// CppAD records one tape at a time per thread, and must outlive it.
+class StageCheckpoints {
+public:
+    typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
+    
+    // One checkpoint per distinct value of `dts`, for polynomials of
+    // `n_coeffs` coefficients.
+    StageCheckpoints(const vector<double> &dts, size_t n_coeffs) : n_coeffs(n_coeffs) {
+        ADvector in(n_in()), out(6);
+        for (size_t i = 0; i < in.size(); i++) {
+            in[i] = 0.0;
+        }
+        for (double dt : dts) {
+            if (find(dt)) {
+                continue;
+            }
+            // The argument is (s[6], delta, a, coeffs...), the result the
+            // next state.
+            auto step = [dt](const ADvector &in, ADvector &out) {
+                size_t n = in.size() - 8;
+                ADvector coeffs(n);
+                for (size_t i = 0; i < n; i++) {
+                    coeffs[i] = in[8 + i];
+                }
+                AD<double> s[6], next[6];
+                for (int k = 0; k < 6; k++) {
+                    s[k] = in[k];
+                }
+                vehicleStep(s, in[6], in[7], coeffs, dt, next);
+                for (int k = 0; k < 6; k++) {
+                    out[k] = next[k];
+                }
+            };
+            unique_ptr<CppAD::checkpoint<double> > fn(new CppAD::checkpoint<double>("vehicle_step", step, in, out));
+            steps.push_back(make_pair(dt, std::move(fn)));
+        }
+        in_scratch.resize(n_in());
+        out_scratch.resize(6);
+    }
+    
+    // vehicleStep through the checkpoint of `dt`, which must have been
+    // one of the constructor's `dts`.
+    template <typename Coeffs>
+    void step(double dt, const AD<double> s[6], const AD<double> &delta, const AD<double> &a,
+              const Coeffs &coeffs, AD<double> next[6]) {
+        for (int k = 0; k < 6; k++) {
+            in_scratch[k] = s[k];
+        }
+        in_scratch[6] = delta;
+        in_scratch[7] = a;
+        for (size_t i = 0; i < n_coeffs; i++) {
+            in_scratch[8 + i] = coeffs[i];
+        }
+        (*find(dt))(in_scratch, out_scratch);
+        for (int k = 0; k < 6; k++) {
+            next[k] = out_scratch[k];
+        }
+    }
+    
+private:
+    size_t n_coeffs;
+    vector<pair<double, unique_ptr<CppAD::checkpoint<double> > > > steps;
+    ADvector in_scratch;
+    ADvector out_scratch;
+    
+    size_t n_in() const { return 8 + n_coeffs; }
+    
+    CppAD::checkpoint<double> *find(double dt) {
+        for (auto &s : steps) {
+            if (s.first == dt) {
+                return s.second.get();
+            }
+        }
+        return nullptr;
+    }
+};
+
+#endif /* STAGE_CHECKPOINT_H */
@@ -0,0 +1,47 @@
+#ifndef STAGE_POOL_H
+#define STAGE_POOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include "TaskScheduler.h"
+
+using namespace std;
+
+// Fork-join helper for the stage loops of one problem: run() splits a
+// range of stages into contiguous chunks, schedules all but the first as
+// high priority tasks of the process-wide TaskScheduler, runs the first on
+// the calling thread and returns once every chunk is done. Nothing is
+// allocated per run, the chunks are a pointer and an index each.
+//
+// The pool owns no threads, only the width of its runs, so the solvers of
+// every connection share the scheduler's workers.
+class StagePool {
+public:
+    // Runs in chunks for `n_helpers` workers besides the caller.
+    explicit StagePool(size_t n_helpers) : helpers(n_helpers) {}
+
+    size_t size() const { return helpers; }
+
+    // Call fn(chunk_begin, chunk_end) over [begin, end) in chunks of at
+    // least `min_chunk`, all on the caller if there is only one.
+    template <typename F>
+    void run(size_t begin, size_t end, size_t min_chunk, const F &fn) {
+        size_t chunks = min(helpers + 1, (end - begin) / max(min_chunk, (size_t) 1));
+        if (chunks <= 1) {
+            fn(begin, end);
+            return;
+        }
+        auto chunk = [begin, end, chunks, &fn](size_t index) {
+            fn(begin + (end - begin) * index / chunks, begin + (end - begin) * (index + 1) / chunks);
+        };
+        TaskGroup group(TASK_HIGH);
+        group.run(1, chunks, chunk);
+        chunk(0);
+        group.wait();
+    }
+
+private:
+    size_t helpers;
+};
+
+#endif /* STAGE_POOL_H */
@@ -0,0 +1,98 @@
+#include "SteerMessage.h"
+#include <math.h>
+#include <cstdint>
+#include <cstdio>
+
+// 10^k for the decimals of appendNumber.
+static const int64_t powers_of_ten[max_decimals + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+void appendNumber(string &out, double value, int decimals) {
+    if (!isfinite(value)) {
+        out += "null";
+        return;
+    }
+    decimals = decimals < 0 ? 0 : decimals > max_decimals ? max_decimals : decimals;
+    int64_t unit = powers_of_ten[decimals];
+    if (fabs(value) >= 1e18 / unit) {
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), "%.17g", value);
+        out.append(buf, n);
+        return;
+    }
+    
+    int64_t scaled = llround(fabs(value) * unit);
+    if (value < 0 && scaled != 0) {
+        out += '-';
+    }
+    
+    // Digits are produced backwards into a small buffer.
+    char buf[32];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    int64_t frac = scaled % unit;
+    int64_t whole = scaled / unit;
+    if (frac != 0) {
+        int digits = decimals;
+        while (frac % 10 == 0) {
+            frac /= 10;
+            digits--;
+        }
+        for (int i = 0; i < digits; i++) {
+            *--p = '0' + frac % 10;
+            frac /= 10;
+        }
+        *--p = '.';
+    }
+    do {
+        *--p = '0' + whole % 10;
+        whole /= 10;
+    } while (whole != 0);
+    out.append(p, end - p);
+}
+
+static void appendArray(string &out, const char *key, StridedView values, int decimals) {
+    out += '"';
+    out += key;
+    out += "\":[";
+    for (size_t i = 0; i < values.size; i++) {
+        if (i > 0) {
+            out += ',';
+        }
+        appendNumber(out, values[i], decimals);
+    }
+    out += "],";
+}
+
+void writeSteer(string &out, double steering_angle, double throttle,
+                StridedView mpc_x, StridedView mpc_y, StridedView next_x, StridedView next_y,
+                const SteerPrecision &precision) {
+    out.clear();
+    out += "42[\"steer\",{";
+    appendArray(out, "mpc_x", mpc_x, precision.points);
+    appendArray(out, "mpc_y", mpc_y, precision.points);
+    appendArray(out, "next_x", next_x, precision.points);
+    appendArray(out, "next_y", next_y, precision.points);
+    out += "\"steering_angle\":";
+    appendNumber(out, steering_angle, precision.actuators);
+    out += ",\"throttle\":";
+    appendNumber(out, throttle, precision.actuators);
+    out += "}]";
+}
+
+size_t stripSteerLines(string &msg) {
+    static const char head[] = "42[\"steer\",{";
+    static const char empty_lines[] = "42[\"steer\",{\"mpc_x\":[],\"mpc_y\":[],\"next_x\":[],\"next_y\":[],";
+    size_t actuations = msg.find("\"steering_angle\":");
+    if (msg.compare(0, sizeof(head) - 1, head) != 0 || actuations == string::npos) {
+        return 0;
+    }
+    size_t lines_end = sizeof(empty_lines) - 1;
+    if (actuations <= lines_end) {
+        return 0;
+    }
+    size_t removed = actuations - lines_end;
+    msg.replace(0, actuations, empty_lines, lines_end);
+    return removed;
+}
@@ -0,0 +1,58 @@
+#ifndef STEER_MESSAGE_H
+#define STEER_MESSAGE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Most decimals appendNumber writes in fixed point.
+const int max_decimals = 9;
+
+// Append `value` as a JSON number. Finite values of reasonable magnitude
+// are written in fixed point with `decimals` decimals, at most
+// max_decimals, trailing zeros trimmed, with integer arithmetic only;
+// anything else goes through printf. Non-finite values become null, like
+// json::dump. Unlike json::dump, which writes the shortest form that
+// reads back to the same double, the value is rounded, so it does not
+// round-trip beyond `decimals`.
+void appendNumber(string &out, double value, int decimals = 6);
+
+// Decimals of the numbers of the steer event, see writeSteer. The
+// simulator takes floats, whose resolution 9 decimals exceed in [-1, 1];
+// the lines it draws need no more than 0.1 mm.
+struct SteerPrecision {
+    // Of steering_angle and throttle.
+    int actuators = 9;
+    // Of mpc_x, mpc_y, next_x and next_y.
+    int points = 4;
+};
+
+// `size` numbers `stride` doubles apart, e.g. one field of an array of
+// structs of doubles.
+struct StridedView {
+    const double *data;
+    size_t size;
+    size_t stride;
+    
+    StridedView(const double *data, size_t size, size_t stride = 1) : data(data), size(size), stride(stride) {}
+    StridedView(const vector<double> &values) : data(values.data()), size(values.size()), stride(1) {}
+    
+    double operator[](size_t i) const { return data[i * stride]; }
+};
+
+// Write the "steer" event into `out`, replacing its content but keeping
+// its storage. The keys and their sorted order are those json::dump
+// produced for the same fields; the numbers are not, they are rounded to
+// `precision` by appendNumber.
+void writeSteer(string &out, double steering_angle, double throttle,
+                StridedView mpc_x, StridedView mpc_y, StridedView next_x, StridedView next_y,
+                const SteerPrecision &precision = SteerPrecision());
+
+// Empty the four lines of a steer event written by writeSteer in place,
+// keeping the actuations. Returns the bytes removed, 0 for any other
+// message.
+size_t stripSteerLines(string &msg);
+
+#endif /* STEER_MESSAGE_H */
@@ -0,0 +1,479 @@
+#include "TapedNLP.h"
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include "Logger.h"
+#include "Trace.h"
+
+// SparsityEntry::ipopt_row of a row IPOPT does not see.
+static const size_t pinned = (size_t) -1;
+
+TapedNLP::TapedNLP()
+    : sparsity(nullptr), n_vars(0), n_constraints(0), n_coeffs(0), model(CARTESIAN_MODEL),
+      xi(nullptr), xl(nullptr), xu(nullptr), gl(nullptr), gu(nullptr), solution(nullptr) {}
+
+void TapedNLP::warnInlineStages() {
+    static atomic<bool> warned(false);
+    if (!warned.exchange(true)) {
+        MPC_LOG(LOG_WARN, "CppAD is in parallel mode, the stages are inlined instead of checkpointed");
+    }
+}
+
+// Tapes kept per thread, see TapedNLP. Few controllers on a thread solve
+// more configurations than that.
+static const size_t max_thread_tapes = 8;
+
+// The tapes of a thread, most recently used first. They are freed when the
+// thread exits, so it takes its CppAD thread number before them.
+struct ThreadTapes {
+    ThreadTapes() { cppadThreadNumber(); }
+    list<shared_ptr<Tape> > tapes;
+};
+static thread_local ThreadTapes thread_tapes;
+
+bool TapedNLP::findTape() {
+    list<shared_ptr<Tape> > &tapes = thread_tapes.tapes;
+    for (auto it = tapes.begin(); it != tapes.end(); ++it) {
+        const Tape &t = **it;
+        if (t.n_vars == n_vars && t.n_coeffs == n_coeffs && t.weights == weights && t.model == model &&
+            t.checkpoint_stages == recorded_checkpoint_stages) {
+            tapes.splice(tapes.begin(), tapes, it);
+            useTape(tapes.front());
+            return true;
+        }
+    }
+    return false;
+}
+
+void TapedNLP::keepTape(const shared_ptr<Tape> &recorded) {
+    list<shared_ptr<Tape> > &tapes = thread_tapes.tapes;
+    tapes.push_front(recorded);
+    if (tapes.size() > max_thread_tapes) {
+        tapes.pop_back();
+    }
+
+    // The sparsity and the coloring do not depend on the coefficients, so
+    // they are only computed once per tape.
+    tape = recorded;
+    computeSparsity(recorded->sparsity);
+    const SparsityEntry &entry = recorded->sparsity;
+    TapeStats &s = recorded->stats;
+    s.operations = recorded->fun.size_op();
+    s.variables = recorded->fun.size_var();
+    s.parameters = recorded->fun.size_par();
+    s.bytes = recorded->fun.size_op_seq();
+    s.jacobian_nnz = entry.jac.nnz() + entry.linear_jac.nnz();
+    s.linear_constraints = count(entry.linear_rows.begin(), entry.linear_rows.end(), true);
+    s.hessian_nnz = entry.lag_pattern.nnz();
+    useTape(recorded);
+}
+
+void TapedNLP::useTape(const shared_ptr<Tape> &tape) {
+    this->tape = tape;
+    sparsity = &tape->sparsity;
+    tape_stats = tape->stats;
+    x.resize(n_vars);
+    fg.resize(1 + n_constraints);
+}
+
+void TapedNLP::releaseTape() {
+    tape.reset();
+    sparsity = nullptr;
+}
+
+void TapedNLP::computeSparsity(SparsityEntry &entry) {
+    // Jacobian sparsity of [f, g], computed once against the identity.
+    SparsityPattern eye(n_vars, n_vars, n_vars);
+    for (size_t k = 0; k < n_vars; k++) {
+        eye.set(k, k, k);
+    }
+    SparsityPattern fg_pattern;
+    tape->fun.for_jac_sparsity(eye, false, false, false, fg_pattern);
+
+    // A constraint is linear when its Hessian has no nonzeros, which takes
+    // a reverse sweep per row, once per configuration.
+    CPPAD_TESTVECTOR(bool) select_range(1 + n_constraints);
+    for (size_t i = 0; i < select_range.size(); i++) {
+        select_range[i] = false;
+    }
+    entry.linear_rows.assign(n_constraints, false);
+    for (size_t i = 0; i < n_constraints; i++) {
+        select_range[1 + i] = true;
+        SparsityPattern h_row;
+        tape->fun.rev_hes_sparsity(select_range, false, false, h_row);
+        entry.linear_rows[i] = h_row.nnz() == 0;
+        select_range[1 + i] = false;
+    }
+
+    // Linear rows of one variable become its bounds.
+    vector<size_t> row_nnz(n_constraints, 0), row_col(n_constraints, 0);
+    for (size_t k = 0; k < fg_pattern.nnz(); k++) {
+        size_t row = fg_pattern.row()[k];
+        if (row > 0) {
+            row_nnz[row - 1]++;
+            row_col[row - 1] = fg_pattern.col()[k];
+        }
+    }
+    entry.pins.clear();
+    entry.rows.clear();
+    entry.ipopt_row.assign(n_constraints, pinned);
+    for (size_t i = 0; i < n_constraints; i++) {
+        if (entry.linear_rows[i] && row_nnz[i] == 1) {
+            entry.pins.push_back(make_pair(i, row_col[i]));
+        } else {
+            entry.ipopt_row[i] = entry.rows.size();
+            entry.rows.push_back(i);
+        }
+    }
+
+    // Ipopt only wants the other constraint rows, the nonlinear ones in
+    // `jac`.
+    size_t nnz = 0, linear_nnz = 0;
+    for (size_t k = 0; k < fg_pattern.nnz(); k++) {
+        size_t row = fg_pattern.row()[k];
+        if (row > 0 && entry.ipopt_row[row - 1] != pinned) {
+            (entry.linear_rows[row - 1] ? linear_nnz : nnz)++;
+        }
+    }
+    SparsityPattern g_pattern(1 + n_constraints, n_vars, nnz);
+    SparsityPattern linear_pattern(1 + n_constraints, n_vars, linear_nnz);
+    for (size_t k = 0, j = 0, l = 0; k < fg_pattern.nnz(); k++) {
+        size_t row = fg_pattern.row()[k];
+        if (row == 0 || entry.ipopt_row[row - 1] == pinned) {
+            continue;
+        }
+        if (entry.linear_rows[row - 1]) {
+            linear_pattern.set(l++, row, fg_pattern.col()[k]);
+        } else {
+            g_pattern.set(j++, row, fg_pattern.col()[k]);
+        }
+    }
+    entry.jac_pattern = fg_pattern;
+    entry.jac = SparseMatrix(g_pattern);
+    entry.jac_work.clear();
+    entry.linear_jac = SparseMatrix(linear_pattern);
+    entry.linear_jac_work.clear();
+
+    // Lagrangian Hessian sparsity, lower triangle only.
+    for (size_t i = 0; i < select_range.size(); i++) {
+        select_range[i] = true;
+    }
+    SparsityPattern h_full;
+    tape->fun.rev_hes_sparsity(select_range, false, false, h_full);
+    nnz = 0;
+    for (size_t k = 0; k < h_full.nnz(); k++) {
+        if (h_full.row()[k] >= h_full.col()[k]) {
+            nnz++;
+        }
+    }
+    SparsityPattern h_lower(n_vars, n_vars, nnz);
+    for (size_t k = 0, j = 0; k < h_full.nnz(); k++) {
+        if (h_full.row()[k] >= h_full.col()[k]) {
+            h_lower.set(j++, h_full.row()[k], h_full.col()[k]);
+        }
+    }
+    entry.hes_pattern = h_full;
+    entry.hes = SparseMatrix(h_lower);
+    entry.hes_work.clear();
+
+    // Ipopt gets the union with the lower triangle of the cost Hessian.
+    vector<pair<size_t, size_t> > lag;
+    for (size_t k = 0; k < h_lower.nnz(); k++) {
+        lag.push_back(make_pair(h_lower.row()[k], h_lower.col()[k]));
+    }
+    for (const SeparableCost::Term &term : cost.getTerms()) {
+        lag.push_back(make_pair(term.i, term.i));
+        if (term.j != SeparableCost::none) {
+            lag.push_back(make_pair(term.j, term.j));
+            lag.push_back(make_pair(max(term.i, term.j), min(term.i, term.j)));
+        }
+    }
+    sort(lag.begin(), lag.end());
+    lag.erase(unique(lag.begin(), lag.end()), lag.end());
+    entry.lag_pattern.resize(n_vars, n_vars, lag.size());
+    for (size_t k = 0; k < lag.size(); k++) {
+        entry.lag_pattern.set(k, lag[k].first, lag[k].second);
+    }
+    auto index = [&lag](size_t r, size_t c) {
+        return lower_bound(lag.begin(), lag.end(), make_pair(r, c)) - lag.begin();
+    };
+    entry.hes_index.resize(h_lower.nnz());
+    for (size_t k = 0; k < h_lower.nnz(); k++) {
+        entry.hes_index[k] = index(h_lower.row()[k], h_lower.col()[k]);
+    }
+    entry.cost_index.clear();
+    for (const SeparableCost::Term &term : cost.getTerms()) {
+        entry.cost_index.push_back(index(term.i, term.i));
+        if (term.j != SeparableCost::none) {
+            entry.cost_index.push_back(index(term.j, term.j));
+            entry.cost_index.push_back(index(max(term.i, term.j), min(term.i, term.j)));
+        }
+    }
+    costHessian(entry);
+}
+
+void TapedNLP::costHessian(SparsityEntry &entry) {
+    entry.cost_hes.assign(entry.lag_pattern.nnz(), 0.0);
+    const size_t *index = entry.cost_index.data();
+    for (const SeparableCost::Term &term : cost.getTerms()) {
+        entry.cost_hes[*index++] += 2 * term.weight;
+        if (term.j != SeparableCost::none) {
+            entry.cost_hes[*index++] += 2 * term.weight * term.scale * term.scale;
+            entry.cost_hes[*index++] -= 2 * term.weight * term.scale;
+        }
+    }
+    entry.terminal = cost.getTerminal();
+}
+
+bool TapedNLP::isRecorded(size_t n_vars, size_t n_coeffs, const CostWeights &weights,
+                          ModelVariant model) const {
+    return this->n_coeffs == n_coeffs && this->n_vars == n_vars && this->weights == weights &&
+           this->model == model && recorded_checkpoint_stages == checkpoint_stages;
+}
+
+void TapedNLP::setProblem(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+                          const Dvector &gl, const Dvector &gu,
+                          const Eigen::VectorXd &coeffs, SolveResult &solution) {
+    assert(coeffs.size() == n_coeffs);
+    Dvector p(n_coeffs);
+    for (int i = 0; i < n_coeffs; i++) {
+        p[i] = coeffs[i];
+    }
+    tape->fun.new_dynamic(p);
+    if (values) {
+        values->setParameters(coeffs);
+    }
+    fg_at_x = false;
+    if (sparsity->linear_jac.nnz() > 0) {
+        // At any point, they do not depend on it.
+        tape->fun.sparse_jac_for(n_vars, xi, sparsity->linear_jac, sparsity->jac_pattern, "cppad",
+                           sparsity->linear_jac_work);
+    }
+
+    // Another terminal cost only changes the values of the cost Hessian.
+    if (sparsity->terminal != cost.getTerminal()) {
+        costHessian(*sparsity);
+    }
+
+    // The coloring is computed lazily on the first evaluation, so the first
+    // solve after a new configuration still pays for it.
+    if (!tape->used) {
+        stats.misses++;
+        tape->used = true;
+    } else {
+        stats.hits++;
+    }
+
+    this->xi = &xi;
+    this->xl = &xl;
+    this->xu = &xu;
+    this->gl = &gl;
+    this->gu = &gu;
+    this->solution = &solution;
+}
+
+void TapedNLP::forward(const Ipopt::Number *x_in, bool new_x) {
+    if (new_x) {
+        for (size_t i = 0; i < n_vars; i++) {
+            x[i] = x_in[i];
+        }
+        fg_at_x = false;
+    }
+}
+
+void TapedNLP::evaluate() {
+    if (fg_at_x) {
+        return;
+    }
+    if (values) {
+        (*values)(fg, x);
+    } else {
+        fg = tape->fun.Forward(0, x);
+    }
+    fg_at_x = true;
+}
+
+bool TapedNLP::get_nlp_info(Ipopt::Index &n, Ipopt::Index &m, Ipopt::Index &nnz_jac_g,
+                            Ipopt::Index &nnz_h_lag, IndexStyleEnum &index_style) {
+    n = n_vars;
+    m = sparsity->rows.size();
+    nnz_jac_g = sparsity->jac.nnz() + sparsity->linear_jac.nnz();
+    nnz_h_lag = sparsity->lag_pattern.nnz();
+    index_style = C_STYLE;
+    return true;
+}
+
+bool TapedNLP::get_bounds_info(Ipopt::Index n, Ipopt::Number *x_l, Ipopt::Number *x_u,
+                               Ipopt::Index m, Ipopt::Number *g_l, Ipopt::Number *g_u) {
+    for (int i = 0; i < n; i++) {
+        x_l[i] = (*xl)[i];
+        x_u[i] = (*xu)[i];
+    }
+    for (const pair<size_t, size_t> &pin : sparsity->pins) {
+        x_l[pin.second] = max(x_l[pin.second], (*gl)[pin.first]);
+        x_u[pin.second] = min(x_u[pin.second], (*gu)[pin.first]);
+    }
+    for (int i = 0; i < m; i++) {
+        g_l[i] = (*gl)[sparsity->rows[i]];
+        g_u[i] = (*gu)[sparsity->rows[i]];
+    }
+    return true;
+}
+
+bool TapedNLP::get_constraints_linearity(Ipopt::Index m, LinearityType *const_types) {
+    for (int i = 0; i < m; i++) {
+        const_types[i] = sparsity->linear_rows[sparsity->rows[i]] ? LINEAR : NON_LINEAR;
+    }
+    return true;
+}
+
+bool TapedNLP::get_starting_point(Ipopt::Index n, bool init_x, Ipopt::Number *x,
+                                  bool init_z, Ipopt::Number *z_L, Ipopt::Number *z_U,
+                                  Ipopt::Index m, bool init_lambda, Ipopt::Number *lambda) {
+    assert(init_x && !init_z && !init_lambda);
+    for (int i = 0; i < n; i++) {
+        x[i] = (*xi)[i];
+    }
+    return true;
+}
+
+bool TapedNLP::eval_f(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number &obj_value) {
+    MPC_TRACE_SCOPE("tape_f");
+    EvalTimer timer(*this);
+    forward(x, new_x);
+    if (cost_on_tape) {
+        evaluate();
+        obj_value = fg[0];
+    } else {
+        obj_value = cost.value(x);
+    }
+    return true;
+}
+
+bool TapedNLP::eval_grad_f(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number *grad_f) {
+    MPC_TRACE_SCOPE("tape_grad_f");
+    EvalTimer timer(*this);
+    forward(x, new_x);
+    if (!cost_on_tape) {
+        cost.gradient(x, n, grad_f);
+        return true;
+    }
+    evaluate();
+    Dvector w(1 + n_constraints);
+    for (size_t i = 0; i < w.size(); i++) {
+        w[i] = 0.0;
+    }
+    w[0] = 1.0;
+    Dvector grad = tape->fun.Reverse(1, w);
+    for (int i = 0; i < n; i++) {
+        grad_f[i] = grad[i];
+    }
+    return true;
+}
+
+bool TapedNLP::eval_g(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Index m, Ipopt::Number *g) {
+    MPC_TRACE_SCOPE("tape_g");
+    EvalTimer timer(*this);
+    forward(x, new_x);
+    evaluate();
+    for (int i = 0; i < m; i++) {
+        g[i] = fg[1 + sparsity->rows[i]];
+    }
+    return true;
+}
+
+bool TapedNLP::eval_jac_g(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Index m,
+                          Ipopt::Index nele_jac, Ipopt::Index *iRow, Ipopt::Index *jCol,
+                          Ipopt::Number *values) {
+    MPC_TRACE_SCOPE("tape_jac_g");
+    EvalTimer timer(*this);
+    // The nonlinear rows' entries, then the linear ones'.
+    const SparseMatrix &jac = sparsity->jac, &linear_jac = sparsity->linear_jac;
+    if (values == NULL) {
+        for (size_t k = 0; k < jac.nnz(); k++) {
+            iRow[k] = sparsity->ipopt_row[jac.row()[k] - 1];
+            jCol[k] = jac.col()[k];
+        }
+        for (size_t k = 0; k < linear_jac.nnz(); k++) {
+            iRow[jac.nnz() + k] = sparsity->ipopt_row[linear_jac.row()[k] - 1];
+            jCol[jac.nnz() + k] = linear_jac.col()[k];
+        }
+        return true;
+    }
+
+    forward(x, new_x);
+    // Up to n colors in a group, so all of them go through a single
+    // forward sweep of as many directions rather than a sweep each.
+    tape_stats.jacobian_colors =
+        tape->fun.sparse_jac_for(n, this->x, sparsity->jac, sparsity->jac_pattern, "cppad", sparsity->jac_work);
+    for (size_t k = 0; k < jac.nnz(); k++) {
+        values[k] = jac.val()[k];
+    }
+    for (size_t k = 0; k < linear_jac.nnz(); k++) {
+        values[jac.nnz() + k] = linear_jac.val()[k];
+    }
+    return true;
+}
+
+bool TapedNLP::eval_h(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number obj_factor,
+                      Ipopt::Index m, const Ipopt::Number *lambda, bool new_lambda,
+                      Ipopt::Index nele_hess, Ipopt::Index *iRow, Ipopt::Index *jCol,
+                      Ipopt::Number *values) {
+    MPC_TRACE_SCOPE("tape_h");
+    EvalTimer timer(*this);
+    if (values == NULL) {
+        for (int k = 0; k < nele_hess; k++) {
+            iRow[k] = sparsity->lag_pattern.row()[k];
+            jCol[k] = sparsity->lag_pattern.col()[k];
+        }
+        return true;
+    }
+
+    forward(x, new_x);
+    // The pinned rows are linear, nothing of theirs to weigh.
+    Dvector w(1 + n_constraints);
+    for (size_t i = 0; i < w.size(); i++) {
+        w[i] = 0.0;
+    }
+    w[0] = obj_factor;
+    for (int i = 0; i < m; i++) {
+        w[1 + sparsity->rows[i]] = lambda[i];
+    }
+    tape_stats.hessian_colors =
+        tape->fun.sparse_hes(this->x, w, sparsity->hes, sparsity->hes_pattern, "cppad.symmetric", sparsity->hes_work);
+    for (int k = 0; k < nele_hess; k++) {
+        values[k] = obj_factor * sparsity->cost_hes[k];
+    }
+    for (size_t k = 0; k < sparsity->hes.nnz(); k++) {
+        values[sparsity->hes_index[k]] += sparsity->hes.val()[k];
+    }
+    return true;
+}
+
+void TapedNLP::finalize_solution(Ipopt::SolverReturn status, Ipopt::Index n, const Ipopt::Number *x,
+                                 const Ipopt::Number *z_L, const Ipopt::Number *z_U,
+                                 Ipopt::Index m, const Ipopt::Number *g, const Ipopt::Number *lambda,
+                                 Ipopt::Number obj_value, const Ipopt::IpoptData *ip_data,
+                                 Ipopt::IpoptCalculatedQuantities *ip_cq) {
+    solution->status = toStatus(status);
+    solution->x.resize(n);
+    solution->zl.resize(n);
+    solution->zu.resize(n);
+    for (int i = 0; i < n; i++) {
+        solution->x[i] = x[i];
+        solution->zl[i] = z_L[i];
+        solution->zu[i] = z_U[i];
+    }
+    // Back to the rows of the problem, the pinned ones at their variable.
+    solution->g.resize(n_constraints);
+    solution->lambda.resize(n_constraints);
+    for (int i = 0; i < m; i++) {
+        solution->g[sparsity->rows[i]] = g[i];
+        solution->lambda[sparsity->rows[i]] = lambda[i];
+    }
+    for (const pair<size_t, size_t> &pin : sparsity->pins) {
+        solution->g[pin.first] = x[pin.second];
+        solution->lambda[pin.first] = 0.0;
+    }
+    solution->obj_value = obj_value;
+}
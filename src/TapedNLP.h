@@ -0,0 +1,458 @@
+#ifndef TAPED_NLP_H
+#define TAPED_NLP_H
+
+#include <memory>
+#include <utility>
+#include <coin/IpIpoptApplication.hpp>
+#include <coin/IpTNLP.hpp>
+#include <cppad/cppad.hpp>
+#include "CondensedFG_eval.h"
+#include "CppadThreads.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "FG_eval.h"
+#include "FrenetFG_eval.h"
+#include "LinearSolverLock.h"
+#include "MPC.h"
+#include "NLPTypes.h"
+#include "SeparableCost.h"
+#include "StageCheckpoint.h"
+#include "Trace.h"
+
+typedef vector<size_t> Svector;
+typedef CppAD::sparse_rc<Svector> SparsityPattern;
+typedef CppAD::sparse_rcv<Svector, Dvector> SparseMatrix;
+
+// Jacobian/Hessian sparsity of the tape and the coloring CppAD computes
+// for it.
+struct SparsityEntry {
+    // Full sparsity of the Jacobian of [f, g] and of the Hessian of the
+    // tape, plus the subsets handed to Ipopt with the values computed on
+    // them.
+    SparsityPattern jac_pattern;
+    SparseMatrix jac;
+    CppAD::sparse_jac_work jac_work;
+
+    // The constraints the tape has no second derivatives of, e.g. the
+    // speed dynamics, and the Jacobian entries of their rows, left out of
+    // `jac`. They only depend on the parameters, so they are evaluated
+    // once per problem, see setProblem, rather than per iteration.
+    vector<bool> linear_rows;
+    SparseMatrix linear_jac;
+    CppAD::sparse_jac_work linear_jac_work;
+
+    // The linear rows of a single variable, g = x as FG_eval writes the
+    // initial state, as (row, variable). IPOPT gets them as bounds of the
+    // variable instead, so the initial state is fixed and made a parameter
+    // of the KKT system, see fixed_variable_treatment, and sees only the
+    // other rows: `rows` in order, at `ipopt_row` of each, none for those.
+    vector<pair<size_t, size_t> > pins;
+    vector<size_t> rows;
+    vector<size_t> ipopt_row;
+    SparsityPattern hes_pattern;
+    SparseMatrix hes;
+    CppAD::sparse_hes_work hes_work;
+
+    // Lower triangle of the Lagrangian Hessian handed to Ipopt: that of the
+    // tape plus the entries of the SeparableCost, if any. `hes_index` maps
+    // each entry of `hes` into it and `cost_hes` holds the cost Hessian on
+    // it, under the terminal cost `terminal`, at the entries `cost_index`
+    // of the cost's terms in order, one for a term of one variable and
+    // three for one of two.
+    SparsityPattern lag_pattern;
+    vector<size_t> hes_index;
+    vector<double> cost_hes;
+    vector<size_t> cost_index;
+    TerminalCost terminal;
+};
+
+// A tape of FG_eval, see TapedNLP, its sparsity and what it was recorded
+// for. It holds CppAD memory, which has to be freed on the thread that
+// allocated it, so each thread records and keeps tapes of its own.
+struct Tape {
+    CppAD::ADFun<double> fun;
+    // The checkpoints called by `fun`, if it was recorded with them.
+    unique_ptr<StageCheckpoints> checkpoints;
+    SparsityEntry sparsity;
+    // Whether a solve used `sparsity` yet, see SparsityStats.
+    bool used = false;
+    TapeStats stats;
+    size_t n_vars = 0;
+    size_t n_constraints = 0;
+    size_t n_coeffs = 0;
+    CostWeights weights;
+    ModelVariant model = CARTESIAN_MODEL;
+    bool checkpoint_stages = false;
+};
+
+// [f, g] of a model in double, the same as a zero-order sweep of its tape
+// but without the tape, for the evaluations IPOPT asks of values only, see
+// TapedNLP::evaluate.
+class ValueEval {
+public:
+    virtual ~ValueEval() {}
+
+    // The dynamic parameters of the tape.
+    virtual void setParameters(const Eigen::VectorXd &params) = 0;
+
+    virtual void operator()(Dvector &fg, const Dvector &vars) = 0;
+};
+
+// ValueEval of the model `Eval`, FG_eval or FrenetFG_eval on plain
+// Eigen::VectorXd parameters, which are its member `params`.
+template <typename Eval, Eigen::VectorXd Eval::*params>
+class ModelValueEval : public ValueEval {
+public:
+    explicit ModelValueEval(const Eval &eval) : eval(eval) {}
+
+    void setParameters(const Eigen::VectorXd &p) { eval.*params = p; }
+
+    void operator()(Dvector &fg, const Dvector &vars) { eval(fg, vars); }
+
+private:
+    Eval eval;
+};
+
+// Ipopt problem backed by a tape of FG_eval that is recorded once, with the
+// polynomial coefficients as dynamic parameters, and then only re-evaluated.
+// The tapes belong to the threads that record them, up to a few per
+// thread, shared by the TapedNLPs of the same configuration solved there.
+// A TapedNLP only holds on to one from record or findTape to releaseTape,
+// so it may be solved on another thread each time.
+// With FRENET_MODEL the tape is of FrenetFG_eval and the parameters are
+// the curvature profile. With SINGLE_SHOOTING it is of CondensedFG_eval,
+// the parameters being the initial state and the coefficients.
+//
+// In multiple shooting the initial state does not appear on the tape at
+// all; it only enters the problem through the constraint bounds. Neither
+// does the cost: it is quadratic in single variables and adjacent
+// actuations, so its value, gradient and constant Hessian are computed in
+// closed form, see SeparableCost, and the tape only differentiates the
+// dynamics. Of those the linear ones, the speed dynamics in multiple
+// shooting, are told apart once per configuration and their constant
+// Jacobian entries evaluated once per solve. The rows pinning the initial
+// state become bounds of its variables, see SparsityEntry::pins. Values
+// alone, which the line search asks for at every trial point, are then
+// not taken from the tape either: the objective is the SeparableCost's,
+// the constraints those of the model instantiated in double, see
+// ValueEval; the tape only serves the derivatives.
+class TapedNLP : public DeadlineTNLP {
+public:
+    TapedNLP();
+
+    // Set up the problem for the horizon `Config`, `n_coeffs` parameters
+    // of `model` in `formulation` and the cost `weights`, and take the
+    // calling thread's tape of it, recording the tape and its
+    // Jacobian/Hessian sparsity if the thread has none. Whether it did.
+    template <typename Config>
+    bool record(size_t n_coeffs, const CostWeights &weights, ModelVariant model,
+                Formulation formulation = MULTIPLE_SHOOTING);
+
+    // Whether the problem is set up for the number of variables, which
+    // tells the horizons and formulations apart, of parameters, the cost
+    // weights, the model and the use of checkpoints.
+    bool isRecorded(size_t n_vars, size_t n_coeffs, const CostWeights &weights, ModelVariant model) const;
+
+    // Take the calling thread's tape of the problem set up, false if it has
+    // none, see record.
+    bool findTape();
+    // Let go of the tape, on the thread that took it.
+    void releaseTape();
+
+    // Record the stage dynamics once as a CppAD checkpoint function called
+    // by every stage of the Cartesian multiple-shooting tape, see
+    // StageCheckpoint.h; takes effect at the next record. Only for mpc_bench
+    // -k: CppAD cannot construct checkpoints once an MPC has put it in
+    // parallel mode, see CppadThreads.h, and the stages are then inlined.
+    void setCheckpointStages(bool checkpoint) { checkpoint_stages = checkpoint; }
+
+    const SparsityStats &sparsityStats() const { return stats; }
+
+    // Size of the current tape, see TapeStats.
+    const TapeStats &tapeStats() const { return tape_stats; }
+
+    // Reference velocities of the speed terms of the cost, until the next
+    // record; they are on the tape in SINGLE_SHOOTING, ref_v there.
+    void setSpeeds(const StageSpeeds &speeds) { cost.setSpeeds(speeds); }
+
+    // See SeparableCost::setTerminal; none in SINGLE_SHOOTING.
+    void setTerminalCost(const TerminalCost &terminal) { cost.setTerminal(terminal); }
+
+    // Set the data for the next optimization, the result is written to
+    // `solution` by finalize_solution.
+    void setProblem(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+                    const Dvector &gl, const Dvector &gu,
+                    const Eigen::VectorXd &coeffs, SolveResult &solution);
+
+    bool get_nlp_info(Ipopt::Index &n, Ipopt::Index &m, Ipopt::Index &nnz_jac_g,
+                      Ipopt::Index &nnz_h_lag, IndexStyleEnum &index_style);
+
+    bool get_bounds_info(Ipopt::Index n, Ipopt::Number *x_l, Ipopt::Number *x_u,
+                         Ipopt::Index m, Ipopt::Number *g_l, Ipopt::Number *g_u);
+
+    // The rows of SparsityEntry::linear_rows are LINEAR.
+    bool get_constraints_linearity(Ipopt::Index m, LinearityType *const_types);
+
+    bool get_starting_point(Ipopt::Index n, bool init_x, Ipopt::Number *x,
+                            bool init_z, Ipopt::Number *z_L, Ipopt::Number *z_U,
+                            Ipopt::Index m, bool init_lambda, Ipopt::Number *lambda);
+
+    bool eval_f(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number &obj_value);
+
+    bool eval_grad_f(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number *grad_f);
+
+    bool eval_g(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Index m, Ipopt::Number *g);
+
+    bool eval_jac_g(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Index m,
+                    Ipopt::Index nele_jac, Ipopt::Index *iRow, Ipopt::Index *jCol,
+                    Ipopt::Number *values);
+
+    bool eval_h(Ipopt::Index n, const Ipopt::Number *x, bool new_x, Ipopt::Number obj_factor,
+                Ipopt::Index m, const Ipopt::Number *lambda, bool new_lambda,
+                Ipopt::Index nele_hess, Ipopt::Index *iRow, Ipopt::Index *jCol,
+                Ipopt::Number *values);
+
+    void finalize_solution(Ipopt::SolverReturn status, Ipopt::Index n, const Ipopt::Number *x,
+                           const Ipopt::Number *z_L, const Ipopt::Number *z_U,
+                           Ipopt::Index m, const Ipopt::Number *g, const Ipopt::Number *lambda,
+                           Ipopt::Number obj_value, const Ipopt::IpoptData *ip_data,
+                           Ipopt::IpoptCalculatedQuantities *ip_cq);
+
+private:
+    // The calling thread's tape of the problem set up and its sparsity,
+    // from record or findTape to the end of the solve.
+    shared_ptr<Tape> tape;
+    SparsityEntry *sparsity;
+    bool checkpoint_stages = false;
+    bool recorded_checkpoint_stages = false;
+    // Whether f is on the tape, else it is `cost`.
+    bool cost_on_tape = true;
+    SeparableCost cost;
+    size_t n_vars;
+    size_t n_constraints;
+    size_t n_coeffs;
+    CostWeights weights;
+    ModelVariant model;
+    SparsityStats stats;
+    TapeStats tape_stats;
+
+    // In multiple shooting, [f, g] without the tape, see evaluate.
+    unique_ptr<ValueEval> values;
+
+    // Current point and [f, g] evaluated at it, if `fg_at_x`.
+    Dvector x;
+    Dvector fg;
+    bool fg_at_x = false;
+
+    const Dvector *xi;
+    const Dvector *xl;
+    const Dvector *xu;
+    const Dvector *gl;
+    const Dvector *gu;
+    SolveResult *solution;
+
+    // Take `x_in` as the current point if `new_x`.
+    void forward(const Ipopt::Number *x_in, bool new_x);
+    // [f, g] at the current point into `fg`, by `values` or else a
+    // zero-order sweep of the tape, which leaves the tape ready for a
+    // first-order reverse sweep there.
+    void evaluate();
+    // Take `tape` as the calling thread's tape of the problem set up.
+    void useTape(const shared_ptr<Tape> &tape);
+    // Keep `recorded`, just recorded on the calling thread, and use it.
+    void keepTape(const shared_ptr<Tape> &recorded);
+    void computeSparsity(SparsityEntry &entry);
+    void costHessian(SparsityEntry &entry);
+    // Once per process, that checkpoint_stages has no effect.
+    static void warnInlineStages();
+};
+
+template <typename Config>
+bool TapedNLP::record(size_t n_coeffs, const CostWeights &weights, ModelVariant model,
+                      Formulation formulation) {
+    typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
+
+    bool condensed = formulation == SINGLE_SHOOTING;
+    size_t n = condensed ? CondensedFG_eval<Config, ADvector>::n_vars : Config::n_vars;
+    size_t m = condensed ? CondensedFG_eval<Config, ADvector>::n_constraints : Config::n_constraints;
+    n_vars = n;
+    n_constraints = m;
+    this->n_coeffs = n_coeffs;
+    this->weights = weights;
+    this->model = model;
+    recorded_checkpoint_stages = checkpoint_stages;
+
+    cost_on_tape = condensed;
+    if (condensed) {
+        cost.clear();
+    } else {
+        cost.build<Config>(weights);
+    }
+
+    // The same model in double, its parameters set by setProblem.
+    Eigen::VectorXd params = Eigen::VectorXd::Zero(n_coeffs);
+    if (condensed) {
+        values.reset();
+    } else if (model != CARTESIAN_MODEL) {
+        typedef FrenetFG_eval<Config, Eigen::VectorXd> Eval;
+        Eval eval(params, weights);
+        eval.with_cost = false;
+        eval.reduced = model == REDUCED_FRENET_MODEL;
+        values.reset(new ModelValueEval<Eval, &Eval::kappa>(eval));
+    } else {
+        typedef FG_eval<Config, Eigen::VectorXd> Eval;
+        Eval eval(params, weights);
+        eval.with_cost = false;
+        values.reset(new ModelValueEval<Eval, &Eval::coeffs>(eval));
+    }
+
+    if (findTape()) {
+        return false;
+    }
+    shared_ptr<Tape> recording(new Tape());
+    recording->n_vars = n;
+    recording->n_constraints = m;
+    recording->n_coeffs = n_coeffs;
+    recording->weights = weights;
+    recording->model = model;
+    recording->checkpoint_stages = checkpoint_stages;
+    recording->stats.horizon = Config::N;
+
+    // The checkpoints are recorded first, CppAD records one tape at a time.
+    // They cannot be constructed once CppAD is in parallel mode, see
+    // CppadThreads.h, the stages are then inlined.
+    unique_ptr<StageCheckpoints> stage_fns;
+    if (checkpoint_stages && cppadThreadsSetUp()) {
+        warnInlineStages();
+    } else if (checkpoint_stages && !condensed && model == CARTESIAN_MODEL) {
+        vector<double> dts;
+        for (size_t t = 1; t < Config::N; t++) {
+            dts.push_back(Config::stageDt(t));
+        }
+        stage_fns.reset(new StageCheckpoints(dts, n_coeffs));
+    }
+
+    // The coefficients are dynamic parameters, so new_dynamic can swap them
+    // without recording the operation sequence again.
+    ADvector avars(n);
+    for (int i = 0; i < n; i++) {
+        avars[i] = 0.0;
+    }
+    ADvector acoeffs(n_coeffs);
+    for (int i = 0; i < n_coeffs; i++) {
+        acoeffs[i] = 0.0;
+    }
+    CppAD::Independent(avars, acoeffs);
+    ADvector afg(1 + m);
+    if (condensed) {
+        CondensedFG_eval<Config, ADvector> fg_eval(acoeffs, weights);
+        fg_eval(afg, avars);
+    } else if (model != CARTESIAN_MODEL) {
+        FrenetFG_eval<Config, ADvector> fg_eval(acoeffs, weights);
+        fg_eval.with_cost = false;
+        fg_eval.reduced = model == REDUCED_FRENET_MODEL;
+        fg_eval(afg, avars);
+    } else {
+        FG_eval<Config, ADvector> fg_eval(acoeffs, weights);
+        fg_eval.checkpoints = stage_fns.get();
+        fg_eval.with_cost = false;
+        fg_eval(afg, avars);
+    }
+    recording->fun.Dependent(avars, afg);
+
+    // Drops the operations that do not reach the result, e.g. of the
+    // zero-weighted cost terms in single shooting, and shares common
+    // subexpressions, so every sweep of the solve has less to do.
+    recording->fun.optimize();
+    recording->checkpoints = std::move(stage_fns);
+
+    keepTape(recording);
+    return true;
+}
+
+// Persistent IpoptApplication driving a TapedNLP for the horizon `Config`,
+// recording the tape again only when the number of parameters, the cost
+// weights, the model or the formulation change, or on a thread without one.
+template <typename Config>
+class TapedSolver {
+public:
+    TapedSolver()
+        : speeds(constantSpeeds()), model(CARTESIAN_MODEL), formulation(MULTIPLE_SHOOTING),
+          linear_solver_lock(linearSolverLock("")) {
+        app = new Ipopt::IpoptApplication();
+        app->Options()->SetIntegerValue("print_level", 0);
+        app->Options()->SetStringValue("sb", "yes");
+        app->Options()->SetStringValue("fixed_variable_treatment", "make_parameter");
+        app->Initialize();
+        nlp = new TapedNLP();
+    }
+
+    // Same contract as CppAD::ipopt::solve, plus when IPOPT has to stop.
+    // The IPOPT status and iteration count go to `stats`. `coeffs` are the
+    // parameters of the model, the curvature profile for FRENET_MODEL. In
+    // SINGLE_SHOOTING the variables are those of CondensedFG_eval and the
+    // parameters its initial state and coefficients.
+    void solve(const Dvector &xi, const Dvector &xl, const Dvector &xu,
+               const Dvector &gl, const Dvector &gu,
+               const Eigen::VectorXd &coeffs, SolveResult &solution,
+               Deadline deadline, SolveStats &stats) {
+        if (!nlp->isRecorded(xi.size(), coeffs.size(), weights, model) || !nlp->findTape()) {
+            MPC_TRACE_SCOPE("record");
+            stats.recorded = nlp->template record<Config>(coeffs.size(), weights, model, formulation);
+        }
+        nlp->setSpeeds(speeds);
+        nlp->setTerminalCost(terminal);
+        nlp->setProblem(xi, xl, xu, gl, gu, coeffs, solution);
+        nlp->setDeadline(deadline);
+        // The actuations lead the variables of SINGLE_SHOOTING.
+        bool condensed = xi.size() == 2 * Config::n_controls;
+        nlp->setFirstControls(condensed ? 0 : Config::delta_start,
+                              condensed ? Config::n_controls : Config::a_start);
+        LinearSolverGuard guard(linear_solver_lock, stats);
+        setTimeLimit(*app, deadline);
+        MPC_TRACE_SCOPE("ipopt");
+        fillStats(app->OptimizeTNLP(nlp), *app, *nlp, stats);
+        stats.restoration_iterations = nlp->restorationIterations();
+        nlp->releaseTape();
+    }
+
+    const SparsityStats &sparsityStats() const { return nlp->sparsityStats(); }
+
+    const TapeStats &tapeStats() const { return nlp->tapeStats(); }
+
+    void setCostWeights(const CostWeights &weights) { this->weights = weights; }
+
+    // See FG_eval::speeds; in SINGLE_SHOOTING ref_v is on the tape instead.
+    void setReferenceSpeeds(const StageSpeeds &speeds) { this->speeds = speeds; }
+
+    void setModel(ModelVariant model) { this->model = model; }
+
+    // See TapedNLP::setTerminalCost.
+    void setTerminalCost(const TerminalCost &terminal) { this->terminal = terminal; }
+
+    void setFormulation(Formulation formulation) { this->formulation = formulation; }
+
+    // Stop solving once `cancel` is raised, see DeadlineTNLP::setCancel.
+    void setCancel(const CancelToken *cancel) { nlp->setCancel(cancel); }
+
+    // See DeadlineTNLP::setIterationTrace.
+    void setIterationTrace(IterationTrace *trace) { nlp->setIterationTrace(trace); }
+
+    void setOptions(const MpcOptions &options) {
+        applyOptions(*app, options);
+        linear_solver_lock = linearSolverLock(options.linear_solver);
+        nlp->setControlConvergence(options.control_tol, options.control_iterations);
+    }
+
+private:
+    Ipopt::SmartPtr<Ipopt::IpoptApplication> app;
+    Ipopt::SmartPtr<TapedNLP> nlp;
+    CostWeights weights;
+    StageSpeeds speeds;
+    TerminalCost terminal;
+    ModelVariant model;
+    Formulation formulation;
+    // Held around OptimizeTNLP, see LinearSolverLock.h.
+    mutex *linear_solver_lock;
+};
+
+#endif /* TAPED_NLP_H */
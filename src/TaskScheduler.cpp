@@ -0,0 +1,184 @@
+#include "TaskScheduler.h"
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "Eigen-3.3/unsupported/Eigen/CXX11/ThreadPool"
+
+// Tried by the one worker left spinning before it parks, which keeps the
+// wake-up off the latency of a parallel loop that follows another.
+static const int spin_steals = 1000;
+
+typedef Eigen::RunQueue<Task, 1024> TaskQueue;
+
+struct TaskScheduler::Workers {
+    explicit Workers(size_t n) : waiters(n), events(waiters), next_queue(0), spinning(false), stopping(false) {
+        waiters.resize(n);
+    }
+
+    vector<thread> threads;
+    // Per priority, one queue per worker.
+    vector<unique_ptr<TaskQueue> > queues[2];
+    Eigen::MaxSizeVector<Eigen::EventCount::Waiter> waiters;
+    Eigen::EventCount events;
+    // Worker whose queues the next task from outside goes to.
+    atomic<size_t> next_queue;
+    atomic<bool> spinning;
+    atomic<bool> stopping;
+};
+
+// The scheduler the calling thread is a worker of, and its index.
+static thread_local TaskScheduler *current_scheduler = nullptr;
+static thread_local size_t current_worker = 0;
+
+TaskScheduler &TaskScheduler::instance() {
+    static TaskScheduler scheduler([] {
+        const char *s = getenv("MPC_TASK_THREADS");
+        long n = s ? atol(s) : (long) thread::hardware_concurrency();
+        return (size_t) max(1l, n);
+    }());
+    return scheduler;
+}
+
+TaskScheduler::TaskScheduler(size_t n_threads) : workers(new Workers(max((size_t) 1, n_threads))) {
+    size_t n = workers->waiters.size();
+    for (auto &queues : workers->queues) {
+        for (size_t i = 0; i < n; i++) {
+            queues.push_back(unique_ptr<TaskQueue>(new TaskQueue()));
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        workers->threads.push_back(thread(&TaskScheduler::work, this, i));
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    workers->stopping = true;
+    workers->events.Notify(true);
+    for (auto &thread : workers->threads) {
+        thread.join();
+    }
+}
+
+size_t TaskScheduler::size() const {
+    return workers->threads.size();
+}
+
+void TaskScheduler::schedule(const Task &task, TaskPriority priority) {
+    Task rejected;
+    if (current_scheduler == this) {
+        rejected = workers->queues[priority][current_worker]->PushFront(task);
+    } else {
+        size_t i = workers->next_queue.fetch_add(1, memory_order_relaxed) % size();
+        rejected = workers->queues[priority][i]->PushBack(task);
+    }
+    if (rejected.call) {
+        TaskGroup::execute(rejected);
+    } else {
+        workers->events.Notify(false);
+    }
+}
+
+bool TaskScheduler::runOwn(const TaskGroup &group, TaskPriority priority) {
+    if (current_scheduler == this) {
+        TaskQueue &queue = *workers->queues[priority][current_worker];
+        Task task = queue.PopFront();
+        if (!task.call) {
+            return false;
+        }
+        if (task.group != &group) {
+            // Only this worker pushes to the front, so there is room again.
+            queue.PushFront(task);
+            return false;
+        }
+        TaskGroup::execute(task);
+        return true;
+    }
+    // From outside, the tasks of the group were pushed to the backs last.
+    for (auto &queue : workers->queues[priority]) {
+        Task task = queue->PopBack();
+        if (task.call && task.group == &group) {
+            TaskGroup::execute(task);
+            return true;
+        }
+        if (task.call && queue->PushBack(task).call) {
+            TaskGroup::execute(task);
+        }
+    }
+    return false;
+}
+
+// The next task for worker `index`: its own of the high priority, those it
+// can steal, then the same of the low priority.
+static bool nextTask(vector<unique_ptr<TaskQueue> > (&queues)[2], size_t index, Task &task) {
+    size_t n = queues[0].size();
+    for (auto &queue : queues) {
+        task = queue[index]->PopFront();
+        for (size_t k = 1; !task.call && k < n; k++) {
+            task = queue[(index + k) % n]->PopBack();
+        }
+        if (task.call) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool anyQueued(const vector<unique_ptr<TaskQueue> > (&queues)[2]) {
+    for (auto &queue : queues) {
+        for (auto &q : queue) {
+            if (!q->Empty()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::work(size_t index) {
+    current_scheduler = this;
+    current_worker = index;
+    Workers &w = *workers;
+    for (;;) {
+        Task task;
+        if (!nextTask(w.queues, index, task) && !w.spinning && !w.spinning.exchange(true)) {
+            for (int i = 0; i < spin_steals && !task.call; i++) {
+                nextTask(w.queues, index, task);
+            }
+            w.spinning = false;
+        }
+        if (task.call) {
+            TaskGroup::execute(task);
+            continue;
+        }
+        w.events.Prewait(&w.waiters[index]);
+        if (anyQueued(w.queues)) {
+            w.events.CancelWait(&w.waiters[index]);
+            continue;
+        }
+        if (w.stopping) {
+            w.events.CancelWait(&w.waiters[index]);
+            return;
+        }
+        w.events.CommitWait(&w.waiters[index]);
+    }
+}
+
+void TaskGroup::execute(const Task &task) {
+    TaskGroup &group = *task.group;
+    if (!group.cancelled()) {
+        task.call(task.fn, task.index);
+    }
+    // Under the lock, so the waiter cannot return, and destroy the group,
+    // before this is done with it.
+    lock_guard<mutex> guard(group.lock);
+    if (group.pending.fetch_sub(1, memory_order_acq_rel) == 1) {
+        group.finished.notify_all();
+    }
+}
+
+void TaskGroup::wait() {
+    while (pending.load(memory_order_acquire) > 0 && scheduler.runOwn(*this, priority)) {
+    }
+    unique_lock<mutex> guard(lock);
+    finished.wait(guard, [this] { return pending.load(memory_order_acquire) == 0; });
+}
@@ -0,0 +1,145 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+// What a task is for. The workers take every high priority task there is,
+// their own and those they can steal, before any low priority one: the
+// stage loops, rollouts and starts of a solve are high, the episodes,
+// logs and candidates of the batch tools low.
+enum TaskPriority { TASK_HIGH, TASK_LOW };
+
+// Raised to stop the tasks of a group, see TaskGroup: those not started
+// yet are skipped, and those running may poll it. A token with a parent
+// also counts as raised once the parent is, so the starts of a solve stop
+// with the solve, see MPC::setCancel.
+class CancelToken {
+public:
+    explicit CancelToken(const CancelToken *parent = nullptr) : raised(false), parent(parent) {}
+
+    void cancel() { raised.store(true, memory_order_relaxed); }
+
+    bool cancelled() const { return raised.load(memory_order_relaxed) || (parent && parent->cancelled()); }
+
+    // Lower it again for the next use, once nothing polls it.
+    void reset() { raised.store(false, memory_order_relaxed); }
+
+private:
+    atomic<bool> raised;
+    const CancelToken *parent;
+};
+
+class TaskGroup;
+
+// One call of fn(index) on behalf of a group. Plain data, so scheduling one
+// allocates nothing.
+struct Task {
+    void (*call)(const void *fn, size_t index) = nullptr;
+    const void *fn = nullptr;
+    size_t index = 0;
+    TaskGroup *group = nullptr;
+};
+
+// The threads every parallel part of the process runs on, so that none of
+// them spawns threads of its own and together they do not oversubscribe
+// the cores.
+//
+// Each worker has a queue per priority, Eigen's RunQueue: it pushes and
+// pops tasks at the front of its own, LIFO, and steals from the back of
+// the others' when it has none, parking on Eigen's EventCount when no
+// queue has any. Tasks scheduled from other threads go to the back of the
+// workers' queues in turn. A task may schedule and wait for tasks of its
+// own, see TaskGroup::wait.
+class TaskScheduler {
+public:
+    // The one of the process, started on first use with MPC_TASK_THREADS
+    // workers, by default one per hardware thread.
+    static TaskScheduler &instance();
+
+    explicit TaskScheduler(size_t n_threads);
+
+    ~TaskScheduler();
+
+    size_t size() const;
+
+    // Queue `task` at `priority`. Runs it on the spot if the queue it goes
+    // to is full.
+    void schedule(const Task &task, TaskPriority priority);
+
+    // Run a task of `group` on the calling thread if one is where the
+    // caller put it, at the front of its queue of `priority` for a worker,
+    // at the back of one for any other thread; false if none is. Another
+    // thread runs a task of another group it took off a back as well when
+    // that has filled up meanwhile.
+    bool runOwn(const TaskGroup &group, TaskPriority priority);
+
+private:
+    struct Workers;
+    unique_ptr<Workers> workers;
+
+    void work(size_t index);
+};
+
+// Tasks scheduled together and waited for together, e.g. the chunks of a
+// parallel loop.
+//
+//     TaskGroup group(TASK_LOW);
+//     group.run(0, n, fn);   // fn(i) for every i, on the workers
+//     group.wait();
+class TaskGroup {
+public:
+    explicit TaskGroup(TaskPriority priority = TASK_HIGH, const CancelToken *token = nullptr,
+                       TaskScheduler &scheduler = TaskScheduler::instance())
+        : scheduler(scheduler), priority(priority), token(token), pending(0) {}
+
+    ~TaskGroup() { wait(); }
+
+    // Schedule fn(i) for every i in [begin, end). `fn` is called by
+    // reference, so it has to outlive wait().
+    template <typename F>
+    void run(size_t begin, size_t end, const F &fn) {
+        for (size_t i = begin; i < end; i++) {
+            Task task;
+            task.call = &invoke<F>;
+            task.fn = &fn;
+            task.index = i;
+            task.group = this;
+            pending.fetch_add(1, memory_order_relaxed);
+            scheduler.schedule(task, priority);
+        }
+    }
+
+    // Return once every task scheduled is done or skipped. The caller first
+    // runs those of its tasks no worker has taken, see
+    // TaskScheduler::runOwn, and blocks on the rest, so waiting inside a
+    // task does not deadlock. A worker never runs an unrelated task here;
+    // a thread outside the workers may, when a task it took off a queue
+    // looking for its own finds no room to go back.
+    void wait();
+
+    bool cancelled() const { return token && token->cancelled(); }
+
+    // Run `task` of this group unless cancelled, and count it done.
+    static void execute(const Task &task);
+
+private:
+    TaskScheduler &scheduler;
+    TaskPriority priority;
+    const CancelToken *token;
+    atomic<size_t> pending;
+    mutex lock;
+    condition_variable finished;
+
+    template <typename F>
+    static void invoke(const void *fn, size_t index) {
+        (*static_cast<const F *>(fn))(index);
+    }
+};
+
+#endif /* TASK_SCHEDULER_H */
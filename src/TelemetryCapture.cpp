@@ -0,0 +1,409 @@
+#include "TelemetryCapture.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include "TaskScheduler.h"
+
+const char capture_magic[8] = {'M', 'P', 'C', 'C', 'A', 'P', '0', '1'};
+const char capture_compressed_magic[8] = {'M', 'P', 'C', 'C', 'A', 'P', 'Z', '1'};
+const char capture_index_magic[8] = {'M', 'P', 'C', 'C', 'I', 'D', 'X', '1'};
+
+// Bytes after the entries of the index.
+static const size_t index_trailer = 2 * sizeof(uint64_t) + sizeof(capture_index_magic);
+
+const size_t CaptureWriter::queue_capacity;
+constexpr chrono::seconds CaptureWriter::block_interval;
+
+template <typename T>
+static void put(string &out, const T &value) {
+    out.append((const char *) &value, sizeof(value));
+}
+
+template <typename T>
+static bool get(const char *data, size_t end, size_t &offset, T &value) {
+    if (end - offset < sizeof(value)) {
+        return false;
+    }
+    memcpy(&value, data + offset, sizeof(value));
+    offset += sizeof(value);
+    return true;
+}
+
+// Decode the record at `offset` of the `size` bytes at `data` into
+// `telemetry` and move `offset` past it; false if it is truncated.
+static bool decodeRecord(const char *data, size_t size, size_t &offset, Telemetry &telemetry) {
+    size_t at = offset;
+    uint32_t length;
+    if (!get(data, size, at, length) || size - at < length) {
+        return false;
+    }
+    size_t end = at + length;
+
+    int64_t arrival;
+    uint32_t n;
+    if (!get(data, end, at, arrival) ||
+        !get(data, end, at, telemetry.x) || !get(data, end, at, telemetry.y) ||
+        !get(data, end, at, telemetry.psi) || !get(data, end, at, telemetry.speed) ||
+        !get(data, end, at, telemetry.steering_angle) || !get(data, end, at, telemetry.throttle) ||
+        !get(data, end, at, n) || (end - at) / (2 * sizeof(double)) < n) {
+        return false;
+    }
+    telemetry.arrival = chrono::steady_clock::time_point(chrono::nanoseconds(arrival));
+    telemetry.ptsx.resize(n);
+    telemetry.ptsy.resize(n);
+    memcpy(telemetry.ptsx.data(), data + at, n * sizeof(double));
+    memcpy(telemetry.ptsy.data(), data + at + n * sizeof(double), n * sizeof(double));
+
+    offset = end;
+    return true;
+}
+
+CaptureWriter::CaptureWriter() : file(nullptr), level(0), n_frames(0), written(0), stopping(false), n_dropped(0) {}
+
+CaptureWriter::~CaptureWriter() {
+    if (!file) {
+        return;
+    }
+    stopping = true;
+    {
+        lock_guard<mutex> lock(park_mutex);
+    }
+    wakeup.notify_one();
+    writer.join();
+    writeIndex();
+    fclose(file);
+}
+
+void CaptureWriter::writeIndex() {
+    uint64_t n = index.size();
+    fwrite(index.data(), sizeof(CaptureIndexEntry), index.size(), file);
+    fwrite(&n, sizeof(n), 1, file);
+    fwrite(&n_frames, sizeof(n_frames), 1, file);
+    fwrite(capture_index_magic, sizeof(capture_index_magic), 1, file);
+}
+
+bool CaptureWriter::open(const char *path, int level) {
+    if (file) {
+        return false;
+    }
+    file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    this->level = level;
+    index.clear();
+    n_frames = 0;
+    written = sizeof(capture_magic);
+    if (fwrite(level ? capture_compressed_magic : capture_magic, sizeof(capture_magic), 1, file) != 1) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    writer = thread(&CaptureWriter::run, this);
+    return true;
+}
+
+bool CaptureWriter::record(const Telemetry &telemetry) {
+    string out;
+    spare.pop(out);
+    out.clear();
+
+    uint32_t n = telemetry.ptsx.size();
+    uint32_t length = sizeof(int64_t) + 6 * sizeof(double) + sizeof(uint32_t) + 2 * n * sizeof(double);
+    int64_t arrival = chrono::duration_cast<chrono::nanoseconds>(telemetry.arrival.time_since_epoch()).count();
+    put(out, length);
+    put(out, arrival);
+    put(out, telemetry.x);
+    put(out, telemetry.y);
+    put(out, telemetry.psi);
+    put(out, telemetry.speed);
+    put(out, telemetry.steering_angle);
+    put(out, telemetry.throttle);
+    put(out, n);
+    out.append((const char *) telemetry.ptsx.data(), n * sizeof(double));
+    out.append((const char *) telemetry.ptsy.data(), n * sizeof(double));
+
+    if (!pending.push(std::move(out))) {
+        n_dropped.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    // Taking the lock orders the push before the writer's last check of
+    // the ring, so the wakeup cannot be lost.
+    {
+        lock_guard<mutex> lock(park_mutex);
+    }
+    wakeup.notify_one();
+    return true;
+}
+
+void CaptureWriter::run() {
+    for (;;) {
+        string out;
+        if (!pending.pop(out)) {
+            // Nothing queued, a good moment to hand the data to the kernel.
+            if (!block.empty() && chrono::steady_clock::now() - block_start >= block_interval) {
+                writeBlock();
+            }
+            fflush(file);
+            unique_lock<mutex> lock(park_mutex);
+            auto ready = [this] {
+                return stopping || !pending.empty();
+            };
+            if (block.empty()) {
+                wakeup.wait(lock, ready);
+            } else {
+                wakeup.wait_until(lock, block_start + block_interval, ready);
+            }
+            if (stopping && pending.empty()) {
+                if (!block.empty()) {
+                    lock.unlock();
+                    writeBlock();
+                }
+                return;
+            }
+            continue;
+        }
+
+        int64_t arrival;
+        memcpy(&arrival, out.data() + sizeof(uint32_t), sizeof(arrival));
+        if (level) {
+            if (block.empty()) {
+                block_start = chrono::steady_clock::now();
+                block_entry = {n_frames, arrival, 0};
+            }
+            block += out;
+            if (block.size() >= compressed_block_bytes) {
+                writeBlock();
+            }
+        } else {
+            if (n_frames % capture_index_stride == 0) {
+                index.push_back({n_frames, arrival, written});
+            }
+            fwrite(out.data(), 1, out.size(), file);
+            written += out.size();
+        }
+        n_frames++;
+        spare.push(std::move(out));
+    }
+}
+
+void CaptureWriter::writeBlock() {
+    string out;
+    appendBlock(block.data(), block.size(), level, out);
+    block_entry.offset = written;
+    index.push_back(block_entry);
+    fwrite(out.data(), 1, out.size(), file);
+    written += out.size();
+    block.clear();
+}
+
+CaptureReader::CaptureReader()
+    : data(nullptr), size(0), end(0), records(nullptr), records_size(0), offset(0), next_block(0), n_frames(0) {}
+
+CaptureReader::~CaptureReader() {
+    if (data) {
+        munmap((void *) data, size);
+    }
+}
+
+bool CaptureReader::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(capture_magic)) {
+        close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    bool compressed = memcmp(mapped, capture_compressed_magic, sizeof(capture_magic)) == 0;
+    if (!compressed && memcmp(mapped, capture_magic, sizeof(capture_magic)) != 0) {
+        munmap(mapped, st.st_size);
+        return false;
+    }
+
+    if (data) {
+        munmap((void *) data, size);
+    }
+    data = (const char *) mapped;
+    size = st.st_size;
+    end = size;
+    index.clear();
+    n_frames = 0;
+    if (size >= sizeof(capture_magic) + index_trailer &&
+        memcmp(data + size - sizeof(capture_index_magic), capture_index_magic, sizeof(capture_index_magic)) == 0) {
+        uint64_t counts[2];
+        memcpy(counts, data + size - index_trailer, sizeof(counts));
+        size_t available = (size - sizeof(capture_magic) - index_trailer) / sizeof(CaptureIndexEntry);
+        if (counts[0] <= available) {
+            end = size - index_trailer - counts[0] * sizeof(CaptureIndexEntry);
+            index.resize(counts[0]);
+            memcpy(index.data(), data + end, counts[0] * sizeof(CaptureIndexEntry));
+            n_frames = counts[1];
+        }
+    }
+    blocks.clear();
+    if (compressed) {
+        indexBlocks(data + sizeof(capture_magic), end - sizeof(capture_magic), blocks);
+        for (CompressedBlock &block : blocks) {
+            block.offset += sizeof(capture_magic);
+        }
+    }
+    rewind();
+    return true;
+}
+
+bool CaptureReader::next(Telemetry &telemetry) {
+    size_t at;
+    return decodeNext(telemetry, at);
+}
+
+bool CaptureReader::decodeNext(Telemetry &telemetry, size_t &at) {
+    at = offset;
+    while (!decodeRecord(records, records_size, offset, telemetry)) {
+        // A block ends at a record, only the end of the file is truncated.
+        if (next_block == blocks.size() || !inflateBlock(data, blocks[next_block++], inflated)) {
+            return false;
+        }
+        records = inflated.data();
+        records_size = inflated.size();
+        offset = 0;
+        at = 0;
+    }
+    return true;
+}
+
+void CaptureReader::rewind() {
+    next_block = 0;
+    if (blocks.empty()) {
+        records = data + sizeof(capture_magic);
+        records_size = end - sizeof(capture_magic);
+    } else {
+        records = nullptr;
+        records_size = 0;
+    }
+    offset = 0;
+}
+
+// Append the frames of the `size` records at `records` to `frames`; false
+// if they end in a truncated one.
+static bool decodeRecords(const char *records, size_t size, vector<Telemetry> &frames) {
+    size_t at = 0;
+    Telemetry telemetry;
+    while (decodeRecord(records, size, at, telemetry)) {
+        frames.push_back(telemetry);
+    }
+    return at == size;
+}
+
+bool CaptureReader::seek(size_t frame) {
+    rewind();
+    Telemetry skipped;
+    size_t first = 0;
+    auto entry = upper_bound(index.begin(), index.end(), frame,
+                             [](size_t frame, const CaptureIndexEntry &entry) { return frame < entry.frame; });
+    if (entry != index.begin()) {
+        --entry;
+        if (blocks.empty()) {
+            offset = entry->offset - sizeof(capture_magic);
+        } else {
+            // The block whose header is at the entry's offset.
+            auto block = lower_bound(blocks.begin(), blocks.end(), entry->offset,
+                                     [](const CompressedBlock &block, uint64_t offset) {
+                                         return block.offset - 2 * sizeof(uint32_t) < offset;
+                                     });
+            if (block == blocks.end() || !inflateBlock(data, *block, inflated)) {
+                return false;
+            }
+            records = inflated.data();
+            records_size = inflated.size();
+            next_block = block - blocks.begin() + 1;
+        }
+        first = entry->frame;
+    }
+    for (size_t i = first; i < frame; i++) {
+        if (!next(skipped)) {
+            return false;
+        }
+    }
+    // Whether there is a frame left, put back once decoded.
+    size_t at;
+    if (!decodeNext(skipped, at)) {
+        return false;
+    }
+    offset = at;
+    return true;
+}
+
+bool CaptureReader::seekTime(chrono::steady_clock::time_point arrival) {
+    int64_t ns = chrono::duration_cast<chrono::nanoseconds>(arrival.time_since_epoch()).count();
+    auto entry = upper_bound(index.begin(), index.end(), ns,
+                             [](int64_t ns, const CaptureIndexEntry &entry) { return ns < entry.arrival; });
+    if (!seek(entry == index.begin() ? 0 : (entry - 1)->frame)) {
+        return false;
+    }
+    Telemetry telemetry;
+    size_t at;
+    while (decodeNext(telemetry, at)) {
+        if (telemetry.arrival >= arrival) {
+            // Still in `records`, decodeNext only moves on at a record.
+            offset = at;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CaptureReader::readBlock(size_t i, vector<Telemetry> &frames) const {
+    string records;
+    return inflateBlock(data, blocks[i], records) && decodeRecords(records.data(), records.size(), frames);
+}
+
+bool CaptureReader::readAll(vector<Telemetry> &frames) {
+    if (blocks.empty() && index.size() > 1) {
+        // The stretches between the entries, each on a task.
+        vector<vector<Telemetry> > decoded(index.size());
+        auto decode = [&](size_t i) {
+            size_t last = i + 1 < index.size() ? index[i + 1].offset : end;
+            decodeRecords(data + index[i].offset, last - index[i].offset, decoded[i]);
+        };
+        TaskGroup group(TASK_LOW);
+        group.run(0, index.size(), decode);
+        group.wait();
+        for (size_t i = 0; i < index.size(); i++) {
+            frames.insert(frames.end(), decoded[i].begin(), decoded[i].end());
+        }
+        return true;
+    }
+    if (blocks.empty()) {
+        rewind();
+        Telemetry telemetry;
+        while (next(telemetry)) {
+            frames.push_back(telemetry);
+        }
+        return true;
+    }
+    vector<vector<Telemetry> > decoded(blocks.size());
+    vector<char> ok(blocks.size());
+    auto inflate = [&](size_t i) { ok[i] = readBlock(i, decoded[i]); };
+    TaskGroup group(TASK_LOW);
+    group.run(0, blocks.size(), inflate);
+    group.wait();
+    for (size_t i = 0; i < blocks.size(); i++) {
+        frames.insert(frames.end(), decoded[i].begin(), decoded[i].end());
+        if (!ok[i]) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,189 @@
+#ifndef TELEMETRY_CAPTURE_H
+#define TELEMETRY_CAPTURE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BlockCompression.h"
+#include "Controller.h"
+#include "SpscRing.h"
+
+using namespace std;
+
+// Append-only binary capture of decoded telemetry frames.
+//
+// The file starts with an 8 byte magic, followed by one record per frame:
+//
+//     uint32  length of the rest of the record in bytes
+//     int64   arrival, steady clock nanoseconds
+//     double  x, y, psi, speed, steering_angle, throttle
+//     uint32  number of waypoints n
+//     double  ptsx[n], ptsy[n]
+//
+// in the byte order of the machine that wrote it. A compressed capture
+// starts with capture_compressed_magic instead and holds the same records
+// in blocks, see BlockCompression.h.
+//
+// A capture closed cleanly ends in an index of where its frames are:
+//
+//     CaptureIndexEntry  entries[n]
+//     uint64             n
+//     uint64             frames in the capture
+//     byte               capture_index_magic[8]
+//
+// one entry every capture_index_stride frames of an uncompressed capture,
+// one per block of a compressed one. A capture without it, e.g. of a
+// process that crashed, is read from the start as before.
+extern const char capture_magic[8];
+extern const char capture_compressed_magic[8];
+extern const char capture_index_magic[8];
+
+// Frames between the entries of the index of an uncompressed capture.
+const size_t capture_index_stride = 256;
+
+// Where a frame of a capture is: its number from 0, its arrival, and the
+// offset in the file of its record, or of the header of the block it
+// starts, whose first frame it is.
+struct CaptureIndexEntry {
+    uint64_t frame;
+    int64_t arrival;
+    uint64_t offset;
+};
+
+// Writes frames to a capture file on a background thread, so recording
+// costs the loop thread one encode and a push onto a ring. Compressing,
+// the thread writes a block once it holds compressed_block_bytes of
+// frames, once its first frame is block_interval old, and on close.
+class CaptureWriter {
+public:
+    // Frames that may be waiting for the writer thread.
+    static const size_t queue_capacity = 256;
+
+    // Longest a frame waits in a block that is not full.
+    static constexpr chrono::seconds block_interval{10};
+
+    CaptureWriter();
+
+    // Writes out the frames still queued and closes the file.
+    ~CaptureWriter();
+
+    // Create or truncate `path` and start the writer thread, compressing
+    // at zlib `level` unless it is 0.
+    bool open(const char *path, int level = compressionLevel());
+
+    bool isOpen() const { return file != nullptr; }
+
+    // Queue `telemetry` for writing. Only call from one thread. Returns
+    // false, dropping the frame, if the writer is that far behind.
+    bool record(const Telemetry &telemetry);
+
+    // Frames dropped so far.
+    size_t dropped() const { return n_dropped.load(memory_order_relaxed); }
+
+private:
+    FILE *file;
+    int level;
+
+    // Frames not compressed yet, and when the first of them was, only
+    // used by the writer thread.
+    string block;
+    chrono::steady_clock::time_point block_start;
+
+    // The index written on close, the entry of the block being gathered,
+    // the frames and the bytes written so far; the writer thread's until
+    // it is joined.
+    vector<CaptureIndexEntry> index;
+    CaptureIndexEntry block_entry;
+    uint64_t n_frames;
+    uint64_t written;
+
+    // Encoded records on their way to the writer, and the emptied buffers
+    // on their way back, so their storage is reused.
+    SpscRing<string, queue_capacity> pending;
+    SpscRing<string, queue_capacity> spare;
+
+    // Only used to park the idle writer, never on the data path.
+    mutex park_mutex;
+    condition_variable wakeup;
+    atomic<bool> stopping;
+    atomic<size_t> n_dropped;
+    thread writer;
+
+    void run();
+    void writeBlock();
+    void writeIndex();
+};
+
+// Reads a capture file memory-mapped, decoding one frame at a time. With
+// its index, see capture_index_magic, it starts at any frame or time after
+// decoding at most a block or capture_index_stride frames, so a long
+// session can be split into chunks, each read by a reader of its own.
+class CaptureReader {
+public:
+    CaptureReader();
+
+    ~CaptureReader();
+
+    // Map `path`, false if it cannot be mapped or is not a capture.
+    bool open(const char *path);
+
+    // Decode the next frame into `telemetry`, reusing its vectors. False
+    // at the end of the file or at a truncated record.
+    bool next(Telemetry &telemetry);
+
+    // Go back to the first frame.
+    void rewind();
+
+    // Whether the capture has its index, and its frames if so, 0 if not.
+    bool indexed() const { return !index.empty(); }
+    size_t frameCount() const { return n_frames; }
+
+    // Make frame `frame` the next one; false, at the end, if there are not
+    // that many. Without the index it decodes every frame before it.
+    bool seek(size_t frame);
+
+    // Make the first frame that arrived at or after `arrival` the next
+    // one; false if none did.
+    bool seekTime(chrono::steady_clock::time_point arrival);
+
+    // Append every frame to `frames`, as next() from the start would. The
+    // blocks of a compressed capture, and the stretches between the
+    // entries of the index of an uncompressed one, are decoded in parallel
+    // on the TaskScheduler. False at a corrupt block, with the frames
+    // before it.
+    bool readAll(vector<Telemetry> &frames);
+
+    // Blocks of a compressed capture, 0 for an uncompressed one.
+    size_t blockCount() const { return blocks.size(); }
+
+    // Append the frames of block `i` to `frames`; false if it is corrupt.
+    // Safe to call from several threads at once, each on other blocks.
+    bool readBlock(size_t i, vector<Telemetry> &frames) const;
+
+private:
+    const char *data;
+    size_t size;
+    // End of the records, where the index starts if there is one.
+    size_t end;
+    // The records next() decodes from: the mapping past the magic, or the
+    // block last inflated.
+    const char *records;
+    size_t records_size;
+    size_t offset;
+    vector<CompressedBlock> blocks;
+    size_t next_block;
+    string inflated;
+    vector<CaptureIndexEntry> index;
+    size_t n_frames;
+
+    // next(), with the offset of the frame in `records` into `at`.
+    bool decodeNext(Telemetry &telemetry, size_t &at);
+};
+
+#endif /* TELEMETRY_CAPTURE_H */
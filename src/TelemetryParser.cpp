@@ -0,0 +1,266 @@
+#include "TelemetryParser.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Cursor over [p, end) for the small JSON subset the simulator sends.
+struct Cursor {
+    const char *p;
+    const char *end;
+    
+    void skipSpace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            p++;
+        }
+    }
+    
+    bool consume(char c) {
+        skipSpace();
+        if (p < end && *p == c) {
+            p++;
+            return true;
+        }
+        return false;
+    }
+    
+    // A string token, [begin, last) is its raw content with escapes left in.
+    bool str(const char *&begin, const char *&last) {
+        if (!consume('"')) {
+            return false;
+        }
+        begin = p;
+        while (p < end && *p != '"') {
+            if (*p == '\\') {
+                p++;
+            }
+            p++;
+        }
+        if (p >= end) {
+            return false;
+        }
+        last = p++;
+        return true;
+    }
+    
+    bool number(double &value) {
+        skipSpace();
+        // strtod needs a terminated buffer, numbers are short.
+        char buf[64];
+        size_t n = 0;
+        while (p + n < end && n < sizeof(buf) - 1 && p[n] != '\0' && strchr("+-0123456789.eE", p[n])) {
+            buf[n] = p[n];
+            n++;
+        }
+        if (n == 0) {
+            return false;
+        }
+        buf[n] = '\0';
+        char *parsed;
+        value = strtod(buf, &parsed);
+        if (parsed != buf + n) {
+            return false;
+        }
+        p += n;
+        return true;
+    }
+    
+    bool numbers(WaypointVector &values) {
+        values.clear();
+        if (!consume('[')) {
+            return false;
+        }
+        if (consume(']')) {
+            return true;
+        }
+        do {
+            double value;
+            if (!number(value)) {
+                return false;
+            }
+            values.push_back(value);
+        } while (consume(','));
+        return consume(']');
+    }
+    
+    // Skip any value, including nested arrays and objects.
+    bool skipValue() {
+        skipSpace();
+        if (p >= end) {
+            return false;
+        }
+        const char *begin, *last;
+        if (*p == '"') {
+            return str(begin, last);
+        }
+        if (*p == '[' || *p == '{') {
+            char close = *p == '[' ? ']' : '}';
+            p++;
+            if (consume(close)) {
+                return true;
+            }
+            do {
+                if (close == '}' && (!str(begin, last) || !consume(':'))) {
+                    return false;
+                }
+                if (!skipValue()) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(close);
+        }
+        while (p < end && *p != ',' && *p != ']' && *p != '}') {
+            p++;
+        }
+        return true;
+    }
+};
+
+bool equals(const char *begin, const char *last, const char *s) {
+    size_t n = strlen(s);
+    return (size_t) (last - begin) == n && memcmp(begin, s, n) == 0;
+}
+
+// Bounded search for `needle`, the buffer is not terminated.
+const char *find(const char *begin, const char *end, const char *needle) {
+    size_t n = strlen(needle);
+    for (const char *p = begin; p + n <= end; p++) {
+        if (memcmp(p, needle, n) == 0) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+enum Field {
+    PTSX = 1 << 0,
+    PTSY = 1 << 1,
+    X = 1 << 2,
+    Y = 1 << 3,
+    PSI = 1 << 4,
+    SPEED = 1 << 5,
+    STEERING_ANGLE = 1 << 6,
+    THROTTLE = 1 << 7,
+    ALL_FIELDS = (1 << 8) - 1,
+    // The waypoints may be left out when the controller has a map.
+    REQUIRED_FIELDS = ALL_FIELDS & ~(PTSX | PTSY)
+};
+
+bool parseTelemetry(Cursor &c, Telemetry &telemetry) {
+    if (!c.consume('{')) {
+        return false;
+    }
+    int seen = 0;
+    if (!c.consume('}')) {
+        do {
+            const char *key, *key_end;
+            if (!c.str(key, key_end) || !c.consume(':')) {
+                return false;
+            }
+            bool ok;
+            if (equals(key, key_end, "ptsx")) {
+                ok = c.numbers(telemetry.ptsx);
+                seen |= PTSX;
+            } else if (equals(key, key_end, "ptsy")) {
+                ok = c.numbers(telemetry.ptsy);
+                seen |= PTSY;
+            } else if (equals(key, key_end, "x")) {
+                ok = c.number(telemetry.x);
+                seen |= X;
+            } else if (equals(key, key_end, "y")) {
+                ok = c.number(telemetry.y);
+                seen |= Y;
+            } else if (equals(key, key_end, "psi")) {
+                ok = c.number(telemetry.psi);
+                seen |= PSI;
+            } else if (equals(key, key_end, "speed")) {
+                ok = c.number(telemetry.speed);
+                seen |= SPEED;
+            } else if (equals(key, key_end, "steering_angle")) {
+                ok = c.number(telemetry.steering_angle);
+                seen |= STEERING_ANGLE;
+            } else if (equals(key, key_end, "throttle")) {
+                ok = c.number(telemetry.throttle);
+                seen |= THROTTLE;
+            } else {
+                ok = c.skipValue();
+            }
+            if (!ok) {
+                return false;
+            }
+        } while (c.consume(','));
+        if (!c.consume('}')) {
+            return false;
+        }
+    }
+    if (!(seen & PTSX)) {
+        telemetry.ptsx.clear();
+    }
+    if (!(seen & PTSY)) {
+        telemetry.ptsy.clear();
+    }
+    return (seen & REQUIRED_FIELDS) == REQUIRED_FIELDS && telemetry.ptsx.size() == telemetry.ptsy.size();
+}
+
+} // namespace
+
+// The envelope of the telemetry events as the simulator writes them.
+static const char telemetry_prefix[] = "42[\"telemetry\",";
+static const size_t telemetry_prefix_length = sizeof(telemetry_prefix) - 1;
+
+MessageKind parseMessage(const char *data, size_t length, Telemetry &telemetry) {
+    // "42" at the start of the message means there's a websocket message event.
+    // The 4 signifies a websocket message
+    // The 2 signifies a websocket event
+    if (length <= 2 || data[0] != '4' || data[1] != '2') {
+        return MSG_IGNORED;
+    }
+    const char *end = data + length;
+    
+    // Fast path for the common case, a telemetry event with an object that
+    // takes up the rest of the message: it is decoded in a single pass from
+    // the fixed prefix, without scanning the payload for the envelope
+    // first. Anything else, manual mode included, takes the general path.
+    if (length > telemetry_prefix_length && memcmp(data, telemetry_prefix, telemetry_prefix_length) == 0) {
+        Cursor c = {data + telemetry_prefix_length, end};
+        if (c.consume('{')) {
+            c.p--;
+            if (parseTelemetry(c, telemetry) && c.consume(']')) {
+                c.skipSpace();
+                if (c.p == end) {
+                    return MSG_TELEMETRY;
+                }
+            }
+        }
+    }
+    
+    // Checks if the SocketIO event has JSON data, the same way the string
+    // based check did: no "null" anywhere and a "[ ... }]" span.
+    const char *b1 = (const char *) memchr(data, '[', length);
+    const char *b2 = nullptr;
+    for (const char *p = end - 2; p >= data; p--) {
+        if (p[0] == '}' && p[1] == ']') {
+            b2 = p;
+            break;
+        }
+    }
+    if (find(data, end, "null") || !b1 || !b2 || b2 < b1) {
+        return MSG_NO_DATA;
+    }
+    
+    Cursor c = {b1 + 1, b2 + 2};
+    const char *event, *event_end;
+    if (!c.str(event, event_end)) {
+        return MSG_MALFORMED;
+    }
+    if (equals(event, event_end, "visualize")) {
+        return MSG_VISUALIZE;
+    }
+    if (!equals(event, event_end, "telemetry")) {
+        return MSG_OTHER;
+    }
+    if (!c.consume(',') || !parseTelemetry(c, telemetry)) {
+        return MSG_MALFORMED;
+    }
+    return MSG_TELEMETRY;
+}
@@ -0,0 +1,33 @@
+#ifndef TELEMETRY_PARSER_H
+#define TELEMETRY_PARSER_H
+
+#include <cstddef>
+#include "Controller.h"
+
+// What a SocketIO message from the simulator carries.
+enum MessageKind {
+    // Not a websocket event ("42" prefix), nothing to do.
+    MSG_IGNORED,
+    // An event without JSON data, the simulator is in manual mode.
+    MSG_NO_DATA,
+    // A "telemetry" event, its fields were decoded.
+    MSG_TELEMETRY,
+    // Any other event.
+    MSG_OTHER,
+    // A "telemetry" event with missing or unparsable fields.
+    MSG_MALFORMED,
+    // A "visualize" event: draw the lines in the next reply, see
+    // Controller::requestVisualization.
+    MSG_VISUALIZE
+};
+
+// Classify the raw message `data` of `length` bytes and decode telemetry
+// events into `telemetry`.
+//
+// The buffer is scanned in place, it does not need to be NUL terminated,
+// and no DOM is built. ptsx/ptsy are refilled keeping their capacity, so
+// a reused Telemetry does not allocate once it has seen the largest frame.
+// Frames without ptsx/ptsy decode with both empty, see Controller::setMap.
+MessageKind parseMessage(const char *data, size_t length, Telemetry &telemetry);
+
+#endif /* TELEMETRY_PARSER_H */
@@ -0,0 +1,153 @@
+#include "Trace.h"
+
+#ifdef MPC_TRACE
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+struct Span {
+    const char *name;
+    TraceMark start;
+    TraceMark end;
+};
+
+// The spans of one thread and its counters. The buffer outlives the
+// thread, so its spans are still written at exit; the lock is only ever
+// contended by the write.
+struct ThreadTrace {
+    mutex lock;
+    vector<Span> spans;
+    unsigned tid;
+    int group = -1;
+    
+    ThreadTrace(unsigned tid);
+};
+
+// Never destroyed, so they are still there when the trace is written at
+// exit, after the static destructors of other files may have run.
+mutex &registry_lock() {
+    static mutex *lock = new mutex();
+    return *lock;
+}
+
+vector<unique_ptr<ThreadTrace> > &registry() {
+    static vector<unique_ptr<ThreadTrace> > *threads = new vector<unique_ptr<ThreadTrace> >();
+    return *threads;
+}
+
+const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+#ifdef __linux__
+int openCounter(uint64_t config, int group) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+ThreadTrace::ThreadTrace(unsigned tid) : tid(tid) {
+    spans.reserve(1 << 16);
+#ifdef __linux__
+    group = openCounter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (group >= 0 && (openCounter(PERF_COUNT_HW_CACHE_MISSES, group) < 0 ||
+                       openCounter(PERF_COUNT_HW_BRANCH_MISSES, group) < 0)) {
+        close(group);
+        group = -1;
+    }
+#endif
+}
+
+ThreadTrace &threadTrace() {
+    thread_local ThreadTrace *trace = nullptr;
+    if (!trace) {
+        lock_guard<mutex> guard(registry_lock());
+        registry().push_back(unique_ptr<ThreadTrace>(new ThreadTrace(registry().size())));
+        trace = registry().back().get();
+    }
+    return *trace;
+}
+
+void record(const char *name, const TraceMark &start, const TraceMark &end) {
+    ThreadTrace &trace = threadTrace();
+    lock_guard<mutex> guard(trace.lock);
+    trace.spans.push_back({name, start, end});
+}
+
+// The tools join their threads before returning from main, so the trace
+// is complete by the time exit handlers run.
+struct AtExit {
+    AtExit() { atexit(Trace::write); }
+} at_exit;
+
+} // namespace
+
+TraceMark TraceMark::now() {
+    TraceMark mark;
+    mark.ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+    memset(mark.counters, 0, sizeof(mark.counters));
+#ifdef __linux__
+    int group = threadTrace().group;
+    uint64_t values[4];
+    if (group >= 0 && read(group, values, sizeof(values)) == sizeof(values)) {
+        memcpy(mark.counters, values + 1, sizeof(mark.counters));
+    }
+#endif
+    return mark;
+}
+
+TraceScope::~TraceScope() {
+    record(name, start, TraceMark::now());
+}
+
+void TraceClock::lap(const char *name) {
+    TraceMark now = TraceMark::now();
+    record(name, last, now);
+    last = now;
+}
+
+void Trace::write() {
+    const char *path = getenv("MPC_TRACE_FILE");
+    FILE *f = fopen(path ? path : "mpc_trace.json", "w");
+    if (!f) {
+        return;
+    }
+    fputs("{\"traceEvents\":[\n", f);
+    bool first = true;
+    lock_guard<mutex> guard(registry_lock());
+    for (auto &trace : registry()) {
+        lock_guard<mutex> spans_guard(trace->lock);
+        for (const Span &s : trace->spans) {
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"cycles\":%llu,\"cache_misses\":%llu,\"branch_misses\":%llu}}",
+                    first ? "" : ",\n", s.name, trace->tid, s.start.ns * 1e-3, (s.end.ns - s.start.ns) * 1e-3,
+                    (unsigned long long) (s.end.counters[0] - s.start.counters[0]),
+                    (unsigned long long) (s.end.counters[1] - s.start.counters[1]),
+                    (unsigned long long) (s.end.counters[2] - s.start.counters[2]));
+            first = false;
+        }
+    }
+    fputs("\n]}\n", f);
+    fclose(f);
+}
+
+#endif /* MPC_TRACE */
@@ -0,0 +1,76 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstdint>
+
+// Profiling probes, compiled in with -DMPC_TRACE (the MPC_TRACE option of
+// CMake) and to nothing otherwise.
+//
+// Each probe records a span into a buffer of its thread. At exit they are
+// written as Chrome trace events to MPC_TRACE_FILE, mpc_trace.json by
+// default, for chrome://tracing or Perfetto. On Linux every span also
+// carries the cycles, cache misses and branch misses of its thread over it,
+// counted in user space by perf_event_open, when the system allows it
+// (see perf_event_paranoid).
+//
+//     MPC_TRACE_SCOPE("name");      the rest of the scope
+//     MPC_TRACE_CLOCK(clock);       consecutive phases of a scope, each
+//     MPC_TRACE_LAP(clock, "name"); lap the time since the previous one
+//
+// Names must be string literals, only their address is kept.
+
+#ifdef MPC_TRACE
+
+namespace Trace {
+
+// Write everything recorded so far; called at exit.
+void write();
+
+} // namespace Trace
+
+struct TraceMark {
+    uint64_t ns;
+    uint64_t counters[3];
+    
+    static TraceMark now();
+};
+
+// Records one span from its construction to its destruction.
+class TraceScope {
+public:
+    explicit TraceScope(const char *name) : name(name), start(TraceMark::now()) {}
+    
+    ~TraceScope();
+    
+private:
+    const char *name;
+    TraceMark start;
+};
+
+// Records consecutive spans, each from the previous lap or construction.
+class TraceClock {
+public:
+    TraceClock() : last(TraceMark::now()) {}
+    
+    void lap(const char *name);
+    
+private:
+    TraceMark last;
+};
+
+#define MPC_TRACE_JOIN2(a, b) a##b
+#define MPC_TRACE_JOIN(a, b) MPC_TRACE_JOIN2(a, b)
+#define MPC_TRACE_SCOPE(name) TraceScope MPC_TRACE_JOIN(trace_scope_, __LINE__)(name)
+#define MPC_TRACE_CLOCK(clock) TraceClock clock
+#define MPC_TRACE_LAP(clock, name) clock.lap(name)
+
+#else
+
+#define MPC_TRACE_SCOPE(name) ((void) 0)
+#define MPC_TRACE_CLOCK(clock) ((void) 0)
+#define MPC_TRACE_LAP(clock, name) ((void) 0)
+
+#endif /* MPC_TRACE */
+
+#endif /* TRACE_H */
@@ -0,0 +1,596 @@
+#include "Track.h"
+#include <fcntl.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include "PathSpline.h"
+
+namespace {
+
+// Start of a map file, followed by x, y and the arc length of every
+// waypoint, the spline coefficients of x and of y, 4 * n_points each if
+// has_spline, the speed at every waypoint if has_speeds, the chunks, the
+// tiles and one past them, and the cells of the grid.
+struct MapHeader {
+    char magic[8];
+    uint64_t n_points;
+    uint64_t n_cells;
+    uint64_t has_spline;
+    uint64_t has_speeds;
+    double total_length;
+    double cell_size;
+    double origin_x;
+    double origin_y;
+    int64_t cols;
+    int64_t rows;
+    int64_t tile_cells;
+    uint64_t n_tiles;
+    uint64_t chunk_points;
+    uint64_t n_chunks;
+};
+
+const char map_magic[8] = {'M', 'P', 'C', 'M', 'A', 'P', '_', '3'};
+
+// A chunk of waypoints is 45 kB with the spline, a tile about as wide as
+// the stretch of track of a chunk, which a car covers in tens of seconds.
+const size_t default_chunk_points = 512;
+const int64_t default_tile_cells = 128;
+
+// Fraction of the resident limit trimmed down to once over it, so that a
+// trim is not due again with the next chunk.
+const double trim_to = 0.75;
+
+size_t pageSize() {
+    static size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// madvise every page overlapping [begin, end). Dropping one shared with
+// a neighbour in use only costs that neighbour a fault from the page
+// cache, the mapping being read-only.
+void advise(const void *begin, const void *end, int advice) {
+    uintptr_t page = pageSize();
+    uintptr_t first = (uintptr_t) begin / page * page;
+    uintptr_t last = ((uintptr_t) end + page - 1) / page * page;
+    if (first < last) {
+        madvise((void *) first, last - first, advice);
+    }
+}
+
+// Points of each segment the curvature of the spline is sampled at for
+// the speed profile.
+const int speed_samples = 4;
+
+// Segments searched on either side of the hint. Larger than any distance
+// covered in one control period on the sparse lake track.
+const size_t search_radius = 3;
+
+} // namespace
+
+// Per chunk and then per tile, when it was last used, on the clock of the
+// prefetches, and 0 while it is not resident, and the bytes of those that
+// are.
+struct Track::Residency {
+    size_t limit = 0;
+    atomic<uint64_t> clock;
+    atomic<size_t> resident;
+    unique_ptr<atomic<uint64_t>[]> used;
+    size_t n_regions;
+    mutex trimming;
+
+    explicit Residency(size_t n_regions) : clock(0), resident(0), used(new atomic<uint64_t>[n_regions]),
+                                           n_regions(n_regions) {
+        for (size_t i = 0; i < n_regions; i++) {
+            used[i] = 0;
+        }
+    }
+};
+
+Track::Track()
+    : n_points(0), xs(nullptr), ys(nullptr), arc(nullptr), spline_x(nullptr), spline_y(nullptr),
+      speeds(nullptr), cells(nullptr), n_cells(0), tiles(nullptr), n_tiles(0), chunks(nullptr), n_chunks(0),
+      mapped(nullptr), mapped_size(0) {}
+
+Track::~Track() {
+    unmap();
+}
+
+void Track::unmap() {
+    residency.reset();
+    if (mapped) {
+        munmap(mapped, mapped_size);
+        mapped = nullptr;
+        mapped_size = 0;
+    }
+}
+
+bool Track::load(const char *path) {
+    if (open(path)) {
+        return true;
+    }
+    ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    vector<double> read_xs, read_ys;
+    string line;
+    getline(in, line);
+    while (getline(in, line)) {
+        double x, y;
+        char comma;
+        istringstream fields(line);
+        if (fields >> x >> comma >> y && comma == ',') {
+            read_xs.push_back(x);
+            read_ys.push_back(y);
+        }
+    }
+    if (read_xs.size() < 2) {
+        return false;
+    }
+
+    unmap();
+    own_xs.swap(read_xs);
+    own_ys.swap(read_ys);
+    n_points = own_xs.size();
+    xs = own_xs.data();
+    ys = own_ys.data();
+    spline_x = nullptr;
+    spline_y = nullptr;
+    speeds = nullptr;
+    own_speeds.clear();
+    own_arc.resize(n_points);
+    total_length = 0;
+    for (size_t i = 0; i < n_points; i++) {
+        own_arc[i] = total_length;
+        total_length += hypot(x(i + 1) - x(i), y(i + 1) - y(i));
+    }
+    arc = own_arc.data();
+    buildIndex();
+    return true;
+}
+
+bool Track::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    char magic[sizeof(map_magic)];
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(MapHeader) ||
+        pread(fd, magic, sizeof(magic), 0) != (ssize_t) sizeof(magic) ||
+        memcmp(magic, map_magic, sizeof(map_magic)) != 0) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    const MapHeader *header = (const MapHeader *) data;
+    size_t size = st.st_size;
+    size_t n = header->n_points;
+    size_t doubles = n * ((header->has_spline ? 11 : 3) + (header->has_speeds ? 1 : 0));
+    bool ok = n >= 2 && n <= size / sizeof(double) && header->n_cells <= size && header->n_tiles < size &&
+              header->chunk_points > 0 && header->n_chunks == (n + header->chunk_points - 1) / header->chunk_points &&
+              header->tile_cells > 0 &&
+              size == sizeof(MapHeader) + doubles * sizeof(double) + header->n_chunks * sizeof(Chunk) +
+                      (header->n_tiles + 1) * sizeof(Tile) + header->n_cells * sizeof(Cell);
+    if (!ok) {
+        munmap(data, size);
+        return false;
+    }
+
+    unmap();
+    mapped = data;
+    mapped_size = size;
+    n_points = n;
+    const double *values = (const double *) (header + 1);
+    xs = values;
+    ys = values + n;
+    arc = values + 2 * n;
+    spline_x = header->has_spline ? values + 3 * n : nullptr;
+    spline_y = header->has_spline ? values + 7 * n : nullptr;
+    speeds = header->has_speeds ? values + (header->has_spline ? 11 : 3) * n : nullptr;
+    chunks = (const Chunk *) (values + doubles);
+    n_chunks = header->n_chunks;
+    chunk_points = header->chunk_points;
+    tiles = (const Tile *) (chunks + n_chunks);
+    n_tiles = header->n_tiles;
+    cells = (const Cell *) (tiles + n_tiles + 1);
+    n_cells = header->n_cells;
+    total_length = header->total_length;
+    cell_size = header->cell_size;
+    origin_x = header->origin_x;
+    origin_y = header->origin_y;
+    cols = header->cols;
+    rows = header->rows;
+    tile_cells = header->tile_cells;
+    tile_cols = (cols + tile_cells - 1) / tile_cells;
+    own_xs.clear();
+    own_ys.clear();
+    own_arc.clear();
+    own_speeds.clear();
+    own_cells.clear();
+    own_tiles.clear();
+    own_chunks.clear();
+    residency.reset(new Residency(n_chunks + n_tiles));
+    return true;
+}
+
+bool Track::write(const char *path, const PathSpline *spline) const {
+    MapHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, map_magic, sizeof(map_magic));
+    header.n_points = n_points;
+    header.n_cells = n_cells;
+    header.has_spline = spline != nullptr;
+    header.has_speeds = speeds != nullptr;
+    header.total_length = total_length;
+    header.cell_size = cell_size;
+    header.origin_x = origin_x;
+    header.origin_y = origin_y;
+    header.cols = cols;
+    header.rows = rows;
+    header.tile_cells = tile_cells;
+    header.n_tiles = n_tiles;
+    header.chunk_points = chunk_points;
+    header.n_chunks = n_chunks;
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(xs, sizeof(double), n_points, file) == n_points &&
+              fwrite(ys, sizeof(double), n_points, file) == n_points &&
+              fwrite(arc, sizeof(double), n_points, file) == n_points;
+    if (spline) {
+        ok = ok && fwrite(spline->coefficientsX(), sizeof(double), 4 * n_points, file) == 4 * n_points &&
+             fwrite(spline->coefficientsY(), sizeof(double), 4 * n_points, file) == 4 * n_points;
+    }
+    if (speeds) {
+        ok = ok && fwrite(speeds, sizeof(double), n_points, file) == n_points;
+    }
+    ok = ok && fwrite(chunks, sizeof(Chunk), n_chunks, file) == n_chunks &&
+         fwrite(tiles, sizeof(Tile), n_tiles + 1, file) == n_tiles + 1 &&
+         fwrite(cells, sizeof(Cell), n_cells, file) == n_cells;
+    return fclose(file) == 0 && ok;
+}
+
+int64_t Track::tileKey(int64_t c, int64_t r) const {
+    return r / tile_cells * tile_cols + c / tile_cells;
+}
+
+const Track::Tile *Track::findTile(int64_t key) const {
+    const Tile *end = tiles + n_tiles;
+    const Tile *tile = lower_bound(tiles, end, key, [](const Tile &t, int64_t k) {
+        return t.key < k;
+    });
+    return tile != end && tile->key == key ? tile : nullptr;
+}
+
+void Track::buildIndex() {
+    double min_x = *min_element(xs, xs + n_points);
+    double max_x = *max_element(xs, xs + n_points);
+    double min_y = *min_element(ys, ys + n_points);
+    double max_y = *max_element(ys, ys + n_points);
+
+    // About one segment per cell along the track, the grid itself is sparse.
+    cell_size = fmax(total_length / n_points, 1e-6);
+    origin_x = min_x;
+    origin_y = min_y;
+    cols = (int64_t) floor((max_x - min_x) / cell_size) + 1;
+    rows = (int64_t) floor((max_y - min_y) / cell_size) + 1;
+    tile_cells = default_tile_cells;
+    tile_cols = (cols + tile_cells - 1) / tile_cells;
+
+    own_cells.clear();
+    for (size_t i = 0; i < n_points; i++) {
+        int64_t c0 = (int64_t) floor((fmin(x(i), x(i + 1)) - origin_x) / cell_size);
+        int64_t c1 = (int64_t) floor((fmax(x(i), x(i + 1)) - origin_x) / cell_size);
+        int64_t r0 = (int64_t) floor((fmin(y(i), y(i + 1)) - origin_y) / cell_size);
+        int64_t r1 = (int64_t) floor((fmax(y(i), y(i + 1)) - origin_y) / cell_size);
+        for (int64_t r = r0; r <= r1; r++) {
+            for (int64_t c = c0; c <= c1; c++) {
+                own_cells.push_back({r * cols + c, (uint32_t) i, 0});
+            }
+        }
+    }
+    sort(own_cells.begin(), own_cells.end(), [this](const Cell &a, const Cell &b) {
+        int64_t ta = tileKey(a.key % cols, a.key / cols);
+        int64_t tb = tileKey(b.key % cols, b.key / cols);
+        return ta < tb || (ta == tb && a < b);
+    });
+    cells = own_cells.data();
+    n_cells = own_cells.size();
+
+    own_tiles.clear();
+    for (size_t k = 0; k < n_cells; k++) {
+        int64_t key = tileKey(cells[k].key % cols, cells[k].key / cols);
+        if (own_tiles.empty() || own_tiles.back().key != key) {
+            own_tiles.push_back({key, k});
+        }
+    }
+    n_tiles = own_tiles.size();
+    own_tiles.push_back({INT64_MAX, n_cells});
+    tiles = own_tiles.data();
+
+    chunk_points = default_chunk_points;
+    n_chunks = (n_points + chunk_points - 1) / chunk_points;
+    own_chunks.clear();
+    for (size_t k = 0; k < n_chunks; k++) {
+        Chunk chunk = {arc[k * chunk_points], INFINITY, INFINITY, -INFINITY, -INFINITY};
+        size_t last = min(n_points, (k + 1) * chunk_points);
+        for (size_t i = k * chunk_points; i <= last; i++) {
+            chunk.min_x = fmin(chunk.min_x, x(i));
+            chunk.min_y = fmin(chunk.min_y, y(i));
+            chunk.max_x = fmax(chunk.max_x, x(i));
+            chunk.max_y = fmax(chunk.max_y, y(i));
+        }
+        own_chunks.push_back(chunk);
+    }
+    chunks = own_chunks.data();
+}
+
+void Track::buildSpeedProfile(const PathSpline *spline, const SpeedLimits &limits) {
+    size_t n = n_points;
+    vector<double> v(n);
+    for (size_t i = 0; i < n; i++) {
+        double h = (i + 1 < n ? arc[i + 1] : total_length) - arc[i];
+        double kappa = 0;
+        if (spline) {
+            for (int k = 0; k < speed_samples; k++) {
+                kappa = fmax(kappa, fabs(spline->curvature(arc[i] + h * k / speed_samples)));
+            }
+        } else {
+            // The turn at the waypoint over the segments on either side.
+            double turn = remainder(heading(i) - heading(i + n - 1), 2 * M_PI);
+            double before = arc[i] - (i > 0 ? arc[i - 1] : arc[n - 1] - total_length);
+            kappa = fabs(turn) / fmax((h + before) / 2, 1e-6);
+        }
+        v[i] = kappa > 0 ? fmin(limits.max_speed, sqrt(limits.lateral / kappa)) : limits.max_speed;
+    }
+
+    // Braking into every waypoint from the one before, backwards, and
+    // speeding up out of it, forwards; twice around, so that the limits
+    // carry over where the loop closes.
+    for (size_t pass = 0; pass < 2 * n; pass++) {
+        size_t i = (2 * n - 1 - pass) % n;
+        size_t next = (i + 1) % n;
+        double h = (i + 1 < n ? arc[i + 1] : total_length) - arc[i];
+        v[i] = fmin(v[i], sqrt(v[next] * v[next] + 2 * limits.braking * h));
+    }
+    for (size_t pass = 0; pass < 2 * n; pass++) {
+        size_t i = pass % n;
+        size_t next = (i + 1) % n;
+        double h = (i + 1 < n ? arc[i + 1] : total_length) - arc[i];
+        v[next] = fmin(v[next], sqrt(v[i] * v[i] + 2 * limits.accel * h));
+    }
+    own_speeds.swap(v);
+    speeds = own_speeds.data();
+}
+
+double Track::speedAt(double s) const {
+    s = fmod(s, total_length);
+    if (s < 0) {
+        s += total_length;
+    }
+    size_t i = upper_bound(arc, arc + n_points, s) - arc;
+    i = i > 0 ? i - 1 : 0;
+    double h = (i + 1 < n_points ? arc[i + 1] : total_length) - arc[i];
+    double u = h > 0 ? (s - arc[i]) / h : 0;
+    return speed(i) + u * (speed(i + 1) - speed(i));
+}
+
+double Track::heading(size_t i) const {
+    return atan2(y(i + 1) - y(i), x(i + 1) - x(i));
+}
+
+Track::Projection Track::projectOnSegment(double px, double py, size_t i) const {
+    double dx = x(i + 1) - x(i);
+    double dy = y(i + 1) - y(i);
+    double len2 = dx * dx + dy * dy;
+    double u = len2 > 0 ? ((px - x(i)) * dx + (py - y(i)) * dy) / len2 : 0.0;
+    u = fmin(1.0, fmax(0.0, u));
+
+    double ex = px - (x(i) + u * dx);
+    double ey = py - (y(i) + u * dy);
+    double distance = hypot(ex, ey);
+
+    Projection p;
+    p.segment = i % n_points;
+    p.fraction = u;
+    p.s = arc[p.segment] + u * sqrt(len2);
+    p.offset = (dx * ey - dy * ex) >= 0 ? distance : -distance;
+    return p;
+}
+
+Track::Projection Track::project(double px, double py, size_t hint) const {
+    size_t n = n_points;
+    Projection best = projectOnSegment(px, py, hint % n);
+    for (size_t k = 1; k <= search_radius; k++) {
+        Projection ahead = projectOnSegment(px, py, (hint + k) % n);
+        Projection behind = projectOnSegment(px, py, (hint + n - k % n) % n);
+        if (fabs(ahead.offset) < fabs(best.offset)) {
+            best = ahead;
+        }
+        if (fabs(behind.offset) < fabs(best.offset)) {
+            best = behind;
+        }
+    }
+    return best;
+}
+
+Track::Projection Track::locate(double px, double py) const {
+    int64_t qc = (int64_t) floor((px - origin_x) / cell_size);
+    int64_t qr = (int64_t) floor((py - origin_y) / cell_size);
+
+    Projection best = Projection();
+    double best_distance = INFINITY;
+    auto visit = [&](int64_t c, int64_t r) {
+        if (c < 0 || c >= cols) {
+            return;
+        }
+        const Tile *tile = findTile(tileKey(c, r));
+        if (!tile) {
+            return;
+        }
+        const Cell *end = cells + tile[1].first;
+        const Cell *it = lower_bound(cells + tile->first, end, Cell{r * cols + c, 0, 0});
+        for (; it != end && it->key == r * cols + c; ++it) {
+            Projection p = projectOnSegment(px, py, it->segment);
+            if (fabs(p.offset) < best_distance) {
+                best = p;
+                best_distance = fabs(p.offset);
+            }
+        }
+    };
+
+    // Search rings of cells around the query cell. Segments not listed in
+    // rings 0 to k are farther than k cells away, so the search ends once
+    // the nearest one found is closer than that.
+    int64_t first = max(max(max(-qc, qc - (cols - 1)), max(-qr, qr - (rows - 1))), (int64_t) 0);
+    int64_t last = max(max(qc, cols - 1 - qc), max(qr, rows - 1 - qr));
+    for (int64_t k = first; k <= last; k++) {
+        for (int64_t r = max(qr - k, (int64_t) 0); r <= min(qr + k, rows - 1); r++) {
+            if (r == qr - k || r == qr + k) {
+                for (int64_t c = max(qc - k, (int64_t) 0); c <= min(qc + k, cols - 1); c++) {
+                    visit(c, r);
+                }
+            } else {
+                visit(qc - k, r);
+                visit(qc + k, r);
+            }
+        }
+        if (best_distance <= k * cell_size) {
+            break;
+        }
+    }
+    return best;
+}
+
+void Track::window(size_t first, size_t count, WaypointVector &wx, WaypointVector &wy) const {
+    wx.clear();
+    wy.clear();
+    for (size_t k = 0; k < count; k++) {
+        wx.push_back(x(first + k));
+        wy.push_back(y(first + k));
+    }
+}
+
+size_t Track::adviseRegion(size_t region, int advice) const {
+    if (region >= n_chunks) {
+        const Tile *tile = tiles + (region - n_chunks);
+        advise(cells + tile[0].first, cells + tile[1].first, advice);
+        return (tile[1].first - tile[0].first) * sizeof(Cell);
+    }
+    size_t first = region * chunk_points;
+    size_t last = min(n_points, first + chunk_points);
+    const double *arrays[] = {xs, ys, arc};
+    for (const double *a : arrays) {
+        advise(a + first, a + last, advice);
+    }
+    size_t bytes = 3 * (last - first) * sizeof(double);
+    if (spline_x) {
+        advise(spline_x + 4 * first, spline_x + 4 * last, advice);
+        advise(spline_y + 4 * first, spline_y + 4 * last, advice);
+        bytes += 8 * (last - first) * sizeof(double);
+    }
+    // Not one built since, which is on the heap.
+    if (speeds && own_speeds.empty()) {
+        advise(speeds + first, speeds + last, advice);
+        bytes += (last - first) * sizeof(double);
+    }
+    return bytes;
+}
+
+void Track::use(size_t region, uint64_t now) const {
+    if (residency->used[region].exchange(now) == 0) {
+        residency->resident += adviseRegion(region, MADV_WILLNEED);
+    }
+}
+
+void Track::trim() const {
+    Residency &r = *residency;
+    unique_lock<mutex> hold(r.trimming, try_to_lock);
+    if (!hold.owns_lock()) {
+        return;
+    }
+    vector<pair<uint64_t, size_t>> resident;
+    for (size_t i = 0; i < r.n_regions; i++) {
+        if (uint64_t used = r.used[i].load(memory_order_relaxed)) {
+            resident.push_back(make_pair(used, i));
+        }
+    }
+    sort(resident.begin(), resident.end());
+    for (auto &region : resident) {
+        if (r.resident <= r.limit * trim_to) {
+            break;
+        }
+        // A prefetch using it meanwhile keeps it.
+        uint64_t used = region.first;
+        if (!r.used[region.second].compare_exchange_strong(used, 0)) {
+            continue;
+        }
+        r.resident -= adviseRegion(region.second, MADV_DONTNEED);
+    }
+}
+
+void Track::prefetch(size_t segment, double distance) const {
+    if (!residency) {
+        return;
+    }
+    uint64_t now = ++residency->clock;
+    bool forward = distance >= 0;
+    size_t k = segment % n_points / chunk_points;
+    // The rest of the first chunk is not counted, so this reaches at most a
+    // chunk beyond `distance`.
+    double covered = 0;
+    for (size_t visited = 0; visited < n_chunks; visited++) {
+        use(k, now);
+        const Chunk &chunk = chunks[k];
+        int64_t c0 = (int64_t) floor((chunk.min_x - origin_x) / cell_size) / tile_cells;
+        int64_t c1 = (int64_t) floor((chunk.max_x - origin_x) / cell_size) / tile_cells;
+        int64_t r0 = (int64_t) floor((chunk.min_y - origin_y) / cell_size) / tile_cells;
+        int64_t r1 = (int64_t) floor((chunk.max_y - origin_y) / cell_size) / tile_cells;
+        for (int64_t r = r0; r <= r1; r++) {
+            for (int64_t c = c0; c <= c1; c++) {
+                if (const Tile *tile = findTile(r * tile_cols + c)) {
+                    use(n_chunks + (tile - tiles), now);
+                }
+            }
+        }
+        if (visited > 0) {
+            double end = k + 1 < n_chunks ? chunks[k + 1].s : total_length;
+            covered += end - chunk.s;
+        }
+        if (covered >= fabs(distance)) {
+            break;
+        }
+        k = forward ? (k + 1) % n_chunks : (k + n_chunks - 1) % n_chunks;
+    }
+    if (residency->limit > 0 && residency->resident > residency->limit) {
+        trim();
+    }
+}
+
+void Track::setResidentLimit(size_t bytes) {
+    if (residency) {
+        residency->limit = bytes;
+        // Fault in only the pages touched, not those around them.
+        madvise(mapped, mapped_size, bytes > 0 ? MADV_RANDOM : MADV_NORMAL);
+    }
+}
+
+size_t Track::residentBytes() const {
+    return residency ? residency->resident.load() : 0;
+}
@@ -0,0 +1,221 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "SmallVector.h"
+
+using namespace std;
+
+class PathSpline;
+
+// Closed loop of waypoints in map coordinates, driven in the order of the
+// waypoints, e.g. lake_track_waypoints.csv.
+//
+// A track is read from a CSV, or mapped read-only from a map file written
+// by write(), see mpc_mkmap, which holds everything built from the CSV
+// as well: the arc lengths, the grid, the coefficients of the spline and
+// the speed profile.
+// Opening one takes no time for any number of waypoints, and the pages
+// are shared by every process that maps the file. The waypoints are laid
+// out in chunks of consecutive ones and the grid in square tiles of cells,
+// each stored together, so a car only touches the pages of the chunks and
+// tiles around it, see prefetch().
+class Track {
+public:
+    // Where a point lies relative to the center line.
+    struct Projection {
+        // Segment from waypoint `segment` to the next one, and how far along
+        // it, in [0, 1].
+        size_t segment;
+        double fraction;
+        // Arc length from waypoint 0.
+        double s;
+        // Signed distance from the center line, positive to the left.
+        double offset;
+    };
+
+    // What buildSpeedProfile() drives within, in m/s and m/s^2: at most
+    // max_speed, ref_v of the MPC, the centripetal acceleration at most
+    // `lateral`, and speeding up and braking by at most `accel` and
+    // `braking` along the track.
+    struct SpeedLimits {
+        double max_speed = 80;
+        double lateral = 8;
+        double accel = 2;
+        double braking = 2;
+    };
+
+    Track();
+
+    ~Track();
+
+    // Map the map file at `path`, or else read it as a CSV with an "x,y"
+    // header and one waypoint per line.
+    bool load(const char *path);
+
+    // Write the track, the coefficients of `spline`, built on it, and the
+    // speed profile if there is one to a map file; without a spline,
+    // PathSpline::build fits one again.
+    bool write(const char *path, const PathSpline *spline) const;
+
+    // Compute the speed profile within `limits`, replacing that of a map
+    // file: the speed allowed by the lateral limit at the largest
+    // curvature of each segment, of `spline` or else of the polyline, then
+    // lowered so that it is reached braking from the waypoints before,
+    // and speeding up from those after, around the closed loop.
+    void buildSpeedProfile(const PathSpline *spline, const SpeedLimits &limits);
+
+    bool hasSpeedProfile() const { return speeds != nullptr; }
+
+    // The speed of the profile at waypoint i, in m/s.
+    double speed(size_t i) const { return speeds[i % n_points]; }
+
+    // The speed of the profile at arc length s, linear between the
+    // waypoints and around the loop.
+    double speedAt(double s) const;
+
+    size_t size() const { return n_points; }
+
+    double length() const { return total_length; }
+
+    double x(size_t i) const { return xs[i % n_points]; }
+    double y(size_t i) const { return ys[i % n_points]; }
+
+    // Arc length from waypoint 0 to waypoint i.
+    double arcLength(size_t i) const { return arc[i % n_points]; }
+
+    // The arc lengths at the waypoints, in order.
+    const double *arcLengths() const { return arc; }
+
+    // Coefficients of the spline of a map file, see PathSpline, four per
+    // segment for x and as many for y; null if it has none.
+    const double *splineX() const { return spline_x; }
+    const double *splineY() const { return spline_y; }
+
+    // Heading of segment i.
+    double heading(size_t i) const;
+
+    // Projection of (px, py) onto the nearest segment. Only the segments
+    // around `hint`, the segment of the previous projection, are searched.
+    Projection project(double px, double py, size_t hint) const;
+
+    // Projection of (px, py) onto the nearest segment of the whole track,
+    // looked up in a uniform grid over the segments, so without a hint and
+    // in O(log n) for points near the track.
+    Projection locate(double px, double py) const;
+
+    // Copy `count` waypoints starting at `first`, wrapping around, reusing
+    // the storage of `wx` and `wy`.
+    void window(size_t first, size_t count, WaypointVector &wx, WaypointVector &wy) const;
+
+    // Have the pages of the chunks of waypoints from `segment` on for
+    // `distance` m of arc, backwards if negative, and of the tiles of the
+    // grid around them read in the background (MADV_WILLNEED) unless they
+    // are resident already, and mark them used. Past the resident limit,
+    // the chunks and tiles used least recently are dropped again. Does not
+    // touch the mapping itself, so it never waits for a page; safe from
+    // any thread, and nothing for a track read from a CSV.
+    void prefetch(size_t segment, double distance) const;
+
+    // Keep the pages of a mapped map resident to about `bytes`, see
+    // prefetch(); 0, the default, leaves them all to the kernel.
+    void setResidentLimit(size_t bytes);
+
+    // Bytes of the chunks and tiles prefetched and not dropped since.
+    size_t residentBytes() const;
+
+    // Entry of the grid below.
+    struct Cell {
+        int64_t key;
+        uint32_t segment;
+        uint32_t padding;
+
+        bool operator<(const Cell &other) const {
+            return key < other.key || (key == other.key && segment < other.segment);
+        }
+    };
+
+    // A tile of the grid: its key, and its first cell, those of the tile
+    // running up to the first of the next.
+    struct Tile {
+        int64_t key;
+        uint64_t first;
+    };
+
+    // Chunk of consecutive waypoints: the arc length at its first, and the
+    // bounding box of its segments.
+    struct Chunk {
+        double s;
+        double min_x;
+        double min_y;
+        double max_x;
+        double max_y;
+    };
+
+private:
+    // The waypoints and the arc length at each, in the vectors below when
+    // read from a CSV, in the mapping of a map file otherwise.
+    size_t n_points;
+    const double *xs;
+    const double *ys;
+    const double *arc;
+    const double *spline_x;
+    const double *spline_y;
+    // The speed profile at every waypoint, or null.
+    const double *speeds;
+    double total_length = 0;
+
+    // Grid of square cells of `cell_size` with its origin at the lower left
+    // corner of the bounding box. Every segment is listed under each cell
+    // its bounding box overlaps, as (cell key, segment). The cells are
+    // grouped into tiles of tile_cells by tile_cells, in the order of the
+    // tile keys, and sorted by key within each; `tiles` lists the tiles
+    // holding any, and one past the last.
+    double cell_size = 1;
+    double origin_x = 0;
+    double origin_y = 0;
+    int64_t cols = 0;
+    int64_t rows = 0;
+    int64_t tile_cells = 1;
+    int64_t tile_cols = 0;
+    const Cell *cells;
+    size_t n_cells;
+    const Tile *tiles;
+    size_t n_tiles;
+    // Waypoints chunk_points at a time.
+    size_t chunk_points = 1;
+    const Chunk *chunks;
+    size_t n_chunks;
+
+    vector<double> own_xs;
+    vector<double> own_ys;
+    vector<double> own_arc;
+    vector<double> own_speeds;
+    vector<Cell> own_cells;
+    vector<Tile> own_tiles;
+    vector<Chunk> own_chunks;
+    void *mapped;
+    size_t mapped_size;
+
+    // What prefetch() keeps of a mapping, see Track.cpp.
+    struct Residency;
+    unique_ptr<Residency> residency;
+
+    Projection projectOnSegment(double px, double py, size_t i) const;
+    bool open(const char *path);
+    void unmap();
+    void buildIndex();
+    int64_t tileKey(int64_t c, int64_t r) const;
+    const Tile *findTile(int64_t key) const;
+    size_t adviseRegion(size_t region, int advice) const;
+    void use(size_t region, uint64_t now) const;
+    void trim() const;
+
+    Track(const Track &) = delete;
+    Track &operator=(const Track &) = delete;
+};
+
+#endif /* TRACK_H */
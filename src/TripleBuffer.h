@@ -0,0 +1,54 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <array>
+#include <atomic>
+
+// Latest-value handover from exactly one producer thread to one consumer
+// thread, without locks and without either side ever waiting: the
+// producer writes into its back slot and publishes it, the consumer picks
+// up the newest slot published. With only two slots the producer could
+// not publish while the consumer still reads the other one; the third,
+// exchanged between the two sides, lets both run freely. Values published
+// in between are skipped, only the last one counts.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : back_slot(0), middle(1), front_slot(2) {}
+
+    // Producer side: the slot to write the next value into, then hand it
+    // over. The slot keeps its storage from the value it held before.
+    T &back() { return slots[back_slot]; }
+
+    // Returns whether it replaced a value the consumer never took.
+    bool publish() {
+        int replaced = middle.exchange(back_slot | fresh, std::memory_order_acq_rel);
+        back_slot = replaced & slot_mask;
+        return (replaced & fresh) != 0;
+    }
+
+    // Consumer side: take the newest value published, if there is one the
+    // consumer has not taken yet, into front().
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & fresh)) {
+            return false;
+        }
+        front_slot = middle.exchange(front_slot, std::memory_order_acq_rel) & slot_mask;
+        return true;
+    }
+
+    const T &front() const { return slots[front_slot]; }
+
+private:
+    // The slot in the middle, with `fresh` set while the consumer has not
+    // taken it.
+    static const int slot_mask = 3;
+    static const int fresh = 4;
+
+    std::array<T, 3> slots;
+    int back_slot;
+    std::atomic<int> middle;
+    int front_slot;
+};
+
+#endif /* TRIPLE_BUFFER_H */
@@ -0,0 +1,178 @@
+#ifndef VEHICLE_MODEL_H
+#define VEHICLE_MODEL_H
+
+#include <cmath>
+#include <cstddef>
+#include "DualNumber.h"
+#include "Eigen-3.3/Eigen/Core"
+#include "FastMath.h"
+#include "Polynomial.h"
+
+// The kinematic bicycle of the MPC, shared by the prediction over the
+// actuation delay in Controller and by every backend of the optimizer.
+
+// This value assumes the model presented in the classroom is used.
+//
+// It was obtained by measuring the radius formed by running the vehicle in the
+// simulator around in a circle with a constant steering angle and velocity on a
+// flat terrain.
+//
+// Lf was tuned until the the radius formed by the simulating the model
+// presented in the classroom matched the previous radius.
+//
+// This is the length from front to CoG that has a similar radius.
+constexpr double Lf = 2.67;
+
+// Time until actuations sent to the simulator take effect. The controller
+// predicts the state over it before solving, and the horizons hold the
+// actuations decided before it over the stages it spans, see
+// MpcConfig::latency.
+constexpr size_t actuation_delay_ms = 100;
+
+// The upper and lower limits of delta are -25 and 25 degrees (values in
+// radians), those of the acceleration/decceleration -1 and 1.
+constexpr double max_delta = 0.436332;
+constexpr double max_a = 1.0;
+
+// One step of dt from the state s = (x, y, psi, v, cte, epsi) under the
+// actuations delta and a, into `next`: the bicycle in the vehicle frame of
+// the reference polynomial `coeffs`, with cte and epsi taken against it at
+// x. This is the classroom model, including its use of x for the y update.
+//
+// `Scalar` is double or AD<double>; the math functions are those of the
+// build, see modelSin.
+template <typename Scalar, typename Coeffs>
+inline void vehicleStep(const Scalar s[6], const Scalar &delta, const Scalar &a, const Coeffs &coeffs,
+                        double dt, Scalar next[6]) {
+    Scalar f0, psides0;
+    polyevalSlope(coeffs, s[0], f0, psides0);
+    psides0 = modelAtan(psides0);
+
+    Scalar turn = (s[3]/Lf) * delta * dt;
+    next[0] = s[0] + s[3] * modelCos(s[2]) * dt;
+    next[1] = s[0] + s[3] * modelSin(s[2]) * dt;
+    next[2] = s[2] + turn;
+    next[3] = s[3] + a * dt;
+    next[4] = (f0 - s[1]) + s[3] * modelSin(s[5]) * dt;
+    next[5] = (s[2] - psides0) + turn;
+}
+
+// The Jacobians of vehicleStep with respect to the state (A) and the
+// actuations (B), each if requested; a does not enter them. They
+// differentiate the math functions of the build, see modelSinSlope.
+template <typename Scalar, typename Coeffs>
+inline void vehicleJacobians(const Scalar s[6], Scalar delta, const Coeffs &coeffs, Scalar dt,
+                             Eigen::Matrix<Scalar, 6, 6> *A, Eigen::Matrix<Scalar, 6, 2> *B) {
+    const Scalar lf = Lf;
+    Scalar x0 = s[0], psi0 = s[2], v0 = s[3], epsi0 = s[5];
+    if (A) {
+        Scalar f[3];
+        polyDerivatives<2>(coeffs, x0, f);
+
+        A->setZero();
+        (*A)(0, 0) = 1;
+        (*A)(0, 2) = v0 * modelCosSlope(psi0) * dt;
+        (*A)(0, 3) = modelCos(psi0) * dt;
+        (*A)(1, 0) = 1;
+        (*A)(1, 2) = v0 * modelSinSlope(psi0) * dt;
+        (*A)(1, 3) = modelSin(psi0) * dt;
+        (*A)(2, 2) = 1;
+        (*A)(2, 3) = delta * dt / lf;
+        (*A)(3, 3) = 1;
+        (*A)(4, 0) = f[1];
+        (*A)(4, 1) = -1;
+        (*A)(4, 3) = modelSin(epsi0) * dt;
+        (*A)(4, 5) = v0 * modelSinSlope(epsi0) * dt;
+        (*A)(5, 0) = -f[2] * modelAtanSlope(f[1]);
+        (*A)(5, 2) = 1;
+        (*A)(5, 3) = delta * dt / lf;
+    }
+    if (B) {
+        B->setZero();
+        (*B)(2, 0) = v0 * dt / lf;
+        (*B)(3, 1) = dt;
+        (*B)(5, 0) = v0 * dt / lf;
+    }
+}
+
+// vehicleStep into `next` and its Jacobians A and B, each if requested,
+// from one sweep of vehicleStep itself on dual numbers seeded with the
+// state and the actuations: the exact derivatives of the function
+// evaluated, math functions included, with no tape and no allocation.
+template <typename Scalar, typename Coeffs>
+inline void vehicleDualStep(const Scalar s[6], Scalar delta, Scalar a, const Coeffs &coeffs, Scalar dt,
+                            Scalar next[6], Eigen::Matrix<Scalar, 6, 6> *A, Eigen::Matrix<Scalar, 6, 2> *B) {
+    typedef Dual<Scalar, 8> StageDual;
+    StageDual ds[6], dnext[6];
+    for (int k = 0; k < 6; k++) {
+        ds[k] = StageDual(s[k], k);
+    }
+    vehicleStep(ds, StageDual(delta, 6), StageDual(a, 7), coeffs, dt, dnext);
+    for (int k = 0; k < 6; k++) {
+        if (next) {
+            next[k] = dnext[k].value;
+        }
+        if (A) {
+            A->row(k) = dnext[k].grad.template head<6>().transpose();
+        }
+        if (B) {
+            B->row(k) = dnext[k].grad.template tail<2>().transpose();
+        }
+    }
+}
+
+// vehicleStep into `next` and its Jacobians, each if requested, the way
+// the build computes them: by vehicleDualStep with MPC_DUAL_JACOBIANS, by
+// vehicleJacobians otherwise.
+template <typename Scalar, typename Coeffs>
+inline void vehicleStepJacobians(const Scalar s[6], Scalar delta, Scalar a, const Coeffs &coeffs, Scalar dt,
+                                 Scalar next[6], Eigen::Matrix<Scalar, 6, 6> *A, Eigen::Matrix<Scalar, 6, 2> *B) {
+#ifdef MPC_DUAL_JACOBIANS
+    if (A || B) {
+        vehicleDualStep(s, delta, a, coeffs, dt, next, A, B);
+        return;
+    }
+#endif
+    if (next) {
+        vehicleStep(s, delta, a, coeffs, dt, next);
+    }
+    vehicleJacobians(s, delta, coeffs, dt, A, B);
+}
+
+template <int n_coeffs, typename Scalar, typename Coeffs>
+inline void fixedDegreeStep(const Scalar s[6], Scalar delta, Scalar a, const Coeffs &coeffs, Scalar dt,
+                            Scalar next[6], Eigen::Matrix<Scalar, 6, 6> *A, Eigen::Matrix<Scalar, 6, 2> *B) {
+    Eigen::Map<const Eigen::Matrix<typename Coeffs::Scalar, n_coeffs, 1> > fixed(coeffs.data());
+    vehicleStepJacobians(s, delta, a, fixed, dt, next, A, B);
+}
+
+// vehicleStepJacobians for the reference of the backends, which comes in
+// a runtime-size vector: dispatched on its size to the instantiation for
+// each degree from 1 to max_poly_degree, on fixed-size coefficients over
+// which the Horner loops of polyDerivatives unroll. Other sizes go as they
+// are.
+template <typename Scalar, typename Coeffs>
+inline void vehicleStepDegree(const Scalar s[6], Scalar delta, Scalar a, const Coeffs &coeffs, Scalar dt,
+                              Scalar next[6], Eigen::Matrix<Scalar, 6, 6> *A, Eigen::Matrix<Scalar, 6, 2> *B) {
+    switch (coeffs.size()) {
+    case 2:
+        fixedDegreeStep<2>(s, delta, a, coeffs, dt, next, A, B);
+        break;
+    case 3:
+        fixedDegreeStep<3>(s, delta, a, coeffs, dt, next, A, B);
+        break;
+    case 4:
+        fixedDegreeStep<4>(s, delta, a, coeffs, dt, next, A, B);
+        break;
+    case 5:
+        fixedDegreeStep<5>(s, delta, a, coeffs, dt, next, A, B);
+        break;
+    case 6:
+        fixedDegreeStep<6>(s, delta, a, coeffs, dt, next, A, B);
+        break;
+    default:
+        vehicleStepJacobians(s, delta, a, coeffs, dt, next, A, B);
+    }
+}
+
+#endif /* VEHICLE_MODEL_H */
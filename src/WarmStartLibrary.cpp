@@ -0,0 +1,138 @@
+#include "WarmStartLibrary.h"
+#include <algorithm>
+#include <cmath>
+
+// Quantization steps of the features: v, cte, epsi, then the polynomial
+// coefficients from the constant up.
+static const double feature_steps[n_warm_features] = {1.0, 0.25, 0.05, 0.25, 0.05, 0.002, 1e-4};
+
+// Pending entries searched linearly before the tree is rebuilt.
+static const size_t max_pending = 64;
+
+WarmStartLibrary::WarmStartLibrary() : capacity(0), n_inputs(0), n_entries(0), n_indexed(0) {}
+
+void WarmStartLibrary::reset(size_t capacity, size_t n_inputs) {
+    this->capacity = capacity;
+    this->n_inputs = n_inputs;
+    n_entries = 0;
+    n_indexed = 0;
+    features.assign(capacity * n_warm_features, 0.0f);
+    inputs.assign(capacity * n_inputs, 0.0);
+    tree.clear();
+    tree.reserve(capacity);
+    keys.clear();
+}
+
+void WarmStartLibrary::scale(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                             float f[n_warm_features]) const {
+    double raw[n_warm_features] = {state[3], state[4], state[5], 0, 0, 0, 0};
+    for (int i = 0; i < 4 && i < coeffs.size(); i++) {
+        raw[3 + i] = coeffs[i];
+    }
+    for (int i = 0; i < n_warm_features; i++) {
+        f[i] = raw[i] / feature_steps[i];
+    }
+}
+
+void WarmStartLibrary::add(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, const double *inputs) {
+    if (n_entries == capacity) {
+        return;
+    }
+    float f[n_warm_features];
+    scale(state, coeffs, f);
+    uint64_t key = 0;
+    for (int i = 0; i < n_warm_features; i++) {
+        key = key * 0x9e3779b97f4a7c15ull + (uint64_t) (int64_t) lround(f[i]);
+    }
+    if (!keys.insert(key).second) {
+        return;
+    }
+
+    copy(f, f + n_warm_features, &features[n_entries * n_warm_features]);
+    copy(inputs, inputs + n_inputs, &this->inputs[n_entries * n_inputs]);
+    tree.push_back(n_entries++);
+    if (tree.size() - n_indexed >= max_pending || n_entries == capacity) {
+        build(0, tree.size(), 0);
+        n_indexed = tree.size();
+    }
+}
+
+void WarmStartLibrary::build(size_t begin, size_t end, int depth) {
+    if (end - begin < 2) {
+        return;
+    }
+    int axis = depth % n_warm_features;
+    size_t mid = begin + (end - begin) / 2;
+    nth_element(tree.begin() + begin, tree.begin() + mid, tree.begin() + end, [&](uint32_t a, uint32_t b) {
+        return features[a * n_warm_features + axis] < features[b * n_warm_features + axis];
+    });
+    build(begin, mid, depth + 1);
+    build(mid + 1, end, depth + 1);
+}
+
+float WarmStartLibrary::distance2(size_t entry, const float q[n_warm_features]) const {
+    const float *f = &features[entry * n_warm_features];
+    float d2 = 0;
+    for (int i = 0; i < n_warm_features; i++) {
+        d2 += (f[i] - q[i]) * (f[i] - q[i]);
+    }
+    return d2;
+}
+
+void WarmStartLibrary::search(size_t begin, size_t end, int depth, const float q[n_warm_features],
+                              size_t &best, float &best_d2) const {
+    if (begin >= end) {
+        return;
+    }
+    int axis = depth % n_warm_features;
+    size_t mid = begin + (end - begin) / 2;
+    size_t entry = tree[mid];
+    float d2 = distance2(entry, q);
+    if (d2 < best_d2) {
+        best = entry;
+        best_d2 = d2;
+    }
+    float diff = q[axis] - features[entry * n_warm_features + axis];
+    bool left = diff < 0;
+    if (left) {
+        search(begin, mid, depth + 1, q, best, best_d2);
+    } else {
+        search(mid + 1, end, depth + 1, q, best, best_d2);
+    }
+    // The other side can only be closer than the splitting plane.
+    if (diff * diff < best_d2) {
+        if (left) {
+            search(mid + 1, end, depth + 1, q, best, best_d2);
+        } else {
+            search(begin, mid, depth + 1, q, best, best_d2);
+        }
+    }
+}
+
+const double *WarmStartLibrary::nearest(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                                        double max_distance) const {
+    if (n_entries == 0) {
+        return nullptr;
+    }
+    float q[n_warm_features];
+    scale(state, coeffs, q);
+    size_t best = 0;
+    float best_d2 = max_distance * max_distance;
+    bool found = false;
+    for (size_t i = n_indexed; i < tree.size(); i++) {
+        float d2 = distance2(tree[i], q);
+        if (d2 <= best_d2) {
+            best = tree[i];
+            best_d2 = d2;
+            found = true;
+        }
+    }
+    size_t indexed_best = capacity;
+    float indexed_d2 = best_d2;
+    search(0, n_indexed, 0, q, indexed_best, indexed_d2);
+    if (indexed_best != capacity && indexed_d2 <= best_d2) {
+        best = indexed_best;
+        found = true;
+    }
+    return found ? &inputs[best * n_inputs] : nullptr;
+}
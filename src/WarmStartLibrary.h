@@ -0,0 +1,66 @@
+#ifndef WARM_START_LIBRARY_H
+#define WARM_START_LIBRARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+
+using namespace std;
+
+// Features of a problem: v, cte and epsi of the initial state and the
+// four coefficients of the reference.
+static const int n_warm_features = 7;
+
+// Converged actuations of earlier solves, looked up by the features of a
+// new problem when the shifted previous solution is missing or does not
+// fit it, see FixedHorizon::Solve. The features are divided by their
+// quantization steps, so distances count steps on every axis alike, and a
+// problem whose quantized features are already present is not added.
+//
+// Entries go into a k-d tree over a flat array of their indices, rebuilt
+// once enough new entries have piled up beside it; those are searched
+// linearly until then. Once full the library stops learning.
+class WarmStartLibrary {
+public:
+    WarmStartLibrary();
+
+    // Room for `capacity` entries of `n_inputs` actuations each, empty.
+    // Zero disables the library.
+    void reset(size_t capacity, size_t n_inputs);
+
+    bool enabled() const { return capacity > 0; }
+
+    size_t size() const { return n_entries; }
+
+    // Learn the actuations `inputs` of a converged solve of the problem of
+    // `state` and `coeffs`.
+    void add(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, const double *inputs);
+
+    // The actuations of the entry nearest to the problem, if it is within
+    // `max_distance` steps; nullptr otherwise.
+    const double *nearest(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs,
+                          double max_distance = 4.0) const;
+
+private:
+    size_t capacity;
+    size_t n_inputs;
+    size_t n_entries;
+    // Features and actuations of every entry, in the order added.
+    vector<float> features;
+    vector<double> inputs;
+    // Entries [0, n_indexed) of `tree` form the k-d tree: the median of
+    // each range splits it on the axis of its depth. The rest are pending.
+    vector<uint32_t> tree;
+    size_t n_indexed;
+    unordered_set<uint64_t> keys;
+
+    void scale(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, float f[n_warm_features]) const;
+    void build(size_t begin, size_t end, int depth);
+    void search(size_t begin, size_t end, int depth, const float q[n_warm_features],
+                size_t &best, float &best_d2) const;
+    float distance2(size_t entry, const float q[n_warm_features]) const;
+};
+
+#endif /* WARM_START_LIBRARY_H */
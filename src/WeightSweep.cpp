@@ -0,0 +1,145 @@
+#include "WeightSweep.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <string>
+
+static const struct {
+    const char *name;
+    double CostWeights::*field;
+} weight_fields[] = {
+    {"cte", &CostWeights::cte},
+    {"epsi", &CostWeights::epsi},
+    {"v", &CostWeights::v},
+    {"delta", &CostWeights::delta},
+    {"a", &CostWeights::a},
+    {"ddelta", &CostWeights::ddelta},
+    {"da", &CostWeights::da},
+};
+
+bool parseAxis(const char *spec, WeightAxis &axis) {
+    const char *eq = strchr(spec, '=');
+    if (!eq) {
+        return false;
+    }
+    string name(spec, eq - spec);
+    axis = WeightAxis();
+    for (const auto &f : weight_fields) {
+        if (name == f.name) {
+            axis.field = f.field;
+        }
+    }
+    if (!axis.field) {
+        return false;
+    }
+
+    const char *p = eq + 1;
+    char *end;
+    double first = strtod(p, &end);
+    if (end == p) {
+        return false;
+    }
+    if (*end == ':') {
+        p = end + 1;
+        axis.lo = first;
+        axis.hi = strtod(p, &end);
+        axis.values = {axis.lo, axis.hi};
+        return end != p && *end == '\0' && axis.lo > 0 && axis.hi >= axis.lo;
+    }
+    axis.values.push_back(first);
+    while (*end == ',') {
+        p = end + 1;
+        axis.values.push_back(strtod(p, &end));
+        if (end == p) {
+            return false;
+        }
+    }
+    return *end == '\0';
+}
+
+vector<CostWeights> gridSearch(const CostWeights &base, const vector<WeightAxis> &axes) {
+    vector<CostWeights> candidates(1, base);
+    for (const WeightAxis &axis : axes) {
+        vector<CostWeights> next;
+        for (const CostWeights &c : candidates) {
+            for (double value : axis.values) {
+                next.push_back(c);
+                next.back().*axis.field = value;
+            }
+        }
+        candidates.swap(next);
+    }
+    return candidates;
+}
+
+vector<CostWeights> randomSearch(const CostWeights &base, const vector<WeightAxis> &axes,
+                                 size_t samples, unsigned seed) {
+    mt19937 rng(seed);
+    vector<CostWeights> candidates(samples, base);
+    for (CostWeights &c : candidates) {
+        for (const WeightAxis &axis : axes) {
+            if (axis.hi > 0) {
+                uniform_real_distribution<double> exponent(log(axis.lo), log(axis.hi));
+                c.*axis.field = exp(exponent(rng));
+            } else {
+                uniform_int_distribution<size_t> pick(0, axis.values.size() - 1);
+                c.*axis.field = axis.values[pick(rng)];
+            }
+        }
+    }
+    return candidates;
+}
+
+vector<SweepResult> runSweep(const Track &track, const SimOptions &base, const vector<size_t> &starts,
+                             const vector<CostWeights> &candidates, size_t n_threads, size_t n_processes) {
+    vector<SimOptions> episodes;
+    for (const CostWeights &weights : candidates) {
+        for (size_t start : starts) {
+            episodes.push_back(base);
+            episodes.back().weights = weights;
+            episodes.back().start_segment = start;
+        }
+    }
+    vector<EpisodeResult> episode_results = n_processes > 0 ? runForked(track, episodes, n_processes)
+                                                            : runBatch(track, episodes, n_threads);
+
+    vector<SweepResult> results(candidates.size());
+    for (size_t i = 0; i < candidates.size(); i++) {
+        SweepResult &result = results[i];
+        result.weights = candidates[i];
+        vector<double> step_times;
+        double time = 0;
+        for (size_t j = 0; j < starts.size(); j++) {
+            const EpisodeResult &episode = episode_results[i * starts.size() + j];
+            result.runs++;
+            result.max_offset = fmax(result.max_offset, episode.max_offset);
+            if (episode.completed) {
+                result.completed++;
+                time += episode.time;
+            }
+            step_times.insert(step_times.end(), episode.step_times.begin(), episode.step_times.end());
+        }
+        if (result.completed > 0) {
+            result.lap_time = time / (result.completed * base.laps);
+        }
+        if (!step_times.empty()) {
+            sort(step_times.begin(), step_times.end());
+            result.step_p50 = step_times[step_times.size() / 2];
+            result.step_p99 = step_times[min(step_times.size() - 1, step_times.size() * 99 / 100)];
+            result.step_max = step_times.back();
+        }
+    }
+    return results;
+}
+
+bool betterResult(const SweepResult &a, const SweepResult &b) {
+    if (a.completed != b.completed) {
+        return a.completed > b.completed;
+    }
+    if (a.lap_time != b.lap_time) {
+        return a.lap_time < b.lap_time;
+    }
+    return a.max_offset < b.max_offset;
+}
@@ -0,0 +1,56 @@
+#ifndef WEIGHT_SWEEP_H
+#define WEIGHT_SWEEP_H
+
+#include <cstddef>
+#include <vector>
+#include "CostWeights.h"
+#include "Simulator.h"
+#include "Track.h"
+
+using namespace std;
+
+// Values one cost weight takes in a sweep: either a list or a range, which
+// random search samples log-uniformly and grid search visits at its ends.
+struct WeightAxis {
+    double CostWeights::*field = nullptr;
+    vector<double> values;
+    double lo = 0;
+    double hi = 0;
+};
+
+// Parse "name=v1,v2,..." or "name=lo:hi", name being a CostWeights field.
+bool parseAxis(const char *spec, WeightAxis &axis);
+
+// Every combination of the axis values on top of `base`.
+vector<CostWeights> gridSearch(const CostWeights &base, const vector<WeightAxis> &axes);
+
+// `samples` weight sets drawn independently per axis.
+vector<CostWeights> randomSearch(const CostWeights &base, const vector<WeightAxis> &axes,
+                                 size_t samples, unsigned seed);
+
+// How one weight set did over its runs.
+struct SweepResult {
+    CostWeights weights;
+    size_t runs = 0;
+    size_t completed = 0;
+    // Mean time per lap over the completed runs, 0 if there are none.
+    double lap_time = 0;
+    // Largest distance from the center line over all runs.
+    double max_offset = 0;
+    // Percentiles of the controller step times over all runs, in seconds.
+    double step_p50 = 0;
+    double step_p99 = 0;
+    double step_max = 0;
+};
+
+// Evaluate every candidate from each start segment with `base` otherwise.
+// All episodes go into one batch, so the threads stay busy until the last
+// few. With `n_processes` they run in that many processes forked from a
+// prototype controller instead, see runForked.
+vector<SweepResult> runSweep(const Track &track, const SimOptions &base, const vector<size_t> &starts,
+                             const vector<CostWeights> &candidates, size_t n_threads, size_t n_processes = 0);
+
+// Completed runs first, then faster laps, then smaller offsets.
+bool betterResult(const SweepResult &a, const SweepResult &b);
+
+#endif /* WEIGHT_SWEEP_H */
@@ -0,0 +1,286 @@
+#include "WorkerPool.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include "Logger.h"
+#include "Metrics.h"
+
+const size_t WorkerPool::queue_capacity;
+
+// Pin the calling thread to `cpus` unless empty, and move it to SCHED_FIFO
+// at `fifo_priority` unless that is 0, see placeThread.
+static bool placeThreadOn(const vector<int> &cpus, int fifo_priority) {
+#ifdef __linux__
+    bool ok = true;
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+        ok = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+    if (fifo_priority != 0) {
+        sched_param param;
+        param.sched_priority = fifo_priority;
+        ok = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0 && ok;
+    }
+    return ok;
+#else
+    return cpus.empty() && fifo_priority == 0;
+#endif
+}
+
+bool placeThread(int cpu, int fifo_priority) {
+    return placeThreadOn(cpu >= 0 ? vector<int>(1, cpu) : vector<int>(), fifo_priority);
+}
+
+// The list of the kernel's format, e.g. "0-3,8-11", from the file at
+// `path`, into `values`; false if it cannot be read or is empty.
+static bool readKernelList(const string &path, vector<int> &values) {
+    ifstream file(path);
+    string line;
+    values.clear();
+    if (!getline(file, line)) {
+        return false;
+    }
+    stringstream ranges(line);
+    string range;
+    while (getline(ranges, range, ',')) {
+        int first, last;
+        int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n < 1) {
+            continue;
+        }
+        for (int i = first; i <= (n == 2 ? last : first); i++) {
+            values.push_back(i);
+        }
+    }
+    return !values.empty();
+}
+
+int numaNodes() {
+    vector<int> nodes;
+    if (!readKernelList("/sys/devices/system/node/online", nodes)) {
+        return 1;
+    }
+    return nodes.back() + 1;
+}
+
+bool numaCpus(int node, vector<int> &cpus) {
+    return readKernelList("/sys/devices/system/node/node" + to_string(node) + "/cpulist", cpus);
+}
+
+int numaNodeOf(int cpu) {
+    vector<int> cpus;
+    for (int node = 0, n = numaNodes(); node < n; node++) {
+        if (numaCpus(node, cpus) && find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+bool placeThreadOnNode(int node, int fifo_priority) {
+    vector<int> cpus;
+    if (!numaCpus(node, cpus)) {
+        return false;
+    }
+    return placeThreadOn(cpus, fifo_priority);
+}
+
+WorkerPool::WorkerPool(uv_loop_t *loop, size_t n_threads, const SchedulerOptions &options)
+    : next_worker(0), next_assigned(0), options(options), stopping(false), async(new uv_async_t),
+      idle(nullptr) {
+    uv_async_init(loop, async, onAsync);
+    async->data = this;
+    if (options.idle == IDLE_BUSY) {
+        idle = new uv_idle_t;
+        uv_idle_init(loop, idle);
+        idle->data = this;
+        uv_idle_start(idle, onIdle);
+    }
+    if (!options.worker_cpus.empty()) {
+        n_threads = options.worker_cpus.size();
+    }
+    int n_nodes = options.numa ? numaNodes() : 1;
+    vector<vector<size_t> > by_node(n_nodes);
+    for (size_t i = 0; i < n_threads; i++) {
+        workers.push_back(unique_ptr<Worker>(new Worker()));
+        if (options.numa) {
+            int node = options.worker_cpus.empty() ? (int) (i % n_nodes) : numaNodeOf(options.worker_cpus[i]);
+            workers.back()->node = node;
+            by_node[node % n_nodes].push_back(i);
+        } else {
+            by_node[0].push_back(i);
+        }
+    }
+    // The workers of the nodes interleaved, so consecutive clients go to
+    // different nodes.
+    for (size_t k = 0; assign_order.size() < workers.size(); k++) {
+        for (const vector<size_t> &node : by_node) {
+            if (k < node.size()) {
+                assign_order.push_back(node[k]);
+            }
+        }
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->runner = thread(&WorkerPool::run, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    stopping = true;
+    for (auto &worker : workers) {
+        worker->events.Notify(true);
+    }
+    for (auto &worker : workers) {
+        worker->runner.join();
+    }
+    
+    // The handle is only released by libuv once the close completes.
+    uv_close((uv_handle_t *) async, [](uv_handle_t *handle) {
+        delete (uv_async_t *) handle;
+    });
+    if (idle) {
+        uv_close((uv_handle_t *) idle, [](uv_handle_t *handle) {
+            delete (uv_idle_t *) handle;
+        });
+    }
+}
+
+size_t WorkerPool::assign() {
+    size_t worker = assign_order[next_assigned];
+    next_assigned = (next_assigned + 1) % workers.size();
+    return worker;
+}
+
+bool WorkerPool::post(function<void()> work, function<void()> done) {
+    // Round robin, skipping workers that are saturated.
+    for (size_t i = 0; i < workers.size(); i++) {
+        Worker &worker = *workers[next_worker];
+        next_worker = (next_worker + 1) % workers.size();
+        if (push(worker, work, done, JOB_CONTROL, Time::max())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkerPool::post(size_t worker, function<void()> work, function<void()> done, JobClass job_class,
+                      Time deadline) {
+    return push(*workers[worker], work, done, job_class, deadline);
+}
+
+bool WorkerPool::push(Worker &worker, function<void()> &work, function<void()> &done, JobClass job_class,
+                      Time deadline) {
+    if (worker.outstanding == queue_capacity) {
+        return false;
+    }
+    
+    worker.outstanding++;
+    worker.requests.push({std::move(work), std::move(done), job_class, deadline, 0});
+    
+    // The EventCount orders the push before the worker's last check of
+    // the ring, so the wakeup cannot be lost. A spinning worker sees it.
+    if (options.idle == IDLE_PARK) {
+        worker.events.Notify(true);
+    }
+    return true;
+}
+
+// Whether `a` is to run after `b`: with deadline_order control jobs
+// first, then the earlier deadline, otherwise and on ties in the order
+// they arrived.
+bool WorkerPool::runsAfter(const Job &a, const Job &b) const {
+    if (options.deadline_order) {
+        if (a.job_class != b.job_class) {
+            return a.job_class > b.job_class;
+        }
+        if (a.deadline != b.deadline) {
+            return a.deadline > b.deadline;
+        }
+    }
+    return a.sequence > b.sequence;
+}
+
+void WorkerPool::run(size_t index) {
+    Worker &worker = *workers[index];
+    int cpu = options.worker_cpus.empty() ? -1 : options.worker_cpus[index];
+    if (cpu < 0 && worker.node >= 0) {
+        if (!placeThreadOnNode(worker.node, options.fifo_priority)) {
+            MPC_LOG(LOG_WARN, "Cannot place worker %zu on NUMA node %d at FIFO priority %d", index, worker.node,
+                    options.fifo_priority);
+        }
+    } else if (!placeThread(cpu, options.fifo_priority)) {
+        MPC_LOG(LOG_WARN, "Cannot place worker %zu on CPU %d at FIFO priority %d", index, cpu,
+                options.fifo_priority);
+    }
+    
+    // The ring holds at most queue_capacity jobs, so the heap never grows.
+    worker.ready.reserve(queue_capacity);
+    auto later = [this](const Job &a, const Job &b) { return runsAfter(a, b); };
+    for (;;) {
+        Job job;
+        while (worker.requests.pop(job)) {
+            job.sequence = worker.arrivals++;
+            worker.ready.push_back(std::move(job));
+            push_heap(worker.ready.begin(), worker.ready.end(), later);
+        }
+        if (worker.ready.empty()) {
+            if (stopping) {
+                return;
+            }
+            if (options.idle == IDLE_BUSY) {
+                cpuRelax();
+                continue;
+            }
+            worker.events.Prewait(&worker.waiters[0]);
+            if (stopping || !worker.requests.empty()) {
+                worker.events.CancelWait(&worker.waiters[0]);
+                continue;
+            }
+            worker.events.CommitWait(&worker.waiters[0]);
+            continue;
+        }
+        pop_heap(worker.ready.begin(), worker.ready.end(), later);
+        job = std::move(worker.ready.back());
+        worker.ready.pop_back();
+        
+        job.work();
+        if (job.job_class == JOB_CONTROL && job.deadline != Time::max() &&
+            chrono::steady_clock::now() > job.deadline) {
+            Metrics::recordDeadlineMiss();
+        }
+        
+        worker.completed.push(std::move(job.done));
+        // Several sends may be coalesced into one callback. A busy loop
+        // polls the ring instead.
+        if (options.idle == IDLE_PARK) {
+            uv_async_send(async);
+        }
+    }
+}
+
+void WorkerPool::poll() {
+    for (auto &worker : workers) {
+        function<void()> done;
+        while (worker->completed.pop(done)) {
+            worker->outstanding--;
+            done();
+        }
+    }
+}
+
+void WorkerPool::onAsync(uv_async_t *async) {
+    ((WorkerPool *) async->data)->poll();
+}
+
+void WorkerPool::onIdle(uv_idle_t *idle) {
+    ((WorkerPool *) idle->data)->poll();
+}
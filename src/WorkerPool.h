@@ -0,0 +1,186 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <uv.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "Eigen-3.3/unsupported/Eigen/CXX11/ThreadPool"
+#include "SpscRing.h"
+
+using namespace std;
+
+// How the threads of the server wait for work. IDLE_PARK puts an idle
+// worker to sleep on an EventCount and leaves the loop thread in epoll,
+// woken by the workers through a uv_async_t: no CPU is spent while idle,
+// at the cost of a wakeup per frame and per reply. IDLE_BUSY never
+// sleeps: the workers spin on their rings, and an active uv_idle_t keeps
+// libuv polling the sockets without a timeout and checks the completion
+// rings on every turn of the loop. Each thread then keeps a core to
+// itself.
+enum IdleMode { IDLE_PARK, IDLE_BUSY };
+
+// Placement of the threads of the server.
+struct SchedulerOptions {
+    // CPU of each worker, one worker per entry. Empty leaves the workers
+    // unpinned.
+    vector<int> worker_cpus;
+    // CPU of the loop thread, -1 leaves it unpinned.
+    int io_cpu = -1;
+    // Place the workers by NUMA node: without worker_cpus, worker i runs
+    // on the CPUs of node i % numaNodes(), and the clients are assigned to
+    // the nodes in turn, so their state is allocated on the node they run
+    // on, see WorkerPool::nodeOf.
+    bool numa = false;
+    // SCHED_FIFO priority of every thread; 0 keeps the default policy.
+    int fifo_priority = 0;
+    // Run the jobs waiting on a worker earliest deadline first, control
+    // jobs before background ones, see WorkerPool::post; false runs them in
+    // the order posted.
+    bool deadline_order = true;
+    IdleMode idle = IDLE_PARK;
+};
+
+// What a job of the pool is for. Control jobs answer a frame by a
+// deadline; background ones, such as speculative solves, only fill the
+// time until the next frame.
+enum JobClass { JOB_CONTROL, JOB_BACKGROUND };
+
+// Pin the calling thread to `cpu` unless it is negative, and move it to
+// SCHED_FIFO at `fifo_priority` unless that is 0. Returns false if the
+// system refused either, e.g. without CAP_SYS_NICE, or does not support it.
+bool placeThread(int cpu, int fifo_priority);
+
+// NUMA nodes of the machine, as listed in /sys/devices/system/node; 1
+// where there is no such list.
+int numaNodes();
+
+// CPUs of NUMA node `node` into `cpus`; false if it has none.
+bool numaCpus(int node, vector<int> &cpus);
+
+// NUMA node of `cpu`, 0 if unknown.
+int numaNodeOf(int cpu);
+
+// Pin the calling thread to the CPUs of NUMA node `node`, as placeThread.
+// What it allocates and touches first then lands on that node under the
+// kernel's default policy.
+bool placeThreadOnNode(int node, int fifo_priority);
+
+// Tell the core the calling thread is spinning, see IDLE_BUSY.
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Runs jobs on a fixed set of solver threads and hands their completions
+// back to the thread running the uv loop, where it is safe to touch sockets
+// again.
+//
+// Every worker is connected to the loop thread by a pair of lock-free
+// single-producer/single-consumer rings, one for requests and one for
+// completions. post() and the completion callbacks must only be called on
+// the loop thread. How both sides wait on their rings is
+// SchedulerOptions::idle.
+//
+// A client that always posts to the same worker, see assign(), keeps its
+// state on that thread: a connection's controller, with its tape, IPOPT
+// application and scratch, then stays in the caches of one core.
+//
+// Each worker takes everything posted to it off its ring before it picks
+// the next job, so of the clients sharing a worker the one closest to its
+// deadline goes first rather than the one that posted first. A job is not
+// preempted once started. Control jobs completing after their deadline
+// are counted, see Metrics::recordDeadlineMiss.
+class WorkerPool {
+public:
+    typedef chrono::steady_clock::time_point Time;
+    
+    // Jobs that may be in flight per worker.
+    static const size_t queue_capacity = 64;
+    
+    // `n_threads` workers, or one per CPU of options.worker_cpus if set.
+    // The workers place themselves as configured when they start; the loop
+    // thread is left to the caller, see placeThread.
+    WorkerPool(uv_loop_t *loop, size_t n_threads, const SchedulerOptions &options = SchedulerOptions());
+    
+    ~WorkerPool();
+    
+    size_t size() const { return workers.size(); }
+    
+    // Worker for a new client, round robin, over the NUMA nodes in turn
+    // with SchedulerOptions::numa.
+    size_t assign();
+    
+    // NUMA node `worker` runs on with SchedulerOptions::numa, -1 without.
+    int nodeOf(size_t worker) const { return workers[worker]->node; }
+    
+    // Run `work` on one of the workers, then `done` on the loop thread.
+    // Returns false, dropping the job, if every worker is saturated.
+    bool post(function<void()> work, function<void()> done);
+    
+    // The same on the given worker only, false if it is saturated, as a
+    // job of class `job_class` due by `deadline`.
+    bool post(size_t worker, function<void()> work, function<void()> done, JobClass job_class = JOB_CONTROL,
+              Time deadline = Time::max());
+    
+private:
+    struct Job {
+        function<void()> work;
+        function<void()> done;
+        JobClass job_class;
+        Time deadline;
+        // Order of arrival on the worker, which breaks ties.
+        uint64_t sequence;
+    };
+    
+    struct Worker {
+        SpscRing<Job, queue_capacity> requests;
+        SpscRing<function<void()>, queue_capacity> completed;
+        
+        // Parks the worker while its ring is empty, with IDLE_PARK. The
+        // loop thread only pays for a notify when the worker sleeps.
+        Eigen::MaxSizeVector<Eigen::EventCount::Waiter> waiters;
+        Eigen::EventCount events;
+        
+        Worker() : waiters(1), events(waiters) { waiters.resize(1); }
+        
+        // Jobs posted but not completed yet, owned by the loop thread. It
+        // keeps both rings from ever overflowing.
+        size_t outstanding = 0;
+        
+        // Jobs taken off the ring and not started yet, a heap of the next
+        // one first, owned by the worker.
+        vector<Job> ready;
+        uint64_t arrivals = 0;
+        
+        thread runner;
+        int node = -1;
+    };
+    
+    vector<unique_ptr<Worker> > workers;
+    // The workers in the order assign() deals them out.
+    vector<size_t> assign_order;
+    size_t next_worker;
+    size_t next_assigned;
+    SchedulerOptions options;
+    atomic<bool> stopping;
+    uv_async_t *async;
+    // Polls the completions on every turn of the loop with IDLE_BUSY.
+    uv_idle_t *idle;
+    
+    bool push(Worker &worker, function<void()> &work, function<void()> &done, JobClass job_class,
+              Time deadline);
+    bool runsAfter(const Job &a, const Job &b) const;
+    void run(size_t index);
+    // Run the callbacks of the jobs completed so far, on the loop thread.
+    void poll();
+    static void onAsync(uv_async_t *async);
+    static void onIdle(uv_idle_t *idle);
+};
+
+#endif /* WORKER_POOL_H */
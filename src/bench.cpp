@@ -0,0 +1,1272 @@
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include "bench/BenchTimer.h"
+#include "BatchRiccati.h"
+#include "BenchReport.h"
+#include "Controller.h"
+#include "EmbeddedMpc.h"
+#include "FastMath.h"
+#include "GeometricControl.h"
+#include "KinematicNLP.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "MpcConfig.h"
+#include "PathSpline.h"
+#include "RtiStage.h"
+#include "SlowSolveLog.h"
+#include "SteerMessage.h"
+#include "TelemetryCapture.h"
+#include "TelemetryParser.h"
+#include "TapedNLP.h"
+#include "Track.h"
+#include "json.hpp"
+
+// Offline benchmark of Controller::step, i.e. the coordinate transform, the
+// polynomial fit and MPC::Solve, over recorded telemetry.
+//
+//     mpc_bench [-r repeat] corpus [N ...]
+//
+// The corpus is either a capture recorded with MPC_CAPTURE, see
+// TelemetryCapture.h, or one simulator message per line, as printed by the
+// trace log (MPC_LOG_LEVEL=trace), anything before the "42[" of a line
+// being skipped. The frames are replayed in order, with warm starting,
+// once per horizon N (all compiled horizons by default). The IPOPT
+// backends that trace their iterations also get the time of the setup
+// before the first iteration and of each iteration after it.
+//
+//     mpc_bench -k [-r repeat] [N ...]
+//
+// instead times the derivative kernels IPOPT calls, the objective
+// gradient, constraint Jacobian and Lagrangian Hessian, of the taped
+// FG_eval, inline and with checkpointed stages, against the hand-derived
+// kinematic problem at the same point, serially and on three threads. It also prints the size of each
+// tape, see TapeStats, and of the tape for a quintic reference, and times
+// the stage Jacobians of vehicleJacobians against those of the dual
+// numbers of vehicleDualStep, with how far apart they are.
+//
+//     mpc_bench -H [-r repeat] corpus [N ...]
+//
+// replays the corpus twice per horizon, with IPOPT on the exact Hessian and
+// on its limited-memory approximation, and compares the two runs: step
+// time, iterations, the mean objective reached, and how far the
+// actuations of the second run are from those of the first.
+//
+//     mpc_bench -F [-r repeat] corpus [N ...]
+//
+// compares the multiple-shooting and the single-shooting formulation of
+// the CppAD backends the same way.
+//
+//     mpc_bench -P [-r repeat] corpus [N ...]
+//
+// compares double and single precision the same way, for the backends
+// that have both, MPC_SOLVER=rti and mppi.
+//
+//     mpc_bench -G [-r repeat] corpus [N ...]
+//
+// compares the backend of MPC_SOLVER with the geometric baseline,
+// MPC_SOLVER=geometric, the same way, with pure pursuit and then Stanley,
+// after timing a call of geometricControl of each law on its own.
+//
+//     mpc_bench -m [-r repeat]
+//
+// checks the fits of FastMath.h against libm: the largest error of each
+// function and of its slope over a fine grid, sin and cos over [-pi, pi]
+// and atan over [-50, 50], and the time per call of both.
+//
+//     mpc_bench -v [-r repeat]
+//
+// times the fixed-size kernels of the stage form, as built on the target:
+// the transform of the waypoints into the vehicle frame, polyfitFixed, the
+// stage Jacobians of a horizon, the box-constrained Riccati solve of its
+// QP on its own and batch_lanes at a time, and a whole EmbeddedMpc::step.
+// For every degree up to max_poly_degree it also times polyfitDegree and
+// a stage on runtime-size coefficients, as they are and dispatched by
+// vehicleStepDegree.
+// It first prints the architecture and the SIMD instruction sets Eigen
+// was compiled for, NEON on aarch64, and fails when doubles have no
+// packets, so a build that does not vectorize shows as such.
+//
+//     mpc_bench -D [-r repeat] slow_solves
+//
+// solves the problems of a log written with MPC_SLOW_SOLVES again, see
+// SlowSolveLog.h, each dump on an MPC of its own configured as recorded:
+// the problems before the slow one for the solver state, then the slow
+// one `repeat` times, each from the warm start it had, and prints how it
+// went then and now, with the iterations of both for the backends that
+// trace them, see MPC::setIterationTrace.
+//
+//     mpc_bench -p [-r repeat]
+//
+// times the stages of the pipeline around the solver, each on its own on
+// a telemetry event of the simulator: parseMessage, and for comparison
+// hasData and json::parse as the server parsed before it, the transform
+// of the waypoints by convertToCoordinates, polyfitFixed, polyeval,
+// writeSteer and json::dump of the same reply, and then a whole
+// Controller::step for what the solve adds. Each is timed warm, called
+// over and over on the same data, and cold, after the caches have been
+// flooded, in ns and allocations per call.
+//
+// With -o results.json after the mode and -r, the step times of the runs,
+// the times of the stages of -p and those of the kernels of -v are also
+// written there with the environment, see BenchReport, for mpc_benchdiff
+// to compare against the results of another build.
+
+// Calls of operator new, for the allocations per call of -p.
+static atomic<uint64_t> allocations(0);
+
+// What -o writes, null without it.
+static BenchReport *report = nullptr;
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+static bool loadCorpus(const char *path, vector<Telemetry> &frames) {
+    CaptureReader capture;
+    if (capture.open(path)) {
+        capture.readAll(frames);
+        return true;
+    }
+
+    ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    string line;
+    Telemetry telemetry;
+    while (getline(in, line)) {
+        size_t begin = line.find("42[");
+        if (begin == string::npos) {
+            continue;
+        }
+        if (parseMessage(line.data() + begin, line.size() - begin, telemetry) == MSG_TELEMETRY) {
+            frames.push_back(telemetry);
+        }
+    }
+    return true;
+}
+
+// Settings applied to the controller of a run over those from the
+// environment.
+typedef function<void(Controller &)> Setup;
+
+// Steps of a replay in one bin of the track, see Metrics::trackBinOf.
+struct TrackSteps {
+    vector<double> latencies;
+    size_t iterations = 0;
+    int max_iterations = 0;
+    size_t fallbacks = 0;
+    size_t failures = 0;
+};
+
+// Bins of the track printed after a replay, those of the slowest p99.
+static const size_t printed_track_bins = 5;
+
+// The steps of a replay of horizon N by where on `map` they were: a
+// result per bin into the report, and the bins of the slowest p99 printed
+// under the line of the replay.
+static void reportTrack(size_t N, const Track &map, const vector<TrackSteps> &bins, const char *label,
+                        const char *backend) {
+    double width = Metrics::trackBinLength(map.length());
+    vector<pair<double, size_t> > slowest;
+    for (size_t i = 0; i < bins.size(); i++) {
+        const TrackSteps &bin = bins[i];
+        if (bin.latencies.empty()) {
+            continue;
+        }
+        vector<double> sorted = bin.latencies;
+        sort(sorted.begin(), sorted.end());
+        slowest.emplace_back(benchPercentile(sorted, 0.99), i);
+        if (report) {
+            BenchResult result;
+            result.name = "track";
+            result.label = (label ? string(label) + " " : string()) + "s=" + to_string((long) (i * width));
+            result.backend = backend;
+            result.N = N;
+            result.unit = "ms";
+            for (double latency : bin.latencies) {
+                result.samples.push_back(latency * 1e3);
+            }
+            result.iterations_mean = (double) bin.iterations / bin.latencies.size();
+            result.iterations_max = bin.max_iterations;
+            result.failures = bin.failures;
+            report->add(result);
+        }
+    }
+    sort(slowest.rbegin(), slowest.rend());
+    for (size_t k = 0; k < slowest.size() && k < printed_track_bins; k++) {
+        const TrackSteps &bin = bins[slowest[k].second];
+        if (label) {
+            printf("%-15s ", "");
+        }
+        printf("      s %6.0f-%-6.0f m %5zu steps  p99 %7.3f ms  iterations mean %5.1f max %3d  "
+               "fallbacks %zu  failed %zu\n",
+               slowest[k].second * width, (slowest[k].second + 1) * width, bin.latencies.size(),
+               slowest[k].first * 1e3, (double) bin.iterations / bin.latencies.size(), bin.max_iterations,
+               bin.fallbacks, bin.failures);
+    }
+}
+
+// Replay `frames` through a controller with horizon N. With `setup` the
+// controller is adjusted first and the line printed is tagged with
+// `label`. The steering and throttle of every step are appended to
+// `actuations` if given, and the mean objective returned. For the IPOPT
+// backends that trace their iterations, see MPC::setIterationTrace, a
+// second line splits the solve time into the setup before the first
+// iteration and the iterations after it. With a map, the steps are also
+// binned by where on it the car was, see reportTrack.
+static double run(size_t N, const vector<Telemetry> &frames, int repeat, const Track *map,
+                  const PathSpline *spline, const Setup &setup = nullptr,
+                  const char *label = nullptr, vector<double> *actuations = nullptr) {
+    Controller controller;
+    controller.setMap(map);
+    controller.setReference(spline);
+    if (!controller.setHorizon(N)) {
+        fprintf(stderr, "N = %zu is not compiled in\n", N);
+        return 0.0;
+    }
+    if (setup) {
+        setup(controller);
+    }
+    // Only IPOPT's own time limit, the frames are not arriving in real time.
+    controller.setDeadlineBudget(chrono::microseconds(0));
+
+    vector<double> latencies;
+    latencies.reserve(frames.size() * repeat);
+    size_t iterations = 0;
+    int max_iterations = 0;
+    size_t failures = 0;
+    double objective = 0;
+    IterationTrace trace;
+    controller.setIterationTrace(&trace);
+    vector<double> setups, steps;
+    size_t restorations = 0;
+    string reply;
+    Eigen::BenchTimer total;
+    Eigen::BenchTimer timer;
+    vector<TrackSteps> track_steps;
+    if (map) {
+        track_steps.resize(Metrics::max_track_bins);
+    }
+
+    total.start();
+    for (int r = 0; r < repeat; r++) {
+        controller.reset();
+        for (const Telemetry &telemetry : frames) {
+            timer.start();
+            controller.step(telemetry, reply);
+            timer.stop();
+            latencies.push_back(timer.value(Eigen::REAL_TIMER));
+
+            const SolveStats &stats = controller.lastStats();
+            iterations += max(0, stats.iterations);
+            max_iterations = max(max_iterations, stats.iterations);
+            failures += !stats.ok();
+            objective += stats.objective;
+            if (map) {
+                TrackSteps &bin = track_steps[Metrics::trackBinOf(map->locate(telemetry.x, telemetry.y).s,
+                                                                  map->length())];
+                bin.latencies.push_back(timer.value(Eigen::REAL_TIMER));
+                bin.iterations += max(0, stats.iterations);
+                bin.max_iterations = max(bin.max_iterations, stats.iterations);
+                bin.fallbacks += stats.fallback;
+                bin.failures += !stats.ok();
+            }
+            for (size_t i = 0; i < trace.size(); i++) {
+                if (i == 0 && trace.n_iterations == trace.size()) {
+                    setups.push_back(trace[0].elapsed);
+                } else if (i > 0) {
+                    steps.push_back(trace[i].elapsed - trace[i - 1].elapsed);
+                }
+                restorations += trace[i].restoration;
+            }
+            if (actuations) {
+                actuations->push_back(controller.lastSteering());
+                actuations->push_back(controller.lastThrottle());
+            }
+        }
+    }
+    total.stop();
+
+    sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    if (label) {
+        printf("%-15s ", label);
+    }
+    printf("N=%-3zu %6zu steps %8.1f steps/s  p50 %7.3f  p90 %7.3f  p99 %7.3f  max %7.3f ms  "
+           "iterations mean %5.1f max %3d  failed %zu\n",
+           N, n, n / total.value(Eigen::REAL_TIMER),
+           benchPercentile(latencies, 0.5) * 1e3, benchPercentile(latencies, 0.9) * 1e3,
+           benchPercentile(latencies, 0.99) * 1e3, latencies.back() * 1e3,
+           (double) iterations / n, max_iterations, failures);
+    if (!setups.empty()) {
+        sort(setups.begin(), setups.end());
+        sort(steps.begin(), steps.end());
+        if (label) {
+            printf("%-15s ", "");
+        }
+        printf("      setup p50 %7.3f  p99 %7.3f ms  iteration p50 %7.3f  p99 %7.3f ms  restoration %zu of %zu\n",
+               benchPercentile(setups, 0.5) * 1e3, benchPercentile(setups, 0.99) * 1e3, benchPercentile(steps, 0.5) * 1e3,
+               benchPercentile(steps, 0.99) * 1e3, restorations, steps.size() + setups.size());
+    }
+    if (map) {
+        reportTrack(N, *map, track_steps, label, backendName(controller.getBackend()));
+    }
+    if (report) {
+        BenchResult result;
+        result.name = "replay";
+        result.label = label ? label : "";
+        result.backend = backendName(controller.getBackend());
+        result.N = N;
+        result.unit = "ms";
+        for (double latency : latencies) {
+            result.samples.push_back(latency * 1e3);
+        }
+        result.throughput = n / total.value(Eigen::REAL_TIMER);
+        result.iterations_mean = (double) iterations / n;
+        result.iterations_max = max_iterations;
+        result.failures = failures;
+        report->add(result);
+    }
+    return objective / n;
+}
+
+// Run horizon N with the settings `first` and then `second`, and print
+// how the second compares to the first.
+static void compare(size_t N, const vector<Telemetry> &frames, int repeat, const Track *map,
+                    const PathSpline *spline, const char *first_label, const Setup &first,
+                    const char *second_label, const Setup &second) {
+    vector<double> first_actuations;
+    vector<double> second_actuations;
+    double first_objective = run(N, frames, repeat, map, spline, first, first_label, &first_actuations);
+    double second_objective = run(N, frames, repeat, map, spline, second, second_label, &second_actuations);
+    if (first_actuations.empty() || first_actuations.size() != second_actuations.size()) {
+        return;
+    }
+    
+    // RMS and largest difference of the steering and of the throttle.
+    double sum[2] = {0, 0};
+    double largest[2] = {0, 0};
+    for (size_t i = 0; i < first_actuations.size(); i++) {
+        double d = fabs(second_actuations[i] - first_actuations[i]);
+        sum[i % 2] += d * d;
+        largest[i % 2] = max(largest[i % 2], d);
+    }
+    size_t n = first_actuations.size() / 2;
+    printf("%-15s N=%-3zu objective mean %.4g vs %.4g  steering rms %.4f max %.4f  "
+           "throttle rms %.4f max %.4f\n",
+           "difference", N, second_objective, first_objective, sqrt(sum[0] / n), largest[0],
+           sqrt(sum[1] / n), largest[1]);
+}
+
+// The exact against the limited-memory Hessian.
+static void compareHessians(size_t N, const vector<Telemetry> &frames, int repeat, const Track *map,
+                            const PathSpline *spline) {
+    MpcOptions exact;
+    MpcOptions lbfgs;
+    lbfgs.exact_hessian = false;
+    compare(N, frames, repeat, map, spline,
+            "exact", [&](Controller &controller) { controller.setOptions(exact); },
+            "limited-memory", [&](Controller &controller) { controller.setOptions(lbfgs); });
+}
+
+// Multiple against single shooting.
+static void compareFormulations(size_t N, const vector<Telemetry> &frames, int repeat, const Track *map,
+                                const PathSpline *spline) {
+    compare(N, frames, repeat, map, spline,
+            "multiple", [](Controller &controller) { controller.setFormulation(MULTIPLE_SHOOTING); },
+            "single", [](Controller &controller) { controller.setFormulation(SINGLE_SHOOTING); });
+}
+
+// Double against single precision.
+static void comparePrecisions(size_t N, const vector<Telemetry> &frames, int repeat, const Track *map,
+                              const PathSpline *spline) {
+    MpcOptions single;
+    single.single_precision = true;
+    compare(N, frames, repeat, map, spline,
+            "double", [](Controller &controller) { controller.setOptions(MpcOptions()); },
+            "single", [&](Controller &controller) { controller.setOptions(single); });
+}
+
+// The backend of the environment against the geometric baseline with
+// `law`.
+static void compareGeometric(size_t N, const vector<Telemetry> &frames, int repeat, const Track *map,
+                             const PathSpline *spline, GeometricLaw law) {
+    MpcOptions options;
+    options.geometric_law = law;
+    compare(N, frames, repeat, map, spline,
+            "optimizer", nullptr,
+            law == GEOMETRIC_STANLEY ? "stanley" : "pursuit", [&](Controller &controller) {
+                controller.setOptions(options);
+                controller.setBackend(GEOMETRIC);
+            });
+}
+
+// Microseconds per call of the gradient, Jacobian and Hessian of `nlp` at
+// `x`, over `reps` calls each. Every call is at a new point as far as the
+// problem knows, so the taped one sweeps forward each time as well.
+static void timeKernels(const char *name, size_t N, Ipopt::TNLP &nlp, vector<double> &x, int reps) {
+    Ipopt::Index n, m, nnz_jac, nnz_hes;
+    Ipopt::TNLP::IndexStyleEnum style;
+    nlp.get_nlp_info(n, m, nnz_jac, nnz_hes, style);
+    vector<double> grad(n), jac(nnz_jac), hes(nnz_hes), lambda(m, 1.0);
+    Eigen::BenchTimer timer[3];
+    
+    timer[0].start();
+    for (int r = 0; r < reps; r++) {
+        nlp.eval_grad_f(n, x.data(), true, grad.data());
+    }
+    timer[0].stop();
+    timer[1].start();
+    for (int r = 0; r < reps; r++) {
+        nlp.eval_jac_g(n, x.data(), true, m, nnz_jac, nullptr, nullptr, jac.data());
+    }
+    timer[1].stop();
+    timer[2].start();
+    for (int r = 0; r < reps; r++) {
+        nlp.eval_h(n, x.data(), true, 1.0, m, lambda.data(), true, nnz_hes, nullptr, nullptr, hes.data());
+    }
+    timer[2].stop();
+    
+    printf("N=%-3zu %-9s gradient %8.3f  jacobian %8.3f  hessian %8.3f us  (%d + %d nonzeros)\n",
+           N, name, timer[0].value(Eigen::REAL_TIMER) * 1e6 / reps,
+           timer[1].value(Eigen::REAL_TIMER) * 1e6 / reps, timer[2].value(Eigen::REAL_TIMER) * 1e6 / reps,
+           nnz_jac, nnz_hes);
+}
+
+static void printTape(const char *name, const TapeStats &tape) {
+    printf("N=%-3zu %-9s tape %zu operations  %zu variables  %zu parameters  %.1f KiB  (%zu + %zu nonzeros, "
+           "%zu + %zu colors, %zu linear constraints)\n",
+           tape.horizon, name, tape.operations, tape.variables, tape.parameters, tape.bytes / 1024.0,
+           tape.jacobian_nnz, tape.hessian_nnz, tape.jacobian_colors, tape.hessian_colors, tape.linear_constraints);
+}
+
+// Where the sums of the timed loops below go, so they are not optimized
+// away.
+static volatile double bench_sink;
+
+static void timeStageJacobians(int reps) {
+    Eigen::VectorXd coeffs(4);
+    coeffs << 0.5, 0.05, 0.002, 1e-5;
+    double s[6] = {1.0, 0.2, 0.1, 12, 0.3, -0.05};
+    double next[6];
+    Eigen::Matrix<double, 6, 6> A, dual_A;
+    Eigen::Matrix<double, 6, 2> B, dual_B;
+    vehicleJacobians(s, 0.1, coeffs, 0.1, &A, &B);
+    vehicleDualStep(s, 0.1, 0.3, coeffs, 0.1, next, &dual_A, &dual_B);
+    double difference = max((A - dual_A).cwiseAbs().maxCoeff(), (B - dual_B).cwiseAbs().maxCoeff());
+    
+    Eigen::BenchTimer timer[2];
+    double sink = 0;
+    timer[0].start();
+    for (int r = 0; r < reps; r++) {
+        s[2] = r * 1e-7;
+        vehicleStep(s, 0.1, 0.3, coeffs, 0.1, next);
+        vehicleJacobians(s, 0.1, coeffs, 0.1, &A, &B);
+        sink += next[0] + A(0, 2);
+    }
+    timer[0].stop();
+    timer[1].start();
+    for (int r = 0; r < reps; r++) {
+        s[2] = r * 1e-7;
+        vehicleDualStep(s, 0.1, 0.3, coeffs, 0.1, next, &dual_A, &dual_B);
+        sink += next[0] + dual_A(0, 2);
+    }
+    timer[1].stop();
+    bench_sink = sink;
+    printf("stage step and jacobians: hand-derived %.1f  dual %.1f ns  (largest difference %.2e)\n",
+           timer[0].value(Eigen::REAL_TIMER) * 1e9 / reps, timer[1].value(Eigen::REAL_TIMER) * 1e9 / reps,
+           difference);
+}
+
+template <typename Config>
+static void benchKernels(int reps) {
+    // A car at 10 m/s along a gentle left curve, steering slightly into it.
+    Dvector xi(Config::n_vars);
+    for (size_t i = 0; i < Config::n_vars; i++) {
+        xi[i] = 0;
+    }
+    for (size_t t = 0; t < Config::N; t++) {
+        xi[Config::x_start + t] = 10 * t * Config::dt;
+        xi[Config::v_start + t] = 10;
+        if (t < Config::n_controls) {
+            xi[Config::delta_start + t] = 0.01;
+            xi[Config::a_start + t] = 0.1;
+        }
+    }
+    Dvector xl(Config::n_vars), xu(Config::n_vars), gl(Config::n_constraints), gu(Config::n_constraints);
+    for (size_t i = 0; i < Config::n_vars; i++) {
+        xl[i] = -1.0e19;
+        xu[i] = 1.0e19;
+    }
+    for (size_t i = 0; i < Config::n_constraints; i++) {
+        gl[i] = gu[i] = 0;
+    }
+    Eigen::VectorXd coeffs(4);
+    coeffs << 0.5, 0.05, 0.002, 1e-5;
+    vector<double> x(xi.data(), xi.data() + Config::n_vars);
+    SolveResult solution;
+    
+    Ipopt::SmartPtr<TapedNLP> taped = new TapedNLP();
+    taped->record<Config>(coeffs.size(), CostWeights(), CARTESIAN_MODEL);
+    taped->setProblem(xi, xl, xu, gl, gu, coeffs, solution);
+    timeKernels("taped", Config::N, *taped, x, reps);
+    printTape("taped", taped->tapeStats());
+    
+    taped->setCheckpointStages(true);
+    taped->record<Config>(coeffs.size(), CostWeights(), CARTESIAN_MODEL);
+    taped->setProblem(xi, xl, xu, gl, gu, coeffs, solution);
+    timeKernels("checkpoint", Config::N, *taped, x, reps);
+    printTape("checkpoint", taped->tapeStats());
+    
+    // A quintic reference, for how the tape grows with the order.
+    taped->setCheckpointStages(false);
+    taped->record<Config>(6, CostWeights(), CARTESIAN_MODEL);
+    printTape("quintic", taped->tapeStats());
+    
+    Ipopt::SmartPtr<KinematicNLP<Config> > kinematic = new KinematicNLP<Config>();
+    kinematic->setProblem(xi, xl, xu, gl, gu, coeffs, solution, false);
+    timeKernels("kinematic", Config::N, *kinematic, x, reps);
+    kinematic->setEvalThreads(2);
+    timeKernels("kin/3thr", Config::N, *kinematic, x, reps);
+}
+
+// Largest error of `fast` against `exact` over n + 1 points of [lo, hi],
+// and the time per call of each over those points, `reps` times, in ns.
+static void checkMath(const char *name, double (*fast)(const double &), double (*exact)(double), double lo,
+                      double hi, int n, int reps) {
+    vector<double> xs(n + 1);
+    double error = 0;
+    for (int i = 0; i <= n; i++) {
+        xs[i] = lo + (hi - lo) * i / n;
+        error = max(error, fabs(fast(xs[i]) - exact(xs[i])));
+    }
+    Eigen::BenchTimer timer[2];
+    double sink = 0;
+    timer[0].start();
+    for (int r = 0; r < reps; r++) {
+        for (double x : xs) {
+            sink += fast(x);
+        }
+    }
+    timer[0].stop();
+    timer[1].start();
+    for (int r = 0; r < reps; r++) {
+        for (double x : xs) {
+            sink += exact(x);
+        }
+    }
+    timer[1].stop();
+    bench_sink = sink;
+    double calls = (double) reps * xs.size();
+    printf("%-6s max error %9.2e  fast %6.2f  libm %6.2f ns\n", name, error,
+           timer[0].value(Eigen::REAL_TIMER) * 1e9 / calls, timer[1].value(Eigen::REAL_TIMER) * 1e9 / calls);
+}
+
+static double libmSin(double x) { return sin(x); }
+static double libmCos(double x) { return cos(x); }
+static double libmAtan(double x) { return atan(x); }
+static double libmSinSlope(double x) { return cos(x); }
+static double libmCosSlope(double x) { return -sin(x); }
+static double libmAtanSlope(double x) { return 1 / (1 + x * x); }
+
+// Nanoseconds per call of geometricControl with `law`, over states spread
+// about a curved reference.
+static void timeGeometric(const char *name, GeometricLaw law, int reps) {
+    GeometricParams params;
+    params.law = law;
+    Eigen::Vector4d coeffs(0.5, -0.05, 0.004, -2e-5);
+    const int n_states = 64;
+    double states[n_states][6];
+    for (int i = 0; i < n_states; i++) {
+        double f = (double) i / n_states;
+        double s[6] = {0.1 * f, 0.02 * f, 0.1 * (f - 0.5), 5 + 20 * f, 0.5 - f, 0.05 - 0.1 * f};
+        copy(s, s + 6, states[i]);
+    }
+    Eigen::BenchTimer timer;
+    double sum = 0;
+    timer.start();
+    for (int r = 0; r < reps; r++) {
+        double delta, a;
+        geometricControl(params, coeffs, states[r % n_states], delta, a);
+        sum += delta + a;
+    }
+    timer.stop();
+    bench_sink = sum;
+    printf("%-8s %8.1f ns/call\n", name, timer.value(Eigen::REAL_TIMER) / reps * 1e9);
+}
+
+// Bytes and nanoseconds of a steer reply with a prediction of
+// `n_predicted` stages and 6 waypoints at `points` decimals, and the
+// largest rounding error of appendNumber against the value.
+static void timeSteer(int points, size_t n_predicted, int reps) {
+    vector<double> mpc_x, mpc_y, next_x, next_y;
+    for (size_t i = 0; i < n_predicted; i++) {
+        mpc_x.push_back(1.3456789123 * (i + 1));
+        mpc_y.push_back(0.0123456789 * (i + 1) * (i + 1));
+    }
+    for (int i = 0; i < 6; i++) {
+        next_x.push_back(-3.2104958372 + 14.7659296843 * i);
+        next_y.push_back(0.5298712893 - 0.0218383741 * i * i);
+    }
+    SteerPrecision precision;
+    precision.points = points;
+    string out;
+    Eigen::BenchTimer timer;
+    timer.start();
+    for (int r = 0; r < reps; r++) {
+        writeSteer(out, -0.0123456789 * (r % 7), 0.3456789123, mpc_x, mpc_y, next_x, next_y, precision);
+    }
+    timer.stop();
+    double error = 0;
+    string number;
+    for (double x : mpc_x) {
+        number.clear();
+        appendNumber(number, x, points);
+        error = max(error, fabs(atof(number.c_str()) - x));
+    }
+    printf("%d decimals %5zu bytes %8.1f ns/reply  max error %.1e\n", points, out.size(),
+           timer.value(Eigen::REAL_TIMER) / reps * 1e9, error);
+}
+
+// A telemetry event of the simulator early on the lake track, its numbers
+// as many digits as it writes.
+static const char pipeline_frame[] =
+    "42[\"telemetry\",{\"ptsx\":[-32.16173,-43.49173,-61.09,-78.29172,-93.05002,-107.7717],"
+    "\"ptsy\":[113.361,105.941,92.88499,78.73102,65.34102,50.57938],\"psi\":3.733651,"
+    "\"psi_unity\":4.12033,\"speed\":0.4380091,\"steering_angle\":0,\"throttle\":0,"
+    "\"x\":-40.62,\"y\":108.73}]";
+
+// The JSON of a SocketIO event, as the server found it before
+// parseMessage, empty for none.
+static string hasData(const string &s) {
+    auto found_null = s.find("null");
+    auto b1 = s.find_first_of("[");
+    auto b2 = s.rfind("}]");
+    if (found_null != string::npos) {
+        return "";
+    } else if (b1 != string::npos && b2 != string::npos) {
+        return s.substr(b1, b2 - b1 + 2);
+    }
+    return "";
+}
+
+// Write a byte of every cache line of a buffer larger than the last level
+// cache, so whatever a stage touches is fetched from memory again.
+static void floodCaches() {
+    static vector<char> flood(64 << 20);
+    for (size_t i = 0; i < flood.size(); i += 64) {
+        flood[i]++;
+    }
+}
+
+// Record the times per call of `name` in ns into the report of -o, if any.
+static void reportStage(const string &name, const vector<double> &samples, double allocs) {
+    if (report) {
+        BenchResult result;
+        result.name = name;
+        result.unit = "ns";
+        result.samples = samples;
+        result.allocations = allocs;
+        report->add(result);
+    }
+}
+
+// Batches the warm calls of timeStage are timed in, each a sample of the
+// report.
+static const int warm_batches = 20;
+
+// Time `op` on its own: `reps` calls in a row, and `cold_reps` calls
+// each after floodCaches, timed one by one, which adds the cost of
+// reading the clock to each of them.
+template <typename Op>
+static void timeStage(const char *name, Op op, int reps, int cold_reps) {
+    floodCaches();
+    op(0);
+    Eigen::BenchTimer timer;
+    vector<double> warm_samples, cold_samples;
+    int batches = min(reps, warm_batches);
+    uint64_t before = allocations.load(memory_order_relaxed);
+    for (int b = 0, r = 0; b < batches; b++) {
+        int end = (int) ((long) reps * (b + 1) / batches);
+        int calls = end - r;
+        timer.start();
+        for (; r < end; r++) {
+            op(r);
+        }
+        timer.stop();
+        warm_samples.push_back(timer.value(Eigen::REAL_TIMER) / calls * 1e9);
+    }
+    double warm_time = timer.total(Eigen::REAL_TIMER) / reps * 1e9;
+    double warm_allocations = (double) (allocations.load(memory_order_relaxed) - before) / reps;
+
+    timer.reset();
+    uint64_t cold_allocations = 0;
+    for (int r = 0; r < cold_reps; r++) {
+        floodCaches();
+        before = allocations.load(memory_order_relaxed);
+        timer.start();
+        op(r);
+        timer.stop();
+        cold_samples.push_back(timer.value(Eigen::REAL_TIMER) * 1e9);
+        cold_allocations += allocations.load(memory_order_relaxed) - before;
+    }
+    printf("%-12s warm %10.1f ns %6.2f allocs  cold %10.1f ns %6.2f allocs\n", name, warm_time, warm_allocations,
+           timer.total(Eigen::REAL_TIMER) / cold_reps * 1e9, (double) cold_allocations / cold_reps);
+    reportStage(string(name) + " warm", warm_samples, warm_allocations);
+    reportStage(string(name) + " cold", cold_samples, (double) cold_allocations / cold_reps);
+}
+
+// The stages of -p.
+static void benchPipeline(int reps, int cold_reps) {
+    const string msg = pipeline_frame;
+    Telemetry telemetry;
+    double sink = 0;
+    timeStage("parse", [&](int) {
+        parseMessage(msg.data(), msg.size(), telemetry);
+        sink += telemetry.x;
+    }, reps, cold_reps);
+    timeStage("hasData", [&](int) { sink += hasData(msg).size(); }, reps, cold_reps);
+    const string data = hasData(msg);
+    timeStage("json::parse", [&](int) {
+        auto j = nlohmann::json::parse(data);
+        vector<double> ptsx = j[1]["ptsx"];
+        sink += ptsx[0] + j[1]["x"].get<double>();
+    }, reps, cold_reps);
+
+    Eigen::VectorXd xvals, yvals;
+    timeStage("transform", [&](int r) {
+        convertToCoordinates(telemetry.x, telemetry.y, telemetry.psi + r * 1e-9, telemetry.ptsx, telemetry.ptsy,
+                             xvals, yvals);
+        sink += xvals[0];
+    }, reps, cold_reps);
+    CubicCoeffs coeffs;
+    timeStage("polyfit", [&](int) {
+        yvals[0] += 1e-12;
+        coeffs = polyfitFixed<3>(xvals.data(), yvals.data(), xvals.size());
+        sink += coeffs[1];
+    }, reps, cold_reps);
+    timeStage("polyeval", [&](int r) { sink += polyeval(coeffs, r * 1e-6); }, reps, cold_reps);
+
+    // The reply of a default horizon, its prediction along the fit.
+    vector<double> mpc_x, mpc_y, next_x(xvals.data(), xvals.data() + xvals.size()),
+        next_y(yvals.data(), yvals.data() + yvals.size());
+    for (size_t t = 1; t < DefaultConfig::N; t++) {
+        mpc_x.push_back(t * 0.5);
+        mpc_y.push_back(polyeval(coeffs, t * 0.5));
+    }
+    string reply;
+    timeStage("steer", [&](int r) {
+        writeSteer(reply, -0.0123456789 * (r % 7), 0.3456789123, mpc_x, mpc_y, next_x, next_y);
+        sink += reply.size();
+    }, reps, cold_reps);
+    timeStage("json::dump", [&](int r) {
+        nlohmann::json msgJson;
+        msgJson["steering_angle"] = -0.0123456789 * (r % 7);
+        msgJson["throttle"] = 0.3456789123;
+        msgJson["mpc_x"] = mpc_x;
+        msgJson["mpc_y"] = mpc_y;
+        msgJson["next_x"] = next_x;
+        msgJson["next_y"] = next_y;
+        reply = "42[\"steer\"," + msgJson.dump() + "]";
+        sink += reply.size();
+    }, reps, cold_reps);
+
+    // The whole cycle, on the backend of MPC_SOLVER, warm started from the
+    // last call.
+    Controller controller;
+    controller.setDeadlineBudget(chrono::microseconds(0));
+    timeStage("step", [&](int) {
+        controller.step(telemetry, reply);
+        sink += reply.size();
+    }, max(1, reps / 1000), cold_reps);
+    bench_sink = sink;
+}
+
+// One line on the iterations of a trace: how long the setup before the
+// first took, the median and largest iteration after it, those in the
+// restoration phase, and where the last one got.
+static void printTrace(const char *label, const vector<IterationRecord> &trace) {
+    if (trace.empty()) {
+        return;
+    }
+    vector<double> steps;
+    size_t restorations = trace[0].restoration;
+    for (size_t i = 1; i < trace.size(); i++) {
+        steps.push_back(trace[i].elapsed - trace[i - 1].elapsed);
+        restorations += trace[i].restoration;
+    }
+    sort(steps.begin(), steps.end());
+    const IterationRecord &last = trace.back();
+    printf("    %-8s %3zu iterations from %d  first at %8.3f ms  iteration p50 %7.3f max %7.3f ms  "
+           "restoration %zu  last inf_pr %.1e inf_du %.1e mu %.1e\n",
+           label, trace.size(), trace[0].iteration, trace[0].elapsed * 1e3, benchPercentile(steps, 0.5) * 1e3,
+           steps.empty() ? 0.0 : steps.back() * 1e3, restorations, last.inf_pr, last.inf_du, last.mu);
+}
+
+// Solve the dump of `problems` from `first` to `last` again, see -D.
+static void replayDump(const vector<ProblemInstance> &problems, size_t first, size_t last, int repeat) {
+    const ProblemInstance &slow = problems[last - 1];
+    MPC mpc;
+    mpc.setWarmStart(slow.warm_starting);
+    mpc.setBackend(slow.backend);
+    mpc.setModel(slow.model);
+    mpc.setFormulation(slow.formulation);
+    if (!mpc.setHorizon(slow.horizon)) {
+        printf("dump %u: N = %zu is not compiled in\n", slow.dump, slow.horizon);
+        return;
+    }
+    mpc.setCostWeights(slow.weights);
+    mpc.setOptions(slow.options);
+    IterationTrace trace;
+    mpc.setIterationTrace(&trace);
+
+    vector<double> wall_times;
+    SolveStats stats;
+    Solution solution;
+    for (size_t i = first; i < last; i++) {
+        const ProblemInstance &p = problems[i];
+        StateVector state;
+        CubicCoeffs coeffs;
+        if (p.state.size() != 6 || p.coeffs.size() != 4) {
+            printf("dump %u: not a cubic reference\n", p.dump);
+            return;
+        }
+        for (int k = 0; k < 6; k++) {
+            state[k] = p.state[k];
+        }
+        for (int k = 0; k < 4; k++) {
+            coeffs[k] = p.coeffs[k];
+        }
+        for (int r = 0; r < (p.trigger ? repeat : 1); r++) {
+            if (p.warm_starting) {
+                mpc.restoreWarmStart(p.has_warm_start ? p.warm_start : vector<double>(), p.fallbacks);
+            }
+            Deadline deadline = Deadline::max();
+            if (p.budget >= 0) {
+                deadline = chrono::steady_clock::now() +
+                           chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(p.budget));
+            }
+            mpc.Solve(state, coeffs, stats, deadline, solution);
+            if (p.trigger) {
+                wall_times.push_back(stats.wall_time);
+            }
+        }
+    }
+
+    sort(wall_times.begin(), wall_times.end());
+    printf("dump %u: %s N=%zu after %zu  recorded status %d  %3d iterations %8.3f ms  "
+           "replayed status %d  %3d iterations  p50 %8.3f max %8.3f ms  delta %+.2e a %+.2e\n",
+           slow.dump, backendName(slow.backend), slow.horizon, last - first - 1, slow.status, slow.iterations,
+           slow.wall_time * 1e3, stats.status, stats.iterations, benchPercentile(wall_times, 0.5) * 1e3,
+           wall_times.back() * 1e3, solution.delta - slow.delta, solution.a - slow.a);
+    vector<IterationRecord> replayed;
+    for (size_t i = 0; i < trace.size(); i++) {
+        replayed.push_back(trace[i]);
+    }
+    printTrace("recorded", slow.trace);
+    printTrace("replayed", replayed);
+}
+
+static int replaySlowSolves(const char *path, int repeat) {
+    vector<ProblemInstance> problems;
+    if (!SlowSolveLog::read(path, problems)) {
+        fprintf(stderr, "%s is not a log of slow solves\n", path);
+        return 1;
+    }
+    size_t first = 0;
+    for (size_t i = 0; i < problems.size(); i++) {
+        if (problems[i].dump != problems[first].dump) {
+            first = i;
+        }
+        if (problems[i].trigger) {
+            replayDump(problems, first, i + 1, repeat);
+            first = i + 1;
+        }
+    }
+    return 0;
+}
+
+static void printKernel(const char *name, const Eigen::BenchTimer &timer, int reps) {
+    printf("%-12s %10.1f ns\n", name, timer.value(Eigen::REAL_TIMER) / reps * 1e9);
+    reportStage(name, vector<double>(1, timer.value(Eigen::REAL_TIMER) / reps * 1e9), -1);
+}
+
+// The kernels of -v on DefaultConfig, for a car at 10 m/s on a gentle left
+// curve seen through 6 waypoints.
+static int benchVectorKernels(int reps) {
+    typedef DefaultConfig Config;
+    const int N = Config::N;
+    typedef BoxRiccati<8, 2, N - 1> StageQP;
+    typedef Eigen::internal::packet_traits<double> DoublePacket;
+    typedef Eigen::internal::packet_traits<float> FloatPacket;
+    printf("%s, %s, packets of %d doubles and %d floats\n", architectureName(), Eigen::SimdInstructionSetsInUse(),
+           (int) DoublePacket::size, (int) FloatPacket::size);
+
+    const int n_points = 6;
+    EmbeddedMpc<Config>::Frame frame;
+    frame.x = 10;
+    frame.y = -5;
+    frame.psi = 0.3;
+    frame.speed = 22;
+    frame.n_points = n_points;
+    for (int i = 0; i < n_points; i++) {
+        double s = 10.0 * (i - 1);
+        frame.ptsx[i] = frame.x + s * cos(frame.psi) - 0.004 * s * s * sin(frame.psi);
+        frame.ptsy[i] = frame.y + s * sin(frame.psi) + 0.004 * s * s * cos(frame.psi);
+    }
+
+    Eigen::BenchTimer timer;
+    double sink = 0;
+    double xs[n_points], ys[n_points];
+    Eigen::Map<const Eigen::Array<double, n_points, 1> > px(frame.ptsx), py(frame.ptsy);
+    Eigen::Map<Eigen::Array<double, n_points, 1> > vx(xs), vy(ys);
+    timer.start();
+    for (int r = 0; r < reps; r++) {
+        double psi = frame.psi + r * 1e-9;
+        double c = cos(psi), s = sin(psi);
+        vx = c * (px - frame.x) + s * (py - frame.y);
+        vy = -s * (px - frame.x) + c * (py - frame.y);
+        sink += xs[r % n_points];
+    }
+    timer.stop();
+    printKernel("transform", timer, reps);
+
+    PolyFit<3>::Coeffs coeffs;
+    timer.start();
+    for (int r = 0; r < reps; r++) {
+        ys[0] += 1e-12;
+        coeffs = polyfitFixed<3>(xs, ys, n_points);
+        sink += coeffs[1];
+    }
+    timer.stop();
+    printKernel("polyfit", timer, reps);
+
+    Eigen::Matrix<double, 2 * Config::n_controls, 1> u;
+    for (size_t j = 0; j < Config::n_controls; j++) {
+        u.segment<2>(2 * j) << 0.01, 0.1;
+    }
+    Eigen::Matrix<double, 6, 1> states[N];
+    Eigen::Matrix<double, 6, 6> jac_A[N];
+    Eigen::Matrix<double, 6, 2> jac_B[N];
+    states[0] << 0, 0, 0, 10, polyeval(coeffs, 0.0), -atan(coeffs[1]);
+    timer.start();
+    for (int r = 0; r < reps; r++) {
+        states[0][2] = r * 1e-9;
+        for (int t = 1; t < N; t++) {
+            int j = Config::controlIndex(t);
+            vehicleStepJacobians(states[t - 1].data(), u[2 * j], u[2 * j + 1], coeffs, Config::stageDt(t),
+                                 states[t].data(), &jac_A[t], &jac_B[t]);
+        }
+        sink += states[N - 1][0];
+    }
+    timer.stop();
+    printKernel("jacobians", timer, reps);
+
+    // The fit and the stage Jacobians of every degree, on the coefficients
+    // in a runtime-size vector as the backends get them and dispatched to
+    // the instantiation of the degree.
+    for (int degree = 1; degree <= max_poly_degree; degree++) {
+        Eigen::VectorXd fitted;
+        timer.start();
+        for (int r = 0; r < reps; r++) {
+            ys[0] += 1e-12;
+            polyfitDegree(degree, xs, ys, n_points, fitted);
+            sink += fitted[0];
+        }
+        timer.stop();
+        double fit_time = timer.value(Eigen::REAL_TIMER) / reps * 1e9;
+        Eigen::BenchTimer fixed_timer;
+        double next[6];
+        Eigen::Matrix<double, 6, 6> A;
+        Eigen::Matrix<double, 6, 2> B;
+        timer.start();
+        for (int r = 0; r < reps; r++) {
+            states[0][2] = r * 1e-9;
+            vehicleStepJacobians(states[0].data(), u[0], u[1], fitted, Config::dt, next, &A, &B);
+            sink += next[0];
+        }
+        timer.stop();
+        fixed_timer.start();
+        for (int r = 0; r < reps; r++) {
+            states[0][2] = r * 1e-9;
+            vehicleStepDegree(states[0].data(), u[0], u[1], fitted, Config::dt, next, &A, &B);
+            sink += next[0];
+        }
+        fixed_timer.stop();
+        printf("degree %d     fit %8.1f ns  stage dynamic %6.1f fixed %6.1f ns\n", degree, fit_time,
+               timer.value(Eigen::REAL_TIMER) / reps * 1e9, fixed_timer.value(Eigen::REAL_TIMER) / reps * 1e9);
+    }
+
+    static StageQP lq;
+    stageProblem<Config>(states, jac_A, jac_B, u, CostWeights(), constantSpeeds(), lq);
+    for (int k = 0; k < N - 1; k++) {
+        lq.lb[k] << -max_delta - u[2 * k], -max_a - u[2 * k + 1];
+        lq.ub[k] << max_delta - u[2 * k], max_a - u[2 * k + 1];
+    }
+    StageQP::State x[N];
+    StageQP::Input du[N - 1];
+    x[0].setZero();
+    int qp_reps = max(1, reps / 10);
+    timer.start();
+    for (int r = 0; r < qp_reps; r++) {
+        sink += lq.solve(x, du);
+    }
+    timer.stop();
+    printKernel("riccati", timer, qp_reps);
+
+    static BatchBoxRiccati<8, 2, N - 1> batch;
+    for (int lane = 0; lane < batch_lanes; lane++) {
+        batch.load(lane, lq);
+    }
+    timer.start();
+    for (int r = 0; r < qp_reps; r++) {
+        sink += batch.solve(x[0]);
+    }
+    timer.stop();
+    printKernel("riccati/lane", timer, qp_reps * batch_lanes);
+
+    static EmbeddedMpc<Config> mpc;
+    int step_reps = max(1, reps / 20);
+    timer.start();
+    for (int r = 0; r < step_reps; r++) {
+        double steering, throttle;
+        mpc.step(frame, steering, throttle);
+        sink += steering;
+    }
+    timer.stop();
+    printKernel("step", timer, step_reps);
+    bench_sink = sink;
+
+    if (!DoublePacket::Vectorizable) {
+        fprintf(stderr, "doubles are not vectorized on this build\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void benchMath(int reps) {
+    const int n = 100000;
+    checkMath("sin", fastSin<double>, libmSin, -M_PI, M_PI, n, reps);
+    checkMath("sin'", fastSinSlope<double>, libmSinSlope, -M_PI, M_PI, n, reps);
+    checkMath("cos", fastCos<double>, libmCos, -M_PI, M_PI, n, reps);
+    checkMath("cos'", fastCosSlope<double>, libmCosSlope, -M_PI, M_PI, n, reps);
+    checkMath("atan", fastAtan<double>, libmAtan, -50, 50, n, reps);
+    checkMath("atan'", fastAtanSlope<double>, libmAtanSlope, -50, 50, n, reps);
+}
+
+int main(int argc, char *argv[]) {
+    int repeat = 1;
+    int arg = 1;
+    bool kernels = false;
+    bool hessians = false;
+    bool formulations = false;
+    bool precisions = false;
+    bool math = false;
+    bool geometric = false;
+    bool steer = false;
+    bool slow_solves = false;
+    bool vector_kernels = false;
+    bool pipeline = false;
+    if (arg < argc && string(argv[arg]) == "-k") {
+        kernels = true;
+        arg++;
+    } else if (arg < argc && string(argv[arg]) == "-H") {
+        hessians = true;
+        arg++;
+    } else if (arg < argc && string(argv[arg]) == "-F") {
+        formulations = true;
+        arg++;
+    } else if (arg < argc && string(argv[arg]) == "-P") {
+        precisions = true;
+        arg++;
+    } else if (arg < argc && string(argv[arg]) == "-m") {
+        math = true;
+        arg++;
+    } else if (arg < argc && string(argv[arg]) == "-G") {
+        geometric = true;
+        arg++;
+    } else if (arg < argc && string(argv[arg]) == "-s") {
+        steer = true;
+        arg++;
+    } else if (arg < argc && string(argv[arg]) == "-D") {
+        slow_solves = true;
+        arg++;
+    } else if (arg < argc && string(argv[arg]) == "-v") {
+        vector_kernels = true;
+        arg++;
+    } else if (arg < argc && string(argv[arg]) == "-p") {
+        pipeline = true;
+        arg++;
+    }
+    if (arg + 1 < argc && string(argv[arg]) == "-r") {
+        repeat = max(1, atoi(argv[arg + 1]));
+        arg += 2;
+    }
+    const char *results_path = nullptr;
+    BenchReport results;
+    if (arg + 1 < argc && string(argv[arg]) == "-o") {
+        results_path = argv[arg + 1];
+        report = &results;
+        arg += 2;
+    }
+    // Writes the report of -o, if any, on the way out of main.
+    struct ReportWriter {
+        const char *path;
+        const BenchReport &results;
+        ~ReportWriter() {
+            if (path && !results.write(path)) {
+                fprintf(stderr, "cannot write %s\n", path);
+            }
+        }
+    } writer{results_path, results};
+    if (math) {
+        benchMath(10 * repeat);
+        return 0;
+    }
+    if (vector_kernels) {
+        return benchVectorKernels(100000 * repeat);
+    }
+    if (pipeline) {
+        benchPipeline(100000 * repeat, 100 * repeat);
+        return 0;
+    }
+    if (steer) {
+        for (int points : {9, 6, 4, 2}) {
+            timeSteer(points, DefaultConfig::N - 1, 100000 * repeat);
+        }
+        return 0;
+    }
+    if (kernels) {
+        vector<size_t> horizons(begin(compiled_horizons), end(compiled_horizons));
+        if (arg < argc) {
+            horizons.clear();
+        }
+        for (; arg < argc; arg++) {
+            horizons.push_back(strtoul(argv[arg], nullptr, 10));
+        }
+        timeStageJacobians(100000 * repeat);
+        for (size_t N : horizons) {
+            if (N == DefaultConfig::N) {
+                benchKernels<DefaultConfig>(1000 * repeat);
+            } else if (N == MediumConfig::N) {
+                benchKernels<MediumConfig>(1000 * repeat);
+            } else if (N == LongConfig::N) {
+                benchKernels<LongConfig>(1000 * repeat);
+            } else if (N == BlockedConfig::N) {
+                benchKernels<BlockedConfig>(1000 * repeat);
+            } else {
+                fprintf(stderr, "N = %zu is not compiled in\n", N);
+            }
+        }
+        return 0;
+    }
+    if (arg >= argc) {
+        fprintf(stderr, "usage: %s [-H | -F | -P | -G] [-r repeat] [-o results.json] corpus [N ...]\n"
+                        "       %s -k [-r repeat] [N ...]\n"
+                        "       %s -m [-r repeat]\n"
+                        "       %s -s [-r repeat]\n"
+                        "       %s -v [-r repeat] [-o results.json]\n"
+                        "       %s -p [-r repeat] [-o results.json]\n"
+                        "       %s -D [-r repeat] slow_solves\n",
+                argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+    if (slow_solves) {
+        return replaySlowSolves(argv[arg], repeat);
+    }
+
+    vector<Telemetry> frames;
+    if (!loadCorpus(argv[arg], frames)) {
+        fprintf(stderr, "cannot read %s\n", argv[arg]);
+        return 1;
+    }
+    if (frames.empty()) {
+        fprintf(stderr, "no telemetry in %s\n", argv[arg]);
+        return 1;
+    }
+    arg++;
+
+    vector<size_t> horizons;
+    for (; arg < argc; arg++) {
+        horizons.push_back(strtoul(argv[arg], nullptr, 10));
+    }
+    if (horizons.empty()) {
+        horizons.assign(begin(compiled_horizons), end(compiled_horizons));
+    }
+
+    // As for mpc, MPC_MAP=<csv> takes the waypoints from a map, which a
+    // capture recorded that way needs, and MPC_REFERENCE=spline the
+    // reference from a spline of it.
+    Track map;
+    const char *map_path = getenv("MPC_MAP");
+    if (map_path && !map.load(map_path)) {
+        fprintf(stderr, "cannot read a track from %s\n", map_path);
+        return 1;
+    }
+    PathSpline spline;
+    const char *reference = getenv("MPC_REFERENCE");
+    bool use_spline = reference && strcmp(reference, "spline") == 0;
+    if (use_spline && !(map_path && spline.build(map))) {
+        fprintf(stderr, "MPC_REFERENCE=spline needs a map of distinct waypoints in MPC_MAP\n");
+        return 1;
+    }
+
+    if (geometric) {
+        timeGeometric("pursuit", GEOMETRIC_PURSUIT, 1000000 * repeat);
+        timeGeometric("stanley", GEOMETRIC_STANLEY, 1000000 * repeat);
+    }
+    printf("%zu frames\n", frames.size());
+    for (size_t N : horizons) {
+        if (hessians) {
+            compareHessians(N, frames, repeat, map_path ? &map : nullptr, use_spline ? &spline : nullptr);
+        } else if (formulations) {
+            compareFormulations(N, frames, repeat, map_path ? &map : nullptr, use_spline ? &spline : nullptr);
+        } else if (precisions) {
+            comparePrecisions(N, frames, repeat, map_path ? &map : nullptr, use_spline ? &spline : nullptr);
+        } else if (geometric) {
+            compareGeometric(N, frames, repeat, map_path ? &map : nullptr, use_spline ? &spline : nullptr,
+                             GEOMETRIC_PURSUIT);
+            compareGeometric(N, frames, repeat, map_path ? &map : nullptr, use_spline ? &spline : nullptr,
+                             GEOMETRIC_STANLEY);
+        } else {
+            run(N, frames, repeat, map_path ? &map : nullptr, use_spline ? &spline : nullptr);
+        }
+    }
+    Logger::flush();
+    return 0;
+}
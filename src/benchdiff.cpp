@@ -0,0 +1,82 @@
+#include <math.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "BenchReport.h"
+
+// Comparison of two result files of mpc_bench -o, see BenchReport.
+//
+//     mpc_benchdiff [-a alpha] [-t threshold] baseline.json candidate.json
+//
+// For every result of the baseline that the candidate has too, by name,
+// label, backend and horizon, it prints the medians of both, the change of
+// the candidate's, and the p-value of the Mann-Whitney U test on their
+// samples. A change is significant at a p-value below alpha, 0.01 by
+// default, and counts once the medians are more than threshold apart,
+// 0.02 (2%) by default; each result is marked faster, slower or
+// unchanged. The differences between the environments of the files are
+// printed first, since results of different machines or builds hardly
+// compare. Exits with 1 if any result got slower, so a CI job can gate on
+// it, and with 2 if a file cannot be read.
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-a alpha] [-t threshold] baseline.json candidate.json\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    double alpha = 0.01;
+    double threshold = 0.02;
+    const char *paths[2] = {nullptr, nullptr};
+    size_t n_paths = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] != '-' && n_paths < 2) {
+            paths[n_paths++] = argv[i];
+        } else if (arg == "-a" && i + 1 < argc) {
+            alpha = atof(argv[++i]);
+        } else if (arg == "-t" && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (n_paths != 2 || !(alpha > 0 && alpha < 1) || threshold < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    BenchReport reports[2];
+    for (int k = 0; k < 2; k++) {
+        if (!reports[k].read(paths[k])) {
+            fprintf(stderr, "cannot read results from %s\n", paths[k]);
+            return 2;
+        }
+    }
+
+    const map<string, string> &base_env = reports[0].environment();
+    const map<string, string> &cand_env = reports[1].environment();
+    for (const auto &entry : base_env) {
+        auto other = cand_env.find(entry.first);
+        string value = other == cand_env.end() ? string() : other->second;
+        if (entry.first != "time" && value != entry.second) {
+            printf("%-12s %s -> %s\n", entry.first.c_str(), entry.second.c_str(), value.c_str());
+        }
+    }
+
+    vector<BenchComparison> comparisons = compareBench(reports[0], reports[1]);
+    size_t slower = 0, faster = 0;
+    for (const BenchComparison &c : comparisons) {
+        const char *verdict = "unchanged";
+        if (c.p < alpha && fabs(c.change) > threshold) {
+            verdict = c.change > 0 ? "slower" : "faster";
+            (c.change > 0 ? slower : faster)++;
+        }
+        printf("%-32s %10.4g -> %10.4g %-3s %+7.1f%%  p %.2g  (%zu vs %zu)  %s\n", c.key.c_str(),
+               c.baseline_p50, c.candidate_p50, c.unit.c_str(), c.change * 100, c.p, c.baseline_count,
+               c.candidate_count, verdict);
+    }
+    printf("%zu compared, %zu slower, %zu faster, %zu of the baseline not in the candidate\n",
+           comparisons.size(), slower, faster, reports[0].results().size() - comparisons.size());
+    return slower > 0 ? 1 : 0;
+}
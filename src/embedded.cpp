@@ -0,0 +1,11 @@
+#include "EmbeddedMpc.h"
+
+// The library of the embedded build, see MPC_EMBEDDED in CMakeLists.txt:
+// EmbeddedMpc on a horizon of MPC_EMBEDDED_N stages of 100 ms, compiled
+// without exceptions or RTTI and with Eigen asserting that nothing is
+// allocated.
+#ifndef MPC_EMBEDDED_N
+#define MPC_EMBEDDED_N 10
+#endif
+
+template class EmbeddedMpc<MpcConfig<MPC_EMBEDDED_N, 100> >;
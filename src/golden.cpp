@@ -0,0 +1,365 @@
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Controller.h"
+#include "LogReplay.h"
+#include "Logger.h"
+#include "MPC.h"
+#include "TaskScheduler.h"
+#include "TelemetryParser.h"
+
+// Equivalence of the optimized backends with the reference one on a fixed
+// corpus of problems.
+//
+//     mpc_golden [-N horizon] [-R solver] [-t steering:throttle:trajectory]
+//                [-j threads] [-w golden | -g golden] corpus [solver[:single] ...]
+//
+// The corpus is a trace log or a capture, see loadReplayLog. Each frame is
+// prepared as Controller::prepare does, for its state and reference, and
+// the problems are solved in order, warm started from one another as in
+// operation, by an MPC per backend with the default weights and options:
+// the reference, MPC_SOLVER=cppad, i.e. CppAD::ipopt::solve, unless -R
+// names another, and each solver listed, by default every other backend,
+// rti and mppi also in single precision. For each the largest and the
+// mean deviation from the reference of the first steering, in rad, and
+// throttle and of the predicted positions, in m, are printed, and whether
+// the largest are within the tolerances, 0.01, 0.05 and 0.5 by default.
+//
+// -w writes the reference solutions to a golden file, -g reads them from
+// one instead of solving, so a build that changes the reference itself,
+// MPC_FAST_MATH for one, is checked against the output of the build
+// before. The exit status is 2 if a solver was out of tolerance.
+//
+// -j then solves the corpus again with the reference and every solver
+// listed, `threads` times each, all of them at once on `threads` threads
+// of the TaskScheduler, each copy on an MPC of its own, and checks every
+// copy against the reference the same way. The solves of the CppAD
+// backends then record and sweep their tapes concurrently, see
+// CppadThreads.h. Then once more one MPC per solver, made and destroyed
+// on the main thread, solving each problem on a thread of its own, as a
+// controller moves between the threads of the server.
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-N horizon] [-R solver] [-t steering:throttle:trajectory]\n"
+                    "       %*s [-j threads] [-w golden | -g golden] corpus [solver[:single] ...]\n",
+            name, (int) strlen(name), "");
+}
+
+// What a solve is compared by: the first actuations and the predicted
+// positions of every stage.
+struct Output {
+    double delta = 0;
+    double a = 0;
+    bool ok = false;
+    vector<double> x;
+    vector<double> y;
+};
+
+struct Tolerances {
+    double steering = 0.01;
+    double throttle = 0.05;
+    double trajectory = 0.5;
+};
+
+// A backend and its precision.
+struct Variant {
+    string name;
+    SolverBackend backend;
+    bool single_precision;
+};
+
+static bool parseVariant(const string &spec, Variant &variant) {
+    variant.name = spec;
+    size_t colon = spec.find(':');
+    variant.single_precision = colon != string::npos;
+    if (variant.single_precision && spec.substr(colon + 1) != "single") {
+        return false;
+    }
+    return parseBackend(spec.substr(0, colon), variant.backend);
+}
+
+// Set `mpc` up for `variant` with horizon N; false if N is not compiled in.
+static bool setUp(MPC &mpc, const Variant &variant, size_t N) {
+    mpc.setWarmStart(true);
+    mpc.setBackend(variant.backend);
+    if (!mpc.setHorizon(N)) {
+        return false;
+    }
+    MpcOptions options;
+    options.single_precision = variant.single_precision;
+    mpc.setOptions(options);
+    return true;
+}
+
+static void solve(MPC &mpc, const ControlFrame &problem, Output &out) {
+    SolveStats stats;
+    Solution solution;
+    mpc.Solve(problem.state, problem.coeffs, stats, Deadline::max(), solution);
+    out = Output();
+    out.delta = solution.delta;
+    out.a = solution.a;
+    out.ok = stats.ok();
+    for (size_t t = 0; t < solution.n_stages; t++) {
+        out.x.push_back(solution.stages[t].x);
+        out.y.push_back(solution.stages[t].y);
+    }
+}
+
+// Solve `problems` in order on a fresh MPC of `variant` with horizon N.
+static bool solveAll(const Variant &variant, size_t N, const vector<ControlFrame> &problems,
+                     vector<Output> &outputs) {
+    MPC mpc;
+    if (!setUp(mpc, variant, N)) {
+        return false;
+    }
+    outputs.assign(problems.size(), Output());
+    for (size_t i = 0; i < problems.size(); i++) {
+        solve(mpc, problems[i], outputs[i]);
+    }
+    return true;
+}
+
+// The golden file: a header line with the horizon and the number of
+// problems, then one line per problem, its status, actuations, number of
+// stages and positions.
+static bool writeGolden(const char *path, size_t N, const vector<Output> &outputs) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        return false;
+    }
+    fprintf(out, "golden %zu %zu\n", N, outputs.size());
+    for (const Output &o : outputs) {
+        fprintf(out, "%d %.17g %.17g %zu", o.ok, o.delta, o.a, o.x.size());
+        for (size_t t = 0; t < o.x.size(); t++) {
+            fprintf(out, " %.17g %.17g", o.x[t], o.y[t]);
+        }
+        fprintf(out, "\n");
+    }
+    return fclose(out) == 0;
+}
+
+static bool readGolden(const char *path, size_t N, size_t n_problems, vector<Output> &outputs) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        return false;
+    }
+    size_t horizon = 0, n = 0;
+    bool good = fscanf(in, "golden %zu %zu", &horizon, &n) == 2 && horizon == N && n == n_problems;
+    outputs.assign(n, Output());
+    for (size_t i = 0; good && i < n; i++) {
+        Output &o = outputs[i];
+        int ok = 0;
+        size_t n_stages = 0;
+        good = fscanf(in, "%d %lf %lf %zu", &ok, &o.delta, &o.a, &n_stages) == 4 && n_stages <= max_horizon;
+        o.ok = ok != 0;
+        o.x.resize(n_stages);
+        o.y.resize(n_stages);
+        for (size_t t = 0; good && t < n_stages; t++) {
+            good = fscanf(in, "%lf %lf", &o.x[t], &o.y[t]) == 2;
+        }
+    }
+    fclose(in);
+    return good;
+}
+
+// Print how far `outputs` are from `reference`; false if beyond
+// `tolerances` or a solve failed where the reference did not.
+static bool compare(const char *name, const vector<Output> &reference, const vector<Output> &outputs,
+                    const Tolerances &tolerances) {
+    double max_steering = 0, max_throttle = 0, max_trajectory = 0;
+    double sum_steering = 0, sum_throttle = 0, sum_trajectory = 0;
+    size_t n_stages = 0, failures = 0;
+    for (size_t i = 0; i < reference.size(); i++) {
+        const Output &r = reference[i], &o = outputs[i];
+        failures += r.ok && !o.ok;
+        double steering = fabs(o.delta - r.delta);
+        double throttle = fabs(o.a - r.a);
+        max_steering = max(max_steering, steering);
+        max_throttle = max(max_throttle, throttle);
+        sum_steering += steering;
+        sum_throttle += throttle;
+        for (size_t t = 0; t < min(r.x.size(), o.x.size()); t++) {
+            double distance = hypot(o.x[t] - r.x[t], o.y[t] - r.y[t]);
+            max_trajectory = max(max_trajectory, distance);
+            sum_trajectory += distance;
+            n_stages++;
+        }
+    }
+    size_t n = max((size_t) 1, reference.size());
+    bool pass = failures == 0 && max_steering <= tolerances.steering && max_throttle <= tolerances.throttle &&
+                max_trajectory <= tolerances.trajectory;
+    printf("%-14s steering max %.2e mean %.2e  throttle max %.2e mean %.2e  trajectory max %.3f mean %.3f m  "
+           "failed %zu/%zu  %s\n",
+           name, max_steering, sum_steering / n, max_throttle, sum_throttle / n, max_trajectory,
+           sum_trajectory / max((size_t) 1, n_stages), failures, reference.size(), pass ? "ok" : "FAIL");
+    return pass;
+}
+
+// Solve `problems` with each of `variants` `copies` times, all at once on
+// up to `copies` threads, and compare every copy with `reference`.
+static bool solveConcurrently(const vector<Variant> &variants, size_t copies, size_t N,
+                              const vector<ControlFrame> &problems, const vector<Output> &reference,
+                              const Tolerances &tolerances) {
+    size_t n_jobs = variants.size() * copies;
+    vector<vector<Output> > outputs(n_jobs);
+    atomic<size_t> next(0);
+    auto work = [&] {
+        for (size_t i = next++; i < n_jobs; i = next++) {
+            solveAll(variants[i % variants.size()], N, problems, outputs[i]);
+        }
+    };
+    auto helper = [&](size_t) { work(); };
+    TaskGroup helpers(TASK_LOW);
+    helpers.run(1, min(copies, n_jobs), helper);
+    work();
+    helpers.wait();
+
+    printf("%zu copies of each solver at once\n", copies);
+    bool pass = true;
+    for (size_t i = 0; i < n_jobs; i++) {
+        string name = variants[i % variants.size()].name + "/" + to_string(i / variants.size());
+        pass = compare(name.c_str(), reference, outputs[i], tolerances) && pass;
+    }
+    return pass;
+}
+
+// Solve `problems` with each of `variants` on an MPC made and destroyed on
+// the calling thread, each problem on a new thread, and compare them with
+// `reference`.
+static bool solveMoving(const vector<Variant> &variants, size_t N, const vector<ControlFrame> &problems,
+                        const vector<Output> &reference, const Tolerances &tolerances) {
+    printf("each problem on a thread of its own\n");
+    bool pass = true;
+    for (const Variant &variant : variants) {
+        vector<Output> outputs(problems.size());
+        {
+            MPC mpc;
+            setUp(mpc, variant, N);
+            for (size_t i = 0; i < problems.size(); i++) {
+                thread solver([&] { solve(mpc, problems[i], outputs[i]); });
+                solver.join();
+            }
+        }
+        pass = compare(variant.name.c_str(), reference, outputs, tolerances) && pass;
+    }
+    return pass;
+}
+
+int main(int argc, char *argv[]) {
+    size_t N = DefaultConfig::N;
+    Variant reference_variant = {"cppad", CPPAD_IPOPT, false};
+    Tolerances tolerances;
+    size_t n_threads = 1;
+    const char *write_path = nullptr;
+    const char *golden_path = nullptr;
+    const char *corpus = nullptr;
+    vector<Variant> variants;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] != '-') {
+            Variant variant;
+            if (!corpus) {
+                corpus = argv[i];
+            } else if (parseVariant(arg, variant)) {
+                variants.push_back(variant);
+            } else {
+                fprintf(stderr, "unknown solver %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "-N") {
+            N = strtoul(value, nullptr, 10);
+        } else if (arg == "-R") {
+            if (!parseVariant(value, reference_variant)) {
+                fprintf(stderr, "unknown solver %s\n", value);
+                return 1;
+            }
+        } else if (arg == "-t") {
+            sscanf(value, "%lf:%lf:%lf", &tolerances.steering, &tolerances.throttle, &tolerances.trajectory);
+        } else if (arg == "-j") {
+            n_threads = max(1l, atol(value));
+        } else if (arg == "-w") {
+            write_path = value;
+        } else if (arg == "-g") {
+            golden_path = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!corpus || (write_path && golden_path)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (variants.empty()) {
+        for (const char *spec : {"taped", "kinematic", "rti", "rti:single", "mppi", "mppi:single", "cgmres"}) {
+            Variant variant;
+            if (parseVariant(spec, variant) && variant.backend != reference_variant.backend) {
+                variants.push_back(variant);
+            }
+        }
+    }
+
+    ReplayLog log;
+    if (!loadReplayLog(corpus, log)) {
+        fprintf(stderr, "cannot read %s\n", corpus);
+        return 1;
+    }
+    Controller controller;
+    Telemetry telemetry;
+    vector<ControlFrame> problems;
+    for (const string &msg : log.messages) {
+        if (parseMessage(msg.data(), msg.size(), telemetry) == MSG_TELEMETRY && telemetry.ptsx.size() >= 4) {
+            problems.emplace_back();
+            controller.prepare(telemetry, problems.back());
+        }
+    }
+    if (problems.empty()) {
+        fprintf(stderr, "no problems in %s\n", corpus);
+        return 1;
+    }
+
+    vector<Output> reference;
+    if (golden_path) {
+        if (!readGolden(golden_path, N, problems.size(), reference)) {
+            fprintf(stderr, "%s is no golden file of %zu problems on N = %zu\n", golden_path, problems.size(), N);
+            return 1;
+        }
+    } else if (!solveAll(reference_variant, N, problems, reference)) {
+        fprintf(stderr, "N = %zu is not compiled in\n", N);
+        return 1;
+    }
+    if (write_path && !writeGolden(write_path, N, reference)) {
+        fprintf(stderr, "cannot write %s\n", write_path);
+        return 1;
+    }
+    printf("%zu problems on N = %zu against %s\n", problems.size(), N,
+           golden_path ? golden_path : reference_variant.name.c_str());
+
+    bool pass = true;
+    vector<Output> outputs;
+    for (const Variant &variant : variants) {
+        solveAll(variant, N, problems, outputs);
+        pass = compare(variant.name.c_str(), reference, outputs, tolerances) && pass;
+    }
+    if (n_threads > 1) {
+        vector<Variant> concurrent = variants;
+        concurrent.insert(concurrent.begin(), reference_variant);
+        pass = solveConcurrently(concurrent, n_threads, N, problems, reference, tolerances) && pass;
+        pass = solveMoving(concurrent, N, problems, reference, tolerances) && pass;
+    }
+    Logger::flush();
+    return pass ? 0 : 2;
+}
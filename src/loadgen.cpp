@@ -0,0 +1,326 @@
+#include <uWS/uWS.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BenchReport.h"
+#include "BinaryProtocol.h"
+#include "LogReplay.h"
+#include "Logger.h"
+#include "TelemetryParser.h"
+
+// Load generator for scaling tests of the server.
+//
+//     mpc_loadgen [-u ws://host:port] [-c connections,...] [-r rate_hz] [-w warmup_s] [-d duration_s]
+//                 [-D delay_ms] [-b] [-l label] log
+//
+// Replays the telemetry of a trace log or a capture, see loadReplayLog,
+// over each of `connections` websockets at `rate_hz`, 10 by default, like
+// one simulator each, starting at spread out frames of the log and with
+// the sends of the connections staggered over the period. For each count
+// of the list, 1,2,4,8,16 by default, connections are opened up to that
+// many, the load runs `warmup_s`, 2, and is then measured for
+// `duration_s`, 10: one line with the frames sent and the replies per
+// second, the frames dropped and the percentiles of the time from sending
+// a frame to its reply, over all connections and the p99 of the worst one.
+// The counts run against one server, so its worker threads, see
+// MPC_CPUS, and loops are what the runs with different -l labels compare.
+//
+// The replies carry nothing of their frame, so they are matched the way
+// the server coalesces them, see main.cpp: in order, and once a reply is
+// in, every frame sent before its solve ended, `delay_ms` ago, 100 like
+// the server's DelayedSend, was waiting and all but the newest of those
+// were replaced. That holds for the server's defaults; MPC_ACTUATION_HZ
+// sends replies of no frame and MPC_BACKPRESSURE may drop some. -b speaks
+// the binary protocol on /binary instead of the simulator's JSON.
+
+typedef chrono::steady_clock Clock;
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-u ws://host:port] [-c connections,...] [-r rate_hz] [-w warmup_s] [-d duration_s] "
+                    "[-D delay_ms] [-b] [-l label] log\n", name);
+}
+
+// Frames sent and not answered beyond which the oldest is given up.
+static const size_t max_outstanding = 1024;
+
+struct LoadGen;
+
+struct Connection {
+    LoadGen *gen = nullptr;
+    size_t id = 0;
+    uWS::WebSocket<uWS::CLIENT> ws;
+    bool open = false;
+    uv_timer_t timer;
+    // Next frame of the log to send.
+    size_t next = 0;
+    // Send times of the frames not answered yet, oldest first.
+    deque<Clock::time_point> outstanding;
+    // Counts of the measurement window and the latencies in it, in s.
+    size_t sent = 0;
+    size_t replies = 0;
+    size_t dropped = 0;
+    vector<double> latencies;
+};
+
+struct LoadGen {
+    uWS::Hub *hub = nullptr;
+    string url;
+    bool binary = false;
+    vector<string> frames;
+    uint64_t period_ms = 100;
+    Clock::duration delay = chrono::milliseconds(100);
+    vector<size_t> steps;
+    size_t step = 0;
+    uint64_t warmup_ms = 2000;
+    uint64_t duration_ms = 10000;
+    string label;
+    bool measuring = false;
+    Clock::time_point window_start;
+    uv_timer_t phase;
+    vector<unique_ptr<Connection>> connections;
+    size_t errors = 0;
+    size_t disconnects = 0;
+    bool any_open = false;
+};
+
+static void onSend(uv_timer_t *timer) {
+    Connection &c = *(Connection *) timer->data;
+    LoadGen &gen = *c.gen;
+    if (!c.open) {
+        return;
+    }
+    const string &msg = gen.frames[c.next++ % gen.frames.size()];
+    c.ws.send(msg.data(), msg.size(), gen.binary ? uWS::OpCode::BINARY : uWS::OpCode::TEXT);
+    if (c.outstanding.size() >= max_outstanding) {
+        c.outstanding.pop_front();
+        c.dropped += gen.measuring;
+    }
+    c.outstanding.push_back(Clock::now());
+    c.sent += gen.measuring;
+}
+
+static void onReply(Connection &c, Clock::time_point now) {
+    if (c.outstanding.empty()) {
+        return;
+    }
+    LoadGen &gen = *c.gen;
+    double latency = chrono::duration<double>(now - c.outstanding.front()).count();
+    c.outstanding.pop_front();
+    if (gen.measuring) {
+        c.replies++;
+        c.latencies.push_back(latency);
+    }
+    // The solve of that frame ended about `delay` ago, and the newest frame
+    // waiting by then replaced the others.
+    Clock::time_point solved = now - gen.delay;
+    size_t waiting = 0;
+    while (waiting < c.outstanding.size() && c.outstanding[waiting] <= solved) {
+        waiting++;
+    }
+    if (waiting > 1) {
+        c.outstanding.erase(c.outstanding.begin(), c.outstanding.begin() + (waiting - 1));
+        c.dropped += gen.measuring ? waiting - 1 : 0;
+    }
+}
+
+static void startStep(LoadGen &gen);
+
+static void finishStep(uv_timer_t *timer) {
+    LoadGen &gen = *(LoadGen *) timer->data;
+    double elapsed = chrono::duration<double>(Clock::now() - gen.window_start).count();
+    size_t open = 0, sent = 0, replies = 0, dropped = 0;
+    double worst_p99 = 0;
+    vector<double> latencies;
+    for (auto &c : gen.connections) {
+        open += c->open;
+        sent += c->sent;
+        replies += c->replies;
+        dropped += c->dropped;
+        sort(c->latencies.begin(), c->latencies.end());
+        worst_p99 = max(worst_p99, benchPercentile(c->latencies, 0.99));
+        latencies.insert(latencies.end(), c->latencies.begin(), c->latencies.end());
+    }
+    sort(latencies.begin(), latencies.end());
+    printf("%-10s %11zu %5zu %9.1f %9.1f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %9.2f\n",
+           gen.label.c_str(), gen.steps[gen.step], open, sent / elapsed, replies / elapsed,
+           sent > 0 ? 100.0 * dropped / sent : 0.0, benchPercentile(latencies, 0.5) * 1e3,
+           benchPercentile(latencies, 0.9) * 1e3, benchPercentile(latencies, 0.99) * 1e3,
+           benchPercentile(latencies, 0.999) * 1e3, latencies.empty() ? 0.0 : latencies.back() * 1e3, worst_p99 * 1e3);
+    fflush(stdout);
+
+    gen.step++;
+    if (gen.step < gen.steps.size()) {
+        startStep(gen);
+        return;
+    }
+    for (auto &c : gen.connections) {
+        uv_timer_stop(&c->timer);
+        if (c->open) {
+            c->open = false;
+            c->ws.close();
+        }
+    }
+    uv_stop(gen.hub->getLoop());
+}
+
+static void startWindow(uv_timer_t *timer) {
+    LoadGen &gen = *(LoadGen *) timer->data;
+    for (auto &c : gen.connections) {
+        c->sent = c->replies = c->dropped = 0;
+        c->latencies.clear();
+    }
+    gen.measuring = true;
+    gen.window_start = Clock::now();
+    uv_timer_start(&gen.phase, finishStep, gen.duration_ms, 0);
+}
+
+static void startStep(LoadGen &gen) {
+    size_t target = gen.steps[gen.step];
+    while (gen.connections.size() < target) {
+        unique_ptr<Connection> c(new Connection);
+        c->gen = &gen;
+        c->id = gen.connections.size();
+        // A prime stride keeps the starts of any number of connections
+        // apart in the log.
+        c->next = c->id * 7919 % gen.frames.size();
+        uv_timer_init(gen.hub->getLoop(), &c->timer);
+        c->timer.data = c.get();
+        gen.hub->connect(gen.url, c.get());
+        gen.connections.push_back(std::move(c));
+    }
+    gen.measuring = false;
+    uv_timer_start(&gen.phase, startWindow, gen.warmup_ms, 0);
+}
+
+int main(int argc, char *argv[]) {
+    LoadGen gen;
+    string host = "ws://127.0.0.1:4567";
+    double rate = 10;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] != '-') {
+            path = argv[i];
+            continue;
+        }
+        if (arg == "-b") {
+            gen.binary = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "-u") {
+            host = value;
+        } else if (arg == "-c") {
+            gen.steps.clear();
+            for (const char *s = value; *s;) {
+                char *end;
+                unsigned long n = strtoul(s, &end, 10);
+                if (end == s || n == 0 || (*end && *end != ',')) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                gen.steps.push_back(n);
+                s = *end ? end + 1 : end;
+            }
+        } else if (arg == "-r") {
+            rate = atof(value);
+        } else if (arg == "-w") {
+            gen.warmup_ms = max(0.0, atof(value)) * 1000;
+        } else if (arg == "-d") {
+            gen.duration_ms = max(0.1, atof(value)) * 1000;
+        } else if (arg == "-D") {
+            gen.delay = chrono::microseconds((long) (atof(value) * 1000));
+        } else if (arg == "-l") {
+            gen.label = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path || !(rate > 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (gen.steps.empty()) {
+        gen.steps = {1, 2, 4, 8, 16};
+    }
+    sort(gen.steps.begin(), gen.steps.end());
+    gen.period_ms = max(1.0, 1000 / rate);
+    gen.url = host + (gen.binary ? "/binary" : "/");
+    if (gen.label.empty()) {
+        gen.label = "-";
+    }
+
+    ReplayLog log;
+    if (!loadReplayLog(path, log) || log.messages.empty()) {
+        fprintf(stderr, "cannot read telemetry from %s\n", path);
+        return 1;
+    }
+    Telemetry telemetry;
+    for (const string &msg : log.messages) {
+        string frame = msg;
+        if (gen.binary) {
+            parseMessage(msg.data(), msg.size(), telemetry);
+            writeTelemetryBinary(frame, telemetry);
+        }
+        gen.frames.push_back(std::move(frame));
+    }
+
+    uWS::Hub hub;
+    gen.hub = &hub;
+    hub.onConnection([&gen](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req) {
+        Connection &c = *(Connection *) ws.getUserData();
+        c.ws = ws;
+        c.open = true;
+        gen.any_open = true;
+        // Spread the connections' sends over the period.
+        uint64_t offset = gen.period_ms * c.id / max<size_t>(1, gen.steps[gen.step]);
+        uv_timer_start(&c.timer, onSend, offset % gen.period_ms, gen.period_ms);
+    });
+    hub.onMessage([](uWS::WebSocket<uWS::CLIENT> ws, char *data, size_t length, uWS::OpCode opCode) {
+        Connection &c = *(Connection *) ws.getUserData();
+        bool steer = opCode == uWS::OpCode::BINARY ? length > 0 && data[0] == 'S'
+                                                    : length > 10 && memcmp(data, "42[\"steer\"", 10) == 0;
+        if (steer) {
+            onReply(c, Clock::now());
+        }
+    });
+    hub.onDisconnection([&gen](uWS::WebSocket<uWS::CLIENT> ws, int code, char *message, size_t length) {
+        Connection &c = *(Connection *) ws.getUserData();
+        if (c.open) {
+            c.open = false;
+            gen.disconnects++;
+            uv_timer_stop(&c.timer);
+        }
+    });
+    hub.onError([&gen](void *user) {
+        Connection &c = *(Connection *) user;
+        if (gen.errors++ == 0) {
+            fprintf(stderr, "cannot connect to %s\n", gen.url.c_str());
+        }
+        uv_timer_stop(&c.timer);
+    });
+
+    uv_timer_init(hub.getLoop(), &gen.phase);
+    gen.phase.data = &gen;
+    printf("%-10s %11s %5s %9s %9s %8s %8s %8s %8s %8s %8s %9s\n", "label", "connections", "open", "sent/s",
+           "replies/s", "dropped%", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms", "worst p99");
+    startStep(gen);
+    hub.run();
+
+    if (gen.errors > 0 || gen.disconnects > 0) {
+        fprintf(stderr, "%zu connection(s) failed, %zu disconnected\n", gen.errors, gen.disconnects);
+    }
+    Logger::flush();
+    return gen.any_open ? 0 : 1;
+}
@@ -1,241 +1,2063 @@
-#include <math.h>
 #include <uWS/uWS.h>
-#include <chrono>
+#include <malloc.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <thread>
 #include <vector>
-#include "Eigen-3.3/Eigen/Core"
-#include "Eigen-3.3/Eigen/QR"
-#include "MPC.h"
-#include "json.hpp"
+#include <sys/stat.h>
+#include "BinaryProtocol.h"
+#include "ControlTable.h"
+#include "Controller.h"
+#include "ControllerState.h"
+#include "Coroutine.h"
+#include "CppadThreads.h"
+#include "DelayedSend.h"
+#include "FleetHash.h"
+#include "Handoff.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "PathSpline.h"
+#include "RealtimeMemory.h"
+#include "ShmChannel.h"
+#include "SolveRpc.h"
+#include "SteerMessage.h"
+#include "TelemetryCapture.h"
+#include "TelemetryParser.h"
+#include "Trace.h"
+#include "Track.h"
+#include "WorkerPool.h"
 
-// for convenience
-using json = nlohmann::json;
+// Bytes of heap allocated through operator new minus those freed on the
+// calling thread, and the most that has been since UsageScope last reset
+// it. Memory may be freed on another thread than it was allocated on, so
+// only differences over a scope mean anything.
+static thread_local int64_t thread_heap = 0;
+static thread_local int64_t thread_heap_peak = 0;
 
-// For converting back and forth between radians and degrees.
-constexpr double pi() { return M_PI; }
-double deg2rad(double x) { return x * pi() / 180; }
-double rad2deg(double x) { return x * 180 / pi(); }
-
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-string hasData(string s) {
-    auto found_null = s.find("null");
-    auto b1 = s.find_first_of("[");
-    auto b2 = s.rfind("}]");
-    if (found_null != string::npos) {
-        return "";
-    } else if (b1 != string::npos && b2 != string::npos) {
-        return s.substr(b1, b2 - b1 + 2);
+void *operator new(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw bad_alloc();
     }
-    return "";
+    thread_heap += malloc_usable_size(p);
+    thread_heap_peak = max(thread_heap_peak, thread_heap);
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
 }
 
-// Evaluate a polynomial.
-double polyeval(Eigen::VectorXd coeffs, double x) {
-    double result = 0.0;
-    for (int i = 0; i < coeffs.size(); i++) {
-        result += coeffs[i] * pow(x, i);
+void operator delete(void *p) noexcept {
+    if (p) {
+        thread_heap -= malloc_usable_size(p);
+        free(p);
     }
-    return result;
 }
 
-// Fit a polynomial.
-// Adapted from
-// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
-Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
-                        int order) {
-    assert(xvals.size() == yvals.size());
-    assert(order >= 1 && order <= xvals.size() - 1);
-    Eigen::MatrixXd A(xvals.size(), order + 1);
+void operator delete[](void *p) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+// What a connection costs, for /metrics and MPC_ADMISSION: the CPU time of
+// the threads solving its frames while they do, the bytes of the messages
+// it sent and was sent, the heap its solves allocated and kept, the most
+// of it at any time and the tape of its horizon, see TapeStats. Updated by
+// its loop and its worker, read from any loop.
+//
+// The heap counts what goes through operator new, IPOPT's and CppAD's
+// included, not what C code mallocs. It grows from when the connection
+// takes its controller: those of MPC_PREWARM and of MPC_POOL come with
+// what pre-warming or the connections before allocated on top.
+struct Usage {
+    Counter cpu_ns;
+    Counter bytes_in;
+    Counter bytes_out;
+    atomic<int64_t> heap;
+    atomic<int64_t> heap_peak;
+    atomic<uint64_t> tape_bytes;
+    // Cores kept busy, the smoothed CPU time of a frame over the interval
+    // between frames.
+    atomic<double> load;
     
-    for (int i = 0; i < xvals.size(); i++) {
-        A(i, 0) = 1.0;
+    Usage() : heap(0), heap_peak(0), tape_bytes(0), load(0) {}
+};
+
+static uint64_t threadCpuNs() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Charges the CPU time and the heap of the calling thread over its scope
+// to a Usage, and adds the CPU time to `spent` as well.
+class UsageScope {
+public:
+    UsageScope(Usage &usage, uint64_t &spent) : usage(usage), spent(spent), cpu(threadCpuNs()), heap(thread_heap) {
+        thread_heap_peak = thread_heap;
     }
     
-    for (int j = 0; j < xvals.size(); j++) {
-        for (int i = 0; i < order; i++) {
-            A(j, i + 1) = A(j, i) * xvals(j);
+    ~UsageScope() {
+        uint64_t elapsed = threadCpuNs() - cpu;
+        spent += elapsed;
+        usage.cpu_ns.add(elapsed);
+        int64_t before = usage.heap.fetch_add(thread_heap - heap, memory_order_relaxed);
+        int64_t peak = before + thread_heap_peak - heap;
+        int64_t highest = usage.heap_peak.load(memory_order_relaxed);
+        while (peak > highest && !usage.heap_peak.compare_exchange_weak(highest, peak, memory_order_relaxed)) {
         }
     }
     
-    auto Q = A.householderQr();
-    auto result = Q.solve(yvals);
-    return result;
-}
+private:
+    Usage &usage;
+    uint64_t &spent;
+    uint64_t cpu;
+    int64_t heap;
+};
+
+// Connections of one configuration, see MPC_CANARY, aggregated for
+// /metrics: how many are connected, the time from the arrival of each
+// frame to its reply being queued, and the errors of the states solved
+// for, |cte| in mm and |epsi| in mrad.
+struct Cohort {
+    const char *name;
+    atomic<unsigned> connections;
+    Histogram latency;
+    Histogram cte;
+    Histogram epsi;
+    
+    explicit Cohort(const char *name) : name(name), connections(0) {}
+};
 
-Eigen::MatrixXd convertToCoordinates(double x, double y, double psi, const vector<double> & ptsx, const vector<double> & ptsy) {
+// One event loop of the server, see MPC_LOOPS: its hub, the workers whose
+// completions it runs and its delayed replies. A connection stays on the
+// loop that accepted it.
+struct EventLoop {
+    explicit EventLoop(int extensions) : hub(extensions) {}
+    
+    uWS::Hub hub;
+    unique_ptr<WorkerPool> pool;
+    unique_ptr<DelayedSend> delayed;
+    // CPU the loop thread is pinned to, -1 for none.
+    int cpu = -1;
+    // Raised by the successor of MPC_HANDOFF, see Handoff.
+    uv_async_t release;
+};
+
+// Controllers prepared ahead of the connections that take them, see
+// MPC_PREWARM, and the configuration of MPC_CONFIG they are set up with.
+// The controllers of closed connections come back to it reset, up to
+// `capacity`, see recycle(), so the next connection takes over their
+// IPOPT applications, tapes and scratch already built.
+// Every reload of the file replaces all of them at once with controllers
+// of the new configuration and bumps `generation`, see upgrade(). All but
+// `generation` is under `lock`.
+struct WarmPool {
+    mutex lock;
+    vector<unique_ptr<Controller> > controllers;
+    // The NUMA node each of `controllers` was prepared on, see MPC_NUMA;
+    // -1 for none in particular.
+    vector<int> nodes;
+    size_t capacity = 0;
+    ControllerVariant config;
+    atomic<unsigned> generation;
+    // Controllers given up by their sessions for ones of a newer
+    // generation, destroyed on the reload thread rather than a loop thread.
+    vector<unique_ptr<Controller> > retired;
+    
+    WarmPool() : generation(0) {}
     
-    assert(ptsx.size() == ptsy.size());
-    unsigned len = ptsx.size();
+    ControllerVariant current() {
+        lock_guard<mutex> hold(lock);
+        return config;
+    }
     
-    auto pathpoints = Eigen::MatrixXd(2,len);
+    // A controller of the pool, the newest prepared on `node` if any; null
+    // if the pool is empty. The caller holds `lock`.
+    unique_ptr<Controller> take(int node) {
+        if (controllers.empty()) {
+            return nullptr;
+        }
+        size_t i = controllers.size() - 1;
+        for (size_t k = controllers.size(); k-- > 0;) {
+            if (nodes[k] == node) {
+                i = k;
+                break;
+            }
+        }
+        unique_ptr<Controller> controller = std::move(controllers[i]);
+        controllers.erase(controllers.begin() + i);
+        nodes.erase(nodes.begin() + i);
+        return controller;
+    }
     
-    for (auto i=0; i<len ; ++i) {
-        double dx = ptsx[i] - x;
-        double dy = ptsy[i] - y;
+    // Add `controller`, prepared on `node`. The caller holds `lock`.
+    void give(unique_ptr<Controller> controller, int node) {
+        controllers.push_back(std::move(controller));
+        nodes.push_back(node);
+    }
+};
+
+// The vehicles of MPC_FLEET driving one track, see Controller::setFleet:
+// their plans, rehashed every control period, and how far apart they keep.
+struct Fleet {
+    unique_ptr<FleetHash> hash;
+    double radius = 0;
+    double weight = 0;
+};
+
+// Admission control and load shedding of MPC_ADMISSION: the cores the
+// connections may keep busy solving and the heap they may hold, 0 for no
+// limit, and where refused connections are sent, if anywhere. While the
+// load is beyond the cores, shed() strips the lines of every reply first,
+// `shed_lines`, and then caps the tiers of the vehicles of the lowest
+// ?priority, see Session::tier_cap, one step a second, until it is back
+// under; below restore_load of the cores it undoes that in reverse.
+struct Admission {
+    double cores = 0;
+    unsigned long mb = 0;
+    string redirect;
+    atomic<bool> shed_lines;
+    
+    Admission() : shed_lines(false) {}
+};
+
+// Fraction of MPC_ADMISSION's cores below which what was shed comes back,
+// so the load settles between it and the limit rather than flapping.
+static const double restore_load = 0.8;
+
+// The solvers of the /rpc connections of every loop, see SolveRpc.h: MPCs
+// set up like those of the controllers, each taken by a request for its
+// solve and given back after, so the requests reuse their IPOPT
+// applications, tapes and scratch rather than build them anew.
+struct RpcContexts {
+    mutex lock;
+    vector<unique_ptr<MPC> > idle;
+    
+    unique_ptr<MPC> take() {
+        {
+            lock_guard<mutex> hold(lock);
+            if (!idle.empty()) {
+                unique_ptr<MPC> mpc = std::move(idle.back());
+                idle.pop_back();
+                return mpc;
+            }
+        }
+        unique_ptr<MPC> mpc(new MPC);
+        mpc->setWarmStart(true);
+        configureMpc(*mpc);
+        return mpc;
+    }
+    
+    void give(unique_ptr<MPC> mpc) {
+        lock_guard<mutex> hold(lock);
+        idle.push_back(std::move(mpc));
+    }
+};
+
+// A request of an /rpc connection being solved, and its answer.
+struct RpcJob {
+    RpcRequest request;
+    vector<Solution> solutions;
+    vector<SolveStats> stats;
+    string reply;
+};
+
+// Requests of an /rpc connection that wait for one of its solves in flight
+// to complete, beyond which it is answered RPC_BUSY.
+static const size_t max_rpc_waiting = 256;
+
+// Server side state of one simulator connection.
+//
+// A frame goes through three stages on two threads: the loop thread
+// decodes it and prepares its problem, see Controller::prepare, a worker
+// solves it and writes the reply, and the loop thread sends that once the
+// latency has passed, see DelayedSend. So the transform and the fit of a
+// frame overlap with the solve of the one before.
+//
+// Everything except `controller`, `current` and `reply` is only touched on
+// the loop thread. The controller is handed to a worker for one frame at a
+// time, by the flow of the connection, see resume(); a frame prepared
+// while it is busy replaces any frame already waiting, so a slow solve
+// never builds up a backlog of stale telemetry. Every frame replaced that
+// way is counted, see Metrics::recordDrop. With MPC_SPECULATE, a worker
+// left idle after a reply solves ahead for the frame expected next, see
+// Controller::speculate, and stays busy until then, or until a frame
+// arrives off the prediction, see Controller::abandonSpeculation. With
+// MPC_ACTUATION_HZ, a timer of the loop thread sends the actuations of the
+// last reply's plan between replies, at that rate.
+//
+// Frames are prepared into `next` and swapped with `current`, so they
+// keep their storage from cycle to cycle.
+struct Session {
+    uWS::WebSocket<uWS::SERVER> ws;
+    unique_ptr<Controller> controller;
+    Cohort *cohort = nullptr;
+    bool closed = false;
+    bool busy = false;
+    bool has_next = false;
+    // Where the flow of the connection is, see resume().
+    Coroutine flow;
+    // Connected to /binary, see BinaryProtocol.h.
+    bool binary = false;
+    // Connected with ?lockstep=<ms>: the simulator advances only once it
+    // has the reply to a frame and applies it `ms` later in its own time,
+    // 100 by default. So every frame is solved, its reply goes out at once
+    // rather than after the latency, and the delay predicted over is that
+    // of the simulator, see configureLockstep.
+    bool lockstep = false;
+    // A "visualize" event came since the last frame was handed to the
+    // controller, see Controller::requestVisualization.
+    bool visualize = false;
+    // Bytes buffered for the socket beyond which replies go out without
+    // their lines, see MPC_BACKPRESSURE; 0 never strips them.
+    size_t shed_lines = 0;
+    // The worker solving every frame of this connection, see
+    // WorkerPool::assign, and its NUMA node, -1 without MPC_NUMA.
+    size_t worker = 0;
+    int node = -1;
+    // Snapshot of the controller in the state file, see MPC_STATE, and
+    // its slot there; -1 without one.
+    StateStore *store = nullptr;
+    int slot = -1;
+    // The pool of the controller and the generation of its configuration,
+    // and what the connection asked for over that configuration: its URL
+    // and the variant of its cohort, null for the control, see
+    // configureSession.
+    WarmPool *warm = nullptr;
+    unsigned generation = 0;
+    string url;
+    const ControllerVariant *variant = nullptr;
+    // The connection asked for more than the configuration of the pool, so
+    // its controller does not go back there, and the horizon it started
+    // on.
+    bool customized = false;
+    size_t horizon = 0;
+    // The fleet the connection drives in, see MPC_FLEET; null for none.
+    const Fleet *fleet = nullptr;
+    // Load shedding, see Admission: its ?priority, higher shed last, 0 by
+    // default; the best tier its controller may answer at, applied before
+    // every solve, see Controller::setTierCap; and its load before it was
+    // first capped, which it takes again once restored. Null admission
+    // without MPC_ADMISSION.
+    Admission *admission = nullptr;
+    int priority = 0;
+    atomic<int> tier_cap;
+    double shed_load = 0;
+    // Connected to /rpc, see SolveRpc.h, with no controller: where its
+    // requests are solved, those being solved, at most one per worker of
+    // its loop, and those waiting for one of them to complete.
+    RpcContexts *rpc = nullptr;
+    size_t rpc_in_flight = 0;
+    deque<RpcRequest> rpc_waiting;
+    // Number of the connection since the start, and the time from the
+    // arrival of each frame to its reply being queued, for /metrics.
+    unsigned id = 0;
+    Histogram latency;
+    // What it costs, and the CPU time spent on it since the last reply, in
+    // ns, speculation included.
+    Usage usage;
+    uint64_t solve_cpu_ns = 0;
+    // Solve ahead between frames, see MPC_SPECULATE, expecting them at the
+    // smoothed interval of those so far, in seconds; 0 before the second.
+    bool speculate = false;
+    double period = 0;
+    // Cancel a solve overtaken by a newer frame, see MPC_PREEMPT.
+    bool preempt = false;
+    chrono::steady_clock::time_point last_arrival;
+    // Smoothed time from the arrival of a frame until its reply is sent,
+    // in seconds, predicted over for the next frames, see
+    // MPC_MEASURED_DELAY; the nominal delay until the first reply.
+    bool measure_delay = false;
+    double delay = actuation_delay_ms / 1000.0;
+    bool has_delay = false;
+    // Actuation between replies, see MPC_ACTUATION_HZ: the timer and its
+    // period in ms, the plan of the last reply, the ticks since it and
+    // the message of the last one. No timer without it.
+    uv_timer_t *ticker = nullptr;
+    uint64_t tick_ms = 0;
+    DelayedSend *delayed = nullptr;
+    ActuationPlan plan;
+    size_t ticks = 0;
+    string tick_reply;
+    Telemetry telemetry;
+    ControlFrame current;
+    ControlFrame next;
+    string reply;
+    // The lines of the reply, sent after it, see ?split.
+    string lines_reply;
+    // Migration to another node, see ControllerContext: the router asked
+    // for the context of the controller, sent once it is idle; and the
+    // context another node sent, taken up before the next solve.
+    bool export_requested = false;
+    unique_ptr<ControllerContext> migration;
+    
+    Session(uWS::WebSocket<uWS::SERVER> ws, unique_ptr<Controller> controller)
+        : ws(ws), controller(std::move(controller)), tier_cap(TIER_FULL) {
+        live++;
+    }
+    
+    ~Session() { live--; }
+    
+    // Sessions not destroyed yet, closed ones whose jobs still run
+    // included, which MPC_HANDOFF waits for.
+    static atomic<size_t> live;
+};
+
+atomic<size_t> Session::live(0);
+
+// Give the slot of the session in the state file back once no solve of it
+// can write there anymore.
+static void releaseSlot(Session &session) {
+    if (session.slot >= 0) {
+        session.store->release(session.slot);
+        session.slot = -1;
+    }
+}
+
+// Hand the controller of `session`, closed and idle, back to its pool for
+// the next connection, reset to the horizon it started on, unless the
+// connection customized it, the pool is of a newer configuration by now
+// or full. It is destroyed with the session otherwise.
+static void recycle(Session &session) {
+    WarmPool &warm = *session.warm;
+    if (!session.controller || session.customized) {
+        return;
+    }
+    session.controller->reset();
+    session.controller->setFleet(nullptr, 0, 0, 0);
+    session.controller->setTierCap(TIER_FULL);
+    if (session.controller->getHorizon() != session.horizon) {
+        session.controller->setHorizon(session.horizon);
+    }
+    lock_guard<mutex> hold(warm.lock);
+    if (warm.generation.load(memory_order_relaxed) == session.generation &&
+        warm.controllers.size() < warm.capacity) {
+        warm.give(std::move(session.controller), session.node);
+    }
+}
+
+// What is left once `session` is closed and no solve of it runs anymore.
+static void closeSession(Session &session) {
+    if (session.fleet) {
+        session.fleet->hash->retire(session.id);
+    }
+    releaseSlot(session);
+    recycle(session);
+}
+
+// Queue the actuations of the plan of the last reply for the tick due
+// now, until the plan runs out. They go out with the latency of the
+// replies, so they take effect as far apart from the reply as planned.
+static void onTick(uv_timer_t *timer) {
+    Session &session = *(Session *) timer->data;
+    session.ticks++;
+    double steering, throttle;
+    if (session.closed || !session.plan.at(session.ticks * session.tick_ms * 1e-3, steering, throttle)) {
+        uv_timer_stop(timer);
+        return;
+    }
+    StridedView none(nullptr, 0);
+    if (session.binary) {
+        writeSteerBinary(session.tick_reply, steering, throttle, none, none, none, none);
+        session.delayed->send(session.ws, session.tick_reply, uWS::OpCode::BINARY);
+    } else {
+        writeSteer(session.tick_reply, steering, throttle, none, none, none, none,
+                   session.controller->steerPrecision());
+        session.delayed->send(session.ws, session.tick_reply);
+    }
+    session.usage.bytes_out.add(session.tick_reply.size());
+}
+
+// Weight of the newest sample in Session::delay.
+static const double delay_smoothing = 0.2;
+
+// Queue session.reply, the answer to session.current. The controller is
+// idle meanwhile.
+static void sendReply(Session &session, DelayedSend &delayed) {
+    auto elapsed = chrono::steady_clock::now() - session.current.arrival;
+    session.latency.record(chrono::duration_cast<chrono::microseconds>(elapsed).count());
+    session.cohort->latency.record(chrono::duration_cast<chrono::microseconds>(elapsed).count());
+    session.cohort->cte.record(llround(fabs(session.current.state[4]) * 1e3));
+    session.cohort->epsi.record(llround(fabs(session.current.state[5]) * 1e3));
+    if (session.measure_delay && !session.lockstep) {
+        double sample = chrono::duration<double>(elapsed).count() + delayed.delay() / 1000.0;
+        session.delay = session.has_delay ? session.delay + delay_smoothing * (sample - session.delay) : sample;
+        session.has_delay = true;
+    }
+    if ((session.shed_lines > 0 && delayed.buffered(session.ws) > session.shed_lines) ||
+        (session.admission && session.admission->shed_lines.load(memory_order_relaxed))) {
+        size_t removed = session.binary ? stripSteerBinaryLines(session.reply) : stripSteerLines(session.reply);
+        if (removed > 0) {
+            Metrics::recordShed(SHED_VISUALIZATION, removed);
+        }
+    }
+    if (session.lockstep) {
+        if (!session.binary) {
+            MPC_LOG_PAYLOAD(session.reply.data(), session.reply.length());
+        }
+        session.ws.send(session.reply.data(), session.reply.size(),
+                        session.binary ? uWS::OpCode::BINARY : uWS::OpCode::TEXT);
+    } else if (session.binary) {
+        delayed.send(session.ws, session.reply, uWS::OpCode::BINARY);
+    } else {
+        MPC_LOG_PAYLOAD(session.reply.data(), session.reply.length());
+        delayed.send(session.ws, session.reply);
+    }
+    session.usage.bytes_out.add(session.reply.size());
+    if (session.ticker) {
+        session.controller->actuationPlan(session.plan);
+        session.ticks = 0;
+        uv_timer_start(session.ticker, onTick, session.tick_ms, session.tick_ms);
+    }
+}
+
+// Queue the lines session.reply left out, if it did, see ?split; dropped
+// like the lines of a reply while the connection is backed up.
+static void sendVisualization(Session &session, DelayedSend &delayed) {
+    if (!session.controller->writeVisualization(session.current, session.lines_reply)) {
+        return;
+    }
+    if ((session.shed_lines > 0 && delayed.buffered(session.ws) > session.shed_lines) ||
+        (session.admission && session.admission->shed_lines.load(memory_order_relaxed))) {
+        Metrics::recordShed(SHED_VISUALIZATION, session.lines_reply.size());
+        return;
+    }
+    uWS::OpCode opcode = session.binary ? uWS::OpCode::BINARY : uWS::OpCode::TEXT;
+    if (session.lockstep) {
+        session.ws.send(session.lines_reply.data(), session.lines_reply.size(), opcode);
+    } else {
+        delayed.send(session.ws, session.lines_reply, opcode);
+    }
+    session.usage.bytes_out.add(session.lines_reply.size());
+}
+
+// Time a reply is due after its frame, in s, until the period of the
+// connection is known.
+static const double default_reply_period = 0.1;
+
+// Weight of the newest interval in Session::period, and of the newest
+// frame in Usage::load.
+static const double period_smoothing = 0.2;
+
+// Fold the CPU time of the frame just solved for `session` into its load.
+static void updateLoad(Session &session) {
+    if (session.period > 0) {
+        double load = session.usage.load.load(memory_order_relaxed);
+        load += period_smoothing * (session.solve_cpu_ns * 1e-9 / session.period - load);
+        session.usage.load.store(load, memory_order_relaxed);
+    }
+    session.solve_cpu_ns = 0;
+}
+
+static void upgrade(Session &session);
+
+// Answer the router's request for the context of the controller of
+// `session`, idle, with the period and delay measured so far.
+static void sendContext(Session &session) {
+    ControllerContext context;
+    session.controller->exportContext(context);
+    context.period = session.period;
+    context.has_delay = session.has_delay;
+    context.delay = session.delay;
+    string message;
+    encodeContext(context, message);
+    session.ws.send(message.data(), message.size(), uWS::OpCode::BINARY);
+    session.usage.bytes_out.add(message.size());
+}
+
+// Take up the context another node sent, once the controller is idle and
+// of the current configuration.
+static void takeContext(Session &session) {
+    if (session.controller->importContext(*session.migration)) {
+        MPC_LOG(LOG_INFO, "Connection %u resumed the controller of another node", session.id);
+    } else {
+        MPC_LOG(LOG_WARN, "Connection %u starts cold, the context sent is of no use", session.id);
+    }
+    session.migration.reset();
+}
+
+// The time by which the reply to session->current is due: the arrival of
+// the next frame, a period after it, or default_reply_period after it
+// while the period is not known yet.
+static WorkerPool::Time replyDeadline(const Session &session) {
+    double period = session.period > 0 ? session.period : default_reply_period;
+    return session.current.arrival + chrono::duration_cast<chrono::steady_clock::duration>(
+                                         chrono::duration<double>(period));
+}
+
+static void resume(shared_ptr<Session> session, WorkerPool &pool, DelayedSend &delayed);
+
+// Post the solve of session->current to the worker of the session, then
+// the speculation after it, resuming the flow once done; false if the
+// worker is saturated. The jobs keep the session alive even if the socket
+// goes away meanwhile.
+static bool postSolve(shared_ptr<Session> session, WorkerPool &pool, DelayedSend &delayed, bool visualize) {
+    return pool.post(session->worker, [session, visualize] {
+        UsageScope usage(session->usage, session->solve_cpu_ns);
+        if (visualize) {
+            session->controller->requestVisualization();
+        }
+        session->controller->setTierCap((ControlTier) session->tier_cap.load(memory_order_relaxed));
+        session->controller->solve(session->current, session->reply);
+        if (session->slot >= 0) {
+            session->controller->snapshot((*session->store)[session->slot]);
+        }
+        session->usage.tape_bytes.store(session->controller->tapeStats().bytes, memory_order_relaxed);
+    }, [session, &pool, &delayed] {
+        session->busy = false;
+        if (session->closed) {
+            closeSession(*session);
+            return;
+        }
+        resume(session, pool, delayed);
+    }, JOB_CONTROL, replyDeadline(*session));
+}
+
+static bool postSpeculation(shared_ptr<Session> session, WorkerPool &pool, DelayedSend &delayed) {
+    return pool.post(session->worker, [session] {
+        UsageScope usage(session->usage, session->solve_cpu_ns);
+        session->controller->speculate(session->current, session->period);
+    }, [session, &pool, &delayed] {
+        session->busy = false;
+        if (session->closed) {
+            closeSession(*session);
+            return;
+        }
+        resume(session, pool, delayed);
+    }, JOB_BACKGROUND);
+}
+
+// The flow of a connection, a coroutine on its loop thread, see
+// Coroutine.h: await a frame in session->next, solve it on the worker of
+// the session and await that, queue the reply, then, while no frame is
+// waiting, solve ahead and await that too, see MPC_SPECULATE. Every frame
+// that arrives and every job that completes resumes it; while a job runs
+// it stays where it is. The replies go out after the latency, and the
+// actuations between them, on timers of their own.
+static void resume(shared_ptr<Session> session, WorkerPool &pool, DelayedSend &delayed) {
+    Session &s = *session;
+    if (s.busy) {
+        return;
+    }
+    if (s.export_requested) {
+        s.export_requested = false;
+        sendContext(s);
+    }
+    MPC_CORO_BEGIN(s.flow);
+    for (;;) {
+        while (!s.has_next) {
+            MPC_CORO_AWAIT(s.flow);
+        }
+        upgrade(s);
+        if (s.migration) {
+            takeContext(s);
+        }
+        swap(s.current, s.next);
+        s.has_next = false;
+        s.busy = postSolve(session, pool, delayed, s.visualize);
+        if (s.busy) {
+            s.visualize = false;
+            MPC_CORO_AWAIT(s.flow);
+        } else {
+            // The solver of the session is saturated, so this frame is not
+            // solved but answered by the predictor or the LQR of the
+            // controller, idle meanwhile.
+            Metrics::recordDrop(DROP_SATURATED);
+            UsageScope usage(s.usage, s.solve_cpu_ns);
+            if (s.visualize) {
+                s.controller->requestVisualization();
+            }
+            s.visualize = false;
+            s.controller->solveFast(s.current, s.reply);
+        }
+        updateLoad(s);
+        sendReply(s, delayed);
+        sendVisualization(s, delayed);
         
-        pathpoints(0,i) =   cos(psi) * dx + sin(psi) * dy;
-        pathpoints(1,i) =  -sin(psi) * dx + cos(psi) * dy;
+        // The frame arriving meanwhile waits for the speculation.
+        s.busy = s.speculate && !s.has_next && s.period > 0 && postSpeculation(session, pool, delayed);
+        if (s.busy) {
+            MPC_CORO_AWAIT(s.flow);
+        }
+    }
+    MPC_CORO_END(s.flow);
+}
+
+// Send the error `code` to request `id` of an /rpc connection.
+static void rejectRpc(Session &session, uint32_t id, RpcError code) {
+    string reply;
+    writeRpcError(reply, id, code);
+    session.ws.send(reply.data(), reply.size(), uWS::OpCode::BINARY);
+    session.usage.bytes_out.add(reply.size());
+}
+
+// Post the requests waiting on the /rpc connection of `session` to any
+// worker while it has fewer in flight than there are workers, so the
+// requests a client pipelines are solved side by side. Each reply goes
+// out as soon as it is solved, without the latency of the steer replies.
+static void postRpc(shared_ptr<Session> session, WorkerPool &pool) {
+    Session &s = *session;
+    while (!s.closed && !s.rpc_waiting.empty() && s.rpc_in_flight < pool.size()) {
+        shared_ptr<RpcJob> job = make_shared<RpcJob>();
+        swap(job->request, s.rpc_waiting.front());
+        s.rpc_waiting.pop_front();
+        bool posted = pool.post([session, job] {
+            uint64_t spent = 0;
+            UsageScope usage(session->usage, spent);
+            unique_ptr<MPC> mpc = session->rpc->take();
+            solveRpc(*mpc, job->request, job->solutions, job->stats);
+            session->rpc->give(std::move(mpc));
+            writeRpcReply(job->reply, job->request, job->solutions, job->stats);
+        }, [session, job, &pool] {
+            session->rpc_in_flight--;
+            if (session->closed) {
+                return;
+            }
+            session->ws.send(job->reply.data(), job->reply.size(), uWS::OpCode::BINARY);
+            session->usage.bytes_out.add(job->reply.size());
+            postRpc(session, pool);
+        });
+        if (!posted) {
+            rejectRpc(s, job->request.id, RPC_BUSY);
+            continue;
+        }
+        s.rpc_in_flight++;
+    }
+    if (s.closed) {
+        s.rpc_waiting.clear();
+    }
+}
+
+// Comma separated list of CPUs, e.g. "2,3,4". Returns false on anything
+// else.
+static bool parseCpus(const char *s, vector<int> &cpus) {
+    cpus.clear();
+    while (*s) {
+        char *end;
+        long cpu = strtol(s, &end, 10);
+        if (end == s || cpu < 0 || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        cpus.push_back((int) cpu);
+        s = *end ? end + 1 : end;
+    }
+    return !cpus.empty();
+}
+
+// The value of `key` in the query of `url`, e.g. "rti" for "solver" in
+// "/binary?solver=rti"; empty if it has none.
+static string queryValue(const string &url, const string &key) {
+    size_t at = url.find('?');
+    while (at != string::npos) {
+        size_t end = url.find('&', at + 1);
+        string pair = url.substr(at + 1, end == string::npos ? string::npos : end - at - 1);
+        if (pair.compare(0, key.size() + 1, key + "=") == 0) {
+            return pair.substr(key.size() + 1);
+        }
+        at = end;
+    }
+    return string();
+}
+
+// Set up the controller of `session` as the connection asked for, over
+// the configuration it was created with: the wire format of /binary, the
+// solver of ?solver, the lines of ?visualize and the canary's variant.
+static void configureSession(Session &session) {
+    const string &url = session.url;
+    if (session.binary) {
+        session.controller->setWireFormat(WIRE_BINARY);
+    }
+    
+    // ?solver=<name> overrides MPC_SOLVER for this connection.
+    string solver = queryValue(url, "solver");
+    SolverBackend backend;
+    if (!solver.empty() && parseBackend(solver, backend)) {
+        session.controller->setBackend(backend);
+    } else if (!solver.empty()) {
+        MPC_LOG(LOG_WARN, "Unknown solver %s, keeping %s", solver.c_str(),
+                backendName(session.controller->getBackend()));
+    }
+    
+    // ?visualize=<period> draws the lines in every period-th reply only,
+    // 0 in none, and ?visualize=demand in those following a
+    // "visualize" event only, see Controller::setVisualization.
+    string visualize = queryValue(url, "visualize");
+    if (visualize == "demand") {
+        session.controller->setVisualization(0);
+    } else if (!visualize.empty()) {
+        session.controller->setVisualization(strtoul(visualize.c_str(), nullptr, 10));
     }
     
-    return pathpoints;
+    // ?split=1 sends the lines in a message after the actuations, see
+    // Controller::setSplitVisualization.
+    string split = queryValue(url, "split");
+    if (!split.empty()) {
+        session.controller->setSplitVisualization(split != "0");
+    }
+    
+    if (session.variant && !session.controller->configure(*session.variant)) {
+        MPC_LOG(LOG_WARN, "No horizon of %zu stages, keeping %zu", session.variant->horizon,
+                session.controller->getHorizon());
+    }
+    session.customized = session.binary || !solver.empty() || !visualize.empty() || !split.empty() ||
+                         session.variant;
+    if (session.fleet) {
+        session.controller->setFleet(session.fleet->hash.get(), session.id, session.fleet->radius,
+                                     session.fleet->weight);
+    }
+    session.horizon = session.controller->getHorizon();
 }
 
+// Drive the simulator of `session` in lockstep if its URL asks for it with
+// ?lockstep=<ms>, see Session::lockstep. Nothing else goes on between its
+// frames, so there is no speculation, no preemption on the wall clock and
+// no actuation between replies, and the delay is not measured.
+static void configureLockstep(Session &session) {
+    string lockstep = queryValue(session.url, "lockstep");
+    if (lockstep.empty()) {
+        return;
+    }
+    double delay_ms = atof(lockstep.c_str());
+    session.lockstep = true;
+    session.delay = (delay_ms > 0 ? delay_ms : actuation_delay_ms) / 1000.0;
+    session.speculate = false;
+    session.preempt = false;
+    session.measure_delay = false;
+    if (session.ticker) {
+        uv_close((uv_handle_t *) session.ticker, [](uv_handle_t *handle) {
+            delete (uv_timer_t *) handle;
+        });
+        session.ticker = nullptr;
+    }
+}
+
+// Whether a new connection fits the limits of `admission`, given the
+// load of `sessions`: the cores they keep busy, what the vehicles shed
+// take back once restored, and, for the newcomer, the mean load of a
+// connection so far, must stay within its cores; their heap within its
+// MB. So a connection is only let in when those already in keep their
+// deadlines with it.
+static bool admit(const Admission &admission, const vector<Session *> &sessions, mutex &sessions_lock) {
+    double load = 0, deferred = 0;
+    int64_t heap = 0;
+    size_t loaded = 0;
+    {
+        lock_guard<mutex> hold(sessions_lock);
+        for (Session *session : sessions) {
+            double l = session->usage.load.load(memory_order_relaxed);
+            load += l;
+            loaded += l > 0;
+            if (session->tier_cap.load(memory_order_relaxed) != TIER_FULL) {
+                deferred += max(0.0, session->shed_load - l);
+            }
+            heap += session->usage.heap.load(memory_order_relaxed);
+        }
+    }
+    double projected = load + deferred + (loaded > 0 ? load / loaded : 0.0);
+    if ((admission.cores > 0 && projected > admission.cores) ||
+        (admission.mb > 0 && heap >= (int64_t) (admission.mb << 20))) {
+        MPC_LOG(LOG_WARN, "Refusing a connection: %.2f cores projected, %lld MB in use", projected,
+                (long long) (heap >> 20));
+        return false;
+    }
+    return true;
+}
+
+// One step of the load shedding of `admission`, called once a second, see
+// Admission: the lines of the replies first, then the vehicles of the
+// lowest priority, the newest first, each down to the reduced horizon and
+// then the LQR before the next; and back up in reverse, the highest
+// priority first, while its load fits under restore_load of the cores.
+static void shed(Admission &admission, const vector<Session *> &sessions, mutex &sessions_lock) {
+    lock_guard<mutex> hold(sessions_lock);
+    double load = 0;
+    Session *lowest = nullptr, *highest = nullptr;
+    for (Session *session : sessions) {
+        load += session->usage.load.load(memory_order_relaxed);
+        if (!session->controller) {
+            continue;
+        }
+        int cap = session->tier_cap.load(memory_order_relaxed);
+        if (cap < TIER_LQR && (!lowest || session->priority < lowest->priority ||
+                               (session->priority == lowest->priority && session->id > lowest->id))) {
+            lowest = session;
+        }
+        if (cap != TIER_FULL && (!highest || session->priority > highest->priority ||
+                                 (session->priority == highest->priority && session->id < highest->id))) {
+            highest = session;
+        }
+    }
+    if (load > admission.cores) {
+        if (!admission.shed_lines.load(memory_order_relaxed)) {
+            MPC_LOG(LOG_WARN, "Overloaded at %.2f cores, replies go out without their lines", load);
+            admission.shed_lines.store(true, memory_order_relaxed);
+        } else if (lowest) {
+            int cap = lowest->tier_cap.load(memory_order_relaxed);
+            if (cap == TIER_FULL) {
+                lowest->shed_load = lowest->usage.load.load(memory_order_relaxed);
+            }
+            MPC_LOG(LOG_WARN, "Overloaded at %.2f cores, connection %u (priority %d) down to tier %d", load,
+                    lowest->id, lowest->priority, cap + 1);
+            lowest->tier_cap.store(cap + 1, memory_order_relaxed);
+        }
+    } else if (highest) {
+        double l = highest->usage.load.load(memory_order_relaxed);
+        if (load + max(0.0, highest->shed_load - l) <= restore_load * admission.cores) {
+            int cap = highest->tier_cap.load(memory_order_relaxed) - 1;
+            MPC_LOG(LOG_INFO, "Connection %u (priority %d) back up to tier %d", highest->id, highest->priority,
+                    cap);
+            highest->tier_cap.store(cap, memory_order_relaxed);
+            if (cap == TIER_FULL) {
+                highest->shed_load = 0;
+            }
+        }
+    } else if (admission.shed_lines.load(memory_order_relaxed) && load <= restore_load * admission.cores) {
+        MPC_LOG(LOG_INFO, "Load down to %.2f cores, replies keep their lines again", load);
+        admission.shed_lines.store(false, memory_order_relaxed);
+    }
+}
+
+// Move `session` onto a controller of the newest configuration of
+// MPC_CONFIG if it is on an older one and the pool has one prepared. Only
+// between solves, on the loop thread: the old controller's plan seeds the
+// warm start of the new one, which was warmed on the reload thread, so the
+// car sees no cold solve.
+static void upgrade(Session &session) {
+    WarmPool &warm = *session.warm;
+    if (warm.generation.load(memory_order_relaxed) == session.generation) {
+        return;
+    }
+    unique_ptr<Controller> controller;
+    {
+        lock_guard<mutex> hold(warm.lock);
+        controller = warm.take(session.node);
+        if (!controller) {
+            return;
+        }
+        session.generation = warm.generation;
+    }
+    ControllerSnapshot snapshot;
+    session.controller->snapshot(snapshot);
+    swap(session.controller, controller);
+    configureSession(session);
+    session.controller->restore(snapshot);
+    lock_guard<mutex> hold(warm.lock);
+    warm.retired.push_back(std::move(controller));
+}
+
+// Interval at which the file of MPC_CONFIG is checked for changes.
+static const auto config_poll = chrono::seconds(1);
+
+// Solves run on each controller prepared before listening, see MPC_PREWARM.
+static const size_t default_prewarm_solves = 10;
+
+// Frame `i` of the synthetic drive that pre-warms the controllers: the car
+// at the origin at 30 mph below waypoints bending alternately left, right
+// and not at all, so the solver sees both active and idle steering.
+static void syntheticFrame(size_t i, Telemetry &telemetry) {
+    double bend = 0.002 * ((int) (i % 3) - 1);
+    telemetry.ptsx.clear();
+    telemetry.ptsy.clear();
+    for (int k = 0; k < 6; k++) {
+        double x = 15.0 * k;
+        telemetry.ptsx.push_back(x);
+        telemetry.ptsy.push_back(bend * x * x);
+    }
+    telemetry.x = 0;
+    telemetry.y = 0;
+    telemetry.psi = 0;
+    telemetry.speed = 30;
+    telemetry.steering_angle = 0;
+    telemetry.throttle = 0.3;
+}
+
+// Run `n_solves` frames through `controller`, from the capture if one is
+// open, otherwise synthetic, then forget them. What stays is the state that
+// makes first solves slow: the IPOPT applications and the faulted-in
+// scratch. The tapes stay on this thread, see CppadThreads.h.
+static void prewarm(Controller &controller, size_t n_solves, CaptureReader *frames) {
+    Telemetry telemetry;
+    string reply;
+    for (size_t i = 0; i < n_solves; i++) {
+        if (frames && !frames->next(telemetry)) {
+            frames->rewind();
+            if (!frames->next(telemetry)) {
+                frames = nullptr;
+            }
+        }
+        if (!frames) {
+            syntheticFrame(i, telemetry);
+        }
+        telemetry.arrival = chrono::steady_clock::now();
+        controller.step(telemetry, reply);
+    }
+    controller.reset();
+}
+
+// Prepare `n` controllers of `config` with `newController` into
+// `controllers`, each pre-warmed by `solves` solves, of the capture at
+// `capture_path` if given, see prewarm(). With more than one of
+// `numa_nodes`, every numa_nodes-th from k on is prepared on a thread of
+// its own placed on node k, so its IPOPT application and scratch are
+// allocated where the workers of that node run it, see MPC_NUMA.
+// `nodes` gets the node of each, -1 without.
+template <typename NewController>
+static void prepareControllers(NewController &newController, const ControllerVariant &config, size_t n,
+                               size_t solves, const char *capture_path, int numa_nodes,
+                               vector<unique_ptr<Controller> > &controllers, vector<int> &nodes) {
+    controllers.clear();
+    controllers.resize(n);
+    nodes.assign(n, -1);
+    auto prepare = [&](int node) {
+        if (node >= 0 && !placeThreadOnNode(node, 0)) {
+            MPC_LOG(LOG_WARN, "Cannot place the thread preparing controllers on NUMA node %d", node);
+        }
+        CaptureReader frames;
+        bool has_frames = capture_path && frames.open(capture_path);
+        for (size_t i = node >= 0 ? node : 0; i < n; i += node >= 0 ? numa_nodes : 1) {
+            controllers[i] = newController(config);
+            nodes[i] = node;
+            if (solves > 0) {
+                prewarm(*controllers[i], solves, has_frames ? &frames : nullptr);
+            }
+        }
+    };
+    if (numa_nodes <= 1) {
+        prepare(-1);
+        return;
+    }
+    // CppAD numbers the threads only once told it has several.
+    setupCppadThreads();
+    vector<thread> threads;
+    for (int node = 0; node < numa_nodes; node++) {
+        threads.push_back(thread(prepare, node));
+    }
+    for (thread &t : threads) {
+        t.join();
+    }
+}
+
+// Vehicles whose controllers are kept in the state file.
+static const size_t state_slots = 16;
+
+// Bytes waiting to be written to a socket beyond which its replies lose
+// their lines, and beyond which stale replies are dropped, see
+// MPC_BACKPRESSURE. A few dozen replies each.
+static const size_t default_shed_lines = 16 * 1024;
+static const size_t default_shed_stale = 64 * 1024;
+
+// Stack of the first loop thread faulted in before locking the memory,
+// see MPC_REALTIME. The other threads' stacks are mapped whole.
+static const size_t realtime_stack = 1 << 20;
+
+// How long a successor of MPC_HANDOFF waits for this process to let go,
+// and this process for the solves of its connections to complete.
+static const auto handoff_timeout = chrono::seconds(10);
+static const auto handoff_drain = chrono::seconds(2);
+
 int main() {
-    uWS::Hub h;
-    
-    // MPC is initialized here!
-    MPC mpc = MPC();
-    
-    h.onMessage([&mpc](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
-                       uWS::OpCode opCode) {
-        // "42" at the start of the message means there's a websocket message event.
-        // The 4 signifies a websocket message
-        // The 2 signifies a websocket event
-        string sdata = string(data).substr(0, length);
-        cout << sdata << endl;
-        if (sdata.size() > 2 && sdata[0] == '4' && sdata[1] == '2') {
-            string s = hasData(sdata);
-            if (s != "") {
-                auto j = json::parse(s);
-                string event = j[0].get<string>();
-                if (event == "telemetry") {
-                    // j[1] is the data JSON object
-                    vector<double> ptsx = j[1]["ptsx"];
-                    vector<double> ptsy = j[1]["ptsy"];
-                    double px = j[1]["x"];
-                    double py = j[1]["y"];
-                    double psi = j[1]["psi"];
-                    double v = j[1]["speed"];
-                    v = v * 0.447;
-                    double steering_angle = j[1]["steering_angle"];
-                    double throttle = j[1]["throttle"];
-                    
-                    // convert from flobal/map coordinates to vehicles coordinates
-                    Eigen::MatrixXd pathpoints = convertToCoordinates(px, py, psi, ptsx, ptsy);
-                    Eigen::VectorXd xvals = pathpoints.row(0);
-                    Eigen::VectorXd yvals = pathpoints.row(1);
-                    
-                    auto coeffs = polyfit(xvals, yvals, 3);
-                    
-                    // calculate the cross track error
-                    double cte = polyeval(coeffs, 0);
-                    
-                    // calculate the orientation error
-                    double epsi = -atan(coeffs[1]);
-                    
-                    double dt = mpc.getTimeInterval();
-                    double Lf = 2.67;
-                    
-                    // use kinematic model to predict the state in time interval dt.
-                    double px_actual = 0.0 + v * dt;
-                    double py_actual = 0.0;
-                    double psi_actual = 0.0 - v * (steering_angle) * dt / Lf;
-                    double v_actual = v + throttle * dt;
-                    double cte_actual = cte + v * sin(epsi) * dt;
-                    double epsi_actual = epsi + psi_actual;
-                    
-                    // state in vehicle coordinates
-                    Eigen::VectorXd state(6);
-                    state << px_actual, py_actual, psi_actual, v_actual, cte_actual, epsi_actual;
-                    
-                    // Calculate steering angle and throttle using MPC. Both are in between [-1, 1].
-                    auto solution = mpc.Solve(state, coeffs);
-                    
-                    double steer_value = solution[6];
-                    double throttle_value = solution[7];
-                    
-                    json msgJson;
-                    // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
-                    // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
-                    steer_value = steer_value/deg2rad(25);
-                    
-                    msgJson["steering_angle"] = -steer_value;
-                    msgJson["throttle"] = throttle_value;
-                    
-                    //Display the MPC predicted trajectory
-                    vector<double> mpc_x_vals = mpc.mpc_x;
-                    vector<double> mpc_y_vals = mpc.mpc_y;
-                    
-                    mpc_x_vals.push_back(solution[0]);
-                    mpc_y_vals.push_back(solution[1]);
-                    
-                    //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-                    // the points in the simulator are connected by a Green line
-                    
-                    msgJson["mpc_x"] = mpc_x_vals;
-                    msgJson["mpc_y"] = mpc_y_vals;
-                    
-                    //Display the waypoints/reference line
-                    vector<double> next_x_vals;
-                    vector<double> next_y_vals;
-                    
-                    for(int i = 0; i<ptsx.size();i++){
-                        next_x_vals.push_back(xvals[i]);
-                        next_y_vals.push_back(yvals[i]);
-                    }
-                    
-                    //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-                    // the points in the simulator are connected by a Yellow line
-                    
-                    msgJson["next_x"] = next_x_vals;
-                    msgJson["next_y"] = next_y_vals;
-                    
-                    
-                    auto msg = "42[\"steer\"," + msgJson.dump() + "]";
-                    std::cout << msg << std::endl;
-                    // Latency
-                    // The purpose is to mimic real driving conditions where
-                    // the car does actuate the commands instantly.
-                    //
-                    // Feel free to play around with this value but should be to drive
-                    // around the track with 100ms latency.
-                    //
-                    // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
-                    // SUBMITTING.
-                    this_thread::sleep_for(chrono::milliseconds(100));
-                    ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+    // MPC_REALTIME=<connections>[:<MB>] serves up to that many connections
+    // without a page fault once listening. The allocator keeps whatever it
+    // faulted in and starts with that much heap faulted in, 64 MB by
+    // default, see reserveHeap. A controller per connection is pre-warmed,
+    // see MPC_PREWARM, and every page is locked in before listening, see
+    // lockMemory. MPC_HUGE_PAGES=1 also backs the heap with huge pages. It
+    // comes first, before any other thread allocates.
+    size_t realtime_connections = 0;
+    if (const char *s = getenv("MPC_REALTIME")) {
+        RealtimeOptions realtime;
+        unsigned long connections = 0, mb = realtime.heap_bytes >> 20;
+        sscanf(s, "%lu:%lu", &connections, &mb);
+        realtime_connections = connections;
+        realtime.heap_bytes = (size_t) mb << 20;
+        const char *huge = getenv("MPC_HUGE_PAGES");
+        realtime.huge_pages = huge && strcmp(huge, "1") == 0;
+        if (realtime_connections == 0) {
+            MPC_LOG(LOG_ERROR, "Ignoring MPC_REALTIME=%s, expected <connections>[:<MB>]", s);
+        } else if (!reserveHeap(realtime)) {
+            MPC_LOG(LOG_WARN, "Cannot reserve %lu MB of heap%s for MPC_REALTIME", mb,
+                    realtime.huge_pages ? " on huge pages" : "");
+        }
+    }
+    
+    // MPC_LOOPS=<n> runs n event loops, each with a hub of its own on a
+    // thread of its own, see EventLoop, all accepting on the port through
+    // SO_REUSEPORT. The kernel spreads the connections over them, so the
+    // network handling scales with the cores. One by default.
+    size_t n_loops = 1;
+    if (const char *s = getenv("MPC_LOOPS")) {
+        n_loops = max(1l, atol(s));
+    }
+    
+    // MPC_CPUS=<cpu,...> pins one worker to each listed CPU, dealt out to
+    // the loops in turn, MPC_IO_CPU=<cpu,...> pins each loop thread to the
+    // CPU listed for it, again in turn, and MPC_SCHED_FIFO=<priority> runs
+    // all of them under SCHED_FIFO. MPC_SCHED_ORDER=fifo runs the jobs of
+    // each worker in the order posted instead of earliest deadline first.
+    // MPC_IDLE=busy has the loop threads and the workers spin rather than
+    // sleep while they wait, see IdleMode; park, the default, sleeps.
+    SchedulerOptions scheduler;
+    const char *cpus = getenv("MPC_CPUS");
+    if (cpus && !parseCpus(cpus, scheduler.worker_cpus)) {
+        MPC_LOG(LOG_ERROR, "Ignoring MPC_CPUS=%s, expected a list of CPUs like 2,3,4", cpus);
+        scheduler.worker_cpus.clear();
+    }
+    vector<int> io_cpus;
+    const char *io_cpu = getenv("MPC_IO_CPU");
+    if (io_cpu && !parseCpus(io_cpu, io_cpus)) {
+        MPC_LOG(LOG_ERROR, "Ignoring MPC_IO_CPU=%s, expected a list of CPUs like 0,1", io_cpu);
+        io_cpus.clear();
+    }
+    const char *fifo = getenv("MPC_SCHED_FIFO");
+    if (fifo) {
+        scheduler.fifo_priority = atoi(fifo);
+    }
+    if (const char *s = getenv("MPC_SCHED_ORDER")) {
+        if (strcmp(s, "fifo") == 0 || strcmp(s, "edf") == 0) {
+            scheduler.deadline_order = strcmp(s, "edf") == 0;
+        } else {
+            MPC_LOG(LOG_ERROR, "Ignoring MPC_SCHED_ORDER=%s, expected fifo or edf", s);
+        }
+    }
+    if (const char *s = getenv("MPC_IDLE")) {
+        if (strcmp(s, "busy") == 0 || strcmp(s, "park") == 0) {
+            scheduler.idle = strcmp(s, "busy") == 0 ? IDLE_BUSY : IDLE_PARK;
+        } else {
+            MPC_LOG(LOG_ERROR, "Ignoring MPC_IDLE=%s, expected busy or park", s);
+        }
+    }
+    
+    // MPC_NUMA=1 places the workers on the NUMA nodes in turn, those of
+    // MPC_CPUS on the nodes of their CPUs, deals the connections out to
+    // the nodes in turn, and prepares the controllers of each node on it,
+    // so a solve never reaches across to the memory of another node, see
+    // SchedulerOptions::numa. Nothing on a machine of one node.
+    int numa_nodes = 1;
+    if (const char *s = getenv("MPC_NUMA")) {
+        numa_nodes = strcmp(s, "0") != 0 ? numaNodes() : 1;
+        scheduler.numa = numa_nodes > 1;
+        MPC_LOG(LOG_INFO, "%d NUMA nodes%s", numa_nodes, scheduler.numa ? "" : ", placing nothing");
+    }
+    scheduler.io_cpu = io_cpus.empty() ? -1 : io_cpus[0];
+    if (!placeThread(scheduler.io_cpu, scheduler.fifo_priority)) {
+        MPC_LOG(LOG_WARN, "Cannot place the loop thread on CPU %d at FIFO priority %d", scheduler.io_cpu,
+                scheduler.fifo_priority);
+    }
+    
+    // One controller per connection, see Session, solved on the workers of
+    // its loop so several simulators can be driven at once. Each connection
+    // stays on the worker it was assigned. The loops share the hardware
+    // threads.
+    // MPC_DEFLATE=<bytes> offers permessage-deflate to the simulators and
+    // compresses the replies of at least that many bytes to the
+    // connections that opt in with ?deflate=1, the large ones with the
+    // lines, while the short steering replies go out as they are. Off by
+    // default.
+    unsigned long deflate_threshold = 0;
+    if (const char *s = getenv("MPC_DEFLATE")) {
+        deflate_threshold = strtoul(s, nullptr, 10);
+    }
+    int extensions = deflate_threshold > 0 ? uWS::PERMESSAGE_DEFLATE | uWS::SERVER_NO_CONTEXT_TAKEOVER : 0;
+    
+    vector<unique_ptr<EventLoop> > loops;
+    size_t n_workers = 0;
+    for (size_t i = 0; i < n_loops; i++) {
+        unique_ptr<EventLoop> loop(new EventLoop(extensions));
+        SchedulerOptions options = scheduler;
+        options.worker_cpus.clear();
+        for (size_t j = i; j < scheduler.worker_cpus.size(); j += n_loops) {
+            options.worker_cpus.push_back(scheduler.worker_cpus[j]);
+        }
+        options.io_cpu = loop->cpu = io_cpus.empty() ? -1 : io_cpus[i % io_cpus.size()];
+        loop->pool.reset(new WorkerPool(loop->hub.getLoop(),
+                                        max<size_t>(1, thread::hardware_concurrency() / n_loops), options));
+        n_workers += loop->pool->size();
+        
+        // Latency
+        // The purpose is to mimic real driving conditions where
+        // the car does actuate the commands instantly.
+        //
+        // Feel free to play around with this value but should be to drive
+        // around the track with 100ms latency.
+        //
+        // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
+        // SUBMITTING.
+        //
+        // The replies are held back on a timer so the event loop keeps
+        // serving other connections in the meantime.
+        loop->delayed.reset(new DelayedSend(loop->hub.getLoop(), 100));
+        loops.push_back(std::move(loop));
+    }
+    
+    // MPC_CAPTURE=<file> records every telemetry frame for mpc_bench, from
+    // any loop under the lock.
+    CaptureWriter capture;
+    mutex capture_lock;
+    const char *capture_path = getenv("MPC_CAPTURE");
+    if (capture_path && !capture.open(capture_path)) {
+        MPC_LOG(LOG_ERROR, "Cannot write capture %s", capture_path);
+    }
+    
+    // MPC_STATE=<file> keeps a snapshot of every controller in a memory
+    // mapped file and seeds the controllers of the next process from it,
+    // see StateStore.
+    StateStore store;
+    const char *state_path = getenv("MPC_STATE");
+    if (state_path && !store.open(state_path, state_slots)) {
+        MPC_LOG(LOG_ERROR, "Cannot map state file %s", state_path);
+    }
+    
+    // MPC_MAP=<csv> looks the waypoints up on a map of the track, loaded
+    // once and shared by every connection, instead of taking them from the
+    // telemetry. With a map file of mpc_mkmap, MPC_MAP_RESIDENT=<MB> keeps
+    // about that much of it resident, see Track::prefetch.
+    Track map;
+    bool has_map = false;
+    const char *map_path = getenv("MPC_MAP");
+    if (map_path) {
+        has_map = map.load(map_path);
+        if (has_map) {
+            MPC_LOG(LOG_INFO, "Map %s: %zu waypoints", map_path, map.size());
+            Metrics::setTrackLength(map.length());
+        } else {
+            MPC_LOG(LOG_ERROR, "Cannot read map %s", map_path);
+        }
+    }
+    if (const char *s = getenv("MPC_MAP_RESIDENT")) {
+        map.setResidentLimit((size_t) (atof(s) * 1024 * 1024));
+    }
+    
+    // MPC_REFERENCE=spline takes the reference polynomial from a spline of
+    // the map rather than fitting the waypoints every frame.
+    PathSpline spline;
+    bool has_spline = false;
+    const char *reference = getenv("MPC_REFERENCE");
+    if (reference && strcmp(reference, "spline") == 0) {
+        has_spline = has_map && spline.build(map);
+        if (!has_spline) {
+            MPC_LOG(LOG_ERROR, "No spline reference without a map of distinct waypoints, see MPC_MAP");
+        }
+    }
+    
+    // MPC_SPEED_PROFILE=<lateral>[:accel:braking] drives the speed profile
+    // of the map within those accelerations in m/s^2, computed at start-up,
+    // and MPC_SPEED_PROFILE=map the one of the map file, see mpc_mkmap,
+    // rather than towards ref_v everywhere.
+    bool has_profile = false;
+    if (const char *s = getenv("MPC_SPEED_PROFILE")) {
+        Track::SpeedLimits limits;
+        sscanf(s, "%lf:%lf:%lf", &limits.lateral, &limits.accel, &limits.braking);
+        if (has_map && limits.lateral > 0 && limits.accel > 0 && limits.braking > 0) {
+            PathSpline curvature;
+            map.buildSpeedProfile(curvature.build(map) ? &curvature : nullptr, limits);
+            has_profile = true;
+        } else if (strcmp(s, "map") == 0) {
+            has_profile = has_map && map.hasSpeedProfile();
+        }
+        if (!has_profile) {
+            MPC_LOG(LOG_ERROR, "Ignoring MPC_SPEED_PROFILE=%s, expected <lateral> or map with a map that has one", s);
+        }
+    }
+    
+    // MPC_TABLE=<file> answers the frames inside the validated region of a
+    // table written by mpc_tabulate without solving, see ControlTable.
+    ControlTable table;
+    const char *table_path = getenv("MPC_TABLE");
+    if (table_path && !table.open(table_path)) {
+        MPC_LOG(LOG_ERROR, "Cannot map control table %s", table_path);
+    }
+    
+    // MPC_SPECULATE=1 solves ahead for the next frame of a connection while
+    // its worker waits for it, see Controller::speculate.
+    const char *speculate_env = getenv("MPC_SPECULATE");
+    bool speculate = speculate_env && strcmp(speculate_env, "1") == 0;
+    
+    // MPC_PREEMPT=1 cancels the solve of a frame still running past the
+    // deadline of its reply once a newer frame of the connection arrives,
+    // see Controller::preempt.
+    const char *preempt_env = getenv("MPC_PREEMPT");
+    bool preempt = preempt_env && strcmp(preempt_env, "1") == 0;
+    
+    // MPC_MEASURED_DELAY=0 predicts every frame over the nominal actuation
+    // delay rather than over the measured time until the replies are
+    // sent: the solve and the wait for the worker on top of the delay of
+    // the sends.
+    const char *measured_env = getenv("MPC_MEASURED_DELAY");
+    bool measure_delay = !measured_env || strcmp(measured_env, "0") != 0;
+    
+    // MPC_ACTUATION_HZ=<rate> sends the actuations of the plan of every
+    // reply at that rate until the next one, interpolated between its
+    // moves, rather than only once per telemetry frame.
+    uint64_t tick_ms = 0;
+    if (const char *s = getenv("MPC_ACTUATION_HZ")) {
+        double rate = atof(s);
+        tick_ms = rate > 0 ? max(1l, lround(1000 / rate)) : 0;
+    }
+    
+    // MPC_CANARY=<fraction>:<variant> runs that fraction of the
+    // connections, spread evenly over them in the order they connect, as
+    // the variant of parseVariant, e.g. "0.25:solver=cgmres,horizon=20";
+    // the others keep the environment's configuration. ?cohort=canary or
+    // ?cohort=control puts a connection in either one. /metrics shows the
+    // latency and the errors of both cohorts side by side, under the same
+    // load.
+    Cohort control("control"), canary("canary");
+    double canary_fraction = 0;
+    ControllerVariant variant;
+    if (const char *s = getenv("MPC_CANARY")) {
+        const char *colon = strchr(s, ':');
+        canary_fraction = atof(s);
+        if (!colon || !parseVariant(colon + 1, variant)) {
+            MPC_LOG(LOG_ERROR, "Ignoring MPC_CANARY=%s, expected <fraction>:<key>=<value>,...", s);
+            canary_fraction = 0;
+        }
+    }
+    
+    // MPC_BACKPRESSURE=<lines>[:<stale>] sheds what a connection that reads
+    // too slowly would only queue up: beyond `lines` bytes waiting to be
+    // written to its socket the replies lose their lines, beyond `stale`
+    // only the newest reply due is kept until the socket drains, see
+    // DelayedSend. 0 turns either off.
+    unsigned long shed_lines = default_shed_lines, shed_stale = default_shed_stale;
+    if (const char *s = getenv("MPC_BACKPRESSURE")) {
+        sscanf(s, "%lu:%lu", &shed_lines, &shed_stale);
+    }
+    for (auto &loop : loops) {
+        loop->delayed->setStaleLimit(shed_stale);
+        loop->delayed->setDeflateThreshold(deflate_threshold);
+    }
+    
+    // MPC_ADMISSION=<cores>[:<MB>] refuses new connections that would
+    // make those connected keep more than that many cores busy solving, by
+    // their smoothed load, or hold that much heap together, see Usage and
+    // admit(), and sheds load beyond the cores, see shed(). Off by default.
+    // MPC_ADMISSION_REDIRECT=<url> gives the refused connections that URL
+    // to try instead, as the reason of their close.
+    Admission admission;
+    if (const char *s = getenv("MPC_ADMISSION")) {
+        sscanf(s, "%lf:%lu", &admission.cores, &admission.mb);
+        if (!(admission.cores > 0) && admission.mb == 0) {
+            MPC_LOG(LOG_ERROR, "Ignoring MPC_ADMISSION=%s, expected <cores>[:<MB>]", s);
+        }
+    }
+    if (const char *s = getenv("MPC_ADMISSION_REDIRECT")) {
+        admission.redirect = s;
+    }
+    
+    // MPC_FLEET=<range>[:<radius>[:<weight>]] drives the connections as
+    // vehicles on one track: each solve keeps its stages `radius` m, 3 by
+    // default, from those of the vehicles within `range` m of its last
+    // plan, by a penalty of `weight`, 1000 by default, see
+    // Controller::setFleet. The plans are rehashed every control period.
+    // Off by default.
+    Fleet fleet;
+    // The solvers of /rpc, see SolveRpc.h.
+    RpcContexts rpc_contexts;
+    if (const char *s = getenv("MPC_FLEET")) {
+        double range = 0;
+        fleet.radius = 3;
+        fleet.weight = 1000;
+        sscanf(s, "%lf:%lf:%lf", &range, &fleet.radius, &fleet.weight);
+        if (range > 0) {
+            fleet.hash.reset(new FleetHash(max(range, fleet.radius)));
+        } else {
+            MPC_LOG(LOG_ERROR, "Ignoring MPC_FLEET=%s, expected <range>[:<radius>[:<weight>]]", s);
+        }
+    }
+    
+    // MPC_CONFIG=<file> sets every controller up with the variant in the
+    // file over the environment's configuration, see readVariant: e.g.
+    // "horizon = 20", "cte = 20" and "tol = 1e-4" on lines of their own.
+    // The file is watched and reloaded on every change, see below.
+    WarmPool warm;
+    const char *config_path = getenv("MPC_CONFIG");
+    if (config_path && !readVariant(config_path, warm.config)) {
+        MPC_LOG(LOG_ERROR, "Ignoring MPC_CONFIG=%s until it parses, expected <key>=<value> lines", config_path);
+        warm.config = ControllerVariant();
+    }
+    
+    // A new controller of the configuration `config`, reading the map, the
+    // spline, the speed profile and the table if they were loaded.
+    auto newController = [&map, has_map, &spline, has_spline, has_profile, &table](const ControllerVariant &config) {
+        unique_ptr<Controller> controller(new Controller());
+        if (has_map) {
+            controller->setMap(&map);
+        }
+        if (has_profile) {
+            controller->setSpeedProfile(&map);
+        }
+        if (has_spline) {
+            controller->setReference(&spline);
+        }
+        if (table.isOpen()) {
+            controller->setTable(&table);
+        }
+        if (!controller->configure(config)) {
+            MPC_LOG(LOG_WARN, "No horizon of %zu stages, keeping %zu", config.horizon, controller->getHorizon());
+        }
+        return controller;
+    };
+    
+    // MPC_SHM=<file> also serves a simulator on the same host through the
+    // shared-memory channel mapped there, e.g. /dev/shm/mpc, see
+    // ShmChannel, in the binary framing of /binary. A thread of its own
+    // with a controller of its own answers each telemetry message as soon
+    // as it arrives, without the loop thread or the delayed send.
+    ShmChannel shm;
+    const char *shm_path = getenv("MPC_SHM");
+    if (shm_path && !shm.open(shm_path)) {
+        MPC_LOG(LOG_ERROR, "Cannot map shared-memory channel %s", shm_path);
+    }
+    if (shm.isOpen()) {
+        thread([&shm, &newController, &warm, has_map, &scheduler] {
+            if (!placeThread(-1, scheduler.fifo_priority)) {
+                MPC_LOG(LOG_WARN, "Cannot run the shared-memory thread at FIFO priority %d",
+                        scheduler.fifo_priority);
+            }
+            unique_ptr<Controller> controller = newController(warm.current());
+            controller->setWireFormat(WIRE_BINARY);
+            Telemetry telemetry;
+            string message, reply;
+            for (;;) {
+                if (!shm.receiveTelemetry(message, chrono::seconds(1))) {
+                    continue;
                 }
+                telemetry.arrival = chrono::steady_clock::now();
+                MessageKind kind;
+                {
+                    ScopedTimer timer(STAGE_PARSE);
+                    kind = parseBinaryMessage(message.data(), message.size(), telemetry);
+                }
+                if (kind != MSG_TELEMETRY || (!has_map && telemetry.ptsx.empty())) {
+                    continue;
+                }
+                controller->step(telemetry, reply);
+                shm.sendSteer(reply);
+            }
+        }).detach();
+        MPC_LOG(LOG_INFO, "Serving the shared-memory channel %s", shm_path);
+    }
+    
+    // MPC_PREWARM=<solves>[:<controllers>] prepares that many controllers,
+    // one per worker by default, by running that many solves on each before
+    // listening, so the first connections start at their steady latency.
+    // MPC_PREWARM_CAPTURE=<file> replays a capture instead of synthetic
+    // frames. MPC_PREWARM=0 starts every controller cold.
+    unsigned long prewarm_solves = default_prewarm_solves;
+    unsigned long prewarm_controllers = n_workers;
+    if (const char *s = getenv("MPC_PREWARM")) {
+        sscanf(s, "%lu:%lu", &prewarm_solves, &prewarm_controllers);
+    }
+    if (realtime_connections > 0) {
+        prewarm_solves = max(prewarm_solves, (unsigned long) default_prewarm_solves);
+        prewarm_controllers = max(prewarm_controllers, (unsigned long) realtime_connections);
+    }
+    
+    // MPC_POOL=<controllers> keeps up to that many controllers of closed
+    // connections for the next ones, see recycle(), as many as MPC_PREWARM
+    // prepares by default. 0 destroys every controller with its
+    // connection.
+    warm.capacity = prewarm_controllers;
+    if (const char *s = getenv("MPC_POOL")) {
+        warm.capacity = strtoul(s, nullptr, 10);
+    }
+    
+    CaptureReader prewarm_capture;
+    const char *prewarm_path = getenv("MPC_PREWARM_CAPTURE");
+    bool has_prewarm_capture = prewarm_path && prewarm_capture.open(prewarm_path);
+    if (prewarm_path && !has_prewarm_capture) {
+        MPC_LOG(LOG_ERROR, "Cannot read capture %s, pre-warming on synthetic frames", prewarm_path);
+    }
+    if (prewarm_solves > 0) {
+        auto start = chrono::steady_clock::now();
+        prepareControllers(newController, warm.config, prewarm_controllers, prewarm_solves,
+                           has_prewarm_capture ? prewarm_path : nullptr, numa_nodes, warm.controllers, warm.nodes);
+        MPC_LOG(LOG_INFO, "Pre-warmed %zu controllers in %.0f ms", warm.controllers.size(),
+                chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+    
+    // Sessions connected now on any loop, for /metrics, and the number of
+    // connections since the start.
+    vector<Session *> sessions;
+    mutex sessions_lock;
+    atomic<unsigned> connections(0);
+    
+    // With MPC_CONFIG, a thread of its own checks the file for changes.
+    // Each change that parses prepares controllers of the new
+    // configuration, one per connection plus MPC_PREWARM's, pre-warmed like
+    // those before listening, and swaps them in for the whole pool at once.
+    // Every connection then moves to one between two frames, see
+    // upgrade(), so the tapes, sparsity patterns and IPOPT applications of
+    // the new horizon and options are never built on a live connection. A
+    // change that does not parse is logged and the configuration kept.
+    if (config_path) {
+        thread([&warm, &newController, &sessions, &sessions_lock, config_path, prewarm_solves, prewarm_controllers,
+                prewarm_path, numa_nodes] {
+            struct stat last = {};
+            stat(config_path, &last);
+            for (;;) {
+                this_thread::sleep_for(config_poll);
+                vector<unique_ptr<Controller> > retired;
+                {
+                    lock_guard<mutex> hold(warm.lock);
+                    retired.swap(warm.retired);
+                }
+                retired.clear();
+                struct stat now;
+                if (stat(config_path, &now) != 0 ||
+                    (now.st_mtim.tv_sec == last.st_mtim.tv_sec && now.st_mtim.tv_nsec == last.st_mtim.tv_nsec &&
+                     now.st_size == last.st_size)) {
+                    continue;
+                }
+                last = now;
+                ControllerVariant config;
+                if (!readVariant(config_path, config)) {
+                    MPC_LOG(LOG_ERROR, "Cannot parse %s, keeping the configuration", config_path);
+                    continue;
+                }
+                
+                auto start = chrono::steady_clock::now();
+                size_t n_controllers;
+                {
+                    lock_guard<mutex> hold(sessions_lock);
+                    n_controllers = sessions.size() + prewarm_controllers;
+                }
+                vector<unique_ptr<Controller> > fresh;
+                vector<int> fresh_nodes;
+                prepareControllers(newController, config, n_controllers, prewarm_solves, prewarm_path, numa_nodes,
+                                   fresh, fresh_nodes);
+                {
+                    lock_guard<mutex> hold(warm.lock);
+                    warm.controllers.swap(fresh);
+                    warm.nodes.swap(fresh_nodes);
+                    warm.config = config;
+                    warm.generation++;
+                }
+                MPC_LOG(LOG_INFO, "Reloaded %s, prepared %zu controllers in %.0f ms", config_path, n_controllers,
+                        chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+            }
+        }).detach();
+    }
+    
+    for (auto &loop : loops) {
+        uWS::Hub &h = loop->hub;
+        WorkerPool &pool = *loop->pool;
+        DelayedSend &delayed = *loop->delayed;
+        
+        h.onMessage([&pool, &delayed, &capture, &capture_lock, has_map](uWS::WebSocket<uWS::SERVER> ws, char *data,
+                                                                       size_t length, uWS::OpCode opCode) {
+            // Refused by MPC_ADMISSION, closing.
+            if (!ws.getUserData()) {
+                return;
+            }
+            auto session = *(shared_ptr<Session> *) ws.getUserData();
+            session->telemetry.arrival = chrono::steady_clock::now();
+            session->usage.bytes_in.add(length);
+            if (session->rpc) {
+                RpcRequest request;
+                RpcError error = opCode == uWS::OpCode::BINARY ? parseRpcRequest(data, length, request)
+                                                                : RPC_MALFORMED;
+                if (error != RPC_OK) {
+                    rejectRpc(*session, request.id, error);
+                } else if (session->rpc_waiting.size() >= max_rpc_waiting) {
+                    rejectRpc(*session, request.id, RPC_BUSY);
+                } else {
+                    session->rpc_waiting.push_back(std::move(request));
+                    postRpc(session, pool);
+                }
+                return;
+            }
+            // Sent by the router moving the vehicle between nodes, whatever
+            // the wire format, see ControllerContext. The frame period and
+            // delay apply at once, to the frames that follow the context.
+            if (opCode == uWS::OpCode::BINARY && isContextMessage(data, length)) {
+                if (length == sizeof(context_magic)) {
+                    session->export_requested = true;
+                    resume(session, pool, delayed);
+                    return;
+                }
+                unique_ptr<ControllerContext> context(new ControllerContext);
+                if (!decodeContext(data, length, *context)) {
+                    MPC_LOG(LOG_WARN, "Connection %u sent a malformed controller context", session->id);
+                    return;
+                }
+                if (context->period > 0) {
+                    session->period = context->period;
+                }
+                if (context->has_delay && session->measure_delay) {
+                    session->delay = context->delay;
+                    session->has_delay = true;
+                }
+                session->migration = std::move(context);
+                return;
+            }
+            MessageKind kind;
+            if (opCode == uWS::OpCode::BINARY) {
+                ScopedTimer timer(STAGE_PARSE);
+                kind = session->binary ? parseBinaryMessage(data, length, session->telemetry) : MSG_IGNORED;
             } else {
+                MPC_LOG_PAYLOAD(data, length);
+                ScopedTimer timer(STAGE_PARSE);
+                kind = parseMessage(data, length, session->telemetry);
+            }
+            switch (kind) {
+            case MSG_TELEMETRY:
+                // Nothing to follow without waypoints.
+                if (!has_map && session->telemetry.ptsx.empty()) {
+                    break;
+                }
+                if (capture.isOpen()) {
+                    lock_guard<mutex> hold(capture_lock);
+                    capture.record(session->telemetry);
+                }
+                if (session->last_arrival != chrono::steady_clock::time_point()) {
+                    double interval =
+                        chrono::duration<double>(session->telemetry.arrival - session->last_arrival).count();
+                    session->period = session->period > 0
+                                          ? session->period + period_smoothing * (interval - session->period)
+                                          : interval;
+                }
+                session->last_arrival = session->telemetry.arrival;
+                // The frame still waiting, if any, is replaced.
+                if (session->has_next) {
+                    Metrics::recordDrop(DROP_SUPERSEDED);
+                }
+                session->telemetry.delay = session->delay;
+                session->controller->prepare(session->telemetry, session->next);
+                session->has_next = true;
+                // A speculation this frame is off from is of no use, so the
+                // worker is freed for the frame.
+                if (session->busy && session->speculate) {
+                    session->controller->abandonSpeculation(session->next);
+                }
+                // Nor is finishing a solve whose reply is late already: the
+                // frame is answered from the previous plan and this one is
+                // solved from where it stopped.
+                if (session->busy && session->preempt && chrono::steady_clock::now() >= replyDeadline(*session) &&
+                    session->controller->preempt()) {
+                    Metrics::recordDrop(DROP_PREEMPTED);
+                }
+                resume(session, pool, delayed);
+                break;
+            case MSG_NO_DATA: {
                 // Manual driving
                 std::string msg = "42[\"manual\",{}]";
                 ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+                break;
             }
-        }
-    });
+            case MSG_VISUALIZE:
+                session->visualize = true;
+                break;
+            case MSG_MALFORMED:
+                // Only the decoded telemetry may be half overwritten; the frame
+                // waiting, if any, is intact and still solved.
+                Metrics::recordDrop(DROP_MALFORMED);
+                break;
+            default:
+                break;
+            }
+        });
+        
+        // /metrics serves everything recorded in Metrics plus the latency of
+        // each connection, /history?since=<unix time> the seconds of the last
+        // hour, see Metrics::sampleHistory, /track the solves by where on the
+        // map of MPC_MAP they were, see Metrics::recordTrackSolve, and
+        // /healthz answers while the loop thread is alive. They only read
+        // atomics, the history and the sessions, under their locks, so they
+        // never wait for a solver.
+        h.onHttpRequest([&sessions, &sessions_lock, &control, &canary, &warm](uWS::HttpResponse *res,
+                                                                              uWS::HttpRequest req, char *data,
+                                                                              size_t, size_t) {
+            std::string url = req.getUrl().toString();
+            if (url == "/metrics") {
+                std::string metrics = Metrics::render();
+                {
+                    lock_guard<mutex> hold(sessions_lock);
+                    metrics += "# TYPE mpc_connections gauge\n";
+                    metrics += "mpc_connections " + to_string(sessions.size()) + "\n";
+                    metrics += "# TYPE mpc_connection_latency_us summary\n";
+                    for (Session *session : sessions) {
+                        string labels = "connection=\"" + to_string(session->id) + "\"";
+                        Metrics::appendQuantiles(metrics, "mpc_connection_latency_us", labels.c_str(),
+                                                 session->latency);
+                    }
+                    
+                    // What each connection costs, see Usage.
+                    const struct {
+                        const char *name;
+                        const char *type;
+                        const char *labels;
+                        double (*value)(const Usage &);
+                    } usage_samples[] = {
+                        {"mpc_connection_cpu_seconds_total", "counter", "",
+                         [](const Usage &u) { return u.cpu_ns.value() * 1e-9; }},
+                        {"mpc_connection_load_cores", "gauge", "",
+                         [](const Usage &u) { return u.load.load(memory_order_relaxed); }},
+                        {"mpc_connection_bytes_total", "counter", ",direction=\"in\"",
+                         [](const Usage &u) { return (double) u.bytes_in.value(); }},
+                        {"mpc_connection_bytes_total", "counter", ",direction=\"out\"",
+                         [](const Usage &u) { return (double) u.bytes_out.value(); }},
+                        {"mpc_connection_heap_bytes", "gauge", "",
+                         [](const Usage &u) { return (double) u.heap.load(memory_order_relaxed); }},
+                        {"mpc_connection_heap_peak_bytes", "gauge", "",
+                         [](const Usage &u) { return (double) u.heap_peak.load(memory_order_relaxed); }},
+                        {"mpc_connection_tape_bytes", "gauge", "",
+                         [](const Usage &u) { return (double) u.tape_bytes.load(memory_order_relaxed); }},
+                    };
+                    const char *family = nullptr;
+                    for (const auto &sample : usage_samples) {
+                        if (!family || strcmp(family, sample.name) != 0) {
+                            metrics += string("# TYPE ") + sample.name + " " + sample.type + "\n";
+                            family = sample.name;
+                        }
+                        for (Session *session : sessions) {
+                            char line[160];
+                            snprintf(line, sizeof(line), "%s{connection=\"%u\"%s} %.17g\n", sample.name,
+                                     session->id, sample.labels, sample.value(session->usage));
+                            metrics += line;
+                        }
+                    }
+                }
+                size_t pooled;
+                {
+                    lock_guard<mutex> hold(warm.lock);
+                    pooled = warm.controllers.size();
+                }
+                metrics += "# TYPE mpc_pooled_controllers gauge\n";
+                metrics += "mpc_pooled_controllers " + to_string(pooled) + "\n";
+                const Cohort *cohorts[] = {&control, &canary};
+                metrics += "# TYPE mpc_cohort_connections gauge\n";
+                for (const Cohort *cohort : cohorts) {
+                    metrics += string("mpc_cohort_connections{cohort=\"") + cohort->name + "\"} " +
+                               to_string(cohort->connections.load()) + "\n";
+                }
+                const struct {
+                    const char *name;
+                    Histogram Cohort::*histogram;
+                } cohort_summaries[] = {
+                    {"mpc_cohort_latency_us", &Cohort::latency},
+                    {"mpc_cohort_cte_mm", &Cohort::cte},
+                    {"mpc_cohort_epsi_mrad", &Cohort::epsi},
+                };
+                for (const auto &summary : cohort_summaries) {
+                    metrics += string("# TYPE ") + summary.name + " summary\n";
+                    for (const Cohort *cohort : cohorts) {
+                        string labels = string("cohort=\"") + cohort->name + "\"";
+                        Metrics::appendQuantiles(metrics, summary.name, labels.c_str(), cohort->*summary.histogram);
+                    }
+                }
+                res->end(metrics.data(), metrics.length());
+            } else if (url.substr(0, url.find('?')) == "/history") {
+                size_t at = url.find("since=");
+                uint32_t since = at != string::npos ? (uint32_t) strtoul(url.c_str() + at + 6, nullptr, 10) : 0;
+                std::string history = Metrics::renderHistory(since);
+                res->end(history.data(), history.length());
+            } else if (url == "/track") {
+                std::string track = Metrics::renderTrack();
+                res->end(track.data(), track.length());
+            } else if (url == "/healthz") {
+                const std::string ok = "ok\n";
+                res->end(ok.data(), ok.length());
+            } else {
+                res->end(nullptr, 0);
+            }
+        });
+        
+        h.onConnection([&h, &pool, &delayed, &store, &warm, &newController, &sessions, &sessions_lock,
+                        &connections, speculate, preempt, measure_delay, tick_ms, &control, &canary, canary_fraction,
+                        &variant, shed_lines, realtime_connections, &admission, &rpc_contexts](
+                           uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+            if ((admission.cores > 0 || admission.mb > 0) && !admit(admission, sessions, sessions_lock)) {
+                Metrics::recordRefused();
+                // 1013, try again later, there if redirected.
+                ws.close(1013, admission.redirect.empty() ? nullptr : admission.redirect.data(),
+                         admission.redirect.size());
+                return;
+            }
+            string url = req.getUrl().toString();
+            if (url.substr(0, url.find('?')) == "/rpc") {
+                auto session = make_shared<Session>(ws, nullptr);
+                session->rpc = &rpc_contexts;
+                session->id = connections++;
+                session->url = url;
+                {
+                    lock_guard<mutex> hold(sessions_lock);
+                    sessions.push_back(session.get());
+                }
+                ws.setUserData(new shared_ptr<Session>(session));
+                MPC_LOG(LOG_INFO, "Connected!!! (rpc)");
+                return;
+            }
+            size_t worker = pool.assign();
+            unique_ptr<Controller> controller;
+            ControllerVariant config;
+            unsigned generation;
+            {
+                lock_guard<mutex> hold(warm.lock);
+                controller = warm.take(pool.nodeOf(worker));
+                if (!controller) {
+                    config = warm.config;
+                }
+                generation = warm.generation;
+            }
+            if (!controller) {
+                if (realtime_connections > 0) {
+                    MPC_LOG(LOG_WARN, "Connection %u starts cold, beyond the controllers of MPC_REALTIME",
+                            connections.load());
+                }
+                controller = newController(config);
+            }
+            auto session = make_shared<Session>(ws, std::move(controller));
+            session->warm = &warm;
+            session->generation = generation;
+            session->worker = worker;
+            session->node = pool.nodeOf(worker);
+            session->id = connections++;
+            session->speculate = speculate;
+            session->preempt = preempt;
+            session->measure_delay = measure_delay;
+            session->shed_lines = shed_lines;
+            if (tick_ms > 0) {
+                session->ticker = new uv_timer_t;
+                uv_timer_init(h.getLoop(), session->ticker);
+                session->ticker->data = session.get();
+                session->tick_ms = tick_ms;
+                session->delayed = &delayed;
+            }
+            {
+                lock_guard<mutex> hold(sessions_lock);
+                sessions.push_back(session.get());
+            }
+            session->url = req.getUrl().toString();
+            session->binary = session->url.substr(0, session->url.find('?')) == "/binary";
+            
+            // Connection n is a canary when (n + 1) * fraction passes a whole
+            // number, so any run of connections has its share.
+            string cohort = queryValue(session->url, "cohort");
+            bool is_canary = cohort.empty()
+                                 ? floor((session->id + 1) * canary_fraction) > floor(session->id * canary_fraction)
+                                 : cohort == "canary";
+            session->cohort = is_canary ? &canary : &control;
+            session->cohort->connections++;
+            session->variant = is_canary ? &variant : nullptr;
+            configureSession(*session);
+            configureLockstep(*session);
+            if (admission.cores > 0) {
+                session->admission = &admission;
+                session->priority = atoi(queryValue(session->url, "priority").c_str());
+            }
+            if (queryValue(session->url, "deflate") == "1") {
+                delayed.enableDeflate(ws);
+            }
+            if (store.isOpen()) {
+                session->store = &store;
+                session->slot = store.acquire();
+                if (session->slot >= 0 && session->controller->restore(store[session->slot])) {
+                    MPC_LOG(LOG_INFO, "Restored the controller state of slot %d", session->slot);
+                }
+            }
+            ws.setUserData(new shared_ptr<Session>(session));
+            MPC_LOG(LOG_INFO, "Connected!!! (%s, %s)", backendName(session->controller->getBackend()),
+                    session->cohort->name);
+        });
+        
+        h.onDisconnection([&h, &delayed, &sessions, &sessions_lock](uWS::WebSocket<uWS::SERVER> ws, int code,
+                                                    char *message, size_t length) {
+            auto session = (shared_ptr<Session> *) ws.getUserData();
+            // Refused by MPC_ADMISSION, see onConnection.
+            if (!session) {
+                return;
+            }
+            (*session)->closed = true;
+            if ((*session)->ticker) {
+                uv_timer_stop((*session)->ticker);
+                uv_close((uv_handle_t *) (*session)->ticker, [](uv_handle_t *handle) {
+                    delete (uv_timer_t *) handle;
+                });
+                (*session)->ticker = nullptr;
+            }
+            {
+                lock_guard<mutex> hold(sessions_lock);
+                sessions.erase(find(sessions.begin(), sessions.end(), session->get()));
+            }
+            // The requests in flight complete into the closed session.
+            if ((*session)->rpc) {
+                (*session)->rpc_waiting.clear();
+                delete session;
+                ws.setUserData(nullptr);
+                ws.close();
+                MPC_LOG(LOG_INFO, "Disconnected");
+                return;
+            }
+            (*session)->cohort->connections--;
+            // A solve still running writes its snapshot, the slot is released
+            // and the controller recycled when it completes.
+            if (!(*session)->busy) {
+                closeSession(**session);
+            }
+            delete session;
+            ws.setUserData(nullptr);
+            delayed.cancel(ws);
+            ws.close();
+            MPC_LOG(LOG_INFO, "Disconnected");
+        });
+    }
     
-    // We don't need this since we're not using HTTP but if it's removed the
-    // program
-    // doesn't compile :-(
-    h.onHttpRequest([](uWS::HttpResponse *res, uWS::HttpRequest req, char *data,
-                       size_t, size_t) {
-        const std::string s = "<h1>Hello world!</h1>";
-        if (req.getUrl().valueLength == 1) {
-            res->end(s.data(), s.length());
-        } else {
-            // i guess this should be done more gracefully?
-            res->end(nullptr, 0);
-        }
-    });
+    uv_timer_t history_tick;
+    uv_timer_init(loops[0]->hub.getLoop(), &history_tick);
+    uv_timer_start(&history_tick, [](uv_timer_t *) { Metrics::sampleHistory(); }, 1000, 1000);
+    
+    // The load shedding of MPC_ADMISSION, a step a second.
+    struct Shedding {
+        Admission *admission;
+        vector<Session *> *sessions;
+        mutex *sessions_lock;
+    } shedding{&admission, &sessions, &sessions_lock};
+    uv_timer_t shed_tick;
+    if (admission.cores > 0) {
+        uv_timer_init(loops[0]->hub.getLoop(), &shed_tick);
+        shed_tick.data = &shedding;
+        uv_timer_start(&shed_tick, [](uv_timer_t *timer) {
+            Shedding *s = (Shedding *) timer->data;
+            shed(*s->admission, *s->sessions, *s->sessions_lock);
+        }, 1000, 1000);
+    }
+    
+    uv_timer_t fleet_tick;
+    if (fleet.hash) {
+        uv_timer_init(loops[0]->hub.getLoop(), &fleet_tick);
+        fleet_tick.data = fleet.hash.get();
+        uv_timer_start(&fleet_tick, [](uv_timer_t *timer) { ((FleetHash *) timer->data)->tick(); },
+                       actuation_delay_ms, actuation_delay_ms);
+    }
+    
+#ifdef MPC_TRACE
+    // The trace is written by an exit handler, so SIGINT exits normally
+    // instead of killing the process.
+    uv_signal_t sigint;
+    uv_signal_init(loops[0]->hub.getLoop(), &sigint);
+    uv_signal_start(&sigint, [](uv_signal_t *, int) { exit(0); }, SIGINT);
+#endif
+    
+    // Last before listening, once everything the connections use is
+    // faulted in.
+    if (realtime_connections > 0 && !lockMemory(realtime_stack)) {
+        MPC_LOG(LOG_WARN, "Cannot lock the memory for MPC_REALTIME, see CAP_IPC_LOCK and RLIMIT_MEMLOCK");
+    }
     
-    h.onConnection([&h](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
-        std::cout << "Connected!!!" << std::endl;
-    });
+    // MPC_HANDOFF=<path> hands the port over from this process to the next
+    // one started with the same path, e.g. a new build, see Handoff. The
+    // next one pre-warms, listens on the port beside this one, through
+    // SO_REUSEPORT, then this one stops accepting and closes its
+    // connections with 1012, service restart, and exits once their solves
+    // completed, their snapshots in MPC_STATE written. The vehicles
+    // reconnect to the next one, warm, and restore their snapshots there.
+    const char *handoff_path = getenv("MPC_HANDOFF");
+    unique_ptr<Handoff> handoff(handoff_path ? new Handoff(handoff_path) : nullptr);
+    bool successor = handoff && handoff->connect();
     
-    h.onDisconnection([&h](uWS::WebSocket<uWS::SERVER> ws, int code,
-                           char *message, size_t length) {
-        ws.close();
-        std::cout << "Disconnected" << std::endl;
-    });
+    struct Releasing {
+        Handoff *handoff;
+        vector<unique_ptr<EventLoop> > *loops;
+        uv_timer_t drain;
+        chrono::steady_clock::time_point deadline;
+    } releasing{handoff.get(), &loops};
+    if (handoff) {
+        uv_timer_init(loops[0]->hub.getLoop(), &releasing.drain);
+        releasing.drain.data = &releasing;
+        for (auto &loop : loops) {
+            loop->release.data = &releasing;
+            uv_async_init(loop->hub.getLoop(), &loop->release, [](uv_async_t *async) {
+                Releasing *r = (Releasing *) async->data;
+                for (auto &loop : *r->loops) {
+                    if (loop->hub.getLoop() == async->loop) {
+                        uWS::Group<uWS::SERVER> &group = loop->hub.getDefaultGroup<uWS::SERVER>();
+                        group.stopListening();
+                        group.close(1012);
+                    }
+                }
+                if (async->loop != (*r->loops)[0]->hub.getLoop()) {
+                    return;
+                }
+                r->deadline = chrono::steady_clock::now() + handoff_drain;
+                uv_timer_start(&r->drain, [](uv_timer_t *timer) {
+                    Releasing *r = (Releasing *) timer->data;
+                    if (Session::live > 0 && chrono::steady_clock::now() < r->deadline) {
+                        return;
+                    }
+                    MPC_LOG(LOG_INFO, "Handed over to the next process, %zu connections still solving",
+                            Session::live.load());
+                    r->handoff->done();
+                    Logger::flush();
+                    exit(0);
+                }, 10, 10);
+            });
+        }
+    }
     
     int port = 4567;
-    if (h.listen(port)) {
-        std::cout << "Listening to port " << port << std::endl;
-    } else {
-        std::cerr << "Failed to listen to port" << std::endl;
-        return -1;
+    int listen_options = n_loops > 1 || handoff ? uS::ListenOptions::REUSE_PORT : 0;
+    for (auto &loop : loops) {
+        if (!loop->hub.listen(port, nullptr, listen_options)) {
+            std::cerr << "Failed to listen to port" << std::endl;
+            Logger::flush();
+            return -1;
+        }
+    }
+    MPC_LOG(LOG_INFO, "Listening to port %d on %zu loops", port, n_loops);
+    
+    // Taken over from the process before, if any, the path is served for
+    // the one after.
+    if (handoff) {
+        thread([&handoff, &loops, successor, handoff_path] {
+            if (successor && !handoff->takeOver(handoff_timeout)) {
+                MPC_LOG(LOG_WARN, "The process serving %s did not let go, not handing over", handoff_path);
+                return;
+            }
+            if (successor) {
+                MPC_LOG(LOG_INFO, "Took over from the process serving %s", handoff_path);
+            }
+            bool served = handoff->serve([&loops] {
+                for (auto &loop : loops) {
+                    uv_async_send(&loop->release);
+                }
+            });
+            if (!served) {
+                MPC_LOG(LOG_ERROR, "Cannot serve MPC_HANDOFF at %s", handoff_path);
+            }
+        }).detach();
+    }
+    
+    // The first loop runs on this thread, the others on threads of their
+    // own for as long as the process.
+    for (size_t i = 1; i < n_loops; i++) {
+        EventLoop *loop = loops[i].get();
+        thread([loop, &scheduler] {
+            if (!placeThread(loop->cpu, scheduler.fifo_priority)) {
+                MPC_LOG(LOG_WARN, "Cannot place the loop thread on CPU %d at FIFO priority %d", loop->cpu,
+                        scheduler.fifo_priority);
+            }
+            loop->hub.run();
+        }).detach();
     }
-    h.run();
+    loops[0]->hub.run();
 }
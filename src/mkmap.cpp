@@ -0,0 +1,74 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "PathSpline.h"
+#include "Track.h"
+
+// Preprocessing of a waypoint CSV into a map file, see Track::write.
+//
+//     mpc_mkmap [-V lateral[:accel:braking]] track.csv map.bin
+//
+// The map holds the waypoints, their arc lengths, the grid of Track::locate,
+// the coefficients of the spline of MPC_REFERENCE=spline and the speed
+// profile of MPC_SPEED_PROFILE=map, so that MPC_MAP, mpc_sim and the others
+// given the map map it instead of parsing the CSV and building all of that
+// at every start. Tracks with repeated waypoints, which have no spline, are
+// written without one, their profile from the curvature of the polyline.
+// -V sets the limits of the profile in m/s^2, see Track::SpeedLimits, the
+// lateral acceleration 8 and the longitudinal ones 2 by default.
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-V lateral[:accel:braking]] track.csv map.bin\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    Track::SpeedLimits limits;
+    const char *paths[2] = {nullptr, nullptr};
+    size_t n_paths = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] != '-' && n_paths < 2) {
+            paths[n_paths++] = argv[i];
+            continue;
+        }
+        if (arg != "-V" || i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        sscanf(argv[++i], "%lf:%lf:%lf", &limits.lateral, &limits.accel, &limits.braking);
+    }
+    if (n_paths != 2 || !(limits.lateral > 0 && limits.accel > 0 && limits.braking > 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Track track;
+    if (!track.load(paths[0])) {
+        fprintf(stderr, "cannot read a track from %s\n", paths[0]);
+        return 1;
+    }
+    PathSpline spline;
+    bool has_spline = spline.build(track);
+    track.buildSpeedProfile(has_spline ? &spline : nullptr, limits);
+    if (!track.write(paths[1], has_spline ? &spline : nullptr)) {
+        fprintf(stderr, "cannot write %s\n", paths[1]);
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    Track map;
+    if (!map.load(paths[1]) || map.size() != track.size()) {
+        fprintf(stderr, "cannot read back %s\n", paths[1]);
+        return 1;
+    }
+    double open_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double slowest = limits.max_speed;
+    for (size_t i = 0; i < map.size(); i++) {
+        slowest = fmin(slowest, map.speed(i));
+    }
+    printf("%zu waypoints, %.1f m, %s spline, speeds down to %.1f m/s, opens in %.3f ms\n", track.size(),
+           track.length(), has_spline ? "with" : "without", slowest, open_time * 1e3);
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BenchReport.h"
+#include "Logger.h"
+#include "Simulator.h"
+
+// Monte Carlo robustness runs of the controller on a waypoint track.
+//
+//     mpc_montecarlo [-n episodes] [-j threads] [-P processes] [-s seed] [-k shard/shards] [-L laps] [-l latency_ms]
+//                    [-J jitter_ms] [-N position:heading:speed] [-O offset:heading] [-V lateral[:accel:braking]|map] [-m] [-S]
+//                    [-c] track.csv
+//
+// Episode i is randomized from seed + i, see SimOptions::seed: its start
+// segment, its start pose up to -O m to the side and rad turned, 1:0.05 by
+// default, gaussian noise of the -N deviations on the telemetry,
+// 0.05:0.005:0.1 in m, rad and m/s, and up to -J ms more latency on each
+// frame, 20. -N 0:0:0 -J 0 -O 0:0 turns each off. -V drives a speed
+// profile as with mpc_sim. The episodes are run over the threads, one
+// controller each, or with -P over that many processes forked from one
+// controller set up beforehand, see runForked. -k runs only the episodes
+// of one shard, those whose index leaves `shard` divided by `shards`, for the nodes of a cluster to
+// split a run between them with the same seed and count. Prints the crash rate and the distributions of the offsets and of
+// the step times over the episodes; with -c instead one CSV line per
+// episode, so that those of the shards concatenate into the whole run.
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n episodes] [-j threads] [-P processes] [-s seed] [-k shard/shards] [-L laps] [-l latency_ms] "
+                    "[-J jitter_ms] [-N position:heading:speed] [-O offset:heading] [-V lateral[:accel:braking]|map] [-m] [-S] [-c] "
+                    "track.csv\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    size_t episodes = 1000;
+    size_t n_threads = max(1u, thread::hardware_concurrency());
+    size_t n_processes = 0;
+    unsigned seed = 1;
+    unsigned long shard = 0, shards = 1;
+    bool csv = false;
+    SimOptions base;
+    base.position_noise = 0.05;
+    base.heading_noise = 0.005;
+    base.speed_noise = 0.1;
+    base.latency_jitter = 0.020;
+    base.initial_offset = 1;
+    base.initial_heading = 0.05;
+    const char *path = nullptr;
+    const char *profile = nullptr;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] != '-') {
+            path = argv[i];
+            continue;
+        }
+        if (arg == "-m") {
+            base.use_map = true;
+            continue;
+        }
+        if (arg == "-S") {
+            base.use_spline = true;
+            continue;
+        }
+        if (arg == "-c") {
+            csv = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "-n") {
+            episodes = max(1l, atol(value));
+        } else if (arg == "-j") {
+            n_threads = max(1l, atol(value));
+        } else if (arg == "-P") {
+            n_processes = max(1l, atol(value));
+        } else if (arg == "-s") {
+            seed = strtoul(value, nullptr, 10);
+        } else if (arg == "-k") {
+            if (sscanf(value, "%lu/%lu", &shard, &shards) != 2 || shard >= shards) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "-L") {
+            base.laps = max(1, atoi(value));
+        } else if (arg == "-l") {
+            base.latency = atof(value) / 1000;
+        } else if (arg == "-J") {
+            base.latency_jitter = atof(value) / 1000;
+        } else if (arg == "-N") {
+            sscanf(value, "%lf:%lf:%lf", &base.position_noise, &base.heading_noise, &base.speed_noise);
+        } else if (arg == "-O") {
+            sscanf(value, "%lf:%lf", &base.initial_offset, &base.initial_heading);
+        } else if (arg == "-V") {
+            profile = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Track track;
+    if (!track.load(path)) {
+        fprintf(stderr, "cannot read a track from %s\n", path);
+        return 1;
+    }
+    if (profile && !prepareSpeedProfile(track, profile)) {
+        fprintf(stderr, "no speed profile %s for %s\n", profile, path);
+        return 1;
+    }
+    base.speed_profile = profile != nullptr;
+
+    vector<size_t> indices;
+    vector<SimOptions> options;
+    for (size_t i = shard; i < episodes; i += shards) {
+        SimOptions o = base;
+        // Never 0, which would turn the randomization off.
+        o.seed = seed + i == 0 ? 1 : seed + i;
+        o.start_segment = mt19937(o.seed)() % track.size();
+        indices.push_back(i);
+        options.push_back(o);
+    }
+    vector<EpisodeResult> results =
+        n_processes > 0 ? runForked(track, options, n_processes) : runBatch(track, options, n_threads);
+
+    if (csv) {
+        printf("episode,seed,start_segment,outcome,time,max_offset,rms_offset,mean_speed,step_p50,step_p99,"
+               "step_max,failed_solves,frames\n");
+    }
+    size_t completed = 0, off_track = 0, failed_solves = 0, frames = 0;
+    vector<double> max_offsets, rms_offsets, steps;
+    for (size_t i = 0; i < results.size(); i++) {
+        const EpisodeResult &r = results[i];
+        bool timed_out = !r.completed && r.time >= options[i].max_time;
+        completed += r.completed;
+        off_track += !r.completed && !timed_out;
+        failed_solves += r.failed_solves;
+        frames += r.frames;
+        max_offsets.push_back(r.max_offset);
+        rms_offsets.push_back(r.rms_offset);
+        if (csv) {
+            vector<double> times = r.step_times;
+            sort(times.begin(), times.end());
+            printf("%zu,%u,%zu,%s,%.2f,%.4f,%.4f,%.3f,%.6f,%.6f,%.6f,%zu,%zu\n", indices[i], options[i].seed,
+                   options[i].start_segment, r.completed ? "completed" : (timed_out ? "timed out" : "off track"),
+                   r.time, r.max_offset, r.rms_offset, r.mean_speed, benchPercentile(times, 0.5),
+                   benchPercentile(times, 0.99), times.empty() ? 0.0 : times.back(), r.failed_solves, r.frames);
+        } else {
+            steps.insert(steps.end(), r.step_times.begin(), r.step_times.end());
+        }
+    }
+
+    if (!csv) {
+        size_t n = results.size();
+        sort(max_offsets.begin(), max_offsets.end());
+        sort(rms_offsets.begin(), rms_offsets.end());
+        sort(steps.begin(), steps.end());
+        printf("%zu episodes of shard %lu/%lu from seed %u: %zu completed, %zu off track, %zu timed out, "
+               "crash rate %.2f%%\n", n, shard, shards, seed, completed, off_track, n - completed - off_track,
+               n > 0 ? 100.0 * (n - completed) / n : 0.0);
+        printf("max offset p50 %5.2f p95 %5.2f p99 %5.2f max %5.2f m\n", benchPercentile(max_offsets, 0.5),
+               benchPercentile(max_offsets, 0.95), benchPercentile(max_offsets, 0.99),
+               max_offsets.empty() ? 0.0 : max_offsets.back());
+        printf("rms offset p50 %5.2f p95 %5.2f p99 %5.2f max %5.2f m\n", benchPercentile(rms_offsets, 0.5),
+               benchPercentile(rms_offsets, 0.95), benchPercentile(rms_offsets, 0.99),
+               rms_offsets.empty() ? 0.0 : rms_offsets.back());
+        printf("step p50 %6.3f p99 %6.3f p99.9 %6.3f max %6.3f ms over %zu frames, failed solves %zu\n",
+               benchPercentile(steps, 0.5) * 1e3, benchPercentile(steps, 0.99) * 1e3, benchPercentile(steps, 0.999) * 1e3,
+               steps.empty() ? 0.0 : steps.back() * 1e3, frames, failed_solves);
+    }
+    Logger::flush();
+    return completed == results.size() ? 0 : 2;
+}
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include "BenchReport.h"
+#include "Controller.h"
+#include "LogReplay.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "TelemetryParser.h"
+
+// Regression gate of the hot path: allocations and latency of the whole
+// pipeline over a fixed corpus.
+//
+//     mpc_perfcheck [-r repeat] [-w warmup] [-t tolerance] [-b baseline] [-u] corpus
+//
+// The corpus is a trace log or a capture, see loadReplayLog, replayed
+// `repeat` times, 3 by default, on one controller configured from the
+// environment like mpc's, as replayLog does: parse, Controller::step and
+// the parse of the reply, with no solve deadline. operator new is counted
+// throughout; after the first `warmup` frames of each pass, 20 by default,
+// which grow the buffers to their steady-state size, any allocation in a
+// cycle fails the check. The p50 and p99 of the cycles and of each stage
+// timed, see Metrics::stage, are printed, and with a baseline file the
+// check also fails when the p50 or p99 of the cycles is more than
+// `tolerance`, 0.25 by default, above that of the baseline. -u writes the
+// measured ones to the baseline instead. The exit status is 2 for a failed
+// check.
+
+static atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-r repeat] [-w warmup] [-t tolerance] [-b baseline] [-u] corpus\n", name);
+}
+
+// The baseline file: "p50 <ms>" and "p99 <ms>" on a line each.
+static bool readBaseline(const char *path, double &p50, double &p99) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        return false;
+    }
+    char key[16];
+    double value;
+    int found = 0;
+    while (fscanf(in, "%15s %lf", key, &value) == 2) {
+        if (strcmp(key, "p50") == 0) {
+            p50 = value;
+            found |= 1;
+        } else if (strcmp(key, "p99") == 0) {
+            p99 = value;
+            found |= 2;
+        }
+    }
+    fclose(in);
+    return found == 3;
+}
+
+static bool writeBaseline(const char *path, double p50, double p99) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        return false;
+    }
+    fprintf(out, "p50 %.4f\np99 %.4f\n", p50, p99);
+    return fclose(out) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    int repeat = 3;
+    size_t warmup = 20;
+    double tolerance = 0.25;
+    const char *baseline = nullptr;
+    bool update = false;
+    const char *corpus = nullptr;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] != '-' && !corpus) {
+            corpus = argv[i];
+            continue;
+        }
+        if (arg == "-u") {
+            update = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "-r") {
+            repeat = max(1, atoi(value));
+        } else if (arg == "-w") {
+            warmup = strtoul(value, nullptr, 10);
+        } else if (arg == "-t") {
+            tolerance = atof(value);
+        } else if (arg == "-b") {
+            baseline = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!corpus || (update && !baseline)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ReplayLog log;
+    if (!loadReplayLog(corpus, log) || log.messages.size() <= warmup) {
+        fprintf(stderr, "%s holds no more than the %zu frames of the warm-up\n", corpus, warmup);
+        return 1;
+    }
+
+    size_t n = log.messages.size();
+    vector<double> cycles;
+    cycles.reserve(n * repeat);
+    Controller controller;
+    controller.setDeadlineBudget(chrono::microseconds(0));
+    Telemetry telemetry;
+    string reply;
+    uint64_t steady_allocations = 0;
+    size_t allocating_cycles = 0;
+    uint64_t worst_cycle = 0;
+    size_t worst_frame = 0;
+    for (int r = 0; r < repeat; r++) {
+        controller.reset();
+        for (size_t i = 0; i < n; i++) {
+            const string &msg = log.messages[i];
+            uint64_t before = allocations.load(memory_order_relaxed);
+            auto t0 = chrono::steady_clock::now();
+            if (parseMessage(msg.data(), msg.size(), telemetry) != MSG_TELEMETRY) {
+                continue;
+            }
+            telemetry.arrival = t0;
+            controller.step(telemetry, reply);
+            double steering = 0, throttle = 0;
+            parseSteer(reply, steering, throttle);
+            double elapsed = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            uint64_t allocated = allocations.load(memory_order_relaxed) - before;
+            if (i < warmup) {
+                continue;
+            }
+            cycles.push_back(elapsed);
+            steady_allocations += allocated;
+            allocating_cycles += allocated > 0;
+            if (allocated > worst_cycle) {
+                worst_cycle = allocated;
+                worst_frame = i;
+            }
+        }
+    }
+
+    sort(cycles.begin(), cycles.end());
+    double p50 = benchPercentile(cycles, 0.5) * 1e3;
+    double p99 = benchPercentile(cycles, 0.99) * 1e3;
+    printf("%zu steady-state cycles  p50 %.3f p99 %.3f ms\n", cycles.size(), p50, p99);
+    for (int s = STAGE_PARSE; s < STAGE_STEP; s++) {
+        const Histogram &h = Metrics::stage((Stage) s);
+        if (h.count() == 0) {
+            continue;
+        }
+        printf("  %-10s p50 %6llu p99 %6llu us\n", Metrics::stageName((Stage) s),
+               (unsigned long long) h.quantile(0.5), (unsigned long long) h.quantile(0.99));
+    }
+    printf("%llu allocations in %zu of them", (unsigned long long) steady_allocations, allocating_cycles);
+    if (worst_cycle > 0) {
+        printf(", up to %llu in frame %zu", (unsigned long long) worst_cycle, worst_frame);
+    }
+    printf("\n");
+
+    bool failed = steady_allocations > 0;
+    if (update) {
+        if (!writeBaseline(baseline, p50, p99)) {
+            fprintf(stderr, "cannot write %s\n", baseline);
+            return 1;
+        }
+    } else if (baseline) {
+        double base_p50 = 0, base_p99 = 0;
+        if (!readBaseline(baseline, base_p50, base_p99)) {
+            fprintf(stderr, "%s is not a baseline\n", baseline);
+            return 1;
+        }
+        bool slower = p50 > base_p50 * (1 + tolerance) || p99 > base_p99 * (1 + tolerance);
+        printf("baseline p50 %.3f p99 %.3f ms: %s\n", base_p50, base_p99, slower ? "regressed" : "ok");
+        failed = failed || slower;
+    }
+    Logger::flush();
+    return failed ? 2 : 0;
+}
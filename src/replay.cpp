@@ -0,0 +1,191 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LogReplay.h"
+#include "Logger.h"
+
+// Accelerated replay of recorded sessions through the whole pipeline.
+//
+//     mpc_replay [-j threads] [-r repeat] [-t tolerance] [-s shard/shards] [-o run] log|directory ...
+//
+// Every log, or every file of a directory, is a trace log or a capture,
+// see loadReplayLog, and is replayed as fast as it goes on a controller of
+// its own configured from the environment like mpc's, one log at a time
+// on each thread, each read only when a thread takes it up. Replies are
+// compared to those recorded, to `tolerance`, 1e-9 by default, which the
+// nine decimals of the actuations round to; a capture's to those of its
+// first pass. The logs are printed in order, then the throughput of them
+// all. The exit status is 2 if any reply differed.
+//
+// -s replays only shard `shard` of `shards`, counting from 0, see
+// shardPaths, so that nodes given the same archive split it between them,
+// and -o writes the results to the run file `run`, see ReplayRun.
+//
+//     mpc_replay -m run ...
+//
+// merges the run files of the shards instead: every log, a line per run
+// with its wall time, then all of them together, the step percentiles of
+// the merged histograms, the solve statistics and the largest deviations
+// of the actuations. The exit status is 2 if any reply differed or a log
+// could not be read.
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-j threads] [-r repeat] [-t tolerance] [-s shard/shards] [-o run] log|directory ...\n"
+                    "       %s -m run ...\n", name, name);
+}
+
+// The files of `path`, sorted, or `path` itself if it is no directory.
+static void listLogs(const char *path, vector<string> &paths) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        paths.push_back(path);
+        return;
+    }
+    vector<string> names;
+    while (struct dirent *entry = readdir(dir)) {
+        string name = string(path) + "/" + entry->d_name;
+        struct stat st;
+        if (entry->d_name[0] != '.' && stat(name.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    sort(names.begin(), names.end());
+    paths.insert(paths.end(), names.begin(), names.end());
+}
+
+static void printLog(const string &path, const ReplayResult &r) {
+    if (!r.loaded) {
+        printf("%s: cannot read\n", path.c_str());
+        return;
+    }
+    printf("%s: %zu frames %8.1f frames/s  step p50 %6.3f p99 %6.3f ms  compared %zu  "
+           "max error steering %.1e throttle %.1e  mismatches %zu\n",
+           path.c_str(), r.frames, r.time > 0 ? r.frames / r.time : 0.0, r.step_p50 * 1e3, r.step_p99 * 1e3,
+           r.compared, r.max_steering_error, r.max_throttle_error, r.mismatches);
+}
+
+// Print the runs in `paths` and all of them merged, see -m.
+static int mergeRuns(const vector<string> &paths) {
+    vector<ReplayResult> all;
+    size_t differing = 0, unread = 0;
+    double longest = 0;
+    vector<ReplayRun> runs(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!readReplayRun(paths[i], runs[i])) {
+            fprintf(stderr, "%s is no run file of mpc_replay -o\n", paths[i].c_str());
+            return 1;
+        }
+        for (size_t j = 0; j < runs[i].paths.size(); j++) {
+            const ReplayResult &r = runs[i].results[j];
+            printLog(runs[i].paths[j], r);
+            all.push_back(r);
+            differing += r.mismatches > 0;
+            unread += !r.loaded;
+        }
+    }
+    for (size_t i = 0; i < runs.size(); i++) {
+        ReplayResult merged = mergeReplayResults(runs[i].results);
+        printf("%s: %zu logs, %zu frames in %.2f s on %zu threads\n", paths[i].c_str(), runs[i].paths.size(),
+               merged.frames, runs[i].wall, runs[i].threads);
+        longest = max(longest, runs[i].wall);
+    }
+    ReplayResult total = mergeReplayResults(all);
+    printf("%zu logs, %zu frames from %zu runs in %.2f s: %.1f frames/s  step p50 %6.3f p99 %6.3f ms\n", all.size(),
+           total.frames, runs.size(), longest, longest > 0 ? total.frames / longest : 0.0, total.step_p50 * 1e3,
+           total.step_p99 * 1e3);
+    printf("%zu failed solves, %zu fallbacks, %.1f iterations per solve  compared %zu  max error steering %.1e "
+           "throttle %.1e  %zu log(s) differing, %zu unread\n",
+           total.failed_solves, total.fallbacks,
+           total.iterated_solves ? (double) total.iterations / total.iterated_solves : 0.0, total.compared,
+           total.max_steering_error, total.max_throttle_error, differing, unread);
+    return differing == 0 && unread == 0 ? 0 : 2;
+}
+
+int main(int argc, char *argv[]) {
+    size_t n_threads = max(1u, thread::hardware_concurrency());
+    int repeat = 1;
+    double tolerance = 1e-9;
+    size_t shard = 0, n_shards = 1;
+    const char *run_path = nullptr;
+    bool merge = false;
+    vector<string> paths;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] != '-') {
+            if (merge) {
+                paths.push_back(arg);
+            } else {
+                listLogs(argv[i], paths);
+            }
+            continue;
+        }
+        if (arg == "-m") {
+            merge = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "-j") {
+            n_threads = max(1l, atol(value));
+        } else if (arg == "-r") {
+            repeat = max(1, atoi(value));
+        } else if (arg == "-t") {
+            tolerance = atof(value);
+        } else if (arg == "-s") {
+            if (sscanf(value, "%zu/%zu", &shard, &n_shards) != 2 || shard >= n_shards) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "-o") {
+            run_path = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (paths.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (merge) {
+        return mergeRuns(paths);
+    }
+
+    ReplayRun run;
+    run.paths = n_shards > 1 ? shardPaths(paths, shard, n_shards) : paths;
+    run.threads = min(n_threads, run.paths.size());
+    auto start = chrono::steady_clock::now();
+    run.results = replayPaths(run.paths, n_threads, repeat, tolerance);
+    run.wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t frames = 0;
+    size_t differing = 0;
+    for (size_t i = 0; i < run.paths.size(); i++) {
+        const ReplayResult &r = run.results[i];
+        if (!r.loaded) {
+            fprintf(stderr, "cannot read %s\n", run.paths[i].c_str());
+            return 1;
+        }
+        printLog(run.paths[i], r);
+        frames += r.frames;
+        differing += r.mismatches > 0;
+    }
+    printf("%zu logs, %zu frames in %.2f s on %zu threads: %.1f frames/s, %zu log(s) differing\n", run.paths.size(),
+           frames, run.wall, run.threads, frames / run.wall, differing);
+    if (run_path && !writeReplayRun(run_path, run)) {
+        fprintf(stderr, "cannot write %s\n", run_path);
+        return 1;
+    }
+    Logger::flush();
+    return differing == 0 ? 0 : 2;
+}
@@ -0,0 +1,619 @@
+#include <uWS/uWS.h>
+#include <netdb.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ControllerState.h"
+#include "Logger.h"
+
+// Front router of a cluster of mpc nodes.
+//
+//     mpc_router [-p port] [-i poll_ms] host:port[/cores] ...
+//
+// Accepts the simulators' websockets on `port`, 4567 by default, and
+// forwards each to one of the nodes for as long as it stays connected, so
+// its controller, with its warm start and its tapes, lives on one node.
+// The URL is passed on as is, so /binary and the options of the query
+// reach the node. A connection whose query carries `vehicle=<id>` goes to
+// the node its vehicle went to before, while that node answers, so a
+// simulator that reconnects finds its node's MPC_POOL and MPC_PREWARM
+// controllers and any state it restores there.
+//
+// Every `poll_ms`, 1000 by default, the router reads each node's /metrics
+// and sums what its connections cost, mpc_connection_load_cores, the
+// cores they keep busy solving, see Usage in main.cpp. A new vehicle goes
+// to the node with the least of that per core, `cores` of the node, 1 by
+// default, counting each vehicle routed to it since the poll at the mean
+// load of a connection; while no node has load, by connections per core.
+// A node that does not answer its poll or refuses a connection takes none
+// until it answers again, and its vehicles are closed with 1013, try
+// again later, rather than moved.
+//
+// GET /migrate?vehicle=<id>[&to=host:port] moves a connected vehicle to
+// the node `to`, by default the one a new vehicle would go to, keeping
+// its controller warm: the router asks the node for the context of the
+// vehicle's controller, see ControllerContext, opens a connection to the
+// other node, sends it the context and then switches the vehicle over and
+// closes the old connection. Frames keep going to the old node until the
+// new one is open, so the vehicle misses none; if it cannot be opened the
+// vehicle stays.
+//
+// The router serves its own /metrics, the state of each node, and
+// /healthz.
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-p port] [-i poll_ms] host:port[/cores] ...\n", name);
+}
+
+// Frames of a vehicle kept while its node's connection opens, the newest.
+static const size_t max_waiting = 16;
+
+struct Node;
+
+// A node's /metrics being read, freed once its socket is closed.
+struct Probe {
+    Node *node = nullptr;
+    uv_tcp_t tcp;
+    uv_connect_t connect;
+    uv_write_t write;
+    string request;
+    string response;
+};
+
+struct Node {
+    string host;
+    string port;
+    double cores = 1;
+    sockaddr_storage address;
+    // Whether it answered its last poll and took its last connection.
+    bool up = true;
+    // From its last poll: connections and the cores they keep busy.
+    size_t connections = 0;
+    double load = 0;
+    // Vehicles routed since, and when the poll in flight started.
+    size_t routed = 0;
+    size_t routed_at_probe = 0;
+    // Vehicles forwarded to it now, and in all.
+    size_t open = 0;
+    uint64_t routed_total = 0;
+    Probe *probe = nullptr;
+};
+
+// One vehicle: its simulator's connection and the one to its node.
+struct Route {
+    Node *node = nullptr;
+    // Its ?vehicle, empty for none, and the URL it connected with.
+    string id;
+    string url;
+    uWS::WebSocket<uWS::SERVER> vehicle;
+    uWS::WebSocket<uWS::CLIENT> upstream;
+    bool vehicle_open = true;
+    bool upstream_pending = true;
+    bool upstream_open = false;
+    deque<pair<string, uWS::OpCode>> waiting;
+    // A migration, see /migrate: the node it goes to, null for none, the
+    // context its node sent and whether the connection to `target` is
+    // opening, which the upstream never is by then.
+    Node *target = nullptr;
+    string context;
+    bool target_pending = false;
+};
+
+struct Router {
+    uWS::Hub *hub = nullptr;
+    vector<unique_ptr<Node>> nodes;
+    unordered_map<string, Node *> vehicles;
+    // The connected vehicles by their ?vehicle.
+    unordered_map<string, Route *> routes;
+    uv_timer_t poll;
+    uint64_t poll_ms = 1000;
+    uint64_t refused = 0;
+    uint64_t migrated = 0;
+    uint64_t migrations_failed = 0;
+};
+
+static void parseMetrics(Node &node, const string &body) {
+    size_t connections = 0;
+    double load = 0;
+    for (size_t start = 0; start < body.size();) {
+        size_t end = body.find('\n', start);
+        if (end == string::npos) {
+            end = body.size();
+        }
+        const char *line = body.c_str() + start;
+        if (strncmp(line, "mpc_connection_load_cores{", 26) == 0) {
+            const char *value = strchr(line, ' ');
+            if (value && value < body.c_str() + end) {
+                load += atof(value + 1);
+            }
+        } else if (strncmp(line, "mpc_connections ", 16) == 0) {
+            connections = strtoul(line + 16, nullptr, 10);
+        }
+        start = end + 1;
+    }
+    node.connections = connections;
+    node.load = load;
+    node.routed -= min(node.routed, node.routed_at_probe);
+    if (!node.up) {
+        MPC_LOG(LOG_INFO, "Node %s:%s is back", node.host.c_str(), node.port.c_str());
+    }
+    node.up = true;
+}
+
+static void markDown(Node &node, const char *why) {
+    if (node.up) {
+        MPC_LOG(LOG_WARN, "Node %s:%s is down: %s", node.host.c_str(), node.port.c_str(), why);
+    }
+    node.up = false;
+}
+
+static void closeProbe(Probe *probe) {
+    if (probe->node) {
+        probe->node->probe = nullptr;
+        probe->node = nullptr;
+    }
+    uv_close((uv_handle_t *) &probe->tcp, [](uv_handle_t *handle) { delete (Probe *) handle->data; });
+}
+
+// Whether the response holds its whole body, by its Content-Length, and
+// where the body starts, npos before the end of the headers.
+static bool responseComplete(const string &response, size_t &body) {
+    size_t headers = response.find("\r\n\r\n");
+    body = headers == string::npos ? string::npos : headers + 4;
+    if (headers == string::npos) {
+        return false;
+    }
+    const char *length = strcasestr(response.c_str(), "content-length:");
+    if (!length || length > response.c_str() + headers) {
+        return false;
+    }
+    return response.size() - body >= strtoul(length + 15, nullptr, 10);
+}
+
+static void onProbeRead(uv_stream_t *stream, ssize_t n, const uv_buf_t *buf) {
+    Probe *probe = (Probe *) stream->data;
+    if (n > 0) {
+        probe->response.append(buf->base, n);
+    }
+    delete[] buf->base;
+    if (!probe->node) {
+        return;
+    }
+    size_t body;
+    bool complete = responseComplete(probe->response, body);
+    if (!complete && n >= 0) {
+        return;
+    }
+    if (complete || (n == UV_EOF && body != string::npos)) {
+        if (probe->response.size() >= 12 && probe->response.compare(9, 3, "200") == 0) {
+            parseMetrics(*probe->node, probe->response.substr(body));
+        } else {
+            markDown(*probe->node, "bad /metrics response");
+        }
+    } else {
+        markDown(*probe->node, n == UV_EOF ? "short /metrics response" : uv_strerror(n));
+    }
+    uv_read_stop(stream);
+    closeProbe(probe);
+}
+
+static void onProbeConnect(uv_connect_t *request, int status) {
+    Probe *probe = (Probe *) request->data;
+    if (!probe->node) {
+        return;
+    }
+    if (status < 0) {
+        markDown(*probe->node, uv_strerror(status));
+        closeProbe(probe);
+        return;
+    }
+    uv_buf_t buf = uv_buf_init(&probe->request[0], probe->request.size());
+    uv_write(&probe->write, (uv_stream_t *) &probe->tcp, &buf, 1, nullptr);
+    uv_read_start((uv_stream_t *) &probe->tcp,
+                  [](uv_handle_t *, size_t suggested, uv_buf_t *buf) {
+                      *buf = uv_buf_init(new char[suggested], suggested);
+                  },
+                  onProbeRead);
+}
+
+static void onPoll(uv_timer_t *timer) {
+    Router &router = *(Router *) timer->data;
+    for (auto &node : router.nodes) {
+        if (node->probe) {
+            // Still unanswered from the poll before.
+            markDown(*node, "/metrics timed out");
+            closeProbe(node->probe);
+        }
+        Probe *probe = new Probe;
+        probe->node = node.get();
+        probe->request = "GET /metrics HTTP/1.1\r\nHost: " + node->host + "\r\nConnection: close\r\n\r\n";
+        uv_tcp_init(router.hub->getLoop(), &probe->tcp);
+        probe->tcp.data = probe;
+        probe->connect.data = probe;
+        node->probe = probe;
+        node->routed_at_probe = node->routed;
+        int status = uv_tcp_connect(&probe->connect, &probe->tcp, (const sockaddr *) &node->address, onProbeConnect);
+        if (status < 0) {
+            markDown(*node, uv_strerror(status));
+            closeProbe(probe);
+        }
+    }
+}
+
+// The node a new vehicle goes to, null if none is up; never `except`.
+static Node *choose(Router &router, const string &vehicle, const Node *except = nullptr) {
+    if (!vehicle.empty()) {
+        auto it = router.vehicles.find(vehicle);
+        if (it != router.vehicles.end() && it->second->up && it->second != except) {
+            return it->second;
+        }
+    }
+    size_t connections = 0;
+    double load = 0;
+    for (auto &node : router.nodes) {
+        if (node->up) {
+            connections += node->connections;
+            load += node->load;
+        }
+    }
+    double per_connection = connections > 0 ? load / connections : 0;
+    Node *best = nullptr;
+    double best_load = 0, best_connections = 0;
+    for (auto &node : router.nodes) {
+        if (!node->up || node.get() == except) {
+            continue;
+        }
+        double node_load = (node->load + node->routed * per_connection) / node->cores;
+        double node_connections = (node->connections + node->routed) / node->cores;
+        if (!best || node_load < best_load || (node_load == best_load && node_connections < best_connections)) {
+            best = node.get();
+            best_load = node_load;
+            best_connections = node_connections;
+        }
+    }
+    if (best && !vehicle.empty()) {
+        router.vehicles[vehicle] = best;
+    }
+    return best;
+}
+
+static string queryValue(const string &url, const char *key) {
+    size_t query = url.find('?');
+    string needle = string(key) + "=";
+    for (size_t at = query; at != string::npos && at < url.size(); at = url.find('&', at + 1)) {
+        if (url.compare(at + 1, needle.size(), needle) == 0) {
+            size_t start = at + 1 + needle.size();
+            return url.substr(start, url.find('&', start) - start);
+        }
+    }
+    return "";
+}
+
+static string renderMetrics(const Router &router) {
+    string metrics;
+    const struct {
+        const char *name;
+        const char *type;
+        double (*value)(const Node &);
+    } samples[] = {
+        {"mpc_router_node_up", "gauge", [](const Node &n) { return (double) n.up; }},
+        {"mpc_router_node_connections", "gauge", [](const Node &n) { return (double) n.connections; }},
+        {"mpc_router_node_load_cores", "gauge", [](const Node &n) { return n.load; }},
+        {"mpc_router_node_open", "gauge", [](const Node &n) { return (double) n.open; }},
+        {"mpc_router_routed_total", "counter", [](const Node &n) { return (double) n.routed_total; }},
+    };
+    for (const auto &sample : samples) {
+        metrics += string("# TYPE ") + sample.name + " " + sample.type + "\n";
+        for (auto &node : router.nodes) {
+            char line[200];
+            snprintf(line, sizeof(line), "%s{node=\"%s:%s\"} %.17g\n", sample.name, node->host.c_str(),
+                     node->port.c_str(), sample.value(*node));
+            metrics += line;
+        }
+    }
+    metrics += "# TYPE mpc_router_refused_total counter\n";
+    metrics += "mpc_router_refused_total " + to_string(router.refused) + "\n";
+    metrics += "# TYPE mpc_router_migrated_total counter\n";
+    metrics += "mpc_router_migrated_total " + to_string(router.migrated) + "\n";
+    metrics += "# TYPE mpc_router_migrations_failed_total counter\n";
+    metrics += "mpc_router_migrations_failed_total " + to_string(router.migrations_failed) + "\n";
+    return metrics;
+}
+
+// Forget the route once none of its connections is open or opening.
+static void release(Router &router, Route *route) {
+    if (!route->vehicle_open && !route->upstream_open && !route->upstream_pending && !route->target_pending) {
+        auto it = router.routes.find(route->id);
+        if (it != router.routes.end() && it->second == route) {
+            router.routes.erase(it);
+        }
+        route->node->open--;
+        delete route;
+    }
+}
+
+// Start moving the vehicle `id` to the node `to`, "host:port", or to the
+// best one but its own if empty, see /migrate, by asking its node for the
+// context of its controller. Returns what became of the request.
+static string migrate(Router &router, const string &id, const string &to) {
+    auto it = router.routes.find(id);
+    if (id.empty() || it == router.routes.end()) {
+        return "unknown vehicle\n";
+    }
+    Route *route = it->second;
+    if (!route->vehicle_open || !route->upstream_open) {
+        return "vehicle not connected\n";
+    }
+    if (route->target_pending) {
+        return "vehicle already migrating\n";
+    }
+    Node *target = nullptr;
+    for (auto &node : router.nodes) {
+        if (node->host + ":" + node->port == to) {
+            target = node.get();
+        }
+    }
+    if (to.empty()) {
+        target = choose(router, "", route->node);
+    }
+    if (!target || target == route->node || !target->up) {
+        return "no node to migrate to\n";
+    }
+    // Asked again if an earlier request went unanswered.
+    route->target = target;
+    route->upstream.send(context_magic, sizeof(context_magic), uWS::OpCode::BINARY);
+    return "migrating " + id + " to " + target->host + ":" + target->port + "\n";
+}
+
+// The context of the vehicle's controller came from its node: open the
+// connection to the target, to send it there first, see onConnection.
+static void connectTarget(Router &router, Route *route, const char *data, size_t length) {
+    route->context.assign(data, length);
+    route->target_pending = true;
+    route->target->routed++;
+    Node &node = *route->target;
+    router.hub->connect("ws://" + node.host + ":" + node.port + (route->url.empty() ? "/" : route->url), route);
+}
+
+// The connection to the target is open: hand it the context, then the
+// vehicle's frames, and close the one to the old node.
+static void switchTarget(Router &router, Route *route, uWS::WebSocket<uWS::CLIENT> ws) {
+    ws.send(route->context.data(), route->context.size(), uWS::OpCode::BINARY);
+    route->context.clear();
+    route->upstream.setUserData(nullptr);
+    route->upstream.close();
+    route->upstream = ws;
+    MPC_LOG(LOG_INFO, "Vehicle %s moved from %s:%s to %s:%s", route->id.c_str(), route->node->host.c_str(),
+            route->node->port.c_str(), route->target->host.c_str(), route->target->port.c_str());
+    route->node->open--;
+    route->node = route->target;
+    route->target = nullptr;
+    route->node->open++;
+    route->node->routed_total++;
+    router.vehicles[route->id] = route->node;
+    router.migrated++;
+}
+
+int main(int argc, char *argv[]) {
+    Router router;
+    int port = 4567;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] != '-') {
+            unique_ptr<Node> node(new Node);
+            size_t colon = arg.rfind(':');
+            size_t slash = arg.find('/', colon == string::npos ? 0 : colon);
+            if (colon == string::npos || colon == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            node->host = arg.substr(0, colon);
+            node->port = arg.substr(colon + 1, slash == string::npos ? string::npos : slash - colon - 1);
+            if (slash != string::npos) {
+                node->cores = atof(arg.c_str() + slash + 1);
+                if (!(node->cores > 0)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+            addrinfo hints = {}, *found = nullptr;
+            hints.ai_socktype = SOCK_STREAM;
+            if (getaddrinfo(node->host.c_str(), node->port.c_str(), &hints, &found) != 0 || !found) {
+                fprintf(stderr, "cannot resolve %s\n", arg.c_str());
+                return 1;
+            }
+            memcpy(&node->address, found->ai_addr, found->ai_addrlen);
+            freeaddrinfo(found);
+            router.nodes.push_back(std::move(node));
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "-p") {
+            port = atoi(value);
+        } else if (arg == "-i") {
+            router.poll_ms = max(10, atoi(value));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (router.nodes.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uWS::Hub hub;
+    router.hub = &hub;
+    hub.onHttpRequest([&router](uWS::HttpResponse *res, uWS::HttpRequest req, char *, size_t, size_t) {
+        std::string url = req.getUrl().toString();
+        if (url == "/metrics") {
+            std::string metrics = renderMetrics(router);
+            res->end(metrics.data(), metrics.length());
+        } else if (url == "/healthz") {
+            const std::string ok = "ok\n";
+            res->end(ok.data(), ok.length());
+        } else if (url.compare(0, 9, "/migrate?") == 0) {
+            std::string result = migrate(router, queryValue(url, "vehicle"), queryValue(url, "to"));
+            res->end(result.data(), result.length());
+        } else {
+            res->end(nullptr, 0);
+        }
+    });
+
+    hub.onConnection([&router, &hub](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+        std::string url = req.getUrl().toString();
+        std::string id = queryValue(url, "vehicle");
+        Node *node = choose(router, id);
+        if (!node) {
+            router.refused++;
+            ws.close(1013);
+            return;
+        }
+        Route *route = new Route;
+        route->node = node;
+        route->id = id;
+        route->url = url;
+        route->vehicle = ws;
+        if (!id.empty()) {
+            router.routes[id] = route;
+        }
+        node->routed++;
+        node->routed_total++;
+        node->open++;
+        ws.setUserData(route);
+        hub.connect("ws://" + node->host + ":" + node->port + (url.empty() ? "/" : url), route);
+    });
+    hub.onMessage([](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length, uWS::OpCode opCode) {
+        Route *route = (Route *) ws.getUserData();
+        if (!route) {
+            return;
+        }
+        if (route->upstream_open) {
+            route->upstream.send(data, length, opCode);
+            return;
+        }
+        if (route->waiting.size() >= max_waiting) {
+            route->waiting.pop_front();
+        }
+        route->waiting.emplace_back(string(data, length), opCode);
+    });
+    hub.onDisconnection([&router](uWS::WebSocket<uWS::SERVER> ws, int code, char *message, size_t length) {
+        Route *route = (Route *) ws.getUserData();
+        if (!route) {
+            return;
+        }
+        ws.setUserData(nullptr);
+        route->vehicle_open = false;
+        if (route->upstream_open) {
+            route->upstream.close();
+        } else {
+            release(router, route);
+        }
+    });
+
+    // The connections to the nodes. That of a migration, which opens while
+    // the upstream is open, takes over from it, see switchTarget; the one
+    // it replaces is left without a route.
+    hub.onConnection([&router](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req) {
+        Route *route = (Route *) ws.getUserData();
+        if (route->target_pending && !route->upstream_pending) {
+            route->target_pending = false;
+            if (!route->vehicle_open || !route->upstream_open) {
+                // Gone meanwhile, its old node with it.
+                route->target = nullptr;
+                ws.setUserData(nullptr);
+                ws.close();
+                release(router, route);
+                return;
+            }
+            switchTarget(router, route, ws);
+            return;
+        }
+        route->upstream = ws;
+        route->upstream_pending = false;
+        route->upstream_open = true;
+        if (!route->vehicle_open) {
+            ws.close();
+            return;
+        }
+        for (auto &frame : route->waiting) {
+            ws.send(frame.first.data(), frame.first.size(), frame.second);
+        }
+        route->waiting.clear();
+    });
+    hub.onMessage([&router](uWS::WebSocket<uWS::CLIENT> ws, char *data, size_t length, uWS::OpCode opCode) {
+        Route *route = (Route *) ws.getUserData();
+        if (!route) {
+            return;
+        }
+        // The context of a migration is the router's, never the vehicle's.
+        if (opCode == uWS::OpCode::BINARY && isContextMessage(data, length)) {
+            if (route->target && !route->target_pending && route->vehicle_open) {
+                connectTarget(router, route, data, length);
+            }
+            return;
+        }
+        if (route->vehicle_open) {
+            route->vehicle.send(data, length, opCode);
+        }
+    });
+    hub.onDisconnection([&router](uWS::WebSocket<uWS::CLIENT> ws, int code, char *message, size_t length) {
+        Route *route = (Route *) ws.getUserData();
+        if (!route) {
+            return;
+        }
+        route->upstream_open = false;
+        if (route->vehicle_open) {
+            // Passed on, so a refusal by MPC_ADMISSION reads as one.
+            route->vehicle.close(code == 1013 ? 1013 : 1001);
+        } else {
+            release(router, route);
+        }
+    });
+    hub.onError([&router](void *user) {
+        Route *route = (Route *) user;
+        if (route->target_pending && !route->upstream_pending) {
+            // The vehicle stays on its node.
+            MPC_LOG(LOG_WARN, "Vehicle %s cannot move to %s:%s", route->id.c_str(), route->target->host.c_str(),
+                    route->target->port.c_str());
+            markDown(*route->target, "connection refused");
+            route->target_pending = false;
+            route->target = nullptr;
+            route->context.clear();
+            router.migrations_failed++;
+            release(router, route);
+            return;
+        }
+        route->upstream_pending = false;
+        markDown(*route->node, "connection refused");
+        if (route->vehicle_open) {
+            route->vehicle.close(1013);
+        } else {
+            release(router, route);
+        }
+    });
+
+    uv_timer_init(hub.getLoop(), &router.poll);
+    router.poll.data = &router;
+    uv_timer_start(&router.poll, onPoll, 0, router.poll_ms);
+
+    if (!hub.listen(port)) {
+        MPC_LOG(LOG_ERROR, "Failed to listen on port %d", port);
+        Logger::flush();
+        return 1;
+    }
+    MPC_LOG(LOG_INFO, "Routing port %d to %zu node(s)", port, router.nodes.size());
+    hub.run();
+    Logger::flush();
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ControlTable.h"
+#include "Logger.h"
+#include "Simulator.h"
+
+// Headless closed-loop runs of the controller on a waypoint track.
+//
+//     mpc_sim [-n runs] [-j threads] [-L laps] [-l latency_ms] [-m] [-S] [-T table] [-F n] [-A] [-B]
+//             [-V lateral[:accel:braking]|map] track.csv
+//
+// The runs start on segments spread evenly around the track and are
+// distributed over the threads, one controller each. With -m the
+// controller takes the waypoints from the track instead of the telemetry,
+// with -S its reference polynomial from a spline of the track. -T looks the
+// actuations up in a table written by mpc_tabulate where it is validated.
+// -F solves every n-th frame only, the others answered like those of a
+// saturated server, by the predictor with MPC_PREDICTOR=1 or the LQR.
+// -A solves ahead for the next frame after every solved one and counts
+// the frames answered that way. -V drives a speed profile within those
+// accelerations in m/s^2, or the one of the map file, see
+// Controller::setSpeedProfile. -B drives the runs as one fleet in
+// lockstep, solving the frames of every tick together by batched RTI, see
+// runFleet, instead of each run on its own.
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n runs] [-j threads] [-L laps] [-l latency_ms] [-m] [-S] [-T table] [-F n] [-A] [-B] "
+                    "[-V lateral[:accel:braking]|map] track.csv\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    size_t runs = 1;
+    size_t n_threads = max(1u, thread::hardware_concurrency());
+    SimOptions base;
+    const char *path = nullptr;
+    const char *table_path = nullptr;
+    const char *profile = nullptr;
+    bool fleet = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] != '-') {
+            path = argv[i];
+            continue;
+        }
+        if (arg == "-m") {
+            base.use_map = true;
+            continue;
+        }
+        if (arg == "-S") {
+            base.use_spline = true;
+            continue;
+        }
+        if (arg == "-A") {
+            base.speculate = true;
+            continue;
+        }
+        if (arg == "-B") {
+            fleet = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "-n") {
+            runs = max(1l, atol(value));
+        } else if (arg == "-j") {
+            n_threads = max(1l, atol(value));
+        } else if (arg == "-L") {
+            base.laps = max(1, atoi(value));
+        } else if (arg == "-l") {
+            base.latency = atof(value) / 1000;
+        } else if (arg == "-T") {
+            table_path = value;
+        } else if (arg == "-F") {
+            base.solve_every = max(1l, atol(value));
+        } else if (arg == "-V") {
+            profile = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Track track;
+    if (!track.load(path)) {
+        fprintf(stderr, "cannot read a track from %s\n", path);
+        return 1;
+    }
+    if (profile && !prepareSpeedProfile(track, profile)) {
+        fprintf(stderr, "no speed profile %s for %s\n", profile, path);
+        return 1;
+    }
+    base.speed_profile = profile != nullptr;
+
+    ControlTable table;
+    if (table_path) {
+        if (!table.open(table_path)) {
+            fprintf(stderr, "cannot map a table from %s\n", table_path);
+            return 1;
+        }
+        base.table = &table;
+    }
+
+    vector<SimOptions> options(runs, base);
+    for (size_t i = 0; i < runs; i++) {
+        options[i].start_segment = i * track.size() / runs;
+    }
+    vector<EpisodeResult> results =
+        fleet ? runFleet(track, options, n_threads) : runBatch(track, options, n_threads);
+
+    size_t completed = 0;
+    for (size_t i = 0; i < runs; i++) {
+        const EpisodeResult &r = results[i];
+        vector<double> times = r.step_times;
+        sort(times.begin(), times.end());
+        double p50 = times.empty() ? 0 : times[times.size() / 2];
+        double p99 = times.empty() ? 0 : times[min(times.size() - 1, times.size() * 99 / 100)];
+        const char *outcome = r.completed ? "completed" : (r.time >= options[i].max_time ? "timed out" : "off track");
+        printf("run %3zu from segment %3zu: %-9s %7.1f s  max offset %5.2f m  mean speed %5.1f m/s  "
+               "step p50 %6.3f p99 %6.3f ms  failed solves %zu/%zu",
+               i, options[i].start_segment, outcome, r.time,
+               r.max_offset, r.mean_speed, p50 * 1e3, p99 * 1e3, r.failed_solves, r.frames);
+        if (base.speculate) {
+            printf("  speculative %zu", r.speculative);
+        }
+        if (r.degraded > 0) {
+            printf("  degraded %zu", r.degraded);
+        }
+        printf("\n");
+        completed += r.completed;
+    }
+    printf("%zu/%zu runs completed %d lap(s)\n", completed, runs, base.laps);
+    Logger::flush();
+    return completed == runs ? 0 : 2;
+}
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Logger.h"
+#include "WeightSweep.h"
+
+// Search over the cost weights on the headless simulator.
+//
+//     mpc_sweep [-j threads] [-P processes] [-n runs] [-L laps] [-r samples] [-s seed] track.csv name=spec ...
+//
+// Every weight not named keeps its default. A spec is a list "v1,v2,..."
+// or a range "lo:hi". Without -r every combination of the lists (and the
+// ends of the ranges) is tried, with -r that many weight sets are drawn at
+// random, ranges log-uniformly. Each set is driven from `runs` start
+// segments spread around the track. With -P the episodes run in that many
+// processes forked from one controller set up beforehand, see runForked,
+// rather than on threads with a controller each. The results are printed
+// as CSV, best first.
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-j threads] [-P processes] [-n runs] [-L laps] [-r samples] [-s seed] track.csv "
+                    "name=v1,v2,...|name=lo:hi ...\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    size_t n_threads = max(1u, thread::hardware_concurrency());
+    size_t n_processes = 0;
+    size_t runs = 1;
+    size_t samples = 0;
+    unsigned seed = 1;
+    SimOptions base;
+    const char *path = nullptr;
+    vector<WeightAxis> axes;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] == '-') {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+                return 1;
+            }
+            const char *value = argv[++i];
+            if (arg == "-j") {
+                n_threads = max(1l, atol(value));
+            } else if (arg == "-P") {
+                n_processes = max(1l, atol(value));
+            } else if (arg == "-n") {
+                runs = max(1l, atol(value));
+            } else if (arg == "-L") {
+                base.laps = max(1, atoi(value));
+            } else if (arg == "-r") {
+                samples = max(1l, atol(value));
+            } else if (arg == "-s") {
+                seed = atol(value);
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg.find('=') != string::npos) {
+            WeightAxis axis;
+            if (!parseAxis(argv[i], axis)) {
+                fprintf(stderr, "bad weight spec %s\n", argv[i]);
+                return 1;
+            }
+            axes.push_back(axis);
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Track track;
+    if (!track.load(path)) {
+        fprintf(stderr, "cannot read a track from %s\n", path);
+        return 1;
+    }
+
+    vector<CostWeights> candidates = samples > 0 ? randomSearch(CostWeights(), axes, samples, seed)
+                                                 : gridSearch(CostWeights(), axes);
+    vector<size_t> starts;
+    for (size_t i = 0; i < runs; i++) {
+        starts.push_back(i * track.size() / runs);
+    }
+    fprintf(stderr, "%zu weight sets, %zu episodes\n", candidates.size(), candidates.size() * runs);
+
+    vector<SweepResult> results = runSweep(track, base, starts, candidates, n_threads, n_processes);
+    stable_sort(results.begin(), results.end(), betterResult);
+
+    printf("cte,epsi,v,delta,a,ddelta,da,completed,runs,lap_time,max_offset,step_p50_ms,step_p99_ms,step_max_ms\n");
+    for (const SweepResult &r : results) {
+        const CostWeights &w = r.weights;
+        printf("%g,%g,%g,%g,%g,%g,%g,%zu,%zu,%.2f,%.3f,%.3f,%.3f,%.3f\n",
+               w.cte, w.epsi, w.v, w.delta, w.a, w.ddelta, w.da, r.completed, r.runs,
+               r.lap_time, r.max_offset, r.step_p50 * 1e3, r.step_p99 * 1e3, r.step_max * 1e3);
+    }
+    Logger::flush();
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include "ControlTable.h"
+#include "Logger.h"
+
+// Offline tabulation of the MPC for the low-speed regime, see ControlTable.
+//
+//     mpc_tabulate [-j threads] [-t delta_tol:a_tol] table.bin [axis=lo:hi:n ...]
+//
+// The axes are cte, epsi, v and curvature; those not given keep the grid
+// below. The MPC is set up from the environment like the server's, so
+// MPC_SOLVER and the rest pick the solver tabulated, and each point is
+// solved from a cold start. The table is only used at runtime in the cells
+// whose center came within the tolerances of a solve.
+
+static const char *axis_names[N_TABLE_AXES] = {"cte", "epsi", "v", "curvature"};
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-j threads] [-t delta_tol:a_tol] table.bin [cte|epsi|v|curvature=lo:hi:n ...]\n",
+            name);
+}
+
+// Parse "name=lo:hi:n" into its axis of `grid`.
+static bool parseAxis(const char *spec, TableGrid &grid) {
+    const char *eq = strchr(spec, '=');
+    if (!eq) {
+        return false;
+    }
+    string name(spec, eq - spec);
+    for (int i = 0; i < N_TABLE_AXES; i++) {
+        double lo, hi;
+        unsigned n;
+        if (name == axis_names[i]) {
+            if (sscanf(eq + 1, "%lf:%lf:%u", &lo, &hi, &n) != 3 || n < 2 || !(hi > lo)) {
+                return false;
+            }
+            grid.lo[i] = lo;
+            grid.hi[i] = hi;
+            grid.n[i] = n;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    size_t n_threads = max(1u, thread::hardware_concurrency());
+    double delta_tol = 0.01;
+    double a_tol = 0.05;
+    // Gentle curves up to 5 m/s, within a meter and 0.2 rad of the
+    // reference.
+    TableGrid grid = {{-1.0, -0.2, 0.0, -0.02}, {1.0, 0.2, 5.0, 0.02}, {9, 9, 6, 5}};
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] == '-') {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+                return 1;
+            }
+            const char *value = argv[++i];
+            if (arg == "-j") {
+                n_threads = max(1l, atol(value));
+            } else if (arg == "-t") {
+                if (sscanf(value, "%lf:%lf", &delta_tol, &a_tol) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg.find('=') != string::npos) {
+            if (!parseAxis(argv[i], grid)) {
+                fprintf(stderr, "bad axis spec %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < N_TABLE_AXES; i++) {
+        fprintf(stderr, "%-9s %g .. %g, %u nodes\n", axis_names[i], grid.lo[i], grid.hi[i], grid.n[i]);
+    }
+    TableReport report;
+    if (!buildTable(grid, n_threads, delta_tol, a_tol, path, report)) {
+        fprintf(stderr, "cannot write a table to %s\n", path);
+        return 1;
+    }
+    printf("%zu nodes, %zu failed; %zu of %zu cells validated, max error delta %.4f a %.4f\n",
+           report.nodes, report.failed_nodes, report.validated_cells, report.cells,
+           report.max_delta_error, report.max_a_error);
+    Logger::flush();
+    return 0;
+}
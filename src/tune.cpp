@@ -0,0 +1,279 @@
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BenchReport.h"
+#include "Controller.h"
+#include "LogReplay.h"
+#include "Logger.h"
+#include "MPC.h"
+#include "TaskScheduler.h"
+#include "TelemetryParser.h"
+
+// Search over the IPOPT options on a fixed corpus of problems.
+//
+//     mpc_tune [-N horizon] [-R solver] [-j threads] [-r repeat] [-d steering:throttle]
+//              [-l linear_solver,...] [-o profile] corpus
+//
+// The corpus is a trace log or a capture, see loadReplayLog, prepared as
+// mpc_golden does. The backend, MPC_SOLVER=cppad unless -R names another
+// IPOPT one, solves it in order, warm started, with the default options for
+// the reference, then with every combination of tol (1e-8, 1e-6, 1e-4 or
+// 1e-3, acceptable_tol 100 times that), mu_strategy (monotone or
+// adaptive), the exact or the limited-memory Hessian, bound_push (1e-2,
+// 1e-4 or 1e-6) and the linear solvers listed, by default IPOPT's. The
+// candidates are spread over `threads`, by default one per core, each
+// solving the corpus `repeat` times, 1 by default; more threads than cores
+// skew the times. A candidate is admissible when no solve fails that did
+// not in the reference and its first steering and throttle are within
+// `steering` rad and `throttle`, 0.01 and 0.05 by default, of those of the
+// reference on every problem. The candidates are printed fastest p99 of
+// the solve times first, the admissible ones before the others.
+//
+// -o writes the fastest admissible one to `profile`, in the format of
+// MPC_CONFIG, see readVariant. The exit status is 2 if none is admissible.
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-N horizon] [-R solver] [-j threads] [-r repeat] [-d steering:throttle]\n"
+                    "       %*s [-l linear_solver,...] [-o profile] corpus\n",
+            name, (int) strlen(name), "");
+}
+
+// What the candidates are compared by: the first actuations of every solve.
+struct Output {
+    double delta = 0;
+    double a = 0;
+    bool ok = false;
+};
+
+struct Candidate {
+    MpcOptions options;
+    // Solve times in ms, sorted.
+    vector<double> times;
+    double max_steering = 0;
+    double max_throttle = 0;
+    size_t failures = 0;
+    bool admissible = false;
+};
+
+// Solve `problems` in order `repeat` times, each on a fresh MPC of `backend`
+// with horizon N and `options`, into the outputs of the last pass and the
+// times of all.
+static bool solveAll(SolverBackend backend, size_t N, const MpcOptions &options, int repeat,
+                     const vector<ControlFrame> &problems, vector<Output> &outputs, vector<double> &times) {
+    outputs.assign(problems.size(), Output());
+    times.clear();
+    for (int r = 0; r < repeat; r++) {
+        MPC mpc;
+        mpc.setWarmStart(true);
+        mpc.setBackend(backend);
+        if (!mpc.setHorizon(N)) {
+            return false;
+        }
+        mpc.setOptions(options);
+        SolveStats stats;
+        Solution solution;
+        for (size_t i = 0; i < problems.size(); i++) {
+            mpc.Solve(problems[i].state, problems[i].coeffs, stats, Deadline::max(), solution);
+            times.push_back(stats.wall_time * 1e3);
+            outputs[i].delta = solution.delta;
+            outputs[i].a = solution.a;
+            outputs[i].ok = stats.ok();
+        }
+    }
+    sort(times.begin(), times.end());
+    return true;
+}
+
+static vector<MpcOptions> candidateOptions(const vector<string> &linear_solvers) {
+    vector<MpcOptions> candidates;
+    for (const string &linear_solver : linear_solvers) {
+        for (double tol : {1e-8, 1e-6, 1e-4, 1e-3}) {
+            for (const char *mu_strategy : {"monotone", "adaptive"}) {
+                for (bool exact_hessian : {true, false}) {
+                    for (double bound_push : {1e-2, 1e-4, 1e-6}) {
+                        MpcOptions options;
+                        options.linear_solver = linear_solver;
+                        options.mu_strategy = mu_strategy;
+                        options.tol = tol;
+                        options.acceptable_tol = 100 * tol;
+                        options.exact_hessian = exact_hessian;
+                        options.bound_push = bound_push;
+                        candidates.push_back(options);
+                    }
+                }
+            }
+        }
+    }
+    return candidates;
+}
+
+// Admissible ones first, then by the p99 of their solve times.
+static bool fasterCandidate(const Candidate &a, const Candidate &b) {
+    if (a.admissible != b.admissible) {
+        return a.admissible;
+    }
+    return benchPercentile(a.times, 0.99) < benchPercentile(b.times, 0.99);
+}
+
+static void printCandidate(const Candidate &c) {
+    const MpcOptions &o = c.options;
+    printf("%-8s tol %.0e mu %-8s hessian %-14s bound_push %.0e  p50 %7.3f p99 %7.3f ms  "
+           "steering %.2e throttle %.2e failed %zu  %s\n",
+           o.linear_solver.empty() ? "default" : o.linear_solver.c_str(), o.tol, o.mu_strategy.c_str(),
+           o.exact_hessian ? "exact" : "limited-memory", o.bound_push, benchPercentile(c.times, 0.5),
+           benchPercentile(c.times, 0.99), c.max_steering, c.max_throttle, c.failures, c.admissible ? "ok" : "out");
+}
+
+static bool writeProfile(const char *path, const Candidate &c, SolverBackend backend, size_t N,
+                         const char *corpus, size_t n_problems, double reference_p99) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        return false;
+    }
+    const MpcOptions &o = c.options;
+    fprintf(out, "# mpc_tune over %s: %zu problems, p99 %.3f ms against %.3f ms with the defaults\n", corpus,
+            n_problems, benchPercentile(c.times, 0.99), reference_p99);
+    fprintf(out, "solver = %s\n", backendName(backend));
+    fprintf(out, "horizon = %zu\n", N);
+    if (!o.linear_solver.empty()) {
+        fprintf(out, "linear_solver = %s\n", o.linear_solver.c_str());
+    }
+    fprintf(out, "mu_strategy = %s\n", o.mu_strategy.c_str());
+    fprintf(out, "hessian = %s\n", o.exact_hessian ? "exact" : "limited-memory");
+    fprintf(out, "tol = %g\n", o.tol);
+    fprintf(out, "acceptable_tol = %g\n", o.acceptable_tol);
+    fprintf(out, "bound_push = %g\n", o.bound_push);
+    return fclose(out) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t N = DefaultConfig::N;
+    SolverBackend backend = CPPAD_IPOPT;
+    size_t n_threads = max(1u, thread::hardware_concurrency());
+    int repeat = 1;
+    double max_steering = 0.01, max_throttle = 0.05;
+    vector<string> linear_solvers = {""};
+    const char *profile_path = nullptr;
+    const char *corpus = nullptr;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg[0] != '-' && !corpus) {
+            corpus = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "-N") {
+            N = strtoul(value, nullptr, 10);
+        } else if (arg == "-R") {
+            if (!parseBackend(value, backend) ||
+                (backend != CPPAD_IPOPT && backend != TAPED_IPOPT && backend != KINEMATIC_IPOPT)) {
+                fprintf(stderr, "%s is no IPOPT backend\n", value);
+                return 1;
+            }
+        } else if (arg == "-j") {
+            n_threads = max(1l, atol(value));
+        } else if (arg == "-r") {
+            repeat = max(1, atoi(value));
+        } else if (arg == "-d") {
+            sscanf(value, "%lf:%lf", &max_steering, &max_throttle);
+        } else if (arg == "-l") {
+            linear_solvers.clear();
+            for (const char *s = value; *s;) {
+                const char *comma = strchr(s, ',');
+                size_t n = comma ? comma - s : strlen(s);
+                string name(s, n);
+                linear_solvers.push_back(name == "default" ? "" : name);
+                s += n + (comma != nullptr);
+            }
+        } else if (arg == "-o") {
+            profile_path = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!corpus || linear_solvers.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ReplayLog log;
+    if (!loadReplayLog(corpus, log)) {
+        fprintf(stderr, "cannot read %s\n", corpus);
+        return 1;
+    }
+    Controller controller;
+    Telemetry telemetry;
+    vector<ControlFrame> problems;
+    for (const string &msg : log.messages) {
+        if (parseMessage(msg.data(), msg.size(), telemetry) == MSG_TELEMETRY && telemetry.ptsx.size() >= 4) {
+            problems.emplace_back();
+            controller.prepare(telemetry, problems.back());
+        }
+    }
+    if (problems.empty()) {
+        fprintf(stderr, "no problems in %s\n", corpus);
+        return 1;
+    }
+
+    vector<Output> reference;
+    vector<double> reference_times;
+    if (!solveAll(backend, N, MpcOptions(), repeat, problems, reference, reference_times)) {
+        fprintf(stderr, "N = %zu is not compiled in\n", N);
+        return 1;
+    }
+    double reference_p99 = benchPercentile(reference_times, 0.99);
+    printf("%zu problems on N = %zu, %s with the defaults p50 %.3f p99 %.3f ms\n", problems.size(), N,
+           backendName(backend), benchPercentile(reference_times, 0.5), reference_p99);
+
+    vector<MpcOptions> options = candidateOptions(linear_solvers);
+    vector<Candidate> candidates(options.size());
+    atomic<size_t> next(0);
+    auto work = [&] {
+        vector<Output> outputs;
+        for (size_t i = next++; i < candidates.size(); i = next++) {
+            Candidate &c = candidates[i];
+            c.options = options[i];
+            solveAll(backend, N, c.options, repeat, problems, outputs, c.times);
+            for (size_t k = 0; k < problems.size(); k++) {
+                c.failures += reference[k].ok && !outputs[k].ok;
+                c.max_steering = max(c.max_steering, fabs(outputs[k].delta - reference[k].delta));
+                c.max_throttle = max(c.max_throttle, fabs(outputs[k].a - reference[k].a));
+            }
+            c.admissible = c.failures == 0 && c.max_steering <= max_steering && c.max_throttle <= max_throttle;
+        }
+    };
+    auto helper = [&](size_t) { work(); };
+    TaskGroup helpers(TASK_LOW);
+    helpers.run(1, min(n_threads, candidates.size()), helper);
+    work();
+    helpers.wait();
+
+    sort(candidates.begin(), candidates.end(), fasterCandidate);
+    for (const Candidate &c : candidates) {
+        printCandidate(c);
+    }
+    const Candidate &best = candidates.front();
+    if (!best.admissible) {
+        fprintf(stderr, "no candidate within %g rad and %g of the reference\n", max_steering, max_throttle);
+        Logger::flush();
+        return 2;
+    }
+    if (profile_path &&
+        !writeProfile(profile_path, best, backend, N, corpus, problems.size(), reference_p99)) {
+        fprintf(stderr, "cannot write %s\n", profile_path);
+        return 1;
+    }
+    Logger::flush();
+    return 0;
+}